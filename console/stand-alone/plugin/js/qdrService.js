@@ -928,6 +928,24 @@ console.dump(e)
         self.errorText = "Disconnected."
       },
 
+      // Receive the connected router's statistics feed (router.consoleFeedInterval), one
+      // message shared by all subscribed consoles, instead of polling for the same figures.
+      // callback(router, stats) is called for each message; close the returned receiver to stop.
+      subscribeStats: function(callback) {
+        if (!self.connection)
+          return null;
+        var receiver = self.connection.open_receiver({
+          source: {
+            address: "_local/qdconsole"
+          }
+        });
+        receiver.on("message", function(context) {
+          var props = context.message.application_properties || {};
+          callback(props.router, context.message.body);
+        });
+        return receiver;
+      },
+
       connectionTimer: null,
 
       testConnect: function (options, timeout, callback) {
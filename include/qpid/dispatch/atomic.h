@@ -20,10 +20,14 @@
  */
 
 /**@file
- * Portable atomic operations on uint32_t.
+ * Portable atomic operations on uint32_t, on uint64_t counters and on pointers.
+ *
+ * The pointer operations (sys_atomic_ptr_*) are full memory barriers in all
+ * implementations.
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /******************************************************************************
  * C11 atomics                                                                *
@@ -53,8 +57,56 @@ static inline uint32_t sys_atomic_get(sys_atomic_t *ref)
     return atomic_load(ref);
 }
 
+static inline uint32_t sys_atomic_swap(sys_atomic_t *ref, uint32_t value)
+{
+    return atomic_exchange(ref, value);
+}
+
 static inline void sys_atomic_destroy(sys_atomic_t *ref) {}
 
+typedef _Atomic uint64_t sys_atomic64_t;
+
+static inline void sys_atomic64_init(sys_atomic64_t *ref, uint64_t value)
+{
+    atomic_store(ref, value);
+}
+
+static inline uint64_t sys_atomic64_add(sys_atomic64_t *ref, uint64_t value)
+{
+    return atomic_fetch_add(ref, value);
+}
+
+static inline uint64_t sys_atomic64_get(sys_atomic64_t *ref)
+{
+    return atomic_load(ref);
+}
+
+static inline void sys_atomic64_destroy(sys_atomic64_t *ref) {}
+
+typedef void *_Atomic sys_atomic_ptr_t;
+
+static inline void sys_atomic_ptr_init(sys_atomic_ptr_t *ref, void *value)
+{
+    atomic_store(ref, value);
+}
+
+static inline void *sys_atomic_ptr_get(sys_atomic_ptr_t *ref)
+{
+    return atomic_load(ref);
+}
+
+static inline void *sys_atomic_ptr_swap(sys_atomic_ptr_t *ref, void *value)
+{
+    return atomic_exchange(ref, value);
+}
+
+static inline bool sys_atomic_ptr_cas(sys_atomic_ptr_t *ref, void *expected, void *desired)
+{
+    return atomic_compare_exchange_strong(ref, &expected, desired);
+}
+
+static inline void sys_atomic_ptr_destroy(sys_atomic_ptr_t *ref) {}
+
 
 #elif defined(__GNUC__) || defined(__clang__)
 
@@ -84,8 +136,66 @@ static inline uint32_t sys_atomic_get(sys_atomic_t *ref)
     return *ref;
 }
 
+static inline uint32_t sys_atomic_swap(sys_atomic_t *ref, uint32_t value)
+{
+    uint32_t old;
+    do {
+        old = *ref;
+    } while (!__sync_bool_compare_and_swap(ref, old, value));
+    return old;
+}
+
 static inline void sys_atomic_destroy(sys_atomic_t *ref) {}
 
+typedef volatile uint64_t sys_atomic64_t;
+
+static inline void sys_atomic64_init(sys_atomic64_t *ref, uint64_t value)
+{
+    *ref = value;
+}
+
+static inline uint64_t sys_atomic64_add(sys_atomic64_t *ref, uint64_t value)
+{
+    return __sync_fetch_and_add(ref, value);
+}
+
+static inline uint64_t sys_atomic64_get(sys_atomic64_t *ref)
+{
+    return __sync_fetch_and_add(ref, 0);    // A plain load may tear on 32 bit targets
+}
+
+static inline void sys_atomic64_destroy(sys_atomic64_t *ref) {}
+
+typedef void *volatile sys_atomic_ptr_t;
+
+static inline void sys_atomic_ptr_init(sys_atomic_ptr_t *ref, void *value)
+{
+    *ref = value;
+    __sync_synchronize();
+}
+
+static inline void *sys_atomic_ptr_get(sys_atomic_ptr_t *ref)
+{
+    __sync_synchronize();
+    return *ref;
+}
+
+static inline bool sys_atomic_ptr_cas(sys_atomic_ptr_t *ref, void *expected, void *desired)
+{
+    return __sync_bool_compare_and_swap(ref, expected, desired);
+}
+
+static inline void *sys_atomic_ptr_swap(sys_atomic_ptr_t *ref, void *value)
+{
+    void *old;
+    do {
+        old = *ref;
+    } while (!__sync_bool_compare_and_swap(ref, old, value));
+    return old;
+}
+
+static inline void sys_atomic_ptr_destroy(sys_atomic_ptr_t *ref) {}
+
 
 #elif defined(__sun)
 
@@ -120,8 +230,58 @@ static inline uint32_t sys_atomic_get(sys_atomic_t *ref)
     return *ref;
 }
 
+static inline uint32_t sys_atomic_swap(sys_atomic_t *ref, uint32_t value)
+{
+    return atomic_swap_32(ref, value);
+}
+
 static inline void sys_atomic_destroy(sys_atomic_t *ref) {}
 
+typedef volatile uint64_t sys_atomic64_t;
+
+static inline void sys_atomic64_init(sys_atomic64_t *ref, uint64_t value)
+{
+    *ref = value;
+}
+
+static inline uint64_t sys_atomic64_add(sys_atomic64_t *ref, uint64_t value)
+{
+    return atomic_add_64_nv(ref, value) - value;
+}
+
+static inline uint64_t sys_atomic64_get(sys_atomic64_t *ref)
+{
+    return atomic_add_64_nv(ref, 0);
+}
+
+static inline void sys_atomic64_destroy(sys_atomic64_t *ref) {}
+
+typedef void *volatile sys_atomic_ptr_t;
+
+static inline void sys_atomic_ptr_init(sys_atomic_ptr_t *ref, void *value)
+{
+    *ref = value;
+    membar_producer();
+}
+
+static inline void *sys_atomic_ptr_get(sys_atomic_ptr_t *ref)
+{
+    membar_consumer();
+    return *ref;
+}
+
+static inline bool sys_atomic_ptr_cas(sys_atomic_ptr_t *ref, void *expected, void *desired)
+{
+    return atomic_cas_ptr(ref, expected, desired) == expected;
+}
+
+static inline void *sys_atomic_ptr_swap(sys_atomic_ptr_t *ref, void *value)
+{
+    return atomic_swap_ptr(ref, value);
+}
+
+static inline void sys_atomic_ptr_destroy(sys_atomic_ptr_t *ref) {}
+
 #else
 
 /******************************************************************************
@@ -167,12 +327,101 @@ static inline uint32_t sys_atomic_get(sys_atomic_t *ref)
     return value;
 }
 
+static inline uint32_t sys_atomic_swap(sys_atomic_t *ref, uint32_t value)
+{
+    sys_mutex_lock(ref->lock);
+    uint32_t prev = ref->value;
+    ref->value = value;
+    sys_mutex_unlock(ref->lock);
+    return prev;
+}
+
 static inline void sys_atomic_destroy(sys_atomic_t *ref)
 {
     sys_mutex_lock(ref->lock);
     sys_mutex_free(ref->lock);
 }
 
+struct sys_atomic64_t {
+    sys_mutex_t *lock;
+    uint64_t value;
+};
+typedef struct sys_atomic64_t sys_atomic64_t;
+
+static inline void sys_atomic64_init(sys_atomic64_t *ref, uint64_t value)
+{
+    ref->lock = sys_mutex();
+    ref->value = value;
+}
+
+static inline uint64_t sys_atomic64_add(sys_atomic64_t *ref, uint64_t value)
+{
+    sys_mutex_lock(ref->lock);
+    uint64_t prev = ref->value;
+    ref->value += value;
+    sys_mutex_unlock(ref->lock);
+    return prev;
+}
+
+static inline uint64_t sys_atomic64_get(sys_atomic64_t *ref)
+{
+    sys_mutex_lock(ref->lock);
+    uint64_t value = ref->value;
+    sys_mutex_unlock(ref->lock);
+    return value;
+}
+
+static inline void sys_atomic64_destroy(sys_atomic64_t *ref)
+{
+    sys_mutex_lock(ref->lock);
+    sys_mutex_free(ref->lock);
+}
+
+struct sys_atomic_ptr_t {
+    sys_mutex_t *lock;
+    void        *value;
+};
+typedef struct sys_atomic_ptr_t sys_atomic_ptr_t;
+
+static inline void sys_atomic_ptr_init(sys_atomic_ptr_t *ref, void *value)
+{
+    ref->lock = sys_mutex();
+    ref->value = value;
+}
+
+static inline void *sys_atomic_ptr_get(sys_atomic_ptr_t *ref)
+{
+    sys_mutex_lock(ref->lock);
+    void *value = ref->value;
+    sys_mutex_unlock(ref->lock);
+    return value;
+}
+
+static inline bool sys_atomic_ptr_cas(sys_atomic_ptr_t *ref, void *expected, void *desired)
+{
+    sys_mutex_lock(ref->lock);
+    bool swapped = ref->value == expected;
+    if (swapped)
+        ref->value = desired;
+    sys_mutex_unlock(ref->lock);
+    return swapped;
+}
+
+static inline void *sys_atomic_ptr_swap(sys_atomic_ptr_t *ref, void *value)
+{
+    sys_mutex_lock(ref->lock);
+    void *prev = ref->value;
+    ref->value = value;
+    sys_mutex_unlock(ref->lock);
+    return prev;
+}
+
+static inline void sys_atomic_ptr_destroy(sys_atomic_ptr_t *ref)
+{
+    sys_mutex_lock(ref->lock);
+    sys_mutex_free(ref->lock);
+}
+
 #endif
 
 /** Atomic increase: NOTE returns value *before* increase, like i++ */
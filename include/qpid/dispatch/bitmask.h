@@ -30,6 +30,12 @@
 /** A bit mask */
 typedef struct qd_bitmask_t qd_bitmask_t;
 
+/**
+ * Set the number of bits in every bitmask, rounded up to a multiple of 64.  This
+ * must be called before the first bitmask is created.  The default is 128.
+ */
+void qd_bitmask_set_width(int bits);
+
 /** Number of bits in a bitmask. */
 int qd_bitmask_width();
 
@@ -46,6 +52,10 @@ int qd_bitmask_value(qd_bitmask_t *b, int bitnum);
 int qd_bitmask_first_set(qd_bitmask_t *b, int *bitnum);
 int qd_bitmask_cardinality(const qd_bitmask_t *b);
 
+/** Word-wise b |= other and b &= other */
+void qd_bitmask_or(qd_bitmask_t *b, const qd_bitmask_t *other);
+void qd_bitmask_and(qd_bitmask_t *b, const qd_bitmask_t *other);
+
 int _qdbm_start(qd_bitmask_t *b);
 void _qdbm_next(qd_bitmask_t *b, int *v);
 
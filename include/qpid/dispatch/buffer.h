@@ -27,15 +27,26 @@
  */
 
 #include <qpid/dispatch/ctools.h>
+#include <qpid/dispatch/atomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 typedef struct qd_buffer_t qd_buffer_t;
 
 DEQ_DECLARE(qd_buffer_t, qd_buffer_list_t);
 
-/** A raw byte buffer .*/
+/**
+ * A raw byte buffer.
+ *
+ * A buffer may be a clone, which has no data area of its own and shows the first size
+ * octets of another buffer's data.  A buffer whose data is shared with clones is
+ * immutable: it reports no free capacity, so appending to its list starts a new buffer.
+ */
 struct qd_buffer_t {
     DEQ_LINKS(qd_buffer_t);
     unsigned int size;          ///< Size of data content
+    unsigned int capacity;      ///< Size of the data area, set by the buffer's size class; 0 for a clone
+    sys_atomic_t refs;          ///< The buffer and its clones, 0 if not pool-allocated (never shared)
 };
 
 /**
@@ -43,12 +54,48 @@ struct qd_buffer_t {
  */
 void qd_buffer_set_size(size_t size);
 
+/**
+ * Set up and tear down the buffer memory accounting.
+ */
+void qd_buffer_initialize(void);
+void qd_buffer_finalize(void);
+
+/**
+ * Set the ceiling on the memory held in buffers.  Once more than high octets are in use the
+ * buffer memory is reported as constrained until usage falls to low or below.  A high value of
+ * zero removes the ceiling.
+ */
+void qd_buffer_set_memory_limit(uint64_t high, uint64_t low);
+
+/**
+ * Return the octets currently held in allocated buffers and the configured ceiling.  The
+ * count is exact for the calling thread's own buffers; the other threads' may lag by a few
+ * hundred kilobytes each.
+ */
+uint64_t qd_buffer_memory_in_use(void);
+uint64_t qd_buffer_memory_limit(void);
+
+/**
+ * Return true while buffer memory is above its ceiling and has not yet fallen below the
+ * low-water mark.  Callers use this to hold back credit from message producers.
+ */
+bool qd_buffer_memory_constrained(void);
+
 /**
  * Create a buffer with capacity set by last call to qd_buffer_set_size(), and data
  * content size of 0 bytes.
  */
 qd_buffer_t *qd_buffer(void);
 
+/**
+ * Create a buffer from the size class best suited to holding hint octets.  Larger
+ * classes (4KB and 64KB) are used only when the hint will fill them; otherwise this is
+ * equivalent to qd_buffer().
+ *
+ * @param hint The number of octets the caller expects to place in the buffer chain.
+ */
+qd_buffer_t *qd_buffer_sized(size_t hint);
+
 /**
  * Free a buffer
  * @param buf A pointer to an allocated buffer
@@ -93,7 +140,9 @@ size_t qd_buffer_size(qd_buffer_t *buf);
 void qd_buffer_insert(qd_buffer_t *buf, size_t len);
 
 /**
- * Create a new buffer list by cloning an existing one.
+ * Create a new buffer list by cloning an existing one.  The new list shares the data of
+ * the source buffers rather than copying it, so neither list's existing data may be
+ * modified in place afterwards.  Either list may be appended to or freed.
  *
  * @param dst A pointer to a list to contain the new buffers
  * @param src A pointer to an existing buffer list
@@ -48,6 +48,29 @@ typedef struct qd_composed_field_t qd_composed_field_t;
  */
 qd_composed_field_t *qd_compose(uint64_t performative, qd_composed_field_t *extend);
 
+/**
+ * Begin composing a field into contiguous memory supplied by the caller rather
+ * than into buffers.  Composite lengths and counts are written in place.
+ *
+ * Composing first with NULL memory measures the field exactly, without taking
+ * ownership of any buffers inserted, so that the memory can then be sized for
+ * a second pass.  Octets beyond the capacity are counted but not written.
+ * Pass the result to qd_compose as 'extend' to start with a performative.
+ *
+ * @param memory Memory to hold the field, or NULL to only measure it.
+ * @param capacity Size of memory in octets.
+ * @return A pointer to the newly created field.
+ */
+qd_composed_field_t *qd_compose_flat(uint8_t *memory, size_t capacity);
+
+/**
+ * Return the number of octets composed into a field created by qd_compose_flat.
+ * The field was written completely only if this does not exceed its capacity.
+ *
+ * @param field A field created by qd_compose_flat.
+ */
+size_t qd_compose_flat_size(const qd_composed_field_t *field);
+
 /**
  * Free the resources associated with a composed field.
  *
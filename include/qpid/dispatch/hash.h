@@ -65,4 +65,16 @@ void qd_hash_retrieve_prefix(qd_hash_t *h, qd_iterator_t *iter, void **val);
  */
 void qd_hash_retrieve_prefix_const(qd_hash_t *h, qd_iterator_t *iter, const void **val);
 
+/**
+ * Maintain a radix-trie index over the keys whose first octet is one of the
+ * given address classes (e.g. "CDZ").  Prefix retrieves of views in those
+ * classes are answered from the trie in a single pass over the view rather
+ * than one hash probe per segment.  Keys already in the table are indexed
+ * immediately.  Passing null or "" drops the index.
+ *
+ * @param h The hash table
+ * @param prefix_classes The set of leading key octets to index
+ */
+void qd_hash_prefix_index(qd_hash_t *h, const char *prefix_classes);
+
 #endif
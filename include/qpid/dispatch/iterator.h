@@ -45,6 +45,20 @@
  */
 typedef struct qd_iterator_t qd_iterator_t;
 
+/**
+ * Caller-provided storage for an iterator, typically on the stack, so that a
+ * short-lived lookup iterator does not need a pool allocation.  The contents
+ * are private to the iterator module.
+ */
+#define QD_ITERATOR_STORAGE_SIZE 256
+typedef struct qd_iterator_storage_t {
+    union {
+        void          *align;
+        uint64_t       align_64;
+        unsigned char  octets[QD_ITERATOR_STORAGE_SIZE];
+    } u;
+} qd_iterator_storage_t;
+
 
 /**
  * qd_iterator_view_t
@@ -140,6 +154,22 @@ void qd_iterator_set_address(const char *area, const char *router);
 qd_iterator_t* qd_iterator_string(const char         *text,
                                   qd_iterator_view_t  view);
 
+/**
+ * Create an iterator for a null-terminated string in caller-provided storage.
+ *
+ * This is equivalent to qd_iterator_string but allocates nothing.  The iterator
+ * must still be released with qd_iterator_free (which will not free the
+ * storage) and must not outlive the storage.
+ *
+ * @param storage Storage for the iterator, usually a local variable
+ * @param text A null-terminated character string
+ * @param view The view for the iterator
+ * @return The iterator, located in storage.
+ */
+qd_iterator_t *qd_iterator_init_string(qd_iterator_storage_t *storage,
+                                       const char            *text,
+                                       qd_iterator_view_t     view);
+
 /**
  * Create an iterator from binary data.
  *
@@ -298,6 +328,15 @@ unsigned char *qd_iterator_copy(qd_iterator_t *iter);
  */
 qd_iterator_t *qd_iterator_dup(const qd_iterator_t *iter);
 
+/**
+ * Duplicate an iterator into caller-provided storage.  The duplicate is released
+ * with qd_iterator_free, as for qd_iterator_init_string.
+ * @param storage Storage for the duplicate, usually a local variable
+ * @param iter Input iterator
+ * @return Pointer to the duplicate (in storage), or NULL if iter is NULL.
+ */
+qd_iterator_t *qd_iterator_init_dup(qd_iterator_storage_t *storage, const qd_iterator_t *iter);
+
 /**
  * Copy the iterator's view into buffer as a null terminated string,
  * up to a maximum of n bytes. Cursor is advanced by the number of bytes
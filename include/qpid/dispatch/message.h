@@ -40,6 +40,8 @@
 
 typedef struct qd_message_t qd_message_t;
 
+struct qdr_compression_stats_t;
+
 DEQ_DECLARE(qd_message_t, qd_message_list_t);
 
 /** Message representation.
@@ -62,6 +64,13 @@ typedef enum {
     QD_DEPTH_ALL
 } qd_message_depth_t;
 
+/** Result of checking a message that may still be arriving.  */
+typedef enum {
+    QD_MESSAGE_DEPTH_INVALID,     // The message is malformed before the requested depth
+    QD_MESSAGE_DEPTH_OK,          // The message is valid up to the requested depth
+    QD_MESSAGE_DEPTH_INCOMPLETE   // Not enough of the message has arrived to tell
+} qd_message_depth_status_t;
+
 
 /** Message fields */
 typedef enum {
@@ -160,6 +169,15 @@ qd_parsed_field_t *qd_message_message_annotations(qd_message_t *msg);
  */
 void qd_message_set_trace_annotation(qd_message_t *msg, qd_composed_field_t *trace_field);
 
+/**
+ * Set the value for the QD_MA_TRACE field from a list that is already encoded,
+ * such as one that is the same for many messages.  The message gets a copy.
+ *
+ * @param msg Pointer to an outgoing message.
+ * @param encoded The encoded list.
+ */
+void qd_message_set_trace_annotation_encoded(qd_message_t *msg, const qd_buffer_list_t *encoded);
+
 /**
  * Set the value for the QD_MA_TO field in the outgoing message annotations for
  * the message.
@@ -176,6 +194,15 @@ void qd_message_set_trace_annotation(qd_message_t *msg, qd_composed_field_t *tra
  */
 void qd_message_set_to_override_annotation(qd_message_t *msg, qd_composed_field_t *to_field);
 
+/**
+ * Set the value for the QD_MA_TO field from an already encoded address, such as
+ * the target of the link the message arrived on.  The message gets a copy.
+ *
+ * @param msg Pointer to an outgoing message.
+ * @param encoded The encoded to override address.
+ */
+void qd_message_set_to_override_annotation_encoded(qd_message_t *msg, const qd_buffer_list_t *encoded);
+
 /**
  * Set a phase for the phase annotation in the message.
  *
@@ -202,6 +229,15 @@ int  qd_message_get_phase_annotation(const qd_message_t *msg);
  */
 void qd_message_set_ingress_annotation(qd_message_t *msg, qd_composed_field_t *ingress_field);
 
+/**
+ * Set the value for the QD_MA_INGRESS field from an already encoded value.
+ * The message gets a copy.
+ *
+ * @param msg Pointer to an outgoing message.
+ * @param encoded The encoded ingress router.
+ */
+void qd_message_set_ingress_annotation_encoded(qd_message_t *msg, const qd_buffer_list_t *encoded);
+
 /**
  * Receive message data via a delivery.  This function may be called more than once on the same
  * delivery if the message spans multiple frames.  Once a complete message has been received, this
@@ -212,13 +248,104 @@ void qd_message_set_ingress_annotation(qd_message_t *msg, qd_composed_field_t *i
  */
 qd_message_t *qd_message_receive(pn_delivery_t *delivery);
 
+/**
+ * Return the message that is still being received on a delivery.  The message remains owned by
+ * the delivery; callers that need to keep it must take a copy with qd_message_copy.
+ *
+ * @param delivery An incoming delivery from a link
+ * @return A pointer to the partially received message or 0 if no data has arrived yet.
+ */
+qd_message_t *qd_message_partial(pn_delivery_t *delivery);
+
+/**
+ * End the receipt of a message whose delivery will get no more content because its link or
+ * connection was lost.  The partial message is marked aborted and complete, and is detached
+ * from the delivery.
+ *
+ * @param delivery An incoming delivery from a link
+ * @return The message, now owned by the caller, or 0 if no data had arrived.
+ */
+qd_message_t *qd_message_receive_abort(pn_delivery_t *delivery);
+
+/**
+ * Return true once the final frame of the message has been received.  Messages that were
+ * not received from a delivery are always complete.  An aborted message is also complete.
+ */
+bool qd_message_receive_complete(qd_message_t *msg);
+
+/**
+ * Return true if the sender aborted the message, or its incoming link was lost, before the
+ * final frame arrived.  The content of an aborted message is incomplete and must not be
+ * forwarded; copies already being sent are aborted.
+ */
+bool qd_message_aborted(qd_message_t *msg);
+
+/**
+ * Return the number of octets of the message received so far.
+ */
+size_t qd_message_size(qd_message_t *msg);
+
+#define QD_MESSAGE_DEFAULT_PRIORITY 4
+#define QD_MESSAGE_MAX_PRIORITY     9
+
+/**
+ * Return the priority from the message header, QD_MESSAGE_DEFAULT_PRIORITY if it has none.
+ * Priorities above QD_MESSAGE_MAX_PRIORITY are treated as the maximum.
+ */
+uint8_t qd_message_priority(qd_message_t *msg);
+
+/**
+ * Return a non-zero hash of the message's group-id, or zero if it has none or its
+ * properties have not arrived yet.  The hash is kept with the content, so copies of the
+ * message share it.
+ */
+uint32_t qd_message_group_hash(qd_message_t *msg);
+
 /**
  * Send the message outbound on an outgoing link.
  *
+ * If the message is still being received, only the content that has arrived so far is sent.
+ * Calling this function again on the same message resumes where the previous call stopped.
+ *
+ * If compression is set, a message that is completely received when its send starts has
+ * everything after its message annotations sent compressed, where that makes it smaller.
+ * Only a peer router that agreed to compression on the connection can read such a message.
+ *
  * @param msg A pointer to a message to be sent.
  * @param link The outgoing link on which to send the message.
+ * @param compression Statistics of the link's connection if it compresses messages, else null.
  */
-void qd_message_send(qd_message_t *msg, qd_link_t *link, bool strip_outbound_annotations);
+void qd_message_send(qd_message_t *msg, qd_link_t *link, bool strip_outbound_annotations,
+                     struct qdr_compression_stats_t *compression);
+
+/**
+ * Restore a completely received message that a peer router sent compressed by
+ * qd_message_send.  Messages that are not compressed are left as they are.
+ *
+ * @param msg A pointer to a completely received message.
+ * @param compression Statistics of the connection the message arrived on.
+ * @return false if the compressed content is corrupt.
+ */
+bool qd_message_inflate(qd_message_t *msg, struct qdr_compression_stats_t *compression);
+
+/**
+ * Return true once qd_message_send has been called at least once on this message.
+ */
+bool qd_message_send_started(qd_message_t *msg);
+
+/**
+ * Return true once qd_message_send has sent all of the message's content.
+ */
+bool qd_message_send_complete(qd_message_t *msg);
+
+/**
+ * Move the end of a completely received message's body out of memory into the spill file,
+ * if one is configured and no message sharing the content is part way through a send.  The
+ * data is read back when the message is next sent or its body is looked at.
+ *
+ * @return true if any of the message was spilled.
+ */
+bool qd_message_spill(qd_message_t *msg);
 
 /**
  * Check that the message is well-formed up to a certain depth.  Any part of the message that is
@@ -226,6 +353,13 @@ void qd_message_send(qd_message_t *msg, qd_link_t *link, bool strip_outbound_ann
  */
 int qd_message_check(qd_message_t *msg, qd_message_depth_t depth);
 
+/**
+ * Like qd_message_check, but usable on a message that is still being received.  Sections that
+ * are cut short by the end of the received data are reported as incomplete rather than invalid,
+ * and such a check leaves no partial parse state behind.
+ */
+qd_message_depth_status_t qd_message_check_depth(qd_message_t *msg, qd_message_depth_t depth);
+
 /**
  * Return an iterator for the requested message field.  If the field is not in the message,
  * return NULL.
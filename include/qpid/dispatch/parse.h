@@ -42,6 +42,17 @@ typedef struct qd_parsed_field_t qd_parsed_field_t;
  */
 qd_parsed_field_t *qd_parse(qd_iterator_t *iter);
 
+/**
+ * Parse a field as qd_parse does, placing the whole tree in an arena owned by
+ * the returned root.  The children of a compound field are parsed only when
+ * first asked for, and qd_parse_free releases the tree without visiting its
+ * fields.  Suited to large maps of which only a few entries are read.
+ *
+ * @param iter Field iterator for the field being parsed
+ * @return A pointer to the newly created field, freed with qd_parse_free.
+ */
+qd_parsed_field_t *qd_parse_arena(qd_iterator_t *iter);
+
 /**
  * Free the resources associated with a parsed field.
  *
@@ -0,0 +1,88 @@
+#ifndef __dispatch_parse_tree_h__
+#define __dispatch_parse_tree_h__ 1
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**@file
+ * Pattern-matching tree for topic-style addresses.
+ *
+ * Patterns and addresses are divided into tokens by '.' or '/'.  In a pattern
+ * the token '*' matches exactly one token of an address and '#' matches zero
+ * or more tokens; any other token must match literally.  The whole pattern set
+ * is held in one tree so that the cost of a match depends on the length of the
+ * address rather than on the number of patterns.
+ *
+ * Where more than one pattern matches an address the most specific wins:
+ * at each token a literal match is preferred over '*', and '*' over '#'.
+ */
+
+#include <stdbool.h>
+#include <qpid/dispatch/iterator.h>
+#include <qpid/dispatch/error.h>
+
+typedef struct qd_parse_tree_t qd_parse_tree_t;
+
+qd_parse_tree_t *qd_parse_tree(void);
+void qd_parse_tree_free(qd_parse_tree_t *tree);
+
+/**
+ * Add a pattern to the tree.
+ *
+ * @param tree The pattern tree
+ * @param pattern The pattern text, copied by the tree
+ * @param payload Non-null value returned by matches of this pattern
+ * @return QD_ERROR_ALREADY_EXISTS if the (normalized) pattern is already present
+ */
+qd_error_t qd_parse_tree_add_pattern(qd_parse_tree_t *tree, const char *pattern, void *payload);
+
+/**
+ * Remove a pattern from the tree.
+ *
+ * @return The payload of the removed pattern, or 0 if it was not present.
+ */
+void *qd_parse_tree_remove_pattern(qd_parse_tree_t *tree, const char *pattern);
+
+/**
+ * Return the payload of exactly this pattern (not of the patterns that match it),
+ * or 0 if the pattern is not present.
+ */
+void *qd_parse_tree_get_pattern(qd_parse_tree_t *tree, const char *pattern);
+
+/**
+ * Find the most specific pattern that matches the view of an iterator.
+ *
+ * @param tree The pattern tree
+ * @param value The address to match
+ * @param payload [out] The payload of the matching pattern, 0 if none matched
+ * @return True iff a pattern matched
+ */
+bool qd_parse_tree_retrieve_match(qd_parse_tree_t *tree, qd_iterator_t *value, void **payload);
+
+/**
+ * Return true if the text contains a wildcard token and so must be treated as a
+ * pattern rather than a literal address or prefix.
+ */
+bool qd_parse_tree_is_pattern(const char *text);
+
+/**
+ * Return the number of patterns in the tree.
+ */
+size_t qd_parse_tree_size(const qd_parse_tree_t *tree);
+
+#endif
@@ -79,9 +79,13 @@ PyObject *qd_field_to_py(qd_parsed_field_t *field);
 /**
  * These are temporary and will eventually be replaced by having an internal python
  * work queue that feeds a dedicated embedded-python thread.
+ *
+ * The time waiting for and holding the lock is recorded per calling function, see the
+ * pythonLock entity.
  */
 typedef PyGILState_STATE qd_python_lock_state_t;
-qd_python_lock_state_t qd_python_lock(void);
+qd_python_lock_state_t qd_python_lock_at(const char *site);
+#define qd_python_lock() qd_python_lock_at(__func__)
 void qd_python_unlock(qd_python_lock_state_t state);
 void qd_python_check_lock(void);
 
@@ -24,6 +24,7 @@
 #include <qpid/dispatch/compose.h>
 #include <qpid/dispatch/parse.h>
 #include <qpid/dispatch/router.h>
+#include <qpid/dispatch/atomic.h>
 
 
 /**
@@ -48,6 +49,15 @@ typedef enum {
 } qd_router_mode_t;
 ENUM_DECLARE(qd_router_mode);
 
+/**
+ * The order in which deliveries queued on an outgoing link are sent.
+ */
+typedef enum {
+    QD_DELIVERY_PRIORITY_FIFO,      ///< Arrival order, ignoring the message priority
+    QD_DELIVERY_PRIORITY_STRICT,    ///< Higher priority first, arrival order within a priority
+    QD_DELIVERY_PRIORITY_WEIGHTED   ///< Each priority p gets a share of the link proportional to p + 1
+} qd_delivery_priority_t;
+
 /**
  * Allocate and start an instance of the router core module.
  */
@@ -58,6 +68,93 @@ qdr_core_t *qdr_core(qd_dispatch_t *qd, qd_router_mode_t mode, const char *area,
  */
 void qdr_core_free(qdr_core_t *core);
 
+/**
+ * Begin staging core actions on the calling thread.
+ *
+ * Actions enqueued by this thread after this call are held in a thread-local
+ * list and are handed to the core together by qdr_action_batch_end().  This is
+ * intended to bracket the processing of one batch of IO events.  Calls do not
+ * nest.
+ */
+void qdr_action_batch_begin(void);
+
+/**
+ * Hand all actions staged on the calling thread to the core in one operation
+ * and stop staging.
+ */
+void qdr_action_batch_end(void);
+
+/**
+ * Block until the core has taken every action enqueued before the call.  Must not be
+ * called on the core thread or with actions staged on the calling thread.
+ */
+void qdr_core_sync(qdr_core_t *core);
+
+/**
+ * Ask the core to issue any credit it has held back from incoming links if buffer memory
+ * has fallen below its low-water mark.  Called periodically as a backstop for memory freed
+ * outside the core thread.
+ */
+void qdr_core_check_memory(qdr_core_t *core);
+
+/**
+ * Ask the core to issue credit it has held back from incoming links whose connections are
+ * over their rate limits, as far as the limits now allow, and to go on attaching auto-links
+ * paced by autoLinkAttachRate.  Called every QDR_RATE_TICK_MSEC; does nothing unless credit
+ * or auto-links are being held back.
+ */
+void qdr_core_rate_tick(qdr_core_t *core);
+
+#define QDR_RATE_TICK_MSEC 100
+
+/**
+ * Router-wide statistics as last published by the core thread.
+ */
+typedef struct qdr_core_stats_t {
+    uint64_t sequence;              ///< Increases by one with every publication
+    uint64_t published_ns;          ///< Monotonic time of the publication
+    uint64_t addr_count;
+    uint64_t link_count;
+    uint64_t connection_count;
+    uint64_t router_count;
+    uint64_t link_route_count;
+    uint64_t auto_link_count;
+    uint64_t deliveries_ingress;
+    uint64_t deliveries_egress;
+    uint64_t deliveries_transit;
+    uint64_t deliveries_to_container;
+    uint64_t deliveries_from_container;
+    uint64_t dropped_presettled_deliveries;
+    uint64_t spin_time_ns;
+    uint64_t parked_time_ns;
+    uint64_t busy_time_ns;
+    uint64_t utilization;           ///< Busy percentage of the core thread over the last second or so
+    uint64_t drains;
+    uint64_t drained_actions;
+    uint64_t max_drain;
+} qdr_core_stats_t;
+
+/**
+ * Copy the most recently published statistics snapshot.
+ *
+ * The core publishes into one half of a double buffer while readers copy the
+ * other, so this may be called from any thread without a core action or lock.
+ * It retries only if the core published during the copy.
+ */
+void qdr_core_stats(qdr_core_t *core, qdr_core_stats_t *stats);
+
+/**
+ * Address on which consoles receive the router's statistics, see qdr_core_console_tick.
+ */
+#define QDR_CONSOLE_ADDRESS "_local/qdconsole"
+
+/**
+ * Send the statistics snapshot, as gauges and counter deltas since the previous
+ * call, to whatever is subscribed to QDR_CONSOLE_ADDRESS.  One message is shared
+ * by all subscribers; nothing is sent if there are none.
+ */
+void qdr_core_console_tick(qdr_core_t *core);
+
 /**
  ******************************************************************************
  * Route table maintenance functions (Router Control)
@@ -71,17 +168,40 @@ void qdr_core_set_next_hop(qdr_core_t *core, int router_maskbit, int nh_router_m
 void qdr_core_remove_next_hop(qdr_core_t *core, int router_maskbit);
 void qdr_core_set_cost(qdr_core_t *core, int router_maskbit, int cost);
 void qdr_core_set_valid_origins(qdr_core_t *core, int router_maskbit, qd_bitmask_t *routers);
+
+/**
+ * Set the neighbors that each start a lowest-cost path to a remote router, and the
+ * origins for which this router is on any such path.  Anycast forwarding spreads
+ * deliveries to the remote router over these neighbors when there is more than one.
+ * The core takes ownership of both bitmasks.
+ */
+void qdr_core_set_equal_cost_hops(qdr_core_t *core, int router_maskbit, qd_bitmask_t *next_hops, qd_bitmask_t *valid_origins);
 void qdr_core_map_destination(qdr_core_t *core, int router_maskbit, const char *address_hash);
 void qdr_core_unmap_destination(qdr_core_t *core, int router_maskbit, const char *address_hash);
 
-typedef void (*qdr_mobile_added_t)   (void *context, const char *address_hash);
-typedef void (*qdr_mobile_removed_t) (void *context, const char *address_hash);
+/**
+ * Bracket a set of route-table changes made by the calling thread.  The
+ * route-table functions above called between begin and commit are staged and
+ * handed to the core as one action that applies them in order, re-sorting the
+ * routers by cost once at the end.  Brackets may nest; only the outermost
+ * commit hands the changes over.
+ */
+void qdr_core_route_table_begin(qdr_core_t *core);
+void qdr_core_route_table_commit(qdr_core_t *core);
+
+/**
+ * Report changes in the set of locally attached mobile addresses.  Changes are
+ * coalesced in the core for a short time and delivered in batches; an address
+ * that is added and removed again within a batch is not reported at all, so
+ * the added and removed lists never share an address.
+ */
+typedef void (*qdr_mobile_changed_t) (void *context, const char **added, int added_count,
+                                      const char **removed, int removed_count);
 typedef void (*qdr_link_lost_t)      (void *context, int link_maskbit);
 
 void qdr_core_route_table_handlers(qdr_core_t           *core, 
                                    void                 *context,
-                                   qdr_mobile_added_t    mobile_added,
-                                   qdr_mobile_removed_t  mobile_removed,
+                                   qdr_mobile_changed_t  mobile_changed,
                                    qdr_link_lost_t       link_lost);
 
 /**
@@ -91,6 +211,13 @@ void qdr_core_route_table_handlers(qdr_core_t           *core,
  */
 typedef void (*qdr_receive_t) (void *context, qd_message_t *msg, int link_maskbit, int inter_router_cost);
 
+/**
+ * Receive the messages that arrived for a subscription since the last call, oldest first.
+ * The messages are freed when the call returns.
+ */
+typedef void (*qdr_receive_batch_t) (void *context, qd_message_t **msgs, int *link_maskbits,
+                                     int *inter_router_costs, int count);
+
 qdr_subscription_t *qdr_core_subscribe(qdr_core_t             *core,
                                        const char             *address,
                                        char                    aclass,
@@ -99,6 +226,14 @@ qdr_subscription_t *qdr_core_subscribe(qdr_core_t             *core,
                                        qdr_receive_t           on_message,
                                        void                   *context);
 
+qdr_subscription_t *qdr_core_subscribe_batch(qdr_core_t             *core,
+                                             const char             *address,
+                                             char                    aclass,
+                                             char                    phase,
+                                             qd_address_treatment_t  treatment,
+                                             qdr_receive_batch_t     on_message_batch,
+                                             void                   *context);
+
 void qdr_core_unsubscribe(qdr_subscription_t *sub);
 
 /**
@@ -137,9 +272,28 @@ typedef enum {
     QDR_ROLE_NORMAL,
     QDR_ROLE_INTER_ROUTER,
     QDR_ROLE_ROUTE_CONTAINER,
-    QDR_ROLE_ON_DEMAND
+    QDR_ROLE_ON_DEMAND,
+    QDR_ROLE_INTER_ROUTER_DATA, ///< An extra connection to a neighbor router carrying only data links
+    QDR_ROLE_EDGE_CONNECTION    ///< A connection between an edge router and an interior router
 } qdr_connection_role_t;
 
+/**
+ * Limits on the rate at which a connection's client senders may deliver, enforced by
+ * holding back link credit.  A zero rate is no limit.  The user limits are shared by all
+ * connections of the same user in the same scope, the vhost limits by all connections in
+ * the same scope.
+ */
+typedef struct qdr_rate_limits_t {
+    uint64_t    msg_rate;         ///< Messages per second on the connection
+    uint64_t    byte_rate;        ///< Octets per second on the connection
+    uint64_t    user_msg_rate;    ///< Messages per second for the user
+    uint64_t    user_byte_rate;   ///< Octets per second for the user
+    uint64_t    vhost_msg_rate;   ///< Messages per second for the scope
+    uint64_t    vhost_byte_rate;  ///< Octets per second for the scope
+    const void *scope;            ///< Identifies the vhost the shared limits belong to
+    int        *throttled;        ///< If non-null, counts the credits held back
+} qdr_rate_limits_t;
+
 /**
  * qdr_connection_opened
  *
@@ -156,7 +310,9 @@ typedef enum {
  * @param strip_annotations_in True if configured to remove annotations on inbound messages.
  * @param strip_annotations_out True if configured to remove annotations on outbound messages.
  * @param link_capacity The capacity, in deliveries, for links in this connection.
+ * @param link_capacity_max The largest credit window an incoming link may adapt to.
  * @param vhost If non-null, this is the vhost of the connection to be used for multi-tenancy.
+ * @param rate_limits If non-null, the rate limits for the connection's client senders.
  * @return Pointer to a connection object that can be used to refer to this connection over its lifetime.
  */
 qdr_connection_t *qdr_connection_opened(qdr_core_t            *core,
@@ -169,7 +325,9 @@ qdr_connection_t *qdr_connection_opened(qdr_core_t            *core,
                                         bool                   strip_annotations_in,
                                         bool                   strip_annotations_out,
                                         int                    link_capacity,
+                                        int                    link_capacity_max,
                                         const char            *vhost,
+                                        const qdr_rate_limits_t *rate_limits,
                                         qdr_connection_info_t *connection_info);
 
 /**
@@ -436,6 +594,30 @@ int qdr_link_phase(const qdr_link_t *link);
  */
 bool qdr_link_is_anonymous(const qdr_link_t *link);
 
+/**
+ * qdr_link_unroutable
+ *
+ * Tell, from the link's I/O thread, whether the core would release a message that arrived
+ * on the anonymous link for the given address because it knows no such address or the
+ * address has no consumers.  Such a message may be released there and then, without a
+ * round trip through the core.  The answer is read from a view of the core's addresses that
+ * the core keeps up to date, and is always false on an edge router, where such messages go
+ * up to the interior.
+ *
+ * @param link Incoming endpoint link
+ * @param addr Iterator in the address-hash view, annotated with the phase if any.  The
+ *             connection's tenant space is annotated here as the core would.
+ * @return True if the message has nowhere to go.
+ */
+bool qdr_link_unroutable(qdr_link_t *link, qd_iterator_t *addr);
+
+/**
+ * qdr_link_released_unroutable
+ *
+ * Count a delivery that the link's I/O thread released after qdr_link_unroutable.
+ */
+void qdr_link_released_unroutable(qdr_link_t *link);
+
 /**
  * qdr_link_is_routed
  *
@@ -453,6 +635,15 @@ bool qdr_link_is_routed(const qdr_link_t *link);
  */
 bool qdr_link_strip_annotations_in(const qdr_link_t *link);
 
+/**
+ * qdr_link_to_override
+ *
+ * The encoded to-override annotation for the messages arriving on an incoming link with a
+ * target address.  It is empty until the link's I/O thread first composes it, and is then
+ * kept for the life of the link.  Only the link's I/O thread may use it.
+ */
+qd_buffer_list_t *qdr_link_to_override(qdr_link_t *link);
+
 /**
  * qdr_link_strip_annotations_oout
  *
@@ -470,6 +661,16 @@ bool qdr_link_strip_annotations_out(const qdr_link_t *link);
  */
 const char *qdr_link_name(const qdr_link_t *link);
 
+/**
+ * qdr_link_identity
+ *
+ * Retrieve the identity of the link, as shown in the router.link management entity.
+ *
+ * @param link Link object
+ * @return The link's identity
+ */
+uint64_t qdr_link_identity(const qdr_link_t *link);
+
 /**
  * qdr_link_first_attach
  *
@@ -542,7 +743,29 @@ qdr_delivery_t *qdr_link_deliver_to_routed_link(qdr_link_t *link, qd_message_t *
                                                 const uint8_t *tag, int tag_length,
                                                 uint64_t disposition, pn_data_t* disposition_state);
 
-void qdr_link_process_deliveries(qdr_core_t *core, qdr_link_t *link, int credit);
+/**
+ * qdr_link_continue_delivery
+ *
+ * Tell the router core that more content has arrived for a delivery whose message is still
+ * being received on an incoming link.  The outgoing link the delivery is being cut through to
+ * is woken so it can send the new content on.
+ *
+ * @param link Pointer to the incoming link.
+ * @param complete True iff the final frame of the message has arrived.
+ */
+void qdr_link_continue_delivery(qdr_link_t *link, bool complete);
+
+/**
+ * qdr_link_process_deliveries
+ *
+ * Send pending deliveries on an outgoing link.  A delivery whose message is still arriving
+ * stays current on the link, and nothing is sent behind it until all of its content is out.
+ * The connection's deliver handler returns false while that is the case.  Sending also
+ * stops when the link has used up its turn among the connection's sending links.
+ *
+ * @return The number of credits consumed by this call.
+ */
+int qdr_link_process_deliveries(qdr_core_t *core, qdr_link_t *link, int credit);
 
 void qdr_link_flow(qdr_core_t *core, qdr_link_t *link, int credit, bool drain_mode);
 
@@ -556,7 +779,7 @@ typedef void (*qdr_link_offer_t)         (void *context, qdr_link_t *link, int d
 typedef void (*qdr_link_drained_t)       (void *context, qdr_link_t *link);
 typedef void (*qdr_link_drain_t)         (void *context, qdr_link_t *link, bool mode);
 typedef int  (*qdr_link_push_t)          (void *context, qdr_link_t *link, int limit);
-typedef void (*qdr_link_deliver_t)       (void *context, qdr_link_t *link, qdr_delivery_t *delivery, bool settled);
+typedef bool (*qdr_link_deliver_t)       (void *context, qdr_link_t *link, qdr_delivery_t *delivery, bool settled);
 typedef void (*qdr_delivery_update_t)    (void *context, qdr_delivery_t *dlv, uint64_t disp, bool settled);
 
 void qdr_connection_handlers(qdr_core_t             *core,
@@ -587,6 +810,12 @@ void qdr_delivery_incref(qdr_delivery_t *delivery);
 void qdr_delivery_decref(qdr_core_t *core, qdr_delivery_t *delivery);
 void qdr_delivery_tag(const qdr_delivery_t *delivery, const char **tag, int *length);
 qd_message_t *qdr_delivery_message(const qdr_delivery_t *delivery);
+
+/**
+ * Monotonic time at which an outgoing delivery was handed to its link for sending,
+ * 0 if it has not been yet.
+ */
+uint64_t qdr_delivery_handoff_ns(const qdr_delivery_t *delivery);
 qdr_error_t *qdr_delivery_error(const qdr_delivery_t *delivery);
 void qdr_delivery_write_extension_state(qdr_delivery_t *dlv, pn_delivery_t* pdlv, bool update_disposition);
 
@@ -603,6 +832,7 @@ typedef enum {
     QD_ROUTER_ROUTER,
     QD_ROUTER_LINK,
     QD_ROUTER_ADDRESS,
+    QD_ROUTER_CORE_ACTION,
     QD_ROUTER_EXCHANGE,
     QD_ROUTER_BINDING,
     QD_ROUTER_FORBIDDEN
@@ -679,6 +909,7 @@ void qdr_manage_update(qdr_core_t *core, void *context, qd_router_entity_type_t
  * 1) Locate the attributeNames field in the body of the QUERY request
  * 2) Create a composed field for the body of the reply message
  * 3) Call qdr_manage_query with the attributeNames field and the response body
+ *    then, if the request has one, qdr_query_set_filter with its "where" field
  * 4) Start the body map, add the "attributeNames" key
  * 5) Call qdr_query_add_attribute_names.  This will add the attribute names list
  * 6) Add the "results" key, start the outer list
@@ -690,6 +921,15 @@ void qdr_manage_update(qdr_core_t *core, void *context, qd_router_entity_type_t
 
 qdr_query_t *qdr_manage_query(qdr_core_t *core, void *context, qd_router_entity_type_t type,
                               qd_parsed_field_t *attribute_names, qd_composed_field_t *body);
+
+/**
+ * Restrict a link, connection or address query to the entities that satisfy
+ * every clause of a "where" list.  Each clause is a list of
+ * [attribute-name, operator, value]; operators are ==, !=, <, <=, >, >= for
+ * numeric values and ==, != and prefix for strings.  The query's offset counts
+ * matching entities.  A malformed list fails the query with status 400.
+ */
+void qdr_query_set_filter(qdr_query_t *query, qd_parsed_field_t *where);
 void qdr_query_add_attribute_names(qdr_query_t *query);
 void qdr_query_get_first(qdr_query_t *query, int offset);
 void qdr_query_get_next(qdr_query_t *query);
@@ -712,4 +952,26 @@ qdr_connection_info_t *qdr_connection_info(bool             is_encrypted,
                                            int              ssl_ssf,
                                            bool             ssl);
 
+/**
+ * Compression statistics of a connection, for WebSocket permessage-deflate
+ * or for messages compressed between routers.  The counters are
+ * written only by the connection's I/O thread and read by management; the
+ * block is shared by reference so either side may finish with it first.
+ */
+typedef struct qdr_compression_stats_t {
+    sys_atomic_t ref_count;
+    uint64_t     bytes_in;          ///< Message bytes received, after decompression
+    uint64_t     wire_bytes_in;     ///< Message bytes received, as compressed on the wire
+    uint64_t     bytes_out;         ///< Message bytes sent, before compression
+    uint64_t     wire_bytes_out;    ///< Message bytes sent, as compressed on the wire
+    uint64_t     compress_ns;       ///< Time spent compressing and decompressing
+} qdr_compression_stats_t;
+
+/** Allocate zeroed compression statistics holding one reference */
+qdr_compression_stats_t *qdr_compression_stats(void);
+void qdr_compression_stats_decref(qdr_compression_stats_t *stats);
+
+/** Report compression statistics with the connection, the info takes its own reference */
+void qdr_connection_info_set_compression(qdr_connection_info_t *info, qdr_compression_stats_t *stats);
+
 #endif
@@ -73,6 +73,41 @@ void qd_server_run(qd_dispatch_t *qd);
 
 void qd_server_stop(qd_dispatch_t *qd);
 
+
+/**
+ * Wake handler
+ *
+ * Invoked on a worker thread some time after qd_server_wake() is called.  Calls to
+ * qd_server_wake that are made before the handler runs may be coalesced into a
+ * single invocation.  The handler may be invoked concurrently on more than one
+ * thread and must do its own serialization.
+ *
+ * @param context The context supplied to qd_server_set_wake_handler.
+ */
+typedef void (*qd_server_wake_handler_t)(void *context);
+
+
+/**
+ * Register the handler to be run by qd_server_wake().  There is one handler per
+ * server; a handler of 0 cancels the registration.
+ *
+ * @param qd The dispatch handle returned by qd_dispatch.
+ * @param handler The handler to invoke on a worker thread.
+ * @param context An opaque context to be passed back to the handler.
+ */
+void qd_server_set_wake_handler(qd_dispatch_t *qd, qd_server_wake_handler_t handler, void *context);
+
+
+/**
+ * Cause the wake handler to be invoked on a worker thread as soon as one is
+ * available.  This does not go through the timer subsystem.
+ *
+ * May be called from any thread.
+ *
+ * @param qd The dispatch handle returned by qd_dispatch.
+ */
+void qd_server_wake(qd_dispatch_t *qd);
+
 /**
  * @}
  * @defgroup connection connection
@@ -141,6 +176,19 @@ typedef struct qd_server_config_t {
      */
     char *http_root;
 
+    /**
+     * Serve OpenMetrics statistics at the /metrics path of an HTTP listener.
+     */
+    bool http_metrics;
+
+    /**
+     * Offer permessage-deflate to AMQP over WebSocket clients of an HTTP
+     * listener, with this zlib compression level and window size.
+     */
+    bool http_deflate;
+    int  http_deflate_level;
+    int  http_deflate_window_bits;
+
     /**
      * Connection name, used as a reference from other parts of the configuration.
      */
@@ -216,6 +264,12 @@ typedef struct qd_server_config_t {
      */
     int link_capacity;
 
+    /**
+     * The largest credit window an incoming link may grow to.  Windows adapt between
+     * link_capacity and this value.  Equal to link_capacity if the window is fixed.
+     */
+    int link_capacity_max;
+
     /**
      * Path to the file containing the PEM-formatted public certificate for the local end
      * of the connection.
@@ -330,6 +384,61 @@ typedef struct qd_server_config_t {
      */
     int idle_timeout_seconds;
 
+    /**
+     * Seconds for which an SSL domain, with its TLS session cache and ticket keys,
+     * is reused before a fresh one is built.  Zero builds one for every connection.
+     */
+    int ssl_session_lifetime;
+
+    /**
+     * Listeners only: the most incoming connections that may be in the SSL/SASL handshake
+     * at once.  Further accepts are deferred until a handshake completes.  Zero is no limit.
+     */
+    int max_handshakes;
+
+    /**
+     * Listeners only: the most accepts that may be deferred at once.  Beyond it new
+     * connections are accepted and immediately closed.  Zero is no limit.
+     */
+    int max_deferred_accepts;
+
+    /**
+     * Listeners only: the length of the queue of connections waiting for accept in the
+     * kernel.  Zero uses the built-in default.
+     */
+    int backlog;
+
+    /**
+     * Listeners only: microseconds for which a read on an accepted socket busy-polls the
+     * device queue before sleeping (SO_BUSY_POLL).  Zero leaves the system default.
+     */
+    int busy_poll;
+
+    /**
+     * Listeners only: start accepted connections in TCP quick-ack mode, acknowledging
+     * every segment at once rather than after the delayed-ACK timeout.
+     */
+    bool tcp_quick_ack;
+
+    /**
+     * Inter-router connectors only: the number of connections to open to the peer router.
+     * The first carries the control links; each of the others carries only a pair of data
+     * links and joins the pool that routed deliveries are spread over.
+     */
+    int data_connection_count;
+
+    /**
+     * Set on the extra connectors behind data_connection_count.  The connection is opened
+     * with the inter-router-data property so the peer can tell it from the primary one.
+     */
+    bool inter_router_data;
+
+    /**
+     * Inter-router only: compress message content on the connection if the peer router
+     * is configured to as well.
+     */
+    bool inter_router_compression;
+
     /**
      *  Holds comma separated list that indicates which components of the message should be logged.
      *  Defaults to 'none' (log nothing). If you want all properties and application properties of the message logged use 'all'.
@@ -447,6 +556,8 @@ void qd_connection_set_user(qd_connection_t *conn);
  * not have permission to access (i.e. it may be owned by another thread
  * currently).  An activated connection will, when writable, appear in the
  * internal work list and be invoked for processing by a worker thread.
+ * Activations made before the connection has been processed are coalesced into
+ * one wake-up.
  *
  * @param conn The connection over which the application wishes to send data
  */
@@ -23,6 +23,9 @@
  * Portable threading and locking API.
  */
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef struct sys_mutex_t sys_mutex_t;
 
 sys_mutex_t *sys_mutex(void);
@@ -36,6 +39,8 @@ typedef struct sys_cond_t sys_cond_t;
 sys_cond_t *sys_cond(void);
 void        sys_cond_free(sys_cond_t *cond);
 void        sys_cond_wait(sys_cond_t *cond, sys_mutex_t *held_mutex);
+/** Wait until signalled or until deadline, in milliseconds of CLOCK_REALTIME since the epoch. */
+void        sys_cond_timed_wait(sys_cond_t *cond, sys_mutex_t *held_mutex, int64_t deadline);
 void        sys_cond_signal(sys_cond_t *cond);
 void        sys_cond_signal_all(sys_cond_t *cond);
 
@@ -61,4 +66,25 @@ long sys_thread_id(sys_thread_t *thread);
 /** Return the OS identifier for the current thread */
 long sys_thread_self();
 
+/** Return the number of NUMA nodes on this host, 1 if that can't be determined */
+int sys_numa_node_count(void);
+
+/** Return the NUMA node the calling thread is running on, 0 if that can't be determined */
+int sys_numa_node_self(void);
+
+/**
+ * Restrict the calling thread to the CPUs of a NUMA node.
+ *
+ * @return false if the node's CPUs can't be determined or the thread can't be bound.
+ */
+bool sys_thread_bind_node(int node);
+
+/**
+ * Restrict the calling thread to a set of CPUs.
+ *
+ * @param cpus A comma-separated list of CPU numbers and ranges, for example "0-3,8".
+ * @return false if the list is malformed or the thread can't be bound.
+ */
+bool sys_thread_bind_cpus(const char *cpus);
+
 #endif
@@ -50,6 +50,17 @@ void qd_tracemask_free(qd_tracemask_t *tm);
  */
 void qd_tracemask_add_router(qd_tracemask_t *tm, const char *address, int maskbit);
 
+/**
+ * qd_tracemask_set_self
+ *
+ * Tell the TraceMask this router's own id so that qd_tracemask_create can
+ * report a message that has already passed through it.
+ *
+ * @param tm Tracemask created by qd_tracemask()
+ * @param node_id The id of this router as it appears in trace lists.
+ */
+void qd_tracemask_set_self(qd_tracemask_t *tm, const char *node_id);
+
 /**
  * qd_tracemask_del_router
  *
@@ -89,9 +100,10 @@ void qd_tracemask_remove_link(qd_tracemask_t *tm, int router_maskbit);
  *
  * @param tm Tracemask created by qd_tracemask()
  * @param tracelist The parsed field from a message's trace header
+ * @param looped If not null, set to true if this router is in the list
  * @return A new bit mask with a set-bit for each neighbor router in the list.  This must be freed
  *         by the caller when the caller is done with it.
  */
-qd_bitmask_t *qd_tracemask_create(qd_tracemask_t *tm, qd_parsed_field_t *tracelist);
+qd_bitmask_t *qd_tracemask_create(qd_tracemask_t *tm, qd_parsed_field_t *tracelist, bool *looped);
 
 #endif
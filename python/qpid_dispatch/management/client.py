@@ -204,7 +204,7 @@ class Node(object):
         def __repr__(self):
             return "QueryResponse(attribute_names=%r, results=%r"%(self.attribute_names, self.results)
 
-    def query(self, type=None, attribute_names=None, offset=None, count=None):
+    def query(self, type=None, attribute_names=None, offset=None, count=None, where=None):
         """
         Send an AMQP management query message and return the response.
         At least one of type, attribute_names must be specified.
@@ -212,11 +212,16 @@ class Node(object):
         @keyword attribute_names: A list of attribute names to query.
         @keyword offset: An integer offset into the list of results to return.
         @keyword count: A count of the maximum number of results to return.
+        @keyword where: A list of [attribute, operator, value] clauses the router
+            applies before returning results. Operators are ==, !=, <, <=, >, >=
+            and prefix.
         @return: A L{QueryResponse}
         """
+        body = {u'attributeNames': attribute_names or []}
+        if where:
+            body[u'where'] = where
         request = self.node_request(
-            {u'attributeNames': attribute_names or []},
-            operation=u'QUERY', entityType=type, offset=offset, count=count)
+            body, operation=u'QUERY', entityType=type, offset=offset, count=count)
 
         response = self.call(request)
         return Node.QueryResponse(self, response.body[u'attributeNames'], response.body[u'results'])
@@ -304,3 +309,7 @@ class Node(object):
 
     def get_log(self, limit=None, type=None):
         return self.call(self.node_request(operation=u"GET-LOG", entityType=type, limit=limit)).body
+
+    def get_log_ring(self, module=None, limit=None, type=None):
+        return self.call(self.node_request(operation=u"GET-LOG-RING", entityType=type,
+                                           module=module, limit=limit)).body
@@ -56,6 +56,9 @@ class QdDll(ctypes.PyDLL):
         self._prototype(self.qd_error_message, c_char_p, [], check=False)
 
         self._prototype(self.qd_log_entity, c_long, [py_object])
+        if hasattr(self, 'qd_entity_configure_allocator'): # Absent when built without memory pools
+            self._prototype(self.qd_entity_configure_allocator, c_long, [py_object])
+        self._prototype(self.qd_entity_configure_profiler, c_long, [py_object])
         self._prototype(self.qd_dispatch_configure_container, None, [self.qd_dispatch_p, py_object])
         self._prototype(self.qd_dispatch_configure_router, None, [self.qd_dispatch_p, py_object])
         self._prototype(self.qd_dispatch_prepare, None, [self.qd_dispatch_p])
@@ -73,12 +76,19 @@ class QdDll(ctypes.PyDLL):
         self._prototype(self.qd_dispatch_configure_address, None, [self.qd_dispatch_p, py_object])
         self._prototype(self.qd_dispatch_configure_link_route, None, [self.qd_dispatch_p, py_object])
         self._prototype(self.qd_dispatch_configure_auto_link, None, [self.qd_dispatch_p, py_object])
+        self._prototype(self.qd_dispatch_configure_begin, None, [self.qd_dispatch_p], check=False)
+        self._prototype(self.qd_dispatch_configure_end, None, [self.qd_dispatch_p], check=False)
 
         self._prototype(self.qd_dispatch_configure_policy, None, [self.qd_dispatch_p, py_object])
         self._prototype(self.qd_dispatch_register_policy_manager, None, [self.qd_dispatch_p, py_object])
         self._prototype(self.qd_dispatch_policy_c_counts_alloc, c_long, [], check=False)
         self._prototype(self.qd_dispatch_policy_c_counts_free, None, [c_long], check=False)
         self._prototype(self.qd_dispatch_policy_c_counts_refresh, None, [c_long, py_object])
+        self._prototype(self.qd_dispatch_policy_c_counts_limits, None, [c_long, c_long, c_long, c_long], check=False)
+        self._prototype(self.qd_dispatch_policy_cache_clear, None, [self.qd_dispatch_p], check=False)
+        self._prototype(self.qd_dispatch_policy_cache_drain, py_object, [self.qd_dispatch_p])
+        self._prototype(self.qd_dispatch_policy_set_hosts, None, [self.qd_dispatch_p, c_long, c_char_p, py_object])
+        self._prototype(self.qd_dispatch_policy_clear_hosts, None, [self.qd_dispatch_p, c_long], check=False)
 
         self._prototype(self.qd_dispatch_register_display_name_service, None, [self.qd_dispatch_p, py_object])
 
@@ -94,6 +104,7 @@ class QdDll(ctypes.PyDLL):
         self._prototype(self.qd_entity_refresh_end, None, [])
 
         self._prototype(self.qd_log_recent_py, py_object, [c_long])
+        self._prototype(self.qd_log_ring_py, py_object, [c_char_p, c_long])
 
     def _errcheck(self, result, func, args):
         if self.qd_error_code():
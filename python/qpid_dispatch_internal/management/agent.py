@@ -64,6 +64,7 @@ data that may be updated in other threads.
 
 import traceback, json, pstats
 from itertools import ifilter, chain
+from collections import OrderedDict
 from traceback import format_exc
 from threading import Lock
 from cProfile import Profile
@@ -74,7 +75,7 @@ from ..dispatch import IoAdapter, LogAdapter, LOG_INFO, LOG_WARNING, LOG_DEBUG,
 from qpid_dispatch.management.error import ManagementError, OK, CREATED, NO_CONTENT, STATUS_TEXT, \
     BadRequestStatus, InternalServerErrorStatus, NotImplementedStatus, NotFoundStatus, ForbiddenStatus
 from qpid_dispatch.management.entity import camelcase
-from .schema import ValidationError, SchemaEntity, EntityType
+from .schema import ValidationError, SchemaEntity, EntityType, UniqueIndex
 from .qdrouter import QdSchema
 from ..router.message import Message
 from ..router.address import Address
@@ -362,7 +363,8 @@ class SslProfileEntity(EntityAdapter):
 class ListenerEntity(EntityAdapter):
     def create(self):
         config_listener = self._qd.qd_dispatch_configure_listener(self._dispatch, self)
-        self._qd.qd_connection_manager_start(self._dispatch)
+        if not self._agent.connections_deferred:
+            self._qd.qd_connection_manager_start(self._dispatch)
         return config_listener
 
     def _identifier(self):
@@ -377,7 +379,8 @@ class ListenerEntity(EntityAdapter):
 class ConnectorEntity(EntityAdapter):
     def create(self):
         config_connector = self._qd.qd_dispatch_configure_connector(self._dispatch, self)
-        self._qd.qd_connection_manager_start(self._dispatch)
+        if not self._agent.connections_deferred:
+            self._qd.qd_connection_manager_start(self._dispatch)
         return config_connector
 
     def _delete(self):
@@ -498,6 +501,14 @@ class RouterAddressEntity(EntityAdapter):
         return super(RouterAddressEntity, self).__str__().replace("Entity(", "RouterAddressEntity(")
 
 
+class RouterCoreActionEntity(EntityAdapter):
+    def _identifier(self):
+        return self.attributes.get('label')
+
+    def __str__(self):
+        return super(RouterCoreActionEntity, self).__str__().replace("Entity(", "RouterCoreActionEntity(")
+
+
 class ConnectionEntity(EntityAdapter):
     def _identifier(self):
         return self.attributes.get('host') + ":" + str(self.attributes.get('identity'))
@@ -514,46 +525,75 @@ class LogStatsEntity(EntityAdapter):
         return super(LogStatsEntity, self).__str__().replace("Entity(", "LogStatsEntity(")
 
 
+class WorkerThreadEntity(EntityAdapter):
+    def _identifier(self):
+        return self.attributes.get('identity')
+
+    def __str__(self):
+        return super(WorkerThreadEntity, self).__str__().replace("Entity(", "WorkerThreadEntity(")
+
+
+class PythonLockEntity(EntityAdapter):
+    def _identifier(self):
+        return self.attributes.get('identity')
+
+    def __str__(self):
+        return super(PythonLockEntity, self).__str__().replace("Entity(", "PythonLockEntity(")
+
+
 class AllocatorEntity(EntityAdapter):
     def _identifier(self):
         return self.attributes.get('typeName')
 
+    def _update(self):
+        self._qd.qd_entity_configure_allocator(self)
+
     def __str__(self):
         return super(AllocatorEntity, self).__str__().replace("Entity(", "AllocatorEntity(")
 
 
+class ProfilerEntity(EntityAdapter):
+    def _update(self):
+        self._qd.qd_entity_configure_profiler(self)
+
+    def __str__(self):
+        return super(ProfilerEntity, self).__str__().replace("Entity(", "ProfilerEntity(")
+
+
 class EntityCache(object):
     """
     Searchable cache of entities, can be refreshed from implementation objects.
     """
 
     def __init__(self, agent):
-        self.entities = []
+        self.entities = OrderedDict() # id(entity) -> entity, in order of addition
         self.implementations = {}
         self.agent = agent
         self.qd = self.agent.qd
         self.schema = agent.schema
+        self.index = UniqueIndex(self.schema) # Unique values of the entities, for validate_add
         self.log = self.agent.log
 
     def map_filter(self, function, test):
         """Filter with test then apply function."""
-        return map(function, ifilter(test, self.entities))
+        return map(function, ifilter(test, self.entities.itervalues()))
 
     def map_type(self, function, type):
         """Apply function to all entities of type, if type is None do all entities"""
         if type is None:
-            return map(function, self.entities)
+            return map(function, self.entities.itervalues())
         else:
             if not isinstance(type, EntityType): type = self.schema.entity_type(type)
-            return map(function, ifilter(lambda e: e.entity_type.is_a(type), self.entities))
+            return map(function, ifilter(lambda e: e.entity_type.is_a(type), self.entities.itervalues()))
 
     def add(self, entity):
         """Add an entity to the agent"""
         self.log(LOG_DEBUG, "Add entity: %s" % entity)
         entity.validate()       # Fill in defaults etc.
         # Validate in the context of the existing entities for uniqueness
-        self.schema.validate_add(entity, self.entities)
-        self.entities.append(entity)
+        self.schema.validate_add(entity, self.entities.itervalues(), self.index)
+        self.entities[id(entity)] = entity
+        self.index.add(entity)
 
     def _add_implementation(self, implementation, adapter=None):
         """Create an adapter to wrap the implementation object and add it"""
@@ -570,10 +610,11 @@ class EntityCache(object):
 
     def _remove(self, entity):
         try:
-            self.entities.remove(entity)
+            del self.entities[id(entity)]
+            self.index.remove(entity)
             self.log(LOG_DEBUG, "Remove %s entity: %s" %
                      (entity.entity_type.short_name, entity.attributes['identity']))
-        except ValueError: pass
+        except KeyError: pass
 
     def remove(self, entity):
         self._remove(entity)
@@ -587,8 +628,12 @@ class EntityCache(object):
     def remove_implementation(self, key):
         self._remove_implementation(key)
 
-    def refresh_from_c(self):
-        """Refresh entities from the C dispatch runtime"""
+    def refresh_from_c(self, type=None):
+        """
+        Apply the entities added and removed by the C dispatch runtime, then
+        refresh the values of existing entities of type, or of all entities if
+        type is None.  Newly added entities are refreshed as they are added.
+        """
         REMOVE, ADD = 0, 1
 
         def remove_redundant(events):
@@ -618,7 +663,11 @@ class EntityCache(object):
                     entity_type = self.schema.entity_type(type)
                     self._add_implementation(CImplementation(self.qd, entity_type, pointer))
             # Refresh the entity values while the lock is still held.
-            for e in self.entities: e._refresh()
+            if type is None:
+                for e in self.entities.itervalues(): e._refresh()
+            else:
+                for e in self.entities.itervalues():
+                    if e.entity_type.is_a(type): e._refresh()
         finally:
             self.qd.qd_entity_refresh_end()
             self.qd.qd_dispatch_router_unlock(self.agent.dispatch)
@@ -656,8 +705,12 @@ class ManagementEntity(EntityAdapter):
         else:
             names = all_attrs
 
+        where = self._where(request.body.get('where'))
+
         results = []
         def add_result(entity):
+            if not all(test(entity.attributes.get(name)) for name, test in where):
+                return
             result = []
             non_empty = False
             for name in names:
@@ -668,6 +721,26 @@ class ManagementEntity(EntityAdapter):
         self._agent.entities.map_type(add_result, entity_type)
         return (OK, {'attributeNames': list(names), 'results': results})
 
+    WHERE_OPS = {
+        '==': lambda a, b: a == b,
+        '!=': lambda a, b: a != b,
+        '<': lambda a, b: a is not None and a < b,
+        '<=': lambda a, b: a is not None and a <= b,
+        '>': lambda a, b: a is not None and a > b,
+        '>=': lambda a, b: a is not None and a >= b,
+        'prefix': lambda a, b: isinstance(a, basestring) and a.startswith(b)
+    }
+
+    def _where(self, where):
+        """Convert a query's 'where' list of [attribute, operator, value] into (name, test) pairs"""
+        if not where:
+            return []
+        try:
+            return [(name, (lambda op, value: lambda a: op(a, value))(self.WHERE_OPS[op], value))
+                    for name, op, value in where]
+        except (KeyError, TypeError, ValueError):
+            raise BadRequestStatus("Invalid 'where' list: %s" % (where,))
+
     def get_types(self, request):
         type = self.requested_type(request)
         return (OK, dict((t.name, [b.name for b in t.all_bases])
@@ -713,6 +786,11 @@ class ManagementEntity(EntityAdapter):
         logs = self._qd.qd_log_recent_py(self._intprop(request, "limit") or -1)
         return (OK, logs)
 
+    def get_log_ring(self, request):
+        module = request.properties.get("module")
+        logs = self._qd.qd_log_ring_py(module and str(module), self._intprop(request, "limit") or -1)
+        return (OK, logs)
+
     def profile(self, request):
         """Start/stop the python profiler, returns profile results"""
         profile = self.__dict__.get("_profile")
@@ -752,6 +830,7 @@ class Agent(object):
         self.dispatch = dispatch
         self.schema = QdSchema()
         self.entities = EntityCache(self)
+        self.connections_deferred = False # configure_dispatch starts the configured listeners and connectors
         self.request_lock = Lock()
         self.log_adapter = LogAdapter("AGENT")
         self.policy = PolicyManager(self)
@@ -816,7 +895,7 @@ class Agent(object):
         # Coarse locking, handle one request at a time.
         with self.request_lock:
             try:
-                self.entities.refresh_from_c()
+                self.entities.refresh_from_c(self.refresh_type(request))
                 self.log(LOG_DEBUG, "Agent request %s"% request)
                 status, body = self.handle(request)
                 self.respond(request, status=status, body=body)
@@ -827,6 +906,14 @@ class Agent(object):
             except Exception, e:
                 error(InternalServerErrorStatus("%s: %s"%(type(e).__name__, e)), format_exc())
 
+    def refresh_type(self, request):
+        """The entity type a request needs refreshed, or None if it may touch any entity"""
+        type = request.properties.get('entityType')
+        if not type or request.properties.get('operation') != 'QUERY':
+            return None
+        try: return self.schema.entity_type(type)
+        except ValidationError: return None
+
     def entity_type(self, type):
         try: return self.schema.entity_type(type)
         except ValidationError, e: raise NotFoundStatus(str(e))
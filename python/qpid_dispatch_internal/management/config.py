@@ -137,10 +137,11 @@ def configure_dispatch(dispatch, lib_handle, filename):
     agent = Agent(dispatch, qd)
     qd.qd_dispatch_set_agent(dispatch, agent)
 
+    configured = set()
     def configure(attributes):
-        """Configure an entity and remove it from config"""
+        """Configure an entity and note it as done"""
         agent.configure(attributes)
-        config.remove(attributes)
+        configured.add(id(attributes))
 
     modules = set(agent.schema.entity_type("log").attributes["module"].atype.tags)
     for l in config.by_type('log'):
@@ -163,30 +164,40 @@ def configure_dispatch(dispatch, lib_handle, filename):
     qd.qd_dispatch_register_display_name_service(dispatch, displayname_service)
     policyDir = config.by_type('policy')[0]['policyDir']
     policyDefaultVhost = config.by_type('policy')[0]['defaultVhost']
-    # Remaining configuration
-    for t in "sslProfile", "fixedAddress", "listener", "connector", "waypoint", "linkRoutePattern", \
-             "router.config.address", "router.config.linkRoute", "router.config.autoLink", \
-             "policy", "vhost":
-        for a in config.by_type(t):
-            configure(a)
-            if t == "sslProfile":
-                display_file_name = a.get('displayNameFile')
-                if display_file_name:
-                    ssl_profile_name = a.get('name')
-                    displayname_service.add(ssl_profile_name, display_file_name)
-
-    for e in config.entities:
-        configure(e)
-
-    # Load the vhosts from the .json files in policyDir
-    # Only vhosts are loaded. Other entities are silently discarded.
-    if not policyDir == '':
-        apath = os.path.abspath(policyDir)
-        for i in os.listdir(policyDir):
-            if i.endswith(".json"):
-                pconfig = PolicyConfig(os.path.join(apath, i))
-                for a in pconfig.by_type("vhost"):
-                    agent.configure(a)
-
-    # Set policy default application after all rulesets loaded
-    agent.policy.set_default_vhost(policyDefaultVhost)
+    # Remaining configuration.  The core actions of the entities are handed to the core
+    # together, and listeners and connectors are started only once the core has built
+    # its address and route tables from them.
+    agent.connections_deferred = True
+    qd.qd_dispatch_configure_begin(dispatch)
+    try:
+        for t in "sslProfile", "fixedAddress", "listener", "connector", "waypoint", "linkRoutePattern", \
+                 "router.config.address", "router.config.linkRoute", "router.config.autoLink", \
+                 "policy", "vhost":
+            for a in config.by_type(t):
+                configure(a)
+                if t == "sslProfile":
+                    display_file_name = a.get('displayNameFile')
+                    if display_file_name:
+                        ssl_profile_name = a.get('name')
+                        displayname_service.add(ssl_profile_name, display_file_name)
+
+        for e in config.entities:
+            if id(e) not in configured:
+                configure(e)
+
+        # Load the vhosts from the .json files in policyDir
+        # Only vhosts are loaded. Other entities are silently discarded.
+        if not policyDir == '':
+            apath = os.path.abspath(policyDir)
+            for i in os.listdir(policyDir):
+                if i.endswith(".json"):
+                    pconfig = PolicyConfig(os.path.join(apath, i))
+                    for a in pconfig.by_type("vhost"):
+                        agent.configure(a)
+
+        # Set policy default application after all rulesets loaded
+        agent.policy.set_default_vhost(policyDefaultVhost)
+    finally:
+        qd.qd_dispatch_configure_end(dispatch)
+        agent.connections_deferred = False
+    qd.qd_connection_manager_start(dispatch)
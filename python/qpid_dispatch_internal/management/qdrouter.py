@@ -44,24 +44,41 @@ class QdSchema(schema.Schema):
         self.configuration_entity = self.entity_type(self.CONFIGURATION_ENTITY)
         self.operational_entity = self.entity_type(self.OPERATIONAL_ENTITY)
 
-    def validate_add(self, attributes, entities):
+    def validate_add(self, attributes, entities, index=None):
         """
         Check that listeners and connectors can only have role=inter-router if the router has
-        mode=interior.
+        mode=interior, and role=edge if it has mode=interior or mode=edge.
+        Only a router or a listener or connector in one of those roles can break the rule,
+        and with an index the latter need only be checked against the router.
         """
-        entities = list(entities) # Iterate twice
-        super(QdSchema, self).validate_add(attributes, entities)
+        if index is None:
+            entities = list(entities) # Iterate twice
+        super(QdSchema, self).validate_add(attributes, entities, index)
+        short_type = self.short_name(attributes['type'])
+        if short_type == "router":
+            entities = list(entities)
+        elif short_type in ["listener", "connector"] and attributes['role'] in ["inter-router", "edge"]:
+            if index is not None:
+                router = index.singletons.get(self.long_name("router"))
+                entities = [router] if router is not None else []
+        else:
+            return
         entities.append(attributes)
-        inter_router = not_interior = None
+        inter_router = edge = mode = None
         for e in entities:
             short_type = self.short_name(e['type'])
-            if short_type == "router" and e['mode'] != "interior":
-                not_interior = e['mode']
+            if short_type == "router":
+                mode = e['mode']
             if short_type in ["listener", "connector"] and e['role'] == "inter-router":
                 inter_router = e
-            if not_interior and inter_router:
+            if short_type in ["listener", "connector"] and e['role'] == "edge":
+                edge = e
+            if mode and mode != "interior" and inter_router:
                 raise schema.ValidationError(
                     "role='inter-router' only allowed with router mode='interior' for %s." % inter_router)
+            if mode == "standalone" and edge:
+                raise schema.ValidationError(
+                    "role='edge' only allowed with router mode='interior' or 'edge' for %s." % edge)
 
     def is_configuration(self, entity_type):
         return entity_type and self.configuration_entity in entity_type.all_bases
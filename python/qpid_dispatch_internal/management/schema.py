@@ -518,14 +518,17 @@ class Schema(object):
         Validate all the entities from entity_iter, return a list of valid entities.
         """
         entities = []
+        index = UniqueIndex(self)
         for a in attribute_maps:
-            self.validate_add(a, entities)
+            self.validate_add(a, entities, index)
             entities.append(a);
+            index.add(a)
 
-    def validate_add(self, attributes, entities):
+    def validate_add(self, attributes, entities, index=None):
         """
         Validate that attributes would be valid when added to entities.
         Assumes entities are already valid
+        @param index: Optional L{UniqueIndex} of entities, used instead of a scan of entities.
         @raise ValidationError if adding e violates a global constraint like uniqueness.
         """
         self.validate_entity(attributes)
@@ -534,6 +537,18 @@ class Schema(object):
         unique = [a for a in entity_type.attributes.values() if a.unique and a.name in attributes]
         if not unique and not entity_type.singleton:
             return              # Nothing to do
+        if index is not None:
+            e = index.singletons.get(attributes['type'])
+            if entity_type.singleton and e is not None:
+                raise ValidationError("Adding %s singleton %s when %s already exists" %
+                                      (attributes['type'], attributes, e))
+            for a in unique:
+                e = index.values.get((a.name, attributes[a.name]))
+                if e is not None:
+                    raise ValidationError(
+                        "adding %s duplicates unique attribute '%s' from existing %s"%
+                        (attributes, a.name, e))
+            return
         for e in entities:
             if entity_type.singleton and attributes['type'] == e['type']:
                 raise ValidationError("Adding %s singleton %s when %s already exists" %
@@ -569,6 +584,35 @@ class Schema(object):
         else:
             return self.filter(lambda t: t.is_a(type))
 
+class UniqueIndex(object):
+    """
+    Index of the unique attribute values and singletons of a set of valid entities,
+    so L{Schema.validate_add} can check a new entity without a scan of them all.
+    """
+
+    def __init__(self, schema):
+        self.schema = schema
+        self.values = {}        # (attribute name, value) -> entity
+        self.singletons = {}    # long type name -> entity
+        self.keys = {}          # id(entity) -> keys of entity in values, as they were added
+
+    def add(self, entity):
+        entity_type = self.schema.entity_type(entity['type'])
+        keys = [(a.name, entity[a.name]) for a in entity_type.attributes.itervalues()
+                if a.unique and a.name in entity]
+        for k in keys:
+            self.values.setdefault(k, entity)
+        self.keys[id(entity)] = keys
+        if entity_type.singleton:
+            self.singletons.setdefault(entity['type'], entity)
+
+    def remove(self, entity):
+        for k in self.keys.pop(id(entity), []):
+            if self.values.get(k) is entity:
+                del self.values[k]
+        if self.singletons.get(entity['type']) is entity:
+            del self.singletons[entity['type']]
+
 class SchemaEntity(EntityBase):
     """A map of attributes associated with an L{EntityType}"""
     def __init__(self, entity_type, attributes=None, validate=True, **kwattrs):
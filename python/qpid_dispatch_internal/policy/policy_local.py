@@ -47,6 +47,8 @@ class PolicyKeys(object):
     KW_MAXCONNPERUSER              = "maxConnectionsPerUser"
     KW_CONNECTION_ALLOW_DEFAULT    = "allowUnknownUser"
     KW_GROUPS                      = "groups"
+    KW_VHOST_MAX_MESSAGE_RATE      = "maxMessageRate"
+    KW_VHOST_MAX_BYTE_RATE         = "maxByteRate"
 
     # Policy settings key words
     KW_USERS                    = "users"
@@ -62,6 +64,10 @@ class PolicyKeys(object):
     KW_ALLOW_USERID_PROXY       = "allowUserIdProxy"
     KW_SOURCES                  = "sources"
     KW_TARGETS                  = "targets"
+    KW_MAX_MESSAGE_RATE         = "maxMessageRate"
+    KW_MAX_BYTE_RATE            = "maxByteRate"
+    KW_MAX_USER_MESSAGE_RATE    = "maxUserMessageRate"
+    KW_MAX_USER_BYTE_RATE       = "maxUserByteRate"
 
     # Policy stats key words
     KW_CONNECTIONS_APPROVED     = "connectionsApproved"
@@ -85,6 +91,10 @@ class PolicyKeys(object):
 
     # policy stats controlled by C code but referenced by settings
     KW_CSTATS                   = "denialCounts"
+
+    # vhost rate limits handed to C with a user's settings
+    KW_SETTINGS_VHOST_MESSAGE_RATE = "vhostMaxMessageRate"
+    KW_SETTINGS_VHOST_BYTE_RATE    = "vhostMaxByteRate"
 #
 #
 class PolicyCompiler(object):
@@ -105,7 +115,9 @@ class PolicyCompiler(object):
         PolicyKeys.KW_MAXCONNPERHOST,
         PolicyKeys.KW_MAXCONNPERUSER,
         PolicyKeys.KW_CONNECTION_ALLOW_DEFAULT,
-        PolicyKeys.KW_GROUPS
+        PolicyKeys.KW_GROUPS,
+        PolicyKeys.KW_VHOST_MAX_MESSAGE_RATE,
+        PolicyKeys.KW_VHOST_MAX_BYTE_RATE
         ]
 
     allowed_settings_options = [
@@ -121,7 +133,11 @@ class PolicyCompiler(object):
         PolicyKeys.KW_ALLOW_ANONYMOUS_SENDER,
         PolicyKeys.KW_ALLOW_USERID_PROXY,
         PolicyKeys.KW_SOURCES,
-        PolicyKeys.KW_TARGETS
+        PolicyKeys.KW_TARGETS,
+        PolicyKeys.KW_MAX_MESSAGE_RATE,
+        PolicyKeys.KW_MAX_BYTE_RATE,
+        PolicyKeys.KW_MAX_USER_MESSAGE_RATE,
+        PolicyKeys.KW_MAX_USER_BYTE_RATE
         ]
 
     def __init__(self):
@@ -224,6 +240,10 @@ class PolicyCompiler(object):
         policy_out[PolicyKeys.KW_ALLOW_USERID_PROXY] = False
         policy_out[PolicyKeys.KW_SOURCES] = ''
         policy_out[PolicyKeys.KW_TARGETS] = ''
+        policy_out[PolicyKeys.KW_MAX_MESSAGE_RATE] = 0
+        policy_out[PolicyKeys.KW_MAX_BYTE_RATE] = 0
+        policy_out[PolicyKeys.KW_MAX_USER_MESSAGE_RATE] = 0
+        policy_out[PolicyKeys.KW_MAX_USER_BYTE_RATE] = 0
 
         cerror = []
         for key, val in policy_in.iteritems():
@@ -235,7 +255,11 @@ class PolicyCompiler(object):
                        PolicyKeys.KW_MAX_RECEIVERS,
                        PolicyKeys.KW_MAX_SENDERS,
                        PolicyKeys.KW_MAX_SESSION_WINDOW,
-                       PolicyKeys.KW_MAX_SESSIONS
+                       PolicyKeys.KW_MAX_SESSIONS,
+                       PolicyKeys.KW_MAX_MESSAGE_RATE,
+                       PolicyKeys.KW_MAX_BYTE_RATE,
+                       PolicyKeys.KW_MAX_USER_MESSAGE_RATE,
+                       PolicyKeys.KW_MAX_USER_BYTE_RATE
                        ]:
                 if not self.validateNumber(val, 0, 0, cerror):
                     errors.append("Policy vhost '%s' user group '%s' option '%s' has error '%s'." %
@@ -302,6 +326,8 @@ class PolicyCompiler(object):
         policy_out[PolicyKeys.KW_MAXCONNPERUSER] = 65535
         policy_out[PolicyKeys.KW_CONNECTION_ALLOW_DEFAULT] = False
         policy_out[PolicyKeys.KW_GROUPS] = {}
+        policy_out[PolicyKeys.KW_VHOST_MAX_MESSAGE_RATE] = 0
+        policy_out[PolicyKeys.KW_VHOST_MAX_BYTE_RATE] = 0
 
         # validate the options
         for key, val in policy_in.iteritems():
@@ -318,6 +344,14 @@ class PolicyCompiler(object):
                     errors.append(msg)
                     return False
                 policy_out[key] = val
+            elif key in [PolicyKeys.KW_VHOST_MAX_MESSAGE_RATE,
+                         PolicyKeys.KW_VHOST_MAX_BYTE_RATE
+                         ]:
+                if not self.validateNumber(val, 0, 0, cerror):
+                    errors.append("Policy vhost '%s' option '%s' has error '%s'." %
+                                  (name, key, cerror[0]))
+                    return False
+                policy_out[key] = val
             elif key in [PolicyKeys.KW_CONNECTION_ALLOW_DEFAULT]:
                 if not type(val) is bool:
                     errors.append("Policy vhost '%s' option '%s' must be of type 'bool' but is '%s'" %
@@ -377,8 +411,31 @@ class AppStats(object):
                 ruleset[PolicyKeys.KW_MAXCONNPERUSER],
                 ruleset[PolicyKeys.KW_MAXCONNPERHOST])
         self._cstats = self._manager.get_agent().qd.qd_dispatch_policy_c_counts_alloc()
+        self._set_c_limits(ruleset)
         self._manager.get_agent().add_implementation(self, "vhostStats")
 
+    def _set_c_limits(self, ruleset):
+        self._manager.get_agent().qd.qd_dispatch_policy_c_counts_limits(
+            self._cstats,
+            ruleset[PolicyKeys.KW_MAXCONN],
+            ruleset[PolicyKeys.KW_MAXCONNPERUSER],
+            ruleset[PolicyKeys.KW_MAXCONNPERHOST])
+
+    def set_c_hosts(self, ruleset):
+        """
+        Give C the remote host ranges of each user group so it can
+        match the hosts of connections it approves from its lookup cache.
+        """
+        agent = self._manager.get_agent()
+        agent.qd.qd_dispatch_policy_clear_hosts(agent.dispatch, self._cstats)
+        for usergroup, groupsettings in ruleset[PolicyKeys.KW_GROUPS].iteritems():
+            ranges = [h.c_range() for h in groupsettings.get(PolicyKeys.KW_REMOTE_HOSTS, [])]
+            agent.qd.qd_dispatch_policy_set_hosts(agent.dispatch, self._cstats, usergroup, ranges)
+
+    def clear_c_hosts(self):
+        agent = self._manager.get_agent()
+        agent.qd.qd_dispatch_policy_clear_hosts(agent.dispatch, self._cstats)
+
     def update_ruleset(self, ruleset):
         """
         The parent ruleset has changed.
@@ -388,11 +445,13 @@ class AppStats(object):
         """
         self.conn_mgr.update(
             ruleset[PolicyKeys.KW_MAXCONN],
-            ruleset[PolicyKeys.KW_MAXCONNPERHOST],
-            ruleset[PolicyKeys.KW_MAXCONNPERUSER])
+            ruleset[PolicyKeys.KW_MAXCONNPERUSER],
+            ruleset[PolicyKeys.KW_MAXCONNPERHOST])
+        self._set_c_limits(ruleset)
 
     def refresh_entity(self, attributes):
         """Refresh management attributes"""
+        self._manager.sync_cached_connections()
         entitymap = {}
         entitymap[PolicyKeys.KW_VHOST_NAME] =     self.my_id
         entitymap[PolicyKeys.KW_CONNECTIONS_APPROVED] = self.conn_mgr.connections_approved
@@ -406,6 +465,9 @@ class AppStats(object):
     def can_connect(self, conn_id, user, host, diags):
         return self.conn_mgr.can_connect(conn_id, user, host, diags)
 
+    def register(self, conn_id, user, host):
+        self.conn_mgr.register(conn_id, user, host)
+
     def disconnect(self, conn_id, user, host):
         self.conn_mgr.disconnect(conn_id, user, host)
 
@@ -501,6 +563,7 @@ class PolicyLocal(object):
         else:
             self.statsdb[name].update_ruleset(candidate)
             self._manager.log_info("Updated policy rules for vhost %s" % name)
+        self.statsdb[name].set_c_hosts(candidate)
         # TODO: ruleset lock
         self.rulesetdb[name] = {}
         self.rulesetdb[name].update(candidate)
@@ -514,6 +577,7 @@ class PolicyLocal(object):
             raise PolicyError("Policy '%s' does not exist" % name)
         # TODO: ruleset lock
         del self.rulesetdb[name]
+        self.statsdb[name].clear_c_hosts()
 
     #
     # db enumerator
@@ -668,11 +732,31 @@ class PolicyLocal(object):
                 return False
 
             upolicy.update(ruleset[PolicyKeys.KW_GROUPS][groupname])
+            upolicy[PolicyKeys.KW_SETTINGS_VHOST_MESSAGE_RATE] = ruleset.get(PolicyKeys.KW_VHOST_MAX_MESSAGE_RATE, 0)
+            upolicy[PolicyKeys.KW_SETTINGS_VHOST_BYTE_RATE] = ruleset.get(PolicyKeys.KW_VHOST_MAX_BYTE_RATE, 0)
             upolicy[PolicyKeys.KW_CSTATS] = self.statsdb[vhost].get_cstats()
             return True
         except Exception, e:
             return False
 
+    def register_cached_connection(self, conn_id, conn_name, user, rhost, cstats):
+        """
+        Account for a connection the C lookup cache approved without
+        calling lookup_user.
+        @param[in] conn_id internal connection id
+        @param[in] conn_name connection name used for tracking reports
+        @param[in] user connection authId
+        @param[in] rhost connection remote host numeric IP address as string
+        @param[in] cstats the C counts block of the connection's vhost
+        """
+        for vhost, stats in self.statsdb.iteritems():
+            if stats.get_cstats() == cstats:
+                stats.register(conn_name, user, rhost)
+                self._connections[conn_id] = ConnectionFacts(user, rhost, vhost, conn_name)
+                return
+        self._manager.log_trace(
+            "Policy internal error registering cached connection id %s: no vhost stats" % conn_id)
+
     def close_connection(self, conn_id):
         """
         Close the connection.
@@ -67,6 +67,27 @@ class PolicyManager(object):
     def get_agent(self):
         return self._agent
 
+    #
+    # C lookup cache
+    #
+    def _clear_cache(self):
+        """
+        Drop the lookups cached in C, they may no longer match the policy.
+        """
+        self._agent.qd.qd_dispatch_policy_cache_clear(self._agent.dispatch)
+
+    def sync_cached_connections(self):
+        """
+        Account for the connections C approved from its lookup cache, and
+        for those that closed, since the last sync. Must be called before
+        the connection tables are used.
+        """
+        opens, closes = self._agent.qd.qd_dispatch_policy_cache_drain(self._agent.dispatch)
+        for conn_id, conn_name, user, rhost, cstats in opens:
+            self._policy_local.register_cached_connection(conn_id, conn_name, user, rhost, cstats)
+        for conn_id in closes:
+            self._policy_local.close_connection(conn_id)
+
     #
     # Management interface to create a ruleset
     #
@@ -76,6 +97,7 @@ class PolicyManager(object):
         @param[in] attributes: from config
         """
         self._policy_local.create_ruleset(attributes)
+        self._clear_cache()
 
     #
     # Management interface to delete a ruleset
@@ -86,6 +108,7 @@ class PolicyManager(object):
         @param[in] id: ruleset name
         """
         self._policy_local.policy_delete(id)
+        self._clear_cache()
 
     #
     # Management interface to update a ruleset
@@ -96,6 +119,7 @@ class PolicyManager(object):
         @param[in] id: ruleset name
         """
         self._policy_local.create_ruleset(attributes)
+        self._clear_cache()
 
     #
     # Management interface to set the default vhost
@@ -107,6 +131,7 @@ class PolicyManager(object):
         @return:
         """
         self._policy_local.set_default_vhost(name)
+        self._clear_cache()
 
     #
     # Runtime query interface
@@ -124,6 +149,7 @@ class PolicyManager(object):
         @param[in] conn_id internal connection id
         @return settings user-group name if allowed; "" if not allowed
         """
+        self.sync_cached_connections()
         return self._policy_local.lookup_user(user, rhost, vhost, conn_name, conn_id)
 
     def lookup_settings(self, vhost, name, upolicy):
@@ -143,6 +169,7 @@ class PolicyManager(object):
         @param facts:
         @return: none
         """
+        self.sync_cached_connections()
         self._policy_local.close_connection(conn_id)
 #
 #
@@ -206,6 +206,15 @@ class HostAddr(object):
                 ("Wrong type. Expected HostStruct but received %s" % candidate.__class__.__name__)
             return False
 
+    def c_range(self):
+        """
+        The range as the C host tree takes it
+        @return None for the wildcard; else (lowest, highest) packed binary addresses
+        """
+        if self.wildcard:
+            return None
+        return (self.hoststructs[0].binary, self.hoststructs[-1].binary)
+
     def match_str(self, candidate):
         """
         Does the candidate string match the IP or range represented by this?
@@ -304,14 +313,7 @@ class PolicyAppConnectionMgr(object):
         allowbyhost  = n_host < self.max_per_host
 
         if allowbytotal and allowbyuser and allowbyhost:
-            if not user in self.per_user_state:
-                self.per_user_state[user] = []
-            self.per_user_state[user].append(conn_id)
-            if not host in self.per_host_state:
-                self.per_host_state[host] = []
-            self.per_host_state[host].append(conn_id)
-            self.connections_active += 1
-            self.connections_approved += 1
+            self.register(conn_id, user, host)
             return True
         else:
             if not allowbytotal:
@@ -323,6 +325,20 @@ class PolicyAppConnectionMgr(object):
             self.connections_denied += 1
             return False
 
+    def register(self, conn_id, user, host):
+        """
+        Add a connection already approved against the limits
+        to the connection tables.
+        """
+        if not user in self.per_user_state:
+            self.per_user_state[user] = []
+        self.per_user_state[user].append(conn_id)
+        if not host in self.per_host_state:
+            self.per_host_state[host] = []
+        self.per_host_state[host].append(conn_id)
+        self.connections_active += 1
+        self.connections_approved += 1
+
     def disconnect(self, conn_id, user, host):
         """
         Unregister a connection
@@ -21,7 +21,7 @@
 ## Define the current protocol version.  Any messages that do not contain version
 ## information shall be considered to be coming from routers using version 0.
 ##
-ProtocolVersion = 1L
+ProtocolVersion = 2L
 
 def getMandatory(data, key, cls=None):
     """
@@ -239,8 +239,13 @@ class MessageLSR(object):
 
 class MessageMAU(object):
     """
+    Mobile address update.  A differential MAU carries add/del lists that apply on top of
+    mobile_seq - 1, or on top of base_seq when that is present.  An absolute MAU carries
+    the whole exist list; a large one is split into parts numbered by chunk out of chunks.
+    base_seq, chunk and chunks are only sent to peers of protocol version 2 or later.
     """
-    def __init__(self, body, _id=None, _seq=None, _add_list=None, _del_list=None, _exist_list=None):
+    def __init__(self, body, _id=None, _seq=None, _add_list=None, _del_list=None, _exist_list=None,
+                 _base_seq=None, _chunk=None, _chunks=None):
         if body:
             self.id = getMandatory(body, 'id', str)
             self.version = getOptional(body, 'pv', 0, long)
@@ -249,6 +254,9 @@ class MessageMAU(object):
             self.add_list = getOptional(body, 'add', None, list)
             self.del_list = getOptional(body, 'del', None, list)
             self.exist_list = getOptional(body, 'exist', None, list)
+            self.base_seq = getOptional(body, 'base_seq', None, long)
+            self.chunk = getOptional(body, 'chunk', None, long)
+            self.chunks = getOptional(body, 'chunks', None, long)
         else:
             self.id = _id
             self.version = ProtocolVersion
@@ -257,6 +265,9 @@ class MessageMAU(object):
             self.add_list = _add_list
             self.del_list = _del_list
             self.exist_list = _exist_list
+            self.base_seq = None if _base_seq == None else long(_base_seq)
+            self.chunk = None if _chunk == None else long(_chunk)
+            self.chunks = None if _chunks == None else long(_chunks)
 
     def get_opcode(self):
         return 'MAU'
@@ -265,20 +276,27 @@ class MessageMAU(object):
         _add = ''
         _del = ''
         _exist = ''
+        _extra = ''
         if self.add_list != None:   _add   = ' add=%r'   % self.add_list
         if self.del_list != None:   _del   = ' del=%r'   % self.del_list
         if self.exist_list != None: _exist = ' exist=%r' % self.exist_list
-        return "MAU(id=%s pv=%d area=%s mobile_seq=%d%s%s%s)" % \
-                (self.id, self.version, self.area, self.mobile_seq, _add, _del, _exist)
+        if self.base_seq != None:   _extra += ' base_seq=%d' % self.base_seq
+        if self.chunks != None:     _extra += ' chunk=%d/%d' % (self.chunk, self.chunks)
+        return "MAU(id=%s pv=%d area=%s mobile_seq=%d%s%s%s%s)" % \
+                (self.id, self.version, self.area, self.mobile_seq, _extra, _add, _del, _exist)
 
     def to_dict(self):
         body = {'id'         : self.id,
                 'pv'         : self.version,
                 'area'       : self.area,
                 'mobile_seq' : self.mobile_seq }
-        if self.add_list != None:   body['add']   = self.add_list
-        if self.del_list != None:   body['del']   = self.del_list
-        if self.exist_list != None: body['exist'] = self.exist_list
+        if self.add_list != None:   body['add']      = self.add_list
+        if self.del_list != None:   body['del']      = self.del_list
+        if self.exist_list != None: body['exist']    = self.exist_list
+        if self.base_seq != None:   body['base_seq'] = self.base_seq
+        if self.chunks != None:
+            body['chunk']  = self.chunk
+            body['chunks'] = self.chunks
         return body
 
 
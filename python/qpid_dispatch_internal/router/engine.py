@@ -23,6 +23,7 @@ from link import LinkStateEngine
 from path import PathEngine
 from mobile import MobileAddressEngine
 from node import NodeTracker
+from snapshot import TopologySnapshot
 from message import Message
 
 from traceback import format_exc, extract_stack
@@ -73,6 +74,20 @@ class RouterEngine:
         self.link_state_engine     = LinkStateEngine(self)
         self.path_engine           = PathEngine(self)
         self.mobile_address_engine = MobileAddressEngine(self, self.node_tracker)
+        self.topology_snapshot     = None
+
+        ##
+        ## HELLOs and RAs that ask nothing new of this router are absorbed by the IoAdapters:
+        ## their repeats are not delivered here, only their times, once per tick.  The
+        ## absorbed messages are forgotten whenever the topology changes.
+        ##
+        self.absorbed            = {}  # key => (opcode, message)
+        self.absorbed_generation = self.node_tracker.generation
+
+        snapshot_file = self.config.attributes.get('topologySnapshotFile')
+        if snapshot_file:
+            self.topology_snapshot = TopologySnapshot(self, self.node_tracker, snapshot_file)
+            self.topology_snapshot.load(time.time())
 
 
     ##========================================================================================
@@ -95,7 +110,7 @@ class RouterEngine:
         """
         """
         try:
-            if addr[0] in 'MCD':
+            if addr[0] in 'MCDEF':
                 self.mobile_address_engine.add_local_address(addr)
         except Exception:
             self.log_ma(LOG_ERROR, "Exception in new-address processing\n%s" % format_exc(LOG_STACK_LIMIT))
@@ -104,42 +119,96 @@ class RouterEngine:
         """
         """
         try:
-            if addr[0] in 'MCD':
+            if addr[0] in 'MCDEF':
                 self.mobile_address_engine.del_local_address(addr)
         except Exception:
             self.log_ma(LOG_ERROR, "Exception in del-address processing\n%s" % format_exc(LOG_STACK_LIMIT))
 
+    def addressesChanged(self, added, removed):
+        """
+        A batch of local address changes from the core.  An address is in at most one of the lists.
+        """
+        for addr in removed:
+            self.addressRemoved(addr)
+        for addr in added:
+            self.addressAdded(addr)
+
     def linkLost(self, link_id):
         """
         """
-        self.node_tracker.link_lost(link_id)
+        self.router_adapter.begin_route_table()
+        try:
+            self.node_tracker.link_lost(link_id)
+        finally:
+            self.router_adapter.commit_route_table()
+            self._check_absorbed()
+
+
+    def _replay_absorbed(self):
+        """
+        Account for the repeats of the absorbed messages as if they had been received.
+        """
+        for io in self.io_adapter:
+            for key, link_id, cost, when in io.absorbed():
+                if key not in self.absorbed:
+                    continue
+                opcode, msg = self.absorbed[key]
+                if opcode == 'HELLO':
+                    self.hello_protocol.handle_hello(msg, when, link_id, cost)
+                else:
+                    self.link_state_engine.handle_ra(msg, when)
+
+
+    def _check_absorbed(self):
+        """
+        Forget the absorbed messages if the topology changed since they were absorbed.
+        """
+        if self.node_tracker.generation != self.absorbed_generation:
+            self.absorbed_generation = self.node_tracker.generation
+            self.absorbed.clear()
+            for io in self.io_adapter:
+                io.clear_absorbed()
 
 
     def handleTimerTick(self):
         """
         """
+        self.router_adapter.begin_route_table()
         try:
             now = time.time()
+            self._replay_absorbed()
             self.hello_protocol.tick(now)
             self.link_state_engine.tick(now)
             self.node_tracker.tick(now)
+            if self.topology_snapshot:
+                self.topology_snapshot.tick(now)
         except Exception:
             self.log(LOG_ERROR, "Exception in timer processing\n%s" % format_exc(LOG_STACK_LIMIT))
+        finally:
+            self.router_adapter.commit_route_table()
+            self._check_absorbed()
 
     def handleControlMessage(self, opcode, body, link_id, cost):
         """
+        Route-table changes caused by one control message reach the core as a single action.
+
+        Returns the absorption key of a HELLO or RA whose repeats need not be delivered.
         """
+        key = None
+        self.router_adapter.begin_route_table()
         try:
             now = time.time()
             if   opcode == 'HELLO':
                 msg = MessageHELLO(body)
                 self.log_hello(LOG_TRACE, "RCVD: %r" % msg)
                 self.hello_protocol.handle_hello(msg, now, link_id, cost)
+                key = "HELLO/%s/%d" % (msg.id, link_id)
 
             elif opcode == 'RA':
                 msg = MessageRA(body)
                 self.log_ls(LOG_TRACE, "RCVD: %r" % msg)
-                self.link_state_engine.handle_ra(msg, now)
+                if self.link_state_engine.handle_ra(msg, now):
+                    key = "RA/%s/%d" % (msg.id, link_id)
 
             elif opcode == 'LSU':
                 msg = MessageLSU(body)
@@ -161,15 +230,22 @@ class RouterEngine:
                 self.log_ma(LOG_TRACE, "RCVD: %r" % msg)
                 self.mobile_address_engine.handle_mar(msg, now)
 
+            if key:
+                self.absorbed[key] = (opcode, msg)
+
         except Exception:
             self.log(LOG_ERROR, "Control message error: opcode=%s body=%r\n%s" % (opcode, body, format_exc(LOG_STACK_LIMIT)))
+            key = None
+        finally:
+            self.router_adapter.commit_route_table()
+        return key
 
     def receive(self, message, link_id, cost):
         """
         This is the IoAdapter message-receive handler
         """
         try:
-            self.handleControlMessage(message.properties['opcode'], message.body, link_id, cost)
+            return self.handleControlMessage(message.properties['opcode'], message.body, link_id, cost)
         except Exception:
             self.log(LOG_ERROR, "Exception in raw message processing: properties=%r body=%r\n%s" %
                      (message.properties, message.body, format_exc(LOG_STACK_LIMIT)))
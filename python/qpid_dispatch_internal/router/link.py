@@ -47,9 +47,12 @@ class LinkStateEngine(object):
 
 
     def handle_ra(self, msg, now):
+        """
+        Returns True if the RA asks nothing more of this router.
+        """
         if msg.id == self.id:
-            return
-        self.node_tracker.ra_received(msg.id, msg.version, msg.ls_seq, msg.mobile_seq, msg.instance, now)
+            return True
+        return self.node_tracker.ra_received(msg.id, msg.version, msg.ls_seq, msg.mobile_seq, msg.instance, now)
 
 
     def handle_lsu(self, msg, now):
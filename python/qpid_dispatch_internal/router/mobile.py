@@ -22,6 +22,12 @@ from ..dispatch import LOG_TRACE
 
 MAX_KEPT_DELTAS = 10
 
+##
+## Upper bound on the number of addresses carried by one MAU.  Larger updates are split
+## so that no single control message grows with the number of mobile addresses.
+##
+MAX_MAU_ADDRESSES = 1000
+
 class MobileAddressEngine(object):
     """
     This module is responsible for maintaining an up-to-date list of mobile addresses in the domain.
@@ -34,10 +40,11 @@ class MobileAddressEngine(object):
         self.node_tracker  = node_tracker
         self.id            = self.container.id
         self.mobile_seq    = 0
-        self.local_addrs   = []
-        self.added_addrs   = []
-        self.deleted_addrs = []
+        self.local_addrs   = set()
+        self.added_addrs   = set()
+        self.deleted_addrs = set()
         self.sent_deltas   = {}
+        self.delta_size    = 0     # Number of addresses carried by the sent_deltas
 
 
     def tick(self, now):
@@ -45,44 +52,61 @@ class MobileAddressEngine(object):
         ## If local addrs have changed, collect the changes and send a MAU with the diffs
         ## Note: it is important that the differential-MAU be sent before a RA is sent
         ##
+        ## A large change is sent as a series of consecutive deltas, each one a sequence
+        ## number of its own, so every peer can apply it whatever its protocol version.
+        ##
         if len(self.added_addrs) > 0 or len(self.deleted_addrs) > 0:
-            self.mobile_seq += 1
-            msg = MessageMAU(None, self.id, self.mobile_seq, self.added_addrs, self.deleted_addrs)
-
-            self.sent_deltas[self.mobile_seq] = msg
-            if len(self.sent_deltas) > MAX_KEPT_DELTAS:
-                self.sent_deltas.pop(self.mobile_seq - MAX_KEPT_DELTAS)
-
-            self.container.send('amqp:/_topo/0/all/qdrouter.ma', msg)
-            self.container.log_ma(LOG_TRACE, "SENT: %r" % msg)
-            self.local_addrs.extend(self.added_addrs)
-            for addr in self.deleted_addrs:
-                self.local_addrs.remove(addr)
-            self.added_addrs   = []
-            self.deleted_addrs = []
+            added   = sorted(self.added_addrs)
+            deleted = sorted(self.deleted_addrs)
+            self.local_addrs |= self.added_addrs
+            self.local_addrs -= self.deleted_addrs
+            self.added_addrs   = set()
+            self.deleted_addrs = set()
+
+            while added or deleted:
+                add_part = added[:MAX_MAU_ADDRESSES]
+                del_part = deleted[:MAX_MAU_ADDRESSES - len(add_part)]
+                added    = added[len(add_part):]
+                deleted  = deleted[len(del_part):]
+
+                self.mobile_seq += 1
+                msg = MessageMAU(None, self.id, self.mobile_seq, add_part, del_part)
+                self._keep_delta(msg)
+                self.container.send('amqp:/_topo/0/all/qdrouter.ma', msg)
+                self.container.log_ma(LOG_TRACE, "SENT: %r" % msg)
         return self.mobile_seq
 
 
+    def _keep_delta(self, msg):
+        ##
+        ## Keep at least MAX_KEPT_DELTAS deltas, and more as long as catching a peer up
+        ## with them is cheaper than sending it the whole address list.
+        ##
+        self.sent_deltas[msg.mobile_seq] = msg
+        self.delta_size += len(msg.add_list) + len(msg.del_list)
+        oldest = msg.mobile_seq - len(self.sent_deltas) + 1
+        while len(self.sent_deltas) > MAX_KEPT_DELTAS and self.delta_size > len(self.local_addrs):
+            old = self.sent_deltas.pop(oldest)
+            self.delta_size -= len(old.add_list) + len(old.del_list)
+            oldest += 1
+
+
     def add_local_address(self, addr):
         """
         """
-        if self.local_addrs.count(addr) == 0:
-            if self.added_addrs.count(addr) == 0:
-                self.added_addrs.append(addr)
+        if addr not in self.local_addrs:
+            self.added_addrs.add(addr)
         else:
-            if self.deleted_addrs.count(addr) > 0:
-                self.deleted_addrs.remove(addr)
+            self.deleted_addrs.discard(addr)
 
 
     def del_local_address(self, addr):
         """
         """
-        if self.local_addrs.count(addr) > 0:
-            if self.deleted_addrs.count(addr) == 0:
-                self.deleted_addrs.append(addr)
+        if addr in self.local_addrs:
+            self.deleted_addrs.add(addr)
         else:
-            if self.added_addrs.count(addr) > 0:
-                self.added_addrs.remove(addr)
+            self.added_addrs.discard(addr)
 
 
     def handle_mau(self, msg, now):
@@ -98,25 +122,32 @@ class MobileAddressEngine(object):
 
         if msg.exist_list != None:
             ##
-            ## Absolute MAU
+            ## Absolute MAU, possibly in several parts
             ##
             if msg.mobile_seq == node.mobile_address_sequence:
                 return
+            addrs = msg.exist_list
+            if msg.chunks != None:
+                addrs = node.add_address_chunk(msg.mobile_seq, msg.chunk, msg.chunks, msg.exist_list)
+                if addrs == None:
+                    return
             node.mobile_address_sequence = msg.mobile_seq
-            node.overwrite_addresses(msg.exist_list)
+            node.overwrite_addresses(addrs)
         else:
             ##
             ## Differential MAU
             ##
-            if node.mobile_address_sequence + 1 == msg.mobile_seq:
+            base_seq = msg.mobile_seq - 1
+            if msg.base_seq != None:
+                base_seq = msg.base_seq
+
+            if node.mobile_address_sequence == base_seq:
                 ##
-                ## This message represents the next expected sequence, incorporate the deltas
+                ## This message applies on top of what we have, incorporate the deltas
                 ##
-                node.mobile_address_sequence += 1
-                for a in msg.add_list:
-                    node.map_address(a)
-                for a in msg.del_list:
-                    node.unmap_address(a)
+                node.mobile_address_sequence = msg.mobile_seq
+                node.map_addresses(msg.add_list or [])
+                node.unmap_addresses(msg.del_list or [])
 
             elif node.mobile_address_sequence == msg.mobile_seq:
                 ##
@@ -137,21 +168,67 @@ class MobileAddressEngine(object):
             return
         if msg.have_seq == self.mobile_seq:
             return
-        if self.mobile_seq - (msg.have_seq + 1) < len(self.sent_deltas):
+        dest = 'amqp:/_topo/0/%s/qdrouter.ma' % msg.id
+        if msg.have_seq < self.mobile_seq and (msg.have_seq + 1) in self.sent_deltas:
             ##
-            ## We can catch the peer up with a series of stored differential updates
+            ## We can catch the peer up with the stored differential updates.  A peer that
+            ## understands base_seq gets them merged into one update when that is small enough.
             ##
-            for s in range(msg.have_seq + 1, self.mobile_seq + 1):
-                self.container.send('amqp:/_topo/0/%s/qdrouter.ma' % msg.id, self.sent_deltas[s])
+            seqs = range(msg.have_seq + 1, self.mobile_seq + 1)
+            if msg.version >= 2 and len(seqs) > 1:
+                added, deleted = self._merge_deltas(seqs)
+                if len(added) + len(deleted) <= MAX_MAU_ADDRESSES:
+                    smsg = MessageMAU(None, self.id, self.mobile_seq, sorted(added), sorted(deleted),
+                                      _base_seq=msg.have_seq)
+                    self.container.send(dest, smsg)
+                    self.container.log_ma(LOG_TRACE, "SENT: %r" % smsg)
+                    return
+            for s in seqs:
+                self.container.send(dest, self.sent_deltas[s])
                 self.container.log_ma(LOG_TRACE, "SENT: %r" % self.sent_deltas[s])
             return
 
         ##
-        ## The peer needs to be sent an absolute update with the whole address list
+        ## The peer needs to be sent an absolute update with the whole address list.  Peers
+        ## that understand chunks get a large list in parts.
+        ##
+        addrs = sorted(self.local_addrs)
+        if msg.version < 2 or len(addrs) <= MAX_MAU_ADDRESSES:
+            smsg = MessageMAU(None, self.id, self.mobile_seq, None, None, addrs)
+            self.container.send(dest, smsg)
+            self.container.log_ma(LOG_TRACE, "SENT: %r" % smsg)
+            return
+
+        chunks = (len(addrs) + MAX_MAU_ADDRESSES - 1) / MAX_MAU_ADDRESSES
+        for chunk in range(chunks):
+            part = addrs[chunk * MAX_MAU_ADDRESSES:(chunk + 1) * MAX_MAU_ADDRESSES]
+            smsg = MessageMAU(None, self.id, self.mobile_seq, None, None, part,
+                              _chunk=chunk, _chunks=chunks)
+            self.container.send(dest, smsg)
+            self.container.log_ma(LOG_TRACE, "SENT: MAU(id=%s mobile_seq=%d chunk=%d/%d)" %
+                                  (self.id, self.mobile_seq, chunk, chunks))
+
+
+    def _merge_deltas(self, seqs):
+        ##
+        ## Net effect of a series of stored deltas.  An address added and later deleted
+        ## (or the reverse) cancels out.
         ##
-        smsg = MessageMAU(None, self.id, self.mobile_seq, None, None, self.local_addrs)
-        self.container.send('amqp:/_topo/0/%s/qdrouter.ma' % msg.id, smsg)
-        self.container.log_ma(LOG_TRACE, "SENT: %r" % smsg)
+        added   = set()
+        deleted = set()
+        for s in seqs:
+            delta = self.sent_deltas[s]
+            for a in delta.add_list:
+                if a in deleted:
+                    deleted.remove(a)
+                else:
+                    added.add(a)
+            for a in delta.del_list:
+                if a in added:
+                    added.remove(a)
+                else:
+                    deleted.add(a)
+        return added, deleted
 
 
     def send_mar(self, node_id, seq):
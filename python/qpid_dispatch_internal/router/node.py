@@ -38,6 +38,7 @@ class NodeTracker(object):
         self.recompute_topology    = False
         self.last_topology_change  = 0
         self.flux_mode             = False
+        self.generation            = 0   # Bumped by every change to the topology
         self.nodes                 = {}  # id => RouterNode
         self.nodes_by_link_id      = {}  # link-id => node-id
         self.maskbits              = []
@@ -48,6 +49,7 @@ class NodeTracker(object):
         self.neighbor_max_age = self.container.config.helloMaxAge
         self.ls_max_age       = self.container.config.remoteLsMaxAge
         self.flux_interval    = self.container.config.raIntervalFlux * 2
+        self.equal_cost_multipath = self.container.config.equalCostMultipath
         self.container.router_adapter.get_agent().add_implementation(self, "router.node")
 
 
@@ -111,6 +113,7 @@ class NodeTracker(object):
                     if node.keep_alive_count > 2:
                         node.delete()
                         self.nodes.pop(node_id)
+                        self.generation += 1
 
 
     def tick(self, now):
@@ -125,6 +128,7 @@ class NodeTracker(object):
         ## Enter flux mode if things are changing
         ##
         if self.link_state_changed or self.recompute_topology:
+            self.generation += 1
             self.last_topology_change = int(round(now))
             if not self.flux_mode:
                 self.flux_mode = True
@@ -165,6 +169,12 @@ class NodeTracker(object):
                 node.set_valid_origins(vo)
                 node.set_cost(cost)
 
+            if self.equal_cost_multipath:
+                ecmp_hops, ecmp_origins = self.container.path_engine.calculate_equal_cost_routes(collection)
+                self.container.log_ls(LOG_INFO, "Computed equal-cost next hops: %r" % ecmp_hops)
+                for node_id, hops in ecmp_hops.items():
+                    self.nodes[node_id].set_equal_cost_hops(hops, ecmp_origins[node_id])
+
         ##
         ## Send link-state requests and mobile-address requests to the nodes
         ## that have pending requests and are reachable
@@ -244,6 +254,7 @@ class NodeTracker(object):
             node.remove_link()
             if self.link_state.del_peer(node_id):
                 self.link_state_changed = True
+            self.generation += 1
 
 
     def in_flux_mode(self, now):
@@ -256,7 +267,8 @@ class NodeTracker(object):
 
     def ra_received(self, node_id, version, ls_seq, mobile_seq, instance, now):
         """
-        Invoked when a router advertisement is received from another router.
+        Invoked when a router advertisement is received from another router.  Returns True
+        if this router's records of the other are up to date with the advertisement.
         """
         ##
         ## If the node id is not known, create a new RouterNode to track it.
@@ -275,9 +287,11 @@ class NodeTracker(object):
         ## If the instance was updated (i.e. the router restarted suddenly),
         ## schedule a topology recompute and a link-state-request to that router.
         ##
+        current = True
         if node.update_instance(instance, version):
             self.recompute_topology = True
             node.request_link_state()
+            current = False
 
         ##
         ## Update the last seen time to now to control expiration of the link state.
@@ -290,6 +304,7 @@ class NodeTracker(object):
         ##
         if node.link_state.ls_seq < ls_seq:
             self.container.link_state_engine.send_lsr(node_id)
+            current = False
 
         ##
         ## Check the mobile sequence.  Send a mobile-address-request if we are
@@ -297,6 +312,9 @@ class NodeTracker(object):
         ##
         if node.mobile_address_sequence < mobile_seq:
             node.mobile_address_request()
+            current = False
+
+        return current
 
 
     def router_learned(self, node_id, version):
@@ -343,6 +361,23 @@ class NodeTracker(object):
                     self.router_learned(peer, None)
 
 
+    def seed_router(self, node_id, version, instance, ls_seq, peers, mobile_seq, addrs, now):
+        """
+        Invoked at startup for each router in the topology snapshot.  The router is tracked
+        as if its link state and mobile addresses had just been received; the live protocol
+        then confirms or replaces them.
+        """
+        if node_id == self.my_id or node_id in self.nodes:
+            return
+        node = RouterNode(self, node_id, version, instance)
+        self.nodes[node_id] = node
+        node.link_state = LinkState(None, node_id, ls_seq, peers)
+        node.link_state.last_seen = now
+        node.mobile_address_sequence = mobile_seq
+        node.map_addresses(addrs)
+        self.recompute_topology = True
+
+
     def router_node(self, node_id):
         return self.nodes[node_id]
 
@@ -392,8 +427,11 @@ class RouterNode(object):
         self.next_hop_router         = None
         self.cost                    = None
         self.valid_origins           = None
-        self.mobile_addresses        = []
+        self.ecmp_hops               = None
+        self.ecmp_valid_origins      = None
+        self.mobile_addresses        = set()
         self.mobile_address_sequence = 0
+        self.mobile_address_chunks   = None  # (seq, next chunk, addresses) of a partial absolute MAU
         self.need_ls_request         = True
         self.need_mobile_request     = False
         self.keep_alive_count        = 0
@@ -469,6 +507,17 @@ class RouterNode(object):
         self.log(LOG_TRACE, "Node %s valid origins: %r" % (self.id, valid_origins))
 
 
+    def set_equal_cost_hops(self, hops, valid_origins):
+        if self.ecmp_hops == hops and self.ecmp_valid_origins == valid_origins:
+            return
+        self.ecmp_hops          = hops
+        self.ecmp_valid_origins = valid_origins
+        hops_mb = [self.parent.nodes[N].maskbit for N in hops]
+        vo_mb   = [self.parent.nodes[N].maskbit for N in valid_origins]
+        self.adapter.set_equal_cost_hops(self.maskbit, hops_mb, vo_mb)
+        self.log(LOG_TRACE, "Node %s equal-cost next hops: %r" % (self.id, hops))
+
+
     def set_cost(self, cost):
         if self.cost == cost:
             return
@@ -520,7 +569,7 @@ class RouterNode(object):
 
 
     def map_address(self, addr):
-        self.mobile_addresses.append(addr)
+        self.mobile_addresses.add(addr)
         self.adapter.map_destination(addr, self.maskbit)
         self.log(LOG_DEBUG, "Remote destination %s mapped to router %s" % (self._logify(addr), self.id))
 
@@ -531,25 +580,61 @@ class RouterNode(object):
         self.log(LOG_DEBUG, "Remote destination %s unmapped from router %s" % (self._logify(addr), self.id))
 
 
+    def map_addresses(self, addrs):
+        """
+        Map a list of addresses to this router in one call into the core.  Addresses that
+        are already mapped are skipped.
+        """
+        added = [a for a in addrs if a not in self.mobile_addresses]
+        if len(added) == 1:
+            self.map_address(added[0])
+        elif added:
+            self.mobile_addresses.update(added)
+            self.adapter.map_destinations(added, self.maskbit)
+            self.log(LOG_DEBUG, "%d remote destinations mapped to router %s" % (len(added), self.id))
+
+
+    def unmap_addresses(self, addrs):
+        deleted = [a for a in addrs if a in self.mobile_addresses]
+        if len(deleted) == 1:
+            self.unmap_address(deleted[0])
+        elif deleted:
+            self.mobile_addresses.difference_update(deleted)
+            self.adapter.unmap_destinations(deleted, self.maskbit)
+            self.log(LOG_DEBUG, "%d remote destinations unmapped from router %s" % (len(deleted), self.id))
+
+
     def unmap_all_addresses(self):
         self.mobile_address_sequence = 0
-        while self.mobile_addresses:
-            self.unmap_address(self.mobile_addresses[0])
+        self.mobile_address_chunks   = None
+        self.unmap_addresses(list(self.mobile_addresses))
 
 
     def overwrite_addresses(self, addrs):
-        added   = []
-        deleted = []
-        for a in addrs:
-            if a not in self.mobile_addresses:
-                added.append(a)
-        for a in self.mobile_addresses:
-            if a not in addrs:
-                deleted.append(a)
-        for a in added:
-            self.map_address(a)
-        for a in deleted:
-            self.unmap_address(a)
+        addrs = set(addrs)
+        self.map_addresses([a for a in addrs if a not in self.mobile_addresses])
+        self.unmap_addresses([a for a in self.mobile_addresses if a not in addrs])
+
+
+    def add_address_chunk(self, seq, chunk, chunks, addrs):
+        """
+        Collect one part of a chunked absolute MAU.  Returns the complete address set once
+        the last part has arrived, otherwise None.  A part that arrives out of order drops
+        the collected parts and schedules a new request.
+        """
+        if chunk == 0:
+            self.mobile_address_chunks = (seq, 0, set())
+        pending = self.mobile_address_chunks
+        if pending == None or pending[0] != seq or pending[1] != chunk:
+            self.mobile_address_chunks = None
+            self.mobile_address_request()
+            return None
+        pending[2].update(addrs)
+        if chunk + 1 < chunks:
+            self.mobile_address_chunks = (seq, chunk + 1, pending[2])
+            return None
+        self.mobile_address_chunks = None
+        return pending[2]
 
 
     def update_instance(self, instance, version):
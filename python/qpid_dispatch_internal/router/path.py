@@ -28,7 +28,7 @@ class PathEngine(object):
         self.id = self.container.id
 
 
-    def _calculate_tree_from_root(self, root, collection):
+    def _link_states(self, collection):
         ##
         ## Make a copy of the current collection of link-states that contains
         ## a fake link-state for nodes that are known-peers but are not in the
@@ -41,6 +41,11 @@ class PathEngine(object):
             for p in ls.peers:
                 if p not in link_states:
                     link_states[p] = {_id:1L}
+        return link_states
+
+
+    def _calculate_tree_from_root(self, root, collection):
+        link_states = self._link_states(collection)
 
         ##
         ## Setup Dijkstra's Algorithm
@@ -118,6 +123,15 @@ class PathEngine(object):
 
 
     def calculate_routes(self, collection):
+        ##
+        ## Use the router's native engine when it is available.  It computes the same
+        ## trees as the code below, without holding the interpreter for seconds on a
+        ## large topology.
+        ##
+        adapter = getattr(self.container, 'router_adapter', None)
+        if adapter and hasattr(adapter, 'calculate_routes'):
+            return adapter.calculate_routes(self.id, self._link_states(collection))
+
         ##
         ## Generate the shortest-path tree with the local node as root
         ##
@@ -150,6 +164,62 @@ class PathEngine(object):
         return (next_hops, cost, valid_origins)
 
 
+    def calculate_equal_cost_routes(self, collection):
+        """
+        Compute the equal-cost multipath view of the topology.  Returns a map of each
+        reachable node to the sorted list of neighbors that start a lowest-cost path
+        to it, and a map of each node to the origins for which this router lies on
+        any lowest-cost path to it.  The second map is a superset of the valid origins
+        from calculate_routes and is what anycast forwarding needs once the other
+        routers spread traffic over all of their equal-cost next hops.
+        """
+        link_states = self._link_states(collection)
+        prev, cost = self._calculate_tree_from_root(self.id, collection)
+
+        ##
+        ## Walk the nodes outward from the root.  A node's first hops are the union of the
+        ## first hops of every predecessor that lies on one of its lowest-cost paths.
+        ##
+        hops = {}
+        for v in sorted(prev.keys(), key=lambda n: (cost[n], n)):
+            first = set()
+            for u in self._equal_cost_predecessors(self.id, v, cost, link_states):
+                if u == self.id:
+                    first.add(v)
+                else:
+                    first |= hops.get(u, set())
+            hops[v] = first
+        next_hops = {}
+        for v, first in hops.items():
+            next_hops[v] = sorted(first)
+
+        ##
+        ## This router is on a lowest-cost path from root to dest exactly when the
+        ## cost from root to us plus our cost to dest equals the cost from root to dest.
+        ##
+        valid_origins = {}
+        for dest in prev.keys():
+            valid_origins[dest] = []
+        for root in prev.keys():
+            r_prev, r_cost = self._calculate_tree_from_root(root, collection)
+            if self.id not in r_cost:
+                continue
+            for dest in r_prev.keys():
+                if dest != self.id and dest in cost and r_cost[self.id] + cost[dest] == r_cost[dest]:
+                    valid_origins[dest].append(root)
+
+        return (next_hops, valid_origins)
+
+
+    def _equal_cost_predecessors(self, root, node, cost, link_states):
+        preds = []
+        for u, peers in link_states.items():
+            u_cost = 0 if u == root else cost.get(u)
+            if u_cost is not None and node in peers and u_cost + peers[node] == cost[node]:
+                preds.append(u)
+        return preds
+
+
 
 class NodeSet(object):
     """
@@ -0,0 +1,121 @@
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+import json
+import os
+from traceback import format_exc
+
+from ..dispatch import LOG_INFO, LOG_ERROR, LOG_STACK_LIMIT
+from data import ProtocolVersion
+
+##
+## Version of the snapshot file format.  Files of another version are ignored.
+##
+SnapshotVersion = 1
+
+class TopologySnapshot(object):
+    """
+    This module keeps the last known link state and mobile addresses of the other routers
+    in a file, so a restarted router can route to the network as soon as its first neighbor
+    is up instead of after the link-state and mobile-address exchanges.
+
+    The routers in the snapshot are installed provisionally: their link state ages out like
+    any other unless RAs refresh it, and a changed instance or newer sequence in the live
+    protocol replaces the snapshot's state.
+    """
+    def __init__(self, container, node_tracker, filename, save_interval=10.0):
+        self.container     = container
+        self.node_tracker  = node_tracker
+        self.filename      = filename
+        self.save_interval = save_interval
+        self.last_save     = 0
+        self.signature     = None
+
+
+    def _state(self):
+        nodes = []
+        for node_id, node in self.node_tracker.nodes.items():
+            nodes.append({'id'         : node_id,
+                          'instance'   : node.instance,
+                          'version'    : node.version,
+                          'ls_seq'     : node.link_state.ls_seq,
+                          'peers'      : node.link_state.peers,
+                          'mobile_seq' : node.mobile_address_sequence,
+                          'addresses'  : sorted(node.mobile_addresses)})
+        return nodes
+
+
+    def _signature(self):
+        """
+        A cheap summary of the state that changes whenever the snapshot would.
+        """
+        return sorted((n_id, n.instance, n.link_state.ls_seq, n.mobile_address_sequence, len(n.mobile_addresses))
+                      for n_id, n in self.node_tracker.nodes.items())
+
+
+    def save(self):
+        body = {'version'  : SnapshotVersion,
+                'protocol' : ProtocolVersion,
+                'id'       : self.container.id,
+                'area'     : self.container.area,
+                'nodes'    : self._state()}
+        tmp = self.filename + ".tmp"
+        with open(tmp, "w") as f:
+            json.dump(body, f)
+        os.rename(tmp, self.filename)
+
+
+    def tick(self, now):
+        if now - self.last_save < self.save_interval:
+            return
+        self.last_save = now
+        signature = self._signature()
+        if signature == self.signature:
+            return
+        try:
+            self.save()
+            self.signature = signature
+        except Exception:
+            self.container.log(LOG_ERROR, "Cannot write topology snapshot %s\n%s" %
+                               (self.filename, format_exc(LOG_STACK_LIMIT)))
+
+
+    def load(self, now):
+        """
+        Seed the node tracker from the snapshot file if there is a usable one.
+        """
+        if not os.path.exists(self.filename):
+            return
+        try:
+            with open(self.filename) as f:
+                body = json.load(f)
+            if body.get('version') != SnapshotVersion or body.get('protocol') != ProtocolVersion or \
+               body.get('id') != self.container.id or body.get('area') != self.container.area:
+                self.container.log(LOG_INFO, "Ignoring topology snapshot %s from another router or version" %
+                                   self.filename)
+                return
+            for n in body['nodes']:
+                self.node_tracker.seed_router(str(n['id']), n['version'], n['instance'], n['ls_seq'],
+                                              dict((str(k), v) for k, v in n['peers'].items()),
+                                              n['mobile_seq'], [str(a) for a in n['addresses']], now)
+            self.container.log(LOG_INFO, "Loaded %d routers from topology snapshot %s" %
+                               (len(body['nodes']), self.filename))
+        except Exception:
+            self.container.log(LOG_ERROR, "Cannot load topology snapshot %s\n%s" %
+                               (self.filename, format_exc(LOG_STACK_LIMIT)))
@@ -40,6 +40,8 @@
 static inline void qd_alloc_initialize(void) {}
 static inline void qd_alloc_debug_dump(const char *file) {}
 static inline void qd_alloc_finalize(void) {}
+static inline size_t qd_alloc_trim(void) { return 0; }
+static inline void qd_alloc_set_numa_aware(bool aware) {}
 
 
 #endif // ALLOC_MALLOC_H
@@ -21,12 +21,17 @@
 #include "alloc.h"
 #include <qpid/dispatch/ctools.h>
 #include <qpid/dispatch/log.h>
+#include <qpid/dispatch/buffer.h>
 #include <memory.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
+#include <time.h>
 #include "entity.h"
 #include "entity_cache.h"
 #include "config.h"
+#include "probes.h"
 
 #if !defined(NDEBUG)
 #define QD_MEMORY_DEBUG 1
@@ -49,6 +54,7 @@ DEQ_DECLARE(qd_alloc_type_t, qd_alloc_type_list_t);
 
 struct qd_alloc_item_t {
     DEQ_LINKS(qd_alloc_item_t);
+    uint32_t              node;  // NUMA node (slot in desc->global) the memory belongs to
 #ifdef QD_MEMORY_DEBUG
     qd_alloc_type_desc_t *desc;
     uint32_t              header;
@@ -57,12 +63,150 @@ struct qd_alloc_item_t {
 
 DEQ_DECLARE(qd_alloc_item_t, qd_alloc_item_list_t);
 
+struct qd_alloc_slab_t {
+    qd_alloc_slab_t *next;
+    void            *base;
+    size_t           size;
+};
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 
 struct qd_alloc_pool_t {
     DEQ_LINKS(qd_alloc_pool_t);
     qd_alloc_item_list_t free_list;
+    uint32_t             node;                             // The thread's NUMA node
+    qd_alloc_item_list_t remote_list[QD_ALLOC_MAX_NODES];  // Freed items of other nodes
+    qd_alloc_stats_t     stats;                            // This thread's counts
+    uint32_t             sample_countdown;                 // Allocations until the next sample
 };
 
+//
+// The global pool is a lock-free (Treiber) stack of whole batches.  A batch is a chain of
+// transfer_batch_size items linked through 'next'; the first item's 'prev' links to the
+// next batch on the stack.  The stack head carries a generation tag so that a pop racing
+// with a pop-and-push of the same batch fails its CAS rather than corrupting the stack
+// (ABA).  On 64-bit platforms the tag lives in the unused top 16 bits of the pointer;
+// elsewhere it uses the low bits that are free because items are 64-octet aligned.
+//
+// A popper may read the link of a batch that another thread has taken since the popper
+// read the head; the tag makes its CAS fail, but the batch must still be readable.  So
+// items are never freed straight to the heap: global_retire_LH() parks them on the node's
+// retired list, and they are freed only at a moment when the node has no pop in progress.
+// A pop that begins after that moment can't reach them, as they are off the stack.
+//
+#if UINTPTR_MAX > 0xffffffffu
+#define BATCH_TAG_SHIFT 48
+#define BATCH_PTR_MASK  ((((uintptr_t) 1) << 48) - 1)
+#else
+#define BATCH_TAG_SHIFT 0
+#define BATCH_PTR_MASK  (~((uintptr_t) 63))
+#endif
+
+static inline qd_alloc_item_t *batch_ptr(void *head)
+{
+    return (qd_alloc_item_t*) ((uintptr_t) head & BATCH_PTR_MASK);
+}
+
+static inline void *batch_tag_next(void *head, qd_alloc_item_t *batch)
+{
+    uintptr_t tag = ((uintptr_t) head & ~BATCH_PTR_MASK) >> BATCH_TAG_SHIFT;
+    return (void*) ((uintptr_t) batch | (((tag + 1) << BATCH_TAG_SHIFT) & ~BATCH_PTR_MASK));
+}
+
+
+//
+// Push a batch of items onto a global stack, counting failed attempts in *retries.
+//
+static void global_push(qd_alloc_global_t *global, qd_alloc_item_t *batch, uint64_t *retries)
+{
+    assert (((uintptr_t) batch & ~BATCH_PTR_MASK) == 0);
+    void *head;
+
+    //
+    // Counted first so that a pop of this batch can never take the count below zero.
+    //
+    sys_atomic_inc(&global->batch_count);
+    while (true) {
+        head = sys_atomic_ptr_get(&global->batches);
+        batch->prev = batch_ptr(head);
+        if (sys_atomic_ptr_cas(&global->batches, head, batch_tag_next(head, batch)))
+            break;
+        (*retries)++;
+    }
+}
+
+
+//
+// Pop a batch of items from a global stack, or return 0 if it is empty.  Failed attempts
+// are counted in *retries.
+//
+static qd_alloc_item_t *global_pop(qd_alloc_global_t *global, uint64_t *retries)
+{
+    void            *head;
+    qd_alloc_item_t *batch;
+    sys_atomic_inc(&global->poppers);
+    while (true) {
+        head  = sys_atomic_ptr_get(&global->batches);
+        batch = batch_ptr(head);
+        if (!batch)
+            break;
+        if (sys_atomic_ptr_cas(&global->batches, head, batch_tag_next(head, batch->prev)))
+            break;
+        (*retries)++;
+    }
+    sys_atomic_dec(&global->poppers);
+    if (!batch)
+        return 0;
+
+    uint32_t remaining = sys_atomic_dec(&global->batch_count) - 1;
+    if (remaining < global->batch_low)
+        global->batch_low = remaining;  // Racy, but only steers the trimmer
+    batch->prev = 0;
+    return batch;
+}
+
+
+//
+// Free the node's retired batches if no pop is in progress, returning the number of items
+// freed.  The caller holds the type's lock.
+//
+static size_t global_reclaim_LH(qd_alloc_global_t *global)
+{
+    size_t freed = 0;
+
+    //
+    // The add is a full barrier, so a pop not counted here reads the head only after the
+    // retired batches left the stack.
+    //
+    if (!global->retired || sys_atomic_add(&global->poppers, 0) != 0)
+        return 0;
+
+    while (global->retired) {
+        qd_alloc_item_t *batch = global->retired;
+        global->retired = batch->prev;
+        while (batch) {
+            qd_alloc_item_t *item = batch;
+            batch = batch->next;
+            free(item);
+            freed++;
+        }
+    }
+    return freed;
+}
+
+
+//
+// Send a batch that is off the stack back to the heap, now or once no pop can still be
+// reading it.  The caller holds the type's lock.
+//
+static void global_retire_LH(qd_alloc_global_t *global, qd_alloc_item_t *batch)
+{
+    batch->prev     = global->retired;
+    global->retired = batch;
+    global_reclaim_LH(global);
+}
+
 qd_alloc_config_t qd_alloc_default_config_big   = {16,  32, 0};
 qd_alloc_config_t qd_alloc_default_config_small = {64, 128, 0};
 #define BIG_THRESHOLD 256
@@ -70,12 +214,13 @@ qd_alloc_config_t qd_alloc_default_config_small = {64, 128, 0};
 static sys_mutex_t          *init_lock = 0;
 static qd_alloc_type_list_t  type_list;
 static char *debug_dump = 0;
+static bool  numa_aware = false;
 
 static void qd_alloc_init(qd_alloc_type_desc_t *desc)
 {
     sys_mutex_lock(init_lock);
 
-    if (!desc->global_pool) {
+    if (!desc->lock) {
         desc->total_size = desc->type_size;
         if (desc->additional_size)
             desc->total_size += *desc->additional_size;
@@ -86,14 +231,21 @@ static void qd_alloc_init(qd_alloc_type_desc_t *desc)
 
         assert (desc->config->local_free_list_max >= desc->config->transfer_batch_size);
 
-        desc->global_pool = NEW(qd_alloc_pool_t);
-        DEQ_INIT(desc->global_pool->free_list);
+        for (int node = 0; node < QD_ALLOC_MAX_NODES; node++) {
+            sys_atomic_ptr_init(&desc->global[node].batches, 0);
+            sys_atomic_init(&desc->global[node].poppers, 0);
+            sys_atomic_init(&desc->global[node].batch_count, 0);
+            desc->global[node].batch_low = 0;
+            desc->global[node].retired   = 0;
+        }
+        desc->bytes_reclaimed = 0;
         desc->lock = sys_mutex();
         DEQ_INIT(desc->tpool_list);
-#if QD_MEMORY_STATS
         desc->stats = NEW(qd_alloc_stats_t);
         memset(desc->stats, 0, sizeof(qd_alloc_stats_t));
-#endif
+        memset(&desc->shared_stats, 0, sizeof(qd_alloc_stats_t));
+        desc->sites         = 0;
+        desc->sites_dropped = 0;
 
         qd_alloc_type_t *type_item = NEW(qd_alloc_type_t);
         DEQ_ITEM_INIT(type_item);
@@ -109,6 +261,186 @@ static void qd_alloc_init(qd_alloc_type_desc_t *desc)
 }
 
 
+//
+// Return a new slab of at least 'size' octets, preferring huge pages if the type asks for
+// them.  The caller holds desc->lock.
+//
+static qd_alloc_slab_t *qd_alloc_slab(qd_alloc_type_desc_t *desc, size_t size)
+{
+    qd_alloc_slab_t *slab = NEW(qd_alloc_slab_t);
+    if (!slab)
+        return 0;
+
+    slab->base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (desc->config->huge_pages) {
+        slab->size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+        slab->base = mmap(0, slab->size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (slab->base == MAP_FAILED) {
+        // No huge pages reserved (or not asked for); use ordinary pages.
+        slab->size = size;
+        slab->base = mmap(0, slab->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (slab->base == MAP_FAILED) {
+        free(slab);
+        return 0;
+    }
+
+    slab->next   = desc->slabs;
+    desc->slabs  = slab;
+    return slab;
+}
+
+
+//
+// Carve one item of 'size' octets from the type's current slab, starting a new slab when
+// the current one is used up.  Slab memory is mmap'ed, so it is page aligned and items
+// rounded to 64 octets stay cache aligned.  The caller holds desc->lock.
+//
+static qd_alloc_item_t *qd_alloc_carve(qd_alloc_type_desc_t *desc, size_t size)
+{
+    size = size + (size % 64 ? 64 - (size % 64) : 0);
+
+    if (desc->slab_remaining < size) {
+        size_t slab_size = desc->config->slab_size > size ? desc->config->slab_size : size;
+        qd_alloc_slab_t *slab = qd_alloc_slab(desc, slab_size);
+        if (!slab)
+            return 0;
+        desc->slab_cursor    = (unsigned char*) slab->base;
+        desc->slab_remaining = slab->size;
+    }
+
+    qd_alloc_item_t *item = (qd_alloc_item_t*) desc->slab_cursor;
+    desc->slab_cursor    += size;
+    desc->slab_remaining -= size;
+    return item;
+}
+
+
+//
+// Set up the calling thread's pool for a type.
+//
+static qd_alloc_pool_t *qd_alloc_thread_pool(qd_alloc_type_desc_t *desc)
+{
+    qd_alloc_pool_t *pool;
+    NEW_CACHE_ALIGNED(qd_alloc_pool_t, pool);
+    DEQ_ITEM_INIT(pool);
+    DEQ_INIT(pool->free_list);
+    memset(&pool->stats, 0, sizeof(qd_alloc_stats_t));
+    pool->sample_countdown = 0;
+    pool->node = numa_aware ? (uint32_t) sys_numa_node_self() % QD_ALLOC_MAX_NODES : 0;
+    for (int node = 0; node < QD_ALLOC_MAX_NODES; node++)
+        DEQ_INIT(pool->remote_list[node]);
+    sys_mutex_lock(desc->lock);
+    DEQ_INSERT_TAIL(desc->tpool_list, pool);
+    sys_mutex_unlock(desc->lock);
+    return pool;
+}
+
+
+//
+// Move a batch from the head of a thread's list to a node's global stack.
+//
+static void qd_alloc_release_batch(qd_alloc_type_desc_t *desc, qd_alloc_pool_t *pool, uint32_t node, qd_alloc_item_list_t *list)
+{
+    qd_alloc_global_t *global = &desc->global[node];
+    qd_alloc_item_t   *batch  = 0;
+    qd_alloc_item_t   *last   = 0;
+    qd_alloc_item_t   *item;
+
+    for (int idx = 0; idx < desc->config->transfer_batch_size; idx++) {
+        item = DEQ_HEAD(*list);
+        DEQ_REMOVE_HEAD(*list);
+        if (last)
+            last->next = item;
+        else
+            batch = item;
+        last = item;
+    }
+    pool->stats.batches_rebalanced_to_global++;
+    pool->stats.held_by_threads -= desc->config->transfer_batch_size;
+
+    //
+    // If there's a global_free_list size limit, the global stack holds at most that many
+    // items' worth of whole batches; a batch that doesn't fit goes back to the heap.
+    // Slab items can't be returned to the heap individually, so slab types keep them.
+    //
+    if (desc->config->global_free_list_max != 0 && desc->config->slab_size == 0 &&
+        (sys_atomic_get(&global->batch_count) + 1) * desc->config->transfer_batch_size >
+        (uint32_t) desc->config->global_free_list_max) {
+        sys_mutex_lock(desc->lock);
+        global_retire_LH(global, batch);
+        sys_mutex_unlock(desc->lock);
+        pool->stats.total_free_to_heap += desc->config->transfer_batch_size;
+        return;
+    }
+
+    global_push(global, batch, &pool->stats.global_retries);
+}
+
+
+static void qd_alloc_stats_add(qd_alloc_stats_t *total, const qd_alloc_stats_t *stats)
+{
+    total->total_alloc_from_heap         += stats->total_alloc_from_heap;
+    total->total_free_to_heap            += stats->total_free_to_heap;
+    total->held_by_threads               += stats->held_by_threads;
+    total->batches_rebalanced_to_threads += stats->batches_rebalanced_to_threads;
+    total->batches_rebalanced_to_global  += stats->batches_rebalanced_to_global;
+    total->total_allocs                  += stats->total_allocs;
+    total->total_frees                   += stats->total_frees;
+    total->global_retries                += stats->global_retries;
+    total->lock_wait_ns                  += stats->lock_wait_ns;
+}
+
+
+qd_alloc_stats_t *qd_alloc_stats(qd_alloc_type_desc_t *desc)
+{
+    if (desc->header != PATTERN_FRONT)
+        qd_alloc_init(desc);
+
+    //
+    // The thread pools' counters are read while their threads may be updating them, so the
+    // totals are a close snapshot rather than an exact one.
+    //
+    sys_mutex_lock(desc->lock);
+    *desc->stats = desc->shared_stats;
+    qd_alloc_pool_t *pool = DEQ_HEAD(desc->tpool_list);
+    while (pool) {
+        qd_alloc_stats_add(desc->stats, &pool->stats);
+        pool = DEQ_NEXT(pool);
+    }
+    sys_mutex_unlock(desc->lock);
+    return desc->stats;
+}
+
+
+void qd_alloc_each_type(qd_alloc_visit_t visit, void *context)
+{
+    sys_mutex_lock(init_lock);
+    qd_alloc_type_t *type_item = DEQ_HEAD(type_list);
+    while (type_item) {
+        qd_alloc_type_desc_t *desc  = type_item->desc;
+        qd_alloc_stats_t      stats;
+
+        sys_mutex_lock(desc->lock);
+        stats = desc->shared_stats;
+        qd_alloc_pool_t *pool = DEQ_HEAD(desc->tpool_list);
+        while (pool) {
+            qd_alloc_stats_add(&stats, &pool->stats);
+            pool = DEQ_NEXT(pool);
+        }
+        sys_mutex_unlock(desc->lock);
+
+        visit(context, desc->type_name, desc->total_size, &stats);
+        type_item = DEQ_NEXT(type_item);
+    }
+    sys_mutex_unlock(init_lock);
+}
+
+
 /* coverity[+alloc] */
 void *qd_alloc(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool)
 {
@@ -124,14 +456,8 @@ void *qd_alloc(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool)
     // If this is the thread's first pass through here, allocate the
     // thread-local pool for this type.
     //
-    if (*tpool == 0) {
-        NEW_CACHE_ALIGNED(qd_alloc_pool_t, *tpool);
-        DEQ_ITEM_INIT(*tpool);
-        DEQ_INIT((*tpool)->free_list);
-        sys_mutex_lock(desc->lock);
-        DEQ_INSERT_TAIL(desc->tpool_list, *tpool);
-        sys_mutex_unlock(desc->lock);
-    }
+    if (*tpool == 0)
+        *tpool = qd_alloc_thread_pool(desc);
 
     qd_alloc_pool_t *pool = *tpool;
 
@@ -143,6 +469,7 @@ void *qd_alloc(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool)
     qd_alloc_item_t *item = DEQ_HEAD(pool->free_list);
     if (item) {
         DEQ_REMOVE_HEAD(pool->free_list);
+        pool->stats.total_allocs++;
 #ifdef QD_MEMORY_DEBUG
         item->desc   = desc;
         item->header = PATTERN_FRONT;
@@ -153,48 +480,59 @@ void *qd_alloc(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool)
 
     //
     // The local free list is empty, we need to either rebalance a batch
-    // of items from the global list or go to the heap to get new memory.
+    // of items from the global stack of the thread's node or go to the heap to get new
+    // memory.
     //
-    sys_mutex_lock(desc->lock);
-    if (DEQ_SIZE(desc->global_pool->free_list) >= desc->config->transfer_batch_size) {
+    item = global_pop(&desc->global[pool->node], &pool->stats.global_retries);
+    if (item) {
         //
-        // Rebalance a full batch from the global free list to the thread list.
+        // Move the full batch from the global stack to the thread list.
         //
-#if QD_MEMORY_STATS
-        desc->stats->batches_rebalanced_to_threads++;
-        desc->stats->held_by_threads += desc->config->transfer_batch_size;
-#endif
-        for (idx = 0; idx < desc->config->transfer_batch_size; idx++) {
-            item = DEQ_HEAD(desc->global_pool->free_list);
-            DEQ_REMOVE_HEAD(desc->global_pool->free_list);
+        pool->stats.batches_rebalanced_to_threads++;
+        pool->stats.held_by_threads += desc->config->transfer_batch_size;
+        QD_PROBE2(alloc_global, desc->type_name, pool);
+        while (item) {
+            qd_alloc_item_t *next = item->next;
+            DEQ_ITEM_INIT(item);
             DEQ_INSERT_TAIL(pool->free_list, item);
+            item = next;
         }
     } else {
         //
-        // Allocate a full batch from the heap and put it on the thread list.
+        // Allocate a full batch from the heap and put it on the thread list.  The thread
+        // touches the memory first, so its pages come from the thread's node.
         //
+        struct timespec before, after;
+        QD_PROBE2(alloc_heap, desc->type_name, pool);
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        sys_mutex_lock(desc->lock);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        pool->stats.lock_wait_ns += (after.tv_sec - before.tv_sec) * 1000000000 + (after.tv_nsec - before.tv_nsec);
         for (idx = 0; idx < desc->config->transfer_batch_size; idx++) {
             size_t size = sizeof(qd_alloc_item_t) + desc->total_size
 #ifdef QD_MEMORY_DEBUG
                                                   + sizeof(uint32_t)
 #endif
                 ;
-            ALLOC_CACHE_ALIGNED(size, item);
+            if (desc->config->slab_size)
+                item = qd_alloc_carve(desc, size);
+            else
+                ALLOC_CACHE_ALIGNED(size, item);
             if (item == 0)
                 break;
             DEQ_ITEM_INIT(item);
+            item->node = pool->node;
             DEQ_INSERT_TAIL(pool->free_list, item);
-#if QD_MEMORY_STATS
-            desc->stats->held_by_threads++;
-            desc->stats->total_alloc_from_heap++;
-#endif
+            pool->stats.held_by_threads++;
+            pool->stats.total_alloc_from_heap++;
         }
+        sys_mutex_unlock(desc->lock);
     }
-    sys_mutex_unlock(desc->lock);
 
     item = DEQ_HEAD(pool->free_list);
     if (item) {
         DEQ_REMOVE_HEAD(pool->free_list);
+        pool->stats.total_allocs++;
 #ifdef QD_MEMORY_DEBUG
         item->desc = desc;
         item->header = PATTERN_FRONT;
@@ -212,7 +550,6 @@ void qd_dealloc(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool, char *p)
 {
     if (!p) return;
     qd_alloc_item_t *item = ((qd_alloc_item_t*) p) - 1;
-    int              idx;
 
 #ifdef QD_MEMORY_DEBUG
     assert (desc->header  == PATTERN_FRONT);
@@ -227,16 +564,23 @@ void qd_dealloc(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool, char *p)
     // If this is the thread's first pass through here, allocate the
     // thread-local pool for this type.
     //
-    if (*tpool == 0) {
-        *tpool = NEW(qd_alloc_pool_t);
-        DEQ_ITEM_INIT(*tpool);
-        DEQ_INIT((*tpool)->free_list);
-        sys_mutex_lock(desc->lock);
-        DEQ_INSERT_TAIL(desc->tpool_list, *tpool);
-        sys_mutex_unlock(desc->lock);
-    }
+    if (*tpool == 0)
+        *tpool = qd_alloc_thread_pool(desc);
 
     qd_alloc_pool_t *pool = *tpool;
+    pool->stats.total_frees++;
+
+    if (item->node != pool->node) {
+        //
+        // The memory belongs to another node.  Gather it up and send it home a batch at a
+        // time rather than have this thread reuse it.
+        //
+        qd_alloc_item_list_t *remote = &pool->remote_list[item->node];
+        DEQ_INSERT_TAIL(*remote, item);
+        if (DEQ_SIZE(*remote) >= desc->config->transfer_batch_size)
+            qd_alloc_release_batch(desc, pool, item->node, remote);
+        return;
+    }
 
     DEQ_INSERT_TAIL(pool->free_list, item);
 
@@ -245,35 +589,123 @@ void qd_dealloc(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool, char *p)
 
     //
     // We've exceeded the maximum size of the local free list.  A batch must be
-    // rebalanced back to the global list.
+    // rebalanced back to the global stack.
     //
+    qd_alloc_release_batch(desc, pool, pool->node, &pool->free_list);
+}
+
+
+//
+// Count one allocation in sample_rate toward its call site.
+//
+/* coverity[+alloc] */
+void *qd_alloc_sampled(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool, void *site)
+{
+    void *p = qd_alloc(desc, tpool);
+    if (!p)
+        return 0;
+
+    qd_alloc_pool_t *pool = *tpool;
+    if (pool->sample_countdown > 1) {
+        pool->sample_countdown--;
+        return p;
+    }
+    pool->sample_countdown = desc->sample_rate;
+
     sys_mutex_lock(desc->lock);
-#if QD_MEMORY_STATS
-    desc->stats->batches_rebalanced_to_global++;
-    desc->stats->held_by_threads -= desc->config->transfer_batch_size;
-#endif
-    for (idx = 0; idx < desc->config->transfer_batch_size; idx++) {
-        item = DEQ_HEAD(pool->free_list);
-        DEQ_REMOVE_HEAD(pool->free_list);
-        DEQ_INSERT_TAIL(desc->global_pool->free_list, item);
+    if (desc->sites) {
+        uint32_t idx = (uint32_t) (((uintptr_t) site >> 4) % QD_ALLOC_SITES);
+        uint32_t probes;
+        for (probes = 0; probes < QD_ALLOC_SITES; probes++) {
+            qd_alloc_site_t *slot = &desc->sites[(idx + probes) % QD_ALLOC_SITES];
+            if (slot->site == site || slot->site == 0) {
+                slot->site = site;
+                slot->count++;
+                break;
+            }
+        }
+        if (probes == QD_ALLOC_SITES)
+            desc->sites_dropped++;
     }
+    sys_mutex_unlock(desc->lock);
+    return p;
+}
 
-    //
-    // If there's a global_free_list size limit, remove items until the limit is
-    // not exceeded.
-    //
-    if (desc->config->global_free_list_max != 0) {
-        while (DEQ_SIZE(desc->global_pool->free_list) > desc->config->global_free_list_max) {
-            item = DEQ_HEAD(desc->global_pool->free_list);
-            DEQ_REMOVE_HEAD(desc->global_pool->free_list);
-            free(item);
-#if QD_MEMORY_STATS
-            desc->stats->total_free_to_heap++;
+
+void qd_alloc_set_sample_rate(qd_alloc_type_desc_t *desc, uint32_t rate)
+{
+    sys_mutex_lock(desc->lock);
+    if (rate && !desc->sites)
+        desc->sites = NEW_ARRAY(qd_alloc_site_t, QD_ALLOC_SITES);
+    if (rate && rate != desc->sample_rate) {
+        memset(desc->sites, 0, sizeof(qd_alloc_site_t) * QD_ALLOC_SITES);
+        desc->sites_dropped = 0;
+    }
+    desc->sample_rate = rate;
+    sys_mutex_unlock(desc->lock);
+}
+
+
+void qd_alloc_set_numa_aware(bool aware)
+{
+    numa_aware = aware;
+}
+
+
+//
+// The octets of heap memory taken by one item of the type.
+//
+static size_t qd_alloc_item_size(qd_alloc_type_desc_t *desc)
+{
+    size_t size = sizeof(qd_alloc_item_t) + desc->total_size
+#ifdef QD_MEMORY_DEBUG
+                                          + sizeof(uint32_t)
 #endif
+        ;
+    return size + (size % 64 ? 64 - (size % 64) : 0);
+}
+
+
+size_t qd_alloc_trim(void)
+{
+    size_t total = 0;
+
+    sys_mutex_lock(init_lock);
+    qd_alloc_type_t *type_item = DEQ_HEAD(type_list);
+    while (type_item) {
+        qd_alloc_type_desc_t *desc = type_item->desc;
+        sys_mutex_lock(desc->lock);
+        for (int node = 0; node < QD_ALLOC_MAX_NODES; node++) {
+            qd_alloc_global_t *global = &desc->global[node];
+            if (desc->config->slab_size == 0) {
+                //
+                // The batches that stayed on the stack through the whole interval are cold.
+                // They are retired like any other batch leaving for the heap, as pops that
+                // began before they were taken may still read them.
+                //
+                uint32_t cold = global->batch_low;
+                size_t   released = 0;
+                while (cold-- > 0) {
+                    qd_alloc_item_t *batch = global_pop(global, &desc->shared_stats.global_retries);
+                    if (!batch)
+                        break;
+                    global_retire_LH(global, batch);
+                    released += desc->config->transfer_batch_size;
+                }
+                global_reclaim_LH(global);
+                desc->shared_stats.total_free_to_heap += released;
+                released *= qd_alloc_item_size(desc);
+                desc->bytes_reclaimed += released;
+                total                 += released;
+            }
+            global->batch_low = sys_atomic_get(&global->batch_count);
         }
+        sys_mutex_unlock(desc->lock);
+        type_item = DEQ_NEXT(type_item);
     }
+    sys_mutex_unlock(init_lock);
 
-    sys_mutex_unlock(desc->lock);
+    return total;
 }
 
 
@@ -314,57 +746,77 @@ void qd_alloc_finalize(void)
         qd_alloc_type_desc_t *desc = type_item->desc;
 
         //
-        // Reclaim the items on the global free pool
+        // Reclaim the batches on the global stacks
         //
-        item = DEQ_HEAD(desc->global_pool->free_list);
-        while (item) {
-            DEQ_REMOVE_HEAD(desc->global_pool->free_list);
-            free(item);
-#if QD_MEMORY_STATS
-            desc->stats->total_free_to_heap++;
-#endif
-            item = DEQ_HEAD(desc->global_pool->free_list);
+        for (int node = 0; node < QD_ALLOC_MAX_NODES; node++) {
+            qd_alloc_global_t *global = &desc->global[node];
+            qd_alloc_item_t   *batch  = global_pop(global, &desc->shared_stats.global_retries);
+            while (batch) {
+                while (batch) {
+                    item  = batch;
+                    batch = batch->next;
+                    if (!desc->config->slab_size)
+                        free(item);
+                    desc->shared_stats.total_free_to_heap++;
+                }
+                batch = global_pop(global, &desc->shared_stats.global_retries);
+            }
+            global_reclaim_LH(global);  // Their frees were counted when they were retired
+            sys_atomic_ptr_destroy(&global->batches);
+            sys_atomic_destroy(&global->poppers);
+            sys_atomic_destroy(&global->batch_count);
         }
-        free(desc->global_pool);
-        desc->global_pool = 0;
 
         //
-        // Reclaim the items on thread pools
+        // Reclaim the items on thread pools, including those waiting to go to other nodes
         //
         qd_alloc_pool_t *tpool = DEQ_HEAD(desc->tpool_list);
         while (tpool) {
-            item = DEQ_HEAD(tpool->free_list);
-            while (item) {
-                DEQ_REMOVE_HEAD(tpool->free_list);
-                free(item);
-#if QD_MEMORY_STATS
-                desc->stats->total_free_to_heap++;
-#endif
-                item = DEQ_HEAD(tpool->free_list);
+            for (int list = -1; list < QD_ALLOC_MAX_NODES; list++) {
+                qd_alloc_item_list_t *free_list = list < 0 ? &tpool->free_list : &tpool->remote_list[list];
+                item = DEQ_HEAD(*free_list);
+                while (item) {
+                    DEQ_REMOVE_HEAD(*free_list);
+                    if (!desc->config->slab_size)
+                        free(item);
+                    desc->shared_stats.total_free_to_heap++;
+                    item = DEQ_HEAD(*free_list);
+                }
             }
 
+            qd_alloc_stats_add(&desc->shared_stats, &tpool->stats);
             DEQ_REMOVE_HEAD(desc->tpool_list);
             free(tpool);
             tpool = DEQ_HEAD(desc->tpool_list);
         }
 
+        //
+        // Release the slabs, which hold all of the items of slab types
+        //
+        while (desc->slabs) {
+            qd_alloc_slab_t *slab = desc->slabs;
+            desc->slabs = slab->next;
+            munmap(slab->base, slab->size);
+            free(slab);
+        }
+        desc->slab_cursor    = 0;
+        desc->slab_remaining = 0;
+
         //
         // Check the stats for lost items
         //
-#if QD_MEMORY_STATS
-        if (dump_file && desc->stats->total_free_to_heap < desc->stats->total_alloc_from_heap)
+        if (dump_file && desc->shared_stats.total_free_to_heap < desc->shared_stats.total_alloc_from_heap)
             fprintf(dump_file,
                     "alloc.c: Items of type '%s' remain allocated at shutdown: %"PRId64"\n",
                     desc->type_name,
-                    desc->stats->total_alloc_from_heap - desc->stats->total_free_to_heap);
-#endif
+                    desc->shared_stats.total_alloc_from_heap - desc->shared_stats.total_free_to_heap);
 
         //
         // Reclaim the descriptor components
         //
-#if QD_MEMORY_STATS
         free(desc->stats);
-#endif
+        free(desc->sites);
+        desc->sites = 0;
         sys_mutex_free(desc->lock);
         desc->lock = 0;
         desc->trailer = 0;
@@ -379,21 +831,101 @@ void qd_alloc_finalize(void)
 }
 
 
+//
+// Report the sampled allocation sites of a type, busiest first, as "symbol+offset: count".
+//
+static qd_error_t qd_alloc_refresh_sites(qd_entity_t *entity, qd_alloc_type_desc_t *desc)
+{
+    qd_alloc_site_t sites[QD_ALLOC_SITES];
+    int             count = 0;
+
+    sys_mutex_lock(desc->lock);
+    if (desc->sites) {
+        for (int idx = 0; idx < QD_ALLOC_SITES; idx++)
+            if (desc->sites[idx].site)
+                sites[count++] = desc->sites[idx];
+    }
+    sys_mutex_unlock(desc->lock);
+
+    if (qd_entity_set_list(entity, "allocationSites"))
+        return qd_error_code();
+
+    while (count > 0) {
+        int busiest = 0;
+        for (int idx = 1; idx < count; idx++)
+            if (sites[idx].count > sites[busiest].count)
+                busiest = idx;
+
+        char    text[256];
+        Dl_info info;
+        if (dladdr(sites[busiest].site, &info) && info.dli_sname)
+            snprintf(text, sizeof(text), "%s+0x%lx: %"PRIu64, info.dli_sname,
+                     (unsigned long) ((char*) sites[busiest].site - (char*) info.dli_saddr), sites[busiest].count);
+        else
+            snprintf(text, sizeof(text), "%p: %"PRIu64, sites[busiest].site, sites[busiest].count);
+        if (qd_entity_set_string(entity, "allocationSites", text))
+            return qd_error_code();
+
+        sites[busiest] = sites[--count];
+    }
+    return QD_ERROR_NONE;
+}
+
+
+qd_error_t qd_entity_configure_allocator(qd_entity_t *entity)
+{
+    char *type_name = qd_entity_get_string(entity, "typeName"); QD_ERROR_RET();
+    long  rate      = qd_entity_opt_long(entity, "sampleRate", 0);
+    if (qd_error_code()) {
+        free(type_name);
+        return qd_error_code();
+    }
+
+    qd_alloc_type_desc_t *desc = 0;
+    sys_mutex_lock(init_lock);
+    qd_alloc_type_t *type_item = DEQ_HEAD(type_list);
+    while (type_item && strcmp(type_item->desc->type_name, type_name) != 0)
+        type_item = DEQ_NEXT(type_item);
+    if (type_item)
+        desc = type_item->desc;
+    sys_mutex_unlock(init_lock);
+
+    qd_error_t err = QD_ERROR_NONE;
+    if (!desc)
+        err = qd_error(QD_ERROR_NOT_FOUND, "No allocator for type '%s'", type_name);
+    else if (rate < 0)
+        err = qd_error(QD_ERROR_VALUE, "sampleRate must not be negative");
+    else
+        qd_alloc_set_sample_rate(desc, (uint32_t) rate);
+    free(type_name);
+    return err;
+}
+
+
 qd_error_t qd_entity_refresh_allocator(qd_entity_t* entity, void *impl) {
     qd_alloc_type_t *alloc_type = (qd_alloc_type_t*) impl;
+    qd_alloc_stats_t *stats = qd_alloc_stats(alloc_type->desc);
     if (qd_entity_set_string(entity, "typeName", alloc_type->desc->type_name) == 0 &&
         qd_entity_set_long(entity, "typeSize", alloc_type->desc->total_size) == 0 &&
         qd_entity_set_long(entity, "transferBatchSize", alloc_type->desc->config->transfer_batch_size) == 0 &&
         qd_entity_set_long(entity, "localFreeListMax", alloc_type->desc->config->local_free_list_max) == 0 &&
-        qd_entity_set_long(entity, "globalFreeListMax", alloc_type->desc->config->global_free_list_max) == 0
-#if QD_MEMORY_STATS
-        && qd_entity_set_long(entity, "totalAllocFromHeap", alloc_type->desc->stats->total_alloc_from_heap) == 0 &&
-        qd_entity_set_long(entity, "totalFreeToHeap", alloc_type->desc->stats->total_free_to_heap) == 0 &&
-        qd_entity_set_long(entity, "heldByThreads", alloc_type->desc->stats->held_by_threads) == 0 &&
-        qd_entity_set_long(entity, "batchesRebalancedToThreads", alloc_type->desc->stats->batches_rebalanced_to_threads) == 0 &&
-        qd_entity_set_long(entity, "batchesRebalancedToGlobal", alloc_type->desc->stats->batches_rebalanced_to_global) == 0
-#endif
-        )
+        qd_entity_set_long(entity, "globalFreeListMax", alloc_type->desc->config->global_free_list_max) == 0 &&
+        qd_entity_set_long(entity, "bytesReclaimed", alloc_type->desc->bytes_reclaimed) == 0 &&
+        qd_entity_set_long(entity, "bufferMemoryInUse", qd_buffer_memory_in_use()) == 0 &&
+        qd_entity_set_long(entity, "bufferMemoryLimit", qd_buffer_memory_limit()) == 0 &&
+        qd_entity_set_bool(entity, "bufferMemoryConstrained", qd_buffer_memory_constrained()) == 0 &&
+        qd_entity_set_long(entity, "totalAllocFromHeap", stats->total_alloc_from_heap) == 0 &&
+        qd_entity_set_long(entity, "totalFreeToHeap", stats->total_free_to_heap) == 0 &&
+        qd_entity_set_long(entity, "heldByThreads", stats->held_by_threads) == 0 &&
+        qd_entity_set_long(entity, "batchesRebalancedToThreads", stats->batches_rebalanced_to_threads) == 0 &&
+        qd_entity_set_long(entity, "batchesRebalancedToGlobal", stats->batches_rebalanced_to_global) == 0 &&
+        qd_entity_set_long(entity, "totalAllocs", stats->total_allocs) == 0 &&
+        qd_entity_set_long(entity, "totalFrees", stats->total_frees) == 0 &&
+        qd_entity_set_long(entity, "globalRetries", stats->global_retries) == 0 &&
+        qd_entity_set_long(entity, "lockWaitNs", stats->lock_wait_ns) == 0 &&
+        qd_entity_set_long(entity, "inUse", stats->total_allocs - stats->total_frees) == 0 &&
+        qd_entity_set_long(entity, "sampleRate", alloc_type->desc->sample_rate) == 0 &&
+        qd_alloc_refresh_sites(entity, alloc_type->desc) == 0)
         return QD_ERROR_NONE;
     return qd_error_code();
 }
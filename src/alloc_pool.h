@@ -21,7 +21,9 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <qpid/dispatch/threading.h>
+#include <qpid/dispatch/atomic.h>
 #include <qpid/dispatch/ctools.h>
 
 /**
@@ -40,20 +42,53 @@ DEQ_DECLARE(qd_alloc_pool_t, qd_alloc_pool_list_t);
 
 /** Allocation configuration. */
 typedef struct {
-    int  transfer_batch_size;
-    int  local_free_list_max;
-    int  global_free_list_max;
+    int    transfer_batch_size;
+    int    local_free_list_max;
+    int    global_free_list_max;
+    size_t slab_size;   ///< If non-zero, carve items out of slabs of this many octets rather than allocating each from the heap
+    bool   huge_pages;  ///< If true, try to back slabs with huge pages (MAP_HUGETLB)
 } qd_alloc_config_t;
 
-/** Allocation statistics. */
+/** A large block of memory from which items are carved. */
+typedef struct qd_alloc_slab_t qd_alloc_slab_t;
+
+/**
+ * Allocation statistics.  Each thread pool counts its own, without atomics; the type's
+ * totals are summed on demand by qd_alloc_stats.
+ */
 typedef struct {
     uint64_t total_alloc_from_heap;
     uint64_t total_free_to_heap;
     uint64_t held_by_threads;
     uint64_t batches_rebalanced_to_threads;
     uint64_t batches_rebalanced_to_global;
+    uint64_t total_allocs;
+    uint64_t total_frees;
+    uint64_t global_retries;  ///< Pushes and pops of the global stack that lost a race and tried again
+    uint64_t lock_wait_ns;    ///< Time spent waiting for the type's lock to take memory from the heap
 } qd_alloc_stats_t;
 
+/** An allocation site counted by the sampler: the caller of new_T */
+typedef struct {
+    void     *site;
+    uint64_t  count;
+} qd_alloc_site_t;
+
+/** Distinct allocation sites the sampler records per type */
+#define QD_ALLOC_SITES 64
+
+/** NUMA nodes whose memory the pools keep apart; higher-numbered nodes share these */
+#define QD_ALLOC_MAX_NODES 4
+
+/** One NUMA node's share of a type's global pool: a lock-free stack of free batches. */
+typedef struct {
+    sys_atomic_ptr_t         batches     __attribute__((aligned(64)));  ///< Stack head, carrying an ABA tag
+    sys_atomic_t             poppers;      ///< Threads in the middle of a pop
+    sys_atomic_t             batch_count;  ///< Batches on the stack, counted before they are pushed
+    uint32_t                 batch_low;    ///< Fewest batches on the stack since the last trim
+    struct qd_alloc_item_t  *retired;      ///< Batches waiting to be freed, under the type's lock
+} qd_alloc_global_t;
+
 /** Allocation type descriptor. */
 typedef struct {
     uint32_t              header;
@@ -62,17 +97,44 @@ typedef struct {
     size_t               *additional_size;
     size_t                total_size;
     qd_alloc_config_t    *config;
-    qd_alloc_stats_t     *stats           __attribute__((aligned(64)));
-    qd_alloc_pool_t      *global_pool;
+    uint32_t              sample_rate;     ///< If non-zero, record the site of one allocation in this many
+    qd_alloc_stats_t     *stats           __attribute__((aligned(64)));  ///< Totals, refreshed by qd_alloc_stats
     sys_mutex_t          *lock;
     qd_alloc_pool_list_t  tpool_list;
     uint32_t              trailer;
+    qd_alloc_slab_t      *slabs;           ///< Slabs owned by this type, newest first
+    unsigned char        *slab_cursor;     ///< Next free octet in the newest slab
+    size_t                slab_remaining;  ///< Octets left in the newest slab
+    qd_alloc_global_t     global[QD_ALLOC_MAX_NODES];  ///< Global pool, one part per NUMA node
+    uint64_t              bytes_reclaimed;     ///< Octets returned to the heap by qd_alloc_trim
+    qd_alloc_stats_t      shared_stats;        ///< Counts that belong to no thread pool (trim, shutdown)
+    qd_alloc_site_t      *sites;               ///< Sampled allocation sites, QD_ALLOC_SITES of them
+    uint64_t              sites_dropped;       ///< Samples that found the site table full
 } qd_alloc_type_desc_t;
 
 /** Allocate in a thread pool. Use via ALLOC_DECLARE */
 void *qd_alloc(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool);
+/** Allocate in a thread pool, counting toward the sampled allocation sites. Use via ALLOC_DECLARE */
+void *qd_alloc_sampled(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool, void *site);
 /** De-allocate from a thread pool. Use via ALLOC_DECLARE */
 void qd_dealloc(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool, char *p);
+/** Sum the thread pools' statistics for a type into desc->stats and return it */
+qd_alloc_stats_t *qd_alloc_stats(qd_alloc_type_desc_t *desc);
+/**
+ * Start (rate > 0) or stop (rate == 0) recording the call site of one allocation of the
+ * type in every 'rate'.  Changing the rate clears the sites recorded so far.
+ */
+void qd_alloc_set_sample_rate(qd_alloc_type_desc_t *desc, uint32_t rate);
+
+/** Receives one allocation type's name, item size and summed statistics */
+typedef void (*qd_alloc_visit_t)(void *context, const char *type_name, size_t type_size, const qd_alloc_stats_t *stats);
+
+/**
+ * Call visit for every registered allocation type with a private copy of its statistics.
+ * Unlike qd_alloc_stats this does not write the type's shared totals, so it is safe to
+ * use from any thread.
+ */
+void qd_alloc_each_type(qd_alloc_visit_t visit, void *context);
 
 /**
  * Declare functions new_T and alloc_T
@@ -89,9 +151,12 @@ void qd_dealloc(qd_alloc_type_desc_t *desc, qd_alloc_pool_t **tpool, char *p);
 #define ALLOC_DEFINE_CONFIG(T,S,A,C)                                \
     qd_alloc_type_desc_t __desc_##T  __attribute__((aligned(64))) = {0, #T, S, A, 0, C, 0, 0, 0, {0,0}, 0}; \
     __thread qd_alloc_pool_t *__local_pool_##T = 0;                     \
-    T *new_##T(void) { return (T*) qd_alloc(&__desc_##T, &__local_pool_##T); }  \
+    T *new_##T(void) {                                                  \
+        if (__builtin_expect(__desc_##T.sample_rate != 0, 0))           \
+            return (T*) qd_alloc_sampled(&__desc_##T, &__local_pool_##T, __builtin_return_address(0)); \
+        return (T*) qd_alloc(&__desc_##T, &__local_pool_##T); }         \
     void free_##T(T *p) { qd_dealloc(&__desc_##T, &__local_pool_##T, (char*) p); } \
-    qd_alloc_stats_t *alloc_stats_##T(void) { return __desc_##T.stats; } \
+    qd_alloc_stats_t *alloc_stats_##T(void) { return qd_alloc_stats(&__desc_##T); } \
     void *unused##T
 
 /**
@@ -103,4 +168,22 @@ void qd_alloc_initialize(void);
 void qd_alloc_debug_dump(const char *file);
 void qd_alloc_finalize(void);
 
+/**
+ * Keep the memory of each NUMA node apart.  Thread pools take their memory from the node
+ * the thread runs on, and items freed on another node are returned to their own node's
+ * global pool.  Worth enabling only when worker threads are bound to nodes.
+ */
+void qd_alloc_set_numa_aware(bool aware);
+
+/**
+ * Return to the heap the global batches of each type that have gone unused since the
+ * previous call: the low watermark of the type's global stack over the interval.  Meant
+ * to be called periodically so that memory taken during a traffic burst is eventually
+ * released.  Types that allocate from slabs are left alone.  A batch that a concurrent
+ * pop may still be reading is freed by a later trim, or when another batch goes to the heap.
+ *
+ * @return The number of octets released by this call.
+ */
+size_t qd_alloc_trim(void);
+
 #endif
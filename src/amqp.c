@@ -28,6 +28,7 @@ const char * const QD_MA_TRACE   = "x-opt-qd.trace";
 const char * const QD_MA_TO      = "x-opt-qd.to";
 const char * const QD_MA_PHASE   = "x-opt-qd.phase";
 const char * const QD_MA_CLASS   = "x-opt-qd.class";
+const char * const QD_MA_SPAN    = "x-opt-qd.span";
 
 const char * const QD_CAPABILITY_ROUTER_CONTROL  = "qd.router";
 const char * const QD_CAPABILITY_ROUTER_DATA     = "qd.router-data";
@@ -39,6 +40,8 @@ const char * const QD_CONNECTION_PROPERTY_PRODUCT_KEY           = "product";
 const char * const QD_CONNECTION_PROPERTY_PRODUCT_VALUE         = "qpid-dispatch-router";
 const char * const QD_CONNECTION_PROPERTY_VERSION_KEY           = "version";
 const char * const QD_CONNECTION_PROPERTY_COST_KEY              = "qd.inter-router-cost";
+const char * const QD_CONNECTION_PROPERTY_DATA_KEY              = "qd.inter-router-data";
+const char * const QD_CONNECTION_PROPERTY_COMPRESSION_KEY       = "qd.compression";
 const char * const QD_CONNECTION_PROPERTY_FAILOVER_LIST_KEY     = "failover-server-list";
 const char * const QD_CONNECTION_PROPERTY_FAILOVER_NETHOST_KEY  = "network-host";
 const char * const QD_CONNECTION_PROPERTY_FAILOVER_PORT_KEY     = "port";
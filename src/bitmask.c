@@ -22,19 +22,27 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 
-#define QD_BITMASK_LONGS 2
-#define QD_BITMASK_BITS  (QD_BITMASK_LONGS * 64)
+//
+// The width is chosen once at startup, before the first bitmask is created, and is a
+// whole number of 64-bit words.  The words follow the structure in the same allocation.
+//
+#define QD_BITMASK_DEFAULT_BITS 128
+
+static int    bitmask_longs = QD_BITMASK_DEFAULT_BITS / 64;
+static size_t bitmask_size  = (QD_BITMASK_DEFAULT_BITS / 64) * sizeof(uint64_t);
+static int    width_locked  = 0;
 
 struct qd_bitmask_t {
-    uint64_t array[QD_BITMASK_LONGS];
     int      first_set;
     int      cardinality;
+    uint64_t array[];
 };
 
 ALLOC_DECLARE(qd_bitmask_t);
-ALLOC_DEFINE(qd_bitmask_t);
+ALLOC_DEFINE_CONFIG(qd_bitmask_t, sizeof(qd_bitmask_t), &bitmask_size, 0);
 
 #define MASK_INDEX(num)  (num / 64)
 #define MASK_ONEHOT(num) (((uint64_t) 1) << (num % 64))
@@ -42,14 +50,25 @@ ALLOC_DEFINE(qd_bitmask_t);
 #define FIRST_UNKNOWN -2
 
 
+void qd_bitmask_set_width(int bits)
+{
+    assert(!width_locked);
+    if (bits < 64)
+        bits = 64;
+    bitmask_longs = (bits + 63) / 64;
+    bitmask_size  = bitmask_longs * sizeof(uint64_t);
+}
+
+
 int qd_bitmask_width()
 {
-    return QD_BITMASK_BITS;
+    return bitmask_longs * 64;
 }
 
 
 qd_bitmask_t *qd_bitmask(int initial)
 {
+    width_locked = 1;
     qd_bitmask_t *b = new_qd_bitmask_t();
     if (initial)
         qd_bitmask_set_all(b);
@@ -68,17 +87,15 @@ void qd_bitmask_free(qd_bitmask_t *b)
 
 void qd_bitmask_set_all(qd_bitmask_t *b)
 {
-    for (int i = 0; i < QD_BITMASK_LONGS; i++)
-        b->array[i] = 0xFFFFFFFFFFFFFFFF;
+    memset(b->array, 0xFF, bitmask_size);
     b->first_set   = 0;
-    b->cardinality = QD_BITMASK_BITS;
+    b->cardinality = bitmask_longs * 64;
 }
 
 
 void qd_bitmask_clear_all(qd_bitmask_t *b)
 {
-    for (int i = 0; i < QD_BITMASK_LONGS; i++)
-        b->array[i] = 0;
+    memset(b->array, 0, bitmask_size);
     b->first_set   = FIRST_NONE;
     b->cardinality = 0;
 }
@@ -87,7 +104,7 @@ void qd_bitmask_clear_all(qd_bitmask_t *b)
 int qd_bitmask_set_bit(qd_bitmask_t *b, int bitnum)
 {
     int old_value = 1;
-    assert(bitnum < QD_BITMASK_BITS);
+    assert(bitnum < bitmask_longs * 64);
     if ((b->array[MASK_INDEX(bitnum)] & MASK_ONEHOT(bitnum)) == 0) {
         old_value = 0;
         b->cardinality++;
@@ -104,7 +121,7 @@ int qd_bitmask_set_bit(qd_bitmask_t *b, int bitnum)
 int qd_bitmask_clear_bit(qd_bitmask_t *b, int bitnum)
 {
     int old_value = 0;
-    assert(bitnum < QD_BITMASK_BITS);
+    assert(bitnum < bitmask_longs * 64);
     if (b->array[MASK_INDEX(bitnum)] & MASK_ONEHOT(bitnum)) {
         old_value = 1;
         b->cardinality--;
@@ -124,20 +141,29 @@ int qd_bitmask_value(qd_bitmask_t *b, int bitnum)
 }
 
 
-int qd_bitmask_first_set(qd_bitmask_t *b, int *bitnum)
+/**
+ * The lowest set bit at or above bitnum, or FIRST_NONE.
+ */
+static inline int qd_bitmask_scan(const qd_bitmask_t *b, int bitnum)
 {
-    if (b->first_set == FIRST_UNKNOWN) {
-        b->first_set = FIRST_NONE;
-        for (int i = 0; i < QD_BITMASK_LONGS; i++)
-            if (b->array[i]) {
-                for (int j = 0; j < 64; j++)
-                    if ((((uint64_t) 1) << j) & b->array[i]) {
-                        b->first_set = i * 64 + j;
-                        break;
-                    }
-                break;
-            }
+    int idx = MASK_INDEX(bitnum);
+    if (idx >= bitmask_longs)
+        return FIRST_NONE;
+
+    uint64_t word = b->array[idx] & (~((uint64_t) 0) << (bitnum % 64));
+    while (!word) {
+        if (++idx == bitmask_longs)
+            return FIRST_NONE;
+        word = b->array[idx];
     }
+    return idx * 64 + __builtin_ctzll(word);
+}
+
+
+int qd_bitmask_first_set(qd_bitmask_t *b, int *bitnum)
+{
+    if (b->first_set == FIRST_UNKNOWN)
+        b->first_set = qd_bitmask_scan(b, 0);
 
     if (b->first_set == FIRST_NONE)
         return 0;
@@ -152,6 +178,30 @@ int qd_bitmask_cardinality(const qd_bitmask_t *b)
 }
 
 
+void qd_bitmask_or(qd_bitmask_t *b, const qd_bitmask_t *other)
+{
+    int cardinality = 0;
+    for (int i = 0; i < bitmask_longs; i++) {
+        b->array[i] |= other->array[i];
+        cardinality += __builtin_popcountll(b->array[i]);
+    }
+    b->cardinality = cardinality;
+    b->first_set   = cardinality ? FIRST_UNKNOWN : FIRST_NONE;
+}
+
+
+void qd_bitmask_and(qd_bitmask_t *b, const qd_bitmask_t *other)
+{
+    int cardinality = 0;
+    for (int i = 0; i < bitmask_longs; i++) {
+        b->array[i] &= other->array[i];
+        cardinality += __builtin_popcountll(b->array[i]);
+    }
+    b->cardinality = cardinality;
+    b->first_set   = cardinality ? FIRST_UNKNOWN : FIRST_NONE;
+}
+
+
 int _qdbm_start(qd_bitmask_t *b)
 {
     int v;
@@ -163,30 +213,5 @@ int _qdbm_start(qd_bitmask_t *b)
 
 void _qdbm_next(qd_bitmask_t *b, int *v)
 {
-    if (*v == QD_BITMASK_BITS - 1) {
-        *v = -1;
-        return;
-    }
-
-    int      idx  = MASK_INDEX(*v);
-    uint64_t bits = MASK_ONEHOT(*v);
-    int      next = *v;
-
-    while (1) {
-        next++;
-        if (bits & 0x8000000000000000LL) {
-            if (++idx == QD_BITMASK_LONGS) {
-                *v = -1;
-                return;
-            }
-            bits = 1;
-        } else
-            bits = bits << 1;
-
-        if (b->array[idx] & bits) {
-            *v = next;
-            return;
-        }
-    }
+    *v = qd_bitmask_scan(b, *v + 1);
 }
-
@@ -19,16 +19,125 @@
 
 #include <qpid/dispatch/buffer.h>
 #include "alloc.h"
+#include <qpid/dispatch/atomic.h>
 
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
 
 
-static size_t buffer_size = 512;
+static size_t buffer_size        = 512;
+static size_t buffer_size_medium = 4096;
+static size_t buffer_size_large  = 65536;
 static int    size_locked = 0;
 
+//
+// The medium and large size classes share the buffer structure but are carved from their
+// own pools.  Large buffers are expensive to hoard, so their thread-local free lists are
+// kept short.
+//
+typedef qd_buffer_t qd_buffer_medium_t;
+typedef qd_buffer_t qd_buffer_large_t;
+
+//
+// A clone is a buffer of capacity 0 whose data area holds a reference to the buffer with
+// the data, which the clone keeps alive through its refs count.  Clones are never made
+// of clones: cloning one references its origin directly.
+//
+typedef qd_buffer_t qd_buffer_clone_t;
+static size_t buffer_size_clone = sizeof(qd_buffer_t*);
+
+//
+// Small buffers are carved from 2MB slabs, on huge pages where the system has them
+// reserved, to keep the many live buffers of a busy router within few TLB entries.  Slab
+// memory is never given back, so the medium and large classes, which hold most of the
+// octets after a burst of big messages, are allocated from the heap where the periodic
+// trim can return them.
+//
+static qd_alloc_config_t buffer_config        = {16, 32, 0, 2 * 1024 * 1024, true};
+static qd_alloc_config_t buffer_medium_config = {16, 32, 0};
+static qd_alloc_config_t buffer_large_config  = {2,  4,  0};
+
+//
+// Octets held in buffers.  Each thread gathers its allocations and frees in a count of
+// its own and adds it to the shared total only when it reaches BUFFER_FLUSH_OCTETS one
+// way or the other, so the shared total is written once per that much buffer traffic
+// rather than for every buffer.  The total may lag by up to BUFFER_FLUSH_OCTETS for each
+// thread, and goes briefly negative when one thread frees what others have counted.
+// A thread's remainder is flushed when it exits, by the destructor of memory_key.
+//
+#define BUFFER_FLUSH_OCTETS (256 * 1024)
+
+static sys_atomic64_t   memory_in_use;
+static __thread int64_t memory_unflushed;
+static __thread bool    memory_registered;
+static pthread_key_t    memory_key;
+static pthread_once_t   memory_key_once = PTHREAD_ONCE_INIT;
+static uint64_t         memory_high = 0;
+static uint64_t         memory_low  = 0;
+static sys_atomic_t     memory_constrained;
+
 ALLOC_DECLARE(qd_buffer_t);
-ALLOC_DEFINE_CONFIG(qd_buffer_t, sizeof(qd_buffer_t), &buffer_size, 0);
+ALLOC_DEFINE_CONFIG(qd_buffer_t, sizeof(qd_buffer_t), &buffer_size, &buffer_config);
+ALLOC_DECLARE(qd_buffer_medium_t);
+ALLOC_DEFINE_CONFIG(qd_buffer_medium_t, sizeof(qd_buffer_t), &buffer_size_medium, &buffer_medium_config);
+ALLOC_DECLARE(qd_buffer_large_t);
+ALLOC_DEFINE_CONFIG(qd_buffer_large_t, sizeof(qd_buffer_t), &buffer_size_large, &buffer_large_config);
+ALLOC_DECLARE(qd_buffer_clone_t);
+ALLOC_DEFINE_CONFIG(qd_buffer_clone_t, sizeof(qd_buffer_t), &buffer_size_clone, &buffer_config);
+
+
+static inline qd_buffer_t *buffer_origin(qd_buffer_t *clone)
+{
+    return *(qd_buffer_t**) &clone[1];
+}
+
+
+static void memory_thread_exit(void *unflushed)
+{
+    sys_atomic64_add(&memory_in_use, (uint64_t) *(int64_t*) unflushed);
+    *(int64_t*) unflushed = 0;
+}
+
+
+static void memory_key_create(void)
+{
+    pthread_key_create(&memory_key, memory_thread_exit);
+}
+
+
+static void memory_register(void)
+{
+    pthread_once(&memory_key_once, memory_key_create);
+    pthread_setspecific(memory_key, &memory_unflushed);
+    memory_registered = true;
+}
+
+
+static inline void buffer_account(int64_t octets)
+{
+    if (!memory_registered)
+        memory_register();
+    memory_unflushed += octets;
+    if (memory_unflushed >= BUFFER_FLUSH_OCTETS || memory_unflushed <= -BUFFER_FLUSH_OCTETS) {
+        sys_atomic64_add(&memory_in_use, (uint64_t) memory_unflushed);
+        memory_unflushed = 0;
+    }
+}
+
+
+void qd_buffer_initialize(void)
+{
+    sys_atomic64_init(&memory_in_use, 0);
+    sys_atomic_init(&memory_constrained, 0);
+}
+
+
+void qd_buffer_finalize(void)
+{
+    sys_atomic64_destroy(&memory_in_use);
+    sys_atomic_destroy(&memory_constrained);
+}
 
 
 void qd_buffer_set_size(size_t size)
@@ -43,8 +152,39 @@ qd_buffer_t *qd_buffer(void)
     size_locked = 1;
     qd_buffer_t *buf = new_qd_buffer_t();
 
+    DEQ_ITEM_INIT(buf);
+    buf->size     = 0;
+    buf->capacity = buffer_size;
+    sys_atomic_init(&buf->refs, 1);
+    buffer_account(buffer_size);
+    return buf;
+}
+
+
+qd_buffer_t *qd_buffer_sized(size_t hint)
+{
+    qd_buffer_t *buf;
+
+    //
+    // Pick the largest class that the hint will fill so that no more than one small
+    // buffer's worth of space is left unused at the end of the data.  Classes that are
+    // not larger than the default buffer size are never used.
+    //
+    if (hint >= buffer_size_large && buffer_size_large > buffer_size) {
+        size_locked = 1;
+        buf = new_qd_buffer_large_t();
+        buf->capacity = buffer_size_large;
+    } else if (hint >= buffer_size_medium && buffer_size_medium > buffer_size) {
+        size_locked = 1;
+        buf = new_qd_buffer_medium_t();
+        buf->capacity = buffer_size_medium;
+    } else
+        return qd_buffer();
+
     DEQ_ITEM_INIT(buf);
     buf->size = 0;
+    sys_atomic_init(&buf->refs, 1);
+    buffer_account(buf->capacity);
     return buf;
 }
 
@@ -52,25 +192,89 @@ qd_buffer_t *qd_buffer(void)
 void qd_buffer_free(qd_buffer_t *buf)
 {
     if (!buf) return;
-    free_qd_buffer_t(buf);
+    if (buf->capacity == 0) {
+        qd_buffer_t *origin = buffer_origin(buf);
+        sys_atomic_destroy(&buf->refs);
+        free_qd_buffer_clone_t(buf);
+        buf = origin;
+    }
+
+    //
+    // A sole reference can't be cloned concurrently, so only shared buffers pay for the
+    // atomic decrement.
+    //
+    if (sys_atomic_get(&buf->refs) != 1 && sys_atomic_dec(&buf->refs) != 1)
+        return;
+    sys_atomic_destroy(&buf->refs);
+    buffer_account(-(int64_t) buf->capacity);
+
+    if (buf->capacity == buffer_size)
+        free_qd_buffer_t(buf);
+    else if (buf->capacity == buffer_size_medium)
+        free_qd_buffer_medium_t(buf);
+    else
+        free_qd_buffer_large_t(buf);
+}
+
+
+void qd_buffer_set_memory_limit(uint64_t high, uint64_t low)
+{
+    memory_high = high;
+    memory_low  = low < high ? low : high;
+    sys_atomic_swap(&memory_constrained, 0);
+}
+
+
+uint64_t qd_buffer_memory_in_use(void)
+{
+    int64_t in_use = (int64_t) sys_atomic64_get(&memory_in_use) + memory_unflushed;
+    return in_use > 0 ? (uint64_t) in_use : 0;
+}
+
+
+uint64_t qd_buffer_memory_limit(void)
+{
+    return memory_high;
+}
+
+
+bool qd_buffer_memory_constrained(void)
+{
+    if (memory_high == 0)
+        return false;
+
+    //
+    // Callers on different threads may race to flip the state, but each flips it by the
+    // same hysteresis so it settles on what the latest reading calls for.
+    //
+    uint64_t in_use      = qd_buffer_memory_in_use();
+    bool     constrained = sys_atomic_get(&memory_constrained) != 0;
+    bool     now         = in_use > (constrained ? memory_low : memory_high);
+    if (now != constrained)
+        sys_atomic_swap(&memory_constrained, now);
+    return now;
 }
 
 
 unsigned char *qd_buffer_base(qd_buffer_t *buf)
 {
+    if (buf->capacity == 0)
+        buf = buffer_origin(buf);
     return (unsigned char*) &buf[1];
 }
 
 
 unsigned char *qd_buffer_cursor(qd_buffer_t *buf)
 {
-    return ((unsigned char*) &buf[1]) + buf->size;
+    return qd_buffer_base(buf) + buf->size;
 }
 
 
 size_t qd_buffer_capacity(qd_buffer_t *buf)
 {
-    return buffer_size - buf->size;
+    if (buf->capacity == 0 || sys_atomic_get(&buf->refs) > 1)
+        return 0;
+    return buf->capacity - buf->size;
 }
 
 
@@ -82,8 +286,8 @@ size_t qd_buffer_size(qd_buffer_t *buf)
 
 void qd_buffer_insert(qd_buffer_t *buf, size_t len)
 {
+    assert(len <= qd_buffer_capacity(buf));
     buf->size += len;
-    assert(buf->size <= buffer_size);
 }
 
 unsigned int qd_buffer_list_clone(qd_buffer_list_t *dst, const qd_buffer_list_t *src)
@@ -92,13 +296,31 @@ unsigned int qd_buffer_list_clone(qd_buffer_list_t *dst, const qd_buffer_list_t
     DEQ_INIT(*dst);
     qd_buffer_t *buf = DEQ_HEAD(*src);
     while (buf) {
-        size_t to_copy = qd_buffer_size(buf);
-        unsigned char *src = qd_buffer_base(buf);
+        size_t       to_copy = qd_buffer_size(buf);
+        qd_buffer_t *origin  = buf->capacity == 0 ? buffer_origin(buf) : buf;
         len += to_copy;
+
+        if (to_copy && sys_atomic_get(&origin->refs) > 0) {
+            sys_atomic_inc(&origin->refs);
+            qd_buffer_t *clone = new_qd_buffer_clone_t();
+            DEQ_ITEM_INIT(clone);
+            clone->size     = to_copy;
+            clone->capacity = 0;
+            sys_atomic_init(&clone->refs, 1);
+            *(qd_buffer_t**) &clone[1] = origin;
+            DEQ_INSERT_TAIL(*dst, clone);
+            buf = DEQ_NEXT(buf);
+            continue;
+        }
+
+        //
+        // The buffers that are not the pools' own, a message's inline buffer, are copied.
+        //
+        unsigned char *src = qd_buffer_base(buf);
         while (to_copy) {
-            qd_buffer_t *newbuf = qd_buffer();
+            qd_buffer_t *newbuf = qd_buffer_sized(to_copy);
             size_t count = qd_buffer_capacity(newbuf);
-            // default buffer capacity may have changed,
+            // the source may be from a different size class,
             // so don't assume it will fit:
             if (count > to_copy) count = to_copy;
             memcpy(qd_buffer_cursor(newbuf), src, count);
@@ -50,6 +50,15 @@ static void qd_insert(qd_composed_field_t *field, const uint8_t *seq, size_t len
     qd_buffer_t    *buf  = DEQ_TAIL(field->buffers);
     qd_composite_t *comp = DEQ_HEAD(field->fieldStack);
 
+    if (field->flat) {
+        if (field->flat_size + len <= field->flat_capacity)
+            memcpy(field->flat_memory + field->flat_size, seq, len);
+        field->flat_size += len;
+        if (comp)
+            comp->length += len;
+        return;
+    }
+
     while (len > 0) {
         if (buf == 0 || qd_buffer_capacity(buf) == 0) {
             buf = qd_buffer();
@@ -118,10 +127,21 @@ static void qd_overwrite(qd_buffer_t **buf, size_t *cursor, uint8_t value)
 }
 
 
-static void qd_overwrite_32(qd_field_location_t *field, uint32_t value)
+static void qd_overwrite_32(qd_composed_field_t *field, qd_field_location_t *location, uint32_t value)
 {
-    qd_buffer_t *buf    = field->buffer;
-    size_t       cursor = field->offset;
+    if (field->flat) {
+        if (location->offset + 4 <= field->flat_capacity) {
+            uint8_t *octets = field->flat_memory + location->offset;
+            octets[0] = (uint8_t) ((value & 0xFF000000) >> 24);
+            octets[1] = (uint8_t) ((value & 0x00FF0000) >> 16);
+            octets[2] = (uint8_t) ((value & 0x0000FF00) >> 8);
+            octets[3] = (uint8_t)  (value & 0x000000FF);
+        }
+        return;
+    }
+
+    qd_buffer_t *buf    = location->buffer;
+    size_t       cursor = location->offset;
 
     qd_overwrite(&buf, &cursor, (uint8_t) ((value & 0xFF000000) >> 24));
     qd_overwrite(&buf, &cursor, (uint8_t) ((value & 0x00FF0000) >> 16));
@@ -145,10 +165,11 @@ static void qd_compose_start_composite(qd_composed_field_t *field, int isMap)
     comp->isMap = isMap;
 
     //
-    // Mark the current location to later overwrite the length
+    // Mark the current location to later overwrite the length.  A flat field
+    // marks it by offset alone.
     //
     comp->length_location.buffer = DEQ_TAIL(field->buffers);
-    comp->length_location.offset = qd_buffer_size(comp->length_location.buffer);
+    comp->length_location.offset = field->flat ? field->flat_size : qd_buffer_size(comp->length_location.buffer);
     comp->length_location.length = 4;
     comp->length_location.parsed = 1;
 
@@ -158,7 +179,7 @@ static void qd_compose_start_composite(qd_composed_field_t *field, int isMap)
     // Mark the current location to later overwrite the count
     //
     comp->count_location.buffer = DEQ_TAIL(field->buffers);
-    comp->count_location.offset = qd_buffer_size(comp->count_location.buffer);
+    comp->count_location.offset = field->flat ? field->flat_size : qd_buffer_size(comp->count_location.buffer);
     comp->count_location.length = 4;
     comp->count_location.parsed = 1;
 
@@ -176,8 +197,8 @@ static void qd_compose_end_composite(qd_composed_field_t *field)
     qd_composite_t *comp = DEQ_HEAD(field->fieldStack);
     assert(comp);
 
-    qd_overwrite_32(&comp->length_location, comp->length);
-    qd_overwrite_32(&comp->count_location,  comp->count);
+    qd_overwrite_32(field, &comp->length_location, comp->length);
+    qd_overwrite_32(field, &comp->count_location,  comp->count);
 
     DEQ_REMOVE_HEAD(field->fieldStack);
 
@@ -205,6 +226,7 @@ qd_composed_field_t *qd_compose_subfield(qd_composed_field_t *extend)
         if (!field)
             return 0;
 
+        ZERO(field);
         DEQ_INIT(field->buffers);
         DEQ_INIT(field->fieldStack);
     }
@@ -213,6 +235,49 @@ qd_composed_field_t *qd_compose_subfield(qd_composed_field_t *extend)
 }
 
 
+qd_composed_field_t *qd_compose_flat(uint8_t *memory, size_t capacity)
+{
+    qd_composed_field_t *field = qd_compose_subfield(0);
+
+    if (field) {
+        field->flat          = true;
+        field->flat_memory   = memory;
+        field->flat_capacity = memory ? capacity : 0;
+    }
+
+    return field;
+}
+
+
+size_t qd_compose_flat_size(const qd_composed_field_t *field)
+{
+    return field->flat_size;
+}
+
+
+//
+// Copy a list of buffers into a flat field.  The buffers are freed, as the
+// buffer form would have taken them, unless the field is only measuring.
+//
+static void qd_insert_flat_buffers(qd_composed_field_t *field, qd_buffer_list_t *buffers)
+{
+    qd_buffer_t *buf = DEQ_HEAD(*buffers);
+    while (buf) {
+        qd_insert(field, qd_buffer_base(buf), qd_buffer_size(buf));
+        buf = DEQ_NEXT(buf);
+    }
+
+    if (field->flat_memory) {
+        buf = DEQ_HEAD(*buffers);
+        while (buf) {
+            DEQ_REMOVE_HEAD(*buffers);
+            qd_buffer_free(buf);
+            buf = DEQ_HEAD(*buffers);
+        }
+    }
+}
+
+
 qd_composed_field_t *qd_compose(uint64_t performative, qd_composed_field_t *extend)
 {
     qd_composed_field_t *field = qd_compose_subfield(extend);
@@ -402,6 +467,12 @@ void qd_compose_insert_binary_buffers(qd_composed_field_t *field, qd_buffer_list
         qd_insert_32(field, len);
     }
 
+    if (field->flat) {
+        qd_insert_flat_buffers(field, buffers);
+        bump_count(field);
+        return;
+    }
+
     //
     // Move the supplied buffers to the tail of the field's buffer list.
     //
@@ -524,7 +595,10 @@ void qd_compose_insert_buffers(qd_composed_field_t *field,
                                qd_buffer_list_t *list)
 {
     uint32_t len = qd_buffer_list_length(list);
-    if (len) {
+    if (len && field->flat) {
+        qd_insert_flat_buffers(field, list);
+        bump_count(field);
+    } else if (len) {
         DEQ_APPEND(field->buffers, *list);
         bump_length(field, len);
         bump_count(field);
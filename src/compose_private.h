@@ -40,6 +40,10 @@ DEQ_DECLARE(qd_composite_t, qd_field_stack_t);
 struct qd_composed_field_t {
     qd_buffer_list_t buffers;
     qd_field_stack_t fieldStack;
+    bool             flat;          // Composing into flat_memory instead of buffers
+    uint8_t         *flat_memory;   // Null when only measuring
+    size_t           flat_capacity;
+    size_t           flat_size;     // Octets composed, may exceed flat_capacity
 };
 
 ALLOC_DECLARE(qd_composed_field_t);
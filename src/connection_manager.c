@@ -292,6 +292,10 @@ static qd_error_t load_server_config(qd_dispatch_t *qd, qd_server_config_t *conf
     config->http                 = qd_entity_opt_bool(entity, "http", false);         CHECK();
     config->http_root            = qd_entity_opt_string(entity, "httpRoot", false);   CHECK();
     config->http = config->http || config->http_root; /* httpRoot implies http */
+    config->http_metrics         = qd_entity_opt_bool(entity, "metrics", true);       CHECK();
+    config->http_deflate         = qd_entity_opt_bool(entity, "websocketDeflate", false); CHECK();
+    config->http_deflate_level   = qd_entity_opt_long(entity, "websocketDeflateLevel", 6); CHECK();
+    config->http_deflate_window_bits = qd_entity_opt_long(entity, "websocketDeflateWindowBits", 15); CHECK();
     config->max_frame_size       = qd_entity_get_long(entity, "maxFrameSize");        CHECK();
     config->max_sessions         = qd_entity_get_long(entity, "maxSessions");         CHECK();
     uint64_t ssn_frames          = qd_entity_opt_long(entity, "maxSessionFrames", 0); CHECK();
@@ -301,7 +305,16 @@ static qd_error_t load_server_config(qd_dispatch_t *qd, qd_server_config_t *conf
     config->sasl_mechanisms      = qd_entity_opt_string(entity, "saslMechanisms", 0); CHECK();
     config->ssl_profile          = qd_entity_opt_string(entity, "sslProfile", 0);     CHECK();
     config->link_capacity        = qd_entity_opt_long(entity, "linkCapacity", 0);     CHECK();
+    config->link_capacity_max    = qd_entity_opt_long(entity, "maxLinkCapacity", 0);  CHECK();
     config->multi_tenant         = qd_entity_opt_bool(entity, "multiTenant", false);  CHECK();
+    config->ssl_session_lifetime = qd_entity_opt_long(entity, "sslSessionLifetime", 300); CHECK();
+    config->max_handshakes       = qd_entity_opt_long(entity, "maxHandshakes", 0);    CHECK();
+    config->max_deferred_accepts = qd_entity_opt_long(entity, "maxDeferredAccepts", 0); CHECK();
+    config->busy_poll            = qd_entity_opt_long(entity, "busyPoll", 0);         CHECK();
+    config->backlog              = qd_entity_opt_long(entity, "backlog", 50);         CHECK();
+    config->tcp_quick_ack        = qd_entity_opt_bool(entity, "tcpQuickAck", false);  CHECK();
+    config->data_connection_count = qd_entity_opt_long(entity, "dataConnectionCount", 1); CHECK();
+    config->inter_router_compression = qd_entity_opt_bool(entity, "compression", false); CHECK();
     set_config_host(config, entity);
 
     //
@@ -310,6 +323,9 @@ static qd_error_t load_server_config(qd_dispatch_t *qd, qd_server_config_t *conf
     if (config->link_capacity == 0)
         config->link_capacity = 250;
 
+    if (config->link_capacity_max < config->link_capacity)
+        config->link_capacity_max = config->link_capacity;
+
     if (config->max_sessions == 0 || config->max_sessions > 32768)
         // Proton disallows > 32768
         config->max_sessions = 32768;
@@ -522,7 +538,14 @@ qd_listener_t *qd_dispatch_configure_listener(qd_dispatch_t *qd, qd_entity_t *en
 
 qd_error_t qd_entity_refresh_listener(qd_entity_t* entity, void *impl)
 {
-    return QD_ERROR_NONE;
+    qd_listener_t *li = (qd_listener_t*) impl;
+    if (qd_entity_set_long(entity, "acceptCount", li->accepts) == 0 &&
+        qd_entity_set_long(entity, "acceptsDeferred", li->accepts_deferred) == 0 &&
+        qd_entity_set_long(entity, "acceptsRejected", li->accepts_rejected) == 0 &&
+        qd_entity_set_long(entity, "handshakesInProgress", li->handshakes) == 0 &&
+        qd_entity_set_long(entity, "sslSessionsResumed", li->ssl_sessions_resumed) == 0)
+        return QD_ERROR_NONE;
+    return qd_error_code();
 }
 
 
@@ -537,6 +560,34 @@ qd_connector_t *qd_dispatch_configure_connector(qd_dispatch_t *qd, qd_entity_t *
     qd_connection_manager_t *cm = qd->connection_manager;
     qd_connector_t *ct = qd_server_connector(qd->server);
     if (ct && load_server_config(qd, &ct->config, entity) == QD_ERROR_NONE) {
+        char *fol = qd_entity_opt_string(entity, "failoverList", 0);
+        if (fol) {
+            ct->failover_list = qd_failover_list(fol);
+            free(fol);
+            if (ct->failover_list == 0) {
+                qd_log(cm->log_source, QD_LOG_ERROR, "Unable to create connector, bad failover list: %s",
+                       qd_error_message());
+                qd_connector_decref(ct);
+                return 0;
+            }
+        }
+
+        //
+        // An inter-router connector may open extra data-only connections to the same
+        // peer.  They are chained off the configured connector and share its lifetime.
+        //
+        bool inter_router = strcmp(ct->config.role, "inter-router") == 0;
+        for (int i = 1; inter_router && i < ct->config.data_connection_count; i++) {
+            qd_connector_t *dc = qd_server_connector(qd->server);
+            if (!dc || load_server_config(qd, &dc->config, entity) != QD_ERROR_NONE) {
+                qd_connector_decref(dc);
+                break;
+            }
+            dc->config.inter_router_data = true;
+            dc->data_connector = ct->data_connector;
+            ct->data_connector = dc;
+        }
+
         DEQ_ITEM_INIT(ct);
         DEQ_INSERT_TAIL(cm->connectors, ct);
         log_config(cm->log_source, &ct->config, "Connector");
@@ -612,7 +663,8 @@ void qd_connection_manager_start(qd_dispatch_t *qd)
     }
 
     while (ct) {
-        qd_connector_connect(ct);
+        for (qd_connector_t *c = ct; c; c = c->data_connector)
+            qd_connector_connect(c);
         ct = DEQ_NEXT(ct);
     }
 
@@ -651,11 +703,17 @@ void qd_connection_manager_delete_connector(qd_dispatch_t *qd, void *impl)
 {
     qd_connector_t *ct = (qd_connector_t*) impl;
     if (ct) {
-        sys_mutex_lock(ct->lock);
-        if (ct->ctx && ct->ctx->pn_conn) {
-            qd_connection_invoke_deferred(ct->ctx, deferred_close, ct->ctx->pn_conn);
+        for (qd_connector_t *c = ct; c; c = c->data_connector) {
+            sys_mutex_lock(c->lock);
+            if (c->ctx && c->ctx->pn_conn) {
+                qd_connection_invoke_deferred(c->ctx, deferred_close, c->ctx->pn_conn);
+            }
+            for (int i = 0; i < c->probe_count; i++) {
+                if (c->probes[i]->pn_conn)
+                    qd_connection_invoke_deferred(c->probes[i], deferred_close, c->probes[i]->pn_conn);
+            }
+            sys_mutex_unlock(c->lock);
         }
-        sys_mutex_unlock(ct->lock);
         DEQ_REMOVE(qd->connection_manager->connectors, ct);
         qd_connector_decref(ct);
     }
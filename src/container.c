@@ -32,6 +32,7 @@
 #include <qpid/dispatch/ctools.h>
 #include <qpid/dispatch/hash.h>
 #include <qpid/dispatch/threading.h>
+#include <qpid/dispatch/atomic.h>
 #include <qpid/dispatch/iterator.h>
 #include <qpid/dispatch/log.h>
 
@@ -66,11 +67,13 @@ ALLOC_DECLARE(qd_link_t);
 ALLOC_DEFINE(qd_link_t);
 
 
-typedef struct qdc_node_type_t {
-    DEQ_LINKS(struct qdc_node_type_t);
-    const qd_node_type_t *ntype;
-} qdc_node_type_t;
-DEQ_DECLARE(qdc_node_type_t, qdc_node_type_list_t);
+//
+// The node types are registered at startup and never removed.  They are kept in a fixed
+// array whose entries are written before the count that publishes them, so the event
+// handlers read them without a lock.  In practice the router is the only node type and
+// dispatching to it is a single array load.
+//
+#define QDC_NODE_TYPES_MAX 8
 
 struct qd_container_t {
     qd_dispatch_t        *qd;
@@ -81,7 +84,8 @@ struct qd_container_t {
     qd_node_list_t        nodes;
     sys_mutex_t          *lock;
     qd_node_t            *default_node;
-    qdc_node_type_list_t  node_type_list;
+    const qd_node_type_t *node_types[QDC_NODE_TYPES_MAX];
+    sys_atomic_t          node_type_count;
 };
 
 static void setup_outgoing_link(qd_container_t *container, pn_link_t *pn_link)
@@ -202,19 +206,9 @@ static void do_updated(pn_delivery_t *pnd)
 
 static void notify_opened(qd_container_t *container, qd_connection_t *conn, void *context)
 {
-    const qd_node_type_t *nt;
-
-    //
-    // Note the locking structure in this function.  Generally this would be unsafe, but since
-    // this particular list is only ever appended to and never has items inserted or deleted,
-    // this usage is safe in this case.
-    //
-    sys_mutex_lock(container->lock);
-    qdc_node_type_t *nt_item = DEQ_HEAD(container->node_type_list);
-    sys_mutex_unlock(container->lock);
-
-    while (nt_item) {
-        nt = nt_item->ntype;
+    int count = (int) sys_atomic_get(&container->node_type_count);
+    for (int i = 0; i < count; i++) {
+        const qd_node_type_t *nt = container->node_types[i];
         if (qd_connection_inbound(conn)) {
             if (nt->inbound_conn_opened_handler)
                 nt->inbound_conn_opened_handler(nt->type_context, conn, context);
@@ -222,10 +216,6 @@ static void notify_opened(qd_container_t *container, qd_connection_t *conn, void
             if (nt->outbound_conn_opened_handler)
                 nt->outbound_conn_opened_handler(nt->type_context, conn, context);
         }
-
-        sys_mutex_lock(container->lock);
-        nt_item = DEQ_NEXT(nt_item);
-        sys_mutex_unlock(container->lock);
     }
 }
 
@@ -236,27 +226,11 @@ void policy_notify_opened(void *container, qd_connection_t *conn, void *context)
 
 static void notify_closed(qd_container_t *container, qd_connection_t *conn, void *context)
 {
-    const qd_node_type_t *nt;
-
-    //
-    // Note the locking structure in this function.  Generally this would be unsafe, but since
-    // this particular list is only ever appended to and never has items inserted or deleted,
-    // this usage is safe in this case.
-    //
-    // This assumes that pointer assignment is atomic, which it is on most platforms.
-    //
-    sys_mutex_lock(container->lock);
-    qdc_node_type_t *nt_item = DEQ_HEAD(container->node_type_list);
-    sys_mutex_unlock(container->lock);
-
-    while (nt_item) {
-        nt = nt_item->ntype;
+    int count = (int) sys_atomic_get(&container->node_type_count);
+    for (int i = 0; i < count; i++) {
+        const qd_node_type_t *nt = container->node_types[i];
         if (nt->conn_closed_handler)
             nt->conn_closed_handler(nt->type_context, conn, context);
-
-        sys_mutex_lock(container->lock);
-        nt_item = DEQ_NEXT(nt_item);
-        sys_mutex_unlock(container->lock);
     }
 }
 
@@ -298,32 +272,22 @@ static int close_handler(qd_container_t *container, pn_connection_t *conn, qd_co
 
 static void writable_handler(qd_container_t *container, pn_connection_t *conn, qd_connection_t* qd_conn)
 {
-    const qd_node_type_t *nt;
-    //
-    // Note the locking structure in this function.  Generally this would be unsafe, but since
-    // this particular list is only ever appended to and never has items inserted or deleted,
-    // this usage is safe in this case.
-    //
-    sys_mutex_lock(container->lock);
-    qdc_node_type_t *nt_item = DEQ_HEAD(container->node_type_list);
-    sys_mutex_unlock(container->lock);
-
-    while (nt_item) {
-        nt = nt_item->ntype;
+    int count = (int) sys_atomic_get(&container->node_type_count);
+    for (int i = 0; i < count; i++) {
+        const qd_node_type_t *nt = container->node_types[i];
         if (nt->writable_handler)
             nt->writable_handler(nt->type_context, qd_conn, 0);
-
-        sys_mutex_lock(container->lock);
-        nt_item = DEQ_NEXT(nt_item);
-        sys_mutex_unlock(container->lock);
     }
 }
 
 
-void qd_container_handle_event(qd_container_t *container, pn_event_t *event)
+/**
+ * Handle an event for the container.  The server has already looked up the event's
+ * connection and its context.
+ */
+void qd_container_handle_event(qd_container_t *container, pn_event_t *event,
+                               pn_connection_t *conn, qd_connection_t *qd_conn)
 {
-    pn_connection_t *conn = pn_event_connection(event);
-    qd_connection_t *qd_conn = conn ? pn_connection_get_context(conn) : NULL;
     pn_session_t    *ssn = NULL;
     pn_link_t       *pn_link = NULL;
     qd_link_t       *qd_link = NULL;
@@ -348,8 +312,9 @@ void qd_container_handle_event(qd_container_t *container, pn_event_t *event)
              */
             qd_conn->open_container = (void *)container;
             qd_policy_amqp_open(qd_conn);
-        } else {
-            // This Open is in response to an internally initiated connection
+        } else if (!(pn_connection_state(conn) & PN_LOCAL_CLOSED)) {
+            // This Open is in response to an internally initiated connection, one that
+            // was not closed already because another attempt of its connector won
             notify_opened(container, qd_conn, qd_connection_get_context(qd_conn));
         }
         break;
@@ -554,7 +519,7 @@ qd_container_t *qd_container(qd_dispatch_t *qd)
     container->lock          = sys_mutex();
     container->default_node  = 0;
     DEQ_INIT(container->nodes);
-    DEQ_INIT(container->node_type_list);
+    sys_atomic_init(&container->node_type_count, 0);
 
     qd_server_set_container(qd, container);
     qd_log(container->log_source, QD_LOG_TRACE, "Container Initialized");
@@ -574,12 +539,7 @@ void qd_container_free(qd_container_t *container)
         node = DEQ_HEAD(container->nodes);
     }
 
-    qdc_node_type_t *nt = DEQ_HEAD(container->node_type_list);
-    while (nt) {
-        DEQ_REMOVE_HEAD(container->node_type_list);
-        free(nt);
-        nt = DEQ_HEAD(container->node_type_list);
-    }
+    sys_atomic_destroy(&container->node_type_count);
     qd_hash_free(container->node_map);
     qd_hash_free(container->node_type_map);
     sys_mutex_free(container->lock);
@@ -593,13 +553,18 @@ int qd_container_register_node_type(qd_dispatch_t *qd, const qd_node_type_t *nt)
 
     int result;
     qd_iterator_t *iter = qd_iterator_string(nt->type_name, ITER_VIEW_ALL);
-    qdc_node_type_t     *nt_item = NEW(qdc_node_type_t);
-    DEQ_ITEM_INIT(nt_item);
-    nt_item->ntype = nt;
 
     sys_mutex_lock(container->lock);
+    uint32_t count = sys_atomic_get(&container->node_type_count);
+    if (count == QDC_NODE_TYPES_MAX) {
+        sys_mutex_unlock(container->lock);
+        qd_iterator_free(iter);
+        qd_log(container->log_source, QD_LOG_ERROR, "Too many node types, cannot register %s", nt->type_name);
+        return -1;
+    }
     result = qd_hash_insert_const(container->node_type_map, iter, nt, 0);
-    DEQ_INSERT_TAIL(container->node_type_list, nt_item);
+    container->node_types[count] = nt;
+    sys_atomic_add(&container->node_type_count, 1);
     sys_mutex_unlock(container->lock);
 
     qd_iterator_free(iter);
@@ -0,0 +1,146 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "core_record.h"
+#include <qpid/dispatch/atomic.h>
+#include <qpid/dispatch/log.h>
+#include <qpid/dispatch/static_assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// The replay relies on these sizes.
+STATIC_ASSERT(sizeof(qd_core_record_header_t) == 64, core_record_header_is_64_bytes);
+STATIC_ASSERT(sizeof(qd_core_record_t) == 64, core_record_is_64_bytes);
+
+bool qd_core_record_on = false;
+
+static qd_core_record_header_t *record_header = 0;
+static qd_core_record_t        *records = 0;
+static size_t                   record_capacity = 0;
+static size_t                   record_map_size = 0;
+static uint64_t                 record_start_ns = 0;
+static sys_atomic_t             record_next;
+
+
+static uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+qd_error_t qd_core_record_open(const char *path, size_t capacity, const char *router_id)
+{
+    qd_core_record_close();
+    if (capacity == 0)
+        return qd_error(QD_ERROR_CONFIG, "coreRecordFileRecords must be positive");
+
+    size_t size = sizeof(qd_core_record_header_t) + capacity * sizeof(qd_core_record_t);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return qd_error_errno(errno, "Cannot open core record file '%s'", path);
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return qd_error_errno(errno, "Cannot size core record file '%s'", path);
+    }
+    void *base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return qd_error_errno(errno, "Cannot map core record file '%s'", path);
+
+    record_header   = (qd_core_record_header_t*) base;
+    records         = (qd_core_record_t*) (record_header + 1);
+    record_capacity = capacity;
+    record_map_size = size;
+    record_start_ns = now_ns(CLOCK_MONOTONIC);
+    sys_atomic_init(&record_next, 0);
+
+    // The file was truncated, so every record starts out empty (type 0).
+    memcpy(record_header->magic, QD_CORE_RECORD_MAGIC, sizeof(QD_CORE_RECORD_MAGIC));
+    record_header->version     = QD_CORE_RECORD_VERSION;
+    record_header->record_size = sizeof(qd_core_record_t);
+    record_header->capacity    = capacity;
+    record_header->start_ns    = now_ns(CLOCK_REALTIME);
+    strncpy(record_header->router_id, router_id ? router_id : "", sizeof(record_header->router_id) - 1);
+
+    qd_core_record_on = true;
+    qd_log(qd_log_source("ROUTER_CORE"), QD_LOG_INFO, "Recording core work to %s (%zu records)", path, capacity);
+    return QD_ERROR_NONE;
+}
+
+
+void qd_core_record_close(void)
+{
+    if (!record_header)
+        return;
+    qd_core_record_on = false;
+    munmap(record_header, record_map_size);
+    record_header = 0;
+    records       = 0;
+    sys_atomic_destroy(&record_next);
+}
+
+
+uint32_t qd_core_record_hash(qd_iterator_t *address)
+{
+    // djb2, as for qd_iterator_hash_view
+    uint32_t hash = 5381;
+    if (!address)
+        return 0;
+    qd_iterator_reset(address);
+    while (!qd_iterator_end(address))
+        hash = ((hash << 5) + hash) + qd_iterator_octet(address);
+    qd_iterator_reset(address);
+    return hash;
+}
+
+
+void qd_core_record(qd_core_record_type_t type, uint8_t flags, uint64_t connection_id, uint64_t link_id,
+                    uint64_t sequence, uint64_t value, uint32_t size, uint32_t addr_hash)
+{
+    uint32_t slot = sys_atomic_inc(&record_next);
+    if (slot >= record_capacity) {
+        if (slot == record_capacity)
+            qd_log(qd_log_source("ROUTER_CORE"), QD_LOG_WARNING, "Core record file is full, recording stopped");
+        qd_core_record_on = false;
+        return;
+    }
+
+    qd_core_record_t *record = &records[slot];
+    record->flags         = flags;
+    record->reserved      = 0;
+    record->addr_hash     = addr_hash;
+    record->time_ns       = now_ns(CLOCK_MONOTONIC) - record_start_ns;
+    record->connection_id = connection_id;
+    record->link_id       = link_id;
+    record->sequence      = sequence;
+    record->value         = value;
+    record->size          = size;
+    record->reserved2     = 0;
+    record->reserved3     = 0;
+
+    // A reader that finds type 0 treats the record, and the rest of the file, as not yet written.
+    __sync_synchronize();
+    record->type = (uint8_t) type;
+}
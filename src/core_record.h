@@ -0,0 +1,112 @@
+#ifndef __core_record_h__
+#define __core_record_h__ 1
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**@file
+ * Recording of the work submitted to the router core.
+ *
+ * When the router's coreRecordFile is configured, every call an I/O thread
+ * makes into the router core (connections and links opening and closing,
+ * credit, deliveries and disposition updates) is written as a fixed-size
+ * record into a memory-mapped file.  The core_replay benchmark replays the
+ * file against a router core with stubbed I/O handlers.
+ *
+ * Unlike the delivery trace this is not a ring: a replay needs every object
+ * from its creation, so recording stops when the file is full.  Addresses are
+ * recorded only as hashes.  Deliveries are identified by their link and their
+ * sequence on it.
+ *
+ * The layout below is the file format.  Fields are in host byte order and a
+ * change to the layout must bump QD_CORE_RECORD_VERSION.
+ */
+
+#include <qpid/dispatch/error.h>
+#include <qpid/dispatch/iterator.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define QD_CORE_RECORD_MAGIC   "QDCOREA"
+#define QD_CORE_RECORD_VERSION 1
+
+typedef enum {
+    QD_CORE_RECORD_CONNECTION_OPENED = 1,  ///< qdr_connection_opened, value is the role
+    QD_CORE_RECORD_CONNECTION_CLOSED,      ///< qdr_connection_closed
+    QD_CORE_RECORD_FIRST_ATTACH,           ///< qdr_link_first_attach, a peer attached a link
+    QD_CORE_RECORD_SECOND_ATTACH,          ///< qdr_link_second_attach, a peer answered a router attach
+    QD_CORE_RECORD_DETACH,                 ///< qdr_link_detach
+    QD_CORE_RECORD_FLOW,                   ///< qdr_link_flow, value is the credit
+    QD_CORE_RECORD_DELIVER,                ///< qdr_link_deliver and variants
+    QD_CORE_RECORD_DISPOSITION             ///< qdr_delivery_update_disposition, value is the disposition
+} qd_core_record_type_t;
+
+#define QD_CORE_RECORD_INCOMING  0x01   ///< Incoming connection, or link with direction QD_INCOMING
+#define QD_CORE_RECORD_SETTLED   0x02   ///< Settled delivery or settling update
+#define QD_CORE_RECORD_DRAIN     0x04   ///< Flow in drain mode
+#define QD_CORE_RECORD_ADDRESSED 0x08   ///< Delivery with its own to-address, on an anonymous link
+#define QD_CORE_RECORD_ROUTED    0x10   ///< Delivery on a link route
+
+/** File header, followed by capacity records. */
+typedef struct qd_core_record_header_t {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;       ///< sizeof(qd_core_record_t)
+    uint64_t capacity;          ///< Number of record slots in the file
+    uint64_t start_ns;          ///< Wall clock time the file was opened
+    char     router_id[32];
+} qd_core_record_header_t;
+
+typedef struct qd_core_record_t {
+    uint8_t  type;              ///< qd_core_record_type_t, 0 while the record is written
+    uint8_t  flags;             ///< QD_CORE_RECORD_* flags
+    uint16_t reserved;
+    uint32_t addr_hash;         ///< Hash of the link or message address, 0 if none
+    uint64_t time_ns;           ///< Nanoseconds since the file was opened
+    uint64_t connection_id;
+    uint64_t link_id;           ///< Identity of the router link, as in the router.link entity
+    uint64_t sequence;          ///< Sequence of the delivery on its link
+    uint64_t value;             ///< Credit, disposition, or qdr_connection_role_t of an opened connection
+    uint32_t size;              ///< Bytes of message content received so far
+    uint32_t reserved2;
+    uint64_t reserved3;
+} qd_core_record_t;
+
+/**
+ * Open a record file of the given number of records, replacing any previous
+ * contents.  Recording is enabled if this succeeds.
+ */
+qd_error_t qd_core_record_open(const char *path, size_t records, const char *router_id);
+
+/** Stop recording and unmap the record file. */
+void qd_core_record_close(void);
+
+extern bool qd_core_record_on;
+
+/** True if calls into the core should be recorded. */
+static inline bool qd_core_record_enabled(void) { return qd_core_record_on; }
+
+/** Hash an address for the addr_hash field, 0 for a null address. */
+uint32_t qd_core_record_hash(qd_iterator_t *address);
+
+/** Append a record.  Dropped once the file is full. */
+void qd_core_record(qd_core_record_type_t type, uint8_t flags, uint64_t connection_id, uint64_t link_id,
+                    uint64_t sequence, uint64_t value, uint32_t size, uint32_t addr_hash);
+
+#endif
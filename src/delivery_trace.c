@@ -0,0 +1,143 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "delivery_trace.h"
+#include "message_private.h"
+#include <qpid/dispatch/atomic.h>
+#include <qpid/dispatch/log.h>
+#include <qpid/dispatch/static_assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// The decoder relies on these sizes.
+STATIC_ASSERT(sizeof(qd_trace_header_t) == 64, trace_header_is_64_bytes);
+STATIC_ASSERT(sizeof(qd_trace_record_t) == 64, trace_record_is_64_bytes);
+
+bool qd_delivery_trace_on = false;
+
+static qd_trace_header_t *trace_header = 0;
+static qd_trace_record_t *trace_records = 0;
+static size_t             trace_capacity = 0;
+static size_t             trace_map_size = 0;
+static sys_atomic_t       trace_next;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+qd_error_t qd_delivery_trace_open(const char *path, size_t records, const char *router_id)
+{
+    qd_delivery_trace_close();
+    if (records == 0)
+        return qd_error(QD_ERROR_CONFIG, "traceFileRecords must be positive");
+
+    size_t size = sizeof(qd_trace_header_t) + records * sizeof(qd_trace_record_t);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return qd_error_errno(errno, "Cannot open trace file '%s'", path);
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return qd_error_errno(errno, "Cannot size trace file '%s'", path);
+    }
+    void *base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return qd_error_errno(errno, "Cannot map trace file '%s'", path);
+
+    trace_header   = (qd_trace_header_t*) base;
+    trace_records  = (qd_trace_record_t*) (trace_header + 1);
+    trace_capacity = records;
+    trace_map_size = size;
+    sys_atomic_init(&trace_next, 0);
+
+    // The file was truncated, so every record starts out empty (seq 0).
+    memcpy(trace_header->magic, QD_TRACE_MAGIC, sizeof(QD_TRACE_MAGIC));
+    trace_header->version     = QD_TRACE_VERSION;
+    trace_header->record_size = sizeof(qd_trace_record_t);
+    trace_header->capacity    = records;
+    trace_header->start_ns    = now_ns();
+    strncpy(trace_header->router_id, router_id ? router_id : "", sizeof(trace_header->router_id) - 1);
+
+    qd_delivery_trace_on = true;
+    qd_log(qd_log_source("ROUTER"), QD_LOG_INFO, "Tracing deliveries to %s (%zu records)", path, records);
+    return QD_ERROR_NONE;
+}
+
+
+void qd_delivery_trace_close(void)
+{
+    if (!trace_header)
+        return;
+    qd_delivery_trace_on = false;
+    munmap(trace_header, trace_map_size);
+    trace_header  = 0;
+    trace_records = 0;
+    sys_atomic_destroy(&trace_next);
+}
+
+
+uint32_t qd_delivery_trace_hash(const char *address)
+{
+    // djb2, as for qd_iterator_hash_view
+    uint32_t hash = 5381;
+    if (!address)
+        return 0;
+    while (*address)
+        hash = ((hash << 5) + hash) + (uint8_t) *address++;
+    return hash;
+}
+
+
+void qd_delivery_trace(qd_trace_event_t event, uint8_t flags, uint64_t connection_id, uint64_t link_id,
+                       qd_message_t *msg, uint64_t disposition, uint32_t addr_hash)
+{
+    uint32_t seq = sys_atomic_inc(&trace_next) + 1;
+    if (seq == 0)  // Reserved for a record being written
+        seq = sys_atomic_inc(&trace_next) + 1;
+
+    qd_trace_record_t *record = &trace_records[(seq - 1) % trace_capacity];
+    qd_message_content_t *content = msg ? MSG_CONTENT(msg) : 0;
+
+    // A reader that finds seq 0, or a seq that changed while it read the
+    // record, discards the record as torn.
+    record->seq = 0;
+    __sync_synchronize();
+    record->event         = (uint8_t) event;
+    record->flags         = flags;
+    record->reserved      = 0;
+    record->time_ns       = now_ns();
+    record->connection_id = connection_id;
+    record->link_id       = link_id;
+    record->message_id    = (uint64_t) (uintptr_t) content;
+    record->disposition   = disposition;
+    record->addr_hash     = addr_hash;
+    record->size          = content ? (uint32_t) qd_message_size(msg) : 0;
+    record->reserved2     = 0;
+    __sync_synchronize();
+    record->seq = seq;
+}
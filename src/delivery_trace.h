@@ -0,0 +1,101 @@
+#ifndef __delivery_trace_h__
+#define __delivery_trace_h__ 1
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**@file
+ * Binary delivery trace.
+ *
+ * When the router's traceFile is configured, each delivery event is written
+ * as a fixed-size record into a memory-mapped ring file.  Writing a record
+ * is a handful of stores, cheap enough to leave on permanently; the file is
+ * decoded offline by the qdtrace tool.  The kernel writes the pages back, so
+ * the most recent records survive a crash of the router.
+ *
+ * The layout below is the file format.  Fields are in host byte order and a
+ * change to the layout must bump QD_TRACE_VERSION.
+ */
+
+#include <qpid/dispatch/error.h>
+#include <qpid/dispatch/message.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define QD_TRACE_MAGIC   "QDTRACE"
+#define QD_TRACE_VERSION 1
+
+typedef enum {
+    QD_TRACE_INGRESS     = 1,   ///< A complete message was received on an incoming link
+    QD_TRACE_EGRESS      = 2,   ///< A message was completely sent on an outgoing link
+    QD_TRACE_DISPOSITION = 3    ///< A peer updated or settled a delivery
+} qd_trace_event_t;
+
+#define QD_TRACE_SETTLED 0x01   ///< The delivery was settled by this event
+
+/** File header, followed by capacity records. */
+typedef struct qd_trace_header_t {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;       ///< sizeof(qd_trace_record_t)
+    uint64_t capacity;          ///< Number of record slots in the ring
+    uint64_t start_ns;          ///< Wall clock time the file was opened
+    char     router_id[32];
+} qd_trace_header_t;
+
+typedef struct qd_trace_record_t {
+    uint32_t seq;               ///< Position in the trace, from 1.  0 while the record is written.
+    uint8_t  event;             ///< qd_trace_event_t
+    uint8_t  flags;             ///< QD_TRACE_* flags
+    uint16_t reserved;
+    uint64_t time_ns;           ///< Wall clock time of the event
+    uint64_t connection_id;
+    uint64_t link_id;           ///< Identity of the router link, as in the router.link entity
+    uint64_t message_id;        ///< Same for the ingress and egress records of one message
+    uint64_t disposition;
+    uint32_t addr_hash;         ///< Hash of the link or message address, 0 if none
+    uint32_t size;              ///< Bytes of message content received so far
+    uint64_t reserved2;
+} qd_trace_record_t;
+
+/**
+ * Open a trace ring file of the given number of records, replacing any
+ * previous contents.  Tracing is enabled if this succeeds.
+ */
+qd_error_t qd_delivery_trace_open(const char *path, size_t records, const char *router_id);
+
+/** Stop tracing and unmap the trace file. */
+void qd_delivery_trace_close(void);
+
+extern bool qd_delivery_trace_on;
+
+/** True if delivery events should be traced. */
+static inline bool qd_delivery_trace_enabled(void) { return qd_delivery_trace_on; }
+
+/** Hash an address for the addr_hash field. */
+uint32_t qd_delivery_trace_hash(const char *address);
+
+/**
+ * Append a record for a delivery event.  msg may be 0 for dispositions whose
+ * message has already been released.
+ */
+void qd_delivery_trace(qd_trace_event_t event, uint8_t flags, uint64_t connection_id, uint64_t link_id,
+                       qd_message_t *msg, uint64_t disposition, uint32_t addr_hash);
+
+#endif
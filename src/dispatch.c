@@ -34,6 +34,11 @@
 #include "policy.h"
 #include "entity.h"
 #include "entity_cache.h"
+#include "delivery_trace.h"
+#include "core_record.h"
+#include "path_trace.h"
+#include "profile.h"
+#include "spill.h"
 #include <dlfcn.h>
 
 /**
@@ -46,6 +51,8 @@ qd_container_t *qd_container(qd_dispatch_t *qd);
 void            qd_container_free(qd_container_t *container);
 qd_policy_t    *qd_policy(qd_dispatch_t *qd);
 void            qd_policy_free(qd_policy_t *policy);
+PyObject       *qd_policy_cache_drain(qd_policy_t *policy);
+qd_error_t      qd_policy_set_hosts(qd_policy_t *policy, long ccounts, const char *usergroup, PyObject *ranges);
 qd_router_t    *qd_router(qd_dispatch_t *qd, qd_router_mode_t mode, const char *area, const char *id);
 void            qd_router_setup_late(qd_dispatch_t *qd);
 void            qd_router_free(qd_router_t *router);
@@ -58,6 +65,8 @@ qd_dispatch_t *qd_dispatch(const char *python_pkgdir)
 
     qd_entity_cache_initialize();   /* Must be first */
     qd_alloc_initialize();
+    qd_buffer_initialize();
+    qd_profile_initialize(qd);  /* Before the threads it samples start */
     qd_log_initialize();
     qd_error_initialize();
     if (qd_error_code()) { qd_dispatch_free(qd); return 0; }
@@ -179,6 +188,28 @@ qd_error_t qd_dispatch_configure_router(qd_dispatch_t *qd, qd_entity_t *entity)
     qd->router_mode = qd_entity_get_long(entity, "mode"); QD_ERROR_RET();
     qd->thread_count = qd_entity_opt_long(entity, "workerThreads", 4); QD_ERROR_RET();
     qd->allow_unsettled_multicast = qd_entity_opt_bool(entity, "allowUnsettledMulticast", false); QD_ERROR_RET();
+    qd->delivery_priority = qd_entity_opt_long(entity, "deliveryPriority", QD_DELIVERY_PRIORITY_FIFO); QD_ERROR_RET();
+    qd->core_spin_usec = qd_entity_opt_long(entity, "coreSpinUsec", 0); QD_ERROR_RET();
+    qd_bitmask_set_width(qd_entity_opt_long(entity, "maxRouters", 128)); QD_ERROR_RET();
+    qd->core_action_timing = qd_entity_opt_bool(entity, "coreActionTiming", false); QD_ERROR_RET();
+    qd->auto_link_attach_rate = qd_entity_opt_long(entity, "autoLinkAttachRate", 1000); QD_ERROR_RET();
+    qd->memory_trim_interval = qd_entity_opt_long(entity, "memoryTrimInterval", 60); QD_ERROR_RET();
+    qd->numa_aware = qd_entity_opt_bool(entity, "numaAware", false); QD_ERROR_RET();
+    qd_alloc_set_numa_aware(qd->numa_aware);
+    qd->worker_event_timing = qd_entity_opt_bool(entity, "workerEventTiming", false); QD_ERROR_RET();
+    qd->timer_thread = qd_entity_opt_bool(entity, "timerThread", false); QD_ERROR_RET();
+    qd->worker_cpus = qd_entity_opt_string(entity, "workerCpus", 0); QD_ERROR_RET();
+    qd->core_cpus = qd_entity_opt_string(entity, "coreCpus", 0); QD_ERROR_RET();
+    qd->http_cpus = qd_entity_opt_string(entity, "httpCpus", 0); QD_ERROR_RET();
+    qd->http_thread_count = qd_entity_opt_long(entity, "httpThreads", 1); QD_ERROR_RET();
+    qd->max_handshakes = qd_entity_opt_long(entity, "maxHandshakes", 0); QD_ERROR_RET();
+    qd->handshake_latency_threshold = qd_entity_opt_long(entity, "handshakeLatencyThreshold", 0); QD_ERROR_RET();
+    qd->link_fairness_quantum = qd_entity_opt_long(entity, "linkFairnessQuantum", 65536); QD_ERROR_RET();
+    qd->spill_threshold = qd_entity_opt_long(entity, "spillThreshold", 16777216); QD_ERROR_RET();
+    qd->console_feed_interval = qd_entity_opt_long(entity, "consoleFeedInterval", 2000); QD_ERROR_RET();
+
+    uint64_t memory_limit = (uint64_t) qd_entity_opt_long(entity, "bufferMemoryLimit", 0) * 1024 * 1024; QD_ERROR_RET();
+    qd_buffer_set_memory_limit(memory_limit, memory_limit / 10 * 8);
 
     if (! qd->sasl_config_path) {
         qd->sasl_config_path = qd_entity_opt_string(entity, "saslConfigPath", 0); QD_ERROR_RET();
@@ -187,6 +218,42 @@ qd_error_t qd_dispatch_configure_router(qd_dispatch_t *qd, qd_entity_t *entity)
         qd->sasl_config_name = qd_entity_opt_string(entity, "saslConfigName", "qdrouterd"); QD_ERROR_RET();
     }
 
+    char *trace_file = qd_entity_opt_string(entity, "traceFile", 0); QD_ERROR_RET();
+    if (trace_file) {
+        long trace_records = qd_entity_opt_long(entity, "traceFileRecords", 1048576);
+        if (!qd_error_code())
+            qd_delivery_trace_open(trace_file, trace_records > 0 ? (size_t) trace_records : 0, qd->router_id);
+        free(trace_file);
+        QD_ERROR_RET();
+    }
+
+    char *record_file = qd_entity_opt_string(entity, "coreRecordFile", 0); QD_ERROR_RET();
+    if (record_file) {
+        long records = qd_entity_opt_long(entity, "coreRecordFileRecords", 1048576);
+        if (!qd_error_code())
+            qd_core_record_open(record_file, records > 0 ? (size_t) records : 0, qd->router_id);
+        free(record_file);
+        QD_ERROR_RET();
+    }
+
+    char *path_trace_file = qd_entity_opt_string(entity, "pathTraceFile", 0); QD_ERROR_RET();
+    if (path_trace_file) {
+        long sample_rate = qd_entity_opt_long(entity, "pathTraceSampleRate", 1000);
+        if (!qd_error_code())
+            qd_path_trace_open(path_trace_file, sample_rate, qd->router_id);
+        free(path_trace_file);
+        QD_ERROR_RET();
+    }
+
+    char *spill_file = qd_entity_opt_string(entity, "spillFile", 0); QD_ERROR_RET();
+    if (spill_file) {
+        long size = qd_entity_opt_long(entity, "spillFileSize", 1024);
+        if (!qd_error_code())
+            qd_spill_open(spill_file, size > 0 ? (uint64_t) size * 1024 * 1024 : 0);
+        free(spill_file);
+        QD_ERROR_RET();
+    }
+
     char *dump_file = qd_entity_opt_string(entity, "debugDump", 0); QD_ERROR_RET();
     if (dump_file) {
         qd_alloc_debug_dump(dump_file); QD_ERROR_RET();
@@ -233,6 +300,18 @@ qd_error_t qd_dispatch_configure_auto_link(qd_dispatch_t *qd, qd_entity_t *entit
     return qd_error_code();
 }
 
+void qd_dispatch_configure_begin(qd_dispatch_t *qd)
+{
+    qdr_action_batch_begin();
+}
+
+void qd_dispatch_configure_end(qd_dispatch_t *qd)
+{
+    qdr_action_batch_end();
+    if (qd->router && qd->router->router_core)
+        qdr_core_sync(qd->router->router_core);
+}
+
 qd_error_t qd_dispatch_configure_policy(qd_dispatch_t *qd, qd_entity_t *entity)
 {
     qd_error_t err;
@@ -271,6 +350,44 @@ void qd_dispatch_policy_c_counts_refresh(long ccounts, qd_entity_t *entity)
     qd_policy_c_counts_refresh(ccounts, entity);
 }
 
+void qd_dispatch_policy_c_counts_limits(long ccounts, long max_connections, long max_per_user, long max_per_host)
+{
+    qd_policy_c_counts_limits(ccounts, max_connections, max_per_user, max_per_host);
+}
+
+void qd_dispatch_policy_cache_clear(qd_dispatch_t *qd)
+{
+    qd_policy_cache_clear(qd->policy);
+}
+
+PyObject *qd_dispatch_policy_cache_drain(qd_dispatch_t *qd)
+{
+    return qd_policy_cache_drain(qd->policy);
+}
+
+qd_error_t qd_dispatch_policy_set_hosts(qd_dispatch_t *qd, long ccounts, const char *usergroup, PyObject *ranges)
+{
+    return qd_policy_set_hosts(qd->policy, ccounts, usergroup, ranges);
+}
+
+void qd_dispatch_policy_clear_hosts(qd_dispatch_t *qd, long ccounts)
+{
+    qd_policy_clear_host_trees(qd->policy, ccounts);
+}
+
+//
+// Periodically hand idle pooled memory back to the heap.
+//
+static void qd_dispatch_memory_trim(void *context)
+{
+    qd_dispatch_t *qd = (qd_dispatch_t*) context;
+    size_t released = qd_alloc_trim();
+    if (released)
+        qd_log(qd_log_source("ROUTER"), QD_LOG_DEBUG, "Returned %zu octets of idle pool memory to the heap", released);
+    qd_timer_schedule(qd->memory_trim_timer, qd->memory_trim_interval * 1000);
+}
+
+
 qd_error_t qd_dispatch_prepare(qd_dispatch_t *qd)
 {
     qd->server             = qd_server(qd, qd->thread_count, qd->router_id, qd->sasl_config_path, qd->sasl_config_name);
@@ -278,6 +395,10 @@ qd_error_t qd_dispatch_prepare(qd_dispatch_t *qd)
     qd->router             = qd_router(qd, qd->router_mode, qd->router_area, qd->router_id);
     qd->connection_manager = qd_connection_manager(qd);
     qd->policy             = qd_policy(qd);
+    if (qd->memory_trim_interval > 0) {
+        qd->memory_trim_timer = qd_timer(qd, qd_dispatch_memory_trim, qd);
+        qd_timer_schedule(qd->memory_trim_timer, qd->memory_trim_interval * 1000);
+    }
     return qd_error_code();
 }
 
@@ -308,13 +429,23 @@ void qd_dispatch_free(qd_dispatch_t *qd)
     qd_dispatch_set_router_area(qd, NULL);
     free(qd->sasl_config_path);
     free(qd->sasl_config_name);
+    free(qd->worker_cpus);
+    free(qd->core_cpus);
+    free(qd->http_cpus);
+    qd_timer_free(qd->memory_trim_timer);
+    qd_profile_finalize();
     qd_connection_manager_free(qd->connection_manager);
     qd_policy_free(qd->policy);
     Py_XDECREF((PyObject*) qd->agent);
     qd_router_free(qd->router);
     qd_container_free(qd->container);
     qd_server_free(qd->server);
+    qd_delivery_trace_close();
+    qd_core_record_close();
+    qd_path_trace_close();
+    qd_spill_close();
     qd_log_finalize();
+    qd_buffer_finalize();
     qd_alloc_finalize();
     qd_python_finalize();
 }
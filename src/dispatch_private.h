@@ -60,6 +60,24 @@ struct qd_dispatch_t {
     char  *router_id;
     qd_router_mode_t  router_mode;
     bool   allow_unsettled_multicast;
+    qd_delivery_priority_t delivery_priority;
+    int    core_spin_usec;
+    bool   core_action_timing;
+    int    auto_link_attach_rate;
+    bool   numa_aware;
+    bool   worker_event_timing;
+    bool   timer_thread;
+    char  *worker_cpus;
+    char  *core_cpus;
+    char  *http_cpus;
+    int    http_thread_count;
+    int    max_handshakes;
+    int    handshake_latency_threshold;
+    int    link_fairness_quantum;
+    long   spill_threshold;
+    int    console_feed_interval;
+    int    memory_trim_interval;
+    qd_timer_t *memory_trim_timer;
 };
 
 /**
@@ -107,6 +125,14 @@ qd_error_t qd_dispatch_configure_lrp(qd_dispatch_t *qd, qd_entity_t *entity);
  */
 qd_error_t qd_dispatch_configure_route(qd_dispatch_t *qd, qd_entity_t *entity);
 
+/**
+ * Bracket the bulk configuration of entities, must be called after qd_dispatch_prepare.
+ * The core actions of the entities configured in between are handed to the core
+ * together, and qd_dispatch_configure_end returns once the core has applied them.
+ */
+void qd_dispatch_configure_begin(qd_dispatch_t *qd);
+void qd_dispatch_configure_end(qd_dispatch_t *qd);
+
 /**
  * Configure security policy, must be called after qd_dispatch_prepare
  */
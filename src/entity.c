@@ -169,6 +169,11 @@ qd_error_t qd_entity_set_map(qd_entity_t *entity, const char *attribute) {
 }
 
 qd_error_t qd_entity_set_map_key_value_int(qd_entity_t *entity, const char *attribute, const char *key, int value)
+{
+    return qd_entity_set_map_key_value_long(entity, attribute, key, value);
+}
+
+qd_error_t qd_entity_set_map_key_value_long(qd_entity_t *entity, const char *attribute, const char *key, long value)
 {
     if (!key)
         return  QD_ERROR_VALUE;
@@ -110,6 +110,8 @@ qd_error_t qd_entity_set_map(qd_entity_t *entity, const char *attribute);
  */
 qd_error_t qd_entity_set_map_key_value_string(qd_entity_t *entity, const char *attribute, const char *key, const char *value);
 
+qd_error_t qd_entity_set_map_key_value_long(qd_entity_t *entity, const char *attribute, const char *key, long value);
+
 qd_error_t qd_entity_set_map_key_value_int(qd_entity_t *entity, const char *attribute, const char *key, int value);
 
 
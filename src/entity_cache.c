@@ -18,6 +18,7 @@
  */
 
 #include <qpid/dispatch/python_embedded.h>
+#include <qpid/dispatch/atomic.h>
 #include <qpid/dispatch/threading.h>
 #include <qpid/dispatch/ctools.h>
 #include <structmember.h>
@@ -33,65 +34,108 @@
 typedef enum { REMOVE=0, ADD=1 }  action_t;
 
 typedef struct entity_event_t {
-    DEQ_LINKS(struct entity_event_t);
+    struct entity_event_t *next;
     action_t action;
     const char *type;
     void *object;
 } entity_event_t;
 
-DEQ_DECLARE(entity_event_t, entity_event_list_t);
-
 static entity_event_t *entity_event(action_t action, const char *type, void *object) {
     entity_event_t *event = NEW(entity_event_t);
-    DEQ_ITEM_INIT(event);
+    event->next = 0;
     event->action = action;
     event->type = type;
     event->object = object;
     return event;
 }
 
-static sys_mutex_t *event_lock = 0;
-static entity_event_list_t  event_list;
+/*
+ * Producers on any thread push events onto a lock-free stack.  The Python
+ * agent takes the whole stack in one swap and reverses it to recover the order
+ * the events were pushed in.
+ *
+ * refresh_lock is held by the agent from qd_entity_refresh_begin to
+ * qd_entity_refresh_end while it reads entity objects.  A remover must not
+ * return, and so let its object be freed, while a refresh that may not have
+ * seen the REMOVE event is running; it waits on refresh_lock only when
+ * 'refreshing' says one is.
+ */
+static bool             initialized = false;
+static sys_atomic_ptr_t event_stack;
+static sys_atomic_t     refreshing;
+static sys_mutex_t     *refresh_lock = 0;
+static entity_event_t  *pending = 0;   /* Taken from the stack, not yet given to Python */
 
 void qd_entity_cache_initialize(void) {
-    event_lock = sys_mutex();
-    DEQ_INIT(event_list);
+    refresh_lock = sys_mutex();
+    sys_atomic_ptr_init(&event_stack, 0);
+    sys_atomic_init(&refreshing, 0);
+    initialized = true;
 }
 
 static void push_event(action_t action, const char *type, void *object) {
-    if (!event_lock) return;    /* Unit tests don't call qd_entity_cache_initialize */
-    sys_mutex_lock(event_lock);
+    if (!initialized) return;    /* Unit tests don't call qd_entity_cache_initialize */
     entity_event_t *event = entity_event(action, type, object);
-    DEQ_INSERT_TAIL(event_list, event);
-    sys_mutex_unlock(event_lock);
+    entity_event_t *head;
+    do {
+        head = (entity_event_t*) sys_atomic_ptr_get(&event_stack);
+        event->next = head;
+    } while (!sys_atomic_ptr_cas(&event_stack, head, event));
 }
 
 void qd_entity_cache_add(const char *type, void *object) { push_event(ADD, type, object); }
 
-void qd_entity_cache_remove(const char *type, void *object) { push_event(REMOVE, type, object); }
+void qd_entity_cache_remove(const char *type, void *object) {
+    push_event(REMOVE, type, object);
+    if (initialized && sys_atomic_get(&refreshing)) {
+        /* Wait for the refresh in progress to finish with the object */
+        sys_mutex_lock(refresh_lock);
+        sys_mutex_unlock(refresh_lock);
+    }
+}
+
+/* Move the events on the stack, oldest first, to the end of the pending list */
+static void take_events(void) {
+    entity_event_t *event = (entity_event_t*) sys_atomic_ptr_swap(&event_stack, 0);
+    entity_event_t *taken = 0;
+    while (event) {
+        entity_event_t *next = event->next;
+        event->next = taken;
+        taken = event;
+        event = next;
+    }
+    entity_event_t **tail = &pending;
+    while (*tail) tail = &(*tail)->next;
+    *tail = taken;
+}
 
 // Get events in the add/remove cache into a python list of (action, type, pointer)
-// Locks the entity cache so entities can be updated safely (prevent entities from being deleted.)
+// Blocks removers until qd_entity_refresh_end so entities can be updated safely (prevent
+// entities from being deleted.)
 // Do not processs any entities if return error code != 0
 // Must call qd_entity_refresh_end when done, regardless of error code.
 qd_error_t qd_entity_refresh_begin(PyObject *list) {
-    if (!event_lock) return QD_ERROR_NONE;    /* Unit tests don't call qd_entity_cache_initialize */
+    if (!initialized) return QD_ERROR_NONE;    /* Unit tests don't call qd_entity_cache_initialize */
     qd_error_clear();
-    sys_mutex_lock(event_lock);
-    entity_event_t *event = DEQ_HEAD(event_list);
+    sys_mutex_lock(refresh_lock);
+    sys_atomic_inc(&refreshing);
+    take_events();
+    entity_event_t *event = pending;
     while (event) {
         PyObject *tuple = Py_BuildValue("(isl)", (int)event->action, event->type, (long)event->object);
         if (!tuple) { qd_error_py(); break; }
         int err = PyList_Append(list, tuple);
         Py_DECREF(tuple);
         if (err) { qd_error_py(); break; }
-        DEQ_REMOVE_HEAD(event_list);
+        pending = event->next;
         free(event);
-        event = DEQ_HEAD(event_list);
+        event = pending;
     }
     return qd_error_code();
 }
 
 void qd_entity_refresh_end() {
-    sys_mutex_unlock(event_lock);
+    if (!initialized) return;
+    sys_atomic_dec(&refreshing);
+    sys_mutex_unlock(refresh_lock);
 }
@@ -26,8 +26,8 @@
 #include <qpid/dispatch/ctools.h>
 
 typedef struct qd_hash_item_t {
-    DEQ_LINKS(struct qd_hash_item_t);
     unsigned char *key;
+    uint32_t       hash;
     union {
         void       *val;
         const void *val_const;
@@ -36,26 +36,53 @@ typedef struct qd_hash_item_t {
 
 ALLOC_DECLARE(qd_hash_item_t);
 ALLOC_DEFINE(qd_hash_item_t);
-DEQ_DECLARE(qd_hash_item_t, items_t);
 
 
-typedef struct bucket_t {
-    items_t items;
-} bucket_t;
+//
+// The table is open-addressed with linear probing.  Each slot holds the full
+// 32-bit hash of its key so that probes only compare keys whose hashes match.
+// Items are pool-allocated and never move, so handles remain valid across a
+// resize; only the slot array is rebuilt.
+//
+typedef struct qd_hash_slot_t {
+    uint32_t        hash;
+    qd_hash_item_t *item;
+} qd_hash_slot_t;
+
+
+typedef struct qd_hash_table_t {
+    qd_hash_slot_t *slots;
+    uint32_t        capacity;
+    uint32_t        mask;
+    size_t          count;
+} qd_hash_table_t;
+
+
+//
+// The table grows (doubling) when the load factor would pass 3/4.  Rather
+// than moving every entry at once, the previous slot array is kept and a
+// few of its slots are migrated on each subsequent insert or remove.
+// Lookups consult both arrays until the migration completes.
+//
+#define QD_HASH_MIN_CAPACITY  8
+#define QD_HASH_MIGRATE_STEP 16
+
 
+typedef struct qd_hash_trie_t qd_hash_trie_t;
 
 struct qd_hash_t {
-    bucket_t     *buckets;
-    unsigned int  bucket_count;
-    unsigned int  bucket_mask;
-    int           batch_size;
-    size_t        size;
-    int           is_const;
+    qd_hash_table_t table;
+    qd_hash_table_t old;
+    uint32_t        migrate_pos;
+    char           *prefix_classes;
+    qd_hash_trie_t *trie;
+    int             batch_size;
+    size_t          size;
+    int             is_const;
 };
 
 
 struct qd_hash_handle_t {
-    bucket_t    *bucket;
     qd_hash_item_t *item;
 };
 
@@ -63,53 +90,474 @@ ALLOC_DECLARE(qd_hash_handle_t);
 ALLOC_DEFINE(qd_hash_handle_t);
 
 
+//
+// Marks a slot in the draining table whose entry has been migrated or
+// removed.  It keeps probe sequences through that slot intact.
+//
+static qd_hash_item_t moved_item;
+#define MOVED (&moved_item)
+
+
+static bool qd_hash_table_init(qd_hash_table_t *t, uint32_t capacity)
+{
+    t->slots = NEW_ARRAY(qd_hash_slot_t, capacity);
+    if (!t->slots)
+        return false;
+    memset(t->slots, 0, sizeof(qd_hash_slot_t) * capacity);
+    t->capacity = capacity;
+    t->mask     = capacity - 1;
+    t->count    = 0;
+    return true;
+}
+
+
+static qd_hash_slot_t *qd_hash_table_find(const qd_hash_table_t *t, uint32_t hash, qd_iterator_t *key)
+{
+    if (!t->slots)
+        return 0;
+
+    uint32_t idx = hash & t->mask;
+    while (t->slots[idx].item) {
+        qd_hash_slot_t *slot = &t->slots[idx];
+        if (slot->hash == hash && slot->item != MOVED && qd_iterator_equal(key, slot->item->key))
+            return slot;
+        idx = (idx + 1) & t->mask;
+    }
+    return 0;
+}
+
+
+static qd_hash_slot_t *qd_hash_table_find_item(const qd_hash_table_t *t, const qd_hash_item_t *item)
+{
+    if (!t->slots)
+        return 0;
+
+    uint32_t idx = item->hash & t->mask;
+    while (t->slots[idx].item) {
+        if (t->slots[idx].item == item)
+            return &t->slots[idx];
+        idx = (idx + 1) & t->mask;
+    }
+    return 0;
+}
+
+
+static void qd_hash_table_put(qd_hash_table_t *t, qd_hash_item_t *item)
+{
+    uint32_t idx = item->hash & t->mask;
+    while (t->slots[idx].item)
+        idx = (idx + 1) & t->mask;
+    t->slots[idx].hash = item->hash;
+    t->slots[idx].item = item;
+    t->count++;
+}
+
+
+//
+// Remove a slot from the active table by shifting later members of its probe
+// run back into the gap, so the active table never holds tombstones.
+//
+static void qd_hash_table_delete(qd_hash_table_t *t, qd_hash_slot_t *slot)
+{
+    uint32_t i = slot - t->slots;
+    uint32_t j = i;
+
+    while (true) {
+        j = (j + 1) & t->mask;
+        if (!t->slots[j].item)
+            break;
+        uint32_t home = t->slots[j].hash & t->mask;
+        bool     move = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (move) {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+
+    t->slots[i].item = 0;
+    t->slots[i].hash = 0;
+    t->count--;
+}
+
+
+static void qd_hash_migrate(qd_hash_t *h, uint32_t steps)
+{
+    while (h->old.slots && steps--) {
+        qd_hash_slot_t *slot = &h->old.slots[h->migrate_pos++];
+        if (slot->item && slot->item != MOVED) {
+            qd_hash_table_put(&h->table, slot->item);
+            slot->item = MOVED;
+        }
+
+        if (h->migrate_pos == h->old.capacity) {
+            free(h->old.slots);
+            h->old.slots = 0;
+            h->old.count = 0;
+        }
+    }
+}
+
+
+static bool qd_hash_grow(qd_hash_t *h)
+{
+    if ((h->table.count + 1) * 4 <= (size_t) h->table.capacity * 3)
+        return true;
+
+    //
+    // A previous resize that is still in progress must finish first.
+    //
+    if (h->old.slots)
+        qd_hash_migrate(h, h->old.capacity - h->migrate_pos);
+
+    qd_hash_table_t bigger;
+    if (!qd_hash_table_init(&bigger, h->table.capacity * 2))
+        return false;
+
+    h->old         = h->table;
+    h->table       = bigger;
+    h->migrate_pos = 0;
+    return true;
+}
+
+
+static qd_hash_item_t *qd_hash_internal_retrieve_with_hash(qd_hash_t *h, uint32_t hash, qd_iterator_t *key)
+{
+    qd_hash_slot_t *slot = qd_hash_table_find(&h->table, hash, key);
+    if (!slot)
+        slot = qd_hash_table_find(&h->old, hash, key);
+    return slot ? slot->item : 0;
+}
+
+
+//
+// Prefix index
+//
+// Longest-prefix lookups, left to the table alone, cost one probe for every
+// segment of the address.  For keys whose first octet (the address class) has
+// been registered with qd_hash_prefix_index, the items are also kept in a
+// compressed radix trie so a prefix lookup is a single walk of the address.
+// Each node carries a label of one or more octets; children are kept sorted
+// by the first octet of their labels.
+//
+static const char *SEPARATORS = "./";
+
+struct qd_hash_trie_t {
+    unsigned char   *label;
+    uint32_t         label_len;
+    qd_hash_item_t  *item;
+    qd_hash_trie_t **children;
+    uint32_t         child_count;
+};
+
+
+static qd_hash_trie_t *qd_hash_trie_node(const unsigned char *label, uint32_t label_len, qd_hash_item_t *item)
+{
+    qd_hash_trie_t *node = NEW(qd_hash_trie_t);
+    ZERO(node);
+    if (label_len) {
+        node->label = (unsigned char*) malloc(label_len);
+        memcpy(node->label, label, label_len);
+    }
+    node->label_len = label_len;
+    node->item      = item;
+    return node;
+}
+
+
+static void qd_hash_trie_free(qd_hash_trie_t *node)
+{
+    if (!node)
+        return;
+    for (uint32_t i = 0; i < node->child_count; i++)
+        qd_hash_trie_free(node->children[i]);
+    free(node->children);
+    free(node->label);
+    free(node);
+}
+
+
+//
+// Return the index of the child whose label starts with octet, or the index at
+// which such a child would be inserted.
+//
+static uint32_t qd_hash_trie_child(const qd_hash_trie_t *node, unsigned char octet, bool *found)
+{
+    uint32_t lo = 0;
+    uint32_t hi = node->child_count;
+
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        unsigned char first = node->children[mid]->label[0];
+        if (first == octet) {
+            *found = true;
+            return mid;
+        }
+        if (first < octet)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = false;
+    return lo;
+}
+
+
+static void qd_hash_trie_add_child(qd_hash_trie_t *node, uint32_t idx, qd_hash_trie_t *child)
+{
+    node->children = (qd_hash_trie_t**) realloc(node->children, sizeof(qd_hash_trie_t*) * (node->child_count + 1));
+    memmove(&node->children[idx + 1], &node->children[idx], sizeof(qd_hash_trie_t*) * (node->child_count - idx));
+    node->children[idx] = child;
+    node->child_count++;
+}
+
+
+static void qd_hash_trie_insert(qd_hash_trie_t *node, const unsigned char *key, qd_hash_item_t *item)
+{
+    size_t remaining = strlen((const char*) key);
+
+    while (remaining) {
+        bool     found;
+        uint32_t idx = qd_hash_trie_child(node, key[0], &found);
+        if (!found) {
+            qd_hash_trie_add_child(node, idx, qd_hash_trie_node(key, remaining, item));
+            return;
+        }
+
+        qd_hash_trie_t *child  = node->children[idx];
+        uint32_t        common = 1;
+        while (common < child->label_len && common < remaining && child->label[common] == key[common])
+            common++;
+
+        if (common < child->label_len) {
+            //
+            // The key diverges part way along the child's label.  Split the child
+            // so that the shared octets become a node of their own.
+            //
+            qd_hash_trie_t *split = qd_hash_trie_node(child->label, common, 0);
+            child->label_len -= common;
+            memmove(child->label, child->label + common, child->label_len);
+            qd_hash_trie_add_child(split, 0, child);
+            node->children[idx] = split;
+            child = split;
+        }
+
+        node       = child;
+        key       += common;
+        remaining -= common;
+    }
+
+    node->item = item;
+}
+
+
+static void qd_hash_trie_remove(qd_hash_trie_t *node, const unsigned char *key, size_t remaining)
+{
+    if (remaining == 0) {
+        node->item = 0;
+        return;
+    }
+
+    bool     found;
+    uint32_t idx = qd_hash_trie_child(node, key[0], &found);
+    if (!found)
+        return;
+
+    qd_hash_trie_t *child = node->children[idx];
+    if (remaining < child->label_len || memcmp(child->label, key, child->label_len) != 0)
+        return;
+
+    qd_hash_trie_remove(child, key + child->label_len, remaining - child->label_len);
+
+    if (child->item)
+        return;
+
+    if (child->child_count == 0) {
+        //
+        // Prune the now-empty leaf.
+        //
+        node->child_count--;
+        memmove(&node->children[idx], &node->children[idx + 1], sizeof(qd_hash_trie_t*) * (node->child_count - idx));
+        qd_hash_trie_free(child);
+    } else if (child->child_count == 1) {
+        //
+        // Merge a valueless node with its only child to keep the trie compressed.
+        //
+        qd_hash_trie_t *grandchild = child->children[0];
+        unsigned char  *label      = (unsigned char*) malloc(child->label_len + grandchild->label_len);
+        memcpy(label, child->label, child->label_len);
+        memcpy(label + child->label_len, grandchild->label, grandchild->label_len);
+        free(grandchild->label);
+        grandchild->label      = label;
+        grandchild->label_len += child->label_len;
+        node->children[idx]    = grandchild;
+        child->child_count     = 0;
+        qd_hash_trie_free(child);
+    }
+}
+
+
+//
+// Find the item with the longest key that matches the view up to a separator
+// or the end of the view.
+//
+static qd_hash_item_t *qd_hash_trie_longest_prefix(const qd_hash_trie_t *node, qd_iterator_t *iter)
+{
+    qd_hash_item_t *best = 0;
+
+    qd_iterator_reset(iter);
+    while (true) {
+        if (qd_iterator_end(iter)) {
+            if (node->item)
+                best = node->item;
+            break;
+        }
+
+        unsigned char octet = qd_iterator_octet(iter);
+        if (node->item && octet && strchr(SEPARATORS, (int) octet))
+            best = node->item;
+
+        bool     found;
+        uint32_t idx = qd_hash_trie_child(node, octet, &found);
+        if (!found)
+            break;
+
+        const qd_hash_trie_t *child   = node->children[idx];
+        uint32_t              matched = 1;
+        while (matched < child->label_len && !qd_iterator_end(iter) && qd_iterator_octet(iter) == child->label[matched])
+            matched++;
+        if (matched < child->label_len)
+            break;
+
+        node = child;
+    }
+    qd_iterator_reset(iter);
+
+    return best;
+}
+
+
+static bool qd_hash_key_indexed(const qd_hash_t *h, unsigned char first)
+{
+    return h->prefix_classes && first && strchr(h->prefix_classes, (int) first);
+}
+
+
+static bool qd_hash_view_indexed(const qd_hash_t *h, qd_iterator_t *iter)
+{
+    if (!h->prefix_classes)
+        return false;
+
+    qd_iterator_reset(iter);
+    unsigned char first = qd_iterator_end(iter) ? 0 : qd_iterator_octet(iter);
+    qd_iterator_reset(iter);
+    return qd_hash_key_indexed(h, first);
+}
+
+
+static void qd_hash_index_table(qd_hash_t *h, const qd_hash_table_t *t)
+{
+    if (!t->slots)
+        return;
+
+    for (uint32_t idx = 0; idx < t->capacity; idx++) {
+        qd_hash_item_t *item = t->slots[idx].item;
+        if (item && item != MOVED && qd_hash_key_indexed(h, item->key[0]))
+            qd_hash_trie_insert(h->trie, item->key, item);
+    }
+}
+
+
+void qd_hash_prefix_index(qd_hash_t *h, const char *prefix_classes)
+{
+    free(h->prefix_classes);
+    qd_hash_trie_free(h->trie);
+    h->prefix_classes = 0;
+    h->trie           = 0;
+
+    if (!prefix_classes || !*prefix_classes)
+        return;
+
+    h->prefix_classes = strdup(prefix_classes);
+    h->trie           = qd_hash_trie_node(0, 0, 0);
+    qd_hash_index_table(h, &h->table);
+    qd_hash_index_table(h, &h->old);
+}
+
+
 qd_hash_t *qd_hash(int bucket_exponent, int batch_size, int value_is_const)
 {
-    int i;
     qd_hash_t *h = NEW(qd_hash_t);
 
     if (!h)
         return 0;
 
-    h->bucket_count = 1 << bucket_exponent;
-    h->bucket_mask  = h->bucket_count - 1;
-    h->batch_size   = batch_size;
-    h->size         = 0;
-    h->is_const     = value_is_const;
-    h->buckets = NEW_ARRAY(bucket_t, h->bucket_count);
-    for (i = 0; i < h->bucket_count; i++) {
-        DEQ_INIT(h->buckets[i].items);
+    ZERO(h);
+    uint32_t capacity = 1 << bucket_exponent;
+    if (capacity < QD_HASH_MIN_CAPACITY)
+        capacity = QD_HASH_MIN_CAPACITY;
+
+    if (!qd_hash_table_init(&h->table, capacity)) {
+        free(h);
+        return 0;
     }
 
+    h->batch_size = batch_size;
+    h->is_const   = value_is_const;
+
     return h;
 }
 
-//remove the given item from the given bucket of the given hash
+//remove the given item from the hash
 //return the key if non-null key pointer given, otherwise, free the memory
-static void qd_hash_internal_remove_item(qd_hash_t *h, bucket_t *bucket, qd_hash_item_t *item, unsigned char **key) {
+static void qd_hash_internal_remove_item(qd_hash_t *h, qd_hash_item_t *item, unsigned char **key)
+{
+    qd_hash_slot_t *slot = qd_hash_table_find_item(&h->table, item);
+    if (slot)
+        qd_hash_table_delete(&h->table, slot);
+    else {
+        slot = qd_hash_table_find_item(&h->old, item);
+        assert(slot);
+        if (slot)
+            slot->item = MOVED;
+    }
+
+    if (h->trie && qd_hash_key_indexed(h, item->key[0]))
+        qd_hash_trie_remove(h->trie, item->key, strlen((const char*) item->key));
+
     if (key)
         *key = item->key;
     else
         free(item->key);
-    DEQ_REMOVE(bucket->items, item);
     free_qd_hash_item_t(item);
     h->size--;
+    qd_hash_migrate(h, QD_HASH_MIGRATE_STEP);
 }
 
-void qd_hash_free(qd_hash_t *h)
-{
-    if (!h) return;
-    qd_hash_item_t *item;
-    int             idx;
 
-    for (idx = 0; idx < h->bucket_count; idx++) {
-        item = DEQ_HEAD(h->buckets[idx].items);
-        while (item) {
-            qd_hash_internal_remove_item(h, &h->buckets[idx], item, 0);
-            item = DEQ_HEAD(h->buckets[idx].items);
+static void qd_hash_table_free(qd_hash_table_t *t)
+{
+    if (!t->slots)
+        return;
+
+    for (uint32_t idx = 0; idx < t->capacity; idx++) {
+        qd_hash_item_t *item = t->slots[idx].item;
+        if (item && item != MOVED) {
+            free(item->key);
+            free_qd_hash_item_t(item);
         }
     }
-    free(h->buckets);
+    free(t->slots);
+    t->slots = 0;
+}
+
+
+void qd_hash_free(qd_hash_t *h)
+{
+    if (!h) return;
+    qd_hash_table_free(&h->table);
+    qd_hash_table_free(&h->old);
+    qd_hash_trie_free(h->trie);
+    free(h->prefix_classes);
     free(h);
 }
 
@@ -122,14 +570,8 @@ size_t qd_hash_size(qd_hash_t *h)
 
 static qd_hash_item_t *qd_hash_internal_insert(qd_hash_t *h, qd_iterator_t *key, int *exists, qd_hash_handle_t **handle)
 {
-    unsigned long   idx  = qd_iterator_hash_view(key) & h->bucket_mask;
-    qd_hash_item_t *item = DEQ_HEAD(h->buckets[idx].items);
-
-    while (item) {
-        if (qd_iterator_equal(key, item->key))
-            break;
-        item = DEQ_NEXT(item);
-    }
+    uint32_t        hash = qd_iterator_hash_view(key);
+    qd_hash_item_t *item = qd_hash_internal_retrieve_with_hash(h, hash, key);
 
     if (item) {
         *exists = 1;
@@ -138,24 +580,29 @@ static qd_hash_item_t *qd_hash_internal_insert(qd_hash_t *h, qd_iterator_t *key,
         return item;
     }
 
+    if (!qd_hash_grow(h))
+        return 0;
+
     item = new_qd_hash_item_t();
     if (!item)
         return 0;
 
-    DEQ_ITEM_INIT(item);
-    item->key = qd_iterator_copy(key);
+    item->key  = qd_iterator_copy(key);
+    item->hash = hash;
 
-    DEQ_INSERT_TAIL(h->buckets[idx].items, item);
+    qd_hash_table_put(&h->table, item);
+    if (h->trie && qd_hash_key_indexed(h, item->key[0]))
+        qd_hash_trie_insert(h->trie, item->key, item);
     h->size++;
     *exists = 0;
+    qd_hash_migrate(h, QD_HASH_MIGRATE_STEP);
 
     //
     // If a pointer to a handle-pointer was supplied, create a handle for this item.
     //
     if (handle) {
         *handle = new_qd_hash_handle_t();
-        (*handle)->bucket = &h->buckets[idx];
-        (*handle)->item   = item;
+        (*handle)->item = item;
     }
 
     return item;
@@ -198,21 +645,6 @@ qd_error_t qd_hash_insert_const(qd_hash_t *h, qd_iterator_t *key, const void *va
 }
 
 
-static qd_hash_item_t *qd_hash_internal_retrieve_with_hash(qd_hash_t *h, uint32_t hash, qd_iterator_t *key)
-{
-    uint32_t        idx  = hash & h->bucket_mask;
-	qd_hash_item_t *item = DEQ_HEAD(h->buckets[idx].items);
-
-	while (item) {
-		if (qd_iterator_equal(key, item->key))
-			break;
-		item = DEQ_NEXT(item);
-	}
-
-	return item;
-}
-
-
 static qd_hash_item_t *qd_hash_internal_retrieve(qd_hash_t *h, qd_iterator_t *key)
 {
     uint32_t hash = qd_iterator_hash_view(key);
@@ -222,12 +654,18 @@ static qd_hash_item_t *qd_hash_internal_retrieve(qd_hash_t *h, qd_iterator_t *ke
 
 void qd_hash_retrieve_prefix(qd_hash_t *h, qd_iterator_t *iter, void **val)
 {
+    if (qd_hash_view_indexed(h, iter)) {
+        qd_hash_item_t *item = qd_hash_trie_longest_prefix(h->trie, iter);
+        *val = item ? item->v.val : 0;
+        return;
+    }
+
 	//Hash individual segments by iterating thru the octets in the iterator.
 	qd_iterator_hash_view_segments(iter);
 
 	uint32_t hash = 0;
 
-	qd_hash_item_t *item;
+	qd_hash_item_t *item = 0;
 	while (qd_iterator_next_segment(iter, &hash)) {
 		item = qd_hash_internal_retrieve_with_hash(h, hash, iter);
 		if (item)
@@ -245,12 +683,18 @@ void qd_hash_retrieve_prefix_const(qd_hash_t *h, qd_iterator_t *iter, const void
 {
     assert(h->is_const);
 
+    if (qd_hash_view_indexed(h, iter)) {
+        qd_hash_item_t *item = qd_hash_trie_longest_prefix(h->trie, iter);
+        *val = item ? item->v.val_const : 0;
+        return;
+    }
+
     //Hash individual segments by iterating thru the octets in the iterator.
     qd_iterator_hash_view_segments(iter);
 
     uint32_t hash = 0;
 
-    qd_hash_item_t *item;
+    qd_hash_item_t *item = 0;
 
     while (qd_iterator_next_segment(iter, &hash)) {
         item = qd_hash_internal_retrieve_with_hash(h, hash, iter);
@@ -293,14 +737,11 @@ qd_error_t qd_hash_retrieve_const(qd_hash_t *h, qd_iterator_t *key, const void *
 
 qd_error_t qd_hash_remove(qd_hash_t *h, qd_iterator_t *key)
 {
-    //the retrieve function will re-apply the bucket_mask, but that is ok
-    //we apply it here because we need the bucket index to do the remove
-    uint32_t        idx  = qd_iterator_hash_view(key) & h->bucket_mask;
-    qd_hash_item_t *item = qd_hash_internal_retrieve_with_hash(h, idx, key);
+    qd_hash_item_t *item = qd_hash_internal_retrieve(h, key);
     if (!item)
         return QD_ERROR_NOT_FOUND;
 
-    qd_hash_internal_remove_item(h, &h->buckets[idx], item, 0);
+    qd_hash_internal_remove_item(h, item, 0);
     return QD_ERROR_NONE;
 }
 
@@ -334,6 +775,6 @@ qd_error_t qd_hash_remove_by_handle2(qd_hash_t *h, qd_hash_handle_t *handle, uns
 {
     if (!handle)
         return QD_ERROR_NOT_FOUND;
-    qd_hash_internal_remove_item(h, handle->bucket, handle->item, key);
+    qd_hash_internal_remove_item(h, handle->item, key);
     return QD_ERROR_NONE;
 }
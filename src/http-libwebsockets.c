@@ -30,13 +30,25 @@
 #include <ctype.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
 
 #include "http.h"
 #include "server_private.h"
+#include "profile.h"
 #include "config.h"
 
 static const char *CIPHER_LIST = "ALL:aNULL:!eNULL:@STRENGTH"; /* Default */
 
+/* Router statistics are served at this path when the listener enables metrics */
+#define METRICS_PATH "/metrics"
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/* Profiler stacks are served at this path too, as folded stacks for flame graph tools */
+#define PROFILE_PATH "/profile"
+#define PROFILE_CONTENT_TYPE "text/plain; charset=utf-8"
+
 /* Log for LWS messages. For dispatch server messages use qd_http_server_t::log */
 static qd_log_source_t* http_log;
 
@@ -87,13 +99,23 @@ static void buffer_set_size(buffer_t *buf, size_t size) {
     }
 }
 
+typedef struct http_thread_t http_thread_t;
+typedef struct connection_t connection_t;
+
 /* AMQPWS connection: set as lws user data and qd_conn->context */
-typedef struct connection_t {
+struct connection_t {
+    DEQ_LINKS(connection_t);            /* http_thread_t::connections */
+    DEQ_LINKS_N(WAKE, connection_t);    /* http_thread_t::woken */
     pn_connection_driver_t driver;
     qd_connection_t* qd_conn;
     buffer_t wbuf;   /* LWS requires allocated header space at start of buffer */
     struct lws *wsi;
-} connection_t;
+    http_thread_t *thread;              /* Service thread that owns wsi, NULL if not established */
+    qdr_compression_stats_t *compression; /* Set if permessage-deflate is in effect */
+    connection_t *next_wake;            /* http_thread_t::wakes stack */
+    sys_atomic_t wake_pending;          /* On the wakes stack or the woken list */
+};
+DEQ_DECLARE(connection_t, connection_list_t);
 
 /* Navigating from WSI pointer to qd objects */
 static qd_http_server_t *wsi_server(struct lws *wsi);
@@ -107,6 +129,27 @@ static int callback_http(struct lws *wsi, enum lws_callback_reasons reason,
 static int callback_amqpws(struct lws *wsi, enum lws_callback_reasons reason,
                            void *user, void *in, size_t len);
 
+/*
+ * LWS receive buffer for AMQPWS connections.  Received data is copied once,
+ * from this buffer straight into the proton driver's read buffer, so a larger
+ * buffer means fewer RECEIVE callbacks and event batches per AMQP frame.
+ */
+#define AMQPWS_RX_BUFFER 65536
+
+static int callback_deflate(struct lws_context *context, const struct lws_extension *ext,
+                            struct lws *wsi, enum lws_extension_callback_reasons reason,
+                            void *user, void *in, size_t len);
+
+/* permessage-deflate is offered on the listeners that enable it */
+static const struct lws_extension deflate_extensions[] = {
+    {
+        "permessage-deflate",
+        callback_deflate,
+        "permessage-deflate; client_no_context_takeover; client_max_window_bits"
+    },
+    { NULL, NULL, NULL } /* terminator */
+};
+
 static struct lws_protocols protocols[] = {
     /* HTTP only protocol comes first */
     {
@@ -119,6 +162,7 @@ static struct lws_protocols protocols[] = {
         "amqp",
         callback_amqpws,
         sizeof(connection_t),
+        AMQPWS_RX_BUFFER,
     },
     /* "binary" is an alias for "amqp", for compatibility with clients designed
      * to work with a WebSocket proxy
@@ -127,6 +171,7 @@ static struct lws_protocols protocols[] = {
         "binary",
         callback_amqpws,
         sizeof(connection_t),
+        AMQPWS_RX_BUFFER,
     },
     { NULL, NULL, 0, 0 } /* terminator */
 };
@@ -159,9 +204,9 @@ static int handle_events(connection_t* c) {
     return 0;
 }
 
-/* The server has a bounded, thread-safe queue for external work */
+/* The server has a bounded, thread-safe queue for external listener work */
 typedef struct work_t {
-    enum { W_NONE, W_LISTEN, W_CLOSE, W_WAKE, W_STOP } type;
+    enum { W_NONE, W_LISTEN, W_CLOSE, W_STOP } type;
     void *value;
 } work_t;
 
@@ -174,15 +219,38 @@ typedef struct work_queue_t {
     size_t head, len;          /* Ring buffer */
 } work_queue_t;
 
-/* HTTP Server runs in a single thread, communication from other threads via work_queue */
+/*
+ * A service thread runs lws_service_tsi() for the connections lws assigns to
+ * its service thread index.  Other threads wake its connections through a
+ * lock-free stack; only the owning thread touches anything else.
+ */
+struct http_thread_t {
+    qd_http_server_t *server;
+    sys_thread_t *thread;
+    int tsi;                        /* LWS service thread index */
+    sys_atomic_ptr_t wakes;         /* Stack of connections to wake, pushed by any thread */
+    connection_list_t woken;        /* Wakes taken from the stack, oldest first */
+    connection_list_t connections;  /* Established AMQPWS connections */
+    pn_timestamp_t now;             /* Cache current time in thread_run */
+    pn_timestamp_t next_tick;       /* Next requested tick service */
+};
+
+/* The service thread running on this thread, if any */
+static __thread http_thread_t *current_thread;
+
+/*
+ * HTTP Server runs a pool of service threads.  Listener changes from other
+ * threads go via work_queue to thread 0.
+ */
 struct qd_http_server_t {
     qd_server_t *server;
-    sys_thread_t *thread;
+    http_thread_t *threads;
+    int n_threads;
+    bool started;               /* Threads started, guarded by work.lock */
+    sys_atomic_t stopping;
     work_queue_t work;
     qd_log_source_t *log;
     struct lws_context *context;
-    pn_timestamp_t now;         /* Cache current time in thread_run */
-    pn_timestamp_t next_tick;   /* Next requested tick service */
 };
 
 static void work_queue_destroy(work_queue_t *wq) {
@@ -200,13 +268,13 @@ static void work_push(qd_http_server_t *hs, work_t w) {
     work_queue_t *wq = &hs->work;
     sys_mutex_lock(wq->lock);
     while (wq->len == WORK_MAX) {
-        lws_cancel_service(hs->context); /* Wake up the run thread to clear space */
+        lws_cancel_service(hs->context); /* Wake up thread 0 to clear space */
         sys_cond_wait(wq->cond, wq->lock);
     }
     wq->work[(wq->head + wq->len) % WORK_MAX] = w;
     ++wq->len;
     sys_mutex_unlock(wq->lock);
-    lws_cancel_service(hs->context); /* Wake up the run thread to handle my work */
+    lws_cancel_service(hs->context); /* Wake up thread 0 to handle my work */
 }
 
 /* Non-blocking, return { W_NONE, NULL } if empty */
@@ -230,6 +298,8 @@ struct qd_http_listener_t {
     qd_http_server_t *server;
     struct lws_vhost *vhost;
     struct lws_http_mount mount;
+    struct lws_http_mount metrics_mount;
+    struct lws_http_mount profile_mount;
 };
 
 void qd_http_listener_free(qd_http_listener_t *hl) {
@@ -273,6 +343,21 @@ static void listener_start(qd_http_listener_t *hl, qd_http_server_t *hs) {
         config->http_root : QPID_CONSOLE_STAND_ALONE_INSTALL_DIR;
     m->def = "index.html";  /* Default file name */
     m->origin_protocol = LWSMPRO_FILE; /* mount type is a directory in a filesystem */
+    if (config->http_metrics) {
+        /* Statistics are rendered by callback_http rather than read from a file */
+        struct lws_http_mount *mm = &hl->metrics_mount;
+        mm->mountpoint = METRICS_PATH;
+        mm->mountpoint_len = strlen(mm->mountpoint);
+        mm->origin = protocols[0].name;
+        mm->origin_protocol = LWSMPRO_CALLBACK;
+        m->mount_next = mm;
+
+        struct lws_http_mount *pm = &hl->profile_mount;
+        *pm = *mm;
+        pm->mountpoint = PROFILE_PATH;
+        pm->mountpoint_len = strlen(pm->mountpoint);
+        mm->mount_next = pm;
+    }
 
     struct lws_context_creation_info info = {0};
     info.mounts = m;
@@ -291,6 +376,9 @@ static void listener_start(qd_http_listener_t *hl, qd_http_server_t *hs) {
             (config->ssl_required ? 0 : LWS_SERVER_OPTION_ALLOW_NON_SSL_ON_SSL_PORT) |
             (config->requireAuthentication ? LWS_SERVER_OPTION_REQUIRE_VALID_OPENSSL_CLIENT_CERT : 0);
     }
+    if (config->http_deflate) {
+        info.extensions = deflate_extensions;
+    }
     info.vhost_name = hl->listener->config.host_port;
     hl->vhost = lws_create_vhost(hs->context, &info);
     if (hl->vhost) {
@@ -320,6 +408,141 @@ static void listener_close(qd_http_listener_t *hl, qd_http_server_t *hs) {
            hl->listener->config.host_port);
 }
 
+/* Append formatted text to buf, leaving it empty if memory runs out */
+static void buffer_printf(buffer_t *buf, const char *fmt, ...) {
+    if (!buf->start) return;
+    size_t at = buf->size;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf->start + at, buf->cap - at, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t) n >= buf->cap - at) {
+        buffer_set_size(buf, at + n + 1);
+        if (!buf->start) return;
+        va_start(ap, fmt);
+        vsnprintf(buf->start + at, buf->cap - at, fmt, ap);
+        va_end(ap);
+    }
+    buf->size = at + n;
+}
+
+static void metric_family(buffer_t *buf, const char *name, const char *type, const char *help) {
+    buffer_printf(buf, "# TYPE qdrouterd_%s %s\n# HELP qdrouterd_%s %s\n", name, type, name, help);
+}
+
+static void metric_gauge(buffer_t *buf, const char *name, const char *help, uint64_t value) {
+    metric_family(buf, name, "gauge", help);
+    buffer_printf(buf, "qdrouterd_%s %"PRIu64"\n", name, value);
+}
+
+static void metric_counter(buffer_t *buf, const char *name, const char *help, uint64_t value) {
+    metric_family(buf, name, "counter", help);
+    buffer_printf(buf, "qdrouterd_%s_total %"PRIu64"\n", name, value);
+}
+
+static void metric_alloc_in_use(void *context, const char *type_name, size_t type_size,
+                                const qd_alloc_stats_t *stats) {
+    buffer_printf((buffer_t*) context, "qdrouterd_alloc_in_use{type=\"%s\"} %"PRIu64"\n",
+                  type_name, stats->total_allocs - stats->total_frees);
+}
+
+static void metric_alloc_heap(void *context, const char *type_name, size_t type_size,
+                              const qd_alloc_stats_t *stats) {
+    buffer_printf((buffer_t*) context, "qdrouterd_alloc_heap_bytes{type=\"%s\"} %"PRIu64"\n",
+                  type_name, (stats->total_alloc_from_heap - stats->total_free_to_heap) * type_size);
+}
+
+/*
+ * Render the router statistics in OpenMetrics text format after LWS_PRE bytes
+ * of header space.  Everything comes from the core's published snapshot and
+ * the allocator, so no core action or Python is involved.
+ */
+static void metrics_render(qd_http_server_t *hs, buffer_t *buf) {
+    qd_dispatch_t    *qd = qd_server_dispatch(hs->server);
+    qdr_core_stats_t  s;
+
+    buffer_set_size(buf, LWS_PRE);
+    qdr_core_stats(qd->router->router_core, &s);
+
+    metric_gauge(buf, "connections", "Open connections", s.connection_count);
+    metric_gauge(buf, "links", "Attached links", s.link_count);
+    metric_gauge(buf, "addresses", "Addresses known to the router", s.addr_count);
+    metric_gauge(buf, "routers", "Remote routers in the network", s.router_count);
+    metric_gauge(buf, "link_routes", "Configured link routes", s.link_route_count);
+    metric_gauge(buf, "auto_links", "Configured auto links", s.auto_link_count);
+    metric_counter(buf, "deliveries_ingress", "Deliveries received from clients", s.deliveries_ingress);
+    metric_counter(buf, "deliveries_egress", "Deliveries sent to clients", s.deliveries_egress);
+    metric_counter(buf, "deliveries_transit", "Deliveries forwarded to other routers", s.deliveries_transit);
+    metric_counter(buf, "deliveries_to_container", "Deliveries to in-process consumers", s.deliveries_to_container);
+    metric_counter(buf, "deliveries_from_container", "Deliveries from in-process producers", s.deliveries_from_container);
+    metric_counter(buf, "deliveries_dropped_presettled", "Pre-settled deliveries shed under back-pressure", s.dropped_presettled_deliveries);
+    metric_family(buf, "core_spin_seconds", "counter", "Time the core thread spent polling for work");
+    buffer_printf(buf, "qdrouterd_core_spin_seconds_total %.6f\n", s.spin_time_ns / 1e9);
+    metric_family(buf, "core_parked_seconds", "counter", "Time the core thread spent parked");
+    buffer_printf(buf, "qdrouterd_core_parked_seconds_total %.6f\n", s.parked_time_ns / 1e9);
+    metric_family(buf, "core_busy_seconds", "counter", "Time the core thread spent processing work");
+    buffer_printf(buf, "qdrouterd_core_busy_seconds_total %.6f\n", s.busy_time_ns / 1e9);
+    metric_gauge(buf, "core_utilization_percent", "Busy share of the core thread over the last second", s.utilization);
+    metric_counter(buf, "core_drains", "Times the core thread took the waiting actions", s.drains);
+    metric_counter(buf, "core_drained_actions", "Actions taken by the core thread", s.drained_actions);
+    metric_gauge(buf, "core_max_drain", "Most actions the core thread has taken at once", s.max_drain);
+    metric_gauge(buf, "stats_sequence", "Publication number of the core statistics snapshot", s.sequence);
+
+    metric_family(buf, "alloc_in_use", "gauge", "Allocated items of each type");
+    qd_alloc_each_type(metric_alloc_in_use, buf);
+    metric_family(buf, "alloc_heap_bytes", "gauge", "Heap memory held by each allocator type");
+    qd_alloc_each_type(metric_alloc_heap, buf);
+
+    buffer_printf(buf, "# EOF\n");
+}
+
+/* Send body, rendered after LWS_PRE bytes of header space. Returns non-zero if the connection should close */
+static int text_respond(struct lws *wsi, buffer_t *body, const char *content_type) {
+    if (!body->start) {
+        lws_return_http_status(wsi, HTTP_STATUS_INTERNAL_SERVER_ERROR, NULL);
+        return -1;
+    }
+
+    size_t         len = body->size - LWS_PRE;
+    unsigned char  headers[LWS_PRE + 256];
+    unsigned char *p   = headers + LWS_PRE;
+    unsigned char *end = headers + sizeof(headers);
+    int            err =
+        lws_add_http_header_status(wsi, HTTP_STATUS_OK, &p, end) ||
+        lws_add_http_header_by_token(wsi, WSI_TOKEN_HTTP_CONTENT_TYPE,
+                                     (const unsigned char*) content_type,
+                                     strlen(content_type), &p, end) ||
+        lws_add_http_header_content_length(wsi, len, &p, end) ||
+        lws_finalize_http_header(wsi, &p, end);
+    if (!err) {
+        err = lws_write(wsi, headers + LWS_PRE, p - (headers + LWS_PRE), LWS_WRITE_HTTP_HEADERS) < 0 ||
+            lws_write(wsi, (unsigned char*) body->start + LWS_PRE, len, LWS_WRITE_HTTP) < 0;
+    }
+    free(body->start);
+    if (err) return -1;
+    return lws_http_transaction_completed(wsi) ? -1 : 0;
+}
+
+/* Respond to a request for METRICS_PATH */
+static int metrics_respond(struct lws *wsi) {
+    buffer_t body = {0};
+    metrics_render(wsi_server(wsi), &body);
+    return text_respond(wsi, &body, METRICS_CONTENT_TYPE);
+}
+
+static void profile_line(void *context, const char *line) {
+    buffer_printf((buffer_t*) context, "%s\n", line);
+}
+
+/* Respond to a request for PROFILE_PATH with the profiler's folded stacks */
+static int profile_respond(struct lws *wsi) {
+    buffer_t body = {0};
+    buffer_set_size(&body, LWS_PRE);
+    qd_profile_each_stack(profile_line, &body);
+    return text_respond(wsi, &body, PROFILE_CONTENT_TYPE);
+}
+
 /*
  * LWS callback for un-promoted HTTP connections.
  * Note main HTTP file serving is handled by the "mount" struct below.
@@ -334,7 +557,15 @@ static int callback_http(struct lws *wsi, enum lws_callback_reasons reason,
         return -1;
 
     case LWS_CALLBACK_HTTP: {
-        /* Called if file mount can't find the file */
+        /* Called for the metrics and profile mounts, or if the file mount can't find the file */
+        char uri[sizeof(METRICS_PATH) + sizeof(PROFILE_PATH)];
+        if (lws_hdr_copy(wsi, uri, sizeof(uri), WSI_TOKEN_GET_URI) > 0 &&
+            wsi_listener(wsi)->listener->config.http_metrics) {
+            if (strcmp(uri, METRICS_PATH) == 0)
+                return metrics_respond(wsi);
+            if (strcmp(uri, PROFILE_PATH) == 0)
+                return profile_respond(wsi);
+        }
         lws_return_http_status(wsi, HTTP_STATUS_NOT_FOUND, (char*)in);
         return -1;
     }
@@ -344,17 +575,121 @@ static int callback_http(struct lws *wsi, enum lws_callback_reasons reason,
     }
 }
 
-/* Wake up a connection managed by the http server thread */
+/* Handle events outside an LWS callback, a connection that must close is closed when next writable */
+static void connection_service(connection_t *c) {
+    if (handle_events(c)) {
+        lws_callback_on_writable(c->wsi);
+    }
+}
+
+/* Wake up a connection owned by an http service thread, lock-free from any thread */
 static void connection_wake(qd_connection_t *qd_conn)
 {
     connection_t *c = qd_conn->context;
-    if (c && qd_conn->listener->http) {
-        qd_http_server_t *hs = qd_conn->listener->http->server;
-        work_t w = { W_WAKE, c };
-        work_push(hs, w);
+    if (c && c->thread && sys_atomic_swap(&c->wake_pending, 1) == 0) {
+        http_thread_t *ht = c->thread;
+        void *head;
+        do {
+            head = sys_atomic_ptr_get(&ht->wakes);
+            c->next_wake = (connection_t*) head;
+        } while (!sys_atomic_ptr_cas(&ht->wakes, head, c));
+        lws_cancel_service_pt(c->wsi);
+    }
+}
+
+/* Move the connections pushed on the wakes stack to the woken list, oldest first */
+static void thread_take_wakes(http_thread_t *ht) {
+    connection_t *c = (connection_t*) sys_atomic_ptr_swap(&ht->wakes, 0);
+    connection_list_t batch;
+    DEQ_INIT(batch);
+    while (c) {
+        connection_t *next = c->next_wake;
+        DEQ_ITEM_INIT_N(WAKE, c);
+        DEQ_INSERT_HEAD_N(WAKE, batch, c);
+        c = next;
+    }
+    DEQ_APPEND_N(WAKE, ht->woken, batch);
+}
+
+static void thread_wake_connections(http_thread_t *ht) {
+    thread_take_wakes(ht);
+    connection_t *c = DEQ_HEAD(ht->woken);
+    while (c) {
+        DEQ_REMOVE_HEAD_N(WAKE, ht->woken);
+        sys_atomic_swap(&c->wake_pending, 0); /* Later wakes are pushed again */
+        pn_collector_put(c->driver.collector, PN_OBJECT, c->driver.connection,
+                         PN_CONNECTION_WAKE);
+        connection_service(c);
+        c = DEQ_HEAD(ht->woken);
+    }
+}
+
+/* Run transport ticks for the thread's connections, may decrease ht->next_tick */
+static void thread_tick(http_thread_t *ht) {
+    for (connection_t *c = DEQ_HEAD(ht->connections); c; c = DEQ_NEXT(c)) {
+        pn_timestamp_t next_tick = pn_transport_tick(c->driver.transport, ht->now);
+        if (next_tick && next_tick > ht->now && next_tick < ht->next_tick) {
+            ht->next_tick = next_tick;
+        }
+        connection_service(c);
     }
 }
 
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Wraps the libwebsockets permessage-deflate extension to count the bytes on
+ * each side of the compressor, and the time it takes, for the connection.
+ */
+static int callback_deflate(struct lws_context *context, const struct lws_extension *ext,
+                            struct lws *wsi, enum lws_extension_callback_reasons reason,
+                            void *user, void *in, size_t len)
+{
+    bool payload = reason == LWS_EXT_CB_PAYLOAD_RX || reason == LWS_EXT_CB_PAYLOAD_TX;
+    connection_t *c = payload ? (connection_t*) lws_wsi_user(wsi) : NULL;
+    if (!c || !c->compression) {
+        return lws_extension_callback_pm_deflate(context, ext, wsi, reason, user, in, len);
+    }
+    struct lws_tokens *eff_buf = (struct lws_tokens*) in;
+    int before = eff_buf->token_len;
+    uint64_t start = monotonic_ns();
+    int result = lws_extension_callback_pm_deflate(context, ext, wsi, reason, user, in, len);
+    qdr_compression_stats_t *stats = c->compression;
+    stats->compress_ns += monotonic_ns() - start;
+    if (result >= 0 && before >= 0 && eff_buf->token_len >= 0) {
+        if (reason == LWS_EXT_CB_PAYLOAD_RX) {
+            stats->wire_bytes_in += before;
+            stats->bytes_in += eff_buf->token_len;
+        } else {
+            stats->bytes_out += before;
+            stats->wire_bytes_out += eff_buf->token_len;
+        }
+    }
+    return result;
+}
+
+/* Apply the listener's deflate settings, return true if permessage-deflate was negotiated */
+static bool deflate_configure(struct lws *wsi, const qd_server_config_t *config) {
+    char value[16];
+    int level = config->http_deflate_level;
+    level = level < 1 ? 1 : level > 9 ? 9 : level;
+    snprintf(value, sizeof(value), "%d", level);
+    if (lws_set_extension_option(wsi, "permessage-deflate", "compression_level", value)) {
+        return false;           /* Not offered by the client */
+    }
+    /* The window only shrinks from the one announced in the handshake */
+    int bits = config->http_deflate_window_bits;
+    bits = bits < 9 ? 9 : bits > 15 ? 15 : bits;
+    snprintf(value, sizeof(value), "%d", bits);
+    lws_set_extension_option(wsi, "permessage-deflate", "server_max_window_bits", value);
+    return true;
+}
+
 /* Callbacks for promoted AMQP over WS connections. */
 static int callback_amqpws(struct lws *wsi, enum lws_callback_reasons reason,
                            void *user, void *in, size_t len)
@@ -376,15 +711,22 @@ static int callback_amqpws(struct lws *wsi, enum lws_callback_reasons reason,
         if (c->qd_conn == NULL) {
             return unexpected_close(c->wsi, "out-of-memory");
         }
+        sys_atomic_init(&c->wake_pending, 0);
         c->qd_conn->context = c;
         c->qd_conn->wake = connection_wake;
         c->qd_conn->listener = hl->listener;
+        if (hl->listener->config.http_deflate && deflate_configure(wsi, &hl->listener->config)) {
+            c->compression = qdr_compression_stats();
+            c->qd_conn->compression = c->compression;
+        }
         lws_get_peer_simple(wsi, c->qd_conn->rhost, sizeof(c->qd_conn->rhost));
         int err = pn_connection_driver_init(&c->driver, c->qd_conn->pn_conn, NULL);
         if (err) {
             return unexpected_close(c->wsi, pn_code(err));
         }
         strncpy(c->qd_conn->rhost_port, c->qd_conn->rhost, sizeof(c->qd_conn->rhost_port));
+        c->thread = current_thread;
+        DEQ_INSERT_TAIL(c->thread->connections, c);
         qd_log(hs->log, QD_LOG_DEBUG,
                "[%"PRIu64"] upgraded HTTP connection from %s to AMQPWS",
                qd_connection_connection_id(c->qd_conn), qd_connection_name(c->qd_conn));
@@ -396,7 +738,9 @@ static int callback_amqpws(struct lws *wsi, enum lws_callback_reasons reason,
         pn_bytes_t dbuf = pn_connection_driver_write_buffer(&c->driver);
         if (dbuf.size) {
             /* lws_write() demands LWS_PRE bytes of free space before the data,
-             * so we must copy from the driver's buffer to larger temporary wbuf
+             * and the driver's buffer belongs to the proton transport with no
+             * space before its head, so copy once into wbuf.  wbuf keeps its
+             * capacity for the life of the connection.
              */
             buffer_set_size(&c->wbuf, LWS_PRE + dbuf.size);
             if (c->wbuf.start == NULL) {
@@ -431,14 +775,6 @@ static int callback_amqpws(struct lws *wsi, enum lws_callback_reasons reason,
         return handle_events(c);
     }
 
-    case LWS_CALLBACK_USER: {
-        pn_timestamp_t next_tick = pn_transport_tick(c->driver.transport, hs->now);
-        if (next_tick && next_tick > hs->now && next_tick < hs->next_tick) {
-            hs->next_tick = next_tick;
-        }
-        return handle_events(c);
-    }
-
     case LWS_CALLBACK_WS_PEER_INITIATED_CLOSE: {
         pn_connection_driver_read_close(&c->driver);
         return handle_events(c);
@@ -451,6 +787,20 @@ static int callback_amqpws(struct lws *wsi, enum lws_callback_reasons reason,
         }
         pn_connection_driver_destroy(&c->driver);
         free(c->wbuf.start);
+        qdr_compression_stats_decref(c->compression);
+        c->compression = NULL;
+        if (c->thread) {
+            http_thread_t *ht = c->thread;
+            DEQ_REMOVE(ht->connections, c);
+            /* Don't leave the freed connection to be woken */
+            thread_take_wakes(ht);
+            connection_t *w = DEQ_HEAD(ht->woken);
+            DEQ_FIND_N(WAKE, w, w == c);
+            if (w) {
+                DEQ_REMOVE_N(WAKE, ht->woken, c);
+            }
+            c->thread = NULL;
+        }
         return -1;
     }
 
@@ -462,17 +812,24 @@ static int callback_amqpws(struct lws *wsi, enum lws_callback_reasons reason,
 #define DEFAULT_TICK 1000
 
 static void* http_thread_run(void* v) {
-    qd_http_server_t *hs = v;
-    qd_log(hs->log, QD_LOG_INFO, "HTTP server thread running");
+    http_thread_t    *ht = v;
+    qd_http_server_t *hs = ht->server;
+    qd_dispatch_t    *qd = qd_server_dispatch(hs->server);
+    current_thread = ht;
+    qd_profile_thread("http");
+    if (qd->http_cpus && !sys_thread_bind_cpus(qd->http_cpus))
+        qd_log(hs->log, QD_LOG_WARNING, "Unable to bind HTTP thread %d to CPUs %s", ht->tsi, qd->http_cpus);
+    qd_log(hs->log, QD_LOG_INFO, "HTTP server thread %d running", ht->tsi);
     int result = 0;
-    while(result >= 0) {
-        /* Send a USER event to run transport ticks, may decrease hs->next_tick. */
-        hs->now = qd_timer_now();
-        hs->next_tick = hs->now + DEFAULT_TICK;
-        lws_callback_all_protocol(hs->context, &protocols[1], LWS_CALLBACK_USER);
-        lws_callback_all_protocol(hs->context, &protocols[2], LWS_CALLBACK_USER);
-        pn_millis_t timeout = (hs->next_tick > hs->now) ? hs->next_tick - hs->now : 1;
-        result = lws_service(hs->context, timeout);
+    while (result >= 0 && !sys_atomic_get(&hs->stopping)) {
+        ht->now = qd_timer_now();
+        ht->next_tick = ht->now + DEFAULT_TICK;
+        thread_tick(ht);
+        pn_millis_t timeout = (ht->next_tick > ht->now) ? ht->next_tick - ht->now : 1;
+        result = lws_service_tsi(hs->context, timeout, ht->tsi);
+
+        thread_wake_connections(ht);
+        if (ht->tsi != 0) continue;
 
         /* Process any work items on the queue */
         for (work_t w = work_pop(hs); w.type != W_NONE; w = work_pop(hs)) {
@@ -480,7 +837,8 @@ static void* http_thread_run(void* v) {
             case W_NONE:
                 break;
             case W_STOP:
-                result = -1;
+                sys_atomic_swap(&hs->stopping, 1);
+                lws_cancel_service(hs->context); /* Wake the other threads to exit */
                 break;
             case W_LISTEN:
                 listener_start((qd_http_listener_t*)w.value, hs);
@@ -488,32 +846,35 @@ static void* http_thread_run(void* v) {
             case W_CLOSE:
                 listener_close((qd_http_listener_t*)w.value, hs);
                 break;
-            case W_WAKE: {
-                connection_t *c = w.value;
-                pn_collector_put(c->driver.collector, PN_OBJECT, c->driver.connection,
-                                 PN_CONNECTION_WAKE);
-                handle_events(c);
-                break;
-            }
             }
         }
     }
-    qd_log(hs->log, QD_LOG_INFO, "HTTP server thread exit");
+    qd_log(hs->log, QD_LOG_INFO, "HTTP server thread %d exit", ht->tsi);
     return NULL;
 }
 
 void qd_http_server_free(qd_http_server_t *hs) {
     if (!hs) return;
-    if (hs->thread) {
+    if (hs->started) {
         /* Thread safe, stop via work queue then clean up */
         work_t work = { W_STOP, NULL };
         work_push(hs, work);
-        sys_thread_join(hs->thread);
-        sys_thread_free(hs->thread);
-        hs->thread = NULL;
+        for (int i = 0; i < hs->n_threads; ++i) {
+            if (hs->threads[i].thread) {
+                sys_thread_join(hs->threads[i].thread);
+                sys_thread_free(hs->threads[i].thread);
+            }
+        }
     }
     work_queue_destroy(&hs->work);
     if (hs->context) lws_context_destroy(hs->context);
+    if (hs->threads) {
+        for (int i = 0; i < hs->n_threads; ++i) {
+            sys_atomic_ptr_destroy(&hs->threads[i].wakes);
+        }
+        free(hs->threads);
+    }
+    sys_atomic_destroy(&hs->stopping);
     free(hs);
 }
 
@@ -522,7 +883,30 @@ qd_http_server_t *qd_http_server(qd_server_t *s, qd_log_source_t *log) {
     qd_http_server_t *hs = calloc(1, sizeof(*hs));
     if (hs) {
         work_queue_init(&hs->work);
+        sys_atomic_init(&hs->stopping, 0);
+        int n_threads = qd_server_dispatch(s)->http_thread_count;
+        if (n_threads < 1) n_threads = 1;
+#ifdef LWS_MAX_SMP
+        if (n_threads > LWS_MAX_SMP) {
+            qd_log(log, QD_LOG_WARNING, "libwebsockets supports at most %d HTTP threads, not %d",
+                   LWS_MAX_SMP, n_threads);
+            n_threads = LWS_MAX_SMP;
+        }
+#else
+        n_threads = 1;
+#endif
+        hs->n_threads = n_threads;
+        hs->threads = calloc(n_threads, sizeof(http_thread_t));
+        for (int i = 0; hs->threads && i < n_threads; ++i) {
+            http_thread_t *ht = &hs->threads[i];
+            ht->server = hs;
+            ht->tsi = i;
+            sys_atomic_ptr_init(&ht->wakes, 0);
+            DEQ_INIT(ht->woken);
+            DEQ_INIT(ht->connections);
+        }
         struct lws_context_creation_info info = {0};
+        info.count_threads = n_threads;
         info.gid = info.uid = -1;
         info.user = hs;
         info.server_string = QD_CONNECTION_PROPERTY_PRODUCT_VALUE;
@@ -535,7 +919,7 @@ qd_http_server_t *qd_http_server(qd_server_t *s, qd_log_source_t *log) {
         hs->context = lws_create_context(&info);
         hs->server = s;
         hs->log = log;              /* For messages from this file */
-        if (!hs->context) {
+        if (!hs->context || !hs->threads) {
             qd_log(hs->log, QD_LOG_CRITICAL, "No memory starting HTTP server");
             qd_http_server_free(hs);
             hs = NULL;
@@ -549,10 +933,13 @@ qd_http_server_t *qd_http_server(qd_server_t *s, qd_log_source_t *log) {
 qd_http_listener_t *qd_http_server_listen(qd_http_server_t *hs, qd_listener_t *li)
 {
     sys_mutex_lock(hs->work.lock);
-    if (!hs->thread) {
-        hs->thread = sys_thread(http_thread_run, hs);
+    if (!hs->started) {
+        hs->started = true;
+        for (int i = 0; i < hs->n_threads; ++i) {
+            hs->threads[i].thread = sys_thread(http_thread_run, &hs->threads[i]);
+        }
     }
-    bool ok = hs->thread;
+    bool ok = hs->threads[0].thread;
     sys_mutex_unlock(hs->work.lock);
     if (!ok) return NULL;
 
@@ -53,6 +53,17 @@ DEQ_DECLARE(qd_hash_segment_t, qd_hash_segment_list_t);
 ALLOC_DECLARE(qd_hash_segment_t);
 ALLOC_DEFINE(qd_hash_segment_t);
 
+//
+// Segments of typical addresses are held inline in the iterator; only deeper
+// addresses spill onto the allocated hash_segments list.
+//
+#define QD_ITERATOR_INLINE_SEGMENTS 8
+
+typedef struct {
+    uint32_t hash;
+    uint32_t segment_length;
+} qd_inline_segment_t;
+
 struct qd_iterator_t {
     pointer_t               start_pointer;      // Pointer to the raw data
     pointer_t               view_start_pointer; // Pointer to the start of the view
@@ -60,7 +71,9 @@ struct qd_iterator_t {
     qd_iterator_view_t      view;
     int                     annotation_length;
     int                     annotation_remaining;
-    qd_hash_segment_list_t  hash_segments;
+    qd_hash_segment_list_t  hash_segments;      // Segments beyond the inline ones
+    qd_inline_segment_t     inline_segments[QD_ITERATOR_INLINE_SEGMENTS];
+    int                     inline_segment_count;
     parse_mode_t            mode;
     view_state_t            state;
     unsigned char           prefix;
@@ -70,11 +83,17 @@ struct qd_iterator_t {
     int                     space_length;
     int                     space_cursor;
     bool                    view_space;
+    bool                    view_hash_valid;    // view_hash holds the hash of the current view
+    bool                    in_storage;         // Lives in caller storage, not the pool
+    uint32_t                view_hash;
 };
 
 ALLOC_DECLARE(qd_iterator_t);
 ALLOC_DEFINE(qd_iterator_t);
 
+// Fails to compile if qd_iterator_storage_t is too small to hold an iterator
+typedef char qd_iterator_storage_check_t[sizeof(qd_iterator_t) <= sizeof(qd_iterator_storage_t) ? 1 : -1];
+
 typedef enum {
     STATE_START,
     STATE_SLASH_LEFT,
@@ -199,7 +218,8 @@ void qd_iterator_remove_trailing_separator(qd_iterator_t *iter)
     }
 
     // We have the last octet in current_octet
-    iter->view_pointer = save_pointer;
+    iter->view_pointer    = save_pointer;
+    iter->view_hash_valid = false;
     if (current_octet && strrchr(SEPARATORS, (int) current_octet))
         iter->view_pointer.remaining--;
 }
@@ -343,6 +363,27 @@ static inline void field_iterator_move_cursor(qd_iterator_t *iter, uint32_t leng
 }
 
 
+//
+// Return the number of octets remaining in the view that can be read directly
+// from the cursor: the annotations are exhausted, the view does not stop
+// at a slash, and the rest of the view lies in a single buffer (or the
+// iterator is over a string).  Returns 0 when the slow path must be used.
+//
+static inline uint32_t contiguous_view(const qd_iterator_t *iter)
+{
+    if (iter->state != STATE_IN_BODY || iter->mode != MODE_TO_END)
+        return 0;
+
+    uint32_t remaining = iter->view_pointer.remaining;
+    if (iter->view_pointer.buffer &&
+        (uint32_t) (qd_buffer_cursor(iter->view_pointer.buffer) - iter->view_pointer.cursor) < remaining)
+        return 0;
+
+    return remaining;
+}
+
+
+
 static void qd_iterator_free_hash_segments(qd_iterator_t *iter)
 {
     qd_hash_segment_t *seg = DEQ_HEAD(iter->hash_segments);
@@ -351,6 +392,7 @@ static void qd_iterator_free_hash_segments(qd_iterator_t *iter)
         free_qd_hash_segment_t(seg);
         seg = DEQ_HEAD(iter->hash_segments);
     }
+    iter->inline_segment_count = 0;
 }
 
 
@@ -389,6 +431,22 @@ qd_iterator_t* qd_iterator_string(const char *text, qd_iterator_view_t view)
 }
 
 
+qd_iterator_t *qd_iterator_init_string(qd_iterator_storage_t *storage, const char *text, qd_iterator_view_t view)
+{
+    qd_iterator_t *iter = (qd_iterator_t*) storage;
+
+    ZERO(iter);
+    iter->start_pointer.cursor    = (unsigned char*) text;
+    iter->start_pointer.remaining = strlen(text);
+    iter->phase                   = '0';
+    iter->in_storage              = true;
+
+    qd_iterator_reset_view(iter, view);
+
+    return iter;
+}
+
+
 qd_iterator_t* qd_iterator_binary(const char *text, int length, qd_iterator_view_t view)
 {
     qd_iterator_t *iter = new_qd_iterator_t();
@@ -430,7 +488,8 @@ void qd_iterator_free(qd_iterator_t *iter)
         return;
 
     qd_iterator_free_hash_segments(iter);
-    free_qd_iterator_t(iter);
+    if (!iter->in_storage)
+        free_qd_iterator_t(iter);
 }
 
 
@@ -454,8 +513,9 @@ void qd_iterator_reset(qd_iterator_t *iter)
 void qd_iterator_reset_view(qd_iterator_t *iter, qd_iterator_view_t view)
 {
     if (iter) {
-        iter->view_pointer = iter->start_pointer;
-        iter->view         = view;
+        iter->view_pointer    = iter->start_pointer;
+        iter->view            = view;
+        iter->view_hash_valid = false;
         view_initialize(iter);
         iter->view_start_pointer   = iter->view_pointer;
         iter->annotation_remaining = iter->annotation_length;
@@ -471,8 +531,10 @@ qd_iterator_view_t qd_iterator_get_view(const qd_iterator_t *iter)
 
 void qd_iterator_annotate_phase(qd_iterator_t *iter, char phase)
 {
-    if (iter)
-        iter->phase = phase;
+    if (iter) {
+        iter->phase           = phase;
+        iter->view_hash_valid = false;
+    }
 }
 
 
@@ -482,6 +544,7 @@ void qd_iterator_trim_view(qd_iterator_t *iter, int length)
         return;
 
     iter->view_start_pointer = iter->view_pointer;
+    iter->view_hash_valid    = false;
     int view_length = qd_iterator_length(iter);
     if (view_length > length) {
         if (iter->annotation_length > length) {
@@ -507,8 +570,9 @@ void qd_iterator_annotate_prefix(qd_iterator_t *iter, char prefix)
 void qd_iterator_annotate_space(qd_iterator_t *iter, const char* space, int space_length)
 {
     if (iter) {
-        iter->space        = space;
-        iter->space_length = space_length;
+        iter->space           = space;
+        iter->space_length    = space_length;
+        iter->view_hash_valid = false;
         if      (iter->view == ITER_VIEW_ADDRESS_HASH)
             iter->annotation_length = (iter->view_space ? space_length : 0) + (iter->prefix == 'M' ? 2 : 1);
         else if (iter->view == ITER_VIEW_ADDRESS_WITH_SPACE) {
@@ -620,6 +684,14 @@ bool qd_iterator_equal(qd_iterator_t *iter, const unsigned char *string)
     qd_iterator_reset(iter);
 
     while (!qd_iterator_end(iter) && *string) {
+        uint32_t contiguous = contiguous_view(iter);
+        if (contiguous) {
+            bool match = strnlen((const char*) string, contiguous + 1) == contiguous &&
+                memcmp(string, iter->view_pointer.cursor, contiguous) == 0;
+            qd_iterator_reset(iter);
+            return match;
+        }
+
         if (*string != qd_iterator_octet(iter))
             break;
         string++;
@@ -639,6 +711,15 @@ bool qd_iterator_prefix(qd_iterator_t *iter, const char *prefix)
     pointer_t      save_pointer = iter->view_pointer;
     unsigned char *c            = (unsigned char*) prefix;
 
+    uint32_t contiguous = contiguous_view(iter);
+    if (contiguous) {
+        size_t length = strnlen(prefix, contiguous + 1);
+        if (length > contiguous || memcmp(prefix, iter->view_pointer.cursor, length) != 0)
+            return false;
+        field_iterator_move_cursor(iter, length);
+        return true;
+    }
+
     while(*c) {
         if (*c != qd_iterator_octet(iter))
             break;
@@ -667,8 +748,17 @@ int qd_iterator_ncopy(qd_iterator_t *iter, unsigned char* buffer, int n)
 
     qd_iterator_reset(iter);
     int i = 0;
-    while (!qd_iterator_end(iter) && i < n)
+    while (!qd_iterator_end(iter) && i < n) {
+        uint32_t contiguous = contiguous_view(iter);
+        if (contiguous) {
+            uint32_t count = (contiguous > (uint32_t) (n - i)) ? (uint32_t) (n - i) : contiguous;
+            memcpy(&buffer[i], iter->view_pointer.cursor, count);
+            field_iterator_move_cursor(iter, count);
+            i += count;
+            break;
+        }
         buffer[i++] = qd_iterator_octet(iter);
+    }
     return i;
 }
 
@@ -700,8 +790,26 @@ qd_iterator_t *qd_iterator_dup(const qd_iterator_t *iter)
         return 0;
 
     qd_iterator_t *dup = new_qd_iterator_t();
-    if (dup)
+    if (dup) {
         *dup = *iter;
+        DEQ_INIT(dup->hash_segments);  // the segments belong to the original
+        dup->inline_segment_count = 0;
+        dup->in_storage           = false;
+    }
+    return dup;
+}
+
+
+qd_iterator_t *qd_iterator_init_dup(qd_iterator_storage_t *storage, const qd_iterator_t *iter)
+{
+    if (!iter)
+        return 0;
+
+    qd_iterator_t *dup = (qd_iterator_t*) storage;
+    *dup = *iter;
+    DEQ_INIT(dup->hash_segments);
+    dup->inline_segment_count = 0;
+    dup->in_storage           = true;
     return dup;
 }
 
@@ -776,13 +884,19 @@ static qd_hash_segment_t *qd_iterator_hash_segment(void)
 
 
 /**
- * Create a new hash segment and insert it at the end of the linked list
+ * Record a segment hash, inline while there is room and on the list after that
  */
 static void qd_insert_hash_segment(qd_iterator_t *iter, uint32_t *hash, int segment_length)
 {
-    qd_hash_segment_t *hash_segment = qd_iterator_hash_segment();
-
     // While storing the segment, don't include the hash of the separator in the segment but do include it in the overall hash.
+    if (iter->inline_segment_count < QD_ITERATOR_INLINE_SEGMENTS) {
+        qd_inline_segment_t *segment = &iter->inline_segments[iter->inline_segment_count++];
+        segment->hash           = *hash;
+        segment->segment_length = segment_length;
+        return;
+    }
+
+    qd_hash_segment_t *hash_segment = qd_iterator_hash_segment();
     hash_segment->hash = *hash;
 
     hash_segment->segment_length = segment_length;
@@ -790,14 +904,53 @@ static void qd_insert_hash_segment(qd_iterator_t *iter, uint32_t *hash, int segm
 }
 
 
+//
+// Continue the hash * 33 + c hash over a run of octets, four at a time.  The
+// result is identical to hashing one octet at a time, which the segment
+// hashes used for prefix lookups rely on.
+//
+static inline uint32_t hash_octets(uint32_t hash, const unsigned char *octets, uint32_t length)
+{
+    while (length >= 4) {
+        hash = hash * (33 * 33 * 33 * 33)
+            + (uint32_t) octets[0] * (33 * 33 * 33)
+            + (uint32_t) octets[1] * (33 * 33)
+            + (uint32_t) octets[2] * 33
+            + (uint32_t) octets[3];
+        octets += 4;
+        length -= 4;
+    }
+    while (length--)
+        hash = ((hash << 5) + hash) + (uint32_t) *octets++;
+    return hash;
+}
+
+
 uint32_t qd_iterator_hash_view(qd_iterator_t *iter)
 {
     uint32_t hash = HASH_INIT;
 
     qd_iterator_reset(iter);
-    while (!qd_iterator_end(iter))
+
+    //
+    // An address is typically looked up and then inserted, or looked up in more than one
+    // table, with the same view.  Walk it only once.
+    //
+    if (iter->view_hash_valid)
+        return iter->view_hash;
+
+    while (!qd_iterator_end(iter)) {
+        uint32_t contiguous = contiguous_view(iter);
+        if (contiguous) {
+            hash = hash_octets(hash, iter->view_pointer.cursor, contiguous);
+            break;
+        }
         hash = ((hash << 5) + hash) + (uint32_t) qd_iterator_octet(iter); /* hash * 33 + c */
+    }
 
+    qd_iterator_reset(iter);
+    iter->view_hash       = hash;
+    iter->view_hash_valid = true;
     return hash;
 }
 
@@ -832,6 +985,10 @@ void qd_iterator_hash_view_segments(qd_iterator_t *iter)
     // Insert the last segment which was not inserted in the previous while loop
     qd_insert_hash_segment(iter, &hash, segment_length);
 
+    // The last segment is the whole view
+    iter->view_hash       = hash;
+    iter->view_hash_valid = true;
+
     // Return the pointers in the iterator back to the original state before returning from this function.
     qd_iterator_reset(iter);
 }
@@ -839,16 +996,25 @@ void qd_iterator_hash_view_segments(qd_iterator_t *iter)
 
 bool qd_iterator_next_segment(qd_iterator_t *iter, uint32_t *hash)
 {
+    //
+    // The longest segments are the most recently recorded: pop the spilled
+    // ones before the inline ones.
+    //
     qd_hash_segment_t *hash_segment = DEQ_TAIL(iter->hash_segments);
-    if (!hash_segment)
-        return false;
-
-    *hash = hash_segment->hash;
-    qd_iterator_trim_view(iter, hash_segment->segment_length);
+    if (hash_segment) {
+        *hash = hash_segment->hash;
+        qd_iterator_trim_view(iter, hash_segment->segment_length);
+        DEQ_REMOVE_TAIL(iter->hash_segments);
+        free_qd_hash_segment_t(hash_segment);
+        return true;
+    }
 
-    DEQ_REMOVE_TAIL(iter->hash_segments);
+    if (iter->inline_segment_count == 0)
+        return false;
 
-    free_qd_hash_segment_t(hash_segment);
+    qd_inline_segment_t *segment = &iter->inline_segments[--iter->inline_segment_count];
+    *hash = segment->hash;
+    qd_iterator_trim_view(iter, segment->segment_length);
 
     return true;
 }
@@ -23,14 +23,20 @@
 #include "entity.h"
 #include "entity_cache.h"
 #include "aprintf.h"
+#include "profile.h"
 #include <qpid/dispatch/atomic.h>
 #include <qpid/dispatch/ctools.h>
 #include <qpid/dispatch/dispatch.h>
 #include "alloc.h"
 #include <qpid/dispatch/threading.h>
 #include <qpid/dispatch/log.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <syslog.h>
@@ -38,6 +44,11 @@
 #define TEXT_MAX QD_LOG_TEXT_MAX
 #define LOG_MAX (QD_LOG_TEXT_MAX+128)
 #define LIST_MAX 1000
+#define QUEUE_MAX 8192
+#define RING_SIZE_DEFAULT 1000
+#define RING_ARGS 8
+#define RING_STRINGS 512
+#define SPEC_MAX 32
 
 const char *QD_LOG_STATS_TYPE = "logStats";
 
@@ -49,12 +60,14 @@ typedef struct qd_log_entry_t qd_log_entry_t;
 
 struct qd_log_entry_t {
     DEQ_LINKS(qd_log_entry_t);
-    const char     *module;
-    int             level;
-    char           *file;
-    int             line;
-    struct timeval  time;
-    char            text[TEXT_MAX];
+    qd_log_entry_t   *next_queued;  // Link in the writer queue
+    qd_log_source_t  *source;
+    const char       *module;
+    int               level;
+    char             *file;
+    int               line;
+    struct timeval    time;
+    char              text[TEXT_MAX];
 };
 
 ALLOC_DECLARE(qd_log_entry_t);
@@ -69,6 +82,38 @@ static void qd_log_entry_free_lh(qd_log_entry_t* entry) {
     free_qd_log_entry_t(entry);
 }
 
+/// Keep entry in the bounded buffer of recent entries, dropping the oldest.
+static void qd_log_entry_keep_lh(qd_log_entry_t* entry) {
+    DEQ_INSERT_TAIL(entries, entry);
+    if (DEQ_SIZE(entries) > LIST_MAX)
+        qd_log_entry_free_lh(DEQ_HEAD(entries));
+}
+
+/*
+ * Entries are formatted and written by a dedicated writer thread so that a
+ * logging thread never blocks on the sink.  Loggers push entries onto a
+ * lock-free stack, the writer takes the whole stack in one swap, restores
+ * arrival order and writes the batch with one flush per sink.  At most
+ * QUEUE_MAX entries may be queued; beyond that entries are dropped and
+ * counted rather than blocking the logger.
+ *
+ * Until the writer is started, and after it stops, entries are written
+ * synchronously by the logging thread.  A logger counts itself in
+ * log_pushers while it may touch the queue or the writer's lock, so that
+ * qd_log_finalize can wait for it before tearing them down.
+ */
+static sys_thread_t     *log_writer = 0;
+static long              log_writer_id = 0;
+static bool              log_writer_stop = false;
+static sys_mutex_t      *log_writer_lock = 0;
+static sys_cond_t       *log_writer_cond = 0;    // Writer waits for entries
+static sys_cond_t       *log_drained_cond = 0;   // qd_log_flush waits for an empty queue
+static sys_atomic_t      log_writer_sleeping;
+static sys_atomic_ptr_t  log_queue;              // Stack of entries, most recent first
+static sys_atomic_t      log_queued;             // Entries pushed but not yet written
+static sys_atomic_t      log_dropped;            // Entries dropped since last reported
+static sys_atomic_t      log_pushers;            // Threads that may be using the queue
+
 // Ref-counted log sink, may be shared by several sources.
 typedef struct log_sink_t {
     sys_atomic_t ref_count;
@@ -161,15 +206,59 @@ typedef enum {DEFAULT, NONE, TRACE, DEBUG, INFO, NOTICE, WARNING, ERROR, CRITICA
 #define N_LEVEL_INDICES (MAX_VALID_LEVEL_INDEX - MIN_VALID_LEVEL_INDEX + 1)
 #define LEVEL_INDEX(LEVEL) ((LEVEL) - TRACE)
 
+/*
+ * Each source may keep a ring of its most recent raw entries, usually at a
+ * more verbose level than it writes to its sink.  A raw entry holds the
+ * format string and a copy of the arguments; it is only formatted when the
+ * ring is dumped through management, so capturing costs no more than parsing
+ * the conversion specs and copying string arguments.
+ *
+ * Format strings must outlive the entry, which holds for the string literals
+ * passed to qd_log.  A format the ring can't capture (too many arguments, wide
+ * or positional conversions, %n, %m) is formatted at once into the entry's
+ * string space instead, truncated to fit.
+ */
+typedef union log_arg_t {
+    intmax_t     i;             /* Integers, and string offsets into the entry's strings */
+    long double  f;
+    const void  *p;
+} log_arg_t;
+
+typedef struct log_ring_entry_t {
+    const char     *fmt;        /* 0 if strings holds the formatted text */
+    int             level;
+    int             line;
+    int             file;       /* Offset of the file name in strings, -1 if none */
+    int             nargs;
+    struct timeval  time;
+    log_arg_t       args[RING_ARGS];
+    char            strings[RING_STRINGS];
+} log_ring_entry_t;
+
+typedef struct log_ring_t {
+    sys_mutex_t      *lock;
+    log_ring_entry_t *entries;
+    size_t            size;
+    size_t            next;     /* Slot for the next entry */
+    size_t            count;    /* Valid entries, at most size */
+} log_ring_t;
+
 struct qd_log_source_t {
     DEQ_LINKS(qd_log_source_t);
     char *module;
-    int mask;
+    int mask;                   /* -1 means use the default source's mask */
+    int ring_mask;              /* -1 means use the default source's ring_mask */
+    int ring_size;              /* -1 means use the default source's ring_size */
+    sys_atomic_t enabled;       /* Effective sink_enabled | ring_enabled */
+    sys_atomic_t sink_enabled;  /* Effective masks, maintained by update_enabled_lh() */
+    sys_atomic_t ring_enabled;
+    log_ring_t ring;
     int timestamp;              /* boolean or -1 means not set */
     int source;                 /* boolean or -1 means not set */
     bool syslog;
     log_sink_t *sink;
     uint64_t severity_histogram[N_LEVEL_INDICES];
+    sys_atomic_t dropped;       /* Entries dropped because the writer queue was full */
 };
 
 DEQ_DECLARE(qd_log_source_t, qd_log_source_list_t);
@@ -283,8 +372,13 @@ static bool default_bool(int value, int default_value) {
     return value == -1 ? default_value : value;
 }
 
+/// Write entry to its sink without flushing.  Called by the writer thread
+/// with the log_source_lock held, or synchronously before the writer starts.
 static void write_log(qd_log_source_t *log_source, qd_log_entry_t *entry)
 {
+    static time_t stamp_sec = -1;
+    static char   stamp_fmt[100];
+
     log_sink_t* sink = log_source->sink ? log_source->sink : default_log_source->sink;
     if (!sink) return;
 
@@ -302,11 +396,15 @@ static void write_log(qd_log_source_t *log_source, qd_log_entry_t *entry)
         char buf[100];
         buf[0] = '\0';
 
+        // Only the microseconds change between entries in the same second.
         time_t sec = entry->time.tv_sec;
-        struct tm *local_tm = localtime(&sec);
-        char fmt[100];
-        strftime(fmt, sizeof fmt, format, local_tm);
-        snprintf(buf, 100, fmt, entry->time.tv_usec);
+        if (sec != stamp_sec) {
+            struct tm local_tm;
+            localtime_r(&sec, &local_tm);
+            strftime(stamp_fmt, sizeof stamp_fmt, format, &local_tm);
+            stamp_sec = sec;
+        }
+        snprintf(buf, 100, stamp_fmt, entry->time.tv_usec);
 
         aprintf(&begin, end, "%s ", buf);
     }
@@ -322,7 +420,6 @@ static void write_log(qd_log_source_t *log_source, qd_log_entry_t *entry)
             perror(msg);
             exit(1);
         };
-        fflush(sink->file);
     }
     if (sink->syslog) {
         int syslog_level = level->syslog;
@@ -331,13 +428,252 @@ static void write_log(qd_log_source_t *log_source, qd_log_entry_t *entry)
     }
 }
 
+typedef enum { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_J, LEN_Z, LEN_T, LEN_BIG_L } log_length_t;
+
+typedef struct log_spec_t {
+    bool         star_width;
+    bool         star_prec;
+    log_length_t length;
+    char         conv;
+} log_spec_t;
+
+/// Parse the conversion spec following a '%'.  Return the end of the spec,
+/// or 0 if the ring can't capture its argument.
+static const char *parse_spec(const char *p, log_spec_t *spec) {
+    const char *start = p;
+    ZERO(spec);
+    while (*p && strchr("-+ #0'", *p)) ++p;
+    if (*p == '*') {
+        spec->star_width = true;
+        ++p;
+    } else
+        while (isdigit((unsigned char) *p)) ++p;
+    if (*p == '.') {
+        ++p;
+        if (*p == '*') {
+            spec->star_prec = true;
+            ++p;
+        } else
+            while (isdigit((unsigned char) *p)) ++p;
+    }
+    switch (*p) {
+    case 'h': ++p; spec->length = LEN_H; if (*p == 'h') { ++p; spec->length = LEN_HH; } break;
+    case 'l': ++p; spec->length = LEN_L; if (*p == 'l') { ++p; spec->length = LEN_LL; } break;
+    case 'q': ++p; spec->length = LEN_LL; break;
+    case 'j': ++p; spec->length = LEN_J; break;
+    case 'z': ++p; spec->length = LEN_Z; break;
+    case 't': ++p; spec->length = LEN_T; break;
+    case 'L': ++p; spec->length = LEN_BIG_L; break;
+    }
+    spec->conv = *p;
+    if (!*p || !strchr("diouxXcsp" "eEfFgGaA", *p) || p + 1 - start >= SPEC_MAX)
+        return 0;
+    if ((spec->conv == 'c' || spec->conv == 's' || spec->conv == 'p') && spec->length != LEN_NONE)
+        return 0;               /* Wide characters and strings */
+    if (strchr("eEfFgGaA", spec->conv) && spec->length != LEN_NONE && spec->length != LEN_BIG_L)
+        return 0;
+    return p + 1;
+}
+
+static bool is_float_conv(char conv) { return strchr("eEfFgGaA", conv) != 0; }
+
+/// Copy s into the entry's strings at *str, truncated to fit. Return its offset.
+static int ring_copy_string(log_ring_entry_t *entry, char **str, const char *s, int max) {
+    char *end = entry->strings + RING_STRINGS;
+    int offset = *str - entry->strings;
+    size_t len = strlen(s);
+    if (max >= 0 && len > (size_t) max) len = max;
+    if (len > (size_t) (end - *str - 1)) len = end - *str - 1;
+    memcpy(*str, s, len);
+    (*str)[len] = '\0';
+    *str += len;
+    if (*str < end - 1) ++*str;  /* Once full, later strings share the final '\0' */
+    return offset;
+}
+
+/// Capture the arguments of fmt into entry. Return false if it can't be captured.
+static bool ring_capture_args(log_ring_entry_t *entry, char **str, const char *fmt, va_list ap) {
+    for (const char *p = strchr(fmt, '%'); p; p = strchr(p, '%')) {
+        ++p;
+        if (*p == '%') {
+            ++p;
+            continue;
+        }
+        log_spec_t spec;
+        const char *end = parse_spec(p, &spec);
+        if (!end || entry->nargs + spec.star_width + spec.star_prec + 1 > RING_ARGS)
+            return false;
+        int prec = -1;
+        if (spec.star_width)
+            entry->args[entry->nargs++].i = va_arg(ap, int);
+        if (spec.star_prec)
+            entry->args[entry->nargs++].i = prec = va_arg(ap, int);
+        log_arg_t *arg = &entry->args[entry->nargs++];
+        if (spec.conv == 's') {
+            const char *s = va_arg(ap, const char*);
+            arg->i = ring_copy_string(entry, str, s ? s : "(null)", prec);
+        } else if (spec.conv == 'p')
+            arg->p = va_arg(ap, const void*);
+        else if (is_float_conv(spec.conv))
+            arg->f = spec.length == LEN_BIG_L ? va_arg(ap, long double) : va_arg(ap, double);
+        else {
+            switch (spec.length) {
+            case LEN_L:  arg->i = va_arg(ap, long); break;
+            case LEN_LL: arg->i = va_arg(ap, long long); break;
+            case LEN_J:  arg->i = va_arg(ap, intmax_t); break;
+            case LEN_Z:  arg->i = va_arg(ap, size_t); break;
+            case LEN_T:  arg->i = va_arg(ap, ptrdiff_t); break;
+            default:     arg->i = va_arg(ap, int); break;
+            }
+        }
+        p = end;
+    }
+    return true;
+}
+
+/// Format a captured entry's text into buf.
+static void ring_format(const log_ring_entry_t *entry, char *buf, size_t size) {
+    char *begin = buf, *end = buf + size;
+    buf[0] = '\0';
+    if (!entry->fmt) {
+        aprintf(&begin, end, "%s", entry->strings + entry->args[0].i);
+        return;
+    }
+    const log_arg_t *arg = entry->args;
+    const char *p = entry->fmt;
+    while (*p) {
+        const char *pct = strchr(p, '%');
+        if (!pct) {
+            aprintf(&begin, end, "%s", p);
+            break;
+        }
+        aprintf(&begin, end, "%.*s", (int) (pct - p), p);
+        if (pct[1] == '%') {
+            aprintf(&begin, end, "%%");
+            p = pct + 2;
+            continue;
+        }
+        log_spec_t spec;
+        p = parse_spec(pct + 1, &spec);
+        assert(p);              /* It was parsed when the entry was captured */
+
+        // Rebuild the spec with any '*' replaced by the captured value.
+        char spec_buf[SPEC_MAX * 2];
+        char *sb = spec_buf, *sb_end = spec_buf + sizeof(spec_buf);
+        for (const char *c = pct; c < p; ++c) {
+            if (*c == '*')
+                aprintf(&sb, sb_end, "%d", (int) (arg++)->i);
+            else
+                aprintf(&sb, sb_end, "%c", *c);
+        }
+
+        if (spec.conv == 's')
+            aprintf(&begin, end, spec_buf, entry->strings + arg->i);
+        else if (spec.conv == 'p')
+            aprintf(&begin, end, spec_buf, arg->p);
+        else if (is_float_conv(spec.conv)) {
+            if (spec.length == LEN_BIG_L)
+                aprintf(&begin, end, spec_buf, arg->f);
+            else
+                aprintf(&begin, end, spec_buf, (double) arg->f);
+        } else {
+            switch (spec.length) {
+            case LEN_L:  aprintf(&begin, end, spec_buf, (long) arg->i); break;
+            case LEN_LL: aprintf(&begin, end, spec_buf, (long long) arg->i); break;
+            case LEN_J:  aprintf(&begin, end, spec_buf, arg->i); break;
+            case LEN_Z:  aprintf(&begin, end, spec_buf, (size_t) arg->i); break;
+            case LEN_T:  aprintf(&begin, end, spec_buf, (ptrdiff_t) arg->i); break;
+            default:     aprintf(&begin, end, spec_buf, (int) arg->i); break;
+            }
+        }
+        ++arg;
+    }
+}
+
+/// Record a raw entry in the source's ring.
+static void ring_capture(qd_log_source_t *source, int level, const char *file, int line,
+                         const char *fmt, va_list ap)
+{
+    log_ring_t *ring = &source->ring;
+    sys_mutex_lock(ring->lock);
+    if (ring->size) {
+        log_ring_entry_t *entry = &ring->entries[ring->next];
+        ring->next = (ring->next + 1) % ring->size;
+        if (ring->count < ring->size) ++ring->count;
+
+        char *str = entry->strings;
+        entry->fmt   = fmt;
+        entry->level = level;
+        entry->line  = line;
+        entry->file  = file ? ring_copy_string(entry, &str, file, -1) : -1;
+        entry->nargs = 0;
+        gettimeofday(&entry->time, NULL);
+
+        va_list args;
+        va_copy(args, ap);
+        bool captured = ring_capture_args(entry, &str, fmt, args);
+        va_end(args);
+        if (!captured) {
+            entry->fmt   = 0;
+            entry->nargs = 1;
+            entry->args[0].i = str - entry->strings;
+            vsnprintf(str, entry->strings + RING_STRINGS - str, fmt, ap);
+        }
+    }
+    sys_mutex_unlock(ring->lock);
+}
+
+/// Discard the ring's entries and give it room for size entries.
+static void ring_resize(log_ring_t *ring, size_t size) {
+    if (ring->size == size)
+        return;
+    sys_mutex_lock(ring->lock);
+    free(ring->entries);
+    ring->entries = size ? (log_ring_entry_t*) calloc(size, sizeof(log_ring_entry_t)) : 0;
+    ring->size = ring->entries ? size : 0;
+    ring->next = 0;
+    ring->count = 0;
+    sys_mutex_unlock(ring->lock);
+}
+
+/// Recompute the effective enable masks and ring of every source after the
+/// configuration changes.  Caller must hold the log_source_lock.
+static void update_enabled_lh(void) {
+    int default_mask = 0;
+    int default_ring_mask = 0;
+    int default_ring_size = RING_SIZE_DEFAULT;
+    if (default_log_source) {
+        default_mask = default_log_source->mask;
+        if (default_log_source->ring_mask != -1) default_ring_mask = default_log_source->ring_mask;
+        if (default_log_source->ring_size != -1) default_ring_size = default_log_source->ring_size;
+    }
+    for (qd_log_source_t *src = DEQ_HEAD(source_list); src; src = DEQ_NEXT(src)) {
+        int sink_mask = src->mask == -1 ? default_mask : src->mask;
+        int ring_mask = src->ring_mask == -1 ? default_ring_mask : src->ring_mask;
+        int ring_size = src->ring_size == -1 ? default_ring_size : src->ring_size;
+        if (!ring_mask || ring_size < 0)
+            ring_size = 0;
+        if (!ring_size)
+            ring_mask = 0;
+        ring_resize(&src->ring, ring_size);
+        if (!src->ring.size)
+            ring_mask = 0;
+        sys_atomic_swap(&src->sink_enabled, sink_mask);
+        sys_atomic_swap(&src->ring_enabled, ring_mask);
+        sys_atomic_swap(&src->enabled, sink_mask | ring_mask);
+    }
+}
+
 /// Reset the log source to the default state
 static void qd_log_source_defaults(qd_log_source_t *log_source) {
     log_source->mask = -1;
+    log_source->ring_mask = -1;
+    log_source->ring_size = -1;
     log_source->timestamp = -1;
     log_source->source = -1;
     log_source->sink = 0;
     memset ( log_source->severity_histogram, 0, sizeof(uint64_t) * (N_LEVEL_INDICES) );
+    sys_atomic_swap(&log_source->dropped, 0);
 }
 
 /// Caller must hold the log_source_lock
@@ -351,8 +687,14 @@ static qd_log_source_t *qd_log_source_lh(const char *module)
         DEQ_ITEM_INIT(log_source);
         log_source->module = (char*) malloc(strlen(module) + 1);
         strcpy(log_source->module, module);
+        sys_atomic_init(&log_source->enabled, 0);
+        sys_atomic_init(&log_source->sink_enabled, 0);
+        sys_atomic_init(&log_source->ring_enabled, 0);
+        sys_atomic_init(&log_source->dropped, 0);
+        log_source->ring.lock = sys_mutex();
         qd_log_source_defaults(log_source);
         DEQ_INSERT_TAIL(source_list, log_source);
+        update_enabled_lh();
         qd_entity_cache_add(QD_LOG_STATS_TYPE, log_source);
     }
     return log_source;
@@ -371,6 +713,7 @@ qd_log_source_t *qd_log_source_reset(const char *module)
     sys_mutex_lock(log_source_lock);
     qd_log_source_t* src = qd_log_source_lh(module);
     qd_log_source_defaults(src);
+    update_enabled_lh();
     sys_mutex_unlock(log_source_lock);
     return src;
 }
@@ -378,14 +721,131 @@ qd_log_source_t *qd_log_source_reset(const char *module)
 static void qd_log_source_free_lh(qd_log_source_t* src) {
     DEQ_REMOVE(source_list, src);
     log_sink_free_lh(src->sink);
+    sys_atomic_destroy(&src->enabled);
+    sys_atomic_destroy(&src->sink_enabled);
+    sys_atomic_destroy(&src->ring_enabled);
+    sys_atomic_destroy(&src->dropped);
+    free(src->ring.entries);
+    sys_mutex_free(src->ring.lock);
     free(src->module);
     free(src);
 }
 
 bool qd_log_enabled(qd_log_source_t *source, qd_log_level_t level) {
-    if (!source) return false;
-    int mask = source->mask == -1 ? default_log_source->mask : source->mask;
-    return level & mask;
+    return source && (level & sys_atomic_get(&source->enabled));
+}
+
+static void log_writer_wake(void)
+{
+    if (sys_atomic_get(&log_writer_sleeping)) {
+        sys_mutex_lock(log_writer_lock);
+        sys_cond_signal(log_writer_cond);
+        sys_mutex_unlock(log_writer_lock);
+    }
+}
+
+static void log_queue_push(qd_log_entry_t *entry)
+{
+    void *head;
+    do {
+        head = sys_atomic_ptr_get(&log_queue);
+        entry->next_queued = (qd_log_entry_t*) head;
+    } while (!sys_atomic_ptr_cas(&log_queue, head, entry));
+    log_writer_wake();
+}
+
+/// Take all queued entries in the order they were pushed.
+static qd_log_entry_t *log_queue_take(void)
+{
+    qd_log_entry_t *entry = (qd_log_entry_t*) sys_atomic_ptr_swap(&log_queue, 0);
+    qd_log_entry_t *batch = 0;
+    while (entry) {
+        qd_log_entry_t *next = entry->next_queued;
+        entry->next_queued = batch;
+        batch = entry;
+        entry = next;
+    }
+    return batch;
+}
+
+static void log_write_batch(qd_log_entry_t *batch)
+{
+    uint32_t count = 0;
+
+    sys_mutex_lock(log_source_lock);
+    uint32_t dropped = sys_atomic_swap(&log_dropped, 0);
+    if (dropped) {
+        qd_log_entry_t report;
+        ZERO(&report);
+        report.module = default_log_source->module;
+        report.level  = QD_LOG_WARNING;
+        gettimeofday(&report.time, NULL);
+        snprintf(report.text, TEXT_MAX, "%"PRIu32" log entries dropped, log writer queue full", dropped);
+        write_log(default_log_source, &report);
+    }
+    for (qd_log_entry_t *entry = batch; entry; entry = entry->next_queued, ++count)
+        write_log(entry->source, entry);
+    for (log_sink_t *sink = DEQ_HEAD(sink_list); sink; sink = DEQ_NEXT(sink))
+        if (sink->file)
+            fflush(sink->file);
+    sys_mutex_unlock(log_source_lock);
+
+    sys_mutex_lock(log_lock);
+    while (batch) {
+        qd_log_entry_t *next = batch->next_queued;
+        batch->next_queued = 0;
+        qd_log_entry_keep_lh(batch);
+        batch = next;
+    }
+    sys_mutex_unlock(log_lock);
+
+    if (sys_atomic_sub(&log_queued, count) == count) {
+        sys_mutex_lock(log_writer_lock);
+        sys_cond_signal_all(log_drained_cond);
+        sys_mutex_unlock(log_writer_lock);
+    }
+}
+
+static void *log_writer_run(void *unused)
+{
+    qd_profile_thread("log");
+    while (true) {
+        qd_log_entry_t *batch = log_queue_take();
+        if (batch) {
+            log_write_batch(batch);
+            continue;
+        }
+
+        sys_mutex_lock(log_writer_lock);
+        sys_atomic_swap(&log_writer_sleeping, 1);
+        while (!sys_atomic_ptr_get(&log_queue) && !log_writer_stop)
+            sys_cond_wait(log_writer_cond, log_writer_lock);
+        sys_atomic_swap(&log_writer_sleeping, 0);
+        bool stop = log_writer_stop && !sys_atomic_ptr_get(&log_queue);
+        sys_mutex_unlock(log_writer_lock);
+        if (stop)
+            break;
+    }
+    return 0;
+}
+
+void qd_log_flush(void)
+{
+    sys_atomic_inc(&log_pushers);
+    if (log_writer && sys_thread_self() != log_writer_id) {
+        sys_mutex_lock(log_writer_lock);
+        while (sys_atomic_get(&log_queued) > 0) {
+            sys_cond_signal(log_writer_cond);
+            sys_cond_wait(log_drained_cond, log_writer_lock);
+        }
+        sys_mutex_unlock(log_writer_lock);
+    }
+    sys_atomic_dec(&log_pushers);
+}
+
+static void log_flush_at_exit(void)
+{
+    qd_log_flush();
 }
 
 void qd_vlog_impl(qd_log_source_t *source, qd_log_level_t level, const char *file, int line, const char *fmt, va_list ap)
@@ -404,21 +864,56 @@ void qd_vlog_impl(qd_log_source_t *source, qd_log_level_t level, const char *fil
 
     if (!qd_log_enabled(source, level)) return;
 
+    if (level & sys_atomic_get(&source->ring_enabled)) {
+        va_list ring_ap;
+        va_copy(ring_ap, ap);
+        ring_capture(source, level, file, line, fmt, ring_ap);
+        va_end(ring_ap);
+    }
+    if (!(level & sys_atomic_get(&source->sink_enabled))) return;
+
+    // The increment is a full barrier, so either qd_log_finalize sees this
+    // logger in log_pushers or this logger sees the writer unpublished.
+    sys_atomic_inc(&log_pushers);
+    bool queued = log_writer != 0;
+    if (queued && sys_atomic_inc(&log_queued) >= QUEUE_MAX) {
+        sys_atomic_dec(&log_queued);
+        sys_atomic_inc(&log_dropped);
+        sys_atomic_inc(&source->dropped);
+        sys_atomic_dec(&log_pushers);
+        return;
+    }
+    if (!queued)
+        sys_atomic_dec(&log_pushers);
+
     qd_log_entry_t *entry = new_qd_log_entry_t();
     DEQ_ITEM_INIT(entry);
+    entry->next_queued = 0;
+    entry->source = source;
     entry->module = source->module;
     entry->level  = level;
     entry->file   = file ? strdup(file) : 0;
     entry->line   = line;
     gettimeofday(&entry->time, NULL);
     vsnprintf(entry->text, TEXT_MAX, fmt, ap);
+
+    if (queued) {
+        log_queue_push(entry);
+        // Don't let a critical entry be lost if the process is about to die.
+        if (level == QD_LOG_CRITICAL)
+            qd_log_flush();
+        sys_atomic_dec(&log_pushers);
+        return;
+    }
+
     write_log(source, entry);
+    log_sink_t* sink = source->sink ? source->sink : default_log_source->sink;
+    if (sink && sink->file)
+        fflush(sink->file);
 
     // Bounded buffer of log entries, keep most recent.
     sys_mutex_lock(log_lock);
-    DEQ_INSERT_TAIL(entries, entry);
-    if (DEQ_SIZE(entries) > LIST_MAX)
-        qd_log_entry_free_lh(DEQ_HEAD(entries));
+    qd_log_entry_keep_lh(entry);
     sys_mutex_unlock(log_lock);
 }
 
@@ -435,14 +930,19 @@ static PyObject *inc_none() { Py_INCREF(Py_None); return Py_None; }
 /// Return the log buffer up to limit as a python list. Called by management agent.
 PyObject *qd_log_recent_py(long limit) {
     if (PyErr_Occurred()) return NULL;
+    qd_log_flush();             /* Include entries still queued for the writer */
     PyObject *list = PyList_New(0);
     PyObject *py_entry = NULL;
     if (!list) goto error;
+    sys_mutex_lock(log_lock);
     qd_log_entry_t *entry = DEQ_TAIL(entries);
     while (entry && limit) {
         const int ENTRY_SIZE=6;
         py_entry = PyList_New(ENTRY_SIZE);
-        if (!py_entry) goto error;
+        if (!py_entry) {
+            sys_mutex_unlock(log_lock);
+            goto error;
+        }
         int i = 0;
         // NOTE: PyList_SetItem steals a reference so no leak here.
         PyList_SetItem(py_entry, i++, PyString_FromString(entry->module));
@@ -453,12 +953,16 @@ PyObject *qd_log_recent_py(long limit) {
         PyList_SetItem(py_entry, i++, entry->file ? PyLong_FromLong(entry->line) : inc_none());
         PyList_SetItem(py_entry, i++, PyLong_FromLongLong((PY_LONG_LONG)entry->time.tv_sec));
         assert(i == ENTRY_SIZE);
-        if (PyErr_Occurred()) goto error;
+        if (PyErr_Occurred()) {
+            sys_mutex_unlock(log_lock);
+            goto error;
+        }
         PyList_Insert(list, 0, py_entry);
         Py_DECREF(py_entry);
         if (limit > 0) --limit;
         entry = DEQ_PREV(entry);
     }
+    sys_mutex_unlock(log_lock);
     return list;
  error:
     Py_XDECREF(list);
@@ -466,6 +970,75 @@ PyObject *qd_log_recent_py(long limit) {
     return NULL;
 }
 
+typedef struct ring_dump_t {
+    struct timeval  time;
+    PyObject       *py_entry;
+} ring_dump_t;
+
+static int ring_dump_cmp(const void *a, const void *b) {
+    const struct timeval *ta = &((const ring_dump_t*) a)->time;
+    const struct timeval *tb = &((const ring_dump_t*) b)->time;
+    if (ta->tv_sec != tb->tv_sec) return ta->tv_sec < tb->tv_sec ? -1 : 1;
+    if (ta->tv_usec != tb->tv_usec) return ta->tv_usec < tb->tv_usec ? -1 : 1;
+    return 0;
+}
+
+/// Format the raw ring entries of module, or of every module if module is 0,
+/// as a python list of the most recent limit entries in the form returned by
+/// qd_log_recent_py.  Called by management agent.
+PyObject *qd_log_ring_py(const char *module, long limit) {
+    if (PyErr_Occurred()) return NULL;
+    PyObject *list = NULL;
+    size_t count = 0, max = 0;
+    ring_dump_t *dump = 0;
+    char *text = malloc(TEXT_MAX);
+
+    sys_mutex_lock(log_source_lock);
+    for (qd_log_source_t *src = DEQ_HEAD(source_list); src; src = DEQ_NEXT(src))
+        if (!module || strcasecmp(module, src->module) == 0)
+            max += src->ring.size;
+    dump = max ? (ring_dump_t*) calloc(max, sizeof(ring_dump_t)) : 0;
+    for (qd_log_source_t *src = DEQ_HEAD(source_list); src && (dump || !max); src = DEQ_NEXT(src)) {
+        if (module && strcasecmp(module, src->module) != 0)
+            continue;
+        log_ring_t *ring = &src->ring;
+        sys_mutex_lock(ring->lock);
+        for (size_t i = 0; i < ring->count && count < max; ++i) {
+            const log_ring_entry_t *entry = &ring->entries[(ring->next + ring->size - ring->count + i) % ring->size];
+            ring_format(entry, text, TEXT_MAX);
+            const level_t *level = level_for_bit(entry->level);
+            PyObject *py_entry = Py_BuildValue("[sNsNNL]", src->module,
+                                               level ? PyString_FromString(level->name) : inc_none(),
+                                               text,
+                                               entry->file >= 0 ? PyString_FromString(entry->strings + entry->file) : inc_none(),
+                                               entry->file >= 0 ? PyLong_FromLong(entry->line) : inc_none(),
+                                               (PY_LONG_LONG) entry->time.tv_sec);
+            if (!py_entry)
+                break;
+            dump[count].time = entry->time;
+            dump[count++].py_entry = py_entry;
+        }
+        sys_mutex_unlock(ring->lock);
+    }
+    sys_mutex_unlock(log_source_lock);
+    free(text);
+
+    if (!PyErr_Occurred()) {
+        if (count)
+            qsort(dump, count, sizeof(ring_dump_t), ring_dump_cmp);
+        size_t first = (limit >= 0 && (size_t) limit < count) ? count - limit : 0;
+        list = PyList_New(count - first);
+        for (size_t i = first; list && i < count; ++i) {
+            PyList_SetItem(list, i - first, dump[i].py_entry); /* Steals the reference */
+            dump[i].py_entry = NULL;
+        }
+    }
+    for (size_t i = 0; i < count; ++i)
+        Py_XDECREF(dump[i].py_entry);
+    free(dump);
+    return list;
+}
+
 void qd_log_initialize(void)
 {
     DEQ_INIT(entries);
@@ -482,14 +1055,68 @@ void qd_log_initialize(void)
     log_source_lock = sys_mutex();
 
     default_log_source = qd_log_source(SOURCE_DEFAULT);
+    sys_mutex_lock(log_source_lock);
     default_log_source->mask = levels[INFO].mask;
+    update_enabled_lh();
+    sys_mutex_unlock(log_source_lock);
     default_log_source->timestamp = true;
     default_log_source->source = 0;
     default_log_source->sink = log_sink_lh(SINK_STDERR);
+
+    log_writer_lock = sys_mutex();
+    log_writer_cond = sys_cond();
+    log_drained_cond = sys_cond();
+    sys_atomic_init(&log_writer_sleeping, 0);
+    sys_atomic_ptr_init(&log_queue, 0);
+    sys_atomic_init(&log_queued, 0);
+    sys_atomic_init(&log_dropped, 0);
+    sys_atomic_init(&log_pushers, 0);
+    log_writer_stop = false;
+    log_writer = sys_thread(log_writer_run, 0);
+    log_writer_id = sys_thread_id(log_writer);
+
+    static bool at_exit_registered = false;
+    if (!at_exit_registered) {
+        atexit(log_flush_at_exit);
+        at_exit_registered = true;
+    }
 }
 
 
 void qd_log_finalize(void) {
+    if (log_writer) {
+        //
+        // Unpublish the writer so new entries are written synchronously, then
+        // wait out the loggers that saw it.  The writer is still running so any
+        // of them waiting in qd_log_flush is released.
+        //
+        sys_thread_t *writer = log_writer;
+        log_writer = 0;
+        while (sys_atomic_add(&log_pushers, 0) != 0)
+            sched_yield();
+
+        sys_mutex_lock(log_writer_lock);
+        log_writer_stop = true;
+        sys_cond_signal(log_writer_cond);
+        sys_mutex_unlock(log_writer_lock);
+        sys_thread_join(writer);
+        sys_thread_free(writer);
+
+        // Nothing can be queued now, write whatever the writer left behind.
+        qd_log_entry_t *batch = log_queue_take();
+        if (batch)
+            log_write_batch(batch);
+
+        sys_atomic_destroy(&log_pushers);
+        sys_atomic_destroy(&log_dropped);
+        sys_atomic_destroy(&log_queued);
+        sys_atomic_ptr_destroy(&log_queue);
+        sys_atomic_destroy(&log_writer_sleeping);
+        sys_cond_free(log_drained_cond);
+        sys_cond_free(log_writer_cond);
+        sys_mutex_free(log_writer_lock);
+    }
+
     while (DEQ_HEAD(source_list))
         qd_log_source_free_lh(DEQ_HEAD(source_list));
     while (DEQ_HEAD(entries))
@@ -508,6 +1135,7 @@ qd_error_t qd_log_entity(qd_entity_t *entity) {
     char* module = 0;
     char *output = 0;
     char *enable = 0;
+    char *ring_enable = 0;
 
     do {
 
@@ -536,9 +1164,28 @@ qd_error_t qd_log_entity(qd_entity_t *entity) {
             enable = qd_entity_get_string(entity, "enable");
             QD_ERROR_BREAK();
             src->mask = enable_mask(enable);
+            update_enabled_lh();
         }
         QD_ERROR_BREAK();
 
+        if (qd_entity_has(entity, "ringEnable")) {
+            ring_enable = qd_entity_get_string(entity, "ringEnable");
+            QD_ERROR_BREAK();
+            src->ring_mask = enable_mask(ring_enable);
+            QD_ERROR_BREAK();
+        }
+
+        if (qd_entity_has(entity, "ringSize")) {
+            long ring_size = qd_entity_get_long(entity, "ringSize");
+            QD_ERROR_BREAK();
+            if (ring_size < 0) {
+                qd_error(QD_ERROR_CONFIG, "ringSize must not be negative");
+                break;
+            }
+            src->ring_size = ring_size;
+        }
+        update_enabled_lh();
+
         if (qd_entity_has(entity, "timestamp"))
             src->timestamp = qd_entity_get_bool(entity, "timestamp");
         QD_ERROR_BREAK();
@@ -555,6 +1202,8 @@ qd_error_t qd_log_entity(qd_entity_t *entity) {
         free(output);
     if (enable)
         free(enable);
+    if (ring_enable)
+        free(ring_enable);
 
     sys_mutex_unlock(log_source_lock);
 
@@ -575,6 +1224,7 @@ qd_error_t qd_entity_refresh_logStats(qd_entity_t* entity, void *impl)
     qd_entity_set_long(entity,   "warningCount",  log->severity_histogram[LEVEL_INDEX(WARNING)]);
     qd_entity_set_long(entity,   "errorCount",    log->severity_histogram[LEVEL_INDEX(ERROR)]);
     qd_entity_set_long(entity,   "criticalCount", log->severity_histogram[LEVEL_INDEX(CRITICAL)]);
+    qd_entity_set_long(entity,   "droppedCount",  sys_atomic_get(&log->dropped));
     qd_entity_set_string(entity, "name",          log->module);
     qd_entity_set_string(entity, "identity",      identity_str);
 
@@ -24,5 +24,8 @@
 void qd_log_initialize(void);
 void qd_log_finalize(void);
 
+/** Wait until every queued log entry has been written and flushed. */
+void qd_log_flush(void);
+
 #define QD_LOG_TEXT_MAX 2048
 #endif
@@ -23,16 +23,21 @@
 #include <qpid/dispatch/threading.h>
 #include <qpid/dispatch/iterator.h>
 #include <qpid/dispatch/log.h>
+#include <qpid/dispatch/router_core.h>
 #include <proton/object.h>
 #include "message_private.h"
 #include "compose_private.h"
 #include "aprintf.h"
+#include "probes.h"
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <limits.h>
 #include <time.h>
 #include <inttypes.h>
+#if USE_ZLIB
+#include <zlib.h>
+#endif
 
 const char *STR_AMQP_NULL = "null";
 const char *STR_AMQP_TRUE = "T";
@@ -66,7 +71,11 @@ static const unsigned char * const TAGS_ANY                     = (unsigned char
 PN_HANDLE(PN_DELIVERY_CTX)
 
 ALLOC_DEFINE_CONFIG(qd_message_t, sizeof(qd_message_pvt_t), 0, 0);
-ALLOC_DEFINE(qd_message_content_t);
+static qd_alloc_config_t content_config = {16, 32, 0, 1024 * 1024, false};
+static size_t            content_inline_size = sizeof(qd_buffer_t) + QD_MESSAGE_INLINE_CAPACITY;
+ALLOC_DEFINE_CONFIG(qd_message_content_t, sizeof(qd_message_content_t), &content_inline_size, &content_config);
+ALLOC_DECLARE(qd_message_properties_t);
+ALLOC_DEFINE(qd_message_properties_t);
 
 typedef void (*buffer_process_t) (void *context, const unsigned char *base, int length);
 
@@ -88,6 +97,52 @@ void qd_message_initialize() {
 
 int qd_message_repr_len() { return qd_log_max_len(); }
 
+//
+// Content starts out owned by a single message and has no lock.  The lock is created by the
+// first qd_message_copy, which is made by the owning thread before the copy is handed to any
+// other, so a content that can be reached from more than one thread always has its lock.
+//
+static inline void content_lock(qd_message_content_t *content)
+{
+    if (content->lock)
+        sys_mutex_lock(content->lock);
+}
+
+static inline void content_unlock(qd_message_content_t *content)
+{
+    if (content->lock)
+        sys_mutex_unlock(content->lock);
+}
+
+//
+// Free a buffer from the content's chain, leaving the content's inline buffer alone.
+//
+static inline void content_free_buffer(qd_message_content_t *content, qd_buffer_t *buf)
+{
+    if (buf != MSG_INLINE_BUFFER(content))
+        qd_buffer_free(buf);
+}
+
+//
+// Read a spilled body tail back onto the end of the buffer chain.
+//
+static void content_unspill_LH(qd_message_content_t *content)
+{
+    if (content->spill.length == 0)
+        return;
+    qd_spill_load(&content->spill, &content->buffers);
+    qd_spill_release(&content->spill);
+}
+
+static void content_unspill(qd_message_content_t *content)
+{
+    if (!qd_spill_enabled())
+        return;
+    content_lock(content);
+    content_unspill_LH(content);
+    content_unlock(content);
+}
+
 /**
  * Quote non-printable characters suitable for log messages. Output in buffer.
  */
@@ -420,11 +475,80 @@ static unsigned char next_octet(unsigned char **cursor, qd_buffer_t **buffer)
 }
 
 
+//
+// Octets needed after an encoded value's tag to hold the largest size field (four octets).
+//
+#define QD_MAX_SIZE_OCTETS 4
+
+//
+// Return the number of octets in the remainder of the buffer at the cursor.
+//
+static inline size_t contiguous_octets(const unsigned char *cursor, qd_buffer_t *buffer)
+{
+    return qd_buffer_size(buffer) - (cursor - qd_buffer_base(buffer));
+}
+
+//
+// Decode the size of an AMQP value from the octets following its type tag.  All
+// of these octets must be in 'p'.  Return the number of octets in the
+// value after its size field, and set *size_octets to the width of the size
+// field.  This is the bulk equivalent of the next_octet sequences below.  It
+// is used when the encoding doesn't straddle a buffer seam.
+//
+static inline int value_size(unsigned char tag, const unsigned char *p, int *size_octets)
+{
+    switch (tag & 0xF0) {
+    case 0x50: *size_octets = 0; return 1;
+    case 0x60: *size_octets = 0; return 2;
+    case 0x70: *size_octets = 0; return 4;
+    case 0x80: *size_octets = 0; return 8;
+    case 0x90: *size_octets = 0; return 16;
+
+    case 0xB0:
+    case 0xD0:
+    case 0xF0:
+        *size_octets = 4;
+        return (int) (((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3]);
+
+    case 0xA0:
+    case 0xC0:
+    case 0xE0:
+        *size_octets = 1;
+        return (int) p[0];
+
+    default:
+        *size_octets = 0;
+        return 0;
+    }
+}
+
+
 static int traverse_field(unsigned char **cursor, qd_buffer_t **buffer, qd_field_location_t *field)
 {
     qd_buffer_t   *start_buffer = *buffer;
     unsigned char *start_cursor = *cursor;
 
+    //
+    // Fast path: the tag and its size field are all in this buffer.
+    //
+    if (start_cursor && contiguous_octets(start_cursor, start_buffer) > QD_MAX_SIZE_OCTETS) {
+        int size_octets;
+        unsigned char tag     = *start_cursor;
+        int           consume = value_size(tag, start_cursor + 1, &size_octets);
+
+        if (field && !field->parsed) {
+            field->buffer     = start_buffer;
+            field->offset     = start_cursor - qd_buffer_base(start_buffer);
+            field->length     = consume;
+            field->hdr_length = 1 + size_octets;
+            field->parsed     = true;
+            field->tag        = tag;
+        }
+
+        advance(cursor, buffer, 1 + size_octets + consume, 0, 0);
+        return 1;
+    }
+
     unsigned char tag = next_octet(cursor, buffer);
     if (!(*cursor)) return 0;
 
@@ -559,6 +683,37 @@ static int qd_check_and_advance(qd_buffer_t         **buffer,
     unsigned char *end_of_buffer = qd_buffer_base(test_buffer) + qd_buffer_size(test_buffer);
     int idx = 0;
 
+    //
+    // Fast path: the descriptor, the section's tag and its size field are all in this buffer,
+    // so compare the descriptor in one go and decode the size in place.  The octet-at-a-time
+    // code below is only needed where the encoding straddles a buffer seam.
+    //
+    if (end_of_buffer - test_cursor > pattern_length + QD_MAX_SIZE_OCTETS) {
+        if (memcmp(test_cursor, pattern, pattern_length) != 0)
+            return 1; // Pattern didn't match
+
+        unsigned char tag = test_cursor[pattern_length];
+        while (*expected_tags && tag != *expected_tags)
+            expected_tags++;
+        if (*expected_tags == 0)
+            return 0;  // Unexpected tag
+
+        if (location->parsed)
+            return 0;  // Duplicate section
+
+        int size_octets;
+        int consume = value_size(tag, test_cursor + pattern_length + 1, &size_octets);
+
+        location->parsed     = 1;
+        location->buffer     = *buffer;
+        location->offset     = *cursor - qd_buffer_base(*buffer);
+        location->length     = 1 + size_octets + consume;
+        location->hdr_length = pattern_length;
+
+        advance(cursor, buffer, pattern_length + location->length, 0, 0);
+        return 1;
+    }
+
     while (idx < pattern_length && *test_cursor == pattern[idx]) {
         idx++;
         test_cursor++;
@@ -691,24 +846,7 @@ static qd_message_field_t qd_field_section(qd_message_field_t field)
 // else 0).
 static qd_field_location_t *qd_message_properties_field(qd_message_t *msg, qd_message_field_t field)
 {
-    static const intptr_t offsets[] = {
-        // position of the field's qd_field_location_t in the message content
-        // object
-        (intptr_t) &((qd_message_content_t *)0)->field_message_id,
-        (intptr_t) &((qd_message_content_t *)0)->field_user_id,
-        (intptr_t) &((qd_message_content_t *)0)->field_to,
-        (intptr_t) &((qd_message_content_t *)0)->field_subject,
-        (intptr_t) &((qd_message_content_t *)0)->field_reply_to,
-        (intptr_t) &((qd_message_content_t *)0)->field_correlation_id,
-        (intptr_t) &((qd_message_content_t *)0)->field_content_type,
-        (intptr_t) &((qd_message_content_t *)0)->field_content_encoding,
-        (intptr_t) &((qd_message_content_t *)0)->field_absolute_expiry_time,
-        (intptr_t) &((qd_message_content_t *)0)->field_creation_time,
-        (intptr_t) &((qd_message_content_t *)0)->field_group_id,
-        (intptr_t) &((qd_message_content_t *)0)->field_group_sequence,
-        (intptr_t) &((qd_message_content_t *)0)->field_reply_to_group_id
-    };
-    // update table above if new fields need to be accessed:
+    // update QD_MESSAGE_PROPERTY_FIELDS if new fields need to be accessed:
     assert(QD_FIELD_MESSAGE_ID <= field && field <= QD_FIELD_REPLY_TO_GROUP_ID);
 
     qd_message_content_t *content = MSG_CONTENT(msg);
@@ -719,8 +857,21 @@ static qd_field_location_t *qd_message_properties_field(qd_message_t *msg, qd_me
     if (field == QD_FIELD_PROPERTIES)
         return &content->section_message_properties;
 
+    if (!content->properties) {
+        qd_message_properties_t *properties = new_qd_message_properties_t();
+        ZERO(properties);
+        content_lock(content);
+        if (!content->properties) {
+            content->properties = properties;
+            properties = 0;
+        }
+        content_unlock(content);
+        if (properties)
+            free_qd_message_properties_t(properties);
+    }
+
     const int index = field - QD_FIELD_MESSAGE_ID;
-    qd_field_location_t *const location = (qd_field_location_t *)((char *)content + offsets[index]);
+    qd_field_location_t *const location = &content->properties->field[index];
     if (location->parsed)
         return location;
 
@@ -732,7 +883,7 @@ static qd_field_location_t *qd_message_properties_field(qd_message_t *msg, qd_me
 
     int position = 0;
     while (position < index) {
-        qd_field_location_t *f = (qd_field_location_t *)((char *)content + offsets[position]);
+        qd_field_location_t *f = &content->properties->field[position];
         if (f->parsed)
             advance(&cursor, &buffer, f->hdr_length + f->length, 0, 0);
         else // parse it out
@@ -762,7 +913,7 @@ static qd_field_location_t *qd_message_header_field(qd_message_t *msg, qd_messag
 
     switch (field) {
     case QD_FIELD_HEADER:
-        return &content->section_message_properties;
+        return &content->section_message_header;
     default:
         // TBD: add header fields as needed (see qd_message_properties_field()
         // as an example)
@@ -808,11 +959,14 @@ static qd_field_location_t *qd_message_field_location(qd_message_t *msg, qd_mess
 
     case QD_FIELD_BODY:
         if (content->section_body.parsed ||
-            (qd_message_check(msg, QD_DEPTH_BODY) && content->section_body.parsed))
+            (qd_message_check(msg, QD_DEPTH_BODY) && content->section_body.parsed)) {
+            content_unspill(content);
             return &content->section_body;
+        }
         break;
 
     case QD_FIELD_FOOTER:
+        content_unspill(content);
         if (content->section_footer.parsed ||
             (qd_message_check(msg, QD_DEPTH_ALL) && content->section_footer.parsed))
             return &content->section_footer;
@@ -838,6 +992,11 @@ qd_message_t *qd_message()
     DEQ_INIT(msg->ma_trace);
     DEQ_INIT(msg->ma_ingress);
     msg->ma_phase = 0;
+    msg->ma_epoch = 0;
+    msg->send_buffer   = 0;
+    msg->send_offset   = 0;
+    msg->send_started  = false;
+    msg->send_complete = false;
     msg->content = new_qd_message_content_t();
 
     if (msg->content == 0) {
@@ -846,10 +1005,17 @@ qd_message_t *qd_message()
     }
 
     ZERO(msg->content);
-    msg->content->lock = sys_mutex();
+    msg->content->lock = 0;
+
+    qd_buffer_t *inline_buf = MSG_INLINE_BUFFER(msg->content);
+    DEQ_ITEM_INIT(inline_buf);
+    inline_buf->size     = 0;
+    inline_buf->capacity = QD_MESSAGE_INLINE_CAPACITY;
+    sys_atomic_init(&inline_buf->refs, 0);
     sys_atomic_init(&msg->content->ref_count, 1);
     msg->content->parse_depth = QD_DEPTH_NONE;
     msg->content->parsed_message_annotations = 0;
+    msg->content->receive_complete = true;
 
     return (qd_message_t*) msg;
 }
@@ -867,20 +1033,38 @@ void qd_message_free(qd_message_t *in_msg)
 
     qd_message_content_t *content = msg->content;
 
+    if (qd_spill_enabled() && msg->send_started && !msg->send_complete) {
+        content_lock(content);
+        content->senders--;
+        content_unlock(content);
+    }
+
     rc = sys_atomic_dec(&content->ref_count) - 1;
 
     if (rc == 0) {
         if (content->parsed_message_annotations)
             qd_parse_free(content->parsed_message_annotations);
 
+        if (content->properties)
+            free_qd_message_properties_t(content->properties);
+
+        free(content->path_span);
+        qd_spill_release(&content->spill);
+
+        qd_buffer_list_free_buffers(&content->composed_ma[0]);
+        qd_buffer_list_free_buffers(&content->composed_ma[1]);
+        qd_buffer_list_free_buffers(&content->compressed);
+
         qd_buffer_t *buf = DEQ_HEAD(content->buffers);
         while (buf) {
             DEQ_REMOVE_HEAD(content->buffers);
-            qd_buffer_free(buf);
+            content_free_buffer(content, buf);
             buf = DEQ_HEAD(content->buffers);
         }
 
-        sys_mutex_free(content->lock);
+        if (content->lock)
+            sys_mutex_free(content->lock);
+        sys_atomic_destroy(&MSG_INLINE_BUFFER(content)->refs);
         free_qd_message_content_t(content);
     }
 
@@ -902,9 +1086,17 @@ qd_message_t *qd_message_copy(qd_message_t *in_msg)
     qd_buffer_list_clone(&copy->ma_trace, &msg->ma_trace);
     qd_buffer_list_clone(&copy->ma_ingress, &msg->ma_ingress);
     copy->ma_phase = msg->ma_phase;
+    copy->ma_epoch = msg->ma_epoch;
+    copy->send_buffer   = 0;
+    copy->send_offset   = 0;
+    copy->send_started  = false;
+    copy->send_complete = false;
 
     copy->content = content;
 
+    if (!content->lock)
+        content->lock = sys_mutex();
+
     qd_message_message_annotations((qd_message_t*) copy);
 
     sys_atomic_inc(&content->ref_count);
@@ -924,7 +1116,7 @@ qd_parsed_field_t *qd_message_message_annotations(qd_message_t *in_msg)
     if (ma == 0)
         return 0;
 
-    content->parsed_message_annotations = qd_parse(ma);
+    content->parsed_message_annotations = qd_parse_arena(ma);
     if (content->parsed_message_annotations == 0 ||
         !qd_parse_ok(content->parsed_message_annotations) ||
         !qd_parse_is_map(content->parsed_message_annotations)) {
@@ -939,25 +1131,56 @@ qd_parsed_field_t *qd_message_message_annotations(qd_message_t *in_msg)
 }
 
 
+//
+// Give the message a fresh annotation epoch after its annotation inputs change so it
+// no longer matches outgoing annotations composed for its copies.
+//
+static void ma_changed(qd_message_pvt_t *msg)
+{
+    qd_message_content_t *content = msg->content;
+    content_lock(content);
+    msg->ma_epoch = ++content->ma_epoch_next;
+    content_unlock(content);
+}
+
 void qd_message_set_trace_annotation(qd_message_t *in_msg, qd_composed_field_t *trace_field)
 {
     qd_message_pvt_t *msg = (qd_message_pvt_t*) in_msg;
+    ma_changed(msg);
     qd_buffer_list_free_buffers(&msg->ma_trace);
     qd_compose_take_buffers(trace_field, &msg->ma_trace);
     qd_compose_free(trace_field);
 }
 
+void qd_message_set_trace_annotation_encoded(qd_message_t *in_msg, const qd_buffer_list_t *encoded)
+{
+    qd_message_pvt_t *msg = (qd_message_pvt_t*) in_msg;
+    ma_changed(msg);
+    qd_buffer_list_free_buffers(&msg->ma_trace);
+    qd_buffer_list_clone(&msg->ma_trace, encoded);
+}
+
 void qd_message_set_to_override_annotation(qd_message_t *in_msg, qd_composed_field_t *to_field)
 {
     qd_message_pvt_t *msg = (qd_message_pvt_t*) in_msg;
+    ma_changed(msg);
     qd_buffer_list_free_buffers(&msg->ma_to_override);
     qd_compose_take_buffers(to_field, &msg->ma_to_override);
     qd_compose_free(to_field);
 }
 
+void qd_message_set_to_override_annotation_encoded(qd_message_t *in_msg, const qd_buffer_list_t *encoded)
+{
+    qd_message_pvt_t *msg = (qd_message_pvt_t*) in_msg;
+    ma_changed(msg);
+    qd_buffer_list_free_buffers(&msg->ma_to_override);
+    qd_buffer_list_clone(&msg->ma_to_override, encoded);
+}
+
 void qd_message_set_phase_annotation(qd_message_t *in_msg, int phase)
 {
     qd_message_pvt_t *msg = (qd_message_pvt_t*) in_msg;
+    ma_changed(msg);
     msg->ma_phase = phase;
 }
 
@@ -970,11 +1193,36 @@ int qd_message_get_phase_annotation(const qd_message_t *in_msg)
 void qd_message_set_ingress_annotation(qd_message_t *in_msg, qd_composed_field_t *ingress_field)
 {
     qd_message_pvt_t *msg = (qd_message_pvt_t*) in_msg;
+    ma_changed(msg);
     qd_buffer_list_free_buffers(&msg->ma_ingress);
     qd_compose_take_buffers(ingress_field, &msg->ma_ingress);
     qd_compose_free(ingress_field);
 }
 
+void qd_message_set_ingress_annotation_encoded(qd_message_t *in_msg, const qd_buffer_list_t *encoded)
+{
+    qd_message_pvt_t *msg = (qd_message_pvt_t*) in_msg;
+    ma_changed(msg);
+    qd_buffer_list_free_buffers(&msg->ma_ingress);
+    qd_buffer_list_clone(&msg->ma_ingress, encoded);
+}
+
+/**
+ * No more content will arrive for the message on this delivery.  Detach it from the delivery
+ * and mark it complete but aborted.
+ */
+static void message_receive_aborted(pn_record_t *record, qd_message_pvt_t *msg)
+{
+    qd_message_content_t *content = msg->content;
+
+    pn_record_set(record, PN_DELIVERY_CTX, 0);
+    content_lock(content);
+    content->aborted          = true;
+    content->receive_complete = true;
+    content_unlock(content);
+}
+
+
 qd_message_t *qd_message_receive(pn_delivery_t *delivery)
 {
     pn_link_t        *link = pn_delivery_link(delivery);
@@ -991,24 +1239,66 @@ qd_message_t *qd_message_receive(pn_delivery_t *delivery)
     //
     if (!msg) {
         msg = (qd_message_pvt_t*) qd_message();
+        msg->content->receive_complete = false;
+        if (qd_path_trace_enabled())
+            msg->content->receive_start_ns = qd_path_trace_now();
         pn_record_def(record, PN_DELIVERY_CTX, PN_WEAKREF);
         pn_record_set(record, PN_DELIVERY_CTX, (void*) msg);
     }
 
+    //
+    // The sender gave up on the delivery.  The message is returned as complete but aborted
+    // so that any copies being cut through to their destinations are aborted too.
+    //
+    if (pn_delivery_aborted(delivery)) {
+        message_receive_aborted(record, msg);
+        return (qd_message_t*) msg;
+    }
+
     //
     // Get a reference to the tail buffer on the message.  This is the buffer into which
-    // we will store incoming message data.  If there is no buffer in the message, allocate
-    // an empty one and add it to the message.
+    // we will store incoming message data.  If there is no buffer in the message, use the
+    // content's inline buffer if what has arrived fits in it, or else allocate an empty
+    // buffer, and add it to the message.
+    //
+    // The buffer chain is extended under the content lock because copies of a partially
+    // received message may be sending from the same chain on other threads.
     //
-    buf = DEQ_TAIL(msg->content->buffers);
+    qd_message_content_t *content = msg->content;
+    buf = DEQ_TAIL(content->buffers);
     if (!buf) {
-        buf = qd_buffer();
-        DEQ_INSERT_TAIL(msg->content->buffers, buf);
+        size_t pending = pn_delivery_pending(delivery);
+        if (pending <= QD_MESSAGE_INLINE_CAPACITY)
+            buf = MSG_INLINE_BUFFER(content);
+        else
+            buf = qd_buffer_sized(pending);
+        content_lock(content);
+        DEQ_INSERT_TAIL(content->buffers, buf);
+        content_unlock(content);
     }
 
     while (1) {
+        //
+        // If the tail buffer is full and more data has arrived, append a buffer whose
+        // size class is chosen from what is pending on the delivery so large messages
+        // build short chains.  A buffer is only added once there is data to put in it:
+        // sized buffers are often filled exactly by the last of a message, and a full
+        // tail lets pn_link_recv report the end of the message without an empty buffer
+        // being allocated and freed.
+        //
+        if (qd_buffer_capacity(buf) == 0) {
+            size_t pending = pn_delivery_pending(delivery);
+            if (pending > 0) {
+                buf = qd_buffer_sized(pending);
+                content_lock(content);
+                DEQ_INSERT_TAIL(content->buffers, buf);
+                content_unlock(content);
+            }
+        }
+
         //
         // Try to receive enough data to fill the remaining space in the tail buffer.
+        // The data is copied from the delivery straight into the message's buffer.
         //
         rc = pn_link_recv(link, (char*) qd_buffer_cursor(buf), qd_buffer_capacity(buf));
 
@@ -1023,15 +1313,23 @@ qd_message_t *qd_message_receive(pn_delivery_t *delivery)
 
             //
             // If the last buffer in the list is empty, remove it and free it.  This
-            // will only happen if the size of the message content is an exact multiple
-            // of the buffer size.
+            // will only happen for a message with no content at all.
             //
 
+            content_lock(content);
             if (qd_buffer_size(buf) == 0) {
-                DEQ_REMOVE_TAIL(msg->content->buffers);
-                qd_buffer_free(buf);
+                DEQ_REMOVE_TAIL(content->buffers);
+                content_free_buffer(content, buf);
             }
+            content->receive_complete = true;
+            content_unlock(content);
+
+            QD_PROBE2(message_received, msg, (int) DEQ_SIZE(content->buffers));
+            return (qd_message_t*) msg;
+        }
 
+        if (rc == PN_ABORTED) {
+            message_receive_aborted(record, msg);
             return (qd_message_t*) msg;
         }
 
@@ -1040,16 +1338,9 @@ qd_message_t *qd_message_receive(pn_delivery_t *delivery)
             // We have received a positive number of bytes for the message.  Advance
             // the cursor in the buffer.
             //
+            content_lock(content);
             qd_buffer_insert(buf, rc);
-
-            //
-            // If the buffer is full, allocate a new empty buffer and append it to the
-            // tail of the message's list.
-            //
-            if (qd_buffer_capacity(buf) == 0) {
-                buf = qd_buffer();
-                DEQ_INSERT_TAIL(msg->content->buffers, buf);
-            }
+            content_unlock(content);
         } else
             //
             // We received zero bytes, and no PN_EOS.  This means that we've received
@@ -1063,22 +1354,180 @@ qd_message_t *qd_message_receive(pn_delivery_t *delivery)
 }
 
 
-static void send_handler(void *context, const unsigned char *start, int length)
+qd_message_t *qd_message_partial(pn_delivery_t *delivery)
 {
-    pn_link_t *pnl = (pn_link_t*) context;
-    pn_link_send(pnl, (const char*) start, length);
+    pn_record_t *record = pn_delivery_attachments(delivery);
+    return (qd_message_t*) pn_record_get(record, PN_DELIVERY_CTX);
 }
 
 
-// create a buffer chain holding the outgoing message annotations section
-static void compose_message_annotations(qd_message_pvt_t *msg, qd_buffer_list_t *out, bool strip_annotations)
+qd_message_t *qd_message_receive_abort(pn_delivery_t *delivery)
+{
+    pn_record_t      *record = pn_delivery_attachments(delivery);
+    qd_message_pvt_t *msg    = (qd_message_pvt_t*) pn_record_get(record, PN_DELIVERY_CTX);
+
+    if (msg)
+        message_receive_aborted(record, msg);
+    return (qd_message_t*) msg;
+}
+
+
+bool qd_message_aborted(qd_message_t *in_msg)
+{
+    qd_message_content_t *content = ((qd_message_pvt_t*) in_msg)->content;
+    bool                  aborted;
+
+    content_lock(content);
+    aborted = content->aborted;
+    content_unlock(content);
+    return aborted;
+}
+
+
+bool qd_message_receive_complete(qd_message_t *in_msg)
+{
+    qd_message_content_t *content = ((qd_message_pvt_t*) in_msg)->content;
+    bool                  complete;
+
+    content_lock(content);
+    complete = content->receive_complete;
+    content_unlock(content);
+    return complete;
+}
+
+
+uint8_t qd_message_priority(qd_message_t *in_msg)
+{
+    qd_message_content_t *content  = MSG_CONTENT(in_msg);
+    uint8_t               priority = QD_MESSAGE_DEFAULT_PRIORITY;
+    bool                  parsed;
+
+    content_lock(content);
+    parsed   = content->priority_parsed;
+    priority = parsed ? content->priority : priority;
+    content_unlock(content);
+    if (parsed)
+        return priority;
+
+    //
+    // The header is the first section, so its absence is known as soon as anything
+    // else has arrived.  Until then, use the default without remembering it.
+    //
+    if (!qd_message_check(in_msg, QD_DEPTH_HEADER))
+        return priority;
+
+    qd_iterator_t *iter = qd_message_field_iterator(in_msg, QD_FIELD_HEADER);
+    if (iter) {
+        qd_parsed_field_t *header = qd_parse_arena(iter);
+        if (qd_parse_ok(header) && qd_parse_is_list(header) && qd_parse_sub_count(header) > 1) {
+            qd_parsed_field_t *field = qd_parse_sub_value(header, 1);
+            if (qd_parse_tag(field) == QD_AMQP_UBYTE) {
+                uint32_t value = qd_parse_as_uint(field);
+                priority = value > QD_MESSAGE_MAX_PRIORITY ? QD_MESSAGE_MAX_PRIORITY : (uint8_t) value;
+            }
+        }
+        qd_parse_free(header);
+        qd_iterator_free(iter);
+    }
+
+    content_lock(content);
+    content->priority        = priority;
+    content->priority_parsed = true;
+    content_unlock(content);
+    return priority;
+}
+
+
+uint32_t qd_message_group_hash(qd_message_t *in_msg)
+{
+    qd_message_content_t *content = MSG_CONTENT(in_msg);
+    uint32_t              hash;
+    bool                  parsed;
+
+    content_lock(content);
+    parsed = content->group_hash_parsed;
+    hash   = content->group_hash;
+    content_unlock(content);
+    if (parsed)
+        return hash;
+
+    if (!qd_message_check(in_msg, QD_DEPTH_PROPERTIES))
+        return 0;
+
+    hash = 0;
+    qd_iterator_t *iter = qd_message_field_iterator(in_msg, QD_FIELD_GROUP_ID);
+    if (iter) {
+        hash = qd_iterator_hash_view(iter);
+        hash = hash ? hash : 1;
+        qd_iterator_free(iter);
+    }
+
+    content_lock(content);
+    content->group_hash        = hash;
+    content->group_hash_parsed = true;
+    content_unlock(content);
+    return hash;
+}
+
+
+size_t qd_message_size(qd_message_t *in_msg)
+{
+    qd_message_content_t *content = ((qd_message_pvt_t*) in_msg)->content;
+    size_t                size    = 0;
+
+    content_lock(content);
+    qd_buffer_t *buf = DEQ_HEAD(content->buffers);
+    while (buf) {
+        size += qd_buffer_size(buf);
+        buf = DEQ_NEXT(buf);
+    }
+    size += content->spill.length;
+    content_unlock(content);
+    return size;
+}
+
+
+//
+// Hand length octets starting at the cursor to the link, one pn_link_send per buffer
+// segment, and leave the cursor just past them.
+//
+// Proton copies whatever is passed to pn_link_send into the session's outgoing buffer and
+// offers no way to lend it the router's buffers, so the single copy made there is the only
+// one on the send path: every segment is passed straight from the content's buffer chain
+// without staging it anywhere first.
+//
+static void send_segments(pn_link_t *pnl, unsigned char **cursor, qd_buffer_t **buffer, int length)
 {
-    qd_composed_field_t *out_ma = qd_compose(QD_PERFORMATIVE_MESSAGE_ANNOTATIONS, 0);
+    unsigned char *local_cursor = *cursor;
+    qd_buffer_t   *local_buffer = *buffer;
+
+    while (length > 0 && local_buffer) {
+        int remaining = qd_buffer_size(local_buffer) - (local_cursor - qd_buffer_base(local_buffer));
+        int segment   = length < remaining ? length : remaining;
+
+        if (segment > 0)
+            pn_link_send(pnl, (const char*) local_cursor, segment);
+        length       -= segment;
+        local_cursor += segment;
+
+        if (local_cursor == qd_buffer_base(local_buffer) + qd_buffer_size(local_buffer)) {
+            local_buffer = DEQ_NEXT(local_buffer);
+            local_cursor = local_buffer ? qd_buffer_base(local_buffer) : 0;
+        }
+    }
+
+    *cursor = local_cursor;
+    *buffer = local_buffer;
+}
 
+
+// write the outgoing message annotations map into out_ma, return false if there are none
+static bool write_message_annotations(qd_message_pvt_t *msg, qd_parsed_field_t *in_ma,
+                                      qd_composed_field_t *out_ma, bool strip_annotations)
+{
     bool map_started = false;
 
     //We will have to add the custom annotations
-    qd_parsed_field_t *in_ma = qd_parse_dup(msg->content->parsed_message_annotations);
     if (in_ma) {
         uint32_t count = qd_parse_sub_count(in_ma);
 
@@ -1095,20 +1544,21 @@ static void compose_message_annotations(qd_message_pvt_t *msg, qd_buffer_list_t
                     map_started = true;
                 }
                 qd_parsed_field_t *sub_value = qd_parse_sub_value(in_ma, idx);
+                qd_iterator_reset(qd_parse_typed(sub_key));
+                qd_iterator_reset(qd_parse_typed(sub_value));
                 qd_compose_insert_typed_iterator(out_ma, qd_parse_typed(sub_key));
                 qd_compose_insert_typed_iterator(out_ma, qd_parse_typed(sub_value));
             }
         }
-
-        qd_parse_free(in_ma);
     }
 
     //Add the dispatch router specific annotations only if strip_annotations is false.
     if (!strip_annotations) {
+        qd_path_span_t *span = msg->content->path_span;
         if (!DEQ_IS_EMPTY(msg->ma_to_override) ||
             !DEQ_IS_EMPTY(msg->ma_trace) ||
             !DEQ_IS_EMPTY(msg->ma_ingress) ||
-            msg->ma_phase != 0) {
+            msg->ma_phase != 0 || span) {
 
             if (!map_started) {
                 qd_compose_start_map(out_ma);
@@ -1134,32 +1584,469 @@ static void compose_message_annotations(qd_message_pvt_t *msg, qd_buffer_list_t
                 qd_compose_insert_symbol(out_ma, QD_MA_PHASE);
                 qd_compose_insert_int(out_ma, msg->ma_phase);
             }
+
+            if (span) {
+                qd_compose_insert_symbol(out_ma, QD_MA_SPAN);
+                qd_compose_start_list(out_ma);
+                qd_compose_insert_ulong(out_ma, span->trace_hi);
+                qd_compose_insert_ulong(out_ma, span->trace_lo);
+                qd_compose_insert_ulong(out_ma, span->span_id);
+                qd_compose_end_list(out_ma);
+            }
         }
     }
 
-    if (map_started) {
+    if (map_started)
         qd_compose_end_map(out_ma);
-        qd_compose_take_buffers(out_ma, out);
-    }
 
+    return map_started;
+}
+
+// create a buffer chain holding the outgoing message annotations section
+static void compose_message_annotations(qd_message_pvt_t *msg, qd_buffer_list_t *out, bool strip_annotations)
+{
+    qd_parsed_field_t *in_ma = qd_parse_dup(msg->content->parsed_message_annotations);
+
+    //
+    // Measure the section first.  It nearly always fits in one buffer, where it is
+    // composed in place without patching lengths across a chain of buffers.
+    //
+    qd_composed_field_t *out_ma  = qd_compose(QD_PERFORMATIVE_MESSAGE_ANNOTATIONS, qd_compose_flat(0, 0));
+    bool                 present = write_message_annotations(msg, in_ma, out_ma, strip_annotations);
+    size_t               size    = qd_compose_flat_size(out_ma);
     qd_compose_free(out_ma);
+
+    if (present) {
+        qd_buffer_t *buf = qd_buffer();
+        if (buf && size <= qd_buffer_capacity(buf)) {
+            out_ma = qd_compose(QD_PERFORMATIVE_MESSAGE_ANNOTATIONS, qd_compose_flat(qd_buffer_cursor(buf), size));
+            write_message_annotations(msg, in_ma, out_ma, strip_annotations);
+            qd_buffer_insert(buf, size);
+            DEQ_INSERT_TAIL(*out, buf);
+        } else {
+            if (buf)
+                qd_buffer_free(buf);
+            out_ma = qd_compose(QD_PERFORMATIVE_MESSAGE_ANNOTATIONS, 0);
+            write_message_annotations(msg, in_ma, out_ma, strip_annotations);
+            qd_compose_take_buffers(out_ma, out);
+        }
+        qd_compose_free(out_ma);
+    }
+
+    qd_parse_free(in_ma);
 }
 
-void qd_message_send(qd_message_t *in_msg,
-                     qd_link_t    *link,
-                     bool          strip_annotations)
+//
+// Return the outgoing message annotations for this message, composing them only if no copy
+// sharing the content has already done so with the same inputs.  Stripped annotations
+// depend only on the content; full annotations also depend on the router annotations on
+// the message, identified by its ma_epoch.
+//
+// A cached list is never modified or replaced until the content is freed, so it may be
+// sent without holding the lock.  If the inputs don't match the cache the annotations are
+// composed into 'scratch', which the caller must free.
+//
+static const qd_buffer_list_t *message_annotations_for_send(qd_message_pvt_t *msg,
+                                                            qd_buffer_list_t *scratch,
+                                                            bool              strip_annotations)
+{
+    qd_message_content_t   *content = msg->content;
+    const qd_buffer_list_t *ma      = 0;
+    int                     slot    = strip_annotations ? 1 : 0;
+
+    DEQ_INIT(*scratch);
+
+    content_lock(content);
+    if (content->composed_ma_cached[slot] && (strip_annotations || content->composed_ma_epoch == msg->ma_epoch))
+        ma = &content->composed_ma[slot];
+    content_unlock(content);
+
+    if (ma)
+        return ma;
+
+    compose_message_annotations(msg, scratch, strip_annotations);
+
+    content_lock(content);
+    if (!content->composed_ma_cached[slot]) {
+        content->composed_ma[slot]        = *scratch;
+        content->composed_ma_cached[slot] = true;
+        if (!strip_annotations)
+            content->composed_ma_epoch = msg->ma_epoch;
+        DEQ_INIT(*scratch);
+        ma = &content->composed_ma[slot];
+    } else
+        ma = scratch;
+    content_unlock(content);
+
+    return ma;
+}
+
+//
+// While a message is still arriving, stop cutting it through to a session that already has
+// this many octets waiting to be written.  The rest is sent as more data arrives, or all at
+// once when the message is complete.
+//
+#define QD_STREAM_SESSION_LIMIT (64 * 1024)
+
+//
+// Send the content between the send cursor and the end of the data received so far.
+//
+static void send_received_content(qd_message_pvt_t *msg, pn_link_t *pnl)
+{
+    qd_message_content_t *content  = msg->content;
+    pn_session_t         *session  = pn_link_session(pnl);
+    bool                  complete;
+
+    content_lock(content);
+    complete = content->receive_complete;
+    content_unlock(content);
+
+    while (msg->send_buffer) {
+        qd_buffer_t *buf = msg->send_buffer;
+        qd_buffer_t *next;
+        size_t       size;
+        size_t       next_size = 0;
+
+        if (complete) {
+            // Nothing is added to a completely received message, no locking needed.
+            size = qd_buffer_size(buf);
+            next = DEQ_NEXT(buf);
+        } else {
+            if (pn_session_outgoing_bytes(session) >= QD_STREAM_SESSION_LIMIT)
+                return;
+            content_lock(content);
+            complete = content->receive_complete;
+            size     = qd_buffer_size(buf);
+            next     = DEQ_NEXT(buf);
+            if (next)
+                next_size = qd_buffer_size(next);
+            content_unlock(content);
+        }
+
+        if (size > msg->send_offset) {
+            pn_link_send(pnl, (char*) qd_buffer_base(buf) + msg->send_offset, size - msg->send_offset);
+            msg->send_offset = size;
+        }
+
+        //
+        // Only the tail buffer grows, and an empty tail is freed when the receive completes.
+        // Step onto the next buffer only once it holds data so the cursor never rests on a
+        // buffer that may go away.
+        //
+        if (next && (complete || next_size > 0)) {
+            msg->send_buffer = next;
+            msg->send_offset = 0;
+        } else if (complete)
+            msg->send_buffer = 0;
+        else
+            return;
+    }
+
+    if (complete)
+        msg->send_complete = true;
+}
+
+
+#if USE_ZLIB
+
+//
+// On a connection that compresses messages, everything after a message's annotations may be
+// replaced by this section: a binary holding the zlib stream of the original octets, after a
+// descriptor in the Qpid domain.  The section never leaves the connection.
+//
+static const unsigned char * const COMPRESSED_SECTION = (unsigned char*) "\x00\x80\x00\x00\x46\x8c\x00\x00\x00\x01\xb0";
+#define COMPRESSED_SECTION_LENGTH 11    // Descriptor and binary tag, followed by a four octet size
+#define COMPRESS_MIN_SIZE         256   // Smaller message content is not worth compressing
+
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+//
+// A zlib stream run over segments of a buffer chain, its output appended to a buffer list.
+//
+typedef struct {
+    z_stream          zs;
+    bool              inflating;
+    int               status;      // Z_OK while the stream runs, Z_STREAM_END once it is done
+    qd_buffer_list_t *out;
+} zlib_pass_t;
+
+
+static void zlib_run(zlib_pass_t *pass, const unsigned char *in, size_t length, int flush)
+{
+    if (pass->status != Z_OK) {
+        if (length > 0)
+            pass->status = Z_DATA_ERROR;    // Octets after the end of the stream
+        return;
+    }
+
+    pass->zs.next_in  = (Bytef*) in;
+    pass->zs.avail_in = length;
+    while (true) {
+        qd_buffer_t *buf = DEQ_TAIL(*pass->out);
+        if (!buf || qd_buffer_capacity(buf) == 0) {
+            buf = qd_buffer();
+            DEQ_INSERT_TAIL(*pass->out, buf);
+        }
+        size_t space = qd_buffer_capacity(buf);
+        pass->zs.next_out  = qd_buffer_cursor(buf);
+        pass->zs.avail_out = space;
+        int rc = pass->inflating ? inflate(&pass->zs, flush) : deflate(&pass->zs, flush);
+        qd_buffer_insert(buf, space - pass->zs.avail_out);
+
+        if (rc == Z_STREAM_END) {
+            pass->status = pass->zs.avail_in > 0 ? Z_DATA_ERROR : Z_STREAM_END;
+            return;
+        }
+        if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            pass->status = rc;
+            return;
+        }
+        // Room left in the output means the stream needs more input
+        if (pass->zs.avail_out > 0 && (pass->zs.avail_in == 0 || rc == Z_BUF_ERROR))
+            return;
+    }
+}
+
+
+static void zlib_segment(void *context, const unsigned char *base, int length)
+{
+    if (length > 0)
+        zlib_run((zlib_pass_t*) context, base, length, Z_NO_FLUSH);
+}
+
+
+static size_t octets_from(unsigned char *cursor, qd_buffer_t *buf)
+{
+    size_t size = 0;
+    if (buf) {
+        size = contiguous_octets(cursor, buf);
+        for (buf = DEQ_NEXT(buf); buf; buf = DEQ_NEXT(buf))
+            size += qd_buffer_size(buf);
+    }
+    return size;
+}
+
+
+//
+// Compress the length octets at the cursor into the compressed section.  Leave out empty
+// if the section would not be smaller than the octets themselves.
+//
+static void compress_content(unsigned char *cursor, qd_buffer_t *buf, size_t length, qd_buffer_list_t *out)
+{
+    zlib_pass_t pass;
+    ZERO(&pass);
+    pass.out = out;
+    if (deflateInit(&pass.zs, Z_DEFAULT_COMPRESSION) != Z_OK)
+        return;
+
+    qd_buffer_t *head = qd_buffer();
+    memcpy(qd_buffer_cursor(head), COMPRESSED_SECTION, COMPRESSED_SECTION_LENGTH);
+    qd_buffer_insert(head, COMPRESSED_SECTION_LENGTH + 4);
+    DEQ_INSERT_TAIL(*out, head);
+
+    advance(&cursor, &buf, length, zlib_segment, &pass);
+    zlib_run(&pass, 0, 0, Z_FINISH);
+    deflateEnd(&pass.zs);
+
+    if (pass.status != Z_STREAM_END || pass.zs.total_out + COMPRESSED_SECTION_LENGTH + 4 >= length) {
+        qd_buffer_list_free_buffers(out);
+        return;
+    }
+
+    uint32_t       size = pass.zs.total_out;
+    unsigned char *p    = qd_buffer_base(head) + COMPRESSED_SECTION_LENGTH;
+    p[0] = size >> 24;
+    p[1] = size >> 16;
+    p[2] = size >> 8;
+    p[3] = size;
+}
+
+
+//
+// Send the message from the cursor, which is just past its annotations, as the compressed
+// section.  The section is made once per content and shared by all of its sends.  Return
+// false if the message is to be sent as it is.
+//
+static bool send_compressed(qd_message_pvt_t *msg, pn_link_t *pnl, unsigned char *cursor, qd_buffer_t *buf,
+                            qdr_compression_stats_t *stats)
+{
+    qd_message_content_t *content = msg->content;
+
+    content_lock(content);
+    bool complete = content->receive_complete;
+    bool cached   = content->compressed_cached;
+    content_unlock(content);
+
+    // A message still being received is streamed as it arrives
+    if (!complete)
+        return false;
+
+    size_t length = octets_from(cursor, buf);
+    if (!cached) {
+        qd_buffer_list_t out;
+        DEQ_INIT(out);
+        if (length >= COMPRESS_MIN_SIZE) {
+            uint64_t start = monotonic_ns();
+            compress_content(cursor, buf, length, &out);
+            stats->compress_ns += monotonic_ns() - start;
+        }
+
+        content_lock(content);
+        if (content->compressed_cached)
+            qd_buffer_list_free_buffers(&out);    // Another send got there first
+        else {
+            content->compressed        = out;
+            content->compressed_cached = true;
+        }
+        content_unlock(content);
+    }
+
+    stats->bytes_out += length;
+    if (DEQ_IS_EMPTY(content->compressed)) {
+        stats->wire_bytes_out += length;
+        return false;
+    }
+
+    qd_buffer_t *out_buf = DEQ_HEAD(content->compressed);
+    while (out_buf) {
+        pn_link_send(pnl, (char*) qd_buffer_base(out_buf), qd_buffer_size(out_buf));
+        stats->wire_bytes_out += qd_buffer_size(out_buf);
+        out_buf = DEQ_NEXT(out_buf);
+    }
+    return true;
+}
+
+
+bool qd_message_inflate(qd_message_t *in_msg, qdr_compression_stats_t *stats)
+{
+    qd_message_content_t *content = MSG_CONTENT(in_msg);
+
+    // A message that doesn't parse this far is left for validation to reject
+    if (!qd_message_check(in_msg, QD_DEPTH_MESSAGE_ANNOTATIONS))
+        return true;
+
+    content_lock(content);
+    qd_buffer_t   *buf    = content->parse_buffer;
+    unsigned char *cursor = content->parse_cursor;
+    size_t         length = octets_from(cursor, buf);
+
+    //
+    // Match the section's descriptor and binary tag, then take its size
+    //
+    qd_buffer_t   *in_buf    = buf;
+    unsigned char *in_cursor = cursor;
+    bool           match     = length >= COMPRESSED_SECTION_LENGTH + 4;
+    for (int i = 0; match && i < COMPRESSED_SECTION_LENGTH; i++)
+        match = next_octet(&in_cursor, &in_buf) == COMPRESSED_SECTION[i];
+
+    stats->wire_bytes_in += length;
+    if (!match) {
+        stats->bytes_in += length;
+        content_unlock(content);
+        return true;
+    }
+
+    uint32_t size = 0;
+    for (int i = 0; i < 4; i++)
+        size = (size << 8) | next_octet(&in_cursor, &in_buf);
+
+    qd_buffer_list_t out;
+    zlib_pass_t      pass;
+    DEQ_INIT(out);
+    ZERO(&pass);
+    pass.inflating = true;
+    pass.out       = &out;
+
+    uint64_t start = monotonic_ns();
+    bool     valid = size == length - COMPRESSED_SECTION_LENGTH - 4 && inflateInit(&pass.zs) == Z_OK;
+    if (valid) {
+        advance(&in_cursor, &in_buf, size, zlib_segment, &pass);
+        inflateEnd(&pass.zs);
+        valid = pass.status == Z_STREAM_END && pass.zs.total_out > 0;
+    }
+    stats->compress_ns += monotonic_ns() - start;
+
+    if (!valid) {
+        qd_buffer_list_free_buffers(&out);
+        content_unlock(content);
+        return false;
+    }
+    stats->bytes_in += pass.zs.total_out;
+
+    //
+    // Replace the section with the octets it held.  Everything before it is left where it is,
+    // and the parse that found it carries on from the first of them.
+    //
+    qd_buffer_t *next = DEQ_NEXT(buf);
+    while (next) {
+        DEQ_REMOVE(content->buffers, next);
+        content_free_buffer(content, next);
+        next = DEQ_NEXT(buf);
+    }
+    buf->size = cursor - qd_buffer_base(buf);
+    if (buf->size == 0 && buf != DEQ_HEAD(content->buffers)) {
+        DEQ_REMOVE(content->buffers, buf);
+        content_free_buffer(content, buf);
+    }
+    content->parse_buffer = DEQ_HEAD(out);
+    content->parse_cursor = qd_buffer_base(content->parse_buffer);
+    DEQ_APPEND(content->buffers, out);
+    content_unlock(content);
+    return true;
+}
+
+#else
+
+bool qd_message_inflate(qd_message_t *in_msg, qdr_compression_stats_t *stats)
+{
+    return true;
+}
+
+#endif
+
+
+static void message_send(qd_message_t *in_msg,
+                         qd_link_t    *link,
+                         bool          strip_annotations,
+                         qdr_compression_stats_t *compression)
 {
     qd_message_pvt_t     *msg     = (qd_message_pvt_t*) in_msg;
     qd_message_content_t *content = msg->content;
-    qd_buffer_t          *buf     = DEQ_HEAD(content->buffers);
-    unsigned char        *cursor;
     pn_link_t            *pnl     = qd_link_pn(link);
 
+    QD_PROBE3(message_send, msg, pnl, msg->send_started);
+
+    if (msg->send_started) {
+        send_received_content(msg, pnl);
+        return;
+    }
+
+    qd_buffer_t          *buf;
+    unsigned char        *cursor;
+    bool                  cut_cached;
+
+    //
+    // Where the content resumes after its original message annotations.  The first send of
+    // a completely received content finds it, later sends start from there without
+    // parsing or walking the annotations.
+    //
+    content_lock(content);
+    cut_cached = content->send_cut_cached;
+    buf        = content->send_cut_buffer;
+    cursor     = content->send_cut_cursor;
+    content_unlock(content);
+
     qd_buffer_list_t new_ma;
-    DEQ_INIT(new_ma);
 
     // Process  the message annotations if any
-    compose_message_annotations(msg, &new_ma, strip_annotations);
+    const qd_buffer_list_t *out_ma = message_annotations_for_send(msg, &new_ma, strip_annotations);
 
     //
     // This is the case where the message annotations have been modified.
@@ -1171,28 +2058,35 @@ void qd_message_send(qd_message_t *in_msg,
     // Start by making sure that we've parsed the message sections through
     // the message annotations
     //
-    // ??? NO LONGER NECESSARY???
-    if (!qd_message_check(in_msg, QD_DEPTH_MESSAGE_ANNOTATIONS)) {
+    if (!cut_cached && !qd_message_check(in_msg, QD_DEPTH_MESSAGE_ANNOTATIONS)) {
         qd_log(log_source, QD_LOG_ERROR, "Cannot send: %s", qd_error_message);
+        qd_buffer_list_free_buffers(&new_ma);
+        msg->send_started  = true;
+        msg->send_complete = true;
         return;
     }
 
     //
     // Send header if present
     //
-    cursor = qd_buffer_base(buf);
     if (content->section_message_header.length > 0) {
-        buf    = content->section_message_header.buffer;
-        cursor = content->section_message_header.offset + qd_buffer_base(buf);
-        advance(&cursor, &buf,
-                content->section_message_header.length + content->section_message_header.hdr_length,
-                send_handler, (void*) pnl);
+        qd_buffer_t   *hdr_buf    = content->section_message_header.buffer;
+        unsigned char *hdr_cursor = content->section_message_header.offset + qd_buffer_base(hdr_buf);
+        send_segments(pnl, &hdr_cursor, &hdr_buf,
+                      content->section_message_header.length + content->section_message_header.hdr_length);
+        if (!cut_cached) {
+            buf    = hdr_buf;
+            cursor = hdr_cursor;
+        }
+    } else if (!cut_cached) {
+        buf    = DEQ_HEAD(content->buffers);
+        cursor = qd_buffer_base(buf);
     }
 
     //
     // Send new message annotations
     //
-    qd_buffer_t *da_buf = DEQ_HEAD(new_ma);
+    qd_buffer_t *da_buf = DEQ_HEAD(*out_ma);
     while (da_buf) {
         char *to_send = (char*) qd_buffer_base(da_buf);
         pn_link_send(pnl, to_send, qd_buffer_size(da_buf));
@@ -1201,29 +2095,129 @@ void qd_message_send(qd_message_t *in_msg,
     qd_buffer_list_free_buffers(&new_ma);
 
     //
-    // Skip over replaced message annotations
+    // Skip over replaced message annotations.  The buffers of a completely received content
+    // stay put, so the point reached can be kept for the next send.
     //
-    if (content->section_message_annotation.length > 0)
-        advance(&cursor, &buf,
-                content->section_message_annotation.hdr_length + content->section_message_annotation.length,
-                0, 0);
+    if (!cut_cached) {
+        if (content->section_message_annotation.length > 0)
+            advance(&cursor, &buf,
+                    content->section_message_annotation.hdr_length + content->section_message_annotation.length,
+                    0, 0);
+
+        content_lock(content);
+        if (content->receive_complete && !content->send_cut_cached) {
+            content->send_cut_buffer = buf;
+            content->send_cut_cursor = cursor;
+            content->send_cut_cached = true;
+        }
+        content_unlock(content);
+    }
+
+#if USE_ZLIB
+    if (compression && send_compressed(msg, pnl, cursor, buf, compression)) {
+        msg->send_started  = true;
+        msg->send_complete = true;
+        return;
+    }
+#endif
 
     //
-    // Send remaining partial buffer
+    // Send the rest of the message from here, or as much of it as has been received.
+    // Note that 'advance' will have moved us to the next buffer in the chain.
     //
-    if (buf) {
-        size_t len = qd_buffer_size(buf) - (cursor - qd_buffer_base(buf));
-        advance(&cursor, &buf, len, send_handler, (void*) pnl);
+    msg->send_started = true;
+    msg->send_buffer  = buf;
+    msg->send_offset  = buf ? cursor - qd_buffer_base(buf) : 0;
+    send_received_content(msg, pnl);
+}
+
+
+void qd_message_send(qd_message_t *in_msg,
+                     qd_link_t    *link,
+                     bool          strip_annotations,
+                     qdr_compression_stats_t *compression)
+{
+    qd_message_pvt_t     *msg     = (qd_message_pvt_t*) in_msg;
+    qd_message_content_t *content = msg->content;
+
+    if (msg->send_complete)
+        return;
+
+    if (!qd_spill_enabled()) {
+        message_send(in_msg, link, strip_annotations, compression);
+        return;
     }
 
-    // Fall through to process the remaining buffers normally
-    // Note that 'advance' will have moved us to the next buffer in the chain.
+    //
+    // A send walks the buffer chain across calls, so the content is not spilled while any
+    // of its messages is part way through one.
+    //
+    if (!msg->send_started) {
+        content_lock(content);
+        content_unspill_LH(content);
+        content->senders++;
+        content_unlock(content);
+    }
 
+    message_send(in_msg, link, strip_annotations, compression);
 
-    while (buf) {
-        pn_link_send(pnl, (char*) qd_buffer_base(buf), qd_buffer_size(buf));
-        buf = DEQ_NEXT(buf);
+    if (msg->send_complete) {
+        content_lock(content);
+        content->senders--;
+        content_unlock(content);
+    }
+}
+
+
+bool qd_message_spill(qd_message_t *in_msg)
+{
+    qd_message_content_t *content = MSG_CONTENT(in_msg);
+    bool                  spilled = false;
+
+    //
+    // Content without a lock has a single owner that reads it unlocked.
+    //
+    if (!qd_spill_enabled() || !content->lock)
+        return false;
+
+    content_lock(content);
+
+    //
+    // Only what follows the buffer holding the start of the body is spilled, and nothing
+    // the parse has reached, so the section locations all stay in memory.  A message whose
+    // footer has been located keeps its body.
+    //
+    if (content->receive_complete && content->spill.length == 0 && content->senders == 0
+        && content->section_body.parsed && content->section_body.buffer && !content->section_footer.parsed) {
+        qd_buffer_t *last = content->section_body.buffer;
+        for (qd_buffer_t *buf = DEQ_NEXT(last); buf; buf = DEQ_NEXT(buf))
+            if (buf == content->parse_buffer)
+                last = buf;
+
+        if (DEQ_NEXT(last) && qd_spill_store(DEQ_NEXT(last), &content->spill)) {
+            while (DEQ_TAIL(content->buffers) != last) {
+                qd_buffer_t *buf = DEQ_TAIL(content->buffers);
+                DEQ_REMOVE_TAIL(content->buffers);
+                content_free_buffer(content, buf);
+            }
+            spilled = true;
+        }
     }
+
+    content_unlock(content);
+    return spilled;
+}
+
+
+bool qd_message_send_started(qd_message_t *msg)
+{
+    return ((qd_message_pvt_t*) msg)->send_started;
+}
+
+
+bool qd_message_send_complete(qd_message_t *msg)
+{
+    return ((qd_message_pvt_t*) msg)->send_complete;
 }
 
 
@@ -1262,6 +2256,8 @@ static bool qd_message_check_LH(qd_message_content_t *content, qd_message_depth_
     if (depth <= content->parse_depth)
         return true; // We've already parsed at least this deep
 
+    content_unspill_LH(content);
+
     if (content->parse_buffer == 0) {
         content->parse_buffer = buffer;
         content->parse_cursor = qd_buffer_base(content->parse_buffer);
@@ -1369,9 +2365,69 @@ int qd_message_check(qd_message_t *in_msg, qd_message_depth_t depth)
     qd_message_content_t *content = msg->content;
     int                   result;
 
-    sys_mutex_lock(content->lock);
+    content_lock(content);
     result = qd_message_check_LH(content, depth);
-    sys_mutex_unlock(content->lock);
+    content_unlock(content);
+    return result;
+}
+
+
+//
+// Forget the results of a section parse so it can be repeated once more data has arrived.
+//
+static void qd_message_parse_reset_LH(qd_message_content_t *content)
+{
+    ZERO(&content->section_message_header);
+    ZERO(&content->section_delivery_annotation);
+    ZERO(&content->section_message_annotation);
+    ZERO(&content->section_message_properties);
+    ZERO(&content->section_application_properties);
+    ZERO(&content->section_body);
+    ZERO(&content->section_footer);
+    content->parse_buffer = 0;
+    content->parse_cursor = 0;
+    content->parse_depth  = QD_DEPTH_NONE;
+    content->send_cut_cached = false;
+}
+
+
+qd_message_depth_status_t qd_message_check_depth(qd_message_t *in_msg, qd_message_depth_t depth)
+{
+    qd_message_pvt_t     *msg     = (qd_message_pvt_t*) in_msg;
+    qd_message_content_t *content = msg->content;
+    qd_message_depth_status_t result;
+
+    content_lock(content);
+    if (content->receive_complete || depth <= content->parse_depth) {
+        result = qd_message_check_LH(content, depth) ? QD_MESSAGE_DEPTH_OK : QD_MESSAGE_DEPTH_INVALID;
+        content_unlock(content);
+        return result;
+    }
+
+    //
+    // The section scanner cannot tell a section that is cut short by the end of the data from
+    // one that is malformed or absent.  Only trust the parse if at least a full section
+    // descriptor's worth of data follows the point where it stopped.
+    //
+    bool   valid     = qd_message_check_LH(content, depth);
+    size_t following = 0;
+    if (valid && content->parse_cursor) {
+        qd_buffer_t *buf = content->parse_buffer;
+        following = qd_buffer_size(buf) - (content->parse_cursor - qd_buffer_base(buf));
+        buf = DEQ_NEXT(buf);
+        while (buf && following < LONG) {
+            following += qd_buffer_size(buf);
+            buf = DEQ_NEXT(buf);
+        }
+    }
+
+    if (following >= LONG)
+        result = QD_MESSAGE_DEPTH_OK;
+    else {
+        qd_message_parse_reset_LH(content);
+        result = QD_MESSAGE_DEPTH_INCOMPLETE;
+    }
+    content_unlock(content);
     return result;
 }
 
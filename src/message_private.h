@@ -21,6 +21,8 @@
 
 #include <qpid/dispatch/message.h>
 #include "alloc.h"
+#include "path_trace.h"
+#include "spill.h"
 #include <qpid/dispatch/threading.h>
 #include <qpid/dispatch/atomic.h>
 
@@ -51,21 +53,38 @@
 
 typedef struct {
     qd_buffer_t *buffer;     // Buffer that contains the first octet of the field, null if the field is not present
-    size_t       offset;     // Offset in the buffer to the first octet of the header
-    size_t       length;     // Length of the field or zero if unneeded
-    size_t       hdr_length; // Length of the field's header (not included in the length of the field)
+    uint32_t     offset;     // Offset in the buffer to the first octet of the header
+    uint32_t     length;     // Length of the field or zero if unneeded
+    uint32_t     hdr_length; // Length of the field's header (not included in the length of the field)
     bool         parsed;     // True iff the buffer chain has been parsed to find this field
     uint8_t      tag;        // Type tag of the field
 } qd_field_location_t;
 
+//
+// Locations of the fields of the properties list, from message-id to reply-to-group-id.
+// Most messages never have their properties picked apart, so this table is only allocated
+// the first time one of its fields is asked for.
+//
+#define QD_MESSAGE_PROPERTY_FIELDS 13
 
-// TODO - consider using pointers to qd_field_location_t below to save memory
-// TODO - provide a way to allocate a message without a lock for the link-routing case.
-//        It's likely that link-routing will cause no contention for the message content.
+typedef struct {
+    qd_field_location_t field[QD_MESSAGE_PROPERTY_FIELDS];
+} qd_message_properties_t;
+
+//
+// The content lock is created only when the content is first shared by qd_message_copy.
+// Content with a single owner, such as a link-routed delivery, is never locked.
 //
 
+//
+// Every content allocation carries a small buffer immediately after the content structure.
+// A message small enough to fit is received into it, so it needs no buffer allocation of its
+// own.  This buffer belongs to the content and must never be passed to qd_buffer_free.
+//
+#define QD_MESSAGE_INLINE_CAPACITY 256
+
 typedef struct {
-    sys_mutex_t         *lock;
+    sys_mutex_t         *lock;                            // Null until the content is shared
     sys_atomic_t         ref_count;                       // The number of messages referencing this
     qd_buffer_list_t     buffers;                         // The buffer chain containing the message
     qd_field_location_t  section_message_header;          // The message header list
@@ -75,25 +94,30 @@ typedef struct {
     qd_field_location_t  section_application_properties;  // The application properties list
     qd_field_location_t  section_body;                    // The message body: Data
     qd_field_location_t  section_footer;                  // The footer
-    qd_field_location_t  field_message_id;                // The string value of the message-id
-    qd_field_location_t  field_user_id;                   // The string value of the user-id
-    qd_field_location_t  field_to;                        // The string value of the to field
-    qd_field_location_t  field_subject;                   // The string value of the subject field
-    qd_field_location_t  field_reply_to;                  // The string value of the reply_to field
-    qd_field_location_t  field_correlation_id;            // The string value of the correlation_id field
-    qd_field_location_t  field_content_type;
-    qd_field_location_t  field_content_encoding;
-    qd_field_location_t  field_absolute_expiry_time;
-    qd_field_location_t  field_creation_time;
-    qd_field_location_t  field_group_id;
-    qd_field_location_t  field_group_sequence;
-    qd_field_location_t  field_reply_to_group_id;
-
-    qd_field_location_t  body;                            // The body of the message
+    qd_message_properties_t *properties;                  // Property field locations, null until one is needed
     qd_buffer_t         *parse_buffer;
     unsigned char       *parse_cursor;
     qd_message_depth_t   parse_depth;
     qd_parsed_field_t   *parsed_message_annotations;
+    bool                 receive_complete;                // True once the final frame has arrived
+    bool                 aborted;                         // Receive ended before the final frame, implies receive_complete
+    qd_buffer_list_t     composed_ma[2];                  // Outgoing annotations, indexed by strip flag
+    bool                 composed_ma_cached[2];           // True once composed_ma[i] is set (never changes after)
+    uint32_t             composed_ma_epoch;               // ma_epoch of the inputs cached in composed_ma[0]
+    uint32_t             ma_epoch_next;                   // Last epoch handed out to a message on this content
+    uint8_t              priority;                        // Header priority, valid once priority_parsed is set
+    bool                 priority_parsed;
+    uint32_t             group_hash;                      // Hash of the group-id, 0 if none, valid once group_hash_parsed is set
+    bool                 group_hash_parsed;
+    qd_path_span_t      *path_span;                       // Trace context if the message is path traced
+    uint64_t             receive_start_ns;                // Arrival of the first frame, kept while path tracing
+    qd_buffer_list_t     compressed;                      // Compressed section sent on compressing connections
+    bool                 compressed_cached;               // True once compressed is set, empty if not worth it
+    qd_buffer_t         *send_cut_buffer;                 // Where sends resume after the message annotations,
+    unsigned char       *send_cut_cursor;                 //   once send_cut_cached is set
+    bool                 send_cut_cached;                 // Set by the first send of the complete content
+    qd_spill_extent_t    spill;                           // Body tail moved to the spill file, length 0 if none
+    uint32_t             senders;                         // Messages part way through qd_message_send, while spilling
 } qd_message_content_t;
 
 typedef struct {
@@ -103,12 +127,18 @@ typedef struct {
     qd_buffer_list_t      ma_trace;        // trace list in outgoing message annotations
     qd_buffer_list_t      ma_ingress;      // ingress field in outgoing message annotations
     int                   ma_phase;        // phase for the override address
+    uint32_t              ma_epoch;        // identifies this set of annotation inputs among the content's messages
+    qd_buffer_t          *send_buffer;     // buffer holding the next octet to send
+    size_t                send_offset;     // offset of the next octet to send in send_buffer
+    bool                  send_started;    // the header and annotations have been sent
+    bool                  send_complete;   // all of the content has been sent
 } qd_message_pvt_t;
 
 ALLOC_DECLARE(qd_message_t);
 ALLOC_DECLARE(qd_message_content_t);
 
 #define MSG_CONTENT(m) (((qd_message_pvt_t*) m)->content)
+#define MSG_INLINE_BUFFER(c) ((qd_buffer_t*) &((qd_message_content_t*) (c))[1])
 
 /** Initialize logging */
 void qd_message_initialize();
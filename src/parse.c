@@ -18,12 +18,24 @@
  */
 
 #include "alloc.h"
+#include <string.h>
 #include <qpid/dispatch/ctools.h>
 #include <qpid/dispatch/parse.h>
 #include <qpid/dispatch/amqp.h>
 
 DEQ_DECLARE(qd_parsed_field_t, qd_parsed_field_list_t);
 
+//
+// Slot in the key index of a map.  Slots are open-addressed by the hash of the
+// raw key and hold the map entry number plus one, zero marks an empty slot.
+//
+typedef struct qd_parsed_key_slot_t {
+    uint32_t hash;
+    uint32_t entry;
+} qd_parsed_key_slot_t;
+
+typedef struct qd_parse_arena_t qd_parse_arena_t;
+
 struct qd_parsed_field_t {
     DEQ_LINKS(qd_parsed_field_t);
     const qd_parsed_field_t *parent;
@@ -32,11 +44,102 @@ struct qd_parsed_field_t {
     qd_iterator_t           *raw_iter;
     qd_iterator_t           *typed_iter;
     const char              *parse_error;
+    qd_parsed_field_t      **index;      // Children by position, built on first indexed access
+    qd_parsed_key_slot_t    *keys;       // Map keys by hash, built on first lookup by key
+    uint32_t                 key_mask;   // Number of key slots minus one
+    qd_parse_arena_t        *arena;      // Set for every field of a tree built by qd_parse_arena
+    uint32_t                 count;      // Number of children of an arena field
 };
 
 ALLOC_DECLARE(qd_parsed_field_t);
 ALLOC_DEFINE(qd_parsed_field_t);
 
+//
+// A tree built by qd_parse_arena places its fields and their iterators in a
+// chain of blocks owned by the root.  However many fields it has, the tree
+// costs a few mallocs and is freed without visiting the fields.  The children
+// of a compound field are only parsed when they are first asked for.
+//
+typedef struct qd_parse_block_t qd_parse_block_t;
+struct qd_parse_block_t {
+    qd_parse_block_t *next;
+    size_t            size;
+    size_t            used;
+};
+
+typedef struct qd_parse_iter_t qd_parse_iter_t;
+struct qd_parse_iter_t {
+    qd_parse_iter_t       *next;
+    qd_iterator_storage_t  storage;
+};
+
+struct qd_parse_arena_t {
+    qd_parse_block_t *blocks;
+    qd_parse_iter_t  *iters;    // Released on free in case a user gave them hash segments
+};
+
+#define QD_PARSE_ALIGN(n)     (((n) + 7) & ~(size_t) 7)
+#define QD_PARSE_BLOCK_HEADER QD_PARSE_ALIGN(sizeof(qd_parse_block_t))
+#define QD_PARSE_BLOCK_SIZE   4096
+
+static void *qd_parse_arena_alloc(qd_parse_arena_t *arena, size_t size)
+{
+    size = QD_PARSE_ALIGN(size);
+    qd_parse_block_t *block = arena->blocks;
+    if (!block || block->used + size > block->size) {
+        size_t block_size = block ? block->size * 2 : QD_PARSE_BLOCK_SIZE;
+        while (block_size < QD_PARSE_BLOCK_HEADER + size)
+            block_size *= 2;
+        qd_parse_block_t *next = (qd_parse_block_t*) malloc(block_size);
+        if (!next)
+            return 0;
+        next->next    = block;
+        next->size    = block_size;
+        next->used    = QD_PARSE_BLOCK_HEADER;
+        arena->blocks = block = next;
+    }
+
+    void *result = (char*) block + block->used;
+    block->used += size;
+    return result;
+}
+
+
+static qd_parse_arena_t *qd_parse_arena_new(void)
+{
+    // The arena lives in its own first block
+    qd_parse_arena_t  first  = {0, 0};
+    qd_parse_arena_t *arena  = (qd_parse_arena_t*) qd_parse_arena_alloc(&first, sizeof(qd_parse_arena_t));
+    if (arena)
+        *arena = first;
+    return arena;
+}
+
+
+static void qd_parse_arena_free(qd_parse_arena_t *arena)
+{
+    for (qd_parse_iter_t *cell = arena->iters; cell; cell = cell->next)
+        qd_iterator_free((qd_iterator_t*) &cell->storage);
+
+    qd_parse_block_t *block = arena->blocks;
+    while (block) {
+        qd_parse_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+
+static qd_iterator_t *qd_parse_arena_iter(qd_parse_arena_t *arena, const qd_iterator_t *iter)
+{
+    qd_parse_iter_t *cell = (qd_parse_iter_t*) qd_parse_arena_alloc(arena, sizeof(qd_parse_iter_t));
+    if (!cell)
+        return 0;
+    cell->next   = arena->iters;
+    arena->iters = cell;
+    return qd_iterator_init_dup(&cell->storage, iter);
+}
+
 /**
  * size = the number of bytes following the tag
  * count = the number of elements. Applies only to compound structures
@@ -132,6 +235,11 @@ static qd_parsed_field_t *qd_parse_internal(qd_iterator_t *iter, qd_parsed_field
     field->parent   = p;
     field->raw_iter = 0;
     field->typed_iter = qd_iterator_dup(iter);
+    field->index    = 0;
+    field->keys     = 0;
+    field->key_mask = 0;
+    field->arena    = 0;
+    field->count    = 0;
 
     uint32_t size            = 0;
     uint32_t count           = 0;
@@ -169,18 +277,141 @@ qd_parsed_field_t *qd_parse(qd_iterator_t *iter)
 }
 
 
+//
+// Check that a field and everything inside it is well formed without building
+// anything, so that an arena tree reports errors up front as qd_parse does.
+//
+static const char *qd_parse_check(qd_iterator_t *iter)
+{
+    uint8_t  tag;
+    uint32_t size;
+    uint32_t count;
+    uint32_t length_of_size;
+    uint32_t length_of_count;
+
+    const char *error = get_type_info(iter, &tag, &size, &count, &length_of_size, &length_of_count);
+    if (error)
+        return error;
+
+    if (count) {
+        qd_iterator_storage_t storage;
+        qd_iterator_t *sub = qd_iterator_init_dup(&storage, iter);
+        qd_iterator_trim_view(sub, size - length_of_count);
+        for (uint32_t idx = 0; idx < count && !error; idx++)
+            error = qd_parse_check(sub);
+        qd_iterator_free(sub);
+    }
+
+    qd_iterator_advance(iter, size - length_of_count);
+    return error;
+}
+
+
+static qd_parsed_field_t *qd_parse_arena_field(qd_parse_arena_t *arena, qd_iterator_t *iter, qd_parsed_field_t *p)
+{
+    qd_parsed_field_t *field = (qd_parsed_field_t*) qd_parse_arena_alloc(arena, sizeof(qd_parsed_field_t));
+    if (!field)
+        return 0;
+
+    ZERO(field);
+    field->parent     = p;
+    field->arena      = arena;
+    field->typed_iter = qd_parse_arena_iter(arena, iter);
+
+    uint32_t size            = 0;
+    uint32_t count           = 0;
+    uint32_t length_of_count = 0;
+    uint32_t length_of_size  = 0;
+
+    field->parse_error = get_type_info(iter, &field->tag, &size, &count, &length_of_size, &length_of_count);
+
+    if (!field->parse_error) {
+        qd_iterator_trim_view(field->typed_iter, size + length_of_size + 1); // + 1 accounts for the tag length
+
+        field->raw_iter = qd_parse_arena_iter(arena, iter);
+        qd_iterator_trim_view(field->raw_iter, size - length_of_count);
+
+        qd_iterator_advance(iter, size - length_of_count);
+        field->count = count;
+    }
+
+    return field;
+}
+
+
+//
+// Parse the children of an arena field into its index.
+//
+static bool qd_parse_arena_children(qd_parsed_field_t *field)
+{
+    qd_parsed_field_t **index = (qd_parsed_field_t**) qd_parse_arena_alloc(field->arena, field->count * sizeof(qd_parsed_field_t*));
+    if (!index)
+        return false;
+
+    qd_iterator_storage_t storage;
+    qd_iterator_t *iter = qd_iterator_init_dup(&storage, field->raw_iter);
+    qd_iterator_reset(iter);
+    bool ok = true;
+    for (uint32_t idx = 0; idx < field->count && ok; idx++) {
+        index[idx] = qd_parse_arena_field(field->arena, iter, field);
+        ok = index[idx] != 0;
+    }
+    qd_iterator_free(iter);
+
+    if (ok)
+        field->index = index;
+    return ok;
+}
+
+
+qd_parsed_field_t *qd_parse_arena(qd_iterator_t *iter)
+{
+    if (!iter)
+        return 0;
+
+    qd_parse_arena_t *arena = qd_parse_arena_new();
+    if (!arena)
+        return 0;
+
+    qd_iterator_storage_t storage;
+    qd_iterator_t *check = qd_iterator_init_dup(&storage, iter);
+    const char    *error = qd_parse_check(check);
+    qd_iterator_free(check);
+
+    qd_parsed_field_t *field = qd_parse_arena_field(arena, iter, 0);
+    if (!field) {
+        qd_parse_arena_free(arena);
+        return 0;
+    }
+
+    if (!field->parse_error)
+        field->parse_error = error;
+    if (field->parse_error)
+        field->count = 0;
+    return field;
+}
+
+
 void qd_parse_free(qd_parsed_field_t *field)
 {
     if (!field)
         return;
 
     assert(field->parent == 0);
+    if (field->arena) {
+        qd_parse_arena_free(field->arena);
+        return;
+    }
+
     if (field->raw_iter)
         qd_iterator_free(field->raw_iter);
 
     if (field->typed_iter)
         qd_iterator_free(field->typed_iter);
 
+    free(field->index);
+    free(field->keys);
+
     qd_parsed_field_t *sub_field = DEQ_HEAD(field->children);
     while (sub_field) {
         qd_parsed_field_t *next = DEQ_NEXT(sub_field);
@@ -208,11 +439,34 @@ static qd_parsed_field_t *qd_parse_dup_internal(const qd_parsed_field_t *field,
     dup->typed_iter  = qd_iterator_dup(field->typed_iter);
     dup->parse_error = field->parse_error;
 
-    qd_parsed_field_t *child = DEQ_HEAD(field->children);
-    while (child) {
-        qd_parsed_field_t *dup_child = qd_parse_dup_internal(child, field);
-        DEQ_INSERT_TAIL(dup->children, dup_child);
-        child = DEQ_NEXT(child);
+    if (field->arena && !field->index) {
+        //
+        // The children have not been parsed yet.  Parse them straight into the
+        // duplicate; the original may be shared with other threads so it is
+        // not touched.
+        //
+        qd_iterator_storage_t storage;
+        qd_iterator_t *iter = qd_iterator_init_dup(&storage, field->raw_iter);
+        qd_iterator_reset(iter);
+        for (uint32_t idx = 0; idx < field->count; idx++) {
+            qd_parsed_field_t *dup_child = qd_parse_internal(iter, dup);
+            if (!dup_child)
+                break;
+            DEQ_INSERT_TAIL(dup->children, dup_child);
+        }
+        qd_iterator_free(iter);
+    } else if (field->arena) {
+        for (uint32_t idx = 0; idx < field->count; idx++) {
+            qd_parsed_field_t *dup_child = qd_parse_dup_internal(field->index[idx], dup);
+            DEQ_INSERT_TAIL(dup->children, dup_child);
+        }
+    } else {
+        qd_parsed_field_t *child = DEQ_HEAD(field->children);
+        while (child) {
+            qd_parsed_field_t *dup_child = qd_parse_dup_internal(child, dup);
+            DEQ_INSERT_TAIL(dup->children, dup_child);
+            child = DEQ_NEXT(child);
+        }
     }
 
     return dup;
@@ -401,9 +655,42 @@ bool qd_parse_as_bool(qd_parsed_field_t *field)
 }
 
 
+static uint32_t qd_parse_child_count(const qd_parsed_field_t *field)
+{
+    return field->arena ? field->count : DEQ_SIZE(field->children);
+}
+
+
+//
+// Return the child at position idx.  Compound fields are usually read entry by
+// entry, so the children are copied into an array the first time one is asked
+// for by position rather than walking the list on every access.
+//
+static qd_parsed_field_t *qd_parse_child(qd_parsed_field_t *field, uint32_t idx)
+{
+    uint32_t size = qd_parse_child_count(field);
+    if (idx >= size)
+        return 0;
+
+    if (!field->index && field->arena) {
+        if (!qd_parse_arena_children(field))
+            return 0;
+    } else if (!field->index) {
+        field->index = NEW_PTR_ARRAY(qd_parsed_field_t, size);
+        if (!field->index)
+            return 0;
+        uint32_t i = 0;
+        for (qd_parsed_field_t *child = DEQ_HEAD(field->children); child; child = DEQ_NEXT(child))
+            field->index[i++] = child;
+    }
+
+    return field->index[idx];
+}
+
+
 uint32_t qd_parse_sub_count(qd_parsed_field_t *field)
 {
-    uint32_t count = DEQ_SIZE(field->children);
+    uint32_t count = qd_parse_child_count(field);
 
     if (field->tag == QD_AMQP_MAP8 || field->tag == QD_AMQP_MAP32)
         count = count >> 1;
@@ -417,14 +704,7 @@ qd_parsed_field_t *qd_parse_sub_key(qd_parsed_field_t *field, uint32_t idx)
     if (field->tag != QD_AMQP_MAP8 && field->tag != QD_AMQP_MAP32)
         return 0;
 
-    idx = idx << 1;
-    qd_parsed_field_t *key = DEQ_HEAD(field->children);
-    while (idx && key) {
-        idx--;
-        key = DEQ_NEXT(key);
-    }
-
-    return key;
+    return qd_parse_child(field, idx << 1);
 }
 
 
@@ -433,13 +713,7 @@ qd_parsed_field_t *qd_parse_sub_value(qd_parsed_field_t *field, uint32_t idx)
     if (field->tag == QD_AMQP_MAP8 || field->tag == QD_AMQP_MAP32)
         idx = (idx << 1) + 1;
 
-    qd_parsed_field_t *key = DEQ_HEAD(field->children);
-    while (idx && key) {
-        idx--;
-        key = DEQ_NEXT(key);
-    }
-
-    return key;
+    return qd_parse_child(field, idx);
 }
 
 
@@ -457,14 +731,76 @@ int qd_parse_is_list(qd_parsed_field_t *field)
 
 int qd_parse_is_scalar(qd_parsed_field_t *field)
 {
-    return DEQ_SIZE(field->children) == 0;
+    return qd_parse_child_count(field) == 0;
+}
+
+
+//
+// Index the keys of a map by the djb2 hash of their raw bytes, the same hash
+// qd_iterator_hash_view computes, in a table at most half full.  Keys are
+// inserted in map order so a duplicated key resolves to its first entry, as a
+// linear scan would.
+//
+static bool qd_parse_index_keys(qd_parsed_field_t *field, uint32_t count)
+{
+    uint32_t slots = 4;
+    while (slots < count * 2)
+        slots <<= 1;
+
+    if (field->arena)
+        field->keys = (qd_parsed_key_slot_t*) qd_parse_arena_alloc(field->arena, slots * sizeof(qd_parsed_key_slot_t));
+    else
+        field->keys = NEW_ARRAY(qd_parsed_key_slot_t, slots);
+    if (!field->keys)
+        return false;
+    memset(field->keys, 0, slots * sizeof(qd_parsed_key_slot_t));
+    field->key_mask = slots - 1;
+
+    for (uint32_t idx = 0; idx < count; idx++) {
+        qd_parsed_field_t *sub  = qd_parse_sub_key(field, idx);
+        qd_iterator_t     *iter = sub ? qd_parse_raw(sub) : 0;
+        if (!iter)
+            break;
+
+        uint32_t hash = qd_iterator_hash_view(iter);
+        uint32_t slot = hash & field->key_mask;
+        while (field->keys[slot].entry)
+            slot = (slot + 1) & field->key_mask;
+        field->keys[slot].hash  = hash;
+        field->keys[slot].entry = idx + 1;
+    }
+
+    return true;
 }
 
 
+//
+// Maps with only a handful of entries are cheaper to scan than to index.
+//
+#define QD_PARSE_KEY_INDEX_MIN 8
+
 qd_parsed_field_t *qd_parse_value_by_key(qd_parsed_field_t *field, const char *key)
 {
     uint32_t count = qd_parse_sub_count(field);
 
+    if (count >= QD_PARSE_KEY_INDEX_MIN && qd_parse_is_map(field) &&
+        (field->keys || qd_parse_index_keys(field, count))) {
+        uint32_t hash = 5381;
+        for (const unsigned char *c = (const unsigned char*) key; *c; c++)
+            hash = ((hash << 5) + hash) + (uint32_t) *c; /* hash * 33 + c */
+
+        uint32_t slot = hash & field->key_mask;
+        while (field->keys[slot].entry) {
+            if (field->keys[slot].hash == hash) {
+                uint32_t idx = field->keys[slot].entry - 1;
+                if (qd_iterator_equal(qd_parse_raw(qd_parse_sub_key(field, idx)), (const unsigned char*) key))
+                    return qd_parse_sub_value(field, idx);
+            }
+            slot = (slot + 1) & field->key_mask;
+        }
+        return 0;
+    }
+
     for (uint32_t idx = 0; idx < count; idx++) {
         qd_parsed_field_t *sub  = qd_parse_sub_key(field, idx);
         if (!sub)
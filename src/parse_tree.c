@@ -0,0 +1,390 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <qpid/dispatch/parse_tree.h>
+#include <qpid/dispatch/ctools.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEPARATORS   "./"
+#define STACK_TEXT   256
+#define STACK_TOKENS 16
+
+//
+// Each node stands for one token position.  Literal tokens are kept in a
+// sorted array of children; the two wildcards have a child of their own.
+//
+typedef struct qd_parse_node_t qd_parse_node_t;
+
+struct qd_parse_node_t {
+    char             *token;
+    qd_parse_node_t **children;
+    uint32_t          child_count;
+    qd_parse_node_t  *star;     // '*' - exactly one token
+    qd_parse_node_t  *hash;     // '#' - zero or more tokens
+    void             *payload;
+};
+
+struct qd_parse_tree_t {
+    qd_parse_node_t *root;
+    size_t           size;
+};
+
+
+//
+// A tokenized pattern or address.  Short ones are held without allocating.
+//
+typedef struct {
+    char   text_storage[STACK_TEXT];
+    char  *token_storage[STACK_TOKENS];
+    char  *text;
+    char **token;
+    int    count;
+} qd_tokens_t;
+
+
+static bool is_separator(char c)
+{
+    return c && strchr(SEPARATORS, (int) c);
+}
+
+
+static char *tokens_text(qd_tokens_t *t, size_t length)
+{
+    t->text  = length < STACK_TEXT ? t->text_storage : (char*) malloc(length + 1);
+    t->token = t->token_storage;
+    t->count = 0;
+    return t->text;
+}
+
+
+static void tokens_split(qd_tokens_t *t, size_t length)
+{
+    int slots = 1;
+    t->text[length] = '\0';
+    for (char *p = t->text; *p; p++)
+        if (is_separator(*p))
+            slots++;
+
+    if (slots > STACK_TOKENS)
+        t->token = NEW_ARRAY(char*, slots);
+
+    char *p = t->text;
+    t->token[t->count++] = p;
+    for (; *p; p++) {
+        if (is_separator(*p)) {
+            *p = '\0';
+            t->token[t->count++] = p + 1;
+        }
+    }
+}
+
+
+static void tokens_fini(qd_tokens_t *t)
+{
+    if (t->text != t->text_storage)
+        free(t->text);
+    if (t->token != t->token_storage)
+        free(t->token);
+}
+
+
+//
+// Tokenize a pattern, collapsing runs of '#' which match the same as one.
+//
+static void tokens_pattern(qd_tokens_t *t, const char *pattern)
+{
+    size_t length = strlen(pattern);
+    memcpy(tokens_text(t, length), pattern, length);
+    tokens_split(t, length);
+
+    int out = 0;
+    for (int in = 0; in < t->count; in++) {
+        if (out > 0 && strcmp(t->token[in], "#") == 0 && strcmp(t->token[out - 1], "#") == 0)
+            continue;
+        t->token[out++] = t->token[in];
+    }
+    t->count = out;
+}
+
+
+static qd_parse_node_t *qd_parse_node(const char *token)
+{
+    qd_parse_node_t *node = NEW(qd_parse_node_t);
+    ZERO(node);
+    node->token = token ? strdup(token) : 0;
+    return node;
+}
+
+
+static void qd_parse_node_free(qd_parse_node_t *node)
+{
+    if (!node)
+        return;
+    for (uint32_t i = 0; i < node->child_count; i++)
+        qd_parse_node_free(node->children[i]);
+    qd_parse_node_free(node->star);
+    qd_parse_node_free(node->hash);
+    free(node->children);
+    free(node->token);
+    free(node);
+}
+
+
+static bool qd_parse_node_empty(const qd_parse_node_t *node)
+{
+    return !node->payload && !node->child_count && !node->star && !node->hash;
+}
+
+
+static uint32_t qd_parse_node_child(const qd_parse_node_t *node, const char *token, bool *found)
+{
+    uint32_t lo = 0;
+    uint32_t hi = node->child_count;
+
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        int      cmp = strcmp(node->children[mid]->token, token);
+        if (cmp == 0) {
+            *found = true;
+            return mid;
+        }
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = false;
+    return lo;
+}
+
+
+//
+// Return the node for a tokenized pattern, creating the path to it if asked.
+//
+static qd_parse_node_t *qd_parse_node_walk(qd_parse_node_t *node, const qd_tokens_t *t, bool create)
+{
+    for (int i = 0; i < t->count && node; i++) {
+        const char        *token = t->token[i];
+        qd_parse_node_t  **wild  = 0;
+
+        if (strcmp(token, "*") == 0)
+            wild = &node->star;
+        else if (strcmp(token, "#") == 0)
+            wild = &node->hash;
+
+        if (wild) {
+            if (!*wild && create)
+                *wild = qd_parse_node(token);
+            node = *wild;
+            continue;
+        }
+
+        bool     found;
+        uint32_t idx = qd_parse_node_child(node, token, &found);
+        if (!found) {
+            if (!create)
+                return 0;
+            node->children = (qd_parse_node_t**) realloc(node->children, sizeof(qd_parse_node_t*) * (node->child_count + 1));
+            memmove(&node->children[idx + 1], &node->children[idx], sizeof(qd_parse_node_t*) * (node->child_count - idx));
+            node->children[idx] = qd_parse_node(token);
+            node->child_count++;
+        }
+        node = node->children[idx];
+    }
+
+    return node;
+}
+
+
+static void *qd_parse_node_remove(qd_parse_node_t *node, const qd_tokens_t *t, int i)
+{
+    if (i == t->count) {
+        void *payload = node->payload;
+        node->payload = 0;
+        return payload;
+    }
+
+    const char       *token = t->token[i];
+    qd_parse_node_t **slot  = 0;
+    uint32_t          idx   = 0;
+    bool              found = false;
+
+    if (strcmp(token, "*") == 0)
+        slot = &node->star;
+    else if (strcmp(token, "#") == 0)
+        slot = &node->hash;
+    else {
+        idx = qd_parse_node_child(node, token, &found);
+        if (found)
+            slot = &node->children[idx];
+    }
+
+    if (!slot || !*slot)
+        return 0;
+
+    qd_parse_node_t *child   = *slot;
+    void            *payload = qd_parse_node_remove(child, t, i + 1);
+
+    if (qd_parse_node_empty(child)) {
+        qd_parse_node_free(child);
+        if (found) {
+            node->child_count--;
+            memmove(&node->children[idx], &node->children[idx + 1], sizeof(qd_parse_node_t*) * (node->child_count - idx));
+        } else
+            *slot = 0;
+    }
+
+    return payload;
+}
+
+
+static const qd_parse_node_t *qd_parse_node_match(const qd_parse_node_t *node, char **token, int count)
+{
+    const qd_parse_node_t *match;
+
+    if (count == 0) {
+        if (node->payload)
+            return node;
+        return node->hash ? qd_parse_node_match(node->hash, token, 0) : 0;
+    }
+
+    bool     found;
+    uint32_t idx = qd_parse_node_child(node, token[0], &found);
+    if (found && (match = qd_parse_node_match(node->children[idx], token + 1, count - 1)))
+        return match;
+
+    if (node->star && (match = qd_parse_node_match(node->star, token + 1, count - 1)))
+        return match;
+
+    if (node->hash) {
+        for (int skip = 0; skip <= count; skip++)
+            if ((match = qd_parse_node_match(node->hash, token + skip, count - skip)))
+                return match;
+    }
+
+    return 0;
+}
+
+
+qd_parse_tree_t *qd_parse_tree(void)
+{
+    qd_parse_tree_t *tree = NEW(qd_parse_tree_t);
+    tree->root = qd_parse_node(0);
+    tree->size = 0;
+    return tree;
+}
+
+
+void qd_parse_tree_free(qd_parse_tree_t *tree)
+{
+    if (!tree)
+        return;
+    qd_parse_node_free(tree->root);
+    free(tree);
+}
+
+
+qd_error_t qd_parse_tree_add_pattern(qd_parse_tree_t *tree, const char *pattern, void *payload)
+{
+    qd_tokens_t tokens;
+    tokens_pattern(&tokens, pattern);
+
+    qd_parse_node_t *node  = qd_parse_node_walk(tree->root, &tokens, true);
+    qd_error_t       error = QD_ERROR_NONE;
+    if (node->payload)
+        error = QD_ERROR_ALREADY_EXISTS;
+    else {
+        node->payload = payload;
+        tree->size++;
+    }
+
+    tokens_fini(&tokens);
+    return error;
+}
+
+
+void *qd_parse_tree_remove_pattern(qd_parse_tree_t *tree, const char *pattern)
+{
+    qd_tokens_t tokens;
+    tokens_pattern(&tokens, pattern);
+
+    void *payload = qd_parse_node_remove(tree->root, &tokens, 0);
+    if (payload)
+        tree->size--;
+
+    tokens_fini(&tokens);
+    return payload;
+}
+
+
+void *qd_parse_tree_get_pattern(qd_parse_tree_t *tree, const char *pattern)
+{
+    qd_tokens_t tokens;
+    tokens_pattern(&tokens, pattern);
+
+    qd_parse_node_t *node = qd_parse_node_walk(tree->root, &tokens, false);
+
+    tokens_fini(&tokens);
+    return node ? node->payload : 0;
+}
+
+
+bool qd_parse_tree_retrieve_match(qd_parse_tree_t *tree, qd_iterator_t *value, void **payload)
+{
+    *payload = 0;
+    if (!tree->size)
+        return false;
+
+    qd_tokens_t tokens;
+    size_t      length = qd_iterator_length(value);
+    length = qd_iterator_ncopy(value, (unsigned char*) tokens_text(&tokens, length), length);
+    tokens_split(&tokens, length);
+
+    const qd_parse_node_t *match = qd_parse_node_match(tree->root, tokens.token, tokens.count);
+    if (match)
+        *payload = match->payload;
+
+    tokens_fini(&tokens);
+    qd_iterator_reset(value);
+    return !!match;
+}
+
+
+bool qd_parse_tree_is_pattern(const char *text)
+{
+    const char *token = text;
+
+    while (true) {
+        if ((*token == '*' || *token == '#') && (token[1] == '\0' || is_separator(token[1])))
+            return true;
+        while (*token && !is_separator(*token))
+            token++;
+        if (!*token)
+            return false;
+        token++;
+    }
+}
+
+
+size_t qd_parse_tree_size(const qd_parse_tree_t *tree)
+{
+    return tree ? tree->size : 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "path_trace.h"
+#include "message_private.h"
+#include <qpid/dispatch/ctools.h>
+#include <qpid/dispatch/log.h>
+#include <qpid/dispatch/threading.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// OTLP span kinds
+#define SPAN_KIND_INTERNAL 1
+#define SPAN_KIND_PRODUCER 4
+#define SPAN_KIND_CONSUMER 5
+
+bool qd_path_trace_on = false;
+
+static FILE        *trace_file = 0;
+static sys_mutex_t *trace_lock = 0;
+static long         trace_sample_rate = 0;
+static char        *trace_resource = 0;    // Encoded resource of every line
+
+// Per-thread sampling countdown and span id generator
+static __thread long     sample_countdown;
+static __thread uint64_t id_state;
+
+
+typedef struct {
+    const char *key;
+    const char *string;     // The value if not null
+    int64_t     value;      // The value otherwise
+} span_attr_t;
+
+
+uint64_t qd_path_trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/**
+ * A random non-zero id, from a xorshift generator per thread.
+ */
+static uint64_t new_id(void)
+{
+    if (id_state == 0)
+        id_state = (realtime_ns() ^ ((uint64_t) getpid() << 32) ^ (uint64_t) (uintptr_t) &id_state) | 1;
+    uint64_t x;
+    do {
+        id_state ^= id_state >> 12;
+        id_state ^= id_state << 25;
+        id_state ^= id_state >> 27;
+        x = id_state * 0x2545F4914F6CDD1DULL;
+    } while (x == 0);
+    return x;
+}
+
+
+static void write_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+
+qd_error_t qd_path_trace_open(const char *path, long sample_rate, const char *router_id)
+{
+    qd_path_trace_close();
+    if (sample_rate < 0)
+        return qd_error(QD_ERROR_CONFIG, "pathTraceSampleRate must not be negative");
+
+    FILE *f = fopen(path, "a");
+    if (!f)
+        return qd_error_errno(errno, "Cannot open path trace file '%s'", path);
+    setvbuf(f, 0, _IOLBF, 0);
+
+    //
+    // The resource part of the lines is the same for every span, encode it once.
+    //
+    char   *resource = 0;
+    size_t  size     = 0;
+    FILE   *r        = open_memstream(&resource, &size);
+    fputs("{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+          "{\"key\":\"service.name\",\"value\":{\"stringValue\":\"qdrouterd\"}},"
+          "{\"key\":\"service.instance.id\",\"value\":{\"stringValue\":", r);
+    write_json_string(r, router_id ? router_id : "");
+    fputs("}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"qpid-dispatch\"},\"spans\":[", r);
+    fclose(r);
+
+    trace_file        = f;
+    trace_lock        = sys_mutex();
+    trace_sample_rate = sample_rate;
+    trace_resource    = resource;
+    qd_path_trace_on  = true;
+    qd_log(qd_log_source("ROUTER"), QD_LOG_INFO, "Writing path trace spans to %s, sampling 1 in %ld messages",
+           path, sample_rate);
+    return QD_ERROR_NONE;
+}
+
+
+void qd_path_trace_close(void)
+{
+    if (!trace_file)
+        return;
+    qd_path_trace_on = false;
+    fclose(trace_file);
+    sys_mutex_free(trace_lock);
+    free(trace_resource);
+    trace_file     = 0;
+    trace_lock     = 0;
+    trace_resource = 0;
+}
+
+
+static void write_span(const qd_path_span_t *ctx, const char *name, int kind, uint64_t span_id, uint64_t parent_id,
+                       uint64_t start_ns, uint64_t end_ns, const span_attr_t *attrs, int attr_count)
+{
+    //
+    // Convert the monotonic times to wall clock times
+    //
+    uint64_t offset = realtime_ns() - qd_path_trace_now();
+
+    sys_mutex_lock(trace_lock);
+    FILE *f = trace_file;
+    fputs(trace_resource, f);
+    fprintf(f, "{\"traceId\":\"%016"PRIx64"%016"PRIx64"\",\"spanId\":\"%016"PRIx64"\",",
+            ctx->trace_hi, ctx->trace_lo, span_id);
+    if (parent_id)
+        fprintf(f, "\"parentSpanId\":\"%016"PRIx64"\",", parent_id);
+    fprintf(f, "\"name\":\"%s\",\"kind\":%d,\"startTimeUnixNano\":\"%"PRIu64"\",\"endTimeUnixNano\":\"%"PRIu64"\",\"attributes\":[",
+            name, kind, start_ns + offset, end_ns + offset);
+    for (int i = 0; i < attr_count; i++) {
+        fprintf(f, "%s{\"key\":\"%s\",\"value\":{", i ? "," : "", attrs[i].key);
+        if (attrs[i].string) {
+            fputs("\"stringValue\":", f);
+            write_json_string(f, attrs[i].string);
+        } else
+            fprintf(f, "\"intValue\":\"%"PRId64"\"", attrs[i].value);
+        fputs("}}", f);
+    }
+    fputs("]}]}]}]}\n", f);
+    sys_mutex_unlock(trace_lock);
+}
+
+
+void qd_path_trace_adopt(qd_message_t *msg, qd_parsed_field_t *span, bool entered)
+{
+    qd_message_content_t *content = MSG_CONTENT(msg);
+    qd_path_span_t        ctx;
+
+    ZERO(&ctx);
+    if (span) {
+        if (!qd_parse_is_list(span) || qd_parse_sub_count(span) != 3)
+            return;
+        ctx.trace_hi  = qd_parse_as_ulong(qd_parse_sub_value(span, 0));
+        ctx.trace_lo  = qd_parse_as_ulong(qd_parse_sub_value(span, 1));
+        ctx.parent_id = qd_parse_as_ulong(qd_parse_sub_value(span, 2));
+        ctx.span_id   = ctx.parent_id;
+    } else {
+        if (!entered || !qd_path_trace_on || trace_sample_rate == 0)
+            return;
+        if (sample_countdown > 0 && --sample_countdown > 0)
+            return;
+        sample_countdown = trace_sample_rate;
+        ctx.trace_hi = new_id();
+        ctx.trace_lo = new_id();
+    }
+
+    if (qd_path_trace_on) {
+        ctx.span_id = new_id();
+        ctx.traced  = true;
+    }
+
+    if (!content->path_span)
+        content->path_span = NEW(qd_path_span_t);
+    *content->path_span = ctx;
+}
+
+
+void qd_path_trace_received(qd_message_t *msg, uint64_t connection_id, uint64_t link_id)
+{
+    qd_message_content_t *content = MSG_CONTENT(msg);
+    qd_path_span_t       *ctx     = content->path_span;
+    if (!ctx || !ctx->traced)
+        return;
+
+    span_attr_t attrs[] = {{"qd.connection.id", 0, (int64_t) connection_id},
+                           {"qd.link.id",       0, (int64_t) link_id}};
+    uint64_t    now     = qd_path_trace_now();
+    write_span(ctx, "receive", SPAN_KIND_CONSUMER, ctx->span_id, ctx->parent_id,
+               content->receive_start_ns ? content->receive_start_ns : now, now, attrs, 2);
+}
+
+
+void qd_path_trace_routed(qd_message_t *msg, uint64_t start_ns, const char *address, int fanout)
+{
+    qd_path_span_t *ctx = MSG_CONTENT(msg)->path_span;
+    if (!ctx || !ctx->traced)
+        return;
+
+    span_attr_t attrs[] = {{"qd.address", address ? address : "", 0},
+                           {"qd.fanout",  0, fanout}};
+    write_span(ctx, "route", SPAN_KIND_INTERNAL, new_id(), ctx->span_id, start_ns, qd_path_trace_now(), attrs, 2);
+}
+
+
+void qd_path_trace_sent(qd_message_t *msg, uint64_t start_ns, uint64_t connection_id, uint64_t link_id)
+{
+    qd_path_span_t *ctx = MSG_CONTENT(msg)->path_span;
+    if (!ctx || !ctx->traced)
+        return;
+
+    span_attr_t attrs[] = {{"qd.connection.id", 0, (int64_t) connection_id},
+                           {"qd.link.id",       0, (int64_t) link_id}};
+    uint64_t    now     = qd_path_trace_now();
+    write_span(ctx, "send", SPAN_KIND_PRODUCER, new_id(), ctx->span_id, start_ns ? start_ns : now, now, attrs, 2);
+}
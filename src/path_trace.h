@@ -0,0 +1,84 @@
+#ifndef __path_trace_h__
+#define __path_trace_h__ 1
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**@file
+ * Sampled message path tracing.
+ *
+ * One in pathTraceSampleRate messages entering the network at a router is
+ * given a trace context, carried from router to router in the QD_MA_SPAN
+ * message annotation.  Each router with a pathTraceFile writes spans for the
+ * message's receive, core routing and send to the file, one OTLP/JSON
+ * ExportTraceServiceRequest per line, ready for a collector's OTLP JSON file
+ * receiver.  A router's receive span is the parent of its routing and send
+ * spans and the child of the previous router's receive span.  Routers without
+ * a pathTraceFile pass the context on unchanged.
+ *
+ * Times passed in are CLOCK_MONOTONIC nanoseconds, as from qd_path_trace_now().
+ */
+
+#include <qpid/dispatch/error.h>
+#include <qpid/dispatch/message.h>
+#include <qpid/dispatch/parse.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Trace context of a sampled message, held by its content. */
+typedef struct qd_path_span_t {
+    uint64_t trace_hi;      ///< 128 bit trace id
+    uint64_t trace_lo;
+    uint64_t parent_id;     ///< Receive span of the previous router, 0 at the first
+    uint64_t span_id;       ///< This router's receive span; passed on as the next parent
+    bool     traced;        ///< Spans are written here, else the context is only passed on
+} qd_path_span_t;
+
+/**
+ * Start writing spans to the file at path, appending to it.  One in sample_rate
+ * messages that enter the network here start a new trace; 0 only continues
+ * traces started elsewhere.
+ */
+qd_error_t qd_path_trace_open(const char *path, long sample_rate, const char *router_id);
+
+void qd_path_trace_close(void);
+
+extern bool qd_path_trace_on;
+
+/** True if this router writes spans. */
+static inline bool qd_path_trace_enabled(void) { return qd_path_trace_on; }
+
+uint64_t qd_path_trace_now(void);
+
+/**
+ * Give an arriving message its trace context: the one it carries in span, the
+ * value of its QD_MA_SPAN annotation, or a new one if entered is set and the
+ * message is sampled.  entered is true for messages entering the network here.
+ */
+void qd_path_trace_adopt(qd_message_t *msg, qd_parsed_field_t *span, bool entered);
+
+/** Write the receive span of a traced message that is being handed to the core. */
+void qd_path_trace_received(qd_message_t *msg, uint64_t connection_id, uint64_t link_id);
+
+/** Write the routing span of a traced message, from start_ns until now. */
+void qd_path_trace_routed(qd_message_t *msg, uint64_t start_ns, const char *address, int fanout);
+
+/** Write the send span of a traced message, from start_ns until now. */
+void qd_path_trace_sent(qd_message_t *msg, uint64_t start_ns, uint64_t connection_id, uint64_t link_id);
+
+#endif
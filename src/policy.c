@@ -23,9 +23,13 @@
 #include "policy_internal.h"
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 #include "dispatch_private.h"
 #include "qpid/dispatch/container.h"
 #include "qpid/dispatch/server.h"
+#include "qpid/dispatch/hash.h"
+#include "qpid/dispatch/threading.h"
 #include <proton/message.h>
 #include <proton/condition.h>
 #include <proton/connection.h>
@@ -53,6 +57,339 @@ static char* CONNECTION_DISALLOWED         = "connection disallowed by local pol
 static char* SESSION_DISALLOWED            = "session disallowed by local policy";
 static char* LINK_DISALLOWED               = "link disallowed by local policy";
 
+//
+// Link name allow lists.
+// A settings sources or targets CSV list is compiled once, when the settings
+// are loaded, into a trie of its names.  A name ending in the wildcard marks
+// its node as a prefix match; any other name marks its node as an exact
+// match; a name starting with the wildcard matches everything.  Approving a
+// link is then a walk of the proposed name, and of the name with the user
+// substituted, without copying the list or allocating.
+//
+// Size of user-name-substituted proposed string.
+#define QPALN_USERBUFSIZE 300
+// C in the CSV string
+#define QPALN_COMMA_SEP ','
+// Wildcard character
+#define QPALN_WILDCARD '*'
+// User name substitution token
+#define QPALN_USER "${user}"
+
+#define QPALN_EXACT  0x01
+#define QPALN_PREFIX 0x02
+
+typedef struct qd_policy_trie_node_t {
+    char     c;
+    uint8_t  flags;
+    uint32_t child;     // First child, 0 if none
+    uint32_t sibling;   // Next sibling, 0 if none
+} qd_policy_trie_node_t;
+
+struct qd_policy_name_trie_t {
+    sys_atomic_t           ref_count;
+    bool                   match_all;   // A name starts with the wildcard
+    bool                   has_user;    // Some name contains QPALN_USER
+    uint32_t               n_nodes;
+    uint32_t               capacity;
+    qd_policy_trie_node_t *nodes;       // nodes[0] is the root
+};
+
+
+static void qd_policy_name_trie_add(qd_policy_name_trie_t *trie, const char *name, size_t len)
+{
+    if (name[0] == QPALN_WILDCARD) {
+        trie->match_all = true;
+        return;
+    }
+    uint8_t flag = QPALN_EXACT;
+    if (name[len - 1] == QPALN_WILDCARD) {
+        flag = QPALN_PREFIX;
+        len--;
+    }
+    uint32_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t c = trie->nodes[n].child;
+        while (c && trie->nodes[c].c != name[i])
+            c = trie->nodes[c].sibling;
+        if (!c) {
+            if (trie->n_nodes == trie->capacity) {
+                trie->capacity *= 2;
+                trie->nodes = (qd_policy_trie_node_t*) realloc(trie->nodes, trie->capacity * sizeof(qd_policy_trie_node_t));
+            }
+            c = trie->n_nodes++;
+            trie->nodes[c].c       = name[i];
+            trie->nodes[c].flags   = 0;
+            trie->nodes[c].child   = 0;
+            trie->nodes[c].sibling = trie->nodes[n].child;
+            trie->nodes[n].child   = c;
+        }
+        n = c;
+    }
+    trie->nodes[n].flags |= flag;
+}
+
+
+/** Compile a CSV allow list.  Never returns null. */
+qd_policy_name_trie_t *qd_policy_name_trie(const char *allowed)
+{
+    qd_policy_name_trie_t *trie = NEW(qd_policy_name_trie_t);
+    ZERO(trie);
+    sys_atomic_init(&trie->ref_count, 1);
+    trie->capacity = 64;
+    trie->nodes    = (qd_policy_trie_node_t*) calloc(trie->capacity, sizeof(qd_policy_trie_node_t));
+    trie->n_nodes  = 1;
+
+    const char *name = allowed ? allowed : "";
+    while (*name) {
+        const char *end = strchr(name, QPALN_COMMA_SEP);
+        size_t len = end ? (size_t) (end - name) : strlen(name);
+        if (len > 0) {
+            qd_policy_name_trie_add(trie, name, len);
+            for (size_t i = 0; i + strlen(QPALN_USER) <= len && !trie->has_user; i++)
+                if (strncmp(name + i, QPALN_USER, strlen(QPALN_USER)) == 0)
+                    trie->has_user = true;
+        }
+        name += len;
+        if (*name)
+            name++;
+    }
+    return trie;
+}
+
+
+static qd_policy_name_trie_t *qd_policy_name_trie_incref(qd_policy_name_trie_t *trie)
+{
+    if (trie)
+        sys_atomic_inc(&trie->ref_count);
+    return trie;
+}
+
+
+void qd_policy_name_trie_decref(qd_policy_name_trie_t *trie)
+{
+    if (trie && sys_atomic_dec(&trie->ref_count) == 1) {
+        sys_atomic_destroy(&trie->ref_count);
+        free(trie->nodes);
+        free(trie);
+    }
+}
+
+
+static bool qd_policy_name_trie_walk(const qd_policy_name_trie_t *trie, const char *name)
+{
+    uint32_t n = 0;
+    for (;;) {
+        const qd_policy_trie_node_t *node = &trie->nodes[n];
+        if (node->flags & QPALN_PREFIX)
+            return true;
+        if (!*name)
+            return node->flags & QPALN_EXACT;
+        n = node->child;
+        while (n && trie->nodes[n].c != *name)
+            n = trie->nodes[n].sibling;
+        if (!n)
+            return false;
+        name++;
+    }
+}
+
+
+bool qd_policy_name_trie_match(const qd_policy_name_trie_t *trie, const char *username, const char *proposed)
+{
+    if (!trie || !proposed || !*proposed)
+        return false;
+    if (trie->match_all || qd_policy_name_trie_walk(trie, proposed))
+        return true;
+    if (!trie->has_user || !username)
+        return false;
+    // Do reverse user substitution into proposed
+    char substbuf[QPALN_USERBUFSIZE];
+    char *prop2 = _qd_policy_link_user_name_subst(username, proposed, substbuf, QPALN_USERBUFSIZE - 1);
+    substbuf[QPALN_USERBUFSIZE - 1] = 0;
+    return prop2 && qd_policy_name_trie_walk(trie, prop2);
+}
+
+
+//
+// Remote host trees.
+// Python compiles each vhost user group's remoteHosts list and hands the
+// address ranges to C, where they are decomposed into CIDR prefixes in a
+// binary trie per address family.  A numeric host address is then matched by
+// walking at most one node per address bit, without the python lock.
+//
+#define QPHT_IPV4 0     // Root node of the IPv4 tree
+#define QPHT_IPV6 1     // Root node of the IPv6 tree
+
+typedef struct qd_policy_host_node_t {
+    uint32_t child[2];  // 0 if none
+    bool     full;      // Every address below this prefix matches
+} qd_policy_host_node_t;
+
+struct qd_policy_host_tree_t {
+    DEQ_LINKS(qd_policy_host_tree_t);
+    qd_hash_handle_t      *handle;
+    long                   ccounts;     // The vhost the tree belongs to
+    bool                   match_all;   // The list has the wildcard
+    uint32_t               n_nodes;
+    uint32_t               capacity;
+    qd_policy_host_node_t *nodes;
+};
+DEQ_DECLARE(qd_policy_host_tree_t, qd_policy_host_tree_list_t);
+
+
+static inline int qd_policy_host_bit(const unsigned char *addr, int bit)
+{
+    return (addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+
+/** True if bits [bit, nbits) of addr are all equal to value */
+static bool qd_policy_host_bits_are(const unsigned char *addr, int bit, int nbits, int value)
+{
+    for (; bit < nbits; bit++)
+        if (qd_policy_host_bit(addr, bit) != value)
+            return false;
+    return true;
+}
+
+
+/** Add the part of [lo, hi] below node n, at depth bit.
+ * A bound is tight while the prefix of n equals that bound's prefix.
+ */
+static void qd_policy_host_tree_add_range(qd_policy_host_tree_t *tree, uint32_t n, int bit, int nbits,
+                                          const unsigned char *lo, const unsigned char *hi,
+                                          bool lo_tight, bool hi_tight)
+{
+    if (tree->nodes[n].full)
+        return;
+    if ((!lo_tight || qd_policy_host_bits_are(lo, bit, nbits, 0)) &&
+        (!hi_tight || qd_policy_host_bits_are(hi, bit, nbits, 1))) {
+        tree->nodes[n].full = true;
+        return;
+    }
+    for (int b = 0; b < 2; b++) {
+        if ((lo_tight && b < qd_policy_host_bit(lo, bit)) || (hi_tight && b > qd_policy_host_bit(hi, bit)))
+            continue;
+        if (!tree->nodes[n].child[b]) {
+            if (tree->n_nodes == tree->capacity) {
+                tree->capacity *= 2;
+                tree->nodes = (qd_policy_host_node_t*) realloc(tree->nodes, tree->capacity * sizeof(qd_policy_host_node_t));
+            }
+            uint32_t c = tree->n_nodes++;
+            tree->nodes[c].child[0] = 0;
+            tree->nodes[c].child[1] = 0;
+            tree->nodes[c].full     = false;
+            tree->nodes[n].child[b] = c;
+        }
+        qd_policy_host_tree_add_range(tree, tree->nodes[n].child[b], bit + 1, nbits, lo, hi,
+                                      lo_tight && b == qd_policy_host_bit(lo, bit),
+                                      hi_tight && b == qd_policy_host_bit(hi, bit));
+    }
+}
+
+
+qd_policy_host_tree_t *qd_policy_host_tree(void)
+{
+    qd_policy_host_tree_t *tree = NEW(qd_policy_host_tree_t);
+    ZERO(tree);
+    DEQ_ITEM_INIT(tree);
+    tree->capacity = 64;
+    tree->nodes    = (qd_policy_host_node_t*) calloc(tree->capacity, sizeof(qd_policy_host_node_t));
+    tree->n_nodes  = 2;
+    return tree;
+}
+
+
+void qd_policy_host_tree_free(qd_policy_host_tree_t *tree)
+{
+    if (!tree)
+        return;
+    free(tree->nodes);
+    free(tree);
+}
+
+
+bool qd_policy_host_tree_add(qd_policy_host_tree_t *tree, const unsigned char *lo, const unsigned char *hi, size_t len)
+{
+    if (!lo) {
+        tree->match_all = true;
+        return true;
+    }
+    if (len != 4 && len != 16)
+        return false;
+    if (memcmp(lo, hi, len) > 0)
+        return false;
+    qd_policy_host_tree_add_range(tree, len == 4 ? QPHT_IPV4 : QPHT_IPV6, 0, len * 8, lo, hi, true, true);
+    return true;
+}
+
+
+bool qd_policy_host_tree_match(const qd_policy_host_tree_t *tree, const char *hostip)
+{
+    if (!tree || !hostip)
+        return false;
+    if (tree->match_all)
+        return true;
+    unsigned char addr[16];
+    uint32_t n     = QPHT_IPV4;
+    int      nbits = 32;
+    if (inet_pton(AF_INET, hostip, addr) != 1) {
+        if (inet_pton(AF_INET6, hostip, addr) != 1)
+            return false;
+        n     = QPHT_IPV6;
+        nbits = 128;
+    }
+    for (int bit = 0; ; bit++) {
+        if (tree->nodes[n].full)
+            return true;
+        if (bit == nbits)
+            return false;
+        n = tree->nodes[n].child[qd_policy_host_bit(addr, bit)];
+        if (!n)
+            return false;
+    }
+}
+
+
+//
+// Lookup cache.
+// The python lookup of a user's usergroup and settings depends only on the
+// vhost and user while the policy is unchanged, provided the remote host is
+// allowed for the usergroup.  Approvals are cached in C by vhost and user,
+// with the usergroup's host tree, and repeat connections from any allowed
+// host are opened without taking the python lock.  Python clears the cache
+// whenever the policy changes.
+//
+// Only vhosts whose per-user and per-host limits can't be reached before the
+// vhost limit are cached, so the vhost's connectionsCurrent is the only count
+// a cached open must check.  Cached opens are queued for python to add to its
+// connection accounting the next time it is entered.  So are the ids of closed
+// connections, which python removes after adding the opens: a storm of closes
+// doesn't take the python lock once per connection.
+//
+#define POLICY_CACHE_MAX 10000
+
+typedef struct qd_policy_cache_entry_t qd_policy_cache_entry_t;
+struct qd_policy_cache_entry_t {
+    DEQ_LINKS(qd_policy_cache_entry_t);
+    qd_hash_handle_t     *handle;
+    char                 *usergroup;
+    const qd_policy_host_tree_t *hosts;
+    qd_policy_settings_t  settings;
+};
+DEQ_DECLARE(qd_policy_cache_entry_t, qd_policy_cache_list_t);
+
+typedef struct qd_policy_cached_open_t qd_policy_cached_open_t;
+struct qd_policy_cached_open_t {
+    DEQ_LINKS(qd_policy_cached_open_t);
+    uint64_t                   conn_id;
+    char                      *conn_name;
+    char                      *user;
+    char                      *hostip;
+    qd_policy_denial_counts_t *counts;
+};
+DEQ_DECLARE(qd_policy_cached_open_t, qd_policy_cached_open_list_t);
+
 //
 // Policy configuration/statistics management interface
 //
@@ -68,6 +405,17 @@ struct qd_policy_t {
     int                   connections_processed;
     int                   connections_denied;
     int                   connections_current;
+                          // lookup cache
+    sys_mutex_t          *cache_lock;
+    qd_hash_t            *cache;
+    qd_policy_cache_list_t cache_entries;
+    qd_policy_cached_open_list_t cached_opens;
+    uint64_t             *closed_ids;     // Closed connections python has yet to remove
+    int                   closed_count;
+    int                   closed_capacity;
+                          // usergroup host trees, guarded by cache_lock
+    qd_hash_t            *host_trees;
+    qd_policy_host_tree_list_t host_tree_list;
 };
 
 /** Create the policy structure
@@ -84,12 +432,30 @@ qd_policy_t *qd_policy(qd_dispatch_t *qd)
     policy->connections_processed= 0;
     policy->connections_denied   = 0;
     policy->connections_current  = 0;
+    policy->cache_lock           = sys_mutex();
+    policy->cache                = qd_hash(10, 32, 0);
+    DEQ_INIT(policy->cache_entries);
+    DEQ_INIT(policy->cached_opens);
+    policy->closed_ids           = 0;
+    policy->closed_count         = 0;
+    policy->closed_capacity      = 0;
+    policy->host_trees           = qd_hash(10, 32, 0);
+    DEQ_INIT(policy->host_tree_list);
 
     qd_log(policy->log_source, QD_LOG_TRACE, "Policy Initialized");
     return policy;
 }
 
 
+static void qd_policy_cached_open_free(qd_policy_cached_open_t *open)
+{
+    free(open->conn_name);
+    free(open->user);
+    free(open->hostip);
+    free(open);
+}
+
+
 /** Free the policy structure
  * @param[in] policy pointer to the policy
  **/
@@ -97,6 +463,18 @@ void qd_policy_free(qd_policy_t *policy)
 {
     if (policy->policyDir)
         free(policy->policyDir);
+    qd_policy_cache_clear(policy);
+    qd_hash_free(policy->cache);
+    qd_policy_clear_host_trees(policy, 0);
+    qd_hash_free(policy->host_trees);
+    qd_policy_cached_open_t *open = DEQ_HEAD(policy->cached_opens);
+    while (open) {
+        DEQ_REMOVE_HEAD(policy->cached_opens);
+        qd_policy_cached_open_free(open);
+        open = DEQ_HEAD(policy->cached_opens);
+    }
+    free(policy->closed_ids);
+    sys_mutex_free(policy->cache_lock);
     free(policy);
 }
 
@@ -155,13 +533,320 @@ qd_error_t qd_policy_c_counts_refresh(long ccounts, qd_entity_t *entity)
     qd_policy_denial_counts_t *dc = (qd_policy_denial_counts_t*)ccounts;
     if (!qd_entity_set_long(entity, "sessionDenied", dc->sessionDenied) &&
         !qd_entity_set_long(entity, "senderDenied", dc->senderDenied) &&
-        !qd_entity_set_long(entity, "receiverDenied", dc->receiverDenied)
+        !qd_entity_set_long(entity, "receiverDenied", dc->receiverDenied) &&
+        !qd_entity_set_long(entity, "creditThrottled", dc->creditThrottled)
     )
         return QD_ERROR_NONE;
     return qd_error_code();
 }
 
 
+void qd_policy_c_counts_limits(long ccounts, long max_connections, long max_per_user, long max_per_host)
+{
+    qd_policy_denial_counts_t *dc = (qd_policy_denial_counts_t*)ccounts;
+    dc->maxConnections        = max_connections;
+    dc->maxConnectionsPerUser = max_per_user;
+    dc->maxConnectionsPerHost = max_per_host;
+}
+
+
+/** Return the cache key for a lookup, or 0 if the lookup can't be cached.
+ * The length keeps names containing the separator apart.
+ * The caller must free the key.
+ **/
+static char *qd_policy_cache_key(const char *vhost, const char *username)
+{
+    if (!vhost || !username)
+        return 0;
+    size_t size = strlen(vhost) + strlen(username) + 24;
+    char *key = (char*) malloc(size);
+    snprintf(key, size, "%zu:%s:%s", strlen(vhost), vhost, username);
+    return key;
+}
+
+
+/** Return the key of a usergroup's host tree.  The caller must free the key. */
+static char *qd_policy_host_tree_key(long ccounts, const char *usergroup)
+{
+    size_t size = strlen(usergroup) + 24;
+    char *key = (char*) malloc(size);
+    snprintf(key, size, "%lx:%s", (unsigned long) ccounts, usergroup);
+    return key;
+}
+
+
+// Caller must hold the cache_lock
+static qd_policy_host_tree_t *qd_policy_host_tree_lh(qd_policy_t *policy, long ccounts, const char *usergroup)
+{
+    char *key = qd_policy_host_tree_key(ccounts, usergroup);
+    qd_policy_host_tree_t *tree = 0;
+    qd_iterator_storage_t storage;
+    qd_iterator_t *iter = qd_iterator_init_string(&storage, key, ITER_VIEW_ALL);
+    qd_hash_retrieve(policy->host_trees, iter, (void**) &tree);
+    qd_iterator_free(iter);
+    free(key);
+    return tree;
+}
+
+
+static void qd_policy_settings_copy(qd_policy_settings_t *dst, const qd_policy_settings_t *src)
+{
+    *dst = *src;
+    dst->sources = src->sources ? strdup(src->sources) : 0;
+    dst->targets = src->targets ? strdup(src->targets) : 0;
+    qd_policy_name_trie_incref(dst->sourcesTrie);
+    qd_policy_name_trie_incref(dst->targetsTrie);
+}
+
+
+static void qd_policy_settings_release(qd_policy_settings_t *settings)
+{
+    free(settings->sources);
+    free(settings->targets);
+    qd_policy_name_trie_decref(settings->sourcesTrie);
+    qd_policy_name_trie_decref(settings->targetsTrie);
+}
+
+
+void qd_policy_settings_free(qd_policy_settings_t *settings)
+{
+    if (!settings)
+        return;
+    qd_policy_settings_release(settings);
+    free(settings);
+}
+
+
+// Caller must hold the cache_lock
+static void qd_policy_cache_clear_lh(qd_policy_t *policy)
+{
+    qd_policy_cache_entry_t *entry = DEQ_HEAD(policy->cache_entries);
+    while (entry) {
+        DEQ_REMOVE_HEAD(policy->cache_entries);
+        qd_hash_remove_by_handle(policy->cache, entry->handle);
+        qd_hash_handle_free(entry->handle);
+        free(entry->usergroup);
+        qd_policy_settings_release(&entry->settings);
+        free(entry);
+        entry = DEQ_HEAD(policy->cache_entries);
+    }
+}
+
+
+void qd_policy_cache_clear(qd_policy_t *policy)
+{
+    sys_mutex_lock(policy->cache_lock);
+    qd_policy_cache_clear_lh(policy);
+    sys_mutex_unlock(policy->cache_lock);
+}
+
+
+// Caller must hold the cache_lock
+static void qd_policy_host_tree_remove_lh(qd_policy_t *policy, qd_policy_host_tree_t *tree)
+{
+    DEQ_REMOVE(policy->host_tree_list, tree);
+    qd_hash_remove_by_handle(policy->host_trees, tree->handle);
+    qd_hash_handle_free(tree->handle);
+    qd_policy_host_tree_free(tree);
+}
+
+
+void qd_policy_set_host_tree(qd_policy_t *policy, long ccounts, const char *usergroup, qd_policy_host_tree_t *tree)
+{
+    char *key = qd_policy_host_tree_key(ccounts, usergroup);
+    sys_mutex_lock(policy->cache_lock);
+    // Cache entries point at the tree being replaced
+    qd_policy_cache_clear_lh(policy);
+    qd_policy_host_tree_t *old = qd_policy_host_tree_lh(policy, ccounts, usergroup);
+    if (old)
+        qd_policy_host_tree_remove_lh(policy, old);
+    if (tree) {
+        tree->ccounts = ccounts;
+        qd_iterator_t *iter = qd_iterator_string(key, ITER_VIEW_ALL);
+        qd_hash_insert(policy->host_trees, iter, tree, &tree->handle);
+        qd_iterator_free(iter);
+        DEQ_INSERT_TAIL(policy->host_tree_list, tree);
+    }
+    sys_mutex_unlock(policy->cache_lock);
+    free(key);
+}
+
+
+void qd_policy_clear_host_trees(qd_policy_t *policy, long ccounts)
+{
+    sys_mutex_lock(policy->cache_lock);
+    qd_policy_cache_clear_lh(policy);
+    qd_policy_host_tree_t *tree = DEQ_HEAD(policy->host_tree_list);
+    while (tree) {
+        qd_policy_host_tree_t *next = DEQ_NEXT(tree);
+        if (!ccounts || tree->ccounts == ccounts)
+            qd_policy_host_tree_remove_lh(policy, tree);
+        tree = next;
+    }
+    sys_mutex_unlock(policy->cache_lock);
+}
+
+
+qd_error_t qd_policy_set_hosts(qd_policy_t *policy, long ccounts, const char *usergroup, PyObject *ranges)
+{
+    qd_error_clear();
+    if (!PyList_Check(ranges))
+        return qd_error(QD_ERROR_VALUE, "Policy host ranges for '%s' are not a list", usergroup);
+    qd_policy_host_tree_t *tree = qd_policy_host_tree();
+    for (Py_ssize_t i = 0; i < PyList_Size(ranges); i++) {
+        PyObject *range = PyList_GetItem(ranges, i);
+        bool ok;
+        if (range == Py_None) {
+            ok = qd_policy_host_tree_add(tree, 0, 0, 0);
+        } else {
+            const char *lo, *hi;
+            int lo_len, hi_len;
+            ok = PyArg_ParseTuple(range, "s#s#", &lo, &lo_len, &hi, &hi_len) && lo_len == hi_len &&
+                qd_policy_host_tree_add(tree, (const unsigned char*) lo, (const unsigned char*) hi, lo_len);
+            PyErr_Clear();
+        }
+        if (!ok) {
+            qd_policy_host_tree_free(tree);
+            return qd_error(QD_ERROR_VALUE, "Policy host range %d for '%s' is invalid", (int) i, usergroup);
+        }
+    }
+    qd_policy_set_host_tree(policy, ccounts, usergroup, tree);
+    return QD_ERROR_NONE;
+}
+
+
+void qd_policy_cache_insert(qd_policy_t *policy, const char *username, const char *hostip,
+                            const char *vhost, const char *usergroup, const qd_policy_settings_t *settings)
+{
+    qd_policy_denial_counts_t *counts = settings->denialCounts;
+    if (!counts || counts->maxConnections <= 0 ||
+        counts->maxConnectionsPerUser < counts->maxConnections ||
+        counts->maxConnectionsPerHost < counts->maxConnections)
+        return;     // The per-user or per-host limit needs python's accounting
+    char *key = qd_policy_cache_key(vhost, username);
+    if (!key)
+        return;
+
+    qd_policy_cache_entry_t *entry = NEW(qd_policy_cache_entry_t);
+    ZERO(entry);
+    DEQ_ITEM_INIT(entry);
+    entry->usergroup = strdup(usergroup);
+    qd_policy_settings_copy(&entry->settings, settings);
+
+    sys_mutex_lock(policy->cache_lock);
+    entry->hosts = qd_policy_host_tree_lh(policy, (long) counts, usergroup);
+    if (qd_policy_host_tree_match(entry->hosts, hostip)) {
+        // Otherwise python has no host tree for the usergroup, or matches hosts differently
+        if (DEQ_SIZE(policy->cache_entries) >= POLICY_CACHE_MAX)
+            qd_policy_cache_clear_lh(policy);
+        qd_iterator_t *iter = qd_iterator_string(key, ITER_VIEW_ALL);
+        if (qd_hash_insert(policy->cache, iter, entry, &entry->handle) == QD_ERROR_NONE) {
+            DEQ_INSERT_TAIL(policy->cache_entries, entry);
+            entry = 0;
+        }
+        qd_iterator_free(iter);
+    }
+    sys_mutex_unlock(policy->cache_lock);
+
+    if (entry) {    // Not cacheable, or already cached by a concurrent open
+        qd_error_clear();
+        free(entry->usergroup);
+        qd_policy_settings_release(&entry->settings);
+        free(entry);
+    }
+    free(key);
+}
+
+
+bool qd_policy_cache_open(qd_policy_t *policy, const char *username, const char *hostip,
+                          const char *vhost, const char *conn_name, uint64_t conn_id,
+                          char *name_buf, int name_buf_size, qd_policy_settings_t *settings)
+{
+    char *key = qd_policy_cache_key(vhost, username);
+    if (!key || !hostip) {
+        free(key);
+        return false;
+    }
+
+    qd_policy_cache_entry_t *entry = 0;
+    qd_iterator_storage_t storage;
+    bool hit = false;
+
+    sys_mutex_lock(policy->cache_lock);
+    qd_iterator_t *iter = qd_iterator_init_string(&storage, key, ITER_VIEW_ALL);
+    qd_hash_retrieve(policy->cache, iter, (void**) &entry);
+    qd_iterator_free(iter);
+    if (entry) {
+        qd_policy_denial_counts_t *counts = entry->settings.denialCounts;
+        // Python will deny and count it otherwise
+        if (counts->connectionsCurrent < counts->maxConnections &&
+            qd_policy_host_tree_match(entry->hosts, hostip)) {
+            counts->connectionsCurrent++;
+            strncpy(name_buf, entry->usergroup, name_buf_size);
+            qd_policy_settings_copy(settings, &entry->settings);
+
+            qd_policy_cached_open_t *open = NEW(qd_policy_cached_open_t);
+            DEQ_ITEM_INIT(open);
+            open->conn_id   = conn_id;
+            open->conn_name = strdup(conn_name ? conn_name : "");
+            open->user      = strdup(username);
+            open->hostip    = strdup(hostip);
+            open->counts    = counts;
+            DEQ_INSERT_TAIL(policy->cached_opens, open);
+            hit = true;
+        }
+    }
+    sys_mutex_unlock(policy->cache_lock);
+    free(key);
+    return hit;
+}
+
+
+PyObject *qd_policy_cache_drain(qd_policy_t *policy)
+{
+    qd_policy_cached_open_list_t opens;
+    sys_mutex_lock(policy->cache_lock);
+    DEQ_MOVE(policy->cached_opens, opens);
+    uint64_t *closed_ids   = policy->closed_ids;
+    int       closed_count = policy->closed_count;
+    policy->closed_ids      = 0;
+    policy->closed_count    = 0;
+    policy->closed_capacity = 0;
+    sys_mutex_unlock(policy->cache_lock);
+
+    PyObject *closes = PyList_New(closed_count);
+    for (int i = 0; closes && i < closed_count; i++) {
+        PyObject *id = PyLong_FromUnsignedLongLong(closed_ids[i]);
+        if (!id)
+            Py_CLEAR(closes);
+        else
+            PyList_SET_ITEM(closes, i, id);
+    }
+    free(closed_ids);
+
+    PyObject *list = PyList_New(0);
+    qd_policy_cached_open_t *open = DEQ_HEAD(opens);
+    while (open) {
+        DEQ_REMOVE_HEAD(opens);
+        if (list) {
+            PyObject *item = Py_BuildValue("(Ksssl)", open->conn_id, open->conn_name, open->user,
+                                           open->hostip, (long) open->counts);
+            if (!item || PyList_Append(list, item) < 0) {
+                Py_CLEAR(list);
+            }
+            Py_XDECREF(item);
+        }
+        qd_policy_cached_open_free(open);
+        open = DEQ_HEAD(opens);
+    }
+
+    PyObject *result = (list && closes) ? Py_BuildValue("(OO)", list, closes) : 0;
+    Py_XDECREF(list);
+    Py_XDECREF(closes);
+    return result;
+}
+
+
 /** Update the statistics in qdrouterd.conf["policy"]
  * @param[in] entity pointer to the policy management object
  **/
@@ -208,30 +893,20 @@ void qd_policy_socket_close(qd_policy_t *policy, const qd_connection_t *conn)
 {
     n_connections -= 1;
     assert (n_connections >= 0);
+    if (conn->policy_settings && conn->policy_settings->denialCounts) {
+        sys_mutex_lock(policy->cache_lock);
+        conn->policy_settings->denialCounts->connectionsCurrent--;
+        sys_mutex_unlock(policy->cache_lock);
+    }
     if (policy->enableVhostPolicy) {
-        // HACK ALERT: TODO: This should be deferred to a Python thread
-        qd_python_lock_state_t lock_state = qd_python_lock();
-        PyObject *module = PyImport_ImportModule("qpid_dispatch_internal.policy.policy_manager");
-        if (module) {
-            PyObject *close_connection = PyObject_GetAttrString(module, "policy_close_connection");
-            if (close_connection) {
-                PyObject *result = PyObject_CallFunction(close_connection, "(OK)",
-                                                         (PyObject *)policy->py_policy_manager,
-                                                          conn->connection_id);
-                if (result) {
-                    Py_XDECREF(result);
-                } else {
-                    qd_log(policy->log_source, QD_LOG_DEBUG, "Internal: Connection close failed: result");
-                }
-                Py_XDECREF(close_connection);
-            } else {
-                qd_log(policy->log_source, QD_LOG_DEBUG, "Internal: Connection close failed: close_connection");
-            }
-            Py_XDECREF(module);
-        } else {
-            qd_log(policy->log_source, QD_LOG_DEBUG, "Internal: Connection close failed: module");
+        // Removed from python's accounting when it is next entered
+        sys_mutex_lock(policy->cache_lock);
+        if (policy->closed_count == policy->closed_capacity) {
+            policy->closed_capacity = policy->closed_capacity ? policy->closed_capacity * 2 : 64;
+            policy->closed_ids = (uint64_t*) realloc(policy->closed_ids, policy->closed_capacity * sizeof(uint64_t));
         }
-        qd_python_unlock(lock_state);
+        policy->closed_ids[policy->closed_count++] = conn->connection_id;
+        sys_mutex_unlock(policy->cache_lock);
     }
     const char *hostname = qd_connection_name(conn);
     qd_log(policy->log_source, QD_LOG_DEBUG, "Connection '%s' closed with resources n_sessions=%d, n_senders=%d, n_receivers=%d. nConnections= %d.",
@@ -270,6 +945,14 @@ bool qd_policy_open_lookup_user(
     uint64_t    conn_id,
     qd_policy_settings_t *settings)
 {
+    if (qd_policy_cache_open(policy, username, hostip, vhost, conn_name, conn_id,
+                             name_buf, name_buf_size, settings)) {
+        qd_log(policy->log_source, QD_LOG_TRACE,
+               "ALLOW AMQP Open lookup_user: %s, rhost: %s, vhost: %s, connection: %s. Usergroup: '%s' (cached)",
+               username, hostip, vhost, conn_name, name_buf);
+        return true;
+    }
+
     // Lookup the user/host/vhost for allow/deny and to get settings name
     bool res = false;
     qd_python_lock_state_t lock_state = qd_python_lock();
@@ -322,8 +1005,16 @@ bool qd_policy_open_lookup_user(
                     settings->allowAnonymousSender = qd_entity_opt_bool((qd_entity_t*)upolicy, "allowAnonymousSender", false);
                     settings->allowDynamicSource   = qd_entity_opt_bool((qd_entity_t*)upolicy, "allowDynamicSource", false);
                     settings->allowUserIdProxy     = qd_entity_opt_bool((qd_entity_t*)upolicy, "allowUserIdProxy", false);
+                    settings->maxMessageRate       = qd_entity_opt_long((qd_entity_t*)upolicy, "maxMessageRate", 0);
+                    settings->maxByteRate          = qd_entity_opt_long((qd_entity_t*)upolicy, "maxByteRate", 0);
+                    settings->maxUserMessageRate   = qd_entity_opt_long((qd_entity_t*)upolicy, "maxUserMessageRate", 0);
+                    settings->maxUserByteRate      = qd_entity_opt_long((qd_entity_t*)upolicy, "maxUserByteRate", 0);
+                    settings->vhostMaxMessageRate  = qd_entity_opt_long((qd_entity_t*)upolicy, "vhostMaxMessageRate", 0);
+                    settings->vhostMaxByteRate     = qd_entity_opt_long((qd_entity_t*)upolicy, "vhostMaxByteRate", 0);
                     settings->sources              = qd_entity_get_string((qd_entity_t*)upolicy, "sources");
                     settings->targets              = qd_entity_get_string((qd_entity_t*)upolicy, "targets");
+                    settings->sourcesTrie          = qd_policy_name_trie(settings->sources);
+                    settings->targetsTrie          = qd_policy_name_trie(settings->targets);
                     settings->denialCounts         = (qd_policy_denial_counts_t*)
                                                     qd_entity_get_long((qd_entity_t*)upolicy, "denialCounts");
                     Py_XDECREF(result2);
@@ -343,6 +1034,13 @@ bool qd_policy_open_lookup_user(
     Py_XDECREF(module);
     qd_python_unlock(lock_state);
 
+    if (res && name_buf[0] && settings->denialCounts) {
+        sys_mutex_lock(policy->cache_lock);
+        settings->denialCounts->connectionsCurrent++;
+        sys_mutex_unlock(policy->cache_lock);
+        qd_policy_cache_insert(policy, username, hostip, vhost, name_buf, settings);
+    }
+
     if (name_buf[0]) {
         qd_log(policy->log_source,
            QD_LOG_TRACE,
@@ -497,70 +1195,11 @@ char * _qd_policy_link_user_name_subst(const char *uname, const char *proposed,
 }
 
 
-//
-//
-// Size of 'easy' temporary copy of allowed input string
-#define QPALN_SIZE 1024
-// Size of user-name-substituted proposed string.
-#define QPALN_USERBUFSIZE 300
-// C in the CSV string
-#define QPALN_COMMA_SEP ","
-// Wildcard character
-#define QPALN_WILDCARD '*'
-
 bool _qd_policy_approve_link_name(const char *username, const char *allowed, const char *proposed)
 {
-    // Verify string sizes are usable
-    size_t p_len = strlen(proposed);
-    if (p_len == 0) {
-        // degenerate case of blank name being opened. will never match anything.
-        return false;
-    }
-    size_t a_len = strlen(allowed);
-    if (a_len == 0) {
-        // no names in 'allowed'.
-        return false;
-    }
-
-    // Create a temporary writable copy of incoming allowed list
-    char t_allow[QPALN_SIZE + 1]; // temporary buffer for normal allow lists
-    char * pa = t_allow;
-    if (a_len > QPALN_SIZE) {
-        pa = (char *)malloc(a_len + 1); // malloc a buffer for larger allow lists
-    }
-    strncpy(pa, allowed, a_len);
-    pa[a_len] = 0;
-    // Do reverse user substitution into proposed
-    char substbuf[QPALN_USERBUFSIZE];
-    char * prop2 = _qd_policy_link_user_name_subst(username, proposed, substbuf, QPALN_USERBUFSIZE);
-    char *toknext = 0;
-    char *tok = strtok_r(pa, QPALN_COMMA_SEP, &toknext);
-    assert (tok);
-    bool result = false;
-    while (tok != NULL) {
-        if (*tok == QPALN_WILDCARD) {
-            result = true;
-            break;
-        }
-        int matchlen = p_len;
-        int len = strlen(tok);
-        if (tok[len-1] == QPALN_WILDCARD) {
-            matchlen = len - 1;
-            assert(len > 0);
-        }
-        if (strncmp(tok, proposed, matchlen) == 0) {
-            result = true;
-            break;
-        }
-        if (prop2 && strncmp(tok, prop2, matchlen) == 0) {
-            result = true;
-            break;
-        }
-        tok = strtok_r(NULL, QPALN_COMMA_SEP, &toknext);
-    }
-    if (pa != t_allow) {
-        free(pa);
-    }
+    qd_policy_name_trie_t *trie = qd_policy_name_trie(allowed);
+    bool result = qd_policy_name_trie_match(trie, username, proposed);
+    qd_policy_name_trie_decref(trie);
     return result;
 }
 
@@ -589,7 +1228,7 @@ bool qd_policy_approve_amqp_sender_link(pn_link_t *pn_link, qd_connection_t *qd_
     bool lookup;
     if (target && *target) {
         // a target is specified
-        lookup = _qd_policy_approve_link_name(qd_conn->user_id, qd_conn->policy_settings->targets, target);
+        lookup = qd_policy_name_trie_match(qd_conn->policy_settings->targetsTrie, qd_conn->user_id, target);
 
         qd_log(qd_server_dispatch(qd_conn->server)->policy->log_source, (lookup ? QD_LOG_TRACE : QD_LOG_INFO),
             "%s AMQP Attach sender link '%s' for user '%s', rhost '%s', vhost '%s' based on link target name",
@@ -651,7 +1290,7 @@ bool qd_policy_approve_amqp_receiver_link(pn_link_t *pn_link, qd_connection_t *q
     const char * source = pn_terminus_get_address(pn_link_remote_source(pn_link));
     if (source && *source) {
         // a source is specified
-        bool lookup = _qd_policy_approve_link_name(qd_conn->user_id, qd_conn->policy_settings->sources, source);
+        bool lookup = qd_policy_name_trie_match(qd_conn->policy_settings->sourcesTrie, qd_conn->user_id, source);
 
         qd_log(qd_server_dispatch(qd_conn->server)->policy->log_source, (lookup ? QD_LOG_TRACE : QD_LOG_INFO),
             "%s AMQP Attach receiver link '%s' for user '%s', rhost '%s', vhost '%s' based on link source name",
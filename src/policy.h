@@ -37,10 +37,20 @@ struct qd_policy_denial_counts_s {
     int sessionDenied;
     int senderDenied;
     int receiverDenied;
+    int creditThrottled;  // credits held back by rate limits, counted by the router core
+                          // vhost connection limits, set by python
+    int maxConnections;
+    int maxConnectionsPerUser;
+    int maxConnectionsPerHost;
+                          // open connections approved for the vhost, guarded by the policy cache lock
+    int connectionsCurrent;
 };
 
 typedef struct qd_policy_t qd_policy_t;
 
+/** A link name allow list compiled for matching, shared by reference. */
+typedef struct qd_policy_name_trie_t qd_policy_name_trie_t;
+
 struct qd_policy__settings_s {
     int  maxFrameSize;
     int  maxMessageSize;
@@ -51,13 +61,36 @@ struct qd_policy__settings_s {
     bool allowDynamicSource;
     bool allowAnonymousSender;
     bool allowUserIdProxy;
+    int64_t maxMessageRate;      // per connection, messages per second
+    int64_t maxByteRate;         // per connection, octets per second
+    int64_t maxUserMessageRate;  // shared by the user's connections to the vhost
+    int64_t maxUserByteRate;
+    int64_t vhostMaxMessageRate; // shared by all connections to the vhost
+    int64_t vhostMaxByteRate;
     char *sources;
     char *targets;
+    qd_policy_name_trie_t *sourcesTrie;
+    qd_policy_name_trie_t *targetsTrie;
     qd_policy_denial_counts_t *denialCounts;
 };
 
 typedef struct qd_policy__settings_s qd_policy_settings_t;
 
+/** Create the policy structure
+ * @param[in] qd pointer the the qd
+ **/
+qd_policy_t *qd_policy(qd_dispatch_t *qd);
+
+/** Free the policy structure
+ * @param[in] policy pointer to the policy
+ **/
+void qd_policy_free(qd_policy_t *policy);
+
+/** Free policy settings and release their compiled allow lists.
+ * @param[in] settings the settings to free, may be null
+ **/
+void qd_policy_settings_free(qd_policy_settings_t *settings);
+
 /** Configure the C policy entity from the settings in qdrouterd.conf["policy"]
  * Called python-to-C during config processing.
  * @param[in] policy pointer to the policy
@@ -89,6 +122,24 @@ void qd_policy_c_counts_free(long ccounts);
  */
 qd_error_t qd_policy_c_counts_refresh(long ccounts, qd_entity_t*entity);
 
+/** Set the vhost connection limits kept in a counts statistics block.
+ * Called from Python when a vhost is created or updated.
+ */
+void qd_policy_c_counts_limits(long ccounts, long max_connections, long max_per_user, long max_per_host);
+
+/** Forget every cached user lookup.
+ * Called from Python whenever the policy rulesets or default vhost change.
+ * @param[in] policy pointer to the policy
+ */
+void qd_policy_cache_clear(qd_policy_t *policy);
+
+/** Forget the remote host trees of a vhost's usergroups, and every cached user lookup.
+ * Called from Python when a vhost ruleset is deleted or replaced.
+ * @param[in] policy pointer to the policy
+ * @param[in] ccounts the vhost's counts statistics block, or 0 for every vhost
+ */
+void qd_policy_clear_host_trees(qd_policy_t *policy, long ccounts);
+
 
 /** Allow or deny an incoming connection based on connection count(s).
  * A server listener has just accepted a socket.
@@ -104,7 +155,9 @@ bool qd_policy_socket_accept(qd_policy_t *context, const char *hostname);
 
 /** Record a closing connection.
  * A server listener is closing a socket.
- * Release the counted connection against provisioned limits
+ * Release the counted connection against provisioned limits.
+ * Python's vhost accounting is updated when it is next entered,
+ * so the python lock is not taken here.
  * 
  * @param[in] context the current policy
  * @param[in] conn qd_connection
@@ -100,4 +100,88 @@ char * _qd_policy_link_user_name_subst(const char *uname, const char *proposed,
  * @param[in] proposed the link target name to be approved
  */
 bool _qd_policy_approve_link_name(const char *username, const char *allowed, const char *proposed);
+
+
+/** Compile a source/target CSV allow list for matching.
+ * Names are matched as by _qd_policy_approve_link_name.
+ * @param[in] allowed policy settings source/target string in packed CSV form.
+ * @return the compiled list with one reference; release with qd_policy_name_trie_decref.
+ */
+qd_policy_name_trie_t *qd_policy_name_trie(const char *allowed);
+
+
+/** Release a reference to a compiled allow list. */
+void qd_policy_name_trie_decref(qd_policy_name_trie_t *trie);
+
+
+/** Approve link by source/target name against a compiled allow list.
+ * Does not allocate.
+ * @param[in] trie the compiled allow list
+ * @param[in] username authenticated user name
+ * @param[in] proposed the link target name to be approved
+ */
+bool qd_policy_name_trie_match(const qd_policy_name_trie_t *trie, const char *username, const char *proposed);
+
+
+/** A usergroup's remoteHosts ranges compiled for matching. */
+typedef struct qd_policy_host_tree_t qd_policy_host_tree_t;
+
+
+/** Create an empty host tree, which matches no host. */
+qd_policy_host_tree_t *qd_policy_host_tree(void);
+
+
+/** Free a host tree that has not been handed to qd_policy_set_host_tree. */
+void qd_policy_host_tree_free(qd_policy_host_tree_t *tree);
+
+
+/** Add the range of addresses [lo, hi] to a host tree.
+ * @param[in] tree the host tree
+ * @param[in] lo lowest address in network order, or NULL for the wildcard
+ * @param[in] hi highest address in network order
+ * @param[in] len address length, 4 for IPv4 and 16 for IPv6
+ * @return false if the range is not valid
+ */
+bool qd_policy_host_tree_add(qd_policy_host_tree_t *tree, const unsigned char *lo, const unsigned char *hi, size_t len);
+
+
+/** Match a numeric IPv4 or IPv6 host address against a host tree.
+ * Does not allocate.
+ */
+bool qd_policy_host_tree_match(const qd_policy_host_tree_t *tree, const char *hostip);
+
+
+/** Replace the host tree of a vhost's usergroup.  The policy takes ownership
+ * of the tree; a NULL tree removes it.  Every cached user lookup is dropped.
+ * @param[in] policy pointer to policy
+ * @param[in] ccounts the vhost's counts statistics block
+ * @param[in] usergroup the usergroup name
+ * @param[in] tree the new host tree
+ */
+void qd_policy_set_host_tree(qd_policy_t *policy, long ccounts, const char *usergroup, qd_policy_host_tree_t *tree);
+
+
+/** Cache the usergroup and settings python approved for a user/vhost.
+ * Nothing is cached unless the vhost's only binding connection limit is
+ * its total maxConnections and python has set the usergroup's host tree.
+ * @param[in] policy pointer to policy
+ * @param[in] username authenticated user name
+ * @param[in] hostip numeric host ip address
+ * @param[in] vhost application name received in remote AMQP Open.hostname
+ * @param[in] usergroup the settings name python returned
+ * @param[in] settings the settings python returned
+ */
+void qd_policy_cache_insert(qd_policy_t *policy, const char *username, const char *hostip,
+                            const char *vhost, const char *usergroup, const qd_policy_settings_t *settings);
+
+
+/** Approve an AMQP Open from the lookup cache, without calling python.
+ * A hit requires the host to match the cached usergroup's host tree.
+ * On a hit the connection is counted against the vhost, queued for python's
+ * accounting, and the usergroup and a copy of the settings are returned.
+ * @return true on a hit; false if python must look up the user.
+ */
+bool qd_policy_cache_open(qd_policy_t *policy, const char *username, const char *hostip,
+                          const char *vhost, const char *conn_name, uint64_t conn_id,
+                          char *name_buf, int name_buf_size, qd_policy_settings_t *settings);
 #endif
@@ -23,11 +23,20 @@
 //
 #undef NDEBUG
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <qpid/dispatch/threading.h>
 #include <qpid/dispatch/ctools.h>
 #include <stdio.h>
+#include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #include <assert.h>
+#include <errno.h>
 
 struct sys_mutex_t {
     pthread_mutex_t mutex;
@@ -93,6 +102,17 @@ void sys_cond_wait(sys_cond_t *cond, sys_mutex_t *held_mutex)
 }
 
 
+void sys_cond_timed_wait(sys_cond_t *cond, sys_mutex_t *held_mutex, int64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec  = deadline / 1000;
+    ts.tv_nsec = (deadline % 1000) * 1000000;
+    int result = pthread_cond_timedwait(&(cond->cond), &(held_mutex->mutex), &ts);
+    assert(result == 0 || result == ETIMEDOUT);
+    (void) result;
+}
+
+
 void sys_cond_signal(sys_cond_t *cond)
 {
     int result = pthread_cond_signal(&(cond->cond));
@@ -177,3 +197,101 @@ void sys_thread_join(sys_thread_t *thread)
 {
     pthread_join(thread->thread, 0);
 }
+
+
+#define NUMA_SYSFS "/sys/devices/system/node"
+
+int sys_numa_node_count(void)
+{
+    static int count = 0;
+    if (count == 0) {
+        char path[64];
+        int  n = 0;
+        for (;;) {
+            snprintf(path, sizeof(path), NUMA_SYSFS "/node%d", n);
+            if (access(path, F_OK) != 0)
+                break;
+            n++;
+        }
+        count = n > 0 ? n : 1;
+    }
+    return count;
+}
+
+
+int sys_numa_node_self(void)
+{
+#ifdef SYS_getcpu
+    unsigned cpu;
+    unsigned node;
+    if (syscall(SYS_getcpu, &cpu, &node, 0) == 0)
+        return (int) node;
+#endif
+    return 0;
+}
+
+
+#ifdef CPU_SET
+//
+// Bind the calling thread to a list of CPU numbers and ranges, for example "0-7,16-23",
+// optionally ending in a newline.
+//
+static bool bind_cpu_list(const char *text)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    const char *cursor = text;
+    while (*cursor && *cursor != '\n') {
+        char *end;
+        long first = strtol(cursor, &end, 10);
+        if (end == cursor || first < 0)
+            return false;
+        long last = first;
+        if (*end == '-') {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+            if (end == cursor || last < first)
+                return false;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &cpus);
+        if (*end == ',')
+            end++;
+        else if (*end && *end != '\n')
+            return false;
+        cursor = end;
+    }
+
+    if (CPU_COUNT(&cpus) == 0)
+        return false;
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+#endif
+
+
+bool sys_thread_bind_node(int node)
+{
+#ifdef CPU_SET
+    char path[64];
+    char list[1024];
+    snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    char *text = fgets(list, sizeof(list), f);
+    fclose(f);
+    return text && bind_cpu_list(text);
+#else
+    return false;
+#endif
+}
+
+
+bool sys_thread_bind_cpus(const char *cpus)
+{
+#ifdef CPU_SET
+    return cpus && bind_cpu_list(cpus);
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,67 @@
+#ifndef __dispatch_probes_h__
+#define __dispatch_probes_h__ 1
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "config.h"
+
+//
+// Static tracepoints (USDT) on the message path, for SystemTap, bpftrace and DTrace.
+//
+// They are compiled in only when the router is configured with -DUSE_SDT=ON.  Each probe
+// is then a single nop in the code and a note in libqpid-dispatch.so naming the probe and
+// where its arguments live; a tracer patches the nop when it attaches.  Arguments should be
+// values the code already has at hand.  Otherwise the probes expand to nothing.
+//
+//   bpftrace -l 'usdt:<libdir>/libqpid-dispatch.so:qdrouterd:*'
+//
+// Probes, all in provider qdrouterd:
+//
+//   message_received      (qd_message_t *msg, int buffers)            last frame of a message arrived
+//   link_deliver          (qdr_link_t *link, qdr_delivery_t *dlv)     delivery handed to the core
+//   forward_message       (qdr_address_t *addr, qdr_delivery_t *dlv, int treatment, int fanout)
+//   forward_attach        (qdr_address_t *addr, qdr_link_t *link, int treatment, bool routed)
+//   message_send          (qd_message_t *msg, pn_link_t *link, bool resumed)
+//   delivery_disposition  (qdr_delivery_t *dlv, uint64_t disposition, bool settled)
+//   core_action           (const char *label)                         action taken off the queue
+//   alloc_global          (const char *type, qd_alloc_pool_t *pool)   local free list refilled from the global pool
+//   alloc_heap            (const char *type, qd_alloc_pool_t *pool)   local free list refilled from the heap
+//
+
+#if USE_SDT
+
+#include <sys/sdt.h>
+
+#define QD_PROBE0(name)                 DTRACE_PROBE(qdrouterd, name)
+#define QD_PROBE1(name, a)              DTRACE_PROBE1(qdrouterd, name, a)
+#define QD_PROBE2(name, a, b)           DTRACE_PROBE2(qdrouterd, name, a, b)
+#define QD_PROBE3(name, a, b, c)        DTRACE_PROBE3(qdrouterd, name, a, b, c)
+#define QD_PROBE4(name, a, b, c, d)     DTRACE_PROBE4(qdrouterd, name, a, b, c, d)
+
+#else
+
+#define QD_PROBE0(name)                 do {} while (0)
+#define QD_PROBE1(name, a)              do {} while (0)
+#define QD_PROBE2(name, a, b)           do {} while (0)
+#define QD_PROBE3(name, a, b, c)        do {} while (0)
+#define QD_PROBE4(name, a, b, c, d)     do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,427 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// For dladdr()
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "profile.h"
+#include "entity.h"
+#include "entity_cache.h"
+#include <qpid/dispatch/ctools.h>
+#include <qpid/dispatch/log.h>
+#include <qpid/dispatch/threading.h>
+#include <qpid/dispatch/timer.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define PROFILE_DEPTH         32      // Frames kept of each stack
+#define PROFILE_SKIP          2       // Frames of the handler and the signal trampoline
+#define PROFILE_RING          1024    // Samples each thread can hold between drains
+#define PROFILE_BUCKETS       1024
+#define PROFILE_STACKS        8192    // Distinct stacks recorded, later ones are only counted
+#define PROFILE_MAX_FREQUENCY 1000
+#define PROFILE_DRAIN_MSEC    1000
+
+const char *QD_PROFILER_TYPE = "profiler";
+
+typedef struct {
+    int   depth;
+    void *pc[PROFILE_SKIP + PROFILE_DEPTH];
+} profile_sample_t;
+
+//
+// The samples of one thread.  Only the thread's signal handler advances head and
+// only the drain, under profile_lock, advances tail, so neither needs a lock.
+// Both are read and written with the compiler's __atomic builtins rather than
+// sys_atomic, whose fallback takes a mutex that a signal handler must not.
+//
+typedef struct profile_ring_t profile_ring_t;
+struct profile_ring_t {
+    DEQ_LINKS(profile_ring_t);
+    const char       *role;
+    profile_sample_t *samples;    // PROFILE_RING of them once sampling has started
+    uint32_t          head;
+    uint32_t          tail;
+};
+
+DEQ_DECLARE(profile_ring_t, profile_ring_list_t);
+
+typedef struct profile_stack_t profile_stack_t;
+struct profile_stack_t {
+    profile_stack_t *next;        // In the hash bucket
+    const char      *role;
+    uint64_t         hash;
+    uint64_t         count;
+    int              depth;
+    void            *pc[PROFILE_DEPTH];   // Innermost first
+};
+
+typedef struct {
+    char     *text;
+    uint64_t  count;
+} profile_line_t;
+
+static qd_dispatch_t       *profile_qd;
+static qd_log_source_t     *profile_log;
+static sys_mutex_t         *profile_lock;
+static profile_ring_list_t  rings;
+static qd_timer_t          *drain_timer;
+static long                 frequency;
+static bool                 handler_installed;
+static profile_stack_t     *buckets[PROFILE_BUCKETS];
+static int                  stack_count;
+static uint64_t             sample_count;
+static uint64_t             unrecorded;   // Samples of stacks beyond PROFILE_STACKS
+static uint32_t             dropped;      // Samples lost to full rings or taken in unnamed threads, __atomic
+static int                  profiler_entity;
+
+// Initial-exec, so that the handler's first use of it in a thread allocates nothing
+static __thread profile_ring_t *thread_ring __attribute__((tls_model("initial-exec")));
+
+
+//
+// Runs in whichever thread was using the CPU.  It takes no locks and allocates
+// nothing; backtrace() is not on the POSIX list of async-signal-safe functions
+// but is safe once its unwinder is loaded, which qd_profile_start() sees to
+// before the handler is installed.
+//
+static void profile_signal(int sig)
+{
+    profile_ring_t *ring = thread_ring;
+    if (!ring || !ring->samples) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    int      saved_errno = errno;
+    uint32_t head        = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= PROFILE_RING)
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    else {
+        profile_sample_t *sample = &ring->samples[head % PROFILE_RING];
+        sample->depth = backtrace(sample->pc, PROFILE_SKIP + PROFILE_DEPTH);
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);    // Publishes the sample to the drain
+    }
+    errno = saved_errno;
+}
+
+
+static void record_LH(const char *role, const profile_sample_t *sample)
+{
+    int          depth = sample->depth - PROFILE_SKIP;
+    void *const *pc    = sample->pc + PROFILE_SKIP;
+    if (depth <= 0)
+        return;
+
+    uint64_t hash = 14695981039346656037ULL ^ (uintptr_t) role;
+    for (int i = 0; i < depth; i++)
+        hash = (hash ^ (uintptr_t) pc[i]) * 1099511628211ULL;
+
+    sample_count++;
+    profile_stack_t **bucket = &buckets[hash % PROFILE_BUCKETS];
+    for (profile_stack_t *stack = *bucket; stack; stack = stack->next) {
+        if (stack->hash == hash && stack->role == role && stack->depth == depth &&
+            memcmp(stack->pc, pc, depth * sizeof(void*)) == 0) {
+            stack->count++;
+            return;
+        }
+    }
+
+    if (stack_count == PROFILE_STACKS) {
+        unrecorded++;
+        return;
+    }
+    profile_stack_t *stack = NEW(profile_stack_t);
+    stack->role  = role;
+    stack->hash  = hash;
+    stack->count = 1;
+    stack->depth = depth;
+    memcpy(stack->pc, pc, depth * sizeof(void*));
+    stack->next  = *bucket;
+    *bucket      = stack;
+    stack_count++;
+}
+
+
+static void drain_LH(void)
+{
+    for (profile_ring_t *ring = DEQ_HEAD(rings); ring; ring = DEQ_NEXT(ring)) {
+        if (!ring->samples)
+            continue;
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (uint32_t at = tail; at != head; at++)
+            record_LH(ring->role, &ring->samples[at % PROFILE_RING]);
+        __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+    }
+}
+
+
+static void clear_LH(void)
+{
+    for (int idx = 0; idx < PROFILE_BUCKETS; idx++) {
+        while (buckets[idx]) {
+            profile_stack_t *stack = buckets[idx];
+            buckets[idx] = stack->next;
+            free(stack);
+        }
+    }
+    stack_count  = 0;
+    sample_count = 0;
+    unrecorded   = 0;
+    __atomic_store_n(&dropped, 0, __ATOMIC_RELAXED);
+}
+
+
+static void profile_drain(void *context)
+{
+    sys_mutex_lock(profile_lock);
+    drain_LH();
+    if (frequency)
+        qd_timer_schedule(drain_timer, PROFILE_DRAIN_MSEC);
+    sys_mutex_unlock(profile_lock);
+}
+
+
+void qd_profile_initialize(qd_dispatch_t *qd)
+{
+    profile_qd   = qd;
+    profile_lock = sys_mutex();
+    DEQ_INIT(rings);
+    dropped      = 0;
+    qd_entity_cache_add(QD_PROFILER_TYPE, &profiler_entity);
+}
+
+
+void qd_profile_finalize(void)
+{
+    if (!profile_lock)
+        return;
+
+    //
+    // Stop the timer before the rings go; a late signal finds the handler ignored.
+    //
+    struct itimerval off;
+    ZERO(&off);
+    setitimer(ITIMER_PROF, &off, 0);
+    if (handler_installed)
+        signal(SIGPROF, SIG_IGN);
+    qd_timer_free(drain_timer);
+    drain_timer = 0;
+
+    clear_LH();
+    profile_ring_t *ring = DEQ_HEAD(rings);
+    while (ring) {
+        DEQ_REMOVE_HEAD(rings);
+        free(ring->samples);
+        free(ring);
+        ring = DEQ_HEAD(rings);
+    }
+    sys_mutex_free(profile_lock);
+    profile_lock = 0;
+    frequency    = 0;
+}
+
+
+void qd_profile_thread(const char *role)
+{
+    if (!profile_lock)
+        return;
+
+    profile_ring_t *ring = NEW(profile_ring_t);
+    ZERO(ring);
+    DEQ_ITEM_INIT(ring);
+    ring->role = role;
+
+    sys_mutex_lock(profile_lock);
+    if (frequency)
+        ring->samples = NEW_ARRAY(profile_sample_t, PROFILE_RING);
+    DEQ_INSERT_TAIL(rings, ring);
+    sys_mutex_unlock(profile_lock);
+    thread_ring = ring;
+}
+
+
+qd_error_t qd_profile_start(long new_frequency)
+{
+    if (new_frequency < 0 || new_frequency > PROFILE_MAX_FREQUENCY)
+        return qd_error(QD_ERROR_VALUE, "Profiler frequency must be from 0 to %d", PROFILE_MAX_FREQUENCY);
+
+    sys_mutex_lock(profile_lock);
+    if (new_frequency && !frequency) {
+        clear_LH();
+        for (profile_ring_t *ring = DEQ_HEAD(rings); ring; ring = DEQ_NEXT(ring)) {
+            if (!ring->samples)
+                ring->samples = NEW_ARRAY(profile_sample_t, PROFILE_RING);
+            __atomic_store_n(&ring->tail, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+        }
+
+        if (!handler_installed) {
+            //
+            // The first backtrace() loads the unwinder, which must not happen in the handler.
+            //
+            void *frames[PROFILE_SKIP];
+            backtrace(frames, PROFILE_SKIP);
+
+            struct sigaction action;
+            ZERO(&action);
+            action.sa_handler = profile_signal;
+            action.sa_flags   = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGPROF, &action, 0);
+            handler_installed = true;
+        }
+
+        if (!drain_timer)
+            drain_timer = qd_timer(profile_qd, profile_drain, 0);
+        qd_timer_schedule(drain_timer, PROFILE_DRAIN_MSEC);
+    }
+    frequency = new_frequency;
+
+    struct itimerval interval;
+    ZERO(&interval);
+    if (frequency) {
+        long usec = 1000000 / frequency;
+        interval.it_interval.tv_sec  = usec / 1000000;
+        interval.it_interval.tv_usec = usec % 1000000;
+        interval.it_value            = interval.it_interval;
+    }
+    setitimer(ITIMER_PROF, &interval, 0);
+    sys_mutex_unlock(profile_lock);
+
+    if (!profile_log)
+        profile_log = qd_log_source("ROUTER");
+    if (new_frequency)
+        qd_log(profile_log, QD_LOG_INFO, "Profiling at %ld samples per CPU second", new_frequency);
+    else
+        qd_log(profile_log, QD_LOG_INFO, "Profiling stopped");
+    return QD_ERROR_NONE;
+}
+
+
+//
+// Name the function of a frame.  Return addresses point after their call, which
+// may be past the end of the function, so the call itself is looked up.
+//
+static void write_frame(FILE *f, void *pc, bool interrupted)
+{
+    Dl_info info;
+    if (!dladdr(interrupted ? pc : (char*) pc - 1, &info))
+        fprintf(f, "%p", pc);
+    else if (info.dli_sname)
+        fputs(info.dli_sname, f);
+    else if (info.dli_fname) {
+        const char *base = strrchr(info.dli_fname, '/');
+        fprintf(f, "[%s]", base ? base + 1 : info.dli_fname);
+    } else
+        fprintf(f, "%p", pc);
+}
+
+
+static int compare_lines(const void *a, const void *b)
+{
+    return strcmp(((const profile_line_t*) a)->text, ((const profile_line_t*) b)->text);
+}
+
+
+void qd_profile_each_stack(qd_profile_visit_t visit, void *context)
+{
+    //
+    // Different return addresses in a function give different stacks with the same
+    // names; the lines are sorted to merge them.
+    //
+    sys_mutex_lock(profile_lock);
+    drain_LH();
+    profile_line_t *lines = NEW_ARRAY(profile_line_t, stack_count ? stack_count : 1);
+    int             count = 0;
+    for (int idx = 0; idx < PROFILE_BUCKETS; idx++) {
+        for (profile_stack_t *stack = buckets[idx]; stack; stack = stack->next) {
+            size_t size = 0;
+            FILE  *f    = open_memstream(&lines[count].text, &size);
+            fputs(stack->role, f);
+            for (int frame = stack->depth - 1; frame >= 0; frame--) {
+                fputc(';', f);
+                write_frame(f, stack->pc[frame], frame == 0);
+            }
+            fclose(f);
+            lines[count++].count = stack->count;
+        }
+    }
+    sys_mutex_unlock(profile_lock);
+
+    qsort(lines, count, sizeof(profile_line_t), compare_lines);
+    for (int idx = 0; idx < count; idx++) {
+        uint64_t total = lines[idx].count;
+        while (idx + 1 < count && strcmp(lines[idx].text, lines[idx + 1].text) == 0) {
+            free(lines[idx].text);
+            total += lines[++idx].count;
+        }
+
+        char  *line = 0;
+        size_t size = 0;
+        FILE  *f    = open_memstream(&line, &size);
+        fprintf(f, "%s %"PRIu64, lines[idx].text, total);
+        fclose(f);
+        visit(context, line);
+        free(line);
+        free(lines[idx].text);
+    }
+    free(lines);
+}
+
+
+static void add_folded_stack(void *context, const char *line)
+{
+    qd_entity_set_string((qd_entity_t*) context, "foldedStacks", line);
+}
+
+
+qd_error_t qd_entity_configure_profiler(qd_entity_t *entity)
+{
+    long new_frequency = qd_entity_opt_long(entity, "frequency", 0); QD_ERROR_RET();
+    return qd_profile_start(new_frequency);
+}
+
+
+qd_error_t qd_entity_refresh_profiler(qd_entity_t *entity, void *impl)
+{
+    sys_mutex_lock(profile_lock);
+    drain_LH();
+    long     current = frequency;
+    uint64_t samples = sample_count;
+    uint64_t lost    = __atomic_load_n(&dropped, __ATOMIC_RELAXED) + unrecorded;
+    sys_mutex_unlock(profile_lock);
+
+    if (qd_entity_set_long(entity, "frequency", current) ||
+        qd_entity_set_long(entity, "samples", samples) ||
+        qd_entity_set_long(entity, "dropped", lost) ||
+        qd_entity_set_list(entity, "foldedStacks"))
+        return qd_error_code();
+    qd_profile_each_stack(add_folded_stack, entity);
+    return qd_error_code();
+}
@@ -0,0 +1,62 @@
+#ifndef __profile_h__
+#define __profile_h__ 1
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**@file
+ * Sampling CPU profiler.
+ *
+ * While a frequency is set, the process's CPU time interval timer raises
+ * SIGPROF that many times per second of CPU used, in whichever thread is using
+ * it.  The handler records the thread's call stack in a ring of that thread,
+ * without locks or allocation; the rings are drained into a table of distinct
+ * stacks every second and whenever the stacks are read.  Only threads that
+ * have named their role with qd_profile_thread() are sampled.
+ *
+ * Stacks are reported in the folded format of flame graph tools, one line per
+ * stack: "role;outermost;...;innermost count".
+ */
+
+#include <qpid/dispatch/dispatch.h>
+#include <qpid/dispatch/error.h>
+
+void qd_profile_initialize(qd_dispatch_t *qd);
+void qd_profile_finalize(void);
+
+/**
+ * Sample the calling thread, under the given role (a string constant).  Called
+ * once by each thread as it starts.
+ */
+void qd_profile_thread(const char *role);
+
+/**
+ * Sample frequency times per second of CPU time.  Starting anew clears the
+ * recorded stacks; 0 stops sampling and keeps them.
+ */
+qd_error_t qd_profile_start(long frequency);
+
+typedef void (*qd_profile_visit_t)(void *context, const char *line);
+
+/**
+ * Visit each recorded stack as a line in folded form, without a newline, in
+ * the order of the stack text.
+ */
+void qd_profile_each_stack(qd_profile_visit_t visit, void *context);
+
+#endif
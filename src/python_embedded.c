@@ -18,14 +18,18 @@
  */
 
 #include "entity_cache.h"
+#include "entity.h"
 #include <qpid/dispatch/python_embedded.h>
 #include <qpid/dispatch/threading.h>
 #include <qpid/dispatch/log.h>
 #include <qpid/dispatch/error.h>
 #include <qpid/dispatch/amqp.h>
+#include <qpid/dispatch/ctools.h>
 #include "alloc.h"
 #include <qpid/dispatch/router.h>
 #include <qpid/dispatch/error.h>
+#include <string.h>
+#include <time.h>
 
 
 #define DISPATCH_MODULE "qpid_dispatch_internal.dispatch"
@@ -431,12 +435,34 @@ static PyTypeObject LogAdapterType = {
 // Message IO Object
 //===============================================================================
 
+//
+// A message the handler has absorbed: the handler returned a key for it, meaning that
+// an identical message on the same link may be counted without calling the handler.
+// A later absorbed message of the same key replaces it.  The times of the repeats are
+// collected by the handler's owner through IoAdapter.absorbed().
+//
+typedef struct qd_absorbed_t qd_absorbed_t;
+struct qd_absorbed_t {
+    DEQ_LINKS(qd_absorbed_t);
+    char          *key;
+    int            link_id;
+    int            cost;
+    uint32_t       hash;
+    unsigned char *content;     // Application properties and body
+    size_t         length;
+    double         last_seen;   // Wall clock time of the latest repeat
+    bool           repeated;    // Repeated since the last IoAdapter.absorbed()
+};
+DEQ_DECLARE(qd_absorbed_t, qd_absorbed_list_t);
+
 typedef struct {
     PyObject_HEAD
     PyObject           *handler;
     qd_dispatch_t      *qd;
     qdr_core_t         *core;
     qdr_subscription_t *sub;
+    sys_mutex_t        *absorb_lock;
+    qd_absorbed_list_t  absorbed;
 } IoAdapter;
 
 // Parse an iterator to a python object.
@@ -489,22 +515,98 @@ static qd_error_t iter_to_py_attr(qd_iterator_t *iter,
     return qd_error_code();
 }
 
-static void qd_io_rx_handler(void *context, qd_message_t *msg, int link_id, int inter_router_cost)
+// Copy the application properties and body of a message, the parts an absorbed message is matched on.
+static unsigned char *absorb_content(qd_message_t *msg, size_t *length)
 {
-    IoAdapter *self = (IoAdapter*) context;
+    unsigned char *content = 0;
+    qd_iterator_t *props   = qd_message_field_iterator(msg, QD_FIELD_APPLICATION_PROPERTIES);
+    qd_iterator_t *body    = qd_message_field_iterator(msg, QD_FIELD_BODY);
+    if (props && body) {
+        int props_len = qd_iterator_length(props);
+        int body_len  = qd_iterator_length(body);
+        content = (unsigned char*) malloc(props_len + body_len);
+        qd_iterator_ncopy(props, content, props_len);
+        qd_iterator_ncopy(body, content + props_len, body_len);
+        *length = props_len + body_len;
+    }
+    qd_iterator_free(props);
+    qd_iterator_free(body);
+    return content;
+}
 
-    //
-    // Parse the message through the body and exit if the message is not well formed.
-    //
-    if (!qd_message_check(msg, QD_DEPTH_BODY))
-        return;
+static uint32_t absorb_hash(const unsigned char *content, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ content[i]) * 16777619u;
+    return hash;
+}
+
+static double absorb_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0;
+}
+
+static void absorbed_free(qd_absorbed_t *entry)
+{
+    free(entry->key);
+    free(entry->content);
+    free(entry);
+}
+
+// Count a repeat of an absorbed message.  Returns true if the message was one.
+static bool absorb_repeat_lh(IoAdapter *self, int link_id, int cost, uint32_t hash,
+                             const unsigned char *content, size_t length)
+{
+    qd_absorbed_t *entry = DEQ_HEAD(self->absorbed);
+    while (entry) {
+        if (entry->hash == hash && entry->link_id == link_id && entry->cost == cost &&
+            entry->length == length && memcmp(entry->content, content, length) == 0) {
+            entry->last_seen = absorb_now();
+            entry->repeated  = true;
+            return true;
+        }
+        entry = DEQ_NEXT(entry);
+    }
+    return false;
+}
+
+// Record an absorbed message, taking the content.
+static void absorb_lh(IoAdapter *self, const char *key, int link_id, int cost, uint32_t hash,
+                      unsigned char *content, size_t length)
+{
+    qd_absorbed_t *entry = DEQ_HEAD(self->absorbed);
+    while (entry) {
+        qd_absorbed_t *next = DEQ_NEXT(entry);
+        if (strcmp(entry->key, key) == 0) {
+            DEQ_REMOVE(self->absorbed, entry);
+            absorbed_free(entry);
+        }
+        entry = next;
+    }
+
+    entry = NEW(qd_absorbed_t);
+    ZERO(entry);
+    DEQ_ITEM_INIT(entry);
+    entry->key     = strdup(key);
+    entry->link_id = link_id;
+    entry->cost    = cost;
+    entry->hash    = hash;
+    entry->content = content;
+    entry->length  = length;
+    DEQ_INSERT_TAIL(self->absorbed, entry);
+}
 
-    // This is called from non-python threads so we need to acquire the GIL to use python APIS.
-    qd_python_lock_state_t lock_state = qd_python_lock();
+// Pass a message to the handler, taking the content it is absorbed on.  Called with the python lock held.
+static void qd_io_rx_message_lh(IoAdapter *self, qd_message_t *msg, int link_id, int inter_router_cost,
+                                unsigned char *content, size_t length, uint32_t hash)
+{
     PyObject *py_msg = PyObject_CallFunction(message_type, NULL);
     if (!py_msg) {
         qd_error_py();
-        qd_python_unlock(lock_state);
+        free(content);
         return;
     }
     iter_to_py_attr(qd_message_field_iterator(msg, QD_FIELD_TO), py_iter_copy, py_msg, "address");
@@ -516,10 +618,66 @@ static void qd_io_rx_handler(void *context, qd_message_t *msg, int link_id, int
 
     PyObject *value = PyObject_CallFunction(self->handler, "Oll", py_msg, link_id, inter_router_cost);
 
+    if (content && value && PyString_Check(value)) {
+        sys_mutex_lock(self->absorb_lock);
+        absorb_lh(self, PyString_AsString(value), link_id, inter_router_cost, hash, content, length);
+        sys_mutex_unlock(self->absorb_lock);
+        content = 0;
+    }
+
     Py_DECREF(py_msg);
     Py_XDECREF(value);
     qd_error_py();
-    qd_python_unlock(lock_state);
+    free(content);
+}
+
+static void qd_io_rx_handler(void *context, qd_message_t **msgs, int *link_ids, int *inter_router_costs, int count)
+{
+    IoAdapter              *self       = (IoAdapter*) context;
+    bool                    locked     = false;
+    qd_python_lock_state_t  lock_state = 0;
+
+    for (int i = 0; i < count; i++) {
+        qd_message_t *msg     = msgs[i];
+        int           link_id = link_ids[i];
+        int           cost    = inter_router_costs[i];
+
+        //
+        // Parse the message through the body and skip it if the message is not well formed.
+        //
+        if (!qd_message_check(msg, QD_DEPTH_BODY))
+            continue;
+
+        //
+        // A repeat of an absorbed message is counted without the GIL.
+        //
+        size_t         length  = 0;
+        unsigned char *content = absorb_content(msg, &length);
+        uint32_t       hash    = 0;
+        if (content) {
+            hash = absorb_hash(content, length);
+            sys_mutex_lock(self->absorb_lock);
+            bool repeat = absorb_repeat_lh(self, link_id, cost, hash, content, length);
+            sys_mutex_unlock(self->absorb_lock);
+            if (repeat) {
+                free(content);
+                continue;
+            }
+        }
+
+        //
+        // This is called from non-python threads so we need to acquire the GIL to use
+        // python APIS.  It is taken once for the batch.
+        //
+        if (!locked) {
+            lock_state = qd_python_lock();
+            locked     = true;
+        }
+        qd_io_rx_message_lh(self, msg, link_id, cost, content, length, hash);
+    }
+
+    if (locked)
+        qd_python_unlock(lock_state);
 }
 
 
@@ -540,12 +698,14 @@ static int IoAdapter_init(IoAdapter *self, PyObject *args, PyObject *kwds)
         return -1;
     }
     Py_INCREF(self->handler);
+    self->absorb_lock = sys_mutex();
+    DEQ_INIT(self->absorbed);
     self->qd   = dispatch;
     self->core = qd_router_core(self->qd);
     const char *address = PyString_AsString(addr);
     if (!address) return -1;
     qd_error_clear();
-    self->sub = qdr_core_subscribe(self->core, address, aclass, phase, treatment, qd_io_rx_handler, self);
+    self->sub = qdr_core_subscribe_batch(self->core, address, aclass, phase, treatment, qd_io_rx_handler, self);
     if (qd_error_code()) {
         PyErr_SetString(PyExc_RuntimeError, qd_error_message());
         return -1;
@@ -557,6 +717,15 @@ static void IoAdapter_dealloc(IoAdapter* self)
 {
     qdr_core_unsubscribe(self->sub);
     Py_DECREF(self->handler);
+    if (self->absorb_lock) {
+        qd_absorbed_t *entry = DEQ_HEAD(self->absorbed);
+        while (entry) {
+            DEQ_REMOVE_HEAD(self->absorbed);
+            absorbed_free(entry);
+            entry = DEQ_HEAD(self->absorbed);
+        }
+        sys_mutex_free(self->absorb_lock);
+    }
     self->ob_type->tp_free((PyObject*)self);
 }
 
@@ -622,8 +791,55 @@ static PyObject *qd_python_send(PyObject *self, PyObject *args)
 }
 
 
+// The absorbed messages repeated since the last call, as (key, link_id, cost, last_seen) tuples.
+static PyObject *qd_python_absorbed(PyObject *self, PyObject *args)
+{
+    IoAdapter *ioa    = (IoAdapter*) self;
+    PyObject  *result = PyList_New(0);
+    if (!result)
+        return 0;
+
+    sys_mutex_lock(ioa->absorb_lock);
+    qd_absorbed_t *entry = DEQ_HEAD(ioa->absorbed);
+    while (entry) {
+        if (entry->repeated) {
+            PyObject *item = Py_BuildValue("(siid)", entry->key, entry->link_id, entry->cost, entry->last_seen);
+            if (!item || PyList_Append(result, item) < 0) {
+                Py_XDECREF(item);
+                Py_DECREF(result);
+                sys_mutex_unlock(ioa->absorb_lock);
+                return 0;
+            }
+            Py_DECREF(item);
+            entry->repeated = false;
+        }
+        entry = DEQ_NEXT(entry);
+    }
+    sys_mutex_unlock(ioa->absorb_lock);
+    return result;
+}
+
+// Forget the absorbed messages, their next arrivals are passed to the handler.
+static PyObject *qd_python_clear_absorbed(PyObject *self, PyObject *args)
+{
+    IoAdapter *ioa = (IoAdapter*) self;
+
+    sys_mutex_lock(ioa->absorb_lock);
+    qd_absorbed_t *entry = DEQ_HEAD(ioa->absorbed);
+    while (entry) {
+        DEQ_REMOVE_HEAD(ioa->absorbed);
+        absorbed_free(entry);
+        entry = DEQ_HEAD(ioa->absorbed);
+    }
+    sys_mutex_unlock(ioa->absorb_lock);
+    Py_RETURN_NONE;
+}
+
+
 static PyMethodDef IoAdapter_methods[] = {
     {"send", qd_python_send, METH_VARARGS, "Send a Message"},
+    {"absorbed", qd_python_absorbed, METH_NOARGS, "Absorbed messages repeated since the last call"},
+    {"clear_absorbed", qd_python_clear_absorbed, METH_NOARGS, "Forget the absorbed messages"},
     {0, 0, 0, 0}
 };
 
@@ -759,15 +975,118 @@ static void qd_python_setup(void)
     }
 }
 
-qd_python_lock_state_t qd_python_lock(void)
+//===============================================================================
+// Python Lock Statistics
+//===============================================================================
+
+//
+// The time the python lock is waited for and held is recorded for each site that takes
+// it, a site being the function calling qd_python_lock.  The statistics are updated
+// with the lock held and published as pythonLock entities.
+//
+#define QD_PYTHON_LOCK_SITES   32
+#define QD_PYTHON_LOCK_BUCKETS 20
+
+typedef struct {
+    const char *site;
+    uint64_t    acquisitions;
+    uint64_t    wait_ns;
+    uint64_t    hold_ns;
+    uint64_t    max_wait_ns;
+    uint64_t    max_hold_ns;
+    uint64_t    wait_histogram[QD_PYTHON_LOCK_BUCKETS];  /* Bucket N > 0: 2^(N-1) to 2^N - 1 microseconds */
+    uint64_t    hold_histogram[QD_PYTHON_LOCK_BUCKETS];
+} qd_python_lock_stats_t;
+
+const char *QD_PYTHON_LOCK_TYPE = "pythonLock";
+
+static qd_python_lock_stats_t  lock_sites[QD_PYTHON_LOCK_SITES];
+static int                     lock_site_count = 0;
+static qd_python_lock_stats_t *held_site  = 0;
+static uint64_t                held_since = 0;
+
+static uint64_t lock_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int lock_bucket(uint64_t ns)
+{
+    uint64_t us     = ns / 1000;
+    int      bucket = 0;
+    while (us && bucket < QD_PYTHON_LOCK_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// The statistics of a site, the last of the table once it is full.  Called with the lock held.
+static qd_python_lock_stats_t *lock_site_lh(const char *site)
+{
+    for (int i = 0; i < lock_site_count; i++)
+        if (lock_sites[i].site == site)
+            return &lock_sites[i];
+    if (lock_site_count == QD_PYTHON_LOCK_SITES)
+        return &lock_sites[QD_PYTHON_LOCK_SITES - 1];
+
+    qd_python_lock_stats_t *stats = &lock_sites[lock_site_count++];
+    stats->site = lock_site_count == QD_PYTHON_LOCK_SITES ? "other" : site;
+    qd_entity_cache_add(QD_PYTHON_LOCK_TYPE, stats);
+    return stats;
+}
+
+qd_python_lock_state_t qd_python_lock_at(const char *site)
 {
+    uint64_t start = lock_clock_ns();
     sys_mutex_lock(ilock);
-    lock_held = true;
+    lock_held  = true;
+    held_since = lock_clock_ns();
+    held_site  = lock_site_lh(site);
+
+    uint64_t wait = held_since - start;
+    held_site->acquisitions++;
+    held_site->wait_ns += wait;
+    if (wait > held_site->max_wait_ns)
+        held_site->max_wait_ns = wait;
+    held_site->wait_histogram[lock_bucket(wait)]++;
     return 0;
 }
 
 void qd_python_unlock(qd_python_lock_state_t lock_state)
 {
+    uint64_t hold = lock_clock_ns() - held_since;
+    held_site->hold_ns += hold;
+    if (hold > held_site->max_hold_ns)
+        held_site->max_hold_ns = hold;
+    held_site->hold_histogram[lock_bucket(hold)]++;
+    held_site = 0;
+
     lock_held = false;
     sys_mutex_unlock(ilock);
 }
+
+qd_error_t qd_entity_refresh_pythonLock(qd_entity_t* entity, void *impl)
+{
+    qd_python_lock_stats_t *stats = (qd_python_lock_stats_t*) impl;
+    char identity[128];
+    snprintf(identity, sizeof(identity), "pythonLock/%s", stats->site);
+
+    if (qd_entity_set_string(entity, "identity", identity) ||
+        qd_entity_set_string(entity, "site", stats->site) ||
+        qd_entity_set_long(entity, "acquisitions", stats->acquisitions) ||
+        qd_entity_set_long(entity, "waitTime", stats->wait_ns / 1000) ||
+        qd_entity_set_long(entity, "holdTime", stats->hold_ns / 1000) ||
+        qd_entity_set_long(entity, "maxWaitTime", stats->max_wait_ns / 1000) ||
+        qd_entity_set_long(entity, "maxHoldTime", stats->max_hold_ns / 1000) ||
+        qd_entity_set_list(entity, "waitHistogram") ||
+        qd_entity_set_list(entity, "holdHistogram"))
+        return qd_error_code();
+    for (int bucket = 0; bucket < QD_PYTHON_LOCK_BUCKETS; bucket++)
+        if (qd_entity_set_long(entity, "waitHistogram", stats->wait_histogram[bucket]) ||
+            qd_entity_set_long(entity, "holdHistogram", stats->hold_histogram[bucket]))
+            return qd_error_code();
+    return QD_ERROR_NONE;
+}
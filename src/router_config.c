@@ -181,11 +181,13 @@ qd_error_t qd_router_configure_address(qd_router_t *router, qd_entity_t *entity)
 {
     char *name    = 0;
     char *prefix  = 0;
+    char *pattern = 0;
     char *distrib = 0;
 
     do {
         name = qd_entity_opt_string(entity, "name", 0);             QD_ERROR_BREAK();
-        prefix = qd_entity_get_string(entity, "prefix");            QD_ERROR_BREAK();
+        prefix = qd_entity_opt_string(entity, "prefix", 0);         QD_ERROR_BREAK();
+        pattern = qd_entity_opt_string(entity, "pattern", 0);       QD_ERROR_BREAK();
         distrib = qd_entity_opt_string(entity, "distribution", 0);  QD_ERROR_BREAK();
 
         bool  waypoint  = qd_entity_opt_bool(entity, "waypoint", false);
@@ -208,6 +210,11 @@ qd_error_t qd_router_configure_address(qd_router_t *router, qd_entity_t *entity)
             qd_compose_insert_string(body, prefix);
         }
 
+        if (pattern) {
+            qd_compose_insert_string(body, "pattern");
+            qd_compose_insert_string(body, pattern);
+        }
+
         if (distrib) {
             qd_compose_insert_string(body, "distribution");
             qd_compose_insert_string(body, distrib);
@@ -234,6 +241,7 @@ qd_error_t qd_router_configure_address(qd_router_t *router, qd_entity_t *entity)
 
     free(name);
     free(prefix);
+    free(pattern);
     free(distrib);
 
     return qd_error_code();
@@ -245,6 +253,7 @@ qd_error_t qd_router_configure_link_route(qd_router_t *router, qd_entity_t *enti
 
     char *name      = 0;
     char *prefix    = 0;
+    char *pattern   = 0;
     char *container = 0;
     char *c_name    = 0;
     char *distrib   = 0;
@@ -252,7 +261,8 @@ qd_error_t qd_router_configure_link_route(qd_router_t *router, qd_entity_t *enti
 
     do {
         name      = qd_entity_opt_string(entity, "name", 0);         QD_ERROR_BREAK();
-        prefix    = qd_entity_get_string(entity, "prefix");          QD_ERROR_BREAK();
+        prefix    = qd_entity_opt_string(entity, "prefix", 0);       QD_ERROR_BREAK();
+        pattern   = qd_entity_opt_string(entity, "pattern", 0);      QD_ERROR_BREAK();
         container = qd_entity_opt_string(entity, "containerId", 0);  QD_ERROR_BREAK();
         c_name    = qd_entity_opt_string(entity, "connection", 0);   QD_ERROR_BREAK();
         distrib   = qd_entity_opt_string(entity, "distribution", 0); QD_ERROR_BREAK();
@@ -274,6 +284,11 @@ qd_error_t qd_router_configure_link_route(qd_router_t *router, qd_entity_t *enti
             qd_compose_insert_string(body, prefix);
         }
 
+        if (pattern) {
+            qd_compose_insert_string(body, "pattern");
+            qd_compose_insert_string(body, pattern);
+        }
+
         if (container) {
             qd_compose_insert_string(body, "containerId");
             qd_compose_insert_string(body, container);
@@ -302,6 +317,7 @@ qd_error_t qd_router_configure_link_route(qd_router_t *router, qd_entity_t *enti
 
     free(name);
     free(prefix);
+    free(pattern);
     free(container);
     free(c_name);
     free(distrib);
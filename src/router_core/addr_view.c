@@ -0,0 +1,128 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "router_core_private.h"
+
+//
+// The address view is a copy of the keys of the addresses in addr_hash that I/O threads
+// may read without asking the core.  It is split into stripes by the hash of the key, each
+// a hash table under its own read-write lock, so lookups from many threads and the core's
+// changes seldom meet on the same lock.  The core adds an address's key in the same action
+// that puts the address in addr_hash and removes it when the address is freed.
+//
+// Each address also publishes its path count (view_paths), which the core updates wherever
+// it adds or removes a local consumer, an in-process subscription or a remote router.  An
+// I/O thread reads it under the stripe's lock, which keeps the address from being freed.
+//
+// A message on an anonymous link to an address that is not in addr_hash, or that has no
+// paths, is released by the core, except on an edge router where it goes up the uplink.  An
+// I/O thread that finds the address missing from the view or without paths can release
+// such a message itself.  Losing the last path may be published late, which only sends
+// messages to the core that it then releases; gaining the first is published before the
+// core does anything else.
+//
+
+
+void qdr_addr_view_setup(qdr_core_t *core)
+{
+    for (int i = 0; i < QDR_ADDR_VIEW_STRIPES; i++) {
+        core->addr_view[i].lock = sys_rwlock();
+        core->addr_view[i].keys = qd_hash(8, 32, 0);
+    }
+}
+
+
+void qdr_addr_view_free(qdr_core_t *core)
+{
+    for (int i = 0; i < QDR_ADDR_VIEW_STRIPES; i++) {
+        sys_rwlock_free(core->addr_view[i].lock);
+        qd_hash_free(core->addr_view[i].keys);
+    }
+}
+
+
+static qdr_addr_view_stripe_t *qdr_addr_view_stripe(qdr_core_t *core, qd_iterator_t *key)
+{
+    return &core->addr_view[qd_iterator_hash_view(key) % QDR_ADDR_VIEW_STRIPES];
+}
+
+
+void qdr_addr_view_add_CT(qdr_core_t *core, qdr_address_t *addr)
+{
+    qd_iterator_storage_t   storage;
+    qd_iterator_t          *key    = qd_iterator_init_string(&storage, (const char*) qd_hash_key_by_handle(addr->hash_handle),
+                                                             ITER_VIEW_ALL);
+    qdr_addr_view_stripe_t *stripe = qdr_addr_view_stripe(core, key);
+
+    sys_rwlock_wrlock(stripe->lock);
+    qd_hash_insert(stripe->keys, key, addr, 0);
+    sys_rwlock_unlock(stripe->lock);
+    qd_iterator_free(key);
+}
+
+
+void qdr_addr_view_paths_CT(qdr_address_t *addr)
+{
+    sys_atomic_swap(&addr->view_paths, (uint32_t) qdr_addr_path_count_CT(addr));
+}
+
+
+void qdr_addr_view_remove_CT(qdr_core_t *core, qdr_address_t *addr)
+{
+    qd_iterator_storage_t   storage;
+    qd_iterator_t          *key    = qd_iterator_init_string(&storage, (const char*) qd_hash_key_by_handle(addr->hash_handle),
+                                                             ITER_VIEW_ALL);
+    qdr_addr_view_stripe_t *stripe = qdr_addr_view_stripe(core, key);
+
+    sys_rwlock_wrlock(stripe->lock);
+    qd_hash_remove(stripe->keys, key);
+    sys_rwlock_unlock(stripe->lock);
+    qd_iterator_free(key);
+}
+
+
+bool qdr_link_unroutable(qdr_link_t *link, qd_iterator_t *addr)
+{
+    qdr_core_t *core = link->core;
+    if (core->router_mode == QD_ROUTER_MODE_EDGE || link->link_type != QD_LINK_ENDPOINT)
+        return false;
+
+    //
+    // Look the address up as the core would, in its tenant space.
+    //
+    qdr_connection_t *conn = link->conn;
+    if (conn && conn->tenant_space)
+        qd_iterator_annotate_space(addr, conn->tenant_space, conn->tenant_space_len);
+
+    qdr_addr_view_stripe_t *stripe = qdr_addr_view_stripe(core, addr);
+    qdr_address_t          *known  = 0;
+    bool                    unroutable;
+
+    sys_rwlock_rdlock(stripe->lock);
+    qd_hash_retrieve(stripe->keys, addr, (void**) &known);
+    unroutable = !known || sys_atomic_get(&known->view_paths) == 0;
+    sys_rwlock_unlock(stripe->lock);
+    return unroutable;
+}
+
+
+void qdr_link_released_unroutable(qdr_link_t *link)
+{
+    sys_atomic_add(&link->released_unroutable, 1);
+}
@@ -25,6 +25,7 @@
 #include "agent_link.h"
 #include "agent_router.h"
 #include "agent_connection.h"
+#include "agent_core_action.h"
 #include "router_core_private.h"
 #include <stdio.h>
 
@@ -40,9 +41,8 @@ ALLOC_DEFINE(qdr_query_t);
 // Internal Functions
 //==================================================================================
 
-static void qdr_agent_response_handler(void *context)
+static void qdr_agent_response_handler(qdr_core_t *core, qdr_general_work_t *work)
 {
-    qdr_core_t  *core = (qdr_core_t*) context;
     qdr_query_t *query;
     bool         done = false;
 
@@ -72,7 +72,31 @@ void qdr_agent_enqueue_response_CT(qdr_core_t *core, qdr_query_t *query)
     sys_mutex_unlock(core->query_lock);
 
     if (notify)
-        qd_timer_schedule(core->agent_timer, 0);
+        qdr_post_general_work_CT(core, qdr_general_work(qdr_agent_response_handler));
+}
+
+
+void qdr_agent_set_cursor_CT(qdr_core_t *core, qdr_query_t *query, void *entity)
+{
+    if (entity && !query->cursor_held) {
+        DEQ_INSERT_TAIL_N(CURSOR, core->query_cursors, query);
+        query->cursor_held = true;
+    } else if (!entity && query->cursor_held) {
+        DEQ_REMOVE_N(CURSOR, core->query_cursors, query);
+        query->cursor_held = false;
+    }
+    query->cursor = entity;
+}
+
+
+void qdr_agent_cursor_remove_CT(qdr_core_t *core, void *entity, void *next)
+{
+    qdr_query_t *query = DEQ_HEAD(core->query_cursors);
+    while (query) {
+        if (query->cursor == entity)
+            query->cursor = next;
+        query = DEQ_NEXT_N(CURSOR, query);
+    }
 }
 
 
@@ -96,6 +120,8 @@ qdr_query_t *qdr_query(qdr_core_t              *core,
 
 static void qdrh_query_get_first_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdrh_query_get_next_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
+static void qdrh_query_free_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
+static const char **qdr_agent_columns(qd_router_entity_type_t type, int *column_count);
 static void qdr_agent_emit_columns(qdr_query_t *query, const char *qdr_columns[], int column_count);
 static void qdr_agent_set_columns(qdr_query_t *query, qd_parsed_field_t *attribute_names, const char *qdr_columns[], int column_count);
 
@@ -119,6 +145,20 @@ void qdr_manage_create(qdr_core_t              *core,
     action->args.agent.in_body      = in_body;
     action->args.agent.body_buffers = body_buffers;
 
+    //
+    // Creates staged together, as when the configuration file is loaded, are
+    // carried to the core by a single action.
+    //
+    qdr_action_t *tail = qdr_action_batch_tail(core, qdr_manage_create_CT);
+    if (tail) {
+        if (tail->args.agent.more_tail)
+            tail->args.agent.more_tail->args.agent.more = action;
+        else
+            tail->args.agent.more = action;
+        tail->args.agent.more_tail = action;
+        return;
+    }
+
     qdr_action_enqueue(core, action);
 }
 
@@ -193,6 +233,7 @@ qdr_query_t *qdr_manage_query(qdr_core_t              *core,
     case QD_ROUTER_CONNECTION:        qdr_agent_set_columns(query, attribute_names, qdr_connection_columns, QDR_CONNECTION_COLUMN_COUNT);  break;
     case QD_ROUTER_LINK:              qdr_agent_set_columns(query, attribute_names, qdr_link_columns, QDR_LINK_COLUMN_COUNT);  break;
     case QD_ROUTER_ADDRESS:           qdr_agent_set_columns(query, attribute_names, qdr_address_columns, QDR_ADDRESS_COLUMN_COUNT); break;
+    case QD_ROUTER_CORE_ACTION:       qdr_agent_set_columns(query, attribute_names, qdr_core_action_columns, QDR_CORE_ACTION_COLUMN_COUNT); break;
     case QD_ROUTER_FORBIDDEN:         break;
     case QD_ROUTER_EXCHANGE:          break;
     case QD_ROUTER_BINDING:           break;
@@ -202,6 +243,239 @@ qdr_query_t *qdr_manage_query(qdr_core_t              *core,
 }
 
 
+static const struct {
+    const char      *name;
+    qdr_filter_op_t  op;
+} qdr_filter_ops[] = {
+    {"==", QDR_FILTER_EQ},
+    {"!=", QDR_FILTER_NE},
+    {"<",  QDR_FILTER_LT},
+    {"<=", QDR_FILTER_LE},
+    {">",  QDR_FILTER_GT},
+    {">=", QDR_FILTER_GE},
+    {"prefix", QDR_FILTER_PREFIX},
+    {0, 0}
+};
+
+
+static bool qdr_agent_is_string(qd_parsed_field_t *field)
+{
+    uint8_t tag = qd_parse_tag(field);
+    return tag == QD_AMQP_STR8_UTF8 || tag == QD_AMQP_STR32_UTF8 || tag == QD_AMQP_SYM8 || tag == QD_AMQP_SYM32;
+}
+
+
+static bool qdr_agent_as_number(qd_parsed_field_t *field, int64_t *number)
+{
+    switch (qd_parse_tag(field)) {
+    case QD_AMQP_ULONG:
+    case QD_AMQP_SMALLULONG:
+    case QD_AMQP_ULONG0:
+        *number = (int64_t) qd_parse_as_ulong(field);
+        return true;
+
+    case QD_AMQP_UINT:
+    case QD_AMQP_SMALLUINT:
+    case QD_AMQP_UINT0:
+    case QD_AMQP_USHORT:
+    case QD_AMQP_UBYTE:
+        *number = qd_parse_as_uint(field);
+        return true;
+
+    case QD_AMQP_LONG:
+    case QD_AMQP_SMALLLONG:
+        *number = qd_parse_as_long(field);
+        return true;
+
+    case QD_AMQP_INT:
+    case QD_AMQP_SMALLINT:
+    case QD_AMQP_SHORT:
+    case QD_AMQP_BYTE:
+        *number = qd_parse_as_int(field);
+        return true;
+
+    case QD_AMQP_BOOLEAN:
+    case QD_AMQP_TRUE:
+    case QD_AMQP_FALSE:
+        *number = qd_parse_as_bool(field);
+        return true;
+    }
+
+    return false;
+}
+
+
+static bool qdr_agent_add_filter(qdr_query_t *query, qd_parsed_field_t *clause,
+                                 const char *qdr_columns[], int column_count)
+{
+    if (!qd_parse_is_list(clause) || qd_parse_sub_count(clause) != 3 || query->filter_count == QDR_AGENT_MAX_FILTERS)
+        return false;
+
+    qd_parsed_field_t  *name   = qd_parse_sub_value(clause, 0);
+    qd_parsed_field_t  *op     = qd_parse_sub_value(clause, 1);
+    qd_parsed_field_t  *value  = qd_parse_sub_value(clause, 2);
+    qdr_query_filter_t *filter = &query->filters[query->filter_count];
+
+    if (!qdr_agent_is_string(name) || !qdr_agent_is_string(op))
+        return false;
+
+    filter->column = -1;
+    for (int i = 0; i < column_count; i++) {
+        if (qd_iterator_equal(qd_parse_raw(name), (const unsigned char*) qdr_columns[i])) {
+            filter->column = i;
+            break;
+        }
+    }
+    if (filter->column < 0)
+        return false;
+
+    int idx = 0;
+    while (qdr_filter_ops[idx].name && !qd_iterator_equal(qd_parse_raw(op), (const unsigned char*) qdr_filter_ops[idx].name))
+        idx++;
+    if (!qdr_filter_ops[idx].name)
+        return false;
+    filter->op = qdr_filter_ops[idx].op;
+
+    filter->numeric = qdr_agent_as_number(value, &filter->number);
+    if (!filter->numeric) {
+        //
+        // Strings can be tested for equality or a prefix, nothing else.
+        //
+        if (!qdr_agent_is_string(value))
+            return false;
+        if (filter->op != QDR_FILTER_EQ && filter->op != QDR_FILTER_NE && filter->op != QDR_FILTER_PREFIX)
+            return false;
+        filter->text = (char*) qd_iterator_copy(qd_parse_raw(value));
+    } else if (filter->op == QDR_FILTER_PREFIX)
+        return false;
+
+    query->filter_count++;
+    return true;
+}
+
+
+void qdr_query_set_filter(qdr_query_t *query, qd_parsed_field_t *where)
+{
+    int          column_count = 0;
+    const char **qdr_columns  = qdr_agent_columns(query->entity_type, &column_count);
+
+    if (!where)
+        return;
+
+    //
+    // Only the entity types with large populations scan with a filter.
+    //
+    if (!qdr_columns || !qd_parse_is_list(where) ||
+        (query->entity_type != QD_ROUTER_LINK &&
+         query->entity_type != QD_ROUTER_CONNECTION &&
+         query->entity_type != QD_ROUTER_ADDRESS)) {
+        query->filter_invalid = true;
+        return;
+    }
+
+    for (uint32_t i = 0; i < qd_parse_sub_count(where); i++) {
+        if (!qdr_agent_add_filter(query, qd_parse_sub_value(where, i), qdr_columns, column_count)) {
+            query->filter_invalid = true;
+            return;
+        }
+    }
+}
+
+
+static bool qdr_agent_filter_test(const qdr_query_filter_t *filter, qd_parsed_field_t *value)
+{
+    if (!filter->numeric) {
+        bool equal;
+        if (!qdr_agent_is_string(value))
+            return filter->op == QDR_FILTER_NE;
+        if (filter->op == QDR_FILTER_PREFIX)
+            return qd_iterator_prefix(qd_parse_raw(value), filter->text);
+        equal = qd_iterator_equal(qd_parse_raw(value), (const unsigned char*) filter->text);
+        return filter->op == QDR_FILTER_EQ ? equal : !equal;
+    }
+
+    int64_t number;
+    if (!qdr_agent_as_number(value, &number))
+        return filter->op == QDR_FILTER_NE;
+
+    switch (filter->op) {
+    case QDR_FILTER_EQ: return number == filter->number;
+    case QDR_FILTER_NE: return number != filter->number;
+    case QDR_FILTER_LT: return number <  filter->number;
+    case QDR_FILTER_LE: return number <= filter->number;
+    case QDR_FILTER_GT: return number >  filter->number;
+    case QDR_FILTER_GE: return number >= filter->number;
+    default:            return false;
+    }
+}
+
+
+//
+// Render each filtered column the same way the row writer would and test the
+// parsed result, so filters see exactly the values a client would.
+//
+static bool qdr_agent_filter_match_CT(qdr_core_t *core, qdr_query_t *query, void *entity, qdr_agent_column_t column)
+{
+    for (int i = 0; i < query->filter_count; i++) {
+        qd_composed_field_t *field = qd_compose_subfield(0);
+        qd_buffer_list_t     buffers;
+
+        column(core, field, query->filters[i].column, entity);
+        qd_compose_take_buffers(field, &buffers);
+        qd_compose_free(field);
+
+        qd_iterator_t     *iter  = qd_iterator_buffer(DEQ_HEAD(buffers), 0, qd_buffer_list_length(&buffers), ITER_VIEW_ALL);
+        qd_parsed_field_t *value = qd_parse(iter);
+        bool               match = qd_parse_ok(value) && qdr_agent_filter_test(&query->filters[i], value);
+
+        qd_parse_free(value);
+        qd_iterator_free(iter);
+        qd_buffer_list_free_buffers(&buffers);
+        if (!match)
+            return false;
+    }
+    return true;
+}
+
+
+bool qdr_agent_scan_CT(qdr_core_t *core, qdr_query_t *query, void **entity,
+                       qdr_agent_column_t column, qdr_agent_next_t next)
+{
+    int scanned = 0;
+
+    if (query->filter_count == 0)
+        return true;
+
+    while (*entity) {
+        if (qdr_agent_filter_match_CT(core, query, *entity, column)) {
+            if (query->filter_skip == 0)
+                return true;
+            query->filter_skip--;
+        }
+
+        *entity = next(*entity);
+        if (++scanned == QDR_AGENT_SCAN_QUANTUM && *entity) {
+            //
+            // Give the core back to other work and continue in a fresh action.
+            //
+            qdr_agent_set_cursor_CT(core, query, *entity);
+            qdr_query_get_next(query);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void qdr_agent_insert_latency(qd_composed_field_t *body, const uint64_t *histogram)
+{
+    qd_compose_start_list(body);
+    for (int i = 0; i < QDR_LATENCY_BUCKETS; i++)
+        qd_compose_insert_ulong(body, histogram[i]);
+    qd_compose_end_list(body);
+}
+
+
 void qdr_query_add_attribute_names(qdr_query_t *query)
 {
     switch (query->entity_type) {
@@ -212,6 +486,7 @@ void qdr_query_add_attribute_names(qdr_query_t *query)
     case QD_ROUTER_CONNECTION:        qdr_agent_emit_columns(query, qdr_connection_columns, QDR_CONNECTION_COLUMN_COUNT); break;
     case QD_ROUTER_LINK:              qdr_agent_emit_columns(query, qdr_link_columns, QDR_LINK_COLUMN_COUNT); break;
     case QD_ROUTER_ADDRESS:           qdr_agent_emit_columns(query, qdr_address_columns, QDR_ADDRESS_COLUMN_COUNT); break;
+    case QD_ROUTER_CORE_ACTION:       qdr_agent_emit_columns(query, qdr_core_action_columns, QDR_CORE_ACTION_COLUMN_COUNT); break;
     case QD_ROUTER_FORBIDDEN:         qd_compose_empty_list(query->body); break;
     case QD_ROUTER_EXCHANGE:          break;
     case QD_ROUTER_BINDING:           break;
@@ -240,9 +515,23 @@ void qdr_query_free(qdr_query_t *query)
     if (!query)
         return;
 
+    //
+    // A query abandoned part way through still sits on the core's cursor list.
+    // It must be unlinked on the core thread before it can be freed.
+    //
+    if (query->cursor_held) {
+        qdr_action_t *action = qdr_action(qdrh_query_free_CT, "query_free");
+        action->args.agent.query = query;
+        qdr_action_enqueue(query->core, action);
+        return;
+    }
+
     if (query->next_key)
         qdr_field_free(query->next_key);
 
+    for (int i = 0; i < query->filter_count; i++)
+        free(query->filters[i].text);
+
     free_qdr_query_t(query);
 }
 
@@ -326,7 +615,6 @@ void qdr_agent_setup_CT(qdr_core_t *core)
 {
     DEQ_INIT(core->outgoing_query_list);
     core->query_lock  = sys_mutex();
-    core->agent_timer = qd_timer(core->qd, qdr_agent_response_handler, core);
 }
 
 
@@ -353,6 +641,7 @@ static void qdr_manage_read_CT(qdr_core_t *core, qdr_action_t *action, bool disc
     case QD_ROUTER_CONNECTION:        qdra_connection_get_CT(core, name, identity, query, qdr_connection_columns); break;
     case QD_ROUTER_LINK:              break;
     case QD_ROUTER_ADDRESS:           qdra_address_get_CT(core, name, identity, query, qdr_address_columns); break;
+    case QD_ROUTER_CORE_ACTION:       qdr_agent_forbidden(core, query, false); break;
     case QD_ROUTER_FORBIDDEN:         qdr_agent_forbidden(core, query, false); break;
     case QD_ROUTER_EXCHANGE:          break;
     case QD_ROUTER_BINDING:           break;
@@ -363,7 +652,7 @@ static void qdr_manage_read_CT(qdr_core_t *core, qdr_action_t *action, bool disc
 }
 
 
-static void qdr_manage_create_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+static void qdr_manage_create_one_CT(qdr_core_t *core, qdr_action_t *action)
 {
     qd_iterator_t     *name         = qdr_field_iterator(action->args.agent.name);
     qdr_query_t       *query        = action->args.agent.query;
@@ -378,6 +667,7 @@ static void qdr_manage_create_CT(qdr_core_t *core, qdr_action_t *action, bool di
     case QD_ROUTER_ROUTER:            qdr_agent_forbidden(core, query, false); break;
     case QD_ROUTER_LINK:              break;
     case QD_ROUTER_ADDRESS:           break;
+    case QD_ROUTER_CORE_ACTION:       qdr_agent_forbidden(core, query, false); break;
     case QD_ROUTER_FORBIDDEN:         qdr_agent_forbidden(core, query, false); break;
     case QD_ROUTER_EXCHANGE:          break;
     case QD_ROUTER_BINDING:           break;
@@ -390,6 +680,20 @@ static void qdr_manage_create_CT(qdr_core_t *core, qdr_action_t *action, bool di
 }
 
 
+static void qdr_manage_create_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    qdr_action_t *more = action->args.agent.more;
+
+    qdr_manage_create_one_CT(core, action);
+    while (more) {
+        qdr_action_t *next = more->args.agent.more;
+        qdr_manage_create_one_CT(core, more);
+        free_qdr_action_t(more);
+        more = next;
+    }
+}
+
+
 static void qdr_manage_delete_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
 {
     qd_iterator_t *name     = qdr_field_iterator(action->args.agent.name);
@@ -404,6 +708,7 @@ static void qdr_manage_delete_CT(qdr_core_t *core, qdr_action_t *action, bool di
     case QD_ROUTER_ROUTER:            qdr_agent_forbidden(core, query, false); break;
     case QD_ROUTER_LINK:              break;
     case QD_ROUTER_ADDRESS:           break;
+    case QD_ROUTER_CORE_ACTION:       qdr_agent_forbidden(core, query, false); break;
     case QD_ROUTER_FORBIDDEN:         qdr_agent_forbidden(core, query, false); break;
     case QD_ROUTER_EXCHANGE:          break;
     case QD_ROUTER_BINDING:           break;
@@ -428,6 +733,7 @@ static void qdr_manage_update_CT(qdr_core_t *core, qdr_action_t *action, bool di
     case QD_ROUTER_ROUTER:            break;
     case QD_ROUTER_LINK:              qdra_link_update_CT(core, name, identity, query, in_body); break;
     case QD_ROUTER_ADDRESS:           break;
+    case QD_ROUTER_CORE_ACTION:       qdr_agent_forbidden(core, query, false); break;
     case QD_ROUTER_FORBIDDEN:         qdr_agent_forbidden(core, query, false); break;
     case QD_ROUTER_EXCHANGE:          break;
     case QD_ROUTER_BINDING:           break;
@@ -446,6 +752,13 @@ static void qdrh_query_get_first_CT(qdr_core_t *core, qdr_action_t *action, bool
     qdr_query_t *query  = action->args.agent.query;
     int          offset = action->args.agent.offset;
 
+    if (!discard && query->filter_invalid) {
+        query->status = QD_AMQP_BAD_REQUEST;
+        query->more   = false;
+        qdr_agent_enqueue_response_CT(core, query);
+        return;
+    }
+
     if (!discard) {
         switch (query->entity_type) {
         case QD_ROUTER_CONFIG_ADDRESS:    qdra_config_address_get_first_CT(core, query, offset); break;
@@ -455,6 +768,7 @@ static void qdrh_query_get_first_CT(qdr_core_t *core, qdr_action_t *action, bool
         case QD_ROUTER_CONNECTION:        qdra_connection_get_first_CT(core, query, offset); break;
         case QD_ROUTER_LINK:              qdra_link_get_first_CT(core, query, offset); break;
         case QD_ROUTER_ADDRESS:           qdra_address_get_first_CT(core, query, offset); break;
+        case QD_ROUTER_CORE_ACTION:       qdra_core_action_get_first_CT(core, query, offset); break;
         case QD_ROUTER_FORBIDDEN:         qdr_agent_forbidden(core, query, true); break;
         case QD_ROUTER_EXCHANGE:          break;
         case QD_ROUTER_BINDING:           break;
@@ -476,6 +790,7 @@ static void qdrh_query_get_next_CT(qdr_core_t *core, qdr_action_t *action, bool
         case QD_ROUTER_CONNECTION:        qdra_connection_get_next_CT(core, query); break;
         case QD_ROUTER_LINK:              qdra_link_get_next_CT(core, query); break;
         case QD_ROUTER_ADDRESS:           qdra_address_get_next_CT(core, query); break;
+        case QD_ROUTER_CORE_ACTION:       qdra_core_action_get_next_CT(core, query); break;
         case QD_ROUTER_FORBIDDEN:         break;
         case QD_ROUTER_EXCHANGE:          break;
         case QD_ROUTER_BINDING:           break;
@@ -483,3 +798,27 @@ static void qdrh_query_get_next_CT(qdr_core_t *core, qdr_action_t *action, bool
     }
 }
 
+
+static void qdrh_query_free_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    qdr_query_t *query = action->args.agent.query;
+
+    qdr_agent_set_cursor_CT(core, query, 0);
+    qdr_query_free(query);
+}
+
+
+static const char **qdr_agent_columns(qd_router_entity_type_t type, int *column_count)
+{
+    switch (type) {
+    case QD_ROUTER_CONFIG_ADDRESS:    *column_count = QDR_CONFIG_ADDRESS_COLUMN_COUNT;    return qdr_config_address_columns;
+    case QD_ROUTER_CONFIG_LINK_ROUTE: *column_count = QDR_CONFIG_LINK_ROUTE_COLUMN_COUNT; return qdr_config_link_route_columns;
+    case QD_ROUTER_CONFIG_AUTO_LINK:  *column_count = QDR_CONFIG_AUTO_LINK_COLUMN_COUNT;  return qdr_config_auto_link_columns;
+    case QD_ROUTER_ROUTER:            *column_count = QDR_ROUTER_COLUMN_COUNT;            return qdr_router_columns;
+    case QD_ROUTER_CONNECTION:        *column_count = QDR_CONNECTION_COLUMN_COUNT;        return qdr_connection_columns;
+    case QD_ROUTER_LINK:              *column_count = QDR_LINK_COLUMN_COUNT;              return qdr_link_columns;
+    case QD_ROUTER_ADDRESS:           *column_count = QDR_ADDRESS_COLUMN_COUNT;           return qdr_address_columns;
+    case QD_ROUTER_CORE_ACTION:       *column_count = QDR_CORE_ACTION_COLUMN_COUNT;       return qdr_core_action_columns;
+    default:                          *column_count = 0;                                  return 0;
+    }
+}
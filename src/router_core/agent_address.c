@@ -37,6 +37,9 @@
 #define QDR_ADDRESS_DELIVERIES_FROM_CONTAINER 14
 #define QDR_ADDRESS_TRANSIT_OUTSTANDING       15
 #define QDR_ADDRESS_TRACKED_DELIVERIES        16
+#define QDR_ADDRESS_DROPPED_PRESETTLED        17
+#define QDR_ADDRESS_DELIVER_LATENCY           18
+#define QDR_ADDRESS_SETTLE_LATENCY            19
 
 const char *qdr_address_columns[] =
     {"name",
@@ -56,8 +59,14 @@ const char *qdr_address_columns[] =
      "deliveriesFromContainer",
      "transitOutstanding",
      "trackedDeliveries",
+     "droppedPresettledDeliveries",
+     "deliverLatency",
+     "settleLatency",
      0};
 
+// The latency histograms of an address that has not yet sent on a local link
+static const uint64_t no_latency[QDR_LATENCY_BUCKETS];
+
 
 static void qdr_insert_address_columns_CT(qdr_core_t          *core,
                                           qdr_address_t       *addr,
@@ -154,6 +163,18 @@ static void qdr_insert_address_columns_CT(qdr_core_t          *core,
         qd_compose_insert_long(body, addr->tracked_deliveries);
         break;
 
+    case QDR_ADDRESS_DROPPED_PRESETTLED:
+        qd_compose_insert_ulong(body, addr->dropped_presettled_deliveries);
+        break;
+
+    case QDR_ADDRESS_DELIVER_LATENCY:
+        qdr_agent_insert_latency(body, addr->latency ? addr->latency->deliver : no_latency);
+        break;
+
+    case QDR_ADDRESS_SETTLE_LATENCY:
+        qdr_agent_insert_latency(body, addr->latency ? addr->latency->settle : no_latency);
+        break;
+
     default:
         qd_compose_insert_null(body);
         break;
@@ -200,11 +221,8 @@ static void qdr_manage_advance_address_CT(qdr_query_t *query, qdr_address_t *add
 {
     query->next_offset++;
     addr = DEQ_NEXT(addr);
-    if (addr) {
-        query->more     = true;
-        query->next_key = qdr_field((const char*) qd_hash_key_by_handle(addr->hash_handle));
-    } else
-        query->more = false;
+    qdr_agent_set_cursor_CT(query->core, query, addr);
+    query->more = !!addr;
 }
 
 void qdra_address_get_CT(qdr_core_t    *core,
@@ -240,6 +258,18 @@ void qdra_address_get_CT(qdr_core_t    *core,
 }
 
 
+static void qdr_address_filter_column_CT(qdr_core_t *core, qd_composed_field_t *field, int col, void *entity)
+{
+    qdr_insert_address_columns_CT(core, (qdr_address_t*) entity, field, col);
+}
+
+
+static void *qdr_address_next(void *entity)
+{
+    return DEQ_NEXT((qdr_address_t*) entity);
+}
+
+
 void qdra_address_get_first_CT(qdr_core_t *core, qdr_query_t *query, int offset)
 {
     //
@@ -247,6 +277,17 @@ void qdra_address_get_first_CT(qdr_core_t *core, qdr_query_t *query, int offset)
     //
     query->status = QD_AMQP_OK;
 
+    //
+    // A filtered query counts its offset in matching addresses, so it scans from
+    // the head like any later page.
+    //
+    if (query->filter_count) {
+        query->filter_skip = offset;
+        qdr_agent_set_cursor_CT(core, query, DEQ_HEAD(core->addrs));
+        qdra_address_get_next_CT(core, query);
+        return;
+    }
+
     //
     // If the offset goes beyond the set of addresses, end the query now.
     //
@@ -284,27 +325,14 @@ void qdra_address_get_first_CT(qdr_core_t *core, qdr_query_t *query, int offset)
 
 void qdra_address_get_next_CT(qdr_core_t *core, qdr_query_t *query)
 {
-    qdr_address_t *addr = 0;
-
     //
-    // Use the stored key to try to find the next entry in the table.
+    // Resume at the cursor left by the previous page.  Addresses removed in the
+    // meantime have already stepped the cursor past themselves.
     //
-    if (query->next_key) {
-        qd_hash_retrieve(core->addr_hash, query->next_key->iterator, (void**) &addr);
-        qdr_field_free(query->next_key);
-        query->next_key = 0;
-    }
-    if (!addr) {
-        //
-        // If the address was removed in the time between this get and the previous one,
-        // we need to use the saved offset, which is less efficient.
-        //
-        if (query->next_offset < DEQ_SIZE(core->addrs)) {
-            addr = DEQ_HEAD(core->addrs);
-            for (int i = 0; i < query->next_offset && addr; i++)
-                addr = DEQ_NEXT(addr);
-        }
-    }
+    qdr_address_t *addr = (qdr_address_t*) query->cursor;
+
+    if (!qdr_agent_scan_CT(core, query, (void**) &addr, qdr_address_filter_column_CT, qdr_address_next))
+        return;
 
     if (addr) {
         //
@@ -316,8 +344,10 @@ void qdra_address_get_next_CT(qdr_core_t *core, qdr_query_t *query)
         // Advance to the next address
         //
         qdr_manage_advance_address_CT(query, addr);
-    } else
+    } else {
         query->more = false;
+        qdr_agent_set_cursor_CT(core, query, 0);
+    }
 
     //
     // Enqueue the response.
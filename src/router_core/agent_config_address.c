@@ -30,6 +30,14 @@
 #define QDR_CONFIG_ADDRESS_WAYPOINT      5
 #define QDR_CONFIG_ADDRESS_IN_PHASE      6
 #define QDR_CONFIG_ADDRESS_OUT_PHASE     7
+#define QDR_CONFIG_ADDRESS_PATTERN       8
+#define QDR_CONFIG_ADDRESS_OVERFLOW      9
+#define QDR_CONFIG_ADDRESS_DEPTH         10
+#define QDR_CONFIG_ADDRESS_OCTETS        11
+#define QDR_CONFIG_ADDRESS_CONFLATE_KEY  12
+#define QDR_CONFIG_ADDRESS_MC_COMPLETION 13
+#define QDR_CONFIG_ADDRESS_MC_QUORUM     14
+#define QDR_CONFIG_ADDRESS_GROUP_AFFINITY 15
 
 const char *qdr_config_address_columns[] =
     {"name",
@@ -40,6 +48,14 @@ const char *qdr_config_address_columns[] =
      "waypoint",
      "ingressPhase",
      "egressPhase",
+     "pattern",
+     "presettledOverflow",
+     "presettledDepth",
+     "presettledBytes",
+     "conflationKey",
+     "multicastCompletion",
+     "multicastQuorum",
+     "groupAffinity",
      0};
 
 const char *CONFIG_ADDRESS_TYPE = "org.apache.qpid.dispatch.router.config.address";
@@ -79,6 +95,13 @@ static void qdr_config_address_insert_column_CT(qdr_address_config_t *addr, int
             qd_compose_insert_null(body);
         break;
 
+    case QDR_CONFIG_ADDRESS_PATTERN:
+        if (addr->pattern)
+            qd_compose_insert_string(body, addr->pattern);
+        else
+            qd_compose_insert_null(body);
+        break;
+
     case QDR_CONFIG_ADDRESS_DISTRIBUTION:
         switch (addr->treatment) {
         case QD_TREATMENT_MULTICAST_FLOOD:
@@ -107,6 +130,46 @@ static void qdr_config_address_insert_column_CT(qdr_address_config_t *addr, int
     case QDR_CONFIG_ADDRESS_OUT_PHASE:
         qd_compose_insert_int(body, addr->out_phase);
         break;
+
+    case QDR_CONFIG_ADDRESS_OVERFLOW:
+        switch (addr->shed.mode) {
+        case QDR_SHED_DROP_ALL:    text = "drop-all";    break;
+        case QDR_SHED_DROP_OLDEST: text = "drop-oldest"; break;
+        case QDR_SHED_DROP_NEWEST: text = "drop-newest"; break;
+        case QDR_SHED_CONFLATE:    text = "conflate";    break;
+        }
+        qd_compose_insert_string(body, text);
+        break;
+
+    case QDR_CONFIG_ADDRESS_DEPTH:
+        qd_compose_insert_int(body, addr->shed.depth);
+        break;
+
+    case QDR_CONFIG_ADDRESS_OCTETS:
+        qd_compose_insert_ulong(body, addr->shed.octets);
+        break;
+
+    case QDR_CONFIG_ADDRESS_CONFLATE_KEY:
+        qd_compose_insert_string(body, addr->shed.conflate_key == QD_FIELD_GROUP_ID ? "group-id" : "subject");
+        break;
+
+    case QDR_CONFIG_ADDRESS_MC_COMPLETION:
+        switch (addr->multicast_rule) {
+        case QDR_MULTICAST_PRESETTLE: text = "presettled"; break;
+        case QDR_MULTICAST_ALL:       text = "all";        break;
+        case QDR_MULTICAST_ANY:       text = "any";        break;
+        case QDR_MULTICAST_QUORUM:    text = "quorum";     break;
+        }
+        qd_compose_insert_string(body, text);
+        break;
+
+    case QDR_CONFIG_ADDRESS_MC_QUORUM:
+        qd_compose_insert_int(body, addr->multicast_quorum);
+        break;
+
+    case QDR_CONFIG_ADDRESS_GROUP_AFFINITY:
+        qd_compose_insert_int(body, addr->group_affinity);
+        break;
     }
 }
 
@@ -217,6 +280,52 @@ static qd_address_treatment_t qdra_address_treatment_CT(qd_parsed_field_t *field
 }
 
 
+static bool qdra_address_shed_mode_CT(qd_parsed_field_t *field, qdr_shed_mode_t *mode)
+{
+    *mode = QDR_SHED_DROP_ALL;
+    if (field) {
+        qd_iterator_t *iter = qd_parse_raw(field);
+        if      (qd_iterator_equal(iter, (unsigned char*) "drop-all"))    *mode = QDR_SHED_DROP_ALL;
+        else if (qd_iterator_equal(iter, (unsigned char*) "drop-oldest")) *mode = QDR_SHED_DROP_OLDEST;
+        else if (qd_iterator_equal(iter, (unsigned char*) "drop-newest")) *mode = QDR_SHED_DROP_NEWEST;
+        else if (qd_iterator_equal(iter, (unsigned char*) "conflate"))    *mode = QDR_SHED_CONFLATE;
+        else
+            return false;
+    }
+    return true;
+}
+
+
+static bool qdra_address_conflate_key_CT(qd_parsed_field_t *field, qd_message_field_t *key)
+{
+    *key = QD_FIELD_SUBJECT;
+    if (field) {
+        qd_iterator_t *iter = qd_parse_raw(field);
+        if      (qd_iterator_equal(iter, (unsigned char*) "subject"))  *key = QD_FIELD_SUBJECT;
+        else if (qd_iterator_equal(iter, (unsigned char*) "group-id")) *key = QD_FIELD_GROUP_ID;
+        else
+            return false;
+    }
+    return true;
+}
+
+
+static bool qdra_address_multicast_rule_CT(qd_parsed_field_t *field, qdr_multicast_rule_t *rule)
+{
+    *rule = QDR_MULTICAST_PRESETTLE;
+    if (field) {
+        qd_iterator_t *iter = qd_parse_raw(field);
+        if      (qd_iterator_equal(iter, (unsigned char*) "presettled")) *rule = QDR_MULTICAST_PRESETTLE;
+        else if (qd_iterator_equal(iter, (unsigned char*) "all"))        *rule = QDR_MULTICAST_ALL;
+        else if (qd_iterator_equal(iter, (unsigned char*) "any"))        *rule = QDR_MULTICAST_ANY;
+        else if (qd_iterator_equal(iter, (unsigned char*) "quorum"))     *rule = QDR_MULTICAST_QUORUM;
+        else
+            return false;
+    }
+    return true;
+}
+
+
 static qdr_address_config_t *qdr_address_config_find_by_identity_CT(qdr_core_t *core, qd_iterator_t *identity)
 {
     if (!identity)
@@ -318,32 +427,49 @@ void qdra_config_address_create_CT(qdr_core_t         *core,
         // Extract the fields from the request
         //
         qd_parsed_field_t *prefix_field    = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_PREFIX]);
+        qd_parsed_field_t *pattern_field   = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_PATTERN]);
         qd_parsed_field_t *distrib_field   = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_DISTRIBUTION]);
         qd_parsed_field_t *waypoint_field  = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_WAYPOINT]);
         qd_parsed_field_t *in_phase_field  = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_IN_PHASE]);
         qd_parsed_field_t *out_phase_field = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_OUT_PHASE]);
+        qd_parsed_field_t *overflow_field  = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_OVERFLOW]);
+        qd_parsed_field_t *depth_field     = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_DEPTH]);
+        qd_parsed_field_t *octets_field    = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_OCTETS]);
+        qd_parsed_field_t *conflate_field  = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_CONFLATE_KEY]);
+        qd_parsed_field_t *mc_rule_field   = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_MC_COMPLETION]);
+        qd_parsed_field_t *mc_quorum_field = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_MC_QUORUM]);
+        qd_parsed_field_t *group_field     = qd_parse_value_by_key(in_body, qdr_config_address_columns[QDR_CONFIG_ADDRESS_GROUP_AFFINITY]);
 
         //
-        // Prefix field is mandatory.  Fail if it is not here.
+        // Exactly one of the prefix and pattern fields is mandatory.
         //
-        if (!prefix_field) {
+        if (!!prefix_field == !!pattern_field) {
             query->status = QD_AMQP_BAD_REQUEST;
-            query->status.description = "prefix field is mandatory";
+            query->status.description = "Exactly one of prefix and pattern must be specified";
             qd_log(core->agent_log, QD_LOG_ERROR, "Error performing CREATE of %s: %s", CONFIG_ADDRESS_TYPE, query->status.description);
             break;
         }
 
         //
-        // Ensure that there isn't another configured address with the same prefix
+        // Ensure that there isn't another configured address with the same prefix or pattern
         //
-        qd_iterator_t *iter = qd_parse_raw(prefix_field);
-        qd_iterator_reset_view(iter, ITER_VIEW_ADDRESS_HASH);
-        qd_iterator_annotate_prefix(iter, 'Z');
+        qd_iterator_t *iter    = 0;
+        char          *pattern = 0;
         addr = 0;
-        qd_hash_retrieve(core->addr_hash, iter, (void**) &addr);
+        if (prefix_field) {
+            iter = qd_parse_raw(prefix_field);
+            qd_iterator_reset_view(iter, ITER_VIEW_ADDRESS_HASH);
+            qd_iterator_annotate_prefix(iter, 'Z');
+            qd_hash_retrieve(core->addr_hash, iter, (void**) &addr);
+        } else {
+            pattern = (char*) qd_iterator_copy(qd_parse_raw(pattern_field));
+            addr    = (qdr_address_config_t*) qd_parse_tree_get_pattern(core->addr_parse_tree, pattern);
+        }
+
         if (!!addr) {
+            free(pattern);
             query->status = QD_AMQP_BAD_REQUEST;
-            query->status.description = "Address prefix conflicts with an existing entity";
+            query->status.description = "Address prefix or pattern conflicts with an existing entity";
             qd_log(core->agent_log, QD_LOG_ERROR, "Error performing CREATE of %s: %s", CONFIG_ADDRESS_TYPE, query->status.description);
             break;
         }
@@ -365,6 +491,7 @@ void qdra_config_address_create_CT(qdr_core_t         *core,
         // Validate the phase values
         //
         if (in_phase < 0 || in_phase > 9 || out_phase < 0 || out_phase > 9) {
+            free(pattern);
             query->status = QD_AMQP_BAD_REQUEST;
             query->status.description = "Phase values must be between 0 and 9";
             qd_log(core->agent_log, QD_LOG_ERROR, "Error performing CREATE of %s: %s", CONFIG_ADDRESS_TYPE, query->status.description);
@@ -372,17 +499,71 @@ void qdra_config_address_create_CT(qdr_core_t         *core,
         }
 
         //
-        // The request is good.  Create the entity and insert it into the hash index and list.
+        // Validate the overflow policy for pre-settled deliveries
+        //
+        qdr_shed_policy_t shed;
+        int64_t octets = octets_field ? qd_parse_as_long(octets_field) : 0;
+        shed.depth     = depth_field  ? qd_parse_as_int(depth_field)   : 0;
+        shed.octets    = octets > 0 ? (uint64_t) octets : 0;
+        if (!qdra_address_shed_mode_CT(overflow_field, &shed.mode)
+            || !qdra_address_conflate_key_CT(conflate_field, &shed.conflate_key)
+            || shed.depth < 0 || octets < 0) {
+            free(pattern);
+            query->status = QD_AMQP_BAD_REQUEST;
+            query->status.description = "Invalid presettled overflow policy";
+            qd_log(core->agent_log, QD_LOG_ERROR, "Error performing CREATE of %s: %s", CONFIG_ADDRESS_TYPE, query->status.description);
+            break;
+        }
+
+        //
+        // Validate the settlement of unsettled multicast deliveries
+        //
+        qdr_multicast_rule_t multicast_rule;
+        int multicast_quorum = mc_quorum_field ? qd_parse_as_int(mc_quorum_field) : 0;
+        if (!qdra_address_multicast_rule_CT(mc_rule_field, &multicast_rule)
+            || (multicast_rule == QDR_MULTICAST_QUORUM && multicast_quorum < 1)) {
+            free(pattern);
+            query->status = QD_AMQP_BAD_REQUEST;
+            query->status.description = "Invalid multicast completion; quorum requires a multicastQuorum of at least 1";
+            qd_log(core->agent_log, QD_LOG_ERROR, "Error performing CREATE of %s: %s", CONFIG_ADDRESS_TYPE, query->status.description);
+            break;
+        }
+
+        //
+        // Validate the group affinity, which only balanced addresses have
+        //
+        qd_address_treatment_t treatment = qdra_address_treatment_CT(distrib_field);
+        int group_affinity = group_field ? qd_parse_as_int(group_field) : 0;
+        if (group_affinity < 0 || (group_affinity > 0 && treatment != QD_TREATMENT_ANYCAST_BALANCED)) {
+            free(pattern);
+            query->status = QD_AMQP_BAD_REQUEST;
+            query->status.description = "Invalid group affinity; it must not be negative and requires balanced distribution";
+            qd_log(core->agent_log, QD_LOG_ERROR, "Error performing CREATE of %s: %s", CONFIG_ADDRESS_TYPE, query->status.description);
+            break;
+        }
+
+        //
+        // The request is good.  Create the entity and insert it into the hash index (or pattern
+        // tree) and list.
         //
         addr = new_qdr_address_config_t();
         DEQ_ITEM_INIT(addr);
-        addr->name      = name ? (char*) qd_iterator_copy(name) : 0;
-        addr->identity  = qdr_identifier(core);
-        addr->treatment = qdra_address_treatment_CT(distrib_field);
-        addr->in_phase  = in_phase;
-        addr->out_phase = out_phase;
-
-        qd_hash_insert(core->addr_hash, iter, addr, &addr->hash_handle);
+        addr->hash_handle = 0;
+        addr->pattern     = pattern;
+        addr->name        = name ? (char*) qd_iterator_copy(name) : 0;
+        addr->identity    = qdr_identifier(core);
+        addr->treatment   = treatment;
+        addr->in_phase    = in_phase;
+        addr->out_phase   = out_phase;
+        addr->shed             = shed;
+        addr->multicast_rule   = multicast_rule;
+        addr->multicast_quorum = multicast_quorum;
+        addr->group_affinity   = group_affinity;
+
+        if (pattern)
+            qd_parse_tree_add_pattern(core->addr_parse_tree, pattern, addr);
+        else
+            qd_hash_insert(core->addr_hash, iter, addr, &addr->hash_handle);
         DEQ_INSERT_TAIL(core->addr_config, addr);
 
         //
@@ -133,6 +133,7 @@ static void qdr_config_auto_link_insert_column_CT(qdr_auto_link_t *al, int col,
     case QDR_CONFIG_AUTO_LINK_OPER_STATUS:
         switch (al->state) {
         case QDR_AUTO_LINK_STATE_INACTIVE:  text = "inactive";  break;
+        case QDR_AUTO_LINK_STATE_QUEUED:    text = "queued";    break;
         case QDR_AUTO_LINK_STATE_ATTACHING: text = "attaching"; break;
         case QDR_AUTO_LINK_STATE_FAILED:    text = "failed";    break;
         case QDR_AUTO_LINK_STATE_ACTIVE:    text = "active";    break;
@@ -32,6 +32,7 @@
 #define QDR_CONFIG_LINK_ROUTE_CONTAINER_ID  6
 #define QDR_CONFIG_LINK_ROUTE_DIR           7
 #define QDR_CONFIG_LINK_ROUTE_OPER_STATUS   8
+#define QDR_CONFIG_LINK_ROUTE_PATTERN       9
 
 const char *qdr_config_link_route_columns[] =
     {"name",
@@ -43,6 +44,7 @@ const char *qdr_config_link_route_columns[] =
      "containerId",
      "dir",
      "operStatus",
+     "pattern",
      0};
 
 const char *CONFIG_LINKROUTE_TYPE = "org.apache.qpid.dispatch.router.config.linkRoute";
@@ -84,6 +86,14 @@ static void qdr_config_link_route_insert_column_CT(qdr_link_route_t *lr, int col
             qd_compose_insert_null(body);
         break;
 
+    case QDR_CONFIG_LINK_ROUTE_PATTERN:
+        key = (const char*) qd_hash_key_by_handle(lr->addr->hash_handle);
+        if (key && (key[0] == QDR_LINK_ROUTE_PATTERN_IN || key[0] == QDR_LINK_ROUTE_PATTERN_OUT))
+            qd_compose_insert_string(body, &key[1]);
+        else
+            qd_compose_insert_null(body);
+        break;
+
     case QDR_CONFIG_LINK_ROUTE_DISTRIBUTION:
         switch (lr->treatment) {
         case QD_TREATMENT_LINK_BALANCED: text = "linkBalanced"; break;
@@ -375,6 +385,7 @@ void qdra_config_link_route_create_CT(qdr_core_t        *core,
         // Extract the fields from the request
         //
         qd_parsed_field_t *prefix_field     = qd_parse_value_by_key(in_body, qdr_config_link_route_columns[QDR_CONFIG_LINK_ROUTE_PREFIX]);
+        qd_parsed_field_t *pattern_field    = qd_parse_value_by_key(in_body, qdr_config_link_route_columns[QDR_CONFIG_LINK_ROUTE_PATTERN]);
         qd_parsed_field_t *distrib_field    = qd_parse_value_by_key(in_body, qdr_config_link_route_columns[QDR_CONFIG_LINK_ROUTE_DISTRIBUTION]);
         qd_parsed_field_t *connection_field = qd_parse_value_by_key(in_body, qdr_config_link_route_columns[QDR_CONFIG_LINK_ROUTE_CONNECTION]);
         qd_parsed_field_t *container_field  = qd_parse_value_by_key(in_body, qdr_config_link_route_columns[QDR_CONFIG_LINK_ROUTE_CONTAINER_ID]);
@@ -392,11 +403,21 @@ void qdra_config_link_route_create_CT(qdr_core_t        *core,
         }
 
         //
-        // Prefix and dir fields are mandatory.  Fail if they're not both here.
+        // Exactly one of prefix and pattern must be given.
+        //
+        if (!!prefix_field == !!pattern_field) {
+            query->status = QD_AMQP_BAD_REQUEST;
+            query->status.description = "Exactly one of prefix and pattern must be specified";
+            qd_log(core->agent_log, QD_LOG_ERROR, "Error performing CREATE of %s: %s", CONFIG_LINKROUTE_TYPE, query->status.description);
+            break;
+        }
+
+        //
+        // The dir field is mandatory.
         //
-        if (!prefix_field || !dir_field) {
+        if (!dir_field) {
             query->status = QD_AMQP_BAD_REQUEST;
-            query->status.description = "prefix and dir fields are mandatory";
+            query->status.description = "dir field is mandatory";
             qd_log(core->agent_log, QD_LOG_ERROR, "Error performing CREATE of %s: %s", CONFIG_LINKROUTE_TYPE, query->status.description);
             break;
         }
@@ -422,7 +443,10 @@ void qdra_config_link_route_create_CT(qdr_core_t        *core,
         //
         // The request is good.  Create the entity.
         //
-        lr = qdr_route_add_link_route_CT(core, name, prefix_field, container_field, connection_field, trt, dir);
+        if (pattern_field)
+            lr = qdr_route_add_link_route_CT(core, name, pattern_field, true, container_field, connection_field, trt, dir);
+        else
+            lr = qdr_route_add_link_route_CT(core, name, prefix_field, false, container_field, connection_field, trt, dir);
 
         //
         // Compose the result map for the response.
@@ -40,6 +40,12 @@
 #define QDR_CONNECTION_TYPE             15
 #define QDR_CONNECTION_SSL              16
 #define QDR_CONNECTION_OPENED           17
+#define QDR_CONNECTION_BYTES_IN         18
+#define QDR_CONNECTION_WIRE_BYTES_IN    19
+#define QDR_CONNECTION_BYTES_OUT        20
+#define QDR_CONNECTION_WIRE_BYTES_OUT   21
+#define QDR_CONNECTION_COMPRESSION_PCT  22
+#define QDR_CONNECTION_COMPRESSION_USEC 23
 
 const char * const QDR_CONNECTION_DIR_IN  = "in";
 const char * const QDR_CONNECTION_DIR_OUT = "out";
@@ -49,6 +55,8 @@ const char *qdr_connection_roles[] =
      "inter-router",
      "route-container",
      "on-demand",
+     "inter-router-data",
+     "edge",
      0};
 
 const char *qdr_connection_columns[] =
@@ -70,6 +78,12 @@ const char *qdr_connection_columns[] =
      "type",
      "ssl",
      "opened",
+     "uncompressedBytesIn",
+     "compressedBytesIn",
+     "uncompressedBytesOut",
+     "compressedBytesOut",
+     "compressionPercent",
+     "compressionUsec",
      0};
 
 const char *CONNECTION_TYPE = "org.apache.qpid.dispatch.connection";
@@ -193,6 +207,31 @@ static void qdr_connection_insert_column_CT(qdr_connection_t *conn, int col, qd_
         qd_compose_insert_bool(body, conn->connection_info->opened);
         break;
 
+    case QDR_CONNECTION_BYTES_IN:
+    case QDR_CONNECTION_WIRE_BYTES_IN:
+    case QDR_CONNECTION_BYTES_OUT:
+    case QDR_CONNECTION_WIRE_BYTES_OUT:
+    case QDR_CONNECTION_COMPRESSION_PCT:
+    case QDR_CONNECTION_COMPRESSION_USEC: {
+        // Racy reads of counters owned by the connection's I/O thread
+        qdr_compression_stats_t *stats = conn->connection_info->compression;
+        if (!stats) {
+            qd_compose_insert_null(body);
+            break;
+        }
+        uint64_t bytes = stats->bytes_in + stats->bytes_out;
+        uint64_t wire  = stats->wire_bytes_in + stats->wire_bytes_out;
+        switch (col) {
+        case QDR_CONNECTION_BYTES_IN:         qd_compose_insert_ulong(body, stats->bytes_in); break;
+        case QDR_CONNECTION_WIRE_BYTES_IN:    qd_compose_insert_ulong(body, stats->wire_bytes_in); break;
+        case QDR_CONNECTION_BYTES_OUT:        qd_compose_insert_ulong(body, stats->bytes_out); break;
+        case QDR_CONNECTION_WIRE_BYTES_OUT:   qd_compose_insert_ulong(body, stats->wire_bytes_out); break;
+        case QDR_CONNECTION_COMPRESSION_PCT:  qd_compose_insert_ulong(body, bytes ? wire * 100 / bytes : 100); break;
+        case QDR_CONNECTION_COMPRESSION_USEC: qd_compose_insert_ulong(body, stats->compress_ns / 1000); break;
+        }
+        break;
+    }
+
     case QDR_CONNECTION_PROPERTIES: {
         pn_data_t *data = conn->connection_info->connection_properties;
         qd_compose_start_map(body);
@@ -251,10 +290,23 @@ static void qdr_manage_advance_connection_CT(qdr_query_t *query, qdr_connection_
 {
     query->next_offset++;
     conn = DEQ_NEXT(conn);
+    qdr_agent_set_cursor_CT(query->core, query, conn);
     query->more = !!conn;
 }
 
 
+static void qdr_connection_filter_column_CT(qdr_core_t *core, qd_composed_field_t *field, int col, void *entity)
+{
+    qdr_connection_insert_column_CT((qdr_connection_t*) entity, col, field, false);
+}
+
+
+static void *qdr_connection_next(void *entity)
+{
+    return DEQ_NEXT((qdr_connection_t*) entity);
+}
+
+
 void qdra_connection_get_first_CT(qdr_core_t *core, qdr_query_t *query, int offset)
 {
     //
@@ -262,6 +314,17 @@ void qdra_connection_get_first_CT(qdr_core_t *core, qdr_query_t *query, int offs
     //
     query->status = QD_AMQP_OK;
 
+    //
+    // A filtered query counts its offset in matching connections, so it scans from
+    // the head like any later page.
+    //
+    if (query->filter_count) {
+        query->filter_skip = offset;
+        qdr_agent_set_cursor_CT(core, query, DEQ_HEAD(core->open_connections));
+        qdra_connection_get_next_CT(core, query);
+        return;
+    }
+
     //
     // If the offset goes beyond the set of objects, end the query now.
     //
@@ -298,13 +361,14 @@ void qdra_connection_get_first_CT(qdr_core_t *core, qdr_query_t *query, int offs
 
 void qdra_connection_get_next_CT(qdr_core_t *core, qdr_query_t *query)
 {
-    qdr_connection_t *conn = 0;
+    //
+    // Resume at the cursor left by the previous page.  Connections closed in
+    // the meantime have already stepped the cursor past themselves.
+    //
+    qdr_connection_t *conn = (qdr_connection_t*) query->cursor;
 
-    if (query->next_offset < DEQ_SIZE(core->open_connections)) {
-        conn = DEQ_HEAD(core->open_connections);
-        for (int i = 0; i < query->next_offset && conn; i++)
-            conn = DEQ_NEXT(conn);
-    }
+    if (!qdr_agent_scan_CT(core, query, (void**) &conn, qdr_connection_filter_column_CT, qdr_connection_next))
+        return;
 
     if (conn) {
         //
@@ -316,8 +380,10 @@ void qdra_connection_get_next_CT(qdr_core_t *core, qdr_query_t *query)
         // Advance to the next object
         //
         qdr_manage_advance_connection_CT(query, conn);
-    } else
+    } else {
         query->more = false;
+        qdr_agent_set_cursor_CT(core, query, 0);
+    }
 
     //
     // Enqueue the response.
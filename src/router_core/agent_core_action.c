@@ -0,0 +1,163 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "agent_core_action.h"
+#include <inttypes.h>
+#include <stdio.h>
+
+#define QDR_CORE_ACTION_NAME               0
+#define QDR_CORE_ACTION_IDENTITY           1
+#define QDR_CORE_ACTION_TYPE               2
+#define QDR_CORE_ACTION_LABEL              3
+#define QDR_CORE_ACTION_COUNT              4
+#define QDR_CORE_ACTION_SERVICE_TIME       5
+#define QDR_CORE_ACTION_MAX_SERVICE_TIME   6
+#define QDR_CORE_ACTION_WAIT_TIME          7
+#define QDR_CORE_ACTION_SERVICE_HISTOGRAM  8
+#define QDR_CORE_ACTION_WAIT_HISTOGRAM     9
+
+const char *qdr_core_action_columns[] =
+    {"name",
+     "identity",
+     "type",
+     "label",
+     "count",
+     "serviceTime",
+     "maxServiceTime",
+     "waitTime",
+     "serviceHistogram",
+     "waitHistogram",
+     0};
+
+
+static void qdr_insert_histogram(qd_composed_field_t *body, const uint64_t *histogram)
+{
+    qd_compose_start_list(body);
+    for (int i = 0; i < QDR_ACTION_HISTOGRAM_BUCKETS; i++)
+        qd_compose_insert_ulong(body, histogram[i]);
+    qd_compose_end_list(body);
+}
+
+
+static void qdr_agent_write_column_CT(qd_composed_field_t *body, int col, qdr_action_stats_t *stats)
+{
+    switch(col) {
+    case QDR_CORE_ACTION_NAME:
+    case QDR_CORE_ACTION_IDENTITY:
+    case QDR_CORE_ACTION_LABEL:
+        qd_compose_insert_string(body, stats->label);
+        break;
+
+    case QDR_CORE_ACTION_TYPE:
+        qd_compose_insert_string(body, "org.apache.qpid.dispatch.router.coreAction");
+        break;
+
+    case QDR_CORE_ACTION_COUNT:
+        qd_compose_insert_ulong(body, stats->count);
+        break;
+
+    case QDR_CORE_ACTION_SERVICE_TIME:
+        qd_compose_insert_ulong(body, stats->service_ns / 1000);
+        break;
+
+    case QDR_CORE_ACTION_MAX_SERVICE_TIME:
+        qd_compose_insert_ulong(body, stats->max_service_ns / 1000);
+        break;
+
+    case QDR_CORE_ACTION_WAIT_TIME:
+        qd_compose_insert_ulong(body, stats->wait_ns / 1000);
+        break;
+
+    case QDR_CORE_ACTION_SERVICE_HISTOGRAM:
+        qdr_insert_histogram(body, stats->service_histogram);
+        break;
+
+    case QDR_CORE_ACTION_WAIT_HISTOGRAM:
+        qdr_insert_histogram(body, stats->wait_histogram);
+        break;
+
+    default:
+        qd_compose_insert_null(body);
+        break;
+    }
+}
+
+
+static void qdr_agent_write_core_action_CT(qdr_query_t *query, qdr_action_stats_t *stats)
+{
+    qd_composed_field_t *body = query->body;
+
+    qd_compose_start_list(body);
+    int i = 0;
+    while (query->columns[i] >= 0) {
+        qdr_agent_write_column_CT(body, query->columns[i], stats);
+        i++;
+    }
+    qd_compose_end_list(body);
+}
+
+
+void qdra_core_action_get_first_CT(qdr_core_t *core, qdr_query_t *query, int offset)
+{
+    //
+    // Queries that get this far will always succeed.
+    //
+    query->status = QD_AMQP_OK;
+
+    //
+    // If the offset goes beyond the set of action records, end the query now.
+    //
+    if (offset >= core->action_stats_count) {
+        query->more = false;
+        qdr_agent_enqueue_response_CT(core, query);
+        return;
+    }
+
+    //
+    // Write the columns of the record at the offset into the response body.
+    //
+    qdr_agent_write_core_action_CT(query, &core->action_stats[offset]);
+
+    //
+    // Advance to the next record
+    //
+    query->next_offset = offset + 1;
+    query->more        = query->next_offset < core->action_stats_count;
+
+    //
+    // Enqueue the response.
+    //
+    qdr_agent_enqueue_response_CT(core, query);
+}
+
+
+void qdra_core_action_get_next_CT(qdr_core_t *core, qdr_query_t *query)
+{
+    if (query->next_offset < core->action_stats_count) {
+        qdr_agent_write_core_action_CT(query, &core->action_stats[query->next_offset]);
+        query->next_offset++;
+        query->more = query->next_offset < core->action_stats_count;
+    } else
+        query->more = false;
+
+    //
+    // Enqueue the response.
+    //
+    qdr_agent_enqueue_response_CT(core, query);
+}
@@ -41,6 +41,9 @@
 #define QDR_LINK_REJECTED_COUNT     17
 #define QDR_LINK_RELEASED_COUNT     18
 #define QDR_LINK_MODIFIED_COUNT     19
+#define QDR_LINK_PRIORITY_UNDELIVERED 20
+#define QDR_LINK_DELIVER_LATENCY    21
+#define QDR_LINK_SETTLE_LATENCY     22
 
 const char *qdr_link_columns[] =
     {"name",
@@ -63,6 +66,9 @@ const char *qdr_link_columns[] =
      "rejectedCount",
      "releasedCount",
      "modifiedCount",
+     "priorityUndeliveredCount",
+     "deliverLatency",
+     "settleLatency",
      0};
 
 static const char *qd_link_type_name(qd_link_type_t lt)
@@ -182,23 +188,38 @@ static void qdr_agent_write_column_CT(qd_composed_field_t *body, int col, qdr_li
         break;
 
     case QDR_LINK_PRESETTLED_COUNT:
-        qd_compose_insert_ulong(body, link->presettled_deliveries);
+        qd_compose_insert_ulong(body, link->counts.presettled);
         break;
 
     case QDR_LINK_ACCEPTED_COUNT:
-        qd_compose_insert_ulong(body, link->accepted_deliveries);
+        qd_compose_insert_ulong(body, link->counts.accepted);
         break;
 
     case QDR_LINK_REJECTED_COUNT:
-        qd_compose_insert_ulong(body, link->rejected_deliveries);
+        qd_compose_insert_ulong(body, link->counts.rejected);
         break;
 
     case QDR_LINK_RELEASED_COUNT:
-        qd_compose_insert_ulong(body, link->released_deliveries);
+        qd_compose_insert_ulong(body, link->counts.released + sys_atomic_get(&link->released_unroutable));
         break;
 
     case QDR_LINK_MODIFIED_COUNT:
-        qd_compose_insert_ulong(body, link->modified_deliveries);
+        qd_compose_insert_ulong(body, link->counts.modified);
+        break;
+
+    case QDR_LINK_PRIORITY_UNDELIVERED:
+        qd_compose_start_list(body);
+        for (int priority = 0; priority < QDR_N_PRIORITIES; priority++)
+            qd_compose_insert_uint(body, link->priority_depth[priority]);
+        qd_compose_end_list(body);
+        break;
+
+    case QDR_LINK_DELIVER_LATENCY:
+        qdr_agent_insert_latency(body, link->deliver_latency);
+        break;
+
+    case QDR_LINK_SETTLE_LATENCY:
+        qdr_agent_insert_latency(body, link->counts.settle_latency);
         break;
 
     default:
@@ -211,6 +232,7 @@ static void qdr_agent_write_link_CT(qdr_query_t *query,  qdr_link_t *link)
 {
     qd_composed_field_t *body = query->body;
 
+    qdr_link_bridge_collect_CT(link);
     qd_compose_start_list(body);
     int i = 0;
     while (query->columns[i] >= 0) {
@@ -224,11 +246,20 @@ static void qdr_manage_advance_link_CT(qdr_query_t *query, qdr_link_t *link)
 {
     query->next_offset++;
     link = DEQ_NEXT(link);
-    if (link) {
-        query->more     = true;
-        //query->next_key = qdr_field((const char*) qd_hash_key_by_handle(link->owning_addr->hash_handle));
-    } else
-        query->more = false;
+    qdr_agent_set_cursor_CT(query->core, query, link);
+    query->more = !!link;
+}
+
+
+static void qdr_link_filter_column_CT(qdr_core_t *core, qd_composed_field_t *field, int col, void *entity)
+{
+    qdr_agent_write_column_CT(field, col, (qdr_link_t*) entity);
+}
+
+
+static void *qdr_link_next(void *entity)
+{
+    return DEQ_NEXT((qdr_link_t*) entity);
 }
 
 
@@ -239,6 +270,17 @@ void qdra_link_get_first_CT(qdr_core_t *core, qdr_query_t *query, int offset)
     //
     query->status = QD_AMQP_OK;
 
+    //
+    // A filtered query counts its offset in matching links, so it scans from
+    // the head like any later page.
+    //
+    if (query->filter_count) {
+        query->filter_skip = offset;
+        qdr_agent_set_cursor_CT(core, query, DEQ_HEAD(core->open_links));
+        qdra_link_get_next_CT(core, query);
+        return;
+    }
+
     //
     // If the offset goes beyond the set of links, end the query now.
     //
@@ -276,13 +318,14 @@ void qdra_link_get_first_CT(qdr_core_t *core, qdr_query_t *query, int offset)
 
 void qdra_link_get_next_CT(qdr_core_t *core, qdr_query_t *query)
 {
-    qdr_link_t *link = 0;
+    //
+    // Resume at the cursor left by the previous page.  Links removed in the
+    // meantime have already stepped the cursor past themselves.
+    //
+    qdr_link_t *link = (qdr_link_t*) query->cursor;
 
-        if (query->next_offset < DEQ_SIZE(core->open_links)) {
-            link = DEQ_HEAD(core->open_links);
-            for (int i = 0; i < query->next_offset && link; i++)
-                link = DEQ_NEXT(link);
-        }
+    if (!qdr_agent_scan_CT(core, query, (void**) &link, qdr_link_filter_column_CT, qdr_link_next))
+        return;
 
     if (link) {
         //
@@ -294,8 +337,10 @@ void qdra_link_get_next_CT(qdr_core_t *core, qdr_query_t *query)
         // Advance to the next link
         //
         qdr_manage_advance_link_CT(query, link);
-    } else
+    } else {
         query->more = false;
+        qdr_agent_set_cursor_CT(core, query, 0);
+    }
 
     //
     // Enqueue the response.
@@ -306,6 +351,7 @@ void qdra_link_get_next_CT(qdr_core_t *core, qdr_query_t *query)
 
 static void qdr_manage_write_response_map_CT(qd_composed_field_t *body, qdr_link_t *link)
 {
+    qdr_link_bridge_collect_CT(link);
     qd_compose_start_map(body);
 
     for(int i = 0; i < QDR_LINK_COLUMN_COUNT; i++) {
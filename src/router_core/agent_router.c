@@ -46,6 +46,16 @@
 #define QDR_ROUTER_ROUTER_ID              21
 #define QDR_ROUTER_MOBILE_ADDR_MAX_AGE    22
 #define QDR_ROUTER_CONNECTION_COUNT       23
+#define QDR_ROUTER_CORE_SPIN_USEC         24
+#define QDR_ROUTER_CORE_SPIN_TIME         25
+#define QDR_ROUTER_CORE_PARKED_TIME       26
+#define QDR_ROUTER_CORE_CONTROL_DEPTH     27
+#define QDR_ROUTER_CORE_DATA_DEPTH        28
+#define QDR_ROUTER_CORE_BUSY_TIME         29
+#define QDR_ROUTER_CORE_UTILIZATION       30
+#define QDR_ROUTER_CORE_DRAINS            31
+#define QDR_ROUTER_CORE_DRAINED_ACTIONS   32
+#define QDR_ROUTER_CORE_MAX_DRAIN         33
 
 const char *qdr_router_columns[] =
     {"name",
@@ -72,6 +82,16 @@ const char *qdr_router_columns[] =
      "routerId",
      "mobileAddrMaxAge",
      "connectionCount",
+     "coreSpinUsec",
+     "coreSpinTime",
+     "coreParkedTime",
+     "coreControlDepth",
+     "coreDataDepth",
+     "coreBusyTime",
+     "coreUtilization",
+     "coreDrains",
+     "coreDrainedActions",
+     "coreMaxDrain",
      0};
 
 
@@ -143,6 +163,46 @@ static void qdr_agent_write_column_CT(qd_composed_field_t *body, int col, qdr_co
         qd_compose_insert_ulong(body, DEQ_SIZE(core->auto_links));
         break;
 
+    case QDR_ROUTER_CORE_SPIN_USEC:
+        qd_compose_insert_long(body, core->spin_usec);
+        break;
+
+    case QDR_ROUTER_CORE_SPIN_TIME:
+        qd_compose_insert_ulong(body, core->spin_time_ns / 1000000);
+        break;
+
+    case QDR_ROUTER_CORE_PARKED_TIME:
+        qd_compose_insert_ulong(body, core->parked_time_ns / 1000000);
+        break;
+
+    case QDR_ROUTER_CORE_CONTROL_DEPTH:
+        qd_compose_insert_ulong(body, sys_atomic_get(&core->action_depth[QDR_ACTION_LANE_CONTROL]));
+        break;
+
+    case QDR_ROUTER_CORE_DATA_DEPTH:
+        qd_compose_insert_ulong(body, sys_atomic_get(&core->action_depth[QDR_ACTION_LANE_DATA]));
+        break;
+
+    case QDR_ROUTER_CORE_BUSY_TIME:
+        qd_compose_insert_ulong(body, core->busy_time_ns / 1000000);
+        break;
+
+    case QDR_ROUTER_CORE_UTILIZATION:
+        qd_compose_insert_ulong(body, core->utilization);
+        break;
+
+    case QDR_ROUTER_CORE_DRAINS:
+        qd_compose_insert_ulong(body, core->drains);
+        break;
+
+    case QDR_ROUTER_CORE_DRAINED_ACTIONS:
+        qd_compose_insert_ulong(body, core->drained_actions);
+        break;
+
+    case QDR_ROUTER_CORE_MAX_DRAIN:
+        qd_compose_insert_ulong(body, core->max_drain);
+        break;
+
     case QDR_ROUTER_ROUTER_ID:
     case QDR_ROUTER_ID:
     case QDR_ROUTER_NAME:
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <strings.h>
 #include "router_core_private.h"
+#include "core_record.h"
 
 static void qdr_connection_opened_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_connection_closed_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
@@ -32,6 +33,7 @@ static void qdr_link_inbound_detach_CT(qdr_core_t *core, qdr_action_t *action, b
 
 ALLOC_DEFINE(qdr_connection_t);
 ALLOC_DEFINE(qdr_connection_work_t);
+ALLOC_DEFINE(qdr_link_teardown_t);
 
 //==================================================================================
 // Internal Functions
@@ -53,6 +55,17 @@ qdr_terminus_t *qdr_terminus_router_data(void)
 }
 
 
+//
+// Address hash of a terminus for the core record, 0 if it is anonymous or dynamic
+//
+static uint32_t qdr_terminus_record_hash(qdr_terminus_t *term)
+{
+    if (qdr_terminus_is_anonymous(term) || qdr_terminus_is_dynamic(term))
+        return 0;
+    return qd_core_record_hash(qdr_terminus_get_address(term));
+}
+
+
 //==================================================================================
 // Interface Functions
 //==================================================================================
@@ -67,7 +80,9 @@ qdr_connection_t *qdr_connection_opened(qdr_core_t            *core,
                                         bool                   strip_annotations_in,
                                         bool                   strip_annotations_out,
                                         int                    link_capacity,
+                                        int                    link_capacity_max,
                                         const char            *vhost,
+                                        const qdr_rate_limits_t *rate_limits,
                                         qdr_connection_info_t *connection_info)
 {
     qdr_action_t     *action = qdr_action(qdr_connection_opened_CT, "connection_opened");
@@ -84,11 +99,14 @@ qdr_connection_t *qdr_connection_opened(qdr_core_t            *core,
     conn->strip_annotations_in  = strip_annotations_in;
     conn->strip_annotations_out = strip_annotations_out;
     conn->link_capacity         = link_capacity;
+    conn->link_capacity_max     = link_capacity_max > link_capacity ? link_capacity_max : link_capacity;
     conn->mask_bit              = -1;
+    if (rate_limits)
+        conn->rate_limits = *rate_limits;
     DEQ_INIT(conn->links);
     DEQ_INIT(conn->work_list);
     conn->connection_info->role = conn->role;
-    conn->work_lock = sys_mutex();
+    conn->work_lock = core->conn_work_locks[management_id % QDR_CONNECTION_WORK_LOCKS];
 
     if (vhost) {
         conn->tenant_space_len = strlen(vhost) + 1;
@@ -100,6 +118,9 @@ qdr_connection_t *qdr_connection_opened(qdr_core_t            *core,
     action->args.connection.conn             = conn;
     action->args.connection.connection_label = qdr_field(label);
     action->args.connection.container_id     = qdr_field(remote_container_id);
+    if (qd_core_record_enabled())
+        qd_core_record(QD_CORE_RECORD_CONNECTION_OPENED, incoming ? QD_CORE_RECORD_INCOMING : 0,
+                       conn->identity, 0, 0, role, 0, 0);
     qdr_action_enqueue(core, action);
 
     return conn;
@@ -108,8 +129,24 @@ qdr_connection_t *qdr_connection_opened(qdr_core_t            *core,
 
 void qdr_connection_closed(qdr_connection_t *conn)
 {
-    qdr_action_t *action = qdr_action(qdr_connection_closed_CT, "connection_closed");
+    if (qd_core_record_enabled())
+        qd_core_record(QD_CORE_RECORD_CONNECTION_CLOSED, 0, conn->identity, 0, 0, 0, 0, 0);
+
+    //
+    // Connections closed together, as a partition drops them, are handed to the core
+    // in one action: fold this one into the newest staged action if it closes
+    // connections too.
+    //
+    qdr_action_t *action = qdr_action_batch_tail(conn->core, qdr_connection_closed_CT);
+    if (action) {
+        conn->next_closed = action->args.connection.conn;
+        action->args.connection.conn = conn;
+        return;
+    }
+
+    action = qdr_action(qdr_connection_closed_CT, "connection_closed");
     action->args.connection.conn = conn;
+    conn->next_closed = 0;
     qdr_action_enqueue(conn->core, action);
 }
 
@@ -117,7 +154,13 @@ void qdr_connection_closed(qdr_connection_t *conn)
 void qdr_connection_set_context(qdr_connection_t *conn, void *context)
 {
     if (conn) {
+        //
+        // The lock keeps I/O threads that hand deliveries straight to a routed link on this
+        // connection from waking it once the context is cleared.
+        //
+        sys_mutex_lock(conn->work_lock);
         conn->user_context = context;
+        sys_mutex_unlock(conn->work_lock);
     }
 }
 
@@ -140,6 +183,7 @@ qdr_connection_info_t *qdr_connection_info(bool             is_encrypted,
     connection_info->is_authenticated      = is_authenticated;
     connection_info->opened                = opened;
     connection_info->container             = container;
+    connection_info->compression           = 0;
 
     if (sasl_mechanisms)
         connection_info->sasl_mechanisms      = strdup(sasl_mechanisms);
@@ -179,6 +223,31 @@ qdr_connection_info_t *qdr_connection_info(bool             is_encrypted,
 }
 
 
+qdr_compression_stats_t *qdr_compression_stats(void)
+{
+    qdr_compression_stats_t *stats = NEW(qdr_compression_stats_t);
+    ZERO(stats);
+    sys_atomic_init(&stats->ref_count, 1);
+    return stats;
+}
+
+
+void qdr_compression_stats_decref(qdr_compression_stats_t *stats)
+{
+    if (stats && sys_atomic_dec(&stats->ref_count) == 1) {
+        sys_atomic_destroy(&stats->ref_count);
+        free(stats);
+    }
+}
+
+
+void qdr_connection_info_set_compression(qdr_connection_info_t *info, qdr_compression_stats_t *stats)
+{
+    sys_atomic_inc(&stats->ref_count);
+    info->compression = stats;
+}
+
+
 void *qdr_connection_get_context(const qdr_connection_t *conn)
 {
     return conn ? conn->user_context : NULL;
@@ -192,19 +261,158 @@ const char *qdr_connection_get_tenant_space(const qdr_connection_t *conn, int *l
 }
 
 
+//
+// Apply a link's delivery updates in the order the deliveries were received or sent, so
+// that proton can write runs of consecutive delivery ids with the same outcome as one
+// ranged disposition.  The list is usually in order already, which insertion sort passes
+// over in one step.  The sort is stable, so updates to one delivery keep their order.
+//
+static void qdr_sort_updated_deliveries(qdr_delivery_ref_list_t *list)
+{
+    qdr_delivery_ref_t *ref = DEQ_HEAD(*list);
+
+    while (ref) {
+        qdr_delivery_ref_t *next = DEQ_NEXT(ref);
+        qdr_delivery_ref_t *pos  = DEQ_PREV(ref);
+
+        if (pos && pos->dlv->sequence > ref->dlv->sequence) {
+            DEQ_REMOVE(*list, ref);
+            while (pos && pos->dlv->sequence > ref->dlv->sequence)
+                pos = DEQ_PREV(pos);
+            if (pos)
+                DEQ_INSERT_AFTER(*list, ref, pos);
+            else
+                DEQ_INSERT_HEAD(*list, ref);
+        }
+        ref = next;
+    }
+}
+
+
+/**
+ * Take the links with work off the connection's list, with their work and updates.  The
+ * taken work is marked as processing so the core leaves it alone.  The links can be added
+ * to the list again at once for work that arrives meanwhile.
+ */
+static void qdr_connection_take_link_work_LH(qdr_connection_t *conn, qdr_link_ref_list_t *links)
+{
+    DEQ_MOVE(conn->links_with_work, *links);
+    qdr_link_ref_t *ref = DEQ_HEAD(*links);
+    while (ref) {
+        qdr_link_t *link = ref->link;
+        link->ref[QDR_LINK_LIST_CLASS_WORK] = 0;
+        DEQ_MOVE(link->work_list, link->work_batch);
+        DEQ_MOVE(link->updated_deliveries, link->updated_batch);
+        for (qdr_link_work_t *work = DEQ_HEAD(link->work_batch); work; work = DEQ_NEXT(work))
+            work->processing = true;
+        ref = DEQ_NEXT(ref);
+    }
+}
+
+
+/**
+ * Run the work taken for a link.  Returns the number of events handled and adds the
+ * octets sent to *octets.  Delivery work that could not be completed, for want of credit
+ * or because the link's turn ended, is left at the head of the link's work_batch.
+ */
+static int qdr_connection_process_link(qdr_core_t *core, qdr_link_t *link, bool *free_link, int64_t *octets)
+{
+    int  event_count = 0;
+    bool turn        = false;
+
+    qdr_link_work_t *link_work = DEQ_HEAD(link->work_batch);
+    while (link_work) {
+        switch (link_work->work_type) {
+        case QDR_LINK_WORK_DELIVERY :
+            {
+                //
+                // Deficit round robin: each visit adds a quantum of octets to what the
+                // link may send, and whatever it sent beyond that is owed from the next.
+                //
+                if (core->link_quantum && !turn) {
+                    link->drr_deficit += core->link_quantum;
+                    turn = true;
+                }
+                int64_t before = link->drr_deficit;
+                int count = core->push_handler(core->user_context, link, link_work->value);
+                assert(count <= link_work->value);
+                link_work->value -= count;
+                *octets += before - link->drr_deficit;
+                break;
+            }
+
+        case QDR_LINK_WORK_FLOW :
+            if (link_work->value > 0)
+                core->flow_handler(core->user_context, link, link_work->value);
+            if      (link_work->drain_action == QDR_LINK_WORK_DRAIN_ACTION_SET)
+                core->drain_handler(core->user_context, link, true);
+            else if (link_work->drain_action == QDR_LINK_WORK_DRAIN_ACTION_CLEAR)
+                core->drain_handler(core->user_context, link, false);
+            else if (link_work->drain_action == QDR_LINK_WORK_DRAIN_ACTION_DRAINED)
+                core->drained_handler(core->user_context, link);
+            break;
+
+        case QDR_LINK_WORK_FIRST_DETACH :
+            core->detach_handler(core->user_context, link, link_work->error, true, link_work->close_link);
+            break;
+
+        case QDR_LINK_WORK_SECOND_DETACH :
+            core->detach_handler(core->user_context, link, link_work->error, false, link_work->close_link);
+            *free_link = true;
+            break;
+        }
+        event_count++;
+
+        if (link_work->work_type == QDR_LINK_WORK_DELIVERY && link_work->value > 0)
+            break; // Halt work processing
+
+        DEQ_REMOVE_HEAD(link->work_batch);
+        qdr_error_free(link_work->error);
+        free_qdr_link_work_t(link_work);
+        link_work = DEQ_HEAD(link->work_batch);
+    }
+
+    //
+    // A link that is not waiting for its next turn starts afresh when it has more to send.
+    //
+    if (!link_work || !link->drr_limited)
+        link->drr_deficit = 0;
+
+    //
+    // Handle disposition/settlement updates
+    //
+    qdr_sort_updated_deliveries(&link->updated_batch);
+
+    qdr_delivery_ref_t *dref = DEQ_HEAD(link->updated_batch);
+    while (dref) {
+        core->delivery_update_handler(core->user_context, dref->dlv, dref->dlv->disposition, dref->dlv->settled);
+        qdr_delivery_decref(core, dref->dlv);
+        qdr_del_delivery_ref(&link->updated_batch, dref);
+        dref = DEQ_HEAD(link->updated_batch);
+        event_count++;
+    }
+
+    return event_count;
+}
+
+
 int qdr_connection_process(qdr_connection_t *conn)
 {
     qdr_connection_work_list_t  work_list;
-    qdr_core_t                 *core = conn->core;
-
-    qdr_link_ref_t *ref;
-    qdr_link_t     *link;
-    bool            free_link;
+    qdr_link_ref_list_t         links;
+    qdr_core_t                 *core   = conn->core;
+    int64_t                     octets = 0;
+    bool                        yield  = false;
 
     int event_count = 0;
 
+    //
+    // All of the connection's pending work is taken in one critical section, and each
+    // further pass, for work that arrived while the last was processed, in one more.
+    //
     sys_mutex_lock(conn->work_lock);
     DEQ_MOVE(conn->work_list, work_list);
+    qdr_connection_take_link_work_LH(conn, &links);
     sys_mutex_unlock(conn->work_lock);
 
     event_count += DEQ_SIZE(work_list);
@@ -229,95 +437,60 @@ int qdr_connection_process(qdr_connection_t *conn)
         work = DEQ_HEAD(work_list);
     }
 
-    do {
-        qdr_link_work_t *link_work;
-        free_link = false;
-
-        sys_mutex_lock(conn->work_lock);
-        ref = DEQ_HEAD(conn->links_with_work);
-        if (ref) {
-            link = ref->link;
-            qdr_del_link_ref(&conn->links_with_work, ref->link, QDR_LINK_LIST_CLASS_WORK);
-            link_work = DEQ_HEAD(link->work_list);
-            if (link_work) {
-                DEQ_REMOVE_HEAD(link->work_list);
-                link_work->processing = true;
-            }
-        } else
-            link = 0;
-        sys_mutex_unlock(conn->work_lock);
-
-        if (link) {
-            while (link_work) {
-                switch (link_work->work_type) {
-                case QDR_LINK_WORK_DELIVERY :
-                    {
-                        int count = core->push_handler(core->user_context, link, link_work->value);
-                        assert(count <= link_work->value);
-                        link_work->value -= count;
-                        break;
-                    }
-
-                case QDR_LINK_WORK_FLOW :
-                    if (link_work->value > 0)
-                        core->flow_handler(core->user_context, link, link_work->value);
-                    if      (link_work->drain_action == QDR_LINK_WORK_DRAIN_ACTION_SET)
-                        core->drain_handler(core->user_context, link, true);
-                    else if (link_work->drain_action == QDR_LINK_WORK_DRAIN_ACTION_CLEAR)
-                        core->drain_handler(core->user_context, link, false);
-                    else if (link_work->drain_action == QDR_LINK_WORK_DRAIN_ACTION_DRAINED)
-                        core->drained_handler(core->user_context, link);
-                    break;
-
-                case QDR_LINK_WORK_FIRST_DETACH :
-                    core->detach_handler(core->user_context, link, link_work->error, true, link_work->close_link);
-                    break;
-
-                case QDR_LINK_WORK_SECOND_DETACH :
-                    core->detach_handler(core->user_context, link, link_work->error, false, link_work->close_link);
-                    free_link = true;
-                    break;
-                }
+    while (DEQ_SIZE(links) > 0) {
+        qdr_link_ref_list_t halted;
+        DEQ_INIT(halted);
 
-                sys_mutex_lock(conn->work_lock);
-                if (link_work->work_type == QDR_LINK_WORK_DELIVERY && link_work->value > 0) {
-                    DEQ_INSERT_HEAD(link->work_list, link_work);
-                    link_work->processing = false;
-                    link_work = 0; // Halt work processing
-                } else {
-                    qdr_error_free(link_work->error);
-                    free_qdr_link_work_t(link_work);
-                    link_work = DEQ_HEAD(link->work_list);
-                    if (link_work) {
-                        DEQ_REMOVE_HEAD(link->work_list);
-                        link_work->processing = true;
-                    }
-                }
-                sys_mutex_unlock(conn->work_lock);
-                event_count++;
-            }
+        qdr_link_ref_t *ref = DEQ_HEAD(links);
+        while (ref) {
+            qdr_link_t *link      = ref->link;
+            bool        free_link = false;
 
-            //
-            // Handle disposition/settlement updates
-            //
-            qdr_delivery_ref_list_t updated_deliveries;
-            sys_mutex_lock(conn->work_lock);
-            DEQ_MOVE(link->updated_deliveries, updated_deliveries);
-            sys_mutex_unlock(conn->work_lock);
-
-            qdr_delivery_ref_t *dref = DEQ_HEAD(updated_deliveries);
-            while (dref) {
-                core->delivery_update_handler(core->user_context, dref->dlv, dref->dlv->disposition, dref->dlv->settled);
-                qdr_delivery_decref(core, dref->dlv);
-                qdr_del_delivery_ref(&updated_deliveries, dref);
-                dref = DEQ_HEAD(updated_deliveries);
-                event_count++;
+            DEQ_REMOVE_HEAD(links);
+            event_count += qdr_connection_process_link(core, link, &free_link, &octets);
+            if (DEQ_SIZE(link->work_batch) > 0) {
+                DEQ_INSERT_TAIL(halted, ref);
+            } else {
+                free_qdr_link_ref_t(ref);
+                if (free_link)
+                    free_qdr_link_t(link);
             }
+            ref = DEQ_HEAD(links);
+        }
 
-            if (free_link)
-                free_qdr_link_t(link);
+        //
+        // Put the unfinished work back ahead of any that arrived meanwhile.  Links that
+        // ran out of credit wait for more; those whose turn ended go to the back of
+        // links_with_work for their next.
+        //
+        sys_mutex_lock(conn->work_lock);
+        ref = DEQ_HEAD(halted);
+        while (ref) {
+            qdr_link_t *link = ref->link;
+            for (qdr_link_work_t *link_work = DEQ_HEAD(link->work_batch); link_work; link_work = DEQ_NEXT(link_work))
+                link_work->processing = false;
+            DEQ_APPEND(link->work_batch, link->work_list);
+            DEQ_MOVE(link->work_batch, link->work_list);
+            DEQ_REMOVE_HEAD(halted);
+            free_qdr_link_ref_t(ref);
+            if (link->drr_limited)
+                qdr_add_link_ref(&conn->links_with_work, link, QDR_LINK_LIST_CLASS_WORK);
+            ref = DEQ_HEAD(halted);
         }
-    } while (free_link || link);
+
+        //
+        // Past its share of the worker, the connection lets the others on the worker
+        // have a turn and is woken again for the rest.
+        //
+        if (core->link_quantum && octets >= (int64_t) core->link_quantum * QDR_CONNECTION_PASS_QUANTA)
+            yield = DEQ_SIZE(conn->links_with_work) > 0;
+        else
+            qdr_connection_take_link_work_LH(conn, &links);
+        sys_mutex_unlock(conn->work_lock);
+    }
+
+    if (yield)
+        qd_server_activate((qd_connection_t*) qdr_connection_get_context(conn));
 
     return event_count;
 }
@@ -372,6 +545,12 @@ bool qdr_link_strip_annotations_in(const qdr_link_t *link)
 }
 
 
+qd_buffer_list_t *qdr_link_to_override(qdr_link_t *link)
+{
+    return &link->to_override;
+}
+
+
 bool qdr_link_strip_annotations_out(const qdr_link_t *link)
 {
     return link->strip_annotations_out;
@@ -384,6 +563,12 @@ const char *qdr_link_name(const qdr_link_t *link)
 }
 
 
+uint64_t qdr_link_identity(const qdr_link_t *link)
+{
+    return link->identity;
+}
+
+
 qdr_link_t *qdr_link_first_attach(qdr_connection_t *conn,
                                   qd_direction_t    dir,
                                   qdr_terminus_t   *source,
@@ -412,6 +597,8 @@ qdr_link_t *qdr_link_first_attach(qdr_connection_t *conn,
     strcpy(link->name, name);
     link->link_direction = dir;
     link->capacity       = conn->link_capacity;
+    link->capacity_min   = conn->link_capacity;
+    link->capacity_max   = conn->link_capacity_max;
     link->admin_enabled  = true;
     link->oper_status    = QDR_LINK_OPER_DOWN;
 
@@ -428,6 +615,10 @@ qdr_link_t *qdr_link_first_attach(qdr_connection_t *conn,
     action->args.connection.dir    = dir;
     action->args.connection.source = source;
     action->args.connection.target = target;
+    if (qd_core_record_enabled())
+        qd_core_record(QD_CORE_RECORD_FIRST_ATTACH, dir == QD_INCOMING ? QD_CORE_RECORD_INCOMING : 0,
+                       conn->identity, link->identity, 0, 0, 0,
+                       qdr_terminus_record_hash(local_terminus));
     qdr_action_enqueue(conn->core, action);
 
     return link;
@@ -441,6 +632,12 @@ void qdr_link_second_attach(qdr_link_t *link, qdr_terminus_t *source, qdr_termin
     action->args.connection.link   = link;
     action->args.connection.source = source;
     action->args.connection.target = target;
+    if (qd_core_record_enabled()) {
+        bool incoming = link->link_direction == QD_INCOMING;
+        qd_core_record(QD_CORE_RECORD_SECOND_ATTACH, incoming ? QD_CORE_RECORD_INCOMING : 0,
+                       link->conn->identity, link->identity, 0, 0, 0,
+                       qdr_terminus_record_hash(incoming ? target : source));
+    }
     qdr_action_enqueue(link->core, action);
 }
 
@@ -453,6 +650,8 @@ void qdr_link_detach(qdr_link_t *link, qd_detach_type_t dt, qdr_error_t *error)
     action->args.connection.link   = link;
     action->args.connection.error  = error;
     action->args.connection.dt     = dt;
+    if (qd_core_record_enabled())
+        qd_core_record(QD_CORE_RECORD_DETACH, 0, link->conn->identity, link->identity, 0, dt, 0, 0);
     qdr_action_enqueue(link->core, action);
 }
 
@@ -524,57 +723,307 @@ void qdr_link_enqueue_work_CT(qdr_core_t      *core,
 }
 
 
-#define QDR_DISCRIMINATOR_SIZE 16
-static void qdr_generate_discriminator(char *string)
+//
+// Dynamic addresses and link names end in a discriminator: an epoch drawn at random when
+// the core is created, then the core's count of discriminators handed out, scrambled so that
+// one client's addresses don't give away the next one's.  Multiplying by an odd constant and
+// xoring with a key maps the 64 bit count one to one, so no two counts give the same
+// discriminator.  The address prefixes are formatted once, up front.
+//
+#define QDR_EPOCH_SIZE         4
+#define QDR_DISCRIMINATOR_SIZE 16    // The epoch, eleven characters of count and a terminator
+static const char discriminator_table[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789+_";
+
+static void qdr_generate_discriminator(qdr_core_t *core, char *string)
 {
-    static const char *table = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789+_";
-    long int rnd1 = random();
-    long int rnd2 = random();
-    long int rnd3 = random();
-    int      idx;
-    int      cursor = 0;
+    uint64_t value = (core->next_discriminator++ * 0x9E3779B97F4A7C15ULL) ^ core->discriminator_key;
 
-    for (idx = 0; idx < 5; idx++) {
-        string[cursor++] = table[(rnd1 >> (idx * 6)) & 63];
-        string[cursor++] = table[(rnd2 >> (idx * 6)) & 63];
-        string[cursor++] = table[(rnd3 >> (idx * 6)) & 63];
+    memcpy(string, core->discriminator_epoch, QDR_EPOCH_SIZE);
+    for (int idx = QDR_EPOCH_SIZE; idx < QDR_DISCRIMINATOR_SIZE - 1; idx++) {
+        string[idx] = discriminator_table[value & 63];
+        value >>= 6;
     }
-    string[cursor] = '\0';
+    string[QDR_DISCRIMINATOR_SIZE - 1] = '\0';
+}
+
+
+void qdr_discriminator_setup(qdr_core_t *core)
+{
+    uint64_t rnd = ((uint64_t) random() << 32) ^ (uint64_t) random();
+    for (int idx = 0; idx < QDR_EPOCH_SIZE; idx++)
+        core->discriminator_epoch[idx] = discriminator_table[(rnd >> (idx * 6)) & 63];
+    core->discriminator_key  = ((uint64_t) random() << 33) ^ ((uint64_t) random() << 11) ^ (uint64_t) random();
+    core->next_discriminator = 1;
+
+    const char *format = "amqp:/_topo/%s/%s/temp.";
+    core->temp_addr_prefix_len = snprintf(0, 0, format, core->router_area, core->router_id);
+    core->temp_addr_prefix     = (char*) malloc(core->temp_addr_prefix_len + 1);
+    snprintf(core->temp_addr_prefix, core->temp_addr_prefix_len + 1, format, core->router_area, core->router_id);
 }
 
 
 /**
  * Generate a temporary routable address for a destination connected to this
- * router node.
+ * router node.  The buffer holds QDR_DYNAMIC_ADDR_SIZE octets.
  */
-static void qdr_generate_temp_addr(qdr_core_t *core, char *buffer, size_t length)
+static void qdr_generate_temp_addr(qdr_core_t *core, char *buffer)
 {
-    char discriminator[QDR_DISCRIMINATOR_SIZE];
-    qdr_generate_discriminator(discriminator);
-    snprintf(buffer, length, "amqp:/_topo/%s/%s/temp.%s", core->router_area, core->router_id, discriminator);
+    memcpy(buffer, core->temp_addr_prefix, core->temp_addr_prefix_len);
+    qdr_generate_discriminator(core, buffer + core->temp_addr_prefix_len);
 }
 
 
 /**
  * Generate a temporary mobile address for a producer connected to this
- * router node.
+ * router node.  The buffer holds QDR_DYNAMIC_ADDR_SIZE octets.
  */
-static void qdr_generate_mobile_addr(qdr_core_t *core, char *buffer, size_t length)
+#define QDR_MOBILE_ADDR_PREFIX "amqp:/_$temp."
+static void qdr_generate_mobile_addr(qdr_core_t *core, char *buffer)
 {
-    char discriminator[QDR_DISCRIMINATOR_SIZE];
-    qdr_generate_discriminator(discriminator);
-    snprintf(buffer, length, "amqp:/_$temp.%s", discriminator);
+    memcpy(buffer, QDR_MOBILE_ADDR_PREFIX, sizeof(QDR_MOBILE_ADDR_PREFIX) - 1);
+    qdr_generate_discriminator(core, buffer + sizeof(QDR_MOBILE_ADDR_PREFIX) - 1);
 }
 
+// Large enough for either kind of dynamic address
+#define QDR_DYNAMIC_ADDR_SIZE(core) \
+    ((core)->temp_addr_prefix_len + sizeof(QDR_MOBILE_ADDR_PREFIX) + QDR_DISCRIMINATOR_SIZE)
+
 
 /**
  * Generate a link name
  */
-static void qdr_generate_link_name(const char *label, char *buffer, size_t length)
+#define QDR_LINK_NAME_LABEL "qdlink."
+static void qdr_generate_link_name(qdr_core_t *core, char *buffer)
+{
+    memcpy(buffer, QDR_LINK_NAME_LABEL, sizeof(QDR_LINK_NAME_LABEL) - 1);
+    qdr_generate_discriminator(core, buffer + sizeof(QDR_LINK_NAME_LABEL) - 1);
+}
+
+
+//
+// An inter-router-data connection is an extra connection to a neighbor router that
+// carries only a pair of data links.  Once the neighbor's primary inter-router
+// connection is known, the data connection shares its mask bit and its outgoing data
+// link joins the pool that the forwarder spreads deliveries over.
+//
+
+static void qdr_data_pool_join_CT(qdr_core_t *core, qdr_connection_t *conn)
 {
-    char discriminator[QDR_DISCRIMINATOR_SIZE];
-    qdr_generate_discriminator(discriminator);
-    snprintf(buffer, length, "%s.%s", label, discriminator);
+    qdr_link_t *link = conn->pool_data_link;
+    if (conn->mask_bit >= 0 && link && !link->ref[QDR_LINK_LIST_CLASS_DATA_POOL])
+        qdr_add_link_ref(&core->data_link_pools_by_mask_bit[conn->mask_bit], link, QDR_LINK_LIST_CLASS_DATA_POOL);
+}
+
+
+static void qdr_data_pool_leave_CT(qdr_core_t *core, qdr_connection_t *conn)
+{
+    qdr_link_t *link = conn->pool_data_link;
+    if (conn->mask_bit >= 0 && link && link->ref[QDR_LINK_LIST_CLASS_DATA_POOL])
+        qdr_del_link_ref(&core->data_link_pools_by_mask_bit[conn->mask_bit], link, QDR_LINK_LIST_CLASS_DATA_POOL);
+}
+
+
+/**
+ * Bind inter-router-data connections to the primary connection from the same peer
+ * router, or unbind them if primary is closing.
+ */
+static void qdr_data_pool_bind_CT(qdr_core_t *core, qdr_connection_t *primary, bool bind)
+{
+    qdr_connection_t *conn = DEQ_HEAD(core->open_connections);
+    while (conn) {
+        if (conn->role == QDR_ROLE_INTER_ROUTER_DATA && conn->peer_container && primary->peer_container &&
+            strcmp(conn->peer_container, primary->peer_container) == 0) {
+            if (bind && conn->mask_bit < 0) {
+                conn->mask_bit = primary->mask_bit;
+                qdr_data_pool_join_CT(core, conn);
+            } else if (!bind && conn->mask_bit == primary->mask_bit) {
+                qdr_data_pool_leave_CT(core, conn);
+                conn->mask_bit = -1;
+            }
+        }
+        conn = DEQ_NEXT(conn);
+    }
+}
+
+
+static void qdr_data_conn_opened_CT(qdr_core_t *core, qdr_connection_t *conn)
+{
+    qdr_connection_t *primary = DEQ_HEAD(core->open_connections);
+    while (primary) {
+        if (primary->role == QDR_ROLE_INTER_ROUTER && primary->mask_bit >= 0 && primary->peer_container &&
+            conn->peer_container && strcmp(conn->peer_container, primary->peer_container) == 0) {
+            conn->mask_bit = primary->mask_bit;
+            break;
+        }
+        primary = DEQ_NEXT(primary);
+    }
+}
+
+
+static void qdr_set_data_link_CT(qdr_core_t *core, qdr_connection_t *conn, qdr_link_t *link)
+{
+    if (conn->role == QDR_ROLE_INTER_ROUTER)
+        core->data_links_by_mask_bit[conn->mask_bit] = link;
+    else {
+        conn->pool_data_link = link;
+        qdr_data_pool_join_CT(core, conn);
+    }
+}
+
+
+//
+// Deliveries of cleaned-up links released per core pass
+//
+#define QDR_LINK_TEARDOWN_BATCH 1024
+
+//
+// Release an undelivered delivery.  If it was on an incoming link it can simply be
+// destroyed.  If on an outgoing link, its peer delivery needs to be released.
+//
+static void qdr_teardown_undelivered_CT(qdr_core_t *core, qd_direction_t dir, qdr_delivery_t *dlv)
+{
+    qdr_delivery_t *peer = dlv->peer;
+    if (peer && peer->multicast)
+        qdr_multicast_settled_CT(core, peer, dlv, PN_RELEASED);
+    else if (peer) {
+        dlv->peer  = 0;
+        peer->peer = 0;
+        qdr_delivery_release_CT(core, peer);
+        qdr_delivery_decref_CT(core, peer);
+        qdr_delivery_decref_CT(core, dlv);
+    }
+
+    //
+    // Account for the lost reference from the Proton delivery
+    // for unsettled deliveries on incoming links
+    //
+    if (dir == QD_INCOMING && !dlv->settled && !dlv->cleared_proton_ref) {
+        dlv->cleared_proton_ref = true;
+        qdr_delivery_decref_CT(core, dlv);
+    }
+    //
+    // Now the undelivered-list reference
+    //
+    qdr_delivery_decref_CT(core, dlv);
+}
+
+
+static void qdr_teardown_unsettled_CT(qdr_core_t *core, qd_direction_t dir, qdr_delivery_t *dlv)
+{
+    if (dlv->tracking_addr) {
+        dlv->tracking_addr->outstanding_deliveries[dlv->tracking_addr_bit]--;
+        dlv->tracking_addr->tracked_deliveries--;
+
+        if (dlv->tracking_addr->tracked_deliveries == 0)
+            qdr_check_addr_CT(core, dlv->tracking_addr, false);
+
+        dlv->tracking_addr = 0;
+    }
+
+    qdr_delivery_t *peer = dlv->peer;
+    if (peer && peer->multicast)
+        qdr_multicast_settled_CT(core, peer, dlv, PN_MODIFIED);
+    else if (peer) {
+        dlv->peer  = 0;
+        peer->peer = 0;
+        if (dir == QD_OUTGOING)
+            qdr_delivery_failed_CT(core, peer);
+
+        qdr_delivery_decref_CT(core, peer);
+        qdr_delivery_decref_CT(core, dlv);
+    }
+
+    //
+    // Account for the lost reference from the Proton delivery
+    //
+    if (!dlv->cleared_proton_ref) {
+        dlv->cleared_proton_ref = true;
+        qdr_delivery_decref_CT(core, dlv);
+    }
+    //
+    // Now the unsettled-list reference
+    //
+    qdr_delivery_decref_CT(core, dlv);
+}
+
+
+//
+// Release up to budget deliveries of the pending teardowns, oldest first.  Returns
+// true if deliveries remain.
+//
+static bool qdr_link_teardown_run_CT(qdr_core_t *core, int budget)
+{
+    qdr_link_teardown_t *teardown = DEQ_HEAD(core->link_teardowns);
+    while (teardown && budget > 0) {
+        //
+        // The 'updated' references go first: they hold no linkage of their own
+        //
+        qdr_delivery_ref_t *ref = DEQ_HEAD(teardown->updated_deliveries);
+        while (ref && budget-- > 0) {
+            //
+            // Account for possible lost reference from the Proton delivery
+            //
+            if (!ref->dlv->cleared_proton_ref) {
+                ref->dlv->cleared_proton_ref = true;
+                qdr_delivery_decref_CT(core, ref->dlv);
+            }
+            //
+            // Now our reference
+            //
+            qdr_delivery_decref_CT(core, ref->dlv);
+            qdr_del_delivery_ref(&teardown->updated_deliveries, ref);
+            ref = DEQ_HEAD(teardown->updated_deliveries);
+        }
+
+        qdr_delivery_t *dlv = DEQ_HEAD(teardown->undelivered);
+        while (dlv && budget-- > 0) {
+            DEQ_REMOVE_HEAD(teardown->undelivered);
+            qdr_teardown_undelivered_CT(core, teardown->link_direction, dlv);
+            dlv = DEQ_HEAD(teardown->undelivered);
+        }
+
+        dlv = DEQ_HEAD(teardown->unsettled);
+        while (dlv && budget-- > 0) {
+            DEQ_REMOVE_HEAD(teardown->unsettled);
+            qdr_teardown_unsettled_CT(core, teardown->link_direction, dlv);
+            dlv = DEQ_HEAD(teardown->unsettled);
+        }
+
+        if (ref || DEQ_HEAD(teardown->undelivered) || dlv)
+            break;
+
+        DEQ_REMOVE_HEAD(core->link_teardowns);
+        free_qdr_link_teardown_t(teardown);
+        teardown = DEQ_HEAD(core->link_teardowns);
+    }
+
+    return !DEQ_IS_EMPTY(core->link_teardowns);
+}
+
+
+static void qdr_link_teardown_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    //
+    // Whatever is left at shutdown is released by qdr_link_teardown_drain_CT
+    //
+    if (discard)
+        return;
+
+    //
+    // Requeue behind the work that arrived meanwhile while deliveries remain
+    //
+    if (qdr_link_teardown_run_CT(core, QDR_LINK_TEARDOWN_BATCH))
+        qdr_action_enqueue(core, qdr_action(qdr_link_teardown_CT, "link_teardown"));
+    else
+        core->link_teardown_scheduled = false;
+}
+
+
+void qdr_link_teardown_drain_CT(qdr_core_t *core)
+{
+    while (qdr_link_teardown_run_CT(core, QDR_LINK_TEARDOWN_BATCH))
+        ;
+    core->link_teardown_scheduled = false;
 }
 
 
@@ -583,53 +1032,118 @@ static void qdr_link_cleanup_CT(qdr_core_t *core, qdr_connection_t *conn, qdr_li
     //
     // Remove the link from the master list of links
     //
+    qdr_agent_cursor_remove_CT(core, link, DEQ_NEXT(link));
     DEQ_REMOVE(core->open_links, link);
 
     //
     // If the link has a connected peer, unlink the peer
     //
     if (link->connected_link) {
+        qdr_link_unbridge_CT(link);
         link->connected_link->connected_link = 0;
         link->connected_link = 0;
     }
 
+    //
+    // Forget any credit held back from the link
+    //
+    qdr_del_link_ref(&core->links_withheld, link, QDR_LINK_LIST_CLASS_WITHHELD);
+    sys_atomic_swap(&core->memory_withholding, DEQ_IS_EMPTY(core->links_withheld) ? 0 : 1);
+    link->credit_withheld = 0;
+    qdr_del_link_ref(&core->links_throttled, link, QDR_LINK_LIST_CLASS_THROTTLED);
+    link->credit_throttled = 0;
+    link->credit_deferred  = 0;
+
+    //
+    // Drop any cut-through associations in either direction
+    //
+    qdr_link_cut_through_clear_CT(link);
+    qdr_link_ref_t *cut_through_ref = DEQ_HEAD(link->cut_through_sources);
+    while (cut_through_ref) {
+        cut_through_ref->link->cut_through_link = 0;
+        qdr_del_link_ref(&link->cut_through_sources, cut_through_ref->link, QDR_LINK_LIST_CLASS_CUT_THROUGH);
+        cut_through_ref = DEQ_HEAD(link->cut_through_sources);
+    }
+
+    //
+    // Take the link out of its balanced address's consumer heap
+    //
+    if (link->balance_slot && link->owning_addr)
+        qdr_forward_balance_remove_CT(link->owning_addr, link);
+
+    //
+    // Forget the link if it was an edge router's uplink or subscription proxy
+    //
+    qdr_edge_link_lost_CT(core, link, link->owning_addr);
+
     //
     // If this link is involved in inter-router communication, remove its reference
     // from the core mask-bit tables
     //
-    if (link->link_type == QD_LINK_CONTROL)
-        core->control_links_by_mask_bit[conn->mask_bit] = 0;
-    if (link->link_type == QD_LINK_ROUTER)
-        core->data_links_by_mask_bit[conn->mask_bit] = 0;
+    if (conn->role == QDR_ROLE_INTER_ROUTER) {
+        if (link->link_type == QD_LINK_CONTROL)
+            core->control_links_by_mask_bit[conn->mask_bit] = 0;
+        if (link->link_type == QD_LINK_ROUTER)
+            core->data_links_by_mask_bit[conn->mask_bit] = 0;
+    } else if (link == conn->pool_data_link) {
+        qdr_data_pool_leave_CT(core, conn);
+        conn->pool_data_link = 0;
+    }
 
     //
-    // Clean up the lists of deliveries on this link
+    // Hand the lists of deliveries on this link to a teardown, which releases them
+    // over later core passes.  Here they are only detached from the link, which
+    // may be freed before they are released.
     //
-    qdr_delivery_ref_list_t updated_deliveries;
-    qdr_delivery_list_t     undelivered;
-    qdr_delivery_list_t     unsettled;
-    qdr_link_work_list_t    work_list;
+    qdr_link_teardown_t  *teardown = new_qdr_link_teardown_t();
+    qdr_link_work_list_t  work_list;
+
+    ZERO(teardown);
+    teardown->link_direction = link->link_direction;
 
     sys_mutex_lock(conn->work_lock);
     DEQ_MOVE(link->work_list, work_list);
-    DEQ_MOVE(link->updated_deliveries, updated_deliveries);
-    DEQ_MOVE(link->undelivered, undelivered);
-    qdr_delivery_t *d = DEQ_HEAD(undelivered);
+    DEQ_MOVE(link->updated_deliveries, teardown->updated_deliveries);
+    DEQ_MOVE(link->undelivered, teardown->undelivered);
+    link->undelivered_octets = 0;
+    memset(link->priority_depth, 0, sizeof(link->priority_depth));
+    qdr_delivery_t *d = DEQ_HEAD(teardown->undelivered);
     while (d) {
         assert(d->where == QDR_DELIVERY_IN_UNDELIVERED);
-        d->where = QDR_DELIVERY_NOWHERE;
+        d->where     = QDR_DELIVERY_NOWHERE;
+        d->link      = 0;
+        d->link_work = 0;
         d = DEQ_NEXT(d);
     }
 
-    DEQ_MOVE(link->unsettled, unsettled);
-    d = DEQ_HEAD(unsettled);
+    DEQ_MOVE(link->unsettled, teardown->unsettled);
+    d = DEQ_HEAD(teardown->unsettled);
     while (d) {
         assert(d->where == QDR_DELIVERY_IN_UNSETTLED);
         d->where = QDR_DELIVERY_NOWHERE;
+        d->link  = 0;
+
+        //
+        // The copies of an unsettled multicast outlive this ingress delivery's link.
+        //
+        if (d->multicast)
+            d->multicast->complete = true;
         d = DEQ_NEXT(d);
     }
+
+    qdr_delivery_ref_t *ref = DEQ_HEAD(teardown->updated_deliveries);
+    while (ref) {
+        ref->dlv->link = 0;
+        ref = DEQ_NEXT(ref);
+    }
+
+    qdr_delivery_t *streaming = link->streaming_delivery;
+    link->streaming_delivery = 0;
     sys_mutex_unlock(conn->work_lock);
 
+    if (streaming)
+        qdr_delivery_decref_CT(core, streaming);
+
     //
     // Free the work list
     //
@@ -641,101 +1155,15 @@ static void qdr_link_cleanup_CT(qdr_core_t *core, qdr_connection_t *conn, qdr_li
         link_work = DEQ_HEAD(work_list);
     }
 
-    //
-    // Free all the 'updated' references
-    //
-    qdr_delivery_ref_t *ref = DEQ_HEAD(updated_deliveries);
-    while (ref) {
-        //
-        // Account for possible lost reference from the Proton delivery
-        //
-        if (!ref->dlv->cleared_proton_ref) {
-            ref->dlv->cleared_proton_ref = true;
-            qdr_delivery_decref_CT(core, ref->dlv);
-        }
-        //
-        // Now our reference
-        //
-        qdr_delivery_decref_CT(core, ref->dlv);
-        qdr_del_delivery_ref(&updated_deliveries, ref);
-        ref = DEQ_HEAD(updated_deliveries);
-    }
-
-    //
-    // Free the undelivered deliveries.  If this is an incoming link, the
-    // undelivereds can simply be destroyed.  If it's an outgoing link, the
-    // undelivereds' peer deliveries need to be released.
-    //
-    qdr_delivery_t *dlv = DEQ_HEAD(undelivered);
-    qdr_delivery_t *peer;
-    while (dlv) {
-        DEQ_REMOVE_HEAD(undelivered);
-        peer = dlv->peer;
-        if (peer) {
-            dlv->peer  = 0;
-            peer->peer = 0;
-            qdr_delivery_release_CT(core, peer);
-            qdr_delivery_decref_CT(core, peer);
-            qdr_delivery_decref_CT(core, dlv);
-        }
-
-        //
-        // Account for the lost reference from the Proton delivery
-        // for unsettled deliveries on incoming links
-        //
-        if (link->link_direction == QD_INCOMING && !dlv->settled && !dlv->cleared_proton_ref) {
-            dlv->cleared_proton_ref = true;
-            qdr_delivery_decref_CT(core, dlv);
+    if (DEQ_IS_EMPTY(teardown->updated_deliveries) && DEQ_IS_EMPTY(teardown->undelivered) &&
+        DEQ_IS_EMPTY(teardown->unsettled))
+        free_qdr_link_teardown_t(teardown);
+    else {
+        DEQ_INSERT_TAIL(core->link_teardowns, teardown);
+        if (!core->link_teardown_scheduled) {
+            core->link_teardown_scheduled = true;
+            qdr_action_enqueue(core, qdr_action(qdr_link_teardown_CT, "link_teardown"));
         }
-        //
-        // Now the undelivered-list reference
-        //
-        qdr_delivery_decref_CT(core, dlv);
-
-        dlv = DEQ_HEAD(undelivered);
-    }
-
-    //
-    // Free the unsettled deliveries.
-    //
-    dlv = DEQ_HEAD(unsettled);
-    while (dlv) {
-        DEQ_REMOVE_HEAD(unsettled);
-
-        if (dlv->tracking_addr) {
-            dlv->tracking_addr->outstanding_deliveries[dlv->tracking_addr_bit]--;
-            dlv->tracking_addr->tracked_deliveries--;
-
-            if (dlv->tracking_addr->tracked_deliveries == 0)
-                qdr_check_addr_CT(core, dlv->tracking_addr, false);
-
-            dlv->tracking_addr = 0;
-        }
-
-        peer = dlv->peer;
-        if (peer) {
-            dlv->peer  = 0;
-            peer->peer = 0;
-            if (link->link_direction == QD_OUTGOING)
-                qdr_delivery_failed_CT(core, peer);
-
-            qdr_delivery_decref_CT(core, peer);
-            qdr_delivery_decref_CT(core, dlv);
-        }
-
-        //
-        // Account for the lost reference from the Proton delivery
-        //
-        if (!dlv->cleared_proton_ref) {
-            dlv->cleared_proton_ref = true;
-            qdr_delivery_decref_CT(core, dlv);
-        }
-        //
-        // Now the unsettled-list reference
-        //
-        qdr_delivery_decref_CT(core, dlv);
-
-        dlv = DEQ_HEAD(unsettled);
     }
 
     //
@@ -747,11 +1175,12 @@ static void qdr_link_cleanup_CT(qdr_core_t *core, qdr_connection_t *conn, qdr_li
     sys_mutex_unlock(conn->work_lock);
 
     //
-    // Free the link's name and terminus_addr
+    // Free the link's name, terminus_addr and to-override
     //
     free(link->name);
     free(link->terminus_addr);
     link->name = 0;
+    qd_buffer_list_free_buffers(&link->to_override);
 }
 
 
@@ -775,9 +1204,11 @@ qdr_link_t *qdr_create_link_CT(qdr_core_t       *core,
     link->link_type      = link_type;
     link->link_direction = dir;
     link->capacity       = conn->link_capacity;
-    link->name           = (char*) malloc(QDR_DISCRIMINATOR_SIZE + 8);
+    link->capacity_min   = conn->link_capacity;
+    link->capacity_max   = conn->link_capacity_max;
+    link->name           = (char*) malloc(sizeof(QDR_LINK_NAME_LABEL) - 1 + QDR_DISCRIMINATOR_SIZE);
     link->terminus_addr  = 0;
-    qdr_generate_link_name("qdlink", link->name, QDR_DISCRIMINATOR_SIZE + 8);
+    qdr_generate_link_name(core, link->name);
     link->admin_enabled  = true;
     link->oper_status    = QDR_LINK_OPER_DOWN;
 
@@ -860,7 +1291,28 @@ static char qdr_prefix_for_dir(qd_direction_t dir)
 }
 
 
-qd_address_treatment_t qdr_treatment_for_address_CT(qdr_core_t *core, qdr_connection_t *conn, qd_iterator_t *iter, int *in_phase, int *out_phase)
+/**
+ * Match the address of an iterator, as seen with its tenant space, against a
+ * pattern tree.  The iterator's own view is left unchanged.
+ */
+static void *qdr_match_pattern_CT(qd_parse_tree_t *tree, qd_iterator_t *iter)
+{
+    void *payload = 0;
+
+    if (qd_parse_tree_size(tree) == 0)
+        return 0;
+
+    qd_iterator_storage_t storage;
+    qd_iterator_t *view = qd_iterator_init_dup(&storage, iter);
+    qd_iterator_reset_view(view, ITER_VIEW_ADDRESS_WITH_SPACE);
+    qd_parse_tree_retrieve_match(tree, view, &payload);
+    qd_iterator_free(view);
+
+    return payload;
+}
+
+
+qd_address_treatment_t qdr_treatment_for_address_CT(qdr_core_t *core, qdr_connection_t *conn, qd_iterator_t *iter, int *in_phase, int *out_phase, qdr_address_config_t **config)
 {
     qdr_address_config_t *addr = 0;
 
@@ -872,15 +1324,18 @@ qd_address_treatment_t qdr_treatment_for_address_CT(qdr_core_t *core, qdr_connec
     if (conn && conn->tenant_space)
         qd_iterator_annotate_space(iter, conn->tenant_space, conn->tenant_space_len);
     qd_hash_retrieve_prefix(core->addr_hash, iter, (void**) &addr);
+    if (!addr)
+        addr = (qdr_address_config_t*) qdr_match_pattern_CT(core->addr_parse_tree, iter);
     qd_iterator_annotate_prefix(iter, '\0');
     if (in_phase)  *in_phase  = addr ? addr->in_phase  : 0;
     if (out_phase) *out_phase = addr ? addr->out_phase : 0;
+    if (config)    *config    = addr;
 
     return addr ? addr->treatment : QD_TREATMENT_ANYCAST_BALANCED;
 }
 
 
-qd_address_treatment_t qdr_treatment_for_address_hash_CT(qdr_core_t *core, qd_iterator_t *iter)
+qd_address_treatment_t qdr_treatment_for_address_hash_CT(qdr_core_t *core, qd_iterator_t *iter, qdr_address_config_t **config)
 {
 #define HASH_STORAGE_SIZE 1000
     char  storage[HASH_STORAGE_SIZE + 1];
@@ -889,6 +1344,9 @@ qd_address_treatment_t qdr_treatment_for_address_hash_CT(qdr_core_t *core, qd_it
     int   length  = qd_iterator_length(iter);
     qd_address_treatment_t trt = QD_TREATMENT_ANYCAST_BALANCED;
 
+    if (config)
+        *config = 0;
+
     if (length > HASH_STORAGE_SIZE) {
         copy    = (char*) malloc(length + 1);
         on_heap = true;
@@ -896,7 +1354,7 @@ qd_address_treatment_t qdr_treatment_for_address_hash_CT(qdr_core_t *core, qd_it
 
     qd_iterator_strncpy(iter, copy, length + 1);
 
-    if (copy[0] == 'C' || copy[0] == 'D')
+    if (copy[0] == 'C' || copy[0] == 'D' || copy[0] == QDR_LINK_ROUTE_PATTERN_IN || copy[0] == QDR_LINK_ROUTE_PATTERN_OUT)
         //
         // Handle the link-route address case
         // TODO - put link-routes into the config table with a different prefix from 'Z'
@@ -908,13 +1366,27 @@ qd_address_treatment_t qdr_treatment_for_address_hash_CT(qdr_core_t *core, qd_it
         // Handle the mobile address case
         //
         copy[1] = 'Z';
-        qd_iterator_t  *config_iter = qd_iterator_string(&copy[1], ITER_VIEW_ALL);
+        qd_iterator_storage_t storage;
+        qd_iterator_t  *config_iter = qd_iterator_init_string(&storage, &copy[1], ITER_VIEW_ALL);
         qdr_address_config_t *addr = 0;
 
         qd_hash_retrieve_prefix(core->addr_hash, config_iter, (void**) &addr);
-        if (addr)
-            trt = addr->treatment;
         qd_iterator_free(config_iter);
+
+        if (!addr && qd_parse_tree_size(core->addr_parse_tree)) {
+            //
+            // Match the patterns against the address without its "Mp" annotation
+            //
+            config_iter = qd_iterator_init_string(&storage, &copy[2], ITER_VIEW_ALL);
+            qd_parse_tree_retrieve_match(core->addr_parse_tree, config_iter, (void**) &addr);
+            qd_iterator_free(config_iter);
+        }
+
+        if (addr) {
+            trt = addr->treatment;
+            if (config)
+                *config = addr;
+        }
     }
 
     if (on_heap)
@@ -1000,6 +1472,8 @@ static qdr_address_t *qdr_lookup_terminus_address_CT(qdr_core_t       *core,
             if (conn->tenant_space)
                 qd_iterator_annotate_space(dnp_address, conn->tenant_space, conn->tenant_space_len);
             qd_hash_retrieve_prefix(core->addr_hash, dnp_address, (void**) &addr);
+            if (!addr)
+                addr = (qdr_address_t*) qdr_match_pattern_CT(core->link_route_tree[dir], dnp_address);
 
             if (addr && conn->tenant_space) {
                 //
@@ -1023,7 +1497,7 @@ static qdr_address_t *qdr_lookup_terminus_address_CT(qdr_core_t       *core,
         if (!accept_dynamic)
             return 0;
 
-        char temp_addr[200];
+        char temp_addr[QDR_DYNAMIC_ADDR_SIZE(core)];
         bool generating = true;
         while (generating) {
             //
@@ -1031,16 +1505,22 @@ static qdr_address_t *qdr_lookup_terminus_address_CT(qdr_core_t       *core,
             // address collides with a previously generated address (this should be _highly_
             // unlikely).
             //
-            if (dir == QD_OUTGOING)
-                qdr_generate_temp_addr(core, temp_addr, 200);
+            //
+            // Addresses local to an edge router can't be reached from the interior, so
+            // its dynamic receivers get mobile addresses, which it subscribes to upstream.
+            //
+            if (dir == QD_OUTGOING && core->router_mode != QD_ROUTER_MODE_EDGE)
+                qdr_generate_temp_addr(core, temp_addr);
             else
-                qdr_generate_mobile_addr(core, temp_addr, 200);
+                qdr_generate_mobile_addr(core, temp_addr);
 
-            qd_iterator_t *temp_iter = qd_iterator_string(temp_addr, ITER_VIEW_ADDRESS_HASH);
+            qd_iterator_storage_t storage;
+            qd_iterator_t *temp_iter = qd_iterator_init_string(&storage, temp_addr, ITER_VIEW_ADDRESS_HASH);
             qd_hash_retrieve(core->addr_hash, temp_iter, (void**) &addr);
             if (!addr) {
                 addr = qdr_address_CT(core, QD_TREATMENT_ANYCAST_BALANCED);
                 qd_hash_insert(core->addr_hash, temp_iter, addr, &addr->hash_handle);
+                qdr_addr_view_add_CT(core, addr);
                 DEQ_INSERT_TAIL(core->addrs, addr);
                 qdr_terminus_set_address(terminus, temp_addr);
                 generating = false;
@@ -1066,6 +1546,8 @@ static qdr_address_t *qdr_lookup_terminus_address_CT(qdr_core_t       *core,
     if (conn->tenant_space)
         qd_iterator_annotate_space(iter, conn->tenant_space, conn->tenant_space_len);
     qd_hash_retrieve_prefix(core->addr_hash, iter, (void**) &addr);
+    if (!addr)
+        addr = (qdr_address_t*) qdr_match_pattern_CT(core->link_route_tree[dir], iter);
     if (addr) {
         *link_route = true;
 
@@ -1086,7 +1568,8 @@ static qdr_address_t *qdr_lookup_terminus_address_CT(qdr_core_t       *core,
     int in_phase;
     int out_phase;
     int addr_phase;
-    qd_address_treatment_t treat = qdr_treatment_for_address_CT(core, conn, iter, &in_phase, &out_phase);
+    qdr_address_config_t *config;
+    qd_address_treatment_t treat = qdr_treatment_for_address_CT(core, conn, iter, &in_phase, &out_phase, &config);
 
     qd_iterator_annotate_prefix(iter, '\0'); // Cancel previous override
     addr_phase = dir == QD_INCOMING ? in_phase : out_phase;
@@ -1095,7 +1578,9 @@ static qdr_address_t *qdr_lookup_terminus_address_CT(qdr_core_t       *core,
     qd_hash_retrieve(core->addr_hash, iter, (void**) &addr);
     if (!addr && create_if_not_found) {
         addr = qdr_address_CT(core, treat);
+        qdr_address_configure_CT(addr, config);
         qd_hash_insert(core->addr_hash, iter, addr, &addr->hash_handle);
+        qdr_addr_view_add_CT(core, addr);
         DEQ_INSERT_TAIL(core->addrs, addr);
     }
 
@@ -1109,6 +1594,7 @@ static void qdr_connection_opened_CT(qdr_core_t *core, qdr_action_t *action, boo
         qdr_connection_t *conn = action->args.connection.conn;
         DEQ_ITEM_INIT(conn);
         DEQ_INSERT_TAIL(core->open_connections, conn);
+        qdr_connection_rate_bind_CT(core, conn);
 
         if (conn->role == QDR_ROLE_NORMAL) {
             //
@@ -1119,6 +1605,17 @@ static void qdr_connection_opened_CT(qdr_core_t *core, qdr_action_t *action, boo
             return;
         }
 
+        if (conn->role == QDR_ROLE_INTER_ROUTER || conn->role == QDR_ROLE_INTER_ROUTER_DATA)
+            conn->peer_container = qdr_field_copy(action->args.connection.container_id);
+
+        if (conn->role == QDR_ROLE_INTER_ROUTER_DATA) {
+            qdr_data_conn_opened_CT(core, conn);
+            if (!conn->incoming) {
+                (void) qdr_create_link_CT(core, conn, QD_LINK_ROUTER,  QD_INCOMING, qdr_terminus_router_data(), qdr_terminus_router_data());
+                (void) qdr_create_link_CT(core, conn, QD_LINK_ROUTER,  QD_OUTGOING, qdr_terminus_router_data(), qdr_terminus_router_data());
+            }
+        }
+
         if (conn->role == QDR_ROLE_INTER_ROUTER) {
             //
             // Assign a unique mask-bit to this connection as a reference to be used by
@@ -1144,8 +1641,13 @@ static void qdr_connection_opened_CT(qdr_core_t *core, qdr_action_t *action, boo
                 (void) qdr_create_link_CT(core, conn, QD_LINK_ROUTER,  QD_INCOMING, qdr_terminus_router_data(), qdr_terminus_router_data());
                 (void) qdr_create_link_CT(core, conn, QD_LINK_ROUTER,  QD_OUTGOING, qdr_terminus_router_data(), qdr_terminus_router_data());
             }
+
+            qdr_data_pool_bind_CT(core, conn, true);
         }
 
+        if (conn->role == QDR_ROLE_EDGE_CONNECTION)
+            qdr_edge_connection_opened_CT(core, conn);
+
         if (conn->role == QDR_ROLE_ROUTE_CONTAINER) {
             //
             // Notify the route-control module that a route-container connection has opened.
@@ -1176,22 +1678,19 @@ static void qdr_connection_free(qdr_connection_t *conn)
         free(conn->connection_info->ssl_cipher);
         free(conn->connection_info->user);
         pn_data_free(conn->connection_info->connection_properties);
+        qdr_compression_stats_decref(conn->connection_info->compression);
     }
 
     free(conn->tenant_space);
+    free(conn->peer_container);
 
     free_qdr_connection_info_t(conn->connection_info);
     free_qdr_connection_t(conn);
 }
 
 
-static void qdr_connection_closed_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+static void qdr_connection_close_CT(qdr_core_t *core, qdr_connection_t *conn)
 {
-    if (discard)
-        return;
-
-    qdr_connection_t *conn = action->args.connection.conn;
-
     //
     // Deactivate routes associated with this connection
     //
@@ -1200,8 +1699,10 @@ static void qdr_connection_closed_CT(qdr_core_t *core, qdr_action_t *action, boo
     //
     // Give back the router mask-bit.
     //
-    if (conn->role == QDR_ROLE_INTER_ROUTER)
+    if (conn->role == QDR_ROLE_INTER_ROUTER) {
+        qdr_data_pool_bind_CT(core, conn, false);
         qd_bitmask_set_bit(core->neighbor_free_mask, conn->mask_bit);
+    }
 
     //
     // TODO - Clean up links associated with this connection
@@ -1220,6 +1721,12 @@ static void qdr_connection_closed_CT(qdr_core_t *core, qdr_action_t *action, boo
         link_ref = DEQ_HEAD(conn->links);
     }
 
+    //
+    // If this was an edge router's uplink, fail over to another edge connection
+    //
+    if (conn->role == QDR_ROLE_EDGE_CONNECTION)
+        qdr_edge_connection_closed_CT(core, conn);
+
     //
     // Discard items on the work list
     //
@@ -1232,12 +1739,27 @@ static void qdr_connection_closed_CT(qdr_core_t *core, qdr_action_t *action, boo
         work = DEQ_HEAD(conn->work_list);
     }
 
+    qdr_connection_rate_unbind_CT(core, conn);
+    qdr_agent_cursor_remove_CT(core, conn, DEQ_NEXT(conn));
     DEQ_REMOVE(core->open_connections, conn);
-    sys_mutex_free(conn->work_lock);
     qdr_connection_free(conn);
 }
 
 
+static void qdr_connection_closed_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    if (discard)
+        return;
+
+    qdr_connection_t *conn = action->args.connection.conn;
+    while (conn) {
+        qdr_connection_t *next = conn->next_closed;
+        qdr_connection_close_CT(core, conn);
+        conn = next;
+    }
+}
+
+
 static void qdr_link_inbound_first_attach_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
 {
     if (discard)
@@ -1259,7 +1781,8 @@ static void qdr_link_inbound_first_attach_CT(qdr_core_t *core, qdr_action_t *act
     //
     // Reject any attaches of inter-router links that arrive on connections that are not inter-router.
     //
-    if (((link->link_type == QD_LINK_CONTROL || link->link_type == QD_LINK_ROUTER) && conn->role != QDR_ROLE_INTER_ROUTER)) {
+    if ((link->link_type == QD_LINK_CONTROL && conn->role != QDR_ROLE_INTER_ROUTER) ||
+        (link->link_type == QD_LINK_ROUTER && conn->role != QDR_ROLE_INTER_ROUTER && conn->role != QDR_ROLE_INTER_ROUTER_DATA)) {
         qdr_link_outbound_detach_CT(core, link, 0, QDR_CONDITION_FORBIDDEN, true);
         qdr_terminus_free(source);
         qdr_terminus_free(target);
@@ -1279,6 +1802,16 @@ static void qdr_link_inbound_first_attach_CT(qdr_core_t *core, qdr_action_t *act
         return;
     }
 
+    //
+    // Inter-router-data connections carry nothing but the data links.
+    //
+    if (conn->role == QDR_ROLE_INTER_ROUTER_DATA && link->link_type == QD_LINK_ENDPOINT) {
+        qdr_link_outbound_detach_CT(core, link, 0, QDR_CONDITION_WRONG_ROLE, true);
+        qdr_terminus_free(source);
+        qdr_terminus_free(target);
+        return;
+    }
+
     if (dir == QD_INCOMING) {
         //
         // Handle incoming link cases
@@ -1327,8 +1860,10 @@ static void qdr_link_inbound_first_attach_CT(qdr_core_t *core, qdr_action_t *act
 
                     //
                     // Issue the initial credit only if there are destinations for the address.
+                    // On an edge router, the interior is one.
                     //
-                    if (DEQ_SIZE(addr->subscriptions) || DEQ_SIZE(addr->rlinks) || qd_bitmask_cardinality(addr->rnodes))
+                    if (DEQ_SIZE(addr->subscriptions) || DEQ_SIZE(addr->rlinks) || qd_bitmask_cardinality(addr->rnodes) ||
+                        qdr_edge_uplink_CT(core, 0, false))
                         qdr_link_issue_credit_CT(core, link, link->capacity, false);
                 }
             }
@@ -1380,6 +1915,8 @@ static void qdr_link_inbound_first_attach_CT(qdr_core_t *core, qdr_action_t *act
                 //
                 link->owning_addr = addr;
                 qdr_add_link_ref(&addr->rlinks, link, QDR_LINK_LIST_CLASS_ADDRESS);
+                qdr_addr_view_paths_CT(addr);
+                qdr_forward_balance_add_CT(addr, link);
                 if (DEQ_SIZE(addr->rlinks) == 1) {
                     const char *key = (const char*) qd_hash_key_by_handle(addr->hash_handle);
                     if (key && *key == 'M')
@@ -1394,12 +1931,13 @@ static void qdr_link_inbound_first_attach_CT(qdr_core_t *core, qdr_action_t *act
         case QD_LINK_CONTROL:
             link->owning_addr = core->hello_addr;
             qdr_add_link_ref(&core->hello_addr->rlinks, link, QDR_LINK_LIST_CLASS_ADDRESS);
+            qdr_addr_view_paths_CT(core->hello_addr);
             core->control_links_by_mask_bit[conn->mask_bit] = link;
             qdr_link_outbound_second_attach_CT(core, link, source, target);
             break;
 
         case QD_LINK_ROUTER:
-            core->data_links_by_mask_bit[conn->mask_bit] = link;
+            qdr_set_data_link_CT(core, conn, link);
             qdr_link_outbound_second_attach_CT(core, link, source, target);
             break;
         }
@@ -1472,7 +2010,9 @@ static void qdr_link_inbound_second_attach_CT(qdr_core_t *core, qdr_action_t *ac
                 if (qdr_terminus_get_address(target)) {
                     link->auto_link->state = QDR_AUTO_LINK_STATE_ACTIVE;
                     qdr_add_link_ref(&link->auto_link->addr->rlinks, link, QDR_LINK_LIST_CLASS_ADDRESS);
+                    qdr_addr_view_paths_CT(link->auto_link->addr);
                     link->owning_addr = link->auto_link->addr;
+                    qdr_forward_balance_add_CT(link->auto_link->addr, link);
                     if (DEQ_SIZE(link->auto_link->addr->rlinks) == 1) {
                         const char *key = (const char*) qd_hash_key_by_handle(link->auto_link->addr->hash_handle);
                         if (key && *key == 'M')
@@ -1486,11 +2026,12 @@ static void qdr_link_inbound_second_attach_CT(qdr_core_t *core, qdr_action_t *ac
         case QD_LINK_CONTROL:
             link->owning_addr = core->hello_addr;
             qdr_add_link_ref(&core->hello_addr->rlinks, link, QDR_LINK_LIST_CLASS_ADDRESS);
+            qdr_addr_view_paths_CT(core->hello_addr);
             core->control_links_by_mask_bit[conn->mask_bit] = link;
             break;
 
         case QD_LINK_ROUTER:
-            core->data_links_by_mask_bit[conn->mask_bit] = link;
+            qdr_set_data_link_CT(core, conn, link);
             break;
         }
     }
@@ -1549,6 +2090,7 @@ static void qdr_link_inbound_detach_CT(qdr_core_t *core, qdr_action_t *action, b
         link->auto_link->last_error = qdr_error_description(error);
     }
 
+    qdr_edge_link_lost_CT(core, link, addr);
     link->owning_addr = 0;
 
     if (link->link_direction == QD_INCOMING) {
@@ -1575,6 +2117,8 @@ static void qdr_link_inbound_detach_CT(qdr_core_t *core, qdr_action_t *action, b
         case QD_LINK_ENDPOINT:
             if (addr) {
                 qdr_del_link_ref(&addr->rlinks, link, QDR_LINK_LIST_CLASS_ADDRESS);
+                qdr_addr_view_paths_CT(addr);
+                qdr_forward_balance_remove_CT(addr, link);
                 was_local = true;
             }
             break;
@@ -1582,6 +2126,7 @@ static void qdr_link_inbound_detach_CT(qdr_core_t *core, qdr_action_t *action, b
         case QD_LINK_CONTROL:
             if (conn->role == QDR_ROLE_INTER_ROUTER) {
                 qdr_del_link_ref(&core->hello_addr->rlinks, link, QDR_LINK_LIST_CLASS_ADDRESS);
+                qdr_addr_view_paths_CT(core->hello_addr);
                 core->control_links_by_mask_bit[conn->mask_bit] = 0;
                 qdr_post_link_lost_CT(core, conn->mask_bit);
             }
@@ -1590,6 +2135,10 @@ static void qdr_link_inbound_detach_CT(qdr_core_t *core, qdr_action_t *action, b
         case QD_LINK_ROUTER:
             if (conn->role == QDR_ROLE_INTER_ROUTER)
                 core->data_links_by_mask_bit[conn->mask_bit] = 0;
+            else if (link == conn->pool_data_link) {
+                qdr_data_pool_leave_CT(core, conn);
+                conn->pool_data_link = 0;
+            }
             break;
         }
     }
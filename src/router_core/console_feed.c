@@ -0,0 +1,120 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "router_core_private.h"
+#include <qpid/dispatch/compose.h>
+
+//
+// Consoles may subscribe to QDR_CONSOLE_ADDRESS instead of polling the management agent
+// for the router-wide figures.  Every tick, while anything is subscribed, the core sends
+// one message built from its statistics snapshot, which all subscribers share.  The body
+// is a map of the current gauges and, under "deltas", of how much each counter grew
+// since the previous message.  The first message's deltas are the totals.
+//
+
+static void insert_value(qd_composed_field_t *field, const char *key, uint64_t value)
+{
+    qd_compose_insert_string(field, key);
+    qd_compose_insert_ulong(field, value);
+}
+
+
+static qd_message_t *qdr_console_message_CT(qdr_core_t *core, const qdr_core_stats_t *now,
+                                            const qdr_core_stats_t *last)
+{
+    qd_composed_field_t *fld = qd_compose(QD_PERFORMATIVE_HEADER, 0);
+    qd_compose_start_list(fld);
+    qd_compose_insert_bool(fld, 0);     // durable
+    qd_compose_end_list(fld);
+
+    fld = qd_compose(QD_PERFORMATIVE_PROPERTIES, fld);
+    qd_compose_start_list(fld);
+    qd_compose_insert_null(fld);                      // message-id
+    qd_compose_insert_null(fld);                      // user-id
+    qd_compose_insert_string(fld, QDR_CONSOLE_ADDRESS); // to
+    qd_compose_insert_string(fld, "stats");           // subject
+    qd_compose_end_list(fld);
+
+    fld = qd_compose(QD_PERFORMATIVE_APPLICATION_PROPERTIES, fld);
+    qd_compose_start_map(fld);
+    qd_compose_insert_string(fld, "router");
+    qd_compose_insert_string(fld, core->router_id);
+    qd_compose_end_map(fld);
+
+    qd_composed_field_t *body = qd_compose(QD_PERFORMATIVE_BODY_AMQP_VALUE, 0);
+    qd_compose_start_map(body);
+    insert_value(body, "sequence",        core->console_sequence);
+    insert_value(body, "intervalMsec",    last->published_ns ? (now->published_ns - last->published_ns) / 1000000 : 0);
+    insert_value(body, "connectionCount", now->connection_count);
+    insert_value(body, "linkCount",       now->link_count);
+    insert_value(body, "addrCount",       now->addr_count);
+    insert_value(body, "nodeCount",       now->router_count);
+    insert_value(body, "linkRouteCount",  now->link_route_count);
+    insert_value(body, "autoLinkCount",   now->auto_link_count);
+    insert_value(body, "coreUtilization", now->utilization);
+
+    qd_compose_insert_string(body, "deltas");
+    qd_compose_start_map(body);
+    insert_value(body, "deliveriesIngress",           now->deliveries_ingress - last->deliveries_ingress);
+    insert_value(body, "deliveriesEgress",            now->deliveries_egress - last->deliveries_egress);
+    insert_value(body, "deliveriesTransit",           now->deliveries_transit - last->deliveries_transit);
+    insert_value(body, "deliveriesToContainer",       now->deliveries_to_container - last->deliveries_to_container);
+    insert_value(body, "deliveriesFromContainer",     now->deliveries_from_container - last->deliveries_from_container);
+    insert_value(body, "droppedPresettledDeliveries",
+                 now->dropped_presettled_deliveries - last->dropped_presettled_deliveries);
+    insert_value(body, "coreBusyTime",                (now->busy_time_ns - last->busy_time_ns) / 1000);
+    qd_compose_end_map(body);
+    qd_compose_end_map(body);
+
+    qd_message_t *msg = qd_message();
+    qd_message_compose_3(msg, fld, body);
+    qd_compose_free(fld);
+    qd_compose_free(body);
+    return msg;
+}
+
+
+static void qdr_console_tick_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    qdr_address_t *addr = core->console_addr;
+    if (discard || !addr || DEQ_SIZE(addr->rlinks) == 0) {
+        //
+        // With nobody listening the next subscriber starts from the totals.
+        //
+        ZERO(&core->console_last);
+        return;
+    }
+
+    qdr_core_stats_t now;
+    qdr_publish_stats_CT(core, true);
+    qdr_core_stats(core, &now);
+
+    core->console_sequence++;
+    qd_message_t *msg = qdr_console_message_CT(core, &now, &core->console_last);
+    core->console_last = now;
+
+    qdr_forward_message_CT(core, addr, msg, 0, true, false);
+    qd_message_free(msg);
+}
+
+
+void qdr_core_console_tick(qdr_core_t *core)
+{
+    qdr_action_enqueue(core, qdr_action(qdr_console_tick_CT, "console_tick"));
+}
@@ -0,0 +1,162 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "router_core_private.h"
+#include <inttypes.h>
+
+//
+// An edge router takes no part in the routing protocol and knows only its own
+// addresses.  It connects to the interior over connections in the edge role, one of
+// which is used at a time as the uplink; if the uplink closes, another edge connection
+// takes over.  Messages with no destination here are sent up the uplink's anonymous
+// link, and multicasts are copied up as well.  For each local mobile address with
+// consumers the edge keeps a receiving link open on the uplink, through which the
+// interior delivers the address's messages from the rest of the network.  Those links
+// follow the batches of mobile address changes, so a burst of client attaches becomes
+// a burst of proxy attaches on a single connection.
+//
+
+
+static void qdr_edge_subscribe_CT(qdr_core_t *core, qdr_address_t *addr)
+{
+    if (addr->edge_link || !core->edge_uplink)
+        return;
+
+    //
+    // Only the mobile addresses of phase 0 are proxied; phased addresses belong to
+    // waypoints, which are an interior concern.
+    //
+    const char *key = (const char*) qd_hash_key_by_handle(addr->hash_handle);
+    if (!key || key[0] != 'M' || key[1] != '0')
+        return;
+
+    qdr_terminus_t *source = qdr_terminus(0);
+    qdr_terminus_set_address(source, &key[2]);
+
+    qdr_link_t *link  = qdr_create_link_CT(core, core->edge_uplink, QD_LINK_ENDPOINT, QD_INCOMING, source, 0);
+    link->edge_proxy  = true;
+    link->owning_addr = addr;
+    addr->edge_link   = link;
+    qdr_add_link_ref(&addr->inlinks, link, QDR_LINK_LIST_CLASS_ADDRESS);
+}
+
+
+static void qdr_edge_unsubscribe_CT(qdr_core_t *core, qdr_address_t *addr)
+{
+    qdr_link_t *link = addr->edge_link;
+    if (!link)
+        return;
+
+    //
+    // The link leaves the address's inlinks when the interior's detach comes back.
+    //
+    addr->edge_link = 0;
+    qdr_link_outbound_detach_CT(core, link, 0, QDR_CONDITION_NONE, true);
+}
+
+
+static void qdr_edge_activate_CT(qdr_core_t *core, qdr_connection_t *conn)
+{
+    core->edge_uplink      = conn;
+    core->edge_uplink_link = qdr_create_link_CT(core, conn, QD_LINK_ENDPOINT, QD_OUTGOING, qdr_terminus(0), qdr_terminus(0));
+    qd_log(core->log, QD_LOG_INFO, "Edge uplink established on connection %"PRIu64, conn->identity);
+
+    //
+    // Subscribe to the addresses with local consumers, and start the senders that
+    // were waiting for a destination now that the interior is one.
+    //
+    qdr_address_t *addr = DEQ_HEAD(core->addrs);
+    while (addr) {
+        if (DEQ_SIZE(addr->rlinks) > 0)
+            qdr_edge_subscribe_CT(core, addr);
+        qdr_addr_start_inlinks_CT(core, addr);
+        addr = DEQ_NEXT(addr);
+    }
+}
+
+
+void qdr_edge_connection_opened_CT(qdr_core_t *core, qdr_connection_t *conn)
+{
+    if (core->router_mode == QD_ROUTER_MODE_EDGE && !core->edge_uplink)
+        qdr_edge_activate_CT(core, conn);
+}
+
+
+void qdr_edge_connection_closed_CT(qdr_core_t *core, qdr_connection_t *conn)
+{
+    if (conn != core->edge_uplink)
+        return;
+
+    //
+    // The connection's links, the proxies among them, are already gone.
+    //
+    core->edge_uplink      = 0;
+    core->edge_uplink_link = 0;
+    qd_log(core->log, QD_LOG_INFO, "Edge uplink on connection %"PRIu64" lost", conn->identity);
+
+    qdr_connection_t *other = DEQ_HEAD(core->open_connections);
+    while (other) {
+        if (other != conn && other->role == QDR_ROLE_EDGE_CONNECTION) {
+            qdr_edge_activate_CT(core, other);
+            break;
+        }
+        other = DEQ_NEXT(other);
+    }
+}
+
+
+void qdr_edge_mobile_changes_CT(qdr_core_t *core, qdr_mobile_change_list_t *changes)
+{
+    qdr_mobile_change_t *change = DEQ_HEAD(*changes);
+    while (change) {
+        DEQ_REMOVE_HEAD(*changes);
+
+        //
+        // Without an uplink the changes are moot: the subscriptions are all made
+        // afresh when one is established.
+        //
+        if (core->edge_uplink) {
+            qd_iterator_storage_t  storage;
+            qd_iterator_t         *iter = qd_iterator_init_string(&storage, change->address_hash, ITER_VIEW_ALL);
+            qdr_address_t         *addr = 0;
+
+            qd_hash_retrieve(core->addr_hash, iter, (void**) &addr);
+            qd_iterator_free(iter);
+            if (addr) {
+                if (change->added && DEQ_SIZE(addr->rlinks) > 0)
+                    qdr_edge_subscribe_CT(core, addr);
+                else if (!change->added && DEQ_SIZE(addr->rlinks) == 0)
+                    qdr_edge_unsubscribe_CT(core, addr);
+            }
+        }
+
+        free(change->address_hash);
+        free_qdr_mobile_change_t(change);
+        change = DEQ_HEAD(*changes);
+    }
+}
+
+
+void qdr_edge_link_lost_CT(qdr_core_t *core, qdr_link_t *link, qdr_address_t *addr)
+{
+    if (link == core->edge_uplink_link)
+        core->edge_uplink_link = 0;
+    if (link->edge_proxy && addr && addr->edge_link == link)
+        addr->edge_link = 0;
+}
@@ -18,6 +18,8 @@
  */
 
 #include "router_core_private.h"
+#include "probes.h"
+#include "spill.h"
 #include <qpid/dispatch/amqp.h>
 #include <stdio.h>
 #include <strings.h>
@@ -100,6 +102,12 @@ static void qdr_forward_find_closest_remotes_CT(qdr_core_t *core, qdr_address_t
 
 
 qdr_delivery_t *qdr_forward_new_delivery_CT(qdr_core_t *core, qdr_delivery_t *in_dlv, qdr_link_t *link, qd_message_t *msg)
+{
+    return qdr_forward_move_delivery_CT(core, in_dlv, link, qd_message_copy(msg));
+}
+
+
+qdr_delivery_t *qdr_forward_move_delivery_CT(qdr_core_t *core, qdr_delivery_t *in_dlv, qdr_link_t *link, qd_message_t *msg)
 {
     qdr_delivery_t *dlv = new_qdr_delivery_t();
     uint64_t       *tag = (uint64_t*) dlv->tag;
@@ -107,18 +115,27 @@ qdr_delivery_t *qdr_forward_new_delivery_CT(qdr_core_t *core, qdr_delivery_t *in
     ZERO(dlv);
     sys_atomic_init(&dlv->ref_count, 0);
     dlv->link       = link;
-    dlv->msg        = qd_message_copy(msg);
+    dlv->msg        = msg;
     dlv->settled    = !in_dlv || in_dlv->settled;
     dlv->presettled = dlv->settled;
     *tag            = core->next_tag++;
     dlv->tag_length = 8;
     dlv->error      = 0;
+    dlv->ingress_ns = in_dlv ? in_dlv->ingress_ns : qdr_monotonic_ns();
 
     //
-    // Create peer linkage only if the delivery is not settled
+    // Create peer linkage only if the delivery is not settled.  The copies of an
+    // unsettled multicast all take the ingress delivery as their peer, but it
+    // takes none of them; their outcomes are aggregated instead.
     //
     if (!dlv->settled) {
-        if (in_dlv && in_dlv->peer == 0) {
+        if (in_dlv && in_dlv->multicast) {
+            dlv->peer = in_dlv;
+            in_dlv->multicast->outstanding++;
+
+            qdr_delivery_incref(dlv);
+            qdr_delivery_incref(in_dlv);
+        } else if (in_dlv && in_dlv->peer == 0) {
             dlv->peer = in_dlv;
             in_dlv->peer = dlv;
 
@@ -127,63 +144,229 @@ qdr_delivery_t *qdr_forward_new_delivery_CT(qdr_core_t *core, qdr_delivery_t *in
         }
     }
 
+    //
+    // If the message is still arriving, more content on the incoming link must wake this one.
+    //
+    if (in_dlv && in_dlv->link && !qd_message_receive_complete(msg))
+        qdr_link_cut_through_CT(in_dlv->link, link);
+
     return dlv;
 }
 
 
 //
-// Drop all pre-settled deliveries pending on the link's
-// undelivered list.
+// A pre-settled delivery with a single destination needs no peer, so rather than build
+// a second delivery and share the message with it, the ingress delivery itself moves to
+// the outgoing link.  Its ingress link counts it now, since it won't be freed there.
+// A message still arriving stays with the ingress link for cut-through.
+//
+static qdr_delivery_t *qdr_forward_anycast_delivery_CT(qdr_core_t *core, qdr_delivery_t *in_dlv, qdr_link_t *link, qd_message_t *msg)
+{
+    if (in_dlv && in_dlv->settled && in_dlv->link && in_dlv->msg == msg && qd_message_receive_complete(msg)) {
+        uint64_t *tag = (uint64_t*) in_dlv->tag;
+
+        in_dlv->link->counts.presettled++;
+        in_dlv->link       = link;
+        *tag               = core->next_tag++;
+        in_dlv->tag_length = 8;
+        return in_dlv;
+    }
+
+    return qdr_forward_new_delivery_CT(core, in_dlv, link, msg);
+}
+
+
+//
+// Drop a pre-settled delivery from the link's undelivered list.  Returns false
+// if it is not pre-settled or is in a link_work record that is being
+// processed, in which case it is too late to drop the delivery.
+//
+static bool qdr_forward_drop_presettled_CT_LH(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv)
+{
+    if (!dlv->settled || !dlv->link_work || dlv->link_work->processing)
+        return false;
+
+    DEQ_REMOVE(link->undelivered, dlv);
+    dlv->where = QDR_DELIVERY_NOWHERE;
+    link->undelivered_octets -= dlv->queued_octets;
+    link->priority_depth[dlv->priority]--;
+
+    //
+    // The link-work item representing this pending delivery must be
+    // updated to reflect the removal of the delivery.  If the item
+    // has no other deliveries associated with it, it can be removed
+    // from the work list.
+    //
+    if (--dlv->link_work->value == 0) {
+        DEQ_REMOVE(link->work_list, dlv->link_work);
+        free_qdr_link_work_t(dlv->link_work);
+        dlv->link_work = 0;
+    }
+    qdr_delivery_decref_CT(core, dlv);
+    return true;
+}
+
+
+static bool qdr_forward_backed_up_LH(qdr_link_t *link, const qdr_shed_policy_t *policy, uint64_t octets)
+{
+    int depth = policy->depth > 0 ? policy->depth : link->capacity;
+
+    if (DEQ_IS_EMPTY(link->undelivered))
+        return false;
+    if (depth > 0 && DEQ_SIZE(link->undelivered) >= depth)
+        return true;
+    return policy->octets > 0 && link->undelivered_octets + octets > policy->octets;
+}
+
+
+//
+// Hash the address with the value of the message's conflation key.  Zero means
+// the message has no value for the key and can't be conflated.
 //
-static void qdr_forward_drop_presettled_CT_LH(qdr_core_t *core, qdr_link_t *link)
+static uint32_t qdr_forward_conflate_hash(qdr_address_t *addr, qd_message_t *msg)
 {
-    qdr_delivery_t *dlv = DEQ_HEAD(link->undelivered);
+    qd_iterator_t *key = qd_message_field_iterator(msg, addr->shed.conflate_key);
+    if (!key)
+        return 0;
+
+    uint32_t hash = 5381;
+    const unsigned char *addr_key = addr->hash_handle ? qd_hash_key_by_handle(addr->hash_handle) : 0;
+    while (addr_key && *addr_key)
+        hash = ((hash << 5) + hash) + *addr_key++;
+    hash = ((hash << 5) + hash) ^ qd_iterator_hash_view(key);
+    qd_iterator_free(key);
+    return hash ? hash : 1;
+}
+
+
+static bool qdr_forward_same_key(qd_message_t *msg, qd_message_t *other, qd_message_field_t field)
+{
+    qd_iterator_t *a = qd_message_field_iterator(msg, field);
+    qd_iterator_t *b = qd_message_field_iterator(other, field);
+    bool           same = a && b && qd_iterator_length(a) == qd_iterator_length(b);
+
+    while (same && !qd_iterator_end(a))
+        same = qd_iterator_octet(a) == qd_iterator_octet(b);
+
+    qd_iterator_free(a);
+    qd_iterator_free(b);
+    return same;
+}
+
+
+//
+// Make room on a backed-up link for a pre-settled delivery according to the
+// address's overflow policy.  Returns false if the delivery itself is to be
+// discarded.
+//
+static bool qdr_forward_shed_presettled_CT_LH(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv,
+                                              qdr_address_t *addr, const qdr_shed_policy_t *policy)
+{
+    qdr_shed_mode_t mode    = policy->mode;
+    uint64_t        dropped = 0;
+    qdr_delivery_t *queued;
     qdr_delivery_t *next;
 
-    while (dlv) {
-        next = DEQ_NEXT(dlv);
-        //
-        // Remove pre-settled deliveries unless they are in a link_work
-        // record that is being processed.  If it's being processed, it is
-        // too late to drop the delivery.
-        //
-        if (dlv->settled && dlv->link_work && !dlv->link_work->processing) {
-            DEQ_REMOVE(link->undelivered, dlv);
-            dlv->where = QDR_DELIVERY_NOWHERE;
+    if (mode == QDR_SHED_DROP_NEWEST) {
+        if (addr)
+            addr->dropped_presettled_deliveries++;
+        core->stats.dropped_presettled_deliveries++;
+        return false;
+    }
 
-            //
-            // The link-work item representing this pending delivery must be
-            // updated to reflect the removal of the delivery.  If the item
-            // has no other deliveries associated with it, it can be removed
-            // from the work list.
-            //
-            assert(dlv->link_work);
-            if (dlv->link_work && (--dlv->link_work->value == 0)) {
-                DEQ_REMOVE(link->work_list, dlv->link_work);
-                free_qdr_link_work_t(dlv->link_work);
-                dlv->link_work = 0;
-            }
-            qdr_delivery_decref_CT(core, dlv);
+    if (mode == QDR_SHED_CONFLATE && dlv->conflate_hash) {
+        queued = DEQ_HEAD(link->undelivered);
+        while (queued) {
+            next = DEQ_NEXT(queued);
+            if (queued->conflate_hash == dlv->conflate_hash
+                && qdr_forward_same_key(queued->msg, dlv->msg, policy->conflate_key)
+                && qdr_forward_drop_presettled_CT_LH(core, link, queued))
+                dropped++;
+            queued = next;
+        }
+    }
+
+    if (dropped == 0 || qdr_forward_backed_up_LH(link, policy, dlv->queued_octets)) {
+        queued = DEQ_HEAD(link->undelivered);
+        while (queued && (mode == QDR_SHED_DROP_ALL || qdr_forward_backed_up_LH(link, policy, dlv->queued_octets))) {
+            next = DEQ_NEXT(queued);
+            if (qdr_forward_drop_presettled_CT_LH(core, link, queued))
+                dropped++;
+            queued = next;
         }
-        dlv = next;
     }
+
+    if (addr)
+        addr->dropped_presettled_deliveries += dropped;
+    core->stats.dropped_presettled_deliveries += dropped;
+    return true;
 }
 
 
-void qdr_forward_deliver_CT(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv)
+//
+// Weighted delivery priority gives each priority a virtual finish time per delivery that
+// advances by a stride inversely proportional to its weight, p + 1.  Sending in order of
+// finish time shares the link among the waiting priorities in proportion to their weights.
+//
+#define QDR_PRIORITY_STRIDE_BASE 2520  // Divisible by every weight from 1 to 10
+
+
+static bool qdr_forward_sends_before(qd_delivery_priority_t mode, const qdr_delivery_t *dlv, const qdr_delivery_t *other)
 {
-    sys_mutex_lock(link->conn->work_lock);
+    if (mode == QD_DELIVERY_PRIORITY_STRICT)
+        return dlv->priority > other->priority;
+    return dlv->priority_key < other->priority_key;
+}
+
+
+//
+// Put a delivery on the link's undelivered list; work is the work item that counts it.
+//
+// Work items only count deliveries: each one sends as many from the head of the list as it
+// counts.  So the owner (link_work) of each queued delivery is positional, the item that
+// will send whichever delivery is in its slot.  When the delivery goes ahead of others,
+// each one it passes moves back a slot and takes that slot's owner.
+//
+static void qdr_forward_enqueue_LH(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv, qdr_link_work_t *work)
+{
+    qd_delivery_priority_t mode = core->qd->delivery_priority;
+    qdr_delivery_t        *pos  = DEQ_TAIL(link->undelivered);
 
     //
-    // If the delivery is pre-settled and the outbound link is at or above capacity,
-    // discard all pre-settled deliveries on the undelivered list prior to enqueuing
-    // the new delivery.
+    // A routed link carries one sender's deliveries end to end, keep them in order.
     //
-    if (dlv->settled && link->capacity > 0 && DEQ_SIZE(link->undelivered) >= link->capacity)
-        qdr_forward_drop_presettled_CT_LH(core, link);
+    if (link->connected_link)
+        mode = QD_DELIVERY_PRIORITY_FIFO;
+
+    if (mode == QD_DELIVERY_PRIORITY_WEIGHTED) {
+        uint64_t start = link->priority_finish[dlv->priority] > link->priority_vtime ?
+            link->priority_finish[dlv->priority] : link->priority_vtime;
+        dlv->priority_key = start + QDR_PRIORITY_STRIDE_BASE / (dlv->priority + 1);
+        link->priority_finish[dlv->priority] = dlv->priority_key;
+    }
 
-    DEQ_INSERT_TAIL(link->undelivered, dlv);
-    dlv->where = QDR_DELIVERY_IN_UNDELIVERED;
+    if (mode != QD_DELIVERY_PRIORITY_FIFO) {
+        while (pos && qdr_forward_sends_before(mode, dlv, pos)) {
+            qdr_link_work_t *owner = pos->link_work;
+            pos->link_work = work;
+            work = owner;
+            pos = DEQ_PREV(pos);
+        }
+    }
+
+    if (pos)
+        DEQ_INSERT_AFTER(link->undelivered, dlv, pos);
+    else
+        DEQ_INSERT_HEAD(link->undelivered, dlv);
+    dlv->link_work = work;
+    dlv->where     = QDR_DELIVERY_IN_UNDELIVERED;
+    link->undelivered_octets += dlv->queued_octets;
+    link->priority_depth[dlv->priority]++;
+}
+
+
+void qdr_forward_push_LH(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv)
+{
     qdr_delivery_incref(dlv);
 
     //
@@ -202,9 +385,47 @@ void qdr_forward_deliver_CT(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *
         DEQ_INSERT_TAIL(link->work_list, work);
         qdr_add_link_ref(&link->conn->links_with_work, link, QDR_LINK_LIST_CLASS_WORK);
     }
-    dlv->link_work = work;
+    qdr_forward_enqueue_LH(core, link, dlv, work);
+}
+
+
+void qdr_forward_deliver_CT(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv, qdr_address_t *addr)
+{
+    const qdr_shed_policy_t *policy = addr ? &addr->shed : &qdr_shed_policy_default;
+
+    dlv->queued_octets = qd_message_size(dlv->msg);
+    dlv->priority      = qd_message_priority(dlv->msg);
+    if (dlv->settled && policy->mode == QDR_SHED_CONFLATE)
+        dlv->conflate_hash = qdr_forward_conflate_hash(addr, dlv->msg);
+
+    sys_mutex_lock(link->conn->work_lock);
+
+    //
+    // If the delivery is pre-settled and the outbound link is backed up, shed
+    // pre-settled deliveries as the address's policy directs before enqueuing
+    // the new delivery.
+    //
+    if (dlv->settled && qdr_forward_backed_up_LH(link, policy, dlv->queued_octets)
+        && !qdr_forward_shed_presettled_CT_LH(core, link, dlv, addr, policy)) {
+        sys_mutex_unlock(link->conn->work_lock);
+        qdr_delivery_incref(dlv);
+        qdr_delivery_decref_CT(core, dlv);
+        return;
+    }
+
+    qdr_forward_push_LH(core, link, dlv);
+    bool spill = link->undelivered_octets > core->spill_threshold;
     sys_mutex_unlock(link->conn->work_lock);
 
+    //
+    // A consumer this far behind will not want the message soon; let the spill file hold
+    // the bulk of it in the meantime.
+    //
+    if (spill && qd_spill_enabled())
+        qd_message_spill(dlv->msg);
+
+    qdr_forward_balance_update_CT(link);
+
     //
     // Activate the outgoing connection for later processing.
     //
@@ -214,23 +435,126 @@ void qdr_forward_deliver_CT(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *
 
 void qdr_forward_on_message(qdr_core_t *core, qdr_general_work_t *work)
 {
-    work->on_message(work->on_message_context, work->msg, work->maskbit, work->inter_router_cost);
+    qdr_subscription_t *sub = work->subscription;
+    if (sub->on_message_batch)
+        sub->on_message_batch(sub->on_message_context, &work->msg, &work->maskbit, &work->inter_router_cost, 1);
+    else
+        sub->on_message(sub->on_message_context, work->msg, work->maskbit, work->inter_router_cost);
     qd_message_free(work->msg);
+    sys_atomic_sub(&sub->inbox_overflow, 1);
+}
+
+
+/**
+ * Deliver the messages in a subscription's inbox.
+ */
+static void qdr_forward_drain_inbox(qdr_core_t *core, qdr_general_work_t *work)
+{
+    qdr_subscription_t *sub = work->subscription;
+
+    //
+    // Clear the flag first: a message added from here on posts another drain.
+    //
+    sys_atomic_swap(&sub->inbox_scheduled, 0);
+    uint32_t head  = sys_atomic_get(&sub->inbox_head);
+    uint32_t count = sys_atomic_get(&sub->inbox_tail) - head;
+    if (count == 0)
+        return;
+
+    qd_message_t *msgs[QDR_SUBSCRIPTION_INBOX];
+    int           maskbits[QDR_SUBSCRIPTION_INBOX];
+    int           costs[QDR_SUBSCRIPTION_INBOX];
+    for (uint32_t i = 0; i < count; i++) {
+        qdr_inbox_entry_t *entry = &sub->inbox[(head + i) % QDR_SUBSCRIPTION_INBOX];
+        msgs[i]     = entry->msg;
+        maskbits[i] = entry->maskbit;
+        costs[i]    = entry->inter_router_cost;
+    }
+
+    if (sub->on_message_batch)
+        sub->on_message_batch(sub->on_message_context, msgs, maskbits, costs, (int) count);
+    else
+        for (uint32_t i = 0; i < count; i++)
+            sub->on_message(sub->on_message_context, msgs[i], maskbits[i], costs[i]);
+
+    for (uint32_t i = 0; i < count; i++)
+        qd_message_free(msgs[i]);
+    sys_atomic_add(&sub->inbox_head, count);
 }
 
 
 void qdr_forward_on_message_CT(qdr_core_t *core, qdr_subscription_t *sub, qdr_link_t *link, qd_message_t *msg)
 {
+    int      maskbit = link ? link->conn->mask_bit : 0;
+    int      cost    = link ? link->conn->inter_router_cost : 1;
+    uint32_t tail    = sys_atomic_get(&sub->inbox_tail);
+
+    if (sys_atomic_get(&sub->inbox_overflow) == 0 &&
+        tail - sys_atomic_get(&sub->inbox_head) < QDR_SUBSCRIPTION_INBOX) {
+        qdr_inbox_entry_t *entry = &sub->inbox[tail % QDR_SUBSCRIPTION_INBOX];
+        entry->msg               = qd_message_copy(msg);
+        entry->maskbit           = maskbit;
+        entry->inter_router_cost = cost;
+        sys_atomic_add(&sub->inbox_tail, 1);
+
+        if (sys_atomic_swap(&sub->inbox_scheduled, 1) == 0) {
+            qdr_general_work_t *work = qdr_general_work(qdr_forward_drain_inbox);
+            work->subscription = sub;
+            qdr_post_general_work_CT(core, work);
+        }
+        return;
+    }
+
+    sys_atomic_add(&sub->inbox_overflow, 1);
     qdr_general_work_t *work = qdr_general_work(qdr_forward_on_message);
-    work->on_message         = sub->on_message;
-    work->on_message_context = sub->on_message_context;
+    work->subscription       = sub;
     work->msg                = qd_message_copy(msg);
-    work->maskbit            = link ? link->conn->mask_bit : 0;
-    work->inter_router_cost  = link ? link->conn->inter_router_cost : 1;
+    work->maskbit            = maskbit;
+    work->inter_router_cost  = cost;
     qdr_post_general_work_CT(core, work);
 }
 
 
+/**
+ * Choose the outgoing data link to the neighbor behind link_bit for a delivery to addr.
+ * The primary data link is used unless inter-router-data connections have added links
+ * to the neighbor's pool; then each address hashes onto one link of the pool, so the
+ * order of deliveries to any one address is kept.
+ */
+static qdr_link_t *qdr_forward_data_link_CT(qdr_core_t *core, int link_bit, qdr_address_t *addr)
+{
+    qdr_link_t          *link = core->data_links_by_mask_bit[link_bit];
+    qdr_link_ref_list_t *pool = &core->data_link_pools_by_mask_bit[link_bit];
+
+    if (!link || DEQ_SIZE(*pool) == 0)
+        return link;
+
+    uint32_t hash = (uint32_t) ((uintptr_t) addr >> 4) * 2654435761u;
+    uint32_t pick = (hash >> 16) % (DEQ_SIZE(*pool) + 1);
+    if (pick == 0)
+        return link;
+
+    qdr_link_ref_t *ref = DEQ_HEAD(*pool);
+    while (--pick > 0)
+        ref = DEQ_NEXT(ref);
+    return ref->link;
+}
+
+
+#define PEER_DATA_LINK_FOR(c,n,a) ((n->link_mask_bit >= 0) ? qdr_forward_data_link_CT(c, n->link_mask_bit, a) : 0)
+
+
+/**
+ * The edge connection a delivery arrived on, if any.  The edge router has already given
+ * the message to its own consumers, so it must not come back down that connection.
+ */
+static inline qdr_connection_t *qdr_forward_edge_origin(const qdr_delivery_t *in_delivery)
+{
+    qdr_connection_t *conn = in_delivery && in_delivery->link ? in_delivery->link->conn : 0;
+    return conn && conn->role == QDR_ROLE_EDGE_CONNECTION ? conn : 0;
+}
+
+
 int qdr_forward_multicast_CT(qdr_core_t      *core,
                              qdr_address_t   *addr,
                              qd_message_t    *msg,
@@ -242,15 +566,19 @@ int qdr_forward_multicast_CT(qdr_core_t      *core,
     int           fanout               = 0;
     qd_bitmask_t *link_exclusion       = !!in_delivery ? in_delivery->link_exclusion : 0;
     bool          presettled           = !!in_delivery ? in_delivery->settled : true;
+    bool          reliable             = !presettled && !control && addr->multicast_rule != QDR_MULTICAST_PRESETTLE;
 
     //
-    // If the delivery is not presettled, set the settled flag for forwarding so all
-    // outgoing deliveries will be presettled.
+    // If the delivery is not presettled and the address aggregates the settlement of
+    // multicast copies, forward unsettled copies and track their outcomes.
     //
-    // NOTE:  This is the only multicast mode currently supported.  Others will likely be
-    //        implemented in the future.
+    // Otherwise, set the settled flag for forwarding so all outgoing deliveries will
+    // be presettled.
     //
-    if (!presettled) {
+    if (reliable) {
+        in_delivery->multicast = new_qdr_multicast_t();
+        ZERO(in_delivery->multicast);
+    } else if (!presettled) {
         in_delivery->settled = true;
 
         //
@@ -268,18 +596,36 @@ int qdr_forward_multicast_CT(qdr_core_t      *core,
     // Forward to local subscribers
     //
     if (!addr->local || exclude_inprocess) {
-        qdr_link_ref_t *link_ref = DEQ_HEAD(addr->rlinks);
+        qdr_connection_t *edge_origin = qdr_forward_edge_origin(in_delivery);
+        qdr_link_ref_t   *link_ref    = DEQ_HEAD(addr->rlinks);
         while (link_ref) {
-            qdr_link_t     *out_link     = link_ref->link;
+            qdr_link_t *out_link = link_ref->link;
+            link_ref = DEQ_NEXT(link_ref);
+            if (out_link->conn == edge_origin)
+                continue;
+
             qdr_delivery_t *out_delivery = qdr_forward_new_delivery_CT(core, in_delivery, out_link, msg);
-            qdr_forward_deliver_CT(core, out_link, out_delivery);
+            qdr_forward_deliver_CT(core, out_link, out_delivery, addr);
             fanout++;
-            if (out_link->link_type != QD_LINK_CONTROL && out_link->link_type != QD_LINK_ROUTER)
+            if (out_link->link_type != QD_LINK_CONTROL && out_link->link_type != QD_LINK_ROUTER) {
                 addr->deliveries_egress++;
-            link_ref = DEQ_NEXT(link_ref);
+                core->stats.deliveries_egress++;
+            }
         }
     }
 
+    //
+    // On an edge router, the interior forwards to the subscribers elsewhere
+    //
+    qdr_link_t *uplink = qdr_edge_uplink_CT(core, in_delivery, control);
+    if (uplink) {
+        qdr_delivery_t *out_delivery = qdr_forward_new_delivery_CT(core, in_delivery, uplink, msg);
+        qdr_forward_deliver_CT(core, uplink, out_delivery, addr);
+        fanout++;
+        addr->deliveries_transit++;
+        core->stats.deliveries_transit++;
+    }
+
     //
     // Forward to remote routers with subscribers using the appropriate
     // link for the traffic class: control or data
@@ -311,15 +657,23 @@ int qdr_forward_multicast_CT(qdr_core_t      *core,
         qd_bitmask_t *link_set = qd_bitmask(0);
 
         //
-        // Loop over the target nodes for this address.  Build a set of outgoing links
-        // for which there are valid targets.  We do this to avoid sending more than one
+        // The target nodes for this address for which the origin is valid, found
+        // word-wise from the per-origin index of valid origins.
+        //
+        qd_bitmask_t *targets = qd_bitmask(0);
+        qd_bitmask_or(targets, addr->rnodes);
+        qd_bitmask_and(targets, core->routers_by_origin[origin]);
+
+        //
+        // Loop over the target nodes.  Build a set of outgoing links for which there
+        // are valid targets.  We do this to avoid sending more than one
         // message down a given link.  It's possible that there are multiple destinations
         // for this address that are all reachable over the same link.  In this case, we
         // will send only one copy of the message over the link and allow a downstream
         // router to fan the message out.
         //
         int c;
-        for (QD_BITMASK_EACH(addr->rnodes, dest_bit, c)) {
+        for (QD_BITMASK_EACH(targets, dest_bit, c)) {
             qdr_node_t *rnode = core->routers_by_mask_bit[dest_bit];
             if (!rnode)
                 continue;
@@ -330,24 +684,25 @@ int qdr_forward_multicast_CT(qdr_core_t      *core,
                 next_node = rnode;
 
             dest_link = control ? PEER_CONTROL_LINK(core, next_node) : PEER_DATA_LINK(core, next_node);
-            if (dest_link && qd_bitmask_value(rnode->valid_origins, origin))
+            if (dest_link)
                 qd_bitmask_set_bit(link_set, dest_link->conn->mask_bit);
         }
+        qd_bitmask_free(targets);
 
         //
         // Send a copy of the message outbound on each identified link.
         //
         int link_bit;
-        while (qd_bitmask_first_set(link_set, &link_bit)) {
-            qd_bitmask_clear_bit(link_set, link_bit);
+        for (QD_BITMASK_EACH(link_set, link_bit, c)) {
             dest_link = control ?
                 core->control_links_by_mask_bit[link_bit] :
-                core->data_links_by_mask_bit[link_bit];
+                qdr_forward_data_link_CT(core, link_bit, addr);
             if (dest_link && (!link_exclusion || qd_bitmask_value(link_exclusion, link_bit) == 0)) {
                 qdr_delivery_t *out_delivery = qdr_forward_new_delivery_CT(core, in_delivery, dest_link, msg);
-                qdr_forward_deliver_CT(core, dest_link, out_delivery);
+                qdr_forward_deliver_CT(core, dest_link, out_delivery, addr);
                 fanout++;
                 addr->deliveries_transit++;
+                core->stats.deliveries_transit++;
             }
         }
 
@@ -363,10 +718,40 @@ int qdr_forward_multicast_CT(qdr_core_t      *core,
             qdr_forward_on_message_CT(core, sub, in_delivery ? in_delivery->link : 0, msg);
             fanout++;
             addr->deliveries_to_container++;
+            core->stats.deliveries_to_container++;
             sub = DEQ_NEXT(sub);
         }
     }
 
+    if (reliable) {
+        qdr_multicast_t *mcast = in_delivery->multicast;
+
+        if (mcast->outstanding > 0) {
+            //
+            // The ingress delivery stays unsettled until its copies decide its outcome.
+            //
+            switch (addr->multicast_rule) {
+            case QDR_MULTICAST_ANY:    mcast->needed = 1;                       break;
+            case QDR_MULTICAST_QUORUM: mcast->needed = addr->multicast_quorum;  break;
+            default:                   mcast->needed = mcast->outstanding;      break;
+            }
+            if (mcast->needed < 1)
+                mcast->needed = 1;
+            if (mcast->needed > mcast->outstanding)
+                mcast->needed = mcast->outstanding;
+            return fanout;
+        }
+
+        //
+        // No unsettled copies were made, at most the in-process subscribers got the
+        // message.  Fall back to settling the delivery here.
+        //
+        free_qdr_multicast_t(mcast);
+        in_delivery->multicast = 0;
+        if (fanout > 0)
+            in_delivery->settled = true;
+    }
+
     if (in_delivery && !presettled) {
         if (fanout == 0)
             //
@@ -388,6 +773,18 @@ int qdr_forward_multicast_CT(qdr_core_t      *core,
 }
 
 
+/**
+ * Deliveries arriving on the same link hash to the same equal-cost next hop, so a
+ * sender's messages to a remote router stay in order.
+ */
+static uint32_t qdr_forward_flow_hash(qdr_delivery_t *in_delivery)
+{
+    uint64_t key = in_delivery && in_delivery->link ? in_delivery->link->identity : 0;
+    uint32_t hash = (uint32_t) (key ^ (key >> 32)) * 2654435761u;
+    return hash >> 16;
+}
+
+
 int qdr_forward_closest_CT(qdr_core_t      *core,
                            qdr_address_t   *addr,
                            qd_message_t    *msg,
@@ -424,6 +821,7 @@ int qdr_forward_closest_CT(qdr_core_t      *core,
             }
 
             addr->deliveries_to_container++;
+            core->stats.deliveries_to_container++;
             return 1;
         }
     }
@@ -434,8 +832,8 @@ int qdr_forward_closest_CT(qdr_core_t      *core,
     qdr_link_ref_t *link_ref = DEQ_HEAD(addr->rlinks);
     if (link_ref) {
         out_link     = link_ref->link;
-        out_delivery = qdr_forward_new_delivery_CT(core, in_delivery, out_link, msg);
-        qdr_forward_deliver_CT(core, out_link, out_delivery);
+        out_delivery = qdr_forward_anycast_delivery_CT(core, in_delivery, out_link, msg);
+        qdr_forward_deliver_CT(core, out_link, out_delivery, addr);
 
         //
         // If there are multiple local subscribers, rotate the list of link references
@@ -447,6 +845,7 @@ int qdr_forward_closest_CT(qdr_core_t      *core,
         }
 
         addr->deliveries_egress++;
+        core->stats.deliveries_egress++;
         return 1;
     }
 
@@ -470,52 +869,341 @@ int qdr_forward_closest_CT(qdr_core_t      *core,
             if (addr->next_remote == -1)
                 qd_bitmask_first_set(addr->closest_remotes, &addr->next_remote);
 
-            if (rnode->next_hop)
-                next_node = rnode->next_hop;
+            if (control)
+                next_node = rnode->next_hop ? rnode->next_hop : rnode;
             else
-                next_node = rnode;
+                next_node = qdr_node_next_hop_CT(core, rnode, qdr_forward_flow_hash(in_delivery));
 
-            out_link = control ? PEER_CONTROL_LINK(core, next_node) : PEER_DATA_LINK(core, next_node);
+            out_link = control ? PEER_CONTROL_LINK(core, next_node) : PEER_DATA_LINK_FOR(core, next_node, addr);
             if (out_link) {
-                out_delivery = qdr_forward_new_delivery_CT(core, in_delivery, out_link, msg);
-                qdr_forward_deliver_CT(core, out_link, out_delivery);
+                out_delivery = qdr_forward_anycast_delivery_CT(core, in_delivery, out_link, msg);
+                qdr_forward_deliver_CT(core, out_link, out_delivery, addr);
                 addr->deliveries_transit++;
+                core->stats.deliveries_transit++;
                 return 1;
             }
         }
     }
 
+    //
+    // On an edge router, the interior finds a consumer elsewhere
+    //
+    out_link = qdr_edge_uplink_CT(core, in_delivery, control);
+    if (out_link) {
+        out_delivery = qdr_forward_anycast_delivery_CT(core, in_delivery, out_link, msg);
+        qdr_forward_deliver_CT(core, out_link, out_delivery, addr);
+        addr->deliveries_transit++;
+        core->stats.deliveries_transit++;
+        return 1;
+    }
+
     return 0;
 }
 
 
-int qdr_forward_balanced_CT(qdr_core_t      *core,
-                            qdr_address_t   *addr,
-                            qd_message_t    *msg,
-                            qdr_delivery_t  *in_delivery,
-                            bool             exclude_inprocess,
-                            bool             control)
+//
+// The local consumers of a balanced address are kept in a binary min-heap ordered by
+// balance_key, so that the least-loaded link is found without visiting them all.
+// Eligible links (fewer outstanding deliveries than capacity) sort before ineligible
+// ones.  Among equal keys, the link chosen longest ago comes first, which spreads
+// deliveries round-robin over idle consumers (see DISPATCH-367).
+//
+// Deliveries leave a link's lists on I/O threads without telling the core, so a key can
+// be stale until the next update from a flow or settlement.  The top of the heap is
+// re-checked before it is used.
+//
+
+static uint64_t balance_key(qdr_link_t *link)
 {
-    //
-    // Control messages should never use balanced treatment.
-    //
-    assert(!control);
+    uint64_t value = DEQ_SIZE(link->undelivered) + DEQ_SIZE(link->unsettled);
+    return link->capacity > value ? value : value | ((uint64_t) 1 << 32);
+}
 
-    //
-    // If this is the first time through here, allocate the array for outstanding delivery counts.
-    //
-    if (addr->outstanding_deliveries == 0) {
-        addr->outstanding_deliveries = NEW_ARRAY(int, qd_bitmask_width());
-        for (int i = 0; i < qd_bitmask_width(); i++)
-            addr->outstanding_deliveries[i] = 0;
+
+static inline bool balance_before(qdr_link_t *a, qdr_link_t *b)
+{
+    if (a->balance_key != b->balance_key)
+        return a->balance_key < b->balance_key;
+    return a->balance_stamp < b->balance_stamp;
+}
+
+
+static inline void balance_place(qdr_address_t *addr, qdr_link_t *link, int pos)
+{
+    addr->balance_heap[pos] = link;
+    link->balance_slot      = pos + 1;
+}
+
+
+static void balance_sift(qdr_address_t *addr, int pos)
+{
+    qdr_link_t *link = addr->balance_heap[pos];
+
+    while (pos > 0 && balance_before(link, addr->balance_heap[(pos - 1) / 2])) {
+        balance_place(addr, addr->balance_heap[(pos - 1) / 2], pos);
+        pos = (pos - 1) / 2;
+    }
+
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (child >= addr->balance_count)
+            break;
+        if (child + 1 < addr->balance_count && balance_before(addr->balance_heap[child + 1], addr->balance_heap[child]))
+            child++;
+        if (!balance_before(addr->balance_heap[child], link))
+            break;
+        balance_place(addr, addr->balance_heap[child], pos);
+        pos = child;
+    }
+    balance_place(addr, link, pos);
+}
+
+
+/* Recompute the link's key, return true if it changed. */
+static bool balance_refresh(qdr_address_t *addr, qdr_link_t *link)
+{
+    uint64_t key = balance_key(link);
+    if (key == link->balance_key)
+        return false;
+    link->balance_key = key;
+    balance_sift(addr, link->balance_slot - 1);
+    return true;
+}
+
+
+void qdr_forward_balance_add_CT(qdr_address_t *addr, qdr_link_t *link)
+{
+    if (addr->treatment != QD_TREATMENT_ANYCAST_BALANCED || link->balance_slot)
+        return;
+    if (addr->balance_count == addr->balance_alloc) {
+        addr->balance_alloc = addr->balance_alloc ? addr->balance_alloc * 2 : 8;
+        addr->balance_heap  = (qdr_link_t**) realloc(addr->balance_heap, addr->balance_alloc * sizeof(qdr_link_t*));
+    }
+    link->balance_key   = balance_key(link);
+    link->balance_stamp = 0;
+    balance_place(addr, link, addr->balance_count++);
+    balance_sift(addr, addr->balance_count - 1);
+}
+
+
+static void qdr_forward_group_forget_link_CT(qdr_address_t *addr, qdr_link_t *link);
+
+void qdr_forward_balance_remove_CT(qdr_address_t *addr, qdr_link_t *link)
+{
+    if (!link->balance_slot)
+        return;
+    int pos = link->balance_slot - 1;
+    link->balance_slot = 0;
+    if (--addr->balance_count > pos) {
+        balance_place(addr, addr->balance_heap[addr->balance_count], pos);
+        balance_sift(addr, pos);
+    }
+    qdr_forward_group_forget_link_CT(addr, link);
+}
+
+
+void qdr_forward_balance_update_CT(qdr_link_t *link)
+{
+    if (link->balance_slot && link->owning_addr)
+        balance_refresh(link->owning_addr, link);
+}
+
+
+bool qdr_forward_backlogged_CT(qdr_address_t *addr)
+{
+    qdr_link_t *link = 0;
+
+    if (addr->balance_count > 0)
+        link = addr->balance_heap[0];
+    else if (DEQ_HEAD(addr->rlinks))
+        link = DEQ_HEAD(addr->rlinks)->link;
+
+    return link && (balance_key(link) >> 32) != 0;
+}
+
+
+//
+// Group affinity.  A balanced address with group_affinity set keeps the messages of a
+// group on the path the group was first sent on: a local consumer, or the next hop toward
+// a remote router.  It remembers up to group_affinity groups, forgetting the least
+// recently used one to make room.  Groups are known by the hash of their group-id that
+// the message content keeps, so groups whose hashes collide share a path.
+//
+// When a local consumer detaches, its groups are forgotten and balanced afresh with their
+// next message.  A group on a remote router moves when the router no longer has consumers
+// for the address.
+//
+
+typedef struct qdr_group_t qdr_group_t;
+
+struct qdr_group_t {
+    DEQ_LINKS(qdr_group_t);         ///< In order of use, most recent first
+    qdr_group_t *bucket_next;
+    uint32_t     hash;
+    qdr_link_t  *link;              ///< The local consumer, or
+    int          router_bit;        ///< the remote router if there is no link
+};
+
+ALLOC_DECLARE(qdr_group_t);
+ALLOC_DEFINE(qdr_group_t);
+DEQ_DECLARE(qdr_group_t, qdr_group_list_t);
+
+struct qdr_group_table_t {
+    qdr_group_list_t   groups;
+    qdr_group_t      **buckets;
+    uint32_t           bucket_mask;
+};
+
+
+static qdr_group_t **qdr_forward_group_slot(struct qdr_group_table_t *table, uint32_t hash)
+{
+    qdr_group_t **slot = &table->buckets[hash & table->bucket_mask];
+    while (*slot && (*slot)->hash != hash)
+        slot = &(*slot)->bucket_next;
+    return slot;
+}
+
+
+static void qdr_forward_group_remove_CT(struct qdr_group_table_t *table, qdr_group_t *group)
+{
+    qdr_group_t **slot = qdr_forward_group_slot(table, group->hash);
+    *slot = group->bucket_next;
+    DEQ_REMOVE(table->groups, group);
+    free_qdr_group_t(group);
+}
+
+
+/**
+ * Find the address's entry for a group, making it the most recently used, or add an
+ * entry without a path.
+ */
+static qdr_group_t *qdr_forward_group_CT(qdr_address_t *addr, uint32_t hash)
+{
+    struct qdr_group_table_t *table = addr->groups;
+    if (!table) {
+        uint32_t buckets = 1;
+        while (buckets < (uint32_t) addr->group_affinity)
+            buckets <<= 1;
+        table = NEW(struct qdr_group_table_t);
+        DEQ_INIT(table->groups);
+        table->buckets     = NEW_PTR_ARRAY(qdr_group_t, buckets);
+        table->bucket_mask = buckets - 1;
+        memset(table->buckets, 0, buckets * sizeof(qdr_group_t*));
+        addr->groups = table;
+    }
+
+    qdr_group_t *group = *qdr_forward_group_slot(table, hash);
+    if (group) {
+        DEQ_REMOVE(table->groups, group);
+        DEQ_INSERT_HEAD(table->groups, group);
+        return group;
+    }
+
+    if (DEQ_SIZE(table->groups) >= (size_t) addr->group_affinity)
+        qdr_forward_group_remove_CT(table, DEQ_TAIL(table->groups));
+
+    group = new_qdr_group_t();
+    ZERO(group);
+    group->hash        = hash;
+    group->router_bit  = -1;
+    group->bucket_next = table->buckets[hash & table->bucket_mask];
+    table->buckets[hash & table->bucket_mask] = group;
+    DEQ_INSERT_HEAD(table->groups, group);
+    return group;
+}
+
+
+static void qdr_forward_group_forget_link_CT(qdr_address_t *addr, qdr_link_t *link)
+{
+    if (!addr->groups)
+        return;
+    qdr_group_t *group = DEQ_HEAD(addr->groups->groups);
+    while (group) {
+        qdr_group_t *next = DEQ_NEXT(group);
+        if (group->link == link)
+            qdr_forward_group_remove_CT(addr->groups, group);
+        group = next;
+    }
+}
+
+
+void qdr_forward_group_free_CT(qdr_address_t *addr)
+{
+    struct qdr_group_table_t *table = addr->groups;
+    if (!table)
+        return;
+    qdr_group_t *group = DEQ_HEAD(table->groups);
+    while (group) {
+        DEQ_REMOVE_HEAD(table->groups);
+        free_qdr_group_t(group);
+        group = DEQ_HEAD(table->groups);
+    }
+    free(table->buckets);
+    free(table);
+    addr->groups = 0;
+}
+
+
+/**
+ * Of the equal-cost next hops toward a remote router, pick the link with the fewest
+ * outstanding deliveries for this address.  Without multiple paths this is simply the
+ * link to the primary next hop.
+ */
+static qdr_link_t *qdr_forward_balanced_next_link_CT(qdr_core_t *core, qdr_address_t *addr, qdr_node_t *rnode)
+{
+    qdr_node_t *next_node = rnode->next_hop ? rnode->next_hop : rnode;
+    qdr_link_t *best      = PEER_DATA_LINK_FOR(core, next_node, addr);
+
+    for (int i = 0; i < rnode->ecmp_count; i++) {
+        qdr_node_t *hop  = core->routers_by_mask_bit[rnode->ecmp_hops[i]];
+        qdr_link_t *link = hop ? PEER_DATA_LINK_FOR(core, hop, addr) : 0;
+        if (link && (!best || addr->outstanding_deliveries[link->conn->mask_bit] <
+                              addr->outstanding_deliveries[best->conn->mask_bit]))
+            best = link;
+    }
+    return best;
+}
+
+
+/**
+ * The mask bit of the router where a delivery entered the network, which the "valid
+ * origins" of the routers toward its destinations are checked against.
+ */
+static int qdr_forward_origin_CT(qdr_core_t *core, qdr_delivery_t *in_delivery)
+{
+    int            origin       = 0;
+    qd_iterator_t *ingress_iter = in_delivery ? in_delivery->origin : 0;
+
+    if (ingress_iter) {
+        qd_iterator_reset_view(ingress_iter, ITER_VIEW_NODE_HASH);
+        qdr_address_t *origin_addr;
+        qd_hash_retrieve(core->addr_hash, ingress_iter, (void*) &origin_addr);
+        if (origin_addr && qd_bitmask_cardinality(origin_addr->rnodes) == 1)
+            qd_bitmask_first_set(origin_addr->rnodes, &origin);
     }
+    return origin;
+}
+
 
-    qdr_link_t *best_eligible_link       = 0;
-    int         best_eligible_link_bit   = -1;
-    uint32_t    eligible_link_value      = UINT32_MAX;
-    qdr_link_t *best_ineligible_link     = 0;
-    int         best_ineligible_link_bit = -1;
-    uint32_t    ineligible_link_value    = UINT32_MAX;
+/**
+ * Choose the least-loaded path of a balanced address.  For a path through another router,
+ * link_bit is the mask bit of the link's connection and router_bit that of the router with
+ * the consumers; both are -1 for a local consumer.
+ */
+static qdr_link_t *qdr_forward_balanced_choose_CT(qdr_core_t     *core,
+                                                  qdr_address_t  *addr,
+                                                  qdr_delivery_t *in_delivery,
+                                                  int            *link_bit,
+                                                  int            *router_bit)
+{
+    qdr_link_t *best_eligible_link          = 0;
+    int         best_eligible_link_bit      = -1;
+    int         best_eligible_router_bit    = -1;
+    uint32_t    eligible_link_value         = UINT32_MAX;
+    qdr_link_t *best_ineligible_link        = 0;
+    int         best_ineligible_link_bit    = -1;
+    int         best_ineligible_router_bit  = -1;
+    uint32_t    ineligible_link_value       = UINT32_MAX;
 
     //
     // Find all the possible outbound links for this delivery, searching for the one with the
@@ -528,27 +1216,21 @@ int qdr_forward_balanced_CT(qdr_core_t      *core,
     //
 
     //
-    // Start with the local links
+    // Start with the local links, the best of which is at the top of the heap.  Bring
+    // its key up to date first, which may let another link take its place.
     //
-    qdr_link_ref_t *link_ref = DEQ_HEAD(addr->rlinks);
-    while (link_ref) {
-        qdr_link_t *link     = link_ref->link;
-        uint32_t    value    = DEQ_SIZE(link->undelivered) + DEQ_SIZE(link->unsettled);
-        bool        eligible = link->capacity > value;
-
-        //
-        // If this is the best eligible link so far, record the fact.
-        // Otherwise, if this is the best ineligible link, make note of that.
-        //
-        if (eligible && eligible_link_value > value) {
-            best_eligible_link  = link;
-            eligible_link_value = value;
-        } else if (!eligible && ineligible_link_value > value) {
-            best_ineligible_link  = link;
+    qdr_link_t *top = addr->balance_count ? addr->balance_heap[0] : 0;
+    for (int checks = addr->balance_count; top && checks > 0 && balance_refresh(addr, top); checks--)
+        top = addr->balance_heap[0];
+    if (top) {
+        uint32_t value = (uint32_t) top->balance_key;
+        if (top->balance_key >> 32) {
+            best_ineligible_link  = top;
             ineligible_link_value = value;
+        } else {
+            best_eligible_link    = top;
+            eligible_link_value   = value;
         }
-
-        link_ref = DEQ_NEXT(link_ref);
     }
 
     //
@@ -556,75 +1238,133 @@ int qdr_forward_balanced_CT(qdr_core_t      *core,
     // inter-router links as well.
     //
     if (!best_eligible_link || eligible_link_value > 0) {
-        //
-        // Get the mask bit associated with the ingress router for the message.
-        // This will be compared against the "valid_origin" masks for each
-        // candidate destination router.
-        //
-        int origin = 0;
-        qd_iterator_t *ingress_iter = in_delivery ? in_delivery->origin : 0;
-
-        if (ingress_iter) {
-            qd_iterator_reset_view(ingress_iter, ITER_VIEW_NODE_HASH);
-            qdr_address_t *origin_addr;
-            qd_hash_retrieve(core->addr_hash, ingress_iter, (void*) &origin_addr);
-            if (origin_addr && qd_bitmask_cardinality(origin_addr->rnodes) == 1)
-                qd_bitmask_first_set(origin_addr->rnodes, &origin);
-        }
+        int origin = qdr_forward_origin_CT(core, in_delivery);
 
         int c;
         int node_bit;
         for (QD_BITMASK_EACH(addr->rnodes, node_bit, c)) {
-            qdr_node_t *rnode     = core->routers_by_mask_bit[node_bit];
-            qdr_node_t *next_node = rnode->next_hop ? rnode->next_hop : rnode;
-            qdr_link_t *link      = PEER_DATA_LINK(core, next_node);
+            qdr_node_t   *rnode   = core->routers_by_mask_bit[node_bit];
+            qdr_link_t   *link    = qdr_forward_balanced_next_link_CT(core, addr, rnode);
+            qd_bitmask_t *origins = rnode->ecmp_valid_origins ? rnode->ecmp_valid_origins : rnode->valid_origins;
             if (!link) continue;
             int         link_bit  = link->conn->mask_bit;
             int         value     = addr->outstanding_deliveries[link_bit];
             bool        eligible  = link->capacity > value;
 
-            if (qd_bitmask_value(rnode->valid_origins, origin)) {
+            if (qd_bitmask_value(origins, origin)) {
                 //
                 // Link is a candidate, adjust the value by the bias (node cost).
                 //
                 value += rnode->cost;
                 if (eligible && eligible_link_value > value) {
-                    best_eligible_link     = link;
-                    best_eligible_link_bit = link_bit;
-                    eligible_link_value    = value;
+                    best_eligible_link       = link;
+                    best_eligible_link_bit   = link_bit;
+                    best_eligible_router_bit = node_bit;
+                    eligible_link_value      = value;
                 } else if (!eligible && ineligible_link_value > value) {
-                    best_ineligible_link     = link;
-                    best_ineligible_link_bit = link_bit;
-                    ineligible_link_value    = value;
+                    best_ineligible_link       = link;
+                    best_ineligible_link_bit   = link_bit;
+                    best_ineligible_router_bit = node_bit;
+                    ineligible_link_value      = value;
                 }
             }
         }
-    } else if (best_eligible_link) {
-        //
-        // Rotate the rlinks list to enhance the appearance of balance when there is
-        // little load (see DISPATCH-367)
-        //
-        if (DEQ_SIZE(addr->rlinks) > 1) {
-            link_ref = DEQ_HEAD(addr->rlinks);
-            DEQ_REMOVE_HEAD(addr->rlinks);
-            DEQ_INSERT_TAIL(addr->rlinks, link_ref);
-        }
     }
 
-    qdr_link_t *chosen_link     = 0;
-    int         chosen_link_bit = -1;
-
     if (best_eligible_link) {
-        chosen_link     = best_eligible_link;
-        chosen_link_bit = best_eligible_link_bit;
-    } else if (best_ineligible_link) {
-        chosen_link     = best_ineligible_link;
-        chosen_link_bit = best_ineligible_link_bit;
+        *link_bit   = best_eligible_link_bit;
+        *router_bit = best_eligible_router_bit;
+        return best_eligible_link;
+    }
+    *link_bit   = best_ineligible_link_bit;
+    *router_bit = best_ineligible_router_bit;
+    return best_ineligible_link;
+}
+
+
+/**
+ * The link on a group's path, if the path is still there.
+ */
+static qdr_link_t *qdr_forward_group_path_CT(qdr_core_t     *core,
+                                             qdr_address_t  *addr,
+                                             qdr_group_t    *group,
+                                             qdr_delivery_t *in_delivery,
+                                             int            *link_bit)
+{
+    if (group->link) {
+        *link_bit = -1;
+        return group->link;
+    }
+
+    if (group->router_bit < 0 || !qd_bitmask_value(addr->rnodes, group->router_bit))
+        return 0;
+
+    qdr_node_t *rnode = core->routers_by_mask_bit[group->router_bit];
+    if (!rnode)
+        return 0;
+
+    qd_bitmask_t *origins = rnode->ecmp_valid_origins ? rnode->ecmp_valid_origins : rnode->valid_origins;
+    qdr_link_t   *link    = qdr_forward_balanced_next_link_CT(core, addr, rnode);
+    if (!link || !qd_bitmask_value(origins, qdr_forward_origin_CT(core, in_delivery)))
+        return 0;
+
+    *link_bit = link->conn->mask_bit;
+    return link;
+}
+
+
+int qdr_forward_balanced_CT(qdr_core_t      *core,
+                            qdr_address_t   *addr,
+                            qd_message_t    *msg,
+                            qdr_delivery_t  *in_delivery,
+                            bool             exclude_inprocess,
+                            bool             control)
+{
+    //
+    // Control messages should never use balanced treatment.
+    //
+    assert(!control);
+
+    //
+    // If this is the first time through here, allocate the array for outstanding delivery counts.
+    //
+    if (addr->outstanding_deliveries == 0) {
+        addr->outstanding_deliveries = NEW_ARRAY(int, qd_bitmask_width());
+        for (int i = 0; i < qd_bitmask_width(); i++)
+            addr->outstanding_deliveries[i] = 0;
+    }
+
+    qdr_link_t  *chosen_link     = 0;
+    int          chosen_link_bit = -1;
+    qdr_group_t *group           = 0;
+
+    //
+    // A message of a group goes the way the group's messages went before, while that
+    // path lasts.  Otherwise, and for messages without a group, take the least-loaded
+    // path, and make it the group's.
+    //
+    uint32_t group_hash = addr->group_affinity > 0 ? qd_message_group_hash(msg) : 0;
+    if (group_hash) {
+        group       = qdr_forward_group_CT(addr, group_hash);
+        chosen_link = qdr_forward_group_path_CT(core, addr, group, in_delivery, &chosen_link_bit);
+    }
+
+    if (!chosen_link) {
+        int router_bit;
+        chosen_link = qdr_forward_balanced_choose_CT(core, addr, in_delivery, &chosen_link_bit, &router_bit);
+        if (group && chosen_link) {
+            group->link       = router_bit < 0 ? chosen_link : 0;
+            group->router_bit = router_bit;
+        }
     }
 
     if (chosen_link) {
-        qdr_delivery_t *out_delivery = qdr_forward_new_delivery_CT(core, in_delivery, chosen_link, msg);
-        qdr_forward_deliver_CT(core, chosen_link, out_delivery);
+        if (chosen_link->balance_slot) {
+            chosen_link->balance_stamp = ++addr->balance_stamp;
+            balance_sift(addr, chosen_link->balance_slot - 1);
+        }
+        qdr_delivery_t *out_delivery = qdr_forward_anycast_delivery_CT(core, in_delivery, chosen_link, msg);
+        qdr_forward_deliver_CT(core, chosen_link, out_delivery, addr);
 
         //
         // If the delivery is unsettled and the link is inter-router, account for the outstanding delivery.
@@ -639,10 +1379,25 @@ int qdr_forward_balanced_CT(qdr_core_t      *core,
         //
         // Bump the appropriate counter based on where we sent the delivery.
         //
-        if (chosen_link_bit >= 0)
+        if (chosen_link_bit >= 0) {
             addr->deliveries_transit++;
-        else
+            core->stats.deliveries_transit++;
+        } else {
             addr->deliveries_egress++;
+            core->stats.deliveries_egress++;
+        }
+        return 1;
+    }
+
+    //
+    // On an edge router, the interior finds a consumer elsewhere
+    //
+    qdr_link_t *uplink = qdr_edge_uplink_CT(core, in_delivery, false);
+    if (uplink) {
+        qdr_delivery_t *out_delivery = qdr_forward_anycast_delivery_CT(core, in_delivery, uplink, msg);
+        qdr_forward_deliver_CT(core, uplink, out_delivery, addr);
+        addr->deliveries_transit++;
+        core->stats.deliveries_transit++;
         return 1;
     }
 
@@ -729,6 +1484,7 @@ bool qdr_forward_link_balanced_CT(qdr_core_t     *core,
 
         out_link->connected_link = in_link;
         in_link->connected_link  = out_link;
+        qdr_link_bridge_CT(in_link, out_link);
 
         DEQ_INSERT_TAIL(core->open_links, out_link);
         qdr_add_link_ref(&conn->links, out_link, QDR_LINK_LIST_CLASS_CONNECTION);
@@ -793,8 +1549,11 @@ qdr_forwarder_t *qdr_forwarder_CT(qdr_core_t *core, qd_address_treatment_t treat
 int qdr_forward_message_CT(qdr_core_t *core, qdr_address_t *addr, qd_message_t *msg, qdr_delivery_t *in_delivery,
                            bool exclude_inprocess, bool control)
 {
-    if (addr->forwarder)
-        return addr->forwarder->forward_message(core, addr, msg, in_delivery, exclude_inprocess, control);
+    if (addr->forwarder) {
+        int fanout = addr->forwarder->forward_message(core, addr, msg, in_delivery, exclude_inprocess, control);
+        QD_PROBE4(forward_message, addr, in_delivery, (int) addr->treatment, fanout);
+        return fanout;
+    }
 
     // TODO - Deal with this delivery's disposition
     return 0;
@@ -804,8 +1563,11 @@ int qdr_forward_message_CT(qdr_core_t *core, qdr_address_t *addr, qd_message_t *
 bool qdr_forward_attach_CT(qdr_core_t *core, qdr_address_t *addr, qdr_link_t *in_link,
                            qdr_terminus_t *source, qdr_terminus_t *target)
 {
-    if (addr->forwarder)
-        return addr->forwarder->forward_attach(core, addr, in_link, source, target);
+    if (addr->forwarder) {
+        bool routed = addr->forwarder->forward_attach(core, addr, in_link, source, target);
+        QD_PROBE4(forward_attach, addr, in_link, (int) addr->treatment, routed);
+        return routed;
+    }
     return false;
 }
 
@@ -39,6 +39,7 @@ const char *IDENTITY = "identity";
 
 const char *OPERATION = "operation";
 const char *ATTRIBUTE_NAMES = "attributeNames";
+const char *WHERE = "where";
 
 const unsigned char *config_address_entity_type = (unsigned char*) "org.apache.qpid.dispatch.router.config.address";
 const unsigned char *link_route_entity_type     = (unsigned char*) "org.apache.qpid.dispatch.router.config.linkRoute";
@@ -48,6 +49,7 @@ const unsigned char *link_entity_type           = (unsigned char*) "org.apache.q
 const unsigned char *console_entity_type        = (unsigned char*) "org.apache.qpid.dispatch.console";
 const unsigned char *router_entity_type         = (unsigned char*) "org.apache.qpid.dispatch.router";
 const unsigned char *connection_entity_type     = (unsigned char*) "org.apache.qpid.dispatch.connection";
+const unsigned char *core_action_entity_type    = (unsigned char*) "org.apache.qpid.dispatch.router.coreAction";
 
 const char * const status_description = "statusDescription";
 const char * const correlation_id = "correlation-id";
@@ -244,17 +246,20 @@ static void qd_core_agent_query_handler(qdr_core_t                 *core,
 
     // Grab the attribute names from the incoming message body. The attribute names will be used later on in the response.
     qd_parsed_field_t *attribute_names_parsed_field = 0;
+    qd_parsed_field_t *where_parsed_field = 0;
 
     qd_iterator_t *body_iter = qd_message_field_iterator(msg, QD_FIELD_BODY);
 
     qd_parsed_field_t *body = qd_parse(body_iter);
     if (body != 0 && qd_parse_is_map(body)) {
         attribute_names_parsed_field = qd_parse_value_by_key(body, ATTRIBUTE_NAMES);
+        where_parsed_field = qd_parse_value_by_key(body, WHERE);
     }
 
     // Set the callback function.
     qdr_manage_handler(core, qd_manage_response_handler);
     ctx->query = qdr_manage_query(core, ctx, entity_type, attribute_names_parsed_field, field);
+    qdr_query_set_filter(ctx->query, where_parsed_field);
 
     //Add the attribute names
     qdr_query_add_attribute_names(ctx->query); //this adds a list of attribute names like ["attribute1", "attribute2", "attribute3", "attribute4",]
@@ -420,6 +425,8 @@ static bool qd_can_handle_request(qd_parsed_field_t           *properties_fld,
         *entity_type = QD_ROUTER_FORBIDDEN;
     else if (qd_iterator_equal(qd_parse_raw(parsed_field), connection_entity_type))
         *entity_type = QD_ROUTER_CONNECTION;
+    else if (qd_iterator_equal(qd_parse_raw(parsed_field), core_action_entity_type))
+        *entity_type = QD_ROUTER_CORE_ACTION;
     else
         return false;
 
@@ -479,7 +486,7 @@ void qdr_management_agent_on_message(void *context, qd_message_t *msg, int unuse
     int32_t count = 0;
     int32_t offset = 0;
 
-    qd_parsed_field_t *properties_fld = qd_parse(app_properties_iter);
+    qd_parsed_field_t *properties_fld = qd_parse_arena(app_properties_iter);
 
     if (qd_can_handle_request(properties_fld, &entity_type, &operation_type, &identity_iter, &name_iter, &count, &offset)) {
         switch (operation_type) {
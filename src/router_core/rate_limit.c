@@ -0,0 +1,202 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "router_core_private.h"
+#include <stdio.h>
+
+#define QDR_RATE_KEY_MAX 300
+
+static void qdr_rate_refill(qdr_rate_bucket_t *bucket, uint64_t now)
+{
+    if (now <= bucket->refill_ns)
+        return;
+    double secs = (double) (now - bucket->refill_ns) / 1000000000.0;
+    bucket->refill_ns = now;
+
+    bucket->msg_tokens += secs * (double) bucket->msg_rate;
+    if (bucket->msg_tokens > (double) bucket->msg_rate)
+        bucket->msg_tokens = (double) bucket->msg_rate;
+    bucket->byte_tokens += secs * (double) bucket->byte_rate;
+    if (bucket->byte_tokens > (double) bucket->byte_rate)
+        bucket->byte_tokens = (double) bucket->byte_rate;
+}
+
+
+/**
+ * Find the shared bucket with the key, or make a new one.  A null key makes a bucket of
+ * the connection's own.  A shared bucket takes the rates of the newest connection to use it.
+ */
+static qdr_rate_bucket_t *qdr_rate_bucket_CT(qdr_core_t *core, const char *key, uint64_t msg_rate, uint64_t byte_rate)
+{
+    qdr_rate_bucket_t *bucket = 0;
+    if (key) {
+        bucket = DEQ_HEAD(core->rate_buckets);
+        while (bucket && strcmp(bucket->key, key) != 0)
+            bucket = DEQ_NEXT(bucket);
+    }
+
+    if (!bucket) {
+        bucket = NEW(qdr_rate_bucket_t);
+        ZERO(bucket);
+        DEQ_ITEM_INIT(bucket);
+        bucket->refill_ns   = qdr_monotonic_ns();
+        bucket->msg_tokens  = (double) msg_rate;
+        bucket->byte_tokens = (double) byte_rate;
+        if (key) {
+            bucket->key = strdup(key);
+            DEQ_INSERT_TAIL(core->rate_buckets, bucket);
+        }
+    }
+
+    bucket->msg_rate  = msg_rate;
+    bucket->byte_rate = byte_rate;
+    bucket->ref_count++;
+    return bucket;
+}
+
+
+static void qdr_rate_bucket_free(qdr_core_t *core, qdr_rate_bucket_t *bucket)
+{
+    if (bucket->key)
+        DEQ_REMOVE(core->rate_buckets, bucket);
+    free(bucket->key);
+    free(bucket);
+}
+
+
+void qdr_connection_rate_bind_CT(qdr_core_t *core, qdr_connection_t *conn)
+{
+    qdr_rate_limits_t *limits = &conn->rate_limits;
+    const char        *user   = conn->connection_info ? conn->connection_info->user : 0;
+    char               key[QDR_RATE_KEY_MAX];
+
+    if (limits->msg_rate || limits->byte_rate)
+        conn->rate_buckets[QDR_RATE_CONNECTION] = qdr_rate_bucket_CT(core, 0, limits->msg_rate, limits->byte_rate);
+
+    if ((limits->user_msg_rate || limits->user_byte_rate) && user) {
+        snprintf(key, sizeof(key), "%p/u/%s", limits->scope, user);
+        conn->rate_buckets[QDR_RATE_USER] = qdr_rate_bucket_CT(core, key, limits->user_msg_rate, limits->user_byte_rate);
+    }
+
+    if (limits->vhost_msg_rate || limits->vhost_byte_rate) {
+        snprintf(key, sizeof(key), "%p/v", limits->scope);
+        conn->rate_buckets[QDR_RATE_VHOST] = qdr_rate_bucket_CT(core, key, limits->vhost_msg_rate, limits->vhost_byte_rate);
+    }
+
+    for (int i = 0; i < QDR_RATE_SCOPES; i++) {
+        qdr_rate_bucket_t *bucket = conn->rate_buckets[i];
+        if (bucket) {
+            conn->rate_limited = true;
+            if (bucket->byte_rate)
+                conn->rate_bytes = true;
+        }
+    }
+}
+
+
+void qdr_connection_rate_unbind_CT(qdr_core_t *core, qdr_connection_t *conn)
+{
+    for (int i = 0; i < QDR_RATE_SCOPES; i++) {
+        qdr_rate_bucket_t *bucket = conn->rate_buckets[i];
+        if (bucket && --bucket->ref_count == 0)
+            qdr_rate_bucket_free(core, bucket);
+        conn->rate_buckets[i] = 0;
+    }
+    conn->rate_limited = false;
+    conn->rate_bytes   = false;
+}
+
+
+/**
+ * Take message tokens for as much of the credit as the connection's buckets allow now.
+ * @return The credit that may be issued.
+ */
+int qdr_connection_rate_allow_CT(qdr_connection_t *conn, int credit)
+{
+    uint64_t now     = qdr_monotonic_ns();
+    int      allowed = credit;
+
+    for (int i = 0; i < QDR_RATE_SCOPES && allowed > 0; i++) {
+        qdr_rate_bucket_t *bucket = conn->rate_buckets[i];
+        if (!bucket)
+            continue;
+        qdr_rate_refill(bucket, now);
+        if (bucket->byte_rate && bucket->byte_tokens < 1.0)
+            allowed = 0;
+        if (bucket->msg_rate && bucket->msg_tokens < (double) allowed)
+            allowed = (int) bucket->msg_tokens;
+    }
+
+    if (allowed > 0) {
+        for (int i = 0; i < QDR_RATE_SCOPES; i++) {
+            qdr_rate_bucket_t *bucket = conn->rate_buckets[i];
+            if (bucket && bucket->msg_rate)
+                bucket->msg_tokens -= (double) allowed;
+        }
+    }
+    return allowed;
+}
+
+
+int qdr_link_rate_limit_CT(qdr_core_t *core, qdr_link_t *link, int credit)
+{
+    qdr_connection_t *conn = link->conn;
+
+    //
+    // Credit already held back is issued first, so new credit waits behind it.
+    //
+    int allowed = link->credit_throttled ? 0 : qdr_connection_rate_allow_CT(conn, credit);
+    int held    = credit - allowed;
+
+    if (held > 0) {
+        if (link->credit_throttled == 0) {
+            qdr_add_link_ref(&core->links_throttled, link, QDR_LINK_LIST_CLASS_THROTTLED);
+            sys_atomic_swap(&core->rate_throttling, 1);
+        }
+        link->credit_throttled += held;
+        if (conn->rate_limits.throttled)
+            *conn->rate_limits.throttled += held;
+    }
+    return allowed;
+}
+
+
+void qdr_link_rate_charge_CT(qdr_link_t *link, qdr_delivery_t *dlv)
+{
+    qdr_connection_t *conn = link->conn;
+    if (!dlv->msg)
+        return;
+
+    double octets = (double) qd_message_size(dlv->msg);
+    for (int i = 0; i < QDR_RATE_SCOPES; i++) {
+        qdr_rate_bucket_t *bucket = conn->rate_buckets[i];
+        if (bucket && bucket->byte_rate)
+            bucket->byte_tokens -= octets;
+    }
+}
+
+
+void qdr_rate_buckets_free(qdr_core_t *core)
+{
+    qdr_rate_bucket_t *bucket = DEQ_HEAD(core->rate_buckets);
+    while (bucket) {
+        qdr_rate_bucket_free(core, bucket);
+        bucket = DEQ_HEAD(core->rate_buckets);
+    }
+}
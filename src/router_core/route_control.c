@@ -26,6 +26,12 @@ ALLOC_DEFINE(qdr_link_route_t);
 ALLOC_DEFINE(qdr_auto_link_t);
 ALLOC_DEFINE(qdr_conn_identifier_t);
 
+//
+// Attaches allowed per rate tick, at least one
+//
+#define QDR_AUTO_LINK_TICK_TOKENS(core) \
+    ((core)->auto_link_attach_rate * QDR_RATE_TICK_MSEC / 1000 > 0 ? (core)->auto_link_attach_rate * QDR_RATE_TICK_MSEC / 1000 : 1)
+
 const char CONTAINER_PREFIX = 'C';
 const char CONNECTION_PREFIX = 'L';
 
@@ -188,10 +194,117 @@ static void qdr_auto_link_activate_CT(qdr_core_t *core, qdr_auto_link_t *al, qdr
 }
 
 
+//
+// Auto-links attached per core pass, between other work
+//
+#define QDR_AUTO_LINK_BATCH 64
+
+static void qdr_auto_link_attach_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
+
+
+static void qdr_auto_link_schedule_CT(qdr_core_t *core)
+{
+    if (!core->auto_link_scheduled) {
+        core->auto_link_scheduled = true;
+        qdr_action_enqueue(core, qdr_action(qdr_auto_link_attach_CT, "auto_link_attach"));
+    }
+}
+
+
+//
+// Queue an auto-link to be attached on the connection.  Those whose address has local
+// senders (for outgoing auto-links) or receivers (incoming) waiting go ahead of the rest.
+//
+static void qdr_auto_link_queue_CT(qdr_core_t *core, qdr_auto_link_t *al, qdr_connection_t *conn)
+{
+    if (al->pending_conn || al->link)
+        return;
+
+    al->pending_conn = conn;
+    al->state        = QDR_AUTO_LINK_STATE_QUEUED;
+    al->waiting      = al->addr && (al->dir == QD_OUTGOING ? DEQ_SIZE(al->addr->inlinks) > 0
+                                                           : DEQ_SIZE(al->addr->rlinks) > 0);
+    if (al->waiting)
+        DEQ_INSERT_TAIL_N(PENDING, core->auto_links_waiting, al);
+    else
+        DEQ_INSERT_TAIL_N(PENDING, core->auto_links_pending, al);
+
+    //
+    // Start with a tick's allowance if the queue isn't already waiting for the tick
+    //
+    if (core->auto_link_attach_rate && !sys_atomic_get(&core->auto_link_paced) && !core->auto_link_scheduled)
+        core->auto_link_tokens = QDR_AUTO_LINK_TICK_TOKENS(core);
+    qdr_auto_link_schedule_CT(core);
+}
+
+
+static void qdr_auto_link_unqueue_CT(qdr_core_t *core, qdr_auto_link_t *al)
+{
+    if (!al->pending_conn)
+        return;
+
+    if (al->waiting)
+        DEQ_REMOVE_N(PENDING, core->auto_links_waiting, al);
+    else
+        DEQ_REMOVE_N(PENDING, core->auto_links_pending, al);
+    al->pending_conn = 0;
+    al->waiting      = false;
+    al->state        = QDR_AUTO_LINK_STATE_INACTIVE;
+}
+
+
+static void qdr_auto_link_attach_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    if (discard)
+        return;
+
+    core->auto_link_scheduled = false;
+
+    int budget = QDR_AUTO_LINK_BATCH;
+    if (core->auto_link_attach_rate && core->auto_link_tokens < budget)
+        budget = core->auto_link_tokens;
+
+    while (budget-- > 0) {
+        qdr_auto_link_t *al = DEQ_HEAD(core->auto_links_waiting);
+        if (!al)
+            al = DEQ_HEAD(core->auto_links_pending);
+        if (!al)
+            break;
+
+        qdr_connection_t *conn = al->pending_conn;
+        qdr_auto_link_unqueue_CT(core, al);
+        qdr_auto_link_activate_CT(core, al, conn);
+        if (core->auto_link_attach_rate)
+            core->auto_link_tokens--;
+    }
+
+    if (DEQ_IS_EMPTY(core->auto_links_waiting) && DEQ_IS_EMPTY(core->auto_links_pending))
+        sys_atomic_swap(&core->auto_link_paced, 0);
+    else if (core->auto_link_attach_rate && core->auto_link_tokens == 0)
+        sys_atomic_swap(&core->auto_link_paced, 1);
+    else
+        qdr_auto_link_schedule_CT(core);
+}
+
+
+void qdr_route_auto_link_tick_CT(qdr_core_t *core)
+{
+    if (!sys_atomic_get(&core->auto_link_paced))
+        return;
+
+    sys_atomic_swap(&core->auto_link_paced, 0);
+    core->auto_link_tokens = QDR_AUTO_LINK_TICK_TOKENS(core);
+    qdr_auto_link_schedule_CT(core);
+}
+
+
 static void qdr_auto_link_deactivate_CT(qdr_core_t *core, qdr_auto_link_t *al, qdr_connection_t *conn)
 {
     qdr_route_log_CT(core, "Auto Link Deactivated", al->name, al->identity, conn);
 
+    if (al->pending_conn == conn)
+        qdr_auto_link_unqueue_CT(core, al);
+
     if (al->link) {
         qdr_link_outbound_detach_CT(core, al->link, 0, QDR_CONDITION_ROUTED_LINK_LOST, true);
         al->link->auto_link = 0;
@@ -205,6 +318,7 @@ static void qdr_auto_link_deactivate_CT(qdr_core_t *core, qdr_auto_link_t *al, q
 qdr_link_route_t *qdr_route_add_link_route_CT(qdr_core_t             *core,
                                               qd_iterator_t          *name,
                                               qd_parsed_field_t      *prefix_field,
+                                              bool                    is_pattern,
                                               qd_parsed_field_t      *container_field,
                                               qd_parsed_field_t      *connection_field,
                                               qd_address_treatment_t  treatment,
@@ -222,17 +336,26 @@ qdr_link_route_t *qdr_route_add_link_route_CT(qdr_core_t             *core,
     lr->treatment = treatment;
 
     //
-    // Find or create an address for link-attach routing
+    // Find or create an address for link-attach routing.  Patterns use their own
+    // address classes so that remote routers can tell them from prefixes.
     //
+    char aclass;
+    if (is_pattern)
+        aclass = dir == QD_INCOMING ? QDR_LINK_ROUTE_PATTERN_IN : QDR_LINK_ROUTE_PATTERN_OUT;
+    else
+        aclass = dir == QD_INCOMING ? 'C' : 'D';
+
     qd_iterator_t *iter = qd_parse_raw(prefix_field);
     qd_iterator_reset_view(iter, ITER_VIEW_ADDRESS_HASH);
-    qd_iterator_annotate_prefix(iter, dir == QD_INCOMING ? 'C' : 'D');
+    qd_iterator_annotate_prefix(iter, aclass);
 
     qd_hash_retrieve(core->addr_hash, iter, (void*) &lr->addr);
     if (!lr->addr) {
         lr->addr = qdr_address_CT(core, treatment);
         DEQ_INSERT_TAIL(core->addrs, lr->addr);
         qd_hash_insert(core->addr_hash, iter, lr->addr, &lr->addr->hash_handle);
+        qdr_addr_view_add_CT(core, lr->addr);
+        qdr_core_index_link_route_pattern_CT(core, lr->addr);
     }
 
     lr->addr->ref_count++;
@@ -324,9 +447,12 @@ qdr_auto_link_t *qdr_route_add_auto_link_CT(qdr_core_t          *core,
 
     qd_hash_retrieve(core->addr_hash, iter, (void*) &al->addr);
     if (!al->addr) {
-        al->addr = qdr_address_CT(core, qdr_treatment_for_address_CT(core, 0, iter, 0, 0));
+        qdr_address_config_t *config;
+        al->addr = qdr_address_CT(core, qdr_treatment_for_address_CT(core, 0, iter, 0, 0, &config));
+        qdr_address_configure_CT(al->addr, config);
         DEQ_INSERT_TAIL(core->addrs, al->addr);
         qd_hash_insert(core->addr_hash, iter, al->addr, &al->addr->hash_handle);
+        qdr_addr_view_add_CT(core, al->addr);
     }
 
     al->addr->ref_count++;
@@ -339,7 +465,7 @@ qdr_auto_link_t *qdr_route_add_auto_link_CT(qdr_core_t          *core,
         DEQ_INSERT_TAIL_N(REF, al->conn_id->auto_link_refs, al);
         qdr_connection_ref_t * cref = DEQ_HEAD(al->conn_id->connection_refs);
         while (cref) {
-            qdr_auto_link_activate_CT(core, al, cref->conn);
+            qdr_auto_link_queue_CT(core, al, cref->conn);
             cref = DEQ_NEXT(cref);
         }
     }
@@ -413,11 +539,11 @@ void qdr_route_connection_opened_CT(qdr_core_t       *core,
     }
 
     //
-    // Activate all auto-links associated with this remote container.
+    // Queue all auto-links associated with this remote container for activation.
     //
     qdr_auto_link_t *al = DEQ_HEAD(cid->auto_link_refs);
     while (al) {
-        qdr_auto_link_activate_CT(core, al, conn);
+        qdr_auto_link_queue_CT(core, al, conn);
         al = DEQ_NEXT_N(REF, al);
     }
 }
@@ -28,10 +28,42 @@ static void qdr_set_next_hop_CT      (qdr_core_t *core, qdr_action_t *action, bo
 static void qdr_remove_next_hop_CT   (qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_set_cost_CT          (qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_set_valid_origins_CT (qdr_core_t *core, qdr_action_t *action, bool discard);
+static void qdr_set_equal_cost_hops_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_map_destination_CT   (qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_unmap_destination_CT (qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_subscribe_CT         (qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_unsubscribe_CT       (qdr_core_t *core, qdr_action_t *action, bool discard);
+static void qdr_route_table_commit_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
+
+
+//
+// Per-thread staging of route-table actions between qdr_core_route_table_begin
+// and qdr_core_route_table_commit.
+//
+typedef struct {
+    qdr_core_t   *core;
+    int           depth;
+    qdr_action_t *head;
+    qdr_action_t *tail;
+} qdr_route_table_delta_t;
+
+static __thread qdr_route_table_delta_t route_delta;
+
+
+static void qdr_route_table_enqueue(qdr_core_t *core, qdr_action_t *action)
+{
+    if (route_delta.depth == 0 || route_delta.core != core) {
+        qdr_action_enqueue(core, action);
+        return;
+    }
+
+    action->next = 0;
+    if (route_delta.tail)
+        route_delta.tail->next = action;
+    else
+        route_delta.head = action;
+    route_delta.tail = action;
+}
 
 
 //==================================================================================
@@ -41,115 +73,177 @@ static void qdr_unsubscribe_CT       (qdr_core_t *core, qdr_action_t *action, bo
 void qdr_core_add_router(qdr_core_t *core, const char *address, int router_maskbit)
 {
     qdr_action_t *action = qdr_action(qdr_add_router_CT, "add_router");
+    action->lane = QDR_ACTION_LANE_CONTROL;
     action->args.route_table.router_maskbit = router_maskbit;
     action->args.route_table.address        = qdr_field(address);
-    qdr_action_enqueue(core, action);
+    qdr_route_table_enqueue(core, action);
 }
 
 
 void qdr_core_del_router(qdr_core_t *core, int router_maskbit)
 {
     qdr_action_t *action = qdr_action(qdr_del_router_CT, "del_router");
+    action->lane = QDR_ACTION_LANE_CONTROL;
     action->args.route_table.router_maskbit = router_maskbit;
-    qdr_action_enqueue(core, action);
+    qdr_route_table_enqueue(core, action);
 }
 
 
 void qdr_core_set_link(qdr_core_t *core, int router_maskbit, int link_maskbit)
 {
     qdr_action_t *action = qdr_action(qdr_set_link_CT, "set_link");
+    action->lane = QDR_ACTION_LANE_CONTROL;
     action->args.route_table.router_maskbit = router_maskbit;
     action->args.route_table.link_maskbit   = link_maskbit;
-    qdr_action_enqueue(core, action);
+    qdr_route_table_enqueue(core, action);
 }
 
 
 void qdr_core_remove_link(qdr_core_t *core, int router_maskbit)
 {
     qdr_action_t *action = qdr_action(qdr_remove_link_CT, "remove_link");
+    action->lane = QDR_ACTION_LANE_CONTROL;
     action->args.route_table.router_maskbit = router_maskbit;
-    qdr_action_enqueue(core, action);
+    qdr_route_table_enqueue(core, action);
 }
 
 
 void qdr_core_set_next_hop(qdr_core_t *core, int router_maskbit, int nh_router_maskbit)
 {
     qdr_action_t *action = qdr_action(qdr_set_next_hop_CT, "set_next_hop");
+    action->lane = QDR_ACTION_LANE_CONTROL;
     action->args.route_table.router_maskbit    = router_maskbit;
     action->args.route_table.nh_router_maskbit = nh_router_maskbit;
-    qdr_action_enqueue(core, action);
+    qdr_route_table_enqueue(core, action);
 }
 
 
 void qdr_core_remove_next_hop(qdr_core_t *core, int router_maskbit)
 {
     qdr_action_t *action = qdr_action(qdr_remove_next_hop_CT, "remove_next_hop");
+    action->lane = QDR_ACTION_LANE_CONTROL;
     action->args.route_table.router_maskbit = router_maskbit;
-    qdr_action_enqueue(core, action);
+    qdr_route_table_enqueue(core, action);
 }
 
 
 void qdr_core_set_cost(qdr_core_t *core, int router_maskbit, int cost)
 {
     qdr_action_t *action = qdr_action(qdr_set_cost_CT, "set_cost");
+    action->lane = QDR_ACTION_LANE_CONTROL;
     action->args.route_table.router_maskbit = router_maskbit;
     action->args.route_table.cost           = cost;
-    qdr_action_enqueue(core, action);
+    qdr_route_table_enqueue(core, action);
 }
 
 
 void qdr_core_set_valid_origins(qdr_core_t *core, int router_maskbit, qd_bitmask_t *routers)
 {
     qdr_action_t *action = qdr_action(qdr_set_valid_origins_CT, "set_valid_origins");
+    action->lane = QDR_ACTION_LANE_CONTROL;
     action->args.route_table.router_maskbit = router_maskbit;
     action->args.route_table.router_set     = routers;
-    qdr_action_enqueue(core, action);
+    qdr_route_table_enqueue(core, action);
+}
+
+
+void qdr_core_set_equal_cost_hops(qdr_core_t *core, int router_maskbit, qd_bitmask_t *next_hops, qd_bitmask_t *valid_origins)
+{
+    qdr_action_t *action = qdr_action(qdr_set_equal_cost_hops_CT, "set_equal_cost_hops");
+    action->lane = QDR_ACTION_LANE_CONTROL;
+    action->args.route_table.router_maskbit = router_maskbit;
+    action->args.route_table.router_set     = next_hops;
+    action->args.route_table.origin_set     = valid_origins;
+    qdr_route_table_enqueue(core, action);
 }
 
 
 void qdr_core_map_destination(qdr_core_t *core, int router_maskbit, const char *address_hash)
 {
     qdr_action_t *action = qdr_action(qdr_map_destination_CT, "map_destination");
+    action->lane = QDR_ACTION_LANE_CONTROL;
     action->args.route_table.router_maskbit = router_maskbit;
     action->args.route_table.address        = qdr_field(address_hash);
-    qdr_action_enqueue(core, action);
+    qdr_route_table_enqueue(core, action);
 }
 
 
 void qdr_core_unmap_destination(qdr_core_t *core, int router_maskbit, const char *address_hash)
 {
     qdr_action_t *action = qdr_action(qdr_unmap_destination_CT, "unmap_destination");
+    action->lane = QDR_ACTION_LANE_CONTROL;
     action->args.route_table.router_maskbit = router_maskbit;
     action->args.route_table.address        = qdr_field(address_hash);
+    qdr_route_table_enqueue(core, action);
+}
+
+void qdr_core_route_table_begin(qdr_core_t *core)
+{
+    if (route_delta.depth > 0 && route_delta.core != core)
+        return;  // Changes for another core are not staged
+    route_delta.core = core;
+    route_delta.depth++;
+}
+
+
+void qdr_core_route_table_commit(qdr_core_t *core)
+{
+    if (route_delta.depth == 0 || route_delta.core != core || --route_delta.depth > 0)
+        return;
+
+    qdr_action_t *head = route_delta.head;
+    route_delta.core = 0;
+    route_delta.head = 0;
+    route_delta.tail = 0;
+
+    if (!head)
+        return;
+
+    if (!head->next) {
+        //
+        // A single change needs no wrapper.
+        //
+        qdr_action_enqueue(core, head);
+        return;
+    }
+
+    qdr_action_t *action = qdr_action(qdr_route_table_commit_CT, "route_table_commit");
+    action->lane = QDR_ACTION_LANE_CONTROL;
+    action->args.route_table.delta = head;
     qdr_action_enqueue(core, action);
 }
 
+
 void qdr_core_route_table_handlers(qdr_core_t           *core, 
                                    void                 *context,
-                                   qdr_mobile_added_t    mobile_added,
-                                   qdr_mobile_removed_t  mobile_removed,
+                                   qdr_mobile_changed_t  mobile_changed,
                                    qdr_link_lost_t       link_lost)
 {
     core->rt_context        = context;
-    core->rt_mobile_added   = mobile_added;
-    core->rt_mobile_removed = mobile_removed;
+    core->rt_mobile_changed = mobile_changed;
     core->rt_link_lost      = link_lost;
 }
 
 
-qdr_subscription_t *qdr_core_subscribe(qdr_core_t             *core,
-                                       const char             *address,
-                                       char                    aclass,
-                                       char                    phase,
-                                       qd_address_treatment_t  treatment,
-                                       qdr_receive_t           on_message,
-                                       void                   *context)
+static qdr_subscription_t *qdr_subscribe(qdr_core_t             *core,
+                                         const char             *address,
+                                         char                    aclass,
+                                         char                    phase,
+                                         qd_address_treatment_t  treatment,
+                                         qdr_receive_t           on_message,
+                                         qdr_receive_batch_t     on_message_batch,
+                                         void                   *context)
 {
     qdr_subscription_t *sub = NEW(qdr_subscription_t);
     sub->core               = core;
     sub->addr               = 0;
     sub->on_message         = on_message;
+    sub->on_message_batch   = on_message_batch;
     sub->on_message_context = context;
+    sys_atomic_init(&sub->inbox_head, 0);
+    sys_atomic_init(&sub->inbox_tail, 0);
+    sys_atomic_init(&sub->inbox_scheduled, 0);
+    sys_atomic_init(&sub->inbox_overflow, 0);
 
     qdr_action_t *action = qdr_action(qdr_subscribe_CT, "subscribe");
     action->args.io.address       = qdr_field(address);
@@ -163,6 +257,43 @@ qdr_subscription_t *qdr_core_subscribe(qdr_core_t             *core,
 }
 
 
+qdr_subscription_t *qdr_core_subscribe(qdr_core_t             *core,
+                                       const char             *address,
+                                       char                    aclass,
+                                       char                    phase,
+                                       qd_address_treatment_t  treatment,
+                                       qdr_receive_t           on_message,
+                                       void                   *context)
+{
+    return qdr_subscribe(core, address, aclass, phase, treatment, on_message, 0, context);
+}
+
+
+qdr_subscription_t *qdr_core_subscribe_batch(qdr_core_t             *core,
+                                             const char             *address,
+                                             char                    aclass,
+                                             char                    phase,
+                                             qd_address_treatment_t  treatment,
+                                             qdr_receive_batch_t     on_message_batch,
+                                             void                   *context)
+{
+    return qdr_subscribe(core, address, aclass, phase, treatment, 0, on_message_batch, context);
+}
+
+
+void qdr_subscription_free(qdr_subscription_t *sub)
+{
+    uint32_t tail = sys_atomic_get(&sub->inbox_tail);
+    for (uint32_t i = sys_atomic_get(&sub->inbox_head); i != tail; i++)
+        qd_message_free(sub->inbox[i % QDR_SUBSCRIPTION_INBOX].msg);
+    sys_atomic_destroy(&sub->inbox_head);
+    sys_atomic_destroy(&sub->inbox_tail);
+    sys_atomic_destroy(&sub->inbox_scheduled);
+    sys_atomic_destroy(&sub->inbox_overflow);
+    free(sub);
+}
+
+
 void qdr_core_unsubscribe(qdr_subscription_t *sub)
 {
     if (sub) {
@@ -195,6 +326,11 @@ void qdr_route_table_update_cost_CT(qdr_core_t *core, qdr_node_t *rnode)
             needs_reinsertion = true;
     }
 
+    if (needs_reinsertion && core->route_delta_active) {
+        core->route_delta_resort = true;  // Sorted once when the commit has been applied
+        return;
+    }
+
     if (needs_reinsertion) {
         core->cost_epoch++;
         DEQ_REMOVE(core->routers, rnode);
@@ -213,13 +349,91 @@ void qdr_route_table_update_cost_CT(qdr_core_t *core, qdr_node_t *rnode)
 }
 
 
+void qdr_route_table_index_origins_CT(qdr_core_t *core, qdr_node_t *rnode, bool add)
+{
+    int origin;
+    int c;
+
+    if (!core->routers_by_origin || !rnode->valid_origins)
+        return;
+
+    for (QD_BITMASK_EACH(rnode->valid_origins, origin, c)) {
+        if (add)
+            qd_bitmask_set_bit(core->routers_by_origin[origin], rnode->mask_bit);
+        else
+            qd_bitmask_clear_bit(core->routers_by_origin[origin], rnode->mask_bit);
+    }
+}
+
+
+//
+// Re-sort core->routers by cost after a route-table commit changed some of the costs.
+// The cost_epoch moves once, and only if the order actually changed.
+//
+static void qdr_route_table_sort_CT(qdr_core_t *core)
+{
+    qdr_node_list_t sorted;
+    bool            moved = false;
+
+    DEQ_INIT(sorted);
+    qdr_node_t *rnode = DEQ_HEAD(core->routers);
+    while (rnode) {
+        DEQ_REMOVE_HEAD(core->routers);
+        qdr_node_t *ptr = DEQ_TAIL(sorted);
+        while (ptr && ptr->cost > rnode->cost)
+            ptr = DEQ_PREV(ptr);
+        if (!ptr)
+            DEQ_INSERT_HEAD(sorted, rnode);
+        else
+            DEQ_INSERT_AFTER(sorted, rnode, ptr);
+        if (DEQ_TAIL(sorted) != rnode)
+            moved = true;
+        rnode = DEQ_HEAD(core->routers);
+    }
+    core->routers = sorted;
+
+    if (moved)
+        core->cost_epoch++;
+}
+
+
+static void qdr_route_table_commit_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    qdr_action_t *staged = action->args.route_table.delta;
+
+    core->route_delta_active = !discard;
+    core->route_delta_resort = false;
+
+    while (staged) {
+        qdr_action_t *next = staged->next;
+        staged->action_handler(core, staged, discard);
+        free_qdr_action_t(staged);
+        staged = next;
+    }
+
+    core->route_delta_active = false;
+    if (core->route_delta_resort)
+        qdr_route_table_sort_CT(core);
+    core->route_delta_resort = false;
+}
+
+
 void qdr_route_table_setup_CT(qdr_core_t *core)
 {
     DEQ_INIT(core->addrs);
     DEQ_INIT(core->routers);
     core->addr_hash    = qd_hash(12, 32, 0);
     core->conn_id_hash = qd_hash(6, 4, 0);
+    core->mobile_change_hash = qd_hash(10, 32, 0);
+    DEQ_INIT(core->mobile_changes);
     core->cost_epoch   = 1;
+    qd_hash_prefix_index(core->addr_hash, "CDZ");  // link-route and address-config prefixes
+
+    core->addr_parse_tree              = qd_parse_tree();
+    core->link_route_tree[QD_INCOMING] = qd_parse_tree();
+    core->link_route_tree[QD_OUTGOING] = qd_parse_tree();
+
+    core->console_addr = qdr_add_local_address_CT(core, 'L', "qdconsole", QD_TREATMENT_MULTICAST_ONCE);
 
     if (core->router_mode == QD_ROUTER_MODE_INTERIOR) {
         core->hello_addr      = qdr_add_local_address_CT(core, 'L', "qdhello",     QD_TREATMENT_MULTICAST_FLOOD);
@@ -233,10 +447,14 @@ void qdr_route_table_setup_CT(qdr_core_t *core)
         core->routers_by_mask_bit       = NEW_PTR_ARRAY(qdr_node_t, qd_bitmask_width());
         core->control_links_by_mask_bit = NEW_PTR_ARRAY(qdr_link_t, qd_bitmask_width());
         core->data_links_by_mask_bit    = NEW_PTR_ARRAY(qdr_link_t, qd_bitmask_width());
+        core->data_link_pools_by_mask_bit = NEW_ARRAY(qdr_link_ref_list_t, qd_bitmask_width());
+        core->routers_by_origin         = NEW_PTR_ARRAY(qd_bitmask_t, qd_bitmask_width());
         for (int idx = 0; idx < qd_bitmask_width(); idx++) {
+            core->routers_by_origin[idx]     = qd_bitmask(0);
             core->routers_by_mask_bit[idx]   = 0;
             core->control_links_by_mask_bit[idx] = 0;
             core->data_links_by_mask_bit[idx] = 0;
+            DEQ_INIT(core->data_link_pools_by_mask_bit[idx]);
         }
     }
 }
@@ -285,6 +503,7 @@ static void qdr_add_router_CT(qdr_core_t *core, qdr_action_t *action, bool disca
         //
         addr = qdr_address_CT(core, QD_TREATMENT_ANYCAST_CLOSEST);
         qd_hash_insert(core->addr_hash, iter, addr, &addr->hash_handle);
+        qdr_addr_view_add_CT(core, addr);
         DEQ_INSERT_TAIL(core->addrs, addr);
 
         //
@@ -299,6 +518,9 @@ static void qdr_add_router_CT(qdr_core_t *core, qdr_action_t *action, bool disca
         rnode->ref_count         = 0;
         rnode->valid_origins     = qd_bitmask(0);
         rnode->cost              = 0;
+        rnode->ecmp_hops          = 0;
+        rnode->ecmp_count         = 0;
+        rnode->ecmp_valid_origins = 0;
 
         //
         // Insert at the head of the list because we don't yet know the cost to this
@@ -311,14 +533,14 @@ static void qdr_add_router_CT(qdr_core_t *core, qdr_action_t *action, bool disca
         //
         // Link the router record to the address record.
         //
-        qd_bitmask_set_bit(addr->rnodes, router_maskbit);
+        qdr_address_rnode_set_CT(core, addr, router_maskbit);
 
         //
         // Link the router record to the router address records.
         // Use the T-class addresses only.
         //
-        qd_bitmask_set_bit(core->router_addr_T->rnodes, router_maskbit);
-        qd_bitmask_set_bit(core->routerma_addr_T->rnodes, router_maskbit);
+        qdr_address_rnode_set_CT(core, core->router_addr_T, router_maskbit);
+        qdr_address_rnode_set_CT(core, core->routerma_addr_T, router_maskbit);
 
         //
         // Bump the ref-count by three for each of the above links.
@@ -356,9 +578,9 @@ static void qdr_del_router_CT(qdr_core_t *core, qdr_action_t *action, bool disca
     //
     // Unlink the router node from the address record
     //
-    qd_bitmask_clear_bit(oaddr->rnodes, router_maskbit);
-    qd_bitmask_clear_bit(core->router_addr_T->rnodes, router_maskbit);
-    qd_bitmask_clear_bit(core->routerma_addr_T->rnodes, router_maskbit);
+    qdr_address_rnode_clear_CT(core, oaddr, router_maskbit);
+    qdr_address_rnode_clear_CT(core, core->router_addr_T, router_maskbit);
+    qdr_address_rnode_clear_CT(core, core->routerma_addr_T, router_maskbit);
     rnode->ref_count -= 3;
 
     //
@@ -367,7 +589,7 @@ static void qdr_del_router_CT(qdr_core_t *core, qdr_action_t *action, bool disca
     //
     qdr_address_t *addr = DEQ_HEAD(core->addrs);
     while (addr && rnode->ref_count > 0) {
-        if (qd_bitmask_clear_bit(addr->rnodes, router_maskbit))
+        if (qdr_address_rnode_clear_CT(core, addr, router_maskbit))
             //
             // If the cleared bit was originally set, decrement the ref count
             //
@@ -525,10 +747,12 @@ static void qdr_set_valid_origins_CT(qdr_core_t *core, qdr_action_t *action, boo
         }
 
         qdr_node_t *rnode = core->routers_by_mask_bit[router_maskbit];
+        qdr_route_table_index_origins_CT(core, rnode, false);
         if (rnode->valid_origins)
             qd_bitmask_free(rnode->valid_origins);
         rnode->valid_origins = valid_origins;
         valid_origins = 0;
+        qdr_route_table_index_origins_CT(core, rnode, true);
     } while (false);
 
     if (valid_origins)
@@ -536,6 +760,70 @@ static void qdr_set_valid_origins_CT(qdr_core_t *core, qdr_action_t *action, boo
 }
 
 
+static void qdr_set_equal_cost_hops_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    int           router_maskbit = action->args.route_table.router_maskbit;
+    qd_bitmask_t *next_hops      = action->args.route_table.router_set;
+    qd_bitmask_t *valid_origins  = action->args.route_table.origin_set;
+
+    do {
+        if (discard)
+            break;
+
+        if (router_maskbit >= qd_bitmask_width() || router_maskbit < 0) {
+            qd_log(core->log, QD_LOG_CRITICAL, "set_equal_cost_hops: Router maskbit out of range: %d", router_maskbit);
+            break;
+        }
+
+        if (core->routers_by_mask_bit[router_maskbit] == 0) {
+            qd_log(core->log, QD_LOG_CRITICAL, "set_equal_cost_hops: Router not found");
+            break;
+        }
+
+        qdr_node_t *rnode = core->routers_by_mask_bit[router_maskbit];
+        free(rnode->ecmp_hops);
+        rnode->ecmp_hops  = 0;
+        rnode->ecmp_count = 0;
+
+        //
+        // A single next hop is already covered by rnode->next_hop.
+        //
+        int count = qd_bitmask_cardinality(next_hops);
+        if (count > 1) {
+            int c;
+            int bit;
+            rnode->ecmp_hops = NEW_ARRAY(int, count);
+            for (QD_BITMASK_EACH(next_hops, bit, c))
+                rnode->ecmp_hops[rnode->ecmp_count++] = bit;
+        }
+
+        if (rnode->ecmp_valid_origins)
+            qd_bitmask_free(rnode->ecmp_valid_origins);
+        rnode->ecmp_valid_origins = valid_origins;
+        valid_origins = 0;
+    } while (false);
+
+    qd_bitmask_free(next_hops);
+    if (valid_origins)
+        qd_bitmask_free(valid_origins);
+}
+
+
+qdr_node_t *qdr_node_next_hop_CT(qdr_core_t *core, qdr_node_t *rnode, uint32_t flow)
+{
+    //
+    // Every equal-cost next hop is a neighbor.  Skip any whose link is not up yet and
+    // fall back to the primary next hop in that case.
+    //
+    if (rnode->ecmp_count > 1) {
+        qdr_node_t *hop = core->routers_by_mask_bit[rnode->ecmp_hops[flow % rnode->ecmp_count]];
+        if (hop && PEER_DATA_LINK(core, hop))
+            return hop;
+    }
+    return rnode->next_hop ? rnode->next_hop : rnode;
+}
+
+
 static void qdr_map_destination_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
 {
     int          router_maskbit = action->args.route_table.router_maskbit;
@@ -562,14 +850,18 @@ static void qdr_map_destination_CT(qdr_core_t *core, qdr_action_t *action, bool
 
         qd_hash_retrieve(core->addr_hash, iter, (void**) &addr);
         if (!addr) {
-            addr = qdr_address_CT(core, qdr_treatment_for_address_hash_CT(core, iter));
+            qdr_address_config_t *config;
+            addr = qdr_address_CT(core, qdr_treatment_for_address_hash_CT(core, iter, &config));
+            qdr_address_configure_CT(addr, config);
             qd_hash_insert(core->addr_hash, iter, addr, &addr->hash_handle);
+            qdr_addr_view_add_CT(core, addr);
+            qdr_core_index_link_route_pattern_CT(core, addr);
             DEQ_ITEM_INIT(addr);
             DEQ_INSERT_TAIL(core->addrs, addr);
         }
 
         qdr_node_t *rnode = core->routers_by_mask_bit[router_maskbit];
-        qd_bitmask_set_bit(addr->rnodes, router_maskbit);
+        qdr_address_rnode_set_CT(core, addr, router_maskbit);
         rnode->ref_count++;
         addr->cost_epoch--;
         qdr_addr_start_inlinks_CT(core, addr);
@@ -611,7 +903,7 @@ static void qdr_unmap_destination_CT(qdr_core_t *core, qdr_action_t *action, boo
             break;
         }
 
-        qd_bitmask_clear_bit(addr->rnodes, router_maskbit);
+        qdr_address_rnode_clear_CT(core, addr, router_maskbit);
         rnode->ref_count--;
         addr->cost_epoch--;
 
@@ -649,6 +941,7 @@ static void qdr_subscribe_CT(qdr_core_t *core, qdr_action_t *action, bool discar
         if (!addr) {
             addr = qdr_address_CT(core, action->args.io.treatment);
             qd_hash_insert(core->addr_hash, address->iterator, addr, &addr->hash_handle);
+            qdr_addr_view_add_CT(core, addr);
             DEQ_ITEM_INIT(addr);
             DEQ_INSERT_TAIL(core->addrs, addr);
         }
@@ -656,53 +949,73 @@ static void qdr_subscribe_CT(qdr_core_t *core, qdr_action_t *action, bool discar
         sub->addr = addr;
         DEQ_ITEM_INIT(sub);
         DEQ_INSERT_TAIL(addr->subscriptions, sub);
+        qdr_addr_view_paths_CT(addr);
         qdr_addr_start_inlinks_CT(core, addr);
 
     } else
-        free(sub);
+        qdr_subscription_free(sub);
 
     qdr_field_free(address);
 }
 
 
+static void qdr_do_free_subscription(qdr_core_t *core, qdr_general_work_t *work)
+{
+    qdr_subscription_free(work->subscription);
+}
+
+
 static void qdr_unsubscribe_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
 {
     qdr_subscription_t *sub = action->args.io.subscription;
 
     if (!discard) {
         DEQ_REMOVE(sub->addr->subscriptions, sub);
+        qdr_addr_view_paths_CT(sub->addr);
         sub->addr = 0;
         qdr_check_addr_CT(sub->core, sub->addr, false);
-    }
 
-    free(sub);
+        //
+        // Deliveries to the subscription may be posted as general work.  Free it
+        // after them.
+        //
+        qdr_general_work_t *work = qdr_general_work(qdr_do_free_subscription);
+        work->subscription = sub;
+        qdr_post_general_work_CT(core, work);
+    } else
+        qdr_subscription_free(sub);
 }
 
 //==================================================================================
 // Call-back Functions
 //==================================================================================
 
-static void qdr_do_mobile_added(qdr_core_t *core, qdr_general_work_t *work)
+static void qdr_do_mobile_changes(qdr_core_t *core, qdr_general_work_t *work)
 {
-    char *address_hash = qdr_field_copy(work->field);
-    if (address_hash) {
-        core->rt_mobile_added(core->rt_context, address_hash);
-        free(address_hash);
+    int          count   = (int) DEQ_SIZE(work->mobile_changes);
+    const char **added   = NEW_PTR_ARRAY(const char, count + 1);
+    const char **removed = NEW_PTR_ARRAY(const char, count + 1);
+    int          added_count   = 0;
+    int          removed_count = 0;
+
+    for (qdr_mobile_change_t *change = DEQ_HEAD(work->mobile_changes); change; change = DEQ_NEXT(change)) {
+        if (change->added)
+            added[added_count++] = change->address_hash;
+        else
+            removed[removed_count++] = change->address_hash;
     }
 
-    qdr_field_free(work->field);
-}
-
+    if (core->rt_mobile_changed)
+        core->rt_mobile_changed(core->rt_context, added, added_count, removed, removed_count);
 
-static void qdr_do_mobile_removed(qdr_core_t *core, qdr_general_work_t *work)
-{
-    char *address_hash = qdr_field_copy(work->field);
-    if (address_hash) {
-        core->rt_mobile_removed(core->rt_context, address_hash);
-        free(address_hash);
+    qdr_mobile_change_t *change = 0;
+    while ( (change = DEQ_HEAD(work->mobile_changes)) ) {
+        DEQ_REMOVE_HEAD(work->mobile_changes);
+        free(change->address_hash);
+        free_qdr_mobile_change_t(change);
     }
-
-    qdr_field_free(work->field);
+    free(added);
+    free(removed);
 }
 
 
@@ -712,18 +1025,83 @@ static void qdr_do_link_lost(qdr_core_t *core, qdr_general_work_t *work)
 }
 
 
+/**
+ * Record a change in the local mobile addresses.  A pending change in the other
+ * direction for the same address cancels out; one in the same direction is a duplicate.
+ */
+static void qdr_mobile_change_CT(qdr_core_t *core, const char *address_hash, bool added)
+{
+    qd_iterator_storage_t  storage;
+    qd_iterator_t         *iter   = qd_iterator_init_string(&storage, address_hash, ITER_VIEW_ALL);
+    qdr_mobile_change_t   *change = 0;
+
+    qd_hash_retrieve(core->mobile_change_hash, iter, (void**) &change);
+    if (change) {
+        if (change->added != added) {
+            DEQ_REMOVE(core->mobile_changes, change);
+            qd_hash_remove_by_handle(core->mobile_change_hash, change->hash_handle);
+            qd_hash_handle_free(change->hash_handle);
+            free(change->address_hash);
+            free_qdr_mobile_change_t(change);
+        }
+        qd_iterator_free(iter);
+        return;
+    }
+
+    change = new_qdr_mobile_change_t();
+    ZERO(change);
+    change->address_hash = strdup(address_hash);
+    change->added        = added;
+    qd_hash_insert(core->mobile_change_hash, iter, change, &change->hash_handle);
+    qd_iterator_free(iter);
+
+    if (DEQ_IS_EMPTY(core->mobile_changes))
+        core->mobile_changes_since = qdr_monotonic_ns();
+    DEQ_INSERT_TAIL(core->mobile_changes, change);
+
+    if (DEQ_SIZE(core->mobile_changes) >= QDR_MOBILE_BATCH_MAX)
+        qdr_flush_mobile_changes_CT(core, true);
+}
+
+
 void qdr_post_mobile_added_CT(qdr_core_t *core, const char *address_hash)
 {
-    qdr_general_work_t *work = qdr_general_work(qdr_do_mobile_added);
-    work->field = qdr_field(address_hash);
-    qdr_post_general_work_CT(core, work);
+    qdr_mobile_change_CT(core, address_hash, true);
 }
 
 
 void qdr_post_mobile_removed_CT(qdr_core_t *core, const char *address_hash)
 {
-    qdr_general_work_t *work = qdr_general_work(qdr_do_mobile_removed);
-    work->field = qdr_field(address_hash);
+    qdr_mobile_change_CT(core, address_hash, false);
+}
+
+
+void qdr_flush_mobile_changes_CT(qdr_core_t *core, bool force)
+{
+    if (DEQ_IS_EMPTY(core->mobile_changes))
+        return;
+    if (!force && qdr_monotonic_ns() - core->mobile_changes_since < QDR_MOBILE_COALESCE_NS)
+        return;
+
+    //
+    // Once posted, the changes can no longer be cancelled.
+    //
+    for (qdr_mobile_change_t *change = DEQ_HEAD(core->mobile_changes); change; change = DEQ_NEXT(change)) {
+        qd_hash_remove_by_handle(core->mobile_change_hash, change->hash_handle);
+        qd_hash_handle_free(change->hash_handle);
+        change->hash_handle = 0;
+    }
+
+    //
+    // An edge router proxies its addresses to the interior instead.
+    //
+    if (core->router_mode == QD_ROUTER_MODE_EDGE) {
+        qdr_edge_mobile_changes_CT(core, &core->mobile_changes);
+        return;
+    }
+
+    qdr_general_work_t *work = qdr_general_work(qdr_do_mobile_changes);
+    DEQ_MOVE(core->mobile_changes, work->mobile_changes);
     qdr_post_general_work_CT(core, work);
 }
 
@@ -20,16 +20,22 @@
 #include "router_core_private.h"
 #include <stdio.h>
 #include <strings.h>
+#include <inttypes.h>
 
 ALLOC_DEFINE(qdr_address_t);
+ALLOC_DEFINE(qdr_address_latency_t);
 ALLOC_DEFINE(qdr_address_config_t);
 ALLOC_DEFINE(qdr_node_t);
 ALLOC_DEFINE(qdr_delivery_t);
 ALLOC_DEFINE(qdr_delivery_ref_t);
+ALLOC_DEFINE(qdr_multicast_t);
+ALLOC_DEFINE(qdr_link_bridge_t);
+ALLOC_DEFINE(qdr_delivery_batch_t);
 ALLOC_DEFINE(qdr_link_t);
 ALLOC_DEFINE(qdr_router_ref_t);
 ALLOC_DEFINE(qdr_link_ref_t);
 ALLOC_DEFINE(qdr_general_work_t);
+ALLOC_DEFINE(qdr_mobile_change_t);
 ALLOC_DEFINE(qdr_link_work_t);
 ALLOC_DEFINE(qdr_connection_ref_t);
 ALLOC_DEFINE(qdr_connection_info_t);
@@ -57,23 +63,46 @@ qdr_core_t *qdr_core(qd_dispatch_t *qd, qd_router_mode_t mode, const char *area,
     //
     qd_log(core->log, QD_LOG_INFO, "Allow Unsettled Multicast: %s", qd->allow_unsettled_multicast ? "yes" : "no");
 
+    //
+    // Set up the idle behavior of the core thread
+    //
+    core->spin_usec = qd->core_spin_usec > 0 ? qd->core_spin_usec : 0;
+    if (core->spin_usec)
+        qd_log(core->log, QD_LOG_INFO, "Core thread spins for %"PRId64" usec before parking", core->spin_usec);
+    core->action_timing = qd->core_action_timing;
+    core->auto_link_attach_rate = qd->auto_link_attach_rate > 0 ? qd->auto_link_attach_rate : 0;
+    core->link_quantum = qd->link_fairness_quantum > 0 ? qd->link_fairness_quantum : 0;
+    core->spill_threshold = qd->spill_threshold > 0 ? (uint64_t) qd->spill_threshold : 0;
+
     //
     // Set up the threading support
     //
     core->action_cond = sys_cond();
     core->action_lock = sys_mutex();
     core->running     = true;
-    DEQ_INIT(core->action_list);
+    for (int lane = 0; lane < QDR_ACTION_LANES; lane++) {
+        sys_atomic_ptr_init(&core->action_stack[lane], 0);
+        sys_atomic_init(&core->action_depth[lane], 0);
+    }
+    sys_atomic_init(&core->action_parked, 0);
+    sys_atomic_init(&core->stats_seq, 0);
+    sys_atomic_init(&core->rate_throttling, 0);
+    sys_atomic_init(&core->memory_withholding, 0);
+    sys_atomic_init(&core->auto_link_paced, 0);
 
     core->work_lock = sys_mutex();
     DEQ_INIT(core->work_list);
-    core->work_timer = qd_timer(core->qd, qdr_general_handler, core);
+    for (int i = 0; i < QDR_CONNECTION_WORK_LOCKS; i++)
+        core->conn_work_locks[i] = sys_mutex();
+    qdr_addr_view_setup(core);
+    if (qd->server)
+        qd_server_set_wake_handler(qd, qdr_general_handler, core);
 
     //
-    // Set up the unique identifier generator
+    // Set up the unique identifier and dynamic address generators
     //
-    core->next_identifier = 1;
-    core->id_lock = sys_mutex();
+    sys_atomic64_init(&core->next_identifier, 1);
+    qdr_discriminator_setup(core);
 
     //
     // Launch the core thread
@@ -99,10 +128,15 @@ void qdr_core_free(qdr_core_t *core)
     //
     // Stop and join the thread
     //
+    sys_mutex_lock(core->action_lock);
     core->running = false;
     sys_cond_signal(core->action_cond);
+    sys_mutex_unlock(core->action_lock);
     sys_thread_join(core->thread);
 
+    // Release the deliveries of links torn down before the thread stopped
+    qdr_link_teardown_drain_CT(core);
+
     // Drain the general work lists
     qdr_general_handler(core);
 
@@ -112,16 +146,28 @@ void qdr_core_free(qdr_core_t *core)
     sys_thread_free(core->thread);
     sys_cond_free(core->action_cond);
     sys_mutex_free(core->action_lock);
+    for (int lane = 0; lane < QDR_ACTION_LANES; lane++) {
+        sys_atomic_ptr_destroy(&core->action_stack[lane]);
+        sys_atomic_destroy(&core->action_depth[lane]);
+    }
+    sys_atomic_destroy(&core->action_parked);
+    sys_atomic_destroy(&core->rate_throttling);
+    sys_atomic_destroy(&core->memory_withholding);
+    sys_atomic_destroy(&core->auto_link_paced);
     sys_mutex_free(core->work_lock);
-    sys_mutex_free(core->id_lock);
-    qd_timer_free(core->work_timer);
+    for (int i = 0; i < QDR_CONNECTION_WORK_LOCKS; i++)
+        sys_mutex_free(core->conn_work_locks[i]);
+    sys_atomic64_destroy(&core->next_identifier);
+    free(core->temp_addr_prefix);
+    if (core->qd->server)
+        qd_server_set_wake_handler(core->qd, 0, 0);
 
 
     //we can't call qdr_core_unsubscribe on the subscriptions because the action processing thread has
     //already been shut down. But, all the action would have done at this point is free the subscriptions
     //so we just do that directly.
-    free(core->agent_subscription_mobile);
-    free(core->agent_subscription_local);
+    qdr_subscription_free(core->agent_subscription_mobile);
+    qdr_subscription_free(core->agent_subscription_local);
 
     for (int i = 0; i <= QD_TREATMENT_LINK_BALANCED; ++i) {
         if (core->forwarders[i]) {
@@ -138,6 +184,20 @@ void qdr_core_free(qdr_core_t *core)
         qdr_core_remove_address_config(core, addr_config);
     }
     qd_hash_free(core->addr_hash);
+    qdr_addr_view_free(core);
+    qdr_rate_buckets_free(core);
+    qdr_mobile_change_t *change = 0;
+    while ( (change = DEQ_HEAD(core->mobile_changes)) ) {
+        DEQ_REMOVE_HEAD(core->mobile_changes);
+        qd_hash_remove_by_handle(core->mobile_change_hash, change->hash_handle);
+        qd_hash_handle_free(change->hash_handle);
+        free(change->address_hash);
+        free_qdr_mobile_change_t(change);
+    }
+    qd_hash_free(core->mobile_change_hash);
+    qd_parse_tree_free(core->addr_parse_tree);
+    qd_parse_tree_free(core->link_route_tree[QD_INCOMING]);
+    qd_parse_tree_free(core->link_route_tree[QD_OUTGOING]);
 
     qd_hash_free(core->conn_id_hash);
     //TODO what about the actual connection identifier objects?
@@ -151,14 +211,30 @@ void qdr_core_free(qdr_core_t *core)
     if (core->routers_by_mask_bit)       free(core->routers_by_mask_bit);
     if (core->control_links_by_mask_bit) free(core->control_links_by_mask_bit);
     if (core->data_links_by_mask_bit)    free(core->data_links_by_mask_bit);
+    if (core->data_link_pools_by_mask_bit) free(core->data_link_pools_by_mask_bit);
     if (core->neighbor_free_mask)        qd_bitmask_free(core->neighbor_free_mask);
+    if (core->rnodes_none)               qd_bitmask_free(core->rnodes_none);
+    if (core->rnodes_single) {
+        for (int idx = 0; idx < qd_bitmask_width(); idx++)
+            qd_bitmask_free(core->rnodes_single[idx]);
+        free(core->rnodes_single);
+    }
+    if (core->routers_by_origin) {
+        for (int idx = 0; idx < qd_bitmask_width(); idx++)
+            qd_bitmask_free(core->routers_by_origin[idx]);
+        free(core->routers_by_origin);
+    }
 
     free(core);
 }
 
 void qdr_router_node_free(qdr_core_t *core, qdr_node_t *rnode)
 {
+    qdr_route_table_index_origins_CT(core, rnode, false);
     qd_bitmask_free(rnode->valid_origins);
+    if (rnode->ecmp_valid_origins)
+        qd_bitmask_free(rnode->ecmp_valid_origins);
+    free(rnode->ecmp_hops);
     DEQ_REMOVE(core->routers, rnode);
     core->routers_by_mask_bit[rnode->mask_bit] = 0;
     core->cost_epoch++;
@@ -263,39 +339,302 @@ qdr_action_t *qdr_action(qdr_action_handler_t action_handler, const char *label)
 }
 
 
+/**
+ * Push a chain of 'count' actions linked through 'next' (newest first, oldest last)
+ * onto the core's lock-free action stack for a lane.
+ */
+static void qdr_action_push_chain(qdr_core_t *core, qdr_action_lane_t lane, qdr_action_t *newest, qdr_action_t *oldest, uint32_t count)
+{
+    //
+    // The 'next' link is used as the stack linkage; the core thread rebuilds a
+    // proper list when it takes the stack.
+    //
+    void *head;
+    sys_atomic_add(&core->action_depth[lane], count);
+    do {
+        head = sys_atomic_ptr_get(&core->action_stack[lane]);
+        oldest->next = (qdr_action_t*) head;
+    } while (!sys_atomic_ptr_cas(&core->action_stack[lane], head, newest));
+
+    //
+    // Only take the lock if the core thread is (or is about to be) parked on the
+    // condition variable.
+    //
+    if (sys_atomic_get(&core->action_parked)) {
+        sys_mutex_lock(core->action_lock);
+        sys_cond_signal(core->action_cond);
+        sys_mutex_unlock(core->action_lock);
+    }
+}
+
+
+//
+// Per-thread staging of actions between qdr_action_batch_begin and
+// qdr_action_batch_end.  Only DATA lane actions are staged.
+//
+typedef struct {
+    bool          active;
+    qdr_core_t   *core;
+    qdr_action_t *newest;
+    qdr_action_t *oldest;
+    uint32_t      count;
+} qdr_action_batch_t;
+
+static __thread qdr_action_batch_t action_batch;
+
+
+static void qdr_action_batch_flush(void)
+{
+    if (action_batch.newest)
+        qdr_action_push_chain(action_batch.core, QDR_ACTION_LANE_DATA,
+                              action_batch.newest, action_batch.oldest, action_batch.count);
+    action_batch.core   = 0;
+    action_batch.newest = 0;
+    action_batch.oldest = 0;
+    action_batch.count  = 0;
+}
+
+
+void qdr_action_batch_begin(void)
+{
+    action_batch.active = true;
+}
+
+
+void qdr_action_batch_end(void)
+{
+    qdr_action_batch_flush();
+    action_batch.active = false;
+}
+
+
+qdr_action_t *qdr_action_batch_tail(qdr_core_t *core, qdr_action_handler_t handler)
+{
+    qdr_action_t *tail = action_batch.newest;
+
+    if (action_batch.active && action_batch.core == core && tail && tail->action_handler == handler)
+        return tail;
+    return 0;
+}
+
+
 void qdr_action_enqueue(qdr_core_t *core, qdr_action_t *action)
 {
-    sys_mutex_lock(core->action_lock);
-    DEQ_INSERT_TAIL(core->action_list, action);
-    sys_cond_signal(core->action_cond);
-    sys_mutex_unlock(core->action_lock);
+    if (core->action_timing)
+        action->enqueued_at = qdr_monotonic_ns();
+
+    //
+    // Control actions are never held back in the staging list.
+    //
+    if (action_batch.active && action->lane == QDR_ACTION_LANE_DATA) {
+        if (action_batch.core != core)
+            qdr_action_batch_flush();
+        action_batch.core = core;
+        action->next = action_batch.newest;
+        action_batch.newest = action;
+        if (!action_batch.oldest)
+            action_batch.oldest = action;
+        action_batch.count++;
+        return;
+    }
+
+    qdr_action_push_chain(core, action->lane, action, action, 1);
+}
+
+
+typedef struct {
+    sys_mutex_t *lock;
+    sys_cond_t  *cond;
+    bool         done;
+} qdr_core_waiter_t;
+
+
+static void qdr_core_sync_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    qdr_core_waiter_t *waiter = (qdr_core_waiter_t*) action->args.sync.waiter;
+
+    sys_mutex_lock(waiter->lock);
+    waiter->done = true;
+    sys_cond_signal(waiter->cond);
+    sys_mutex_unlock(waiter->lock);
+}
+
+
+void qdr_core_sync(qdr_core_t *core)
+{
+    qdr_core_waiter_t waiter = {sys_mutex(), sys_cond(), false};
+    qdr_action_t     *action = qdr_action(qdr_core_sync_CT, "core_sync");
+
+    action->args.sync.waiter = &waiter;
+    qdr_action_enqueue(core, action);
+
+    sys_mutex_lock(waiter.lock);
+    while (!waiter.done)
+        sys_cond_wait(waiter.cond, waiter.lock);
+    sys_mutex_unlock(waiter.lock);
+    sys_mutex_free(waiter.lock);
+    sys_cond_free(waiter.cond);
 }
 
 
+void qdr_publish_stats_CT(qdr_core_t *core, bool force)
+{
+    uint64_t now = qdr_monotonic_ns();
+    if (!force && now - core->stats_published_ns < QDR_STATS_PUBLISH_NS)
+        return;
+    core->stats_published_ns = now;
+
+    uint32_t          seq  = sys_atomic_get(&core->stats_seq);
+    qdr_core_stats_t *slot = &core->stats_slot[(seq + 1) & 1];
+
+    *slot = core->stats;
+    slot->sequence         = seq + 1;
+    slot->published_ns     = now;
+    slot->addr_count       = DEQ_SIZE(core->addrs);
+    slot->link_count       = DEQ_SIZE(core->open_links);
+    slot->connection_count = DEQ_SIZE(core->open_connections);
+    slot->router_count     = DEQ_SIZE(core->routers);
+    slot->link_route_count = DEQ_SIZE(core->link_routes);
+    slot->auto_link_count  = DEQ_SIZE(core->auto_links);
+    slot->spin_time_ns     = core->spin_time_ns;
+    slot->parked_time_ns   = core->parked_time_ns;
+    slot->busy_time_ns     = core->busy_time_ns;
+    slot->utilization      = core->utilization;
+    slot->drains           = core->drains;
+    slot->drained_actions  = core->drained_actions;
+    slot->max_drain        = core->max_drain;
+
+    //
+    // The slot must be complete before the sequence that selects it is seen.
+    //
+    __sync_synchronize();
+    sys_atomic_inc(&core->stats_seq);
+}
+
+
+void qdr_core_stats(qdr_core_t *core, qdr_core_stats_t *stats)
+{
+    uint32_t seq;
+
+    //
+    // The core only writes the slot a reader may be copying after it has
+    // published into the other one, so a copy is good as long as the sequence
+    // did not move during it.
+    //
+    do {
+        seq = sys_atomic_get(&core->stats_seq);
+        __sync_synchronize();
+        *stats = core->stats_slot[seq & 1];
+        __sync_synchronize();
+    } while (sys_atomic_get(&core->stats_seq) != seq);
+}
+
+
+const qdr_shed_policy_t qdr_shed_policy_default = {QDR_SHED_DROP_ALL, 0, 0, QD_FIELD_SUBJECT};
+
+
 qdr_address_t *qdr_address_CT(qdr_core_t *core, qd_address_treatment_t treatment)
 {
     qdr_address_t *addr = new_qdr_address_t();
     ZERO(addr);
     addr->treatment = treatment;
     addr->forwarder = qdr_forwarder_CT(core, treatment);
-    addr->rnodes    = qd_bitmask(0);
+    addr->shed      = qdr_shed_policy_default;
+    if (!core->rnodes_none)
+        core->rnodes_none = qd_bitmask(0);
+    addr->rnodes = core->rnodes_none;
     return addr;
 }
 
 
+static qd_bitmask_t *qdr_rnodes_single_CT(qdr_core_t *core, int router_maskbit)
+{
+    if (!core->rnodes_single)
+        core->rnodes_single = NEW_PTR_ARRAY(qd_bitmask_t, qd_bitmask_width());
+    if (!core->rnodes_single[router_maskbit]) {
+        core->rnodes_single[router_maskbit] = qd_bitmask(0);
+        qd_bitmask_set_bit(core->rnodes_single[router_maskbit], router_maskbit);
+    }
+    return core->rnodes_single[router_maskbit];
+}
+
+
+void qdr_address_rnode_set_CT(qdr_core_t *core, qdr_address_t *addr, int router_maskbit)
+{
+    if (qd_bitmask_value(addr->rnodes, router_maskbit))
+        return;
+
+    if (!addr->rnodes_owned) {
+        if (qd_bitmask_cardinality(addr->rnodes) == 0) {
+            addr->rnodes = qdr_rnodes_single_CT(core, router_maskbit);
+            qdr_addr_view_paths_CT(addr);
+            return;
+        }
+        qd_bitmask_t *rnodes = qd_bitmask(0);
+        qd_bitmask_or(rnodes, addr->rnodes);
+        addr->rnodes       = rnodes;
+        addr->rnodes_owned = true;
+    }
+    qd_bitmask_set_bit(addr->rnodes, router_maskbit);
+    qdr_addr_view_paths_CT(addr);
+}
+
+
+bool qdr_address_rnode_clear_CT(qdr_core_t *core, qdr_address_t *addr, int router_maskbit)
+{
+    if (!qd_bitmask_value(addr->rnodes, router_maskbit))
+        return false;
+
+    if (!addr->rnodes_owned) {
+        addr->rnodes = core->rnodes_none;
+        qdr_addr_view_paths_CT(addr);
+        return true;
+    }
+
+    //
+    // Go back to a shared mask when one router or none is left.
+    //
+    qd_bitmask_clear_bit(addr->rnodes, router_maskbit);
+    if (qd_bitmask_cardinality(addr->rnodes) <= 1) {
+        int remaining;
+        qd_bitmask_t *shared = qd_bitmask_first_set(addr->rnodes, &remaining)
+            ? qdr_rnodes_single_CT(core, remaining) : core->rnodes_none;
+        qd_bitmask_free(addr->rnodes);
+        addr->rnodes       = shared;
+        addr->rnodes_owned = false;
+    }
+    qdr_addr_view_paths_CT(addr);
+    return true;
+}
+
+
+void qdr_address_configure_CT(qdr_address_t *addr, const qdr_address_config_t *config)
+{
+    if (!config)
+        return;
+    addr->shed             = config->shed;
+    addr->multicast_rule   = config->multicast_rule;
+    addr->multicast_quorum = config->multicast_quorum;
+    if (addr->treatment == QD_TREATMENT_ANYCAST_BALANCED)
+        addr->group_affinity = config->group_affinity;
+}
+
+
 qdr_address_t *qdr_add_local_address_CT(qdr_core_t *core, char aclass, const char *address, qd_address_treatment_t treatment)
 {
-    char           addr_string[1000];
-    qdr_address_t *addr = 0;
-    qd_iterator_t *iter = 0;
+    char                  addr_string[1000];
+    qdr_address_t        *addr = 0;
+    qd_iterator_storage_t storage;
+    qd_iterator_t        *iter = 0;
 
     snprintf(addr_string, sizeof(addr_string), "%c%s", aclass, address);
-    iter = qd_iterator_string(addr_string, ITER_VIEW_ALL);
+    iter = qd_iterator_init_string(&storage, addr_string, ITER_VIEW_ALL);
 
     qd_hash_retrieve(core->addr_hash, iter, (void**) &addr);
     if (!addr) {
         addr = qdr_address_CT(core, treatment);
         qd_hash_insert(core->addr_hash, iter, addr, &addr->hash_handle);
+        qdr_addr_view_add_CT(core, addr);
         DEQ_INSERT_TAIL(core->addrs, addr);
         addr->block_deletion = true;
         addr->local = (aclass == 'L');
@@ -304,34 +643,68 @@ qdr_address_t *qdr_add_local_address_CT(qdr_core_t *core, char aclass, const cha
     return addr;
 }
 
+static qd_parse_tree_t *qdr_link_route_tree_for_key(qdr_core_t *core, const char *key)
+{
+    if (key && key[0] == QDR_LINK_ROUTE_PATTERN_IN)
+        return core->link_route_tree[QD_INCOMING];
+    if (key && key[0] == QDR_LINK_ROUTE_PATTERN_OUT)
+        return core->link_route_tree[QD_OUTGOING];
+    return 0;
+}
+
+
+void qdr_core_index_link_route_pattern_CT(qdr_core_t *core, qdr_address_t *addr)
+{
+    const char      *key  = (const char*) qd_hash_key_by_handle(addr->hash_handle);
+    qd_parse_tree_t *tree = qdr_link_route_tree_for_key(core, key);
+    if (tree)
+        qd_parse_tree_add_pattern(tree, &key[1], addr);
+}
+
+
 void qdr_core_remove_address(qdr_core_t *core, qdr_address_t *addr)
 {
-    // Remove the address from the list and hash index
+    // Remove the address from the pattern and hash indices and the list
+    const char      *key  = (const char*) qd_hash_key_by_handle(addr->hash_handle);
+    qd_parse_tree_t *tree = qdr_link_route_tree_for_key(core, key);
+    if (tree)
+        qd_parse_tree_remove_pattern(tree, &key[1]);
     qd_hash_remove_by_handle(core->addr_hash, addr->hash_handle);
+    qdr_addr_view_remove_CT(core, addr);
+    qdr_agent_cursor_remove_CT(core, addr, DEQ_NEXT(addr));
     DEQ_REMOVE(core->addrs, addr);
 
     // Free resources associated with this address
     qd_hash_handle_free(addr->hash_handle);
-    qd_bitmask_free(addr->rnodes);
+    if (addr->rnodes_owned)
+        qd_bitmask_free(addr->rnodes);
+    if (addr->latency)
+        free_qdr_address_latency_t(addr->latency);
     if (addr->treatment == QD_TREATMENT_ANYCAST_CLOSEST) {
         qd_bitmask_free(addr->closest_remotes);
     }
     else if (addr->treatment == QD_TREATMENT_ANYCAST_BALANCED) {
         free(addr->outstanding_deliveries);
+        free(addr->balance_heap);
+        qdr_forward_group_free_CT(addr);
     }
     free_qdr_address_t(addr);
 }
 
 void qdr_core_remove_address_config(qdr_core_t *core, qdr_address_config_t *addr)
 {
-    // Remove the address from the list and the hash index.
-    qd_hash_remove_by_handle(core->addr_hash, addr->hash_handle);
+    // Remove the address from the list and the hash index or pattern tree.
+    if (addr->pattern)
+        qd_parse_tree_remove_pattern(core->addr_parse_tree, addr->pattern);
+    else
+        qd_hash_remove_by_handle(core->addr_hash, addr->hash_handle);
     DEQ_REMOVE(core->addr_config, addr);
 
     // Free resources associated with this address.
     if (addr->name) {
         free(addr->name);
     }
+    free(addr->pattern);
     qd_hash_handle_free(addr->hash_handle);
     free_qdr_address_config_t(addr);
 }
@@ -404,17 +777,34 @@ static void qdr_general_handler(void *context)
     qdr_general_work_list_t  work_list;
     qdr_general_work_t      *work;
 
+    //
+    // If another thread is already processing general work, it will pick up
+    // whatever is on the list now.
+    //
     sys_mutex_lock(core->work_lock);
-    DEQ_MOVE(core->work_list, work_list);
-    sys_mutex_unlock(core->work_lock);
+    if (core->work_in_progress) {
+        sys_mutex_unlock(core->work_lock);
+        return;
+    }
+    core->work_in_progress = true;
+
+    while (!DEQ_IS_EMPTY(core->work_list)) {
+        DEQ_MOVE(core->work_list, work_list);
+        sys_mutex_unlock(core->work_lock);
 
-    work = DEQ_HEAD(work_list);
-    while (work) {
-        DEQ_REMOVE_HEAD(work_list);
-        work->handler(core, work);
-        free_qdr_general_work_t(work);
         work = DEQ_HEAD(work_list);
+        while (work) {
+            DEQ_REMOVE_HEAD(work_list);
+            work->handler(core, work);
+            free_qdr_general_work_t(work);
+            work = DEQ_HEAD(work_list);
+        }
+
+        sys_mutex_lock(core->work_lock);
     }
+
+    core->work_in_progress = false;
+    sys_mutex_unlock(core->work_lock);
 }
 
 
@@ -437,16 +827,13 @@ void qdr_post_general_work_CT(qdr_core_t *core, qdr_general_work_t *work)
     notify = DEQ_SIZE(core->work_list) == 1;
     sys_mutex_unlock(core->work_lock);
 
-    if (notify)
-        qd_timer_schedule(core->work_timer, 0);
+    if (notify && core->qd->server)
+        qd_server_wake(core->qd);
 }
 
 
 uint64_t qdr_identifier(qdr_core_t* core)
 {
-    sys_mutex_lock(core->id_lock);
-    uint64_t id = core->next_identifier++;
-    sys_mutex_unlock(core->id_lock);
-    return id;
+    return sys_atomic64_add(&core->next_identifier, 1);
 }
 
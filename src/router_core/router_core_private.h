@@ -24,7 +24,9 @@
 #include <qpid/dispatch/threading.h>
 #include <qpid/dispatch/atomic.h>
 #include <qpid/dispatch/log.h>
+#include <qpid/dispatch/parse_tree.h>
 #include <memory.h>
+#include <time.h>
 
 typedef struct qdr_address_t         qdr_address_t;
 typedef struct qdr_address_config_t  qdr_address_config_t;
@@ -36,6 +38,18 @@ typedef struct qdr_link_route_t      qdr_link_route_t;
 typedef struct qdr_auto_link_t       qdr_auto_link_t;
 typedef struct qdr_conn_identifier_t qdr_conn_identifier_t;
 typedef struct qdr_connection_ref_t  qdr_connection_ref_t;
+typedef struct qdr_multicast_t       qdr_multicast_t;
+typedef struct qdr_link_bridge_t     qdr_link_bridge_t;
+typedef struct qdr_rate_bucket_t     qdr_rate_bucket_t;
+
+#define QDR_N_PRIORITIES (QD_MESSAGE_MAX_PRIORITY + 1)
+
+//
+// Pool items are not cache aligned, so fields written by different threads are kept off
+// a shared cache line by a full line of padding between them rather than by alignment.
+//
+#define QDR_CACHE_LINE 64
+#define QDR_CACHE_GAP(name) char name[QDR_CACHE_LINE]
 
 qdr_forwarder_t *qdr_forwarder_CT(qdr_core_t *core, qd_address_treatment_t treatment);
 int qdr_forward_message_CT(qdr_core_t *core, qdr_address_t *addr, qd_message_t *msg, qdr_delivery_t *in_delivery,
@@ -72,10 +86,43 @@ char *qdr_field_copy(qdr_field_t *field);
 typedef struct qdr_action_t qdr_action_t;
 typedef void (*qdr_action_handler_t) (qdr_core_t *core, qdr_action_t *action, bool discard);
 
+//
+// Delivery updates and deletions staged by an I/O thread are folded into the newest
+// staged action of the same kind, so a burst of settlements costs the core one action
+// per QDR_DELIVERY_BATCH_MAX deliveries rather than one each.
+//
+#define QDR_DELIVERY_BATCH_MAX 32
+
+typedef struct {
+    qdr_delivery_t *delivery;
+    uint64_t        disposition;
+    qdr_error_t    *error;
+    bool            settled;
+} qdr_delivery_batch_entry_t;
+
+typedef struct {
+    int                        count;
+    qdr_delivery_batch_entry_t updates[QDR_DELIVERY_BATCH_MAX];
+} qdr_delivery_batch_t;
+
+ALLOC_DECLARE(qdr_delivery_batch_t);
+
+//
+// Actions in the CONTROL lane (route-table updates, router-control messages) are
+// processed ahead of actions in the DATA lane.  Ordering is preserved within a lane.
+//
+typedef enum {
+    QDR_ACTION_LANE_DATA = 0,
+    QDR_ACTION_LANE_CONTROL,
+    QDR_ACTION_LANES
+} qdr_action_lane_t;
+
 struct qdr_action_t {
     DEQ_LINKS(qdr_action_t);
     qdr_action_handler_t  action_handler;
     const char           *label;
+    qdr_action_lane_t     lane;
+    uint64_t              enqueued_at;
     union {
         //
         // Arguments for router control-plane actions
@@ -86,7 +133,9 @@ struct qdr_action_t {
             int           nh_router_maskbit;
             int           cost;
             qd_bitmask_t *router_set;
+            qd_bitmask_t *origin_set;
             qdr_field_t  *address;
+            qdr_action_t *delta;  ///< Staged route-table actions, chained by next
         } route_table;
 
         //
@@ -108,6 +157,8 @@ struct qdr_action_t {
             bool              drain;
             uint8_t           tag[32];
             int               tag_length;
+            bool              complete;
+            qdr_link_bridge_t *bridge;  ///< [ref] Bridge whose core_pending counts this action
         } connection;
 
         //
@@ -118,6 +169,8 @@ struct qdr_action_t {
             uint64_t        disposition;
             bool            settled;
             qdr_error_t    *error;
+            qdr_link_bridge_t *bridge;  ///< [ref] Bridge whose core_pending counts this action
+            qdr_delivery_batch_t *batch; ///< Further deliveries folded into this action, in order
         } delivery;
 
         //
@@ -144,34 +197,109 @@ struct qdr_action_t {
             qdr_field_t             *name;
             qd_parsed_field_t       *in_body;
             qd_buffer_list_t         body_buffers;
+            qdr_action_t            *more;      ///< Further creates folded into this action, in order
+            qdr_action_t            *more_tail;
         } agent;
 
+        //
+        // Arguments for qdr_core_sync
+        //
+        struct {
+            void *waiter;
+        } sync;
+
     } args;
 };
 
 ALLOC_DECLARE(qdr_action_t);
 DEQ_DECLARE(qdr_action_t, qdr_action_list_t);
 
+//
+// Per-label statistics for core actions.  These are owned and updated by the
+// core thread.  Histogram bucket N counts samples t (in microseconds) with
+// 2^(N-1) <= t < 2^N; bucket 0 counts samples under one microsecond and the
+// last bucket is unbounded.
+//
+#define QDR_ACTION_STATS_MAX          64
+#define QDR_ACTION_STATS_INDEX_SIZE   128
+#define QDR_ACTION_HISTOGRAM_BUCKETS  16
+
+typedef struct {
+    const char *label;
+    uint64_t    count;
+    uint64_t    service_ns;
+    uint64_t    max_service_ns;
+    uint64_t    wait_ns;
+    uint64_t    service_histogram[QDR_ACTION_HISTOGRAM_BUCKETS];
+    uint64_t    wait_histogram[QDR_ACTION_HISTOGRAM_BUCKETS];
+} qdr_action_stats_t;
+
+static inline uint64_t qdr_monotonic_ns(void)
+{
+    struct timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_nsec;
+}
+
+//
+// Delivery latency histograms, bucketed like the action histograms: bucket N
+// counts samples t (in microseconds) with 2^(N-1) <= t < 2^N, the last bucket
+// (from about 4 seconds) is unbounded.  Each histogram has a single writer.
+//
+#define QDR_LATENCY_BUCKETS 24
+
+static inline void qdr_latency_record(uint64_t *histogram, uint64_t ns)
+{
+    uint64_t usec   = ns / 1000;
+    int      bucket = 0;
+    while (usec && bucket < QDR_LATENCY_BUCKETS - 1) {
+        usec >>= 1;
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
 //
 // General Work
 //
 // The following types are used to post work to the IO threads for
-// non-connection-specific action.  These actions are serialized through
-// a zero-delay timer and are processed by one thread at a time.  General
+// non-connection-specific action.  These actions are dispatched with a
+// server wakeup and are processed by one thread at a time.  General
 // actions occur in-order and are not run concurrently.
 //
 typedef struct qdr_general_work_t qdr_general_work_t;
 typedef void (*qdr_general_work_handler_t) (qdr_core_t *core, qdr_general_work_t *work);
 
+/**
+ * A change in the local mobile addresses that has not been reported yet.
+ */
+typedef struct qdr_mobile_change_t qdr_mobile_change_t;
+struct qdr_mobile_change_t {
+    DEQ_LINKS(qdr_mobile_change_t);
+    char             *address_hash;
+    bool              added;
+    qd_hash_handle_t *hash_handle;
+};
+
+ALLOC_DECLARE(qdr_mobile_change_t);
+DEQ_DECLARE(qdr_mobile_change_t, qdr_mobile_change_list_t);
+
+//
+// Mobile-address changes are reported in batches of at most QDR_MOBILE_BATCH_MAX,
+// held back at most QDR_MOBILE_COALESCE_NS while the core is busy.
+//
+#define QDR_MOBILE_BATCH_MAX   1024
+#define QDR_MOBILE_COALESCE_NS 20000000
+
 struct qdr_general_work_t {
     DEQ_LINKS(qdr_general_work_t);
     qdr_general_work_handler_t  handler;
     qdr_field_t                *field;
     int                         maskbit;
     int                         inter_router_cost;
-    qdr_receive_t               on_message;
-    void                       *on_message_context;
     qd_message_t               *msg;
+    qdr_subscription_t         *subscription;
+    qdr_mobile_change_list_t    mobile_changes;
 };
 
 ALLOC_DECLARE(qdr_general_work_t);
@@ -253,9 +381,34 @@ DEQ_DECLARE(qdr_link_work_t, qdr_link_work_list_t);
 
 #define QDR_AGENT_MAX_COLUMNS 64
 #define QDR_AGENT_COLUMN_NULL (QDR_AGENT_MAX_COLUMNS + 1)
+#define QDR_AGENT_MAX_FILTERS 8
+#define QDR_AGENT_SCAN_QUANTUM 256
+
+typedef enum {
+    QDR_FILTER_EQ,
+    QDR_FILTER_NE,
+    QDR_FILTER_LT,
+    QDR_FILTER_LE,
+    QDR_FILTER_GT,
+    QDR_FILTER_GE,
+    QDR_FILTER_PREFIX
+} qdr_filter_op_t;
+
+/**
+ * One clause of a query's "where" list: [attribute, operator, value].
+ * Clauses are ANDed.
+ */
+typedef struct {
+    int              column;
+    qdr_filter_op_t  op;
+    bool             numeric;
+    int64_t          number;
+    char            *text;
+} qdr_query_filter_t;
 
 struct qdr_query_t {
     DEQ_LINKS(qdr_query_t);
+    DEQ_LINKS_N(CURSOR, qdr_query_t);
     qdr_core_t              *core;
     qd_router_entity_type_t  entity_type;
     void                    *context;
@@ -263,6 +416,12 @@ struct qdr_query_t {
     qd_composed_field_t     *body;
     qdr_field_t             *next_key;
     int                      next_offset;
+    void                    *cursor;       ///< Entity the next get_next resumes at (core thread only)
+    bool                     cursor_held;  ///< True while the query is on core->query_cursors
+    qdr_query_filter_t       filters[QDR_AGENT_MAX_FILTERS];
+    int                      filter_count;
+    bool                     filter_invalid;  ///< The "where" list could not be used; fail the query
+    int                      filter_skip;     ///< Matching rows still to pass over to reach the offset
     bool                     more;
     qd_amqp_error_t          status;
 };
@@ -279,12 +438,17 @@ struct qdr_node_t {
     uint32_t          ref_count;
     qd_bitmask_t     *valid_origins;
     int               cost;
+    int              *ecmp_hops;          ///< Mask bits of the equal-cost next-hop routers
+    int               ecmp_count;         ///< Number of ecmp_hops, zero unless there is more than one
+    qd_bitmask_t     *ecmp_valid_origins; ///< Origins for which this router is on any lowest-cost path
 };
 
 ALLOC_DECLARE(qdr_node_t);
 DEQ_DECLARE(qdr_node_t, qdr_node_list_t);
 void qdr_router_node_free(qdr_core_t *core, qdr_node_t *rnode);
 
+qdr_node_t *qdr_node_next_hop_CT(qdr_core_t *core, qdr_node_t *rnode, uint32_t flow);
+
 #define PEER_CONTROL_LINK(c,n) ((n->link_mask_bit >= 0) ? (c)->control_links_by_mask_bit[n->link_mask_bit] : 0)
 #define PEER_DATA_LINK(c,n)    ((n->link_mask_bit >= 0) ? (c)->data_links_by_mask_bit[n->link_mask_bit] : 0)
 
@@ -304,27 +468,47 @@ typedef enum {
 } qdr_delivery_where_t;
 
 struct qdr_delivery_t {
+    //
+    // Used in forwarding, sending and settling every delivery
+    //
     DEQ_LINKS(qdr_delivery_t);
-    void                *context;
-    sys_atomic_t         ref_count;
     qdr_link_t          *link;
     qdr_delivery_t      *peer;
     qd_message_t        *msg;
-    qd_iterator_t       *to_addr;
-    qd_iterator_t       *origin;
+    void                *context;
+    qdr_link_work_t     *link_work;         ///< Delivery work item for this delivery
     uint64_t             disposition;
-    pn_data_t           *extension_state;
-    qdr_error_t         *error;
     bool                 settled;
     bool                 presettled;
     bool                 cleared_proton_ref;
+    uint8_t              priority;          ///< Message priority, set when queued on an outgoing link
     qdr_delivery_where_t where;
+    uint64_t             sequence;          ///< Order in which the delivery was received or sent on its link
+    uint64_t             queued_octets;     ///< Size of the message when it joined the undelivered list
+    qd_iterator_t       *to_addr;
+    qd_iterator_t       *origin;
+
+    //
+    // Used by some deliveries only, or once
+    //
+    pn_data_t           *extension_state;
+    qdr_error_t         *error;
     uint8_t              tag[32];
     int                  tag_length;
     qd_bitmask_t        *link_exclusion;
     qdr_address_t       *tracking_addr;
     int                  tracking_addr_bit;
-    qdr_link_work_t     *link_work;         ///< Delivery work item for this delivery
+    uint32_t             conflate_hash;     ///< Address and conflation key of a conflatable delivery, else 0
+    qdr_multicast_t     *multicast;         ///< Settlement state of an unsettled multicast (ingress delivery only)
+    uint64_t             priority_key;      ///< Virtual finish time for weighted delivery priority
+    uint64_t             ingress_ns;        ///< When the message came into the router (qdr_monotonic_ns)
+    uint64_t             deliver_ns;        ///< When an outgoing delivery was handed to its connection, 0 before
+
+    //
+    // Taken and released by the core and I/O threads alike, so it is kept more than a
+    // cache line away from the fields above that are read with every forward.
+    //
+    sys_atomic_t         ref_count;
 };
 
 ALLOC_DECLARE(qdr_delivery_t);
@@ -338,13 +522,91 @@ typedef struct qdr_delivery_ref_t {
 ALLOC_DECLARE(qdr_delivery_ref_t);
 DEQ_DECLARE(qdr_delivery_ref_t, qdr_delivery_ref_list_t);
 
+/**
+ * How the outcome of an unsettled delivery to a multicast address is decided.  With
+ * PRESETTLE, the router settles the delivery itself and forwards pre-settled copies.
+ * Otherwise each copy is forwarded unsettled with the ingress delivery as its peer, and
+ * the ingress delivery is accepted once enough copies are accepted: every one (ALL), one
+ * (ANY), or the address's quorum.  Once that is out of reach, the ingress delivery takes
+ * the outcome of the copy that settled it.
+ */
+typedef enum {
+    QDR_MULTICAST_PRESETTLE,
+    QDR_MULTICAST_ALL,
+    QDR_MULTICAST_ANY,
+    QDR_MULTICAST_QUORUM
+} qdr_multicast_rule_t;
+
+struct qdr_multicast_t {
+    int  outstanding;  ///< Copies not yet settled
+    int  accepted;     ///< Copies accepted
+    int  needed;       ///< Acceptances needed to accept the ingress delivery
+    bool complete;     ///< The ingress delivery's outcome has been decided
+};
+
+ALLOC_DECLARE(qdr_multicast_t);
+
+/**
+ * Account for the settlement of a copy of an unsettled multicast (whose peer is the
+ * ingress delivery).  The copy's reference on the ingress delivery is released.
+ */
+void qdr_multicast_settled_CT(qdr_core_t *core, qdr_delivery_t *in_dlv, qdr_delivery_t *copy, uint64_t disposition);
+
+/**
+ * Outcomes of the deliveries freed on a link.
+ */
+typedef struct qdr_link_counts_t {
+    uint64_t presettled;
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t released;
+    uint64_t modified;
+    uint64_t settle_latency[QDR_LATENCY_BUCKETS];   ///< Ingress until a delivery was settled and freed
+} qdr_link_counts_t;
+
+/**
+ * The two links joined by a link route.  While the bridge holds both links, I/O threads
+ * pass deliveries and dispositions between them directly rather than through the core
+ * action queue.  Those hand-offs are serialized by the bridge lock, and are made only
+ * while no core action for either link's deliveries is pending, so they stay in order
+ * with the ones that had to go through the core.  The core empties the bridge before it
+ * cleans up either link.
+ *
+ * The links' counters belong to the core, so what the I/O threads count is kept in the
+ * bridge until qdr_link_bridge_collect_CT moves it to the links.
+ */
+struct qdr_link_bridge_t {
+    sys_mutex_t       *lock;
+    sys_atomic_t       ref_count;     ///< One for each link, one for each I/O thread using it
+    qdr_link_t        *in_link;
+    qdr_link_t        *out_link;
+    int                core_pending;  ///< Deliveries and updates for the links still queued for the core
+    uint64_t           in_deliveries; ///< Transfers handed over from in_link
+    qdr_link_counts_t  in_counts;     ///< Deliveries freed on in_link
+    qdr_link_counts_t  out_counts;    ///< Deliveries freed on out_link
+};
+
+ALLOC_DECLARE(qdr_link_bridge_t);
+
+void qdr_link_bridge_CT(qdr_link_t *link, qdr_link_t *peer);
+void qdr_link_unbridge_CT(qdr_link_t *link);
+
+/**
+ * Move the counts kept in a routed link's bridge to the link.
+ */
+void qdr_link_bridge_collect_CT(qdr_link_t *link);
+
 void qdr_add_delivery_ref(qdr_delivery_ref_list_t *list, qdr_delivery_t *dlv);
 void qdr_del_delivery_ref(qdr_delivery_ref_list_t *list, qdr_delivery_ref_t *ref);
 
 #define QDR_LINK_LIST_CLASS_ADDRESS    0
 #define QDR_LINK_LIST_CLASS_WORK       1
 #define QDR_LINK_LIST_CLASS_CONNECTION 2
-#define QDR_LINK_LIST_CLASSES          3
+#define QDR_LINK_LIST_CLASS_CUT_THROUGH 3
+#define QDR_LINK_LIST_CLASS_WITHHELD   4
+#define QDR_LINK_LIST_CLASS_DATA_POOL  5
+#define QDR_LINK_LIST_CLASS_THROTTLED  6
+#define QDR_LINK_LIST_CLASSES          7
 
 typedef enum {
     QDR_LINK_OPER_UP,
@@ -353,7 +615,39 @@ typedef enum {
     QDR_LINK_OPER_IDLE
 } qdr_link_oper_status_t;
 
+struct qdr_link_ref_t {
+    DEQ_LINKS(qdr_link_ref_t);
+    qdr_link_t *link;
+};
+
+ALLOC_DECLARE(qdr_link_ref_t);
+DEQ_DECLARE(qdr_link_ref_t, qdr_link_ref_list_t);
+
+#define QDR_RATE_CONNECTION 0
+#define QDR_RATE_USER       1
+#define QDR_RATE_VHOST      2
+#define QDR_RATE_SCOPES     3
+
+/**
+ * A token bucket limiting a message rate, an octet rate or both.
+ */
+struct qdr_rate_bucket_t {
+    DEQ_LINKS(qdr_rate_bucket_t);
+    char     *key;          ///< Identifies a shared bucket, 0 for a connection's own
+    int       ref_count;    ///< Connections using the bucket
+    uint64_t  msg_rate;     ///< Messages per second, 0 for no limit
+    uint64_t  byte_rate;    ///< Octets per second, 0 for no limit
+    double    msg_tokens;
+    double    byte_tokens;  ///< May go negative, as octets are taken after they arrive
+    uint64_t  refill_ns;    ///< When the tokens were last refilled
+};
+
+DEQ_DECLARE(qdr_rate_bucket_t, qdr_rate_bucket_list_t);
+
 struct qdr_link_t {
+    //
+    // Set up when the link attaches, read by the core and I/O threads
+    //
     DEQ_LINKS(qdr_link_t);
     qdr_core_t              *core;
     uint64_t                 identity;
@@ -361,44 +655,104 @@ struct qdr_link_t {
     qdr_connection_t        *conn;               ///< [ref] Connection that owns this link
     qd_link_type_t           link_type;
     qd_direction_t           link_direction;
-    qdr_link_work_list_t     work_list;
-    char                    *name;
-    char                    *terminus_addr;
-    int                      detach_count;       ///< 0, 1, or 2 depending on the state of the lifecycle
     qdr_address_t           *owning_addr;        ///< [ref] Address record that owns this link
     qdr_link_t              *connected_link;     ///< [ref] If this is a link-route, reference the connected link
-    qdr_link_ref_t          *ref[QDR_LINK_LIST_CLASSES];  ///< Pointers to containing reference objects
-    qdr_auto_link_t         *auto_link;          ///< [ref] Auto_link that owns this link
+    int                      capacity_min;
+    int                      capacity_max;   ///< Equal to capacity_min if the window is fixed
+    bool                     edge_proxy;         ///< Receives the owning address's messages from the interior (edge mode)
+    bool                     strip_annotations_in;
+    bool                     strip_annotations_out;
+
+    //
+    // Shared by the core and I/O threads under the connection's work_lock
+    //
+    qdr_link_work_list_t     work_list;
+    qdr_action_t            *flow_action;    ///< Flow action not yet run by the core, under the connection's work_lock
+    qdr_link_bridge_t       *bridge;             ///< [ref] Direct path to connected_link, set under the connection's work_lock
     qdr_delivery_list_t      undelivered;        ///< Deliveries to be forwarded or sent
+    uint64_t                 undelivered_octets; ///< Sum of queued_octets over the undelivered list (outgoing only)
+    int                      priority_depth[QDR_N_PRIORITIES];  ///< Undelivered deliveries by priority (outgoing only)
+    uint64_t                 priority_finish[QDR_N_PRIORITIES]; ///< Last virtual finish time given to each priority
     qdr_delivery_list_t      unsettled;          ///< Unsettled deliveries
     qdr_delivery_ref_list_t  updated_deliveries; ///< References to deliveries (in the unsettled list) with updates.
-    bool                     admin_enabled;
-    qdr_link_oper_status_t   oper_status;
-    bool                     strip_annotations_in;
-    bool                     strip_annotations_out;
-    int                      capacity;
+
+    QDR_CACHE_GAP(io_gap);
+
+    //
+    // Written by the link's I/O thread only
+    //
+    qdr_link_work_list_t     work_batch;         ///< Work taken from work_list by qdr_connection_process
+    qdr_delivery_ref_list_t  updated_batch;      ///< Updates taken from updated_deliveries by qdr_connection_process
+    int64_t                  drr_deficit;        ///< Octets the link may still send in its turn (I/O thread only)
+    bool                     drr_limited;        ///< The last push ended on drr_deficit rather than credit
+    int                      credit_to_core; ///< Number of the available credits incrementally given to the core
+    qdr_delivery_t          *streaming_delivery; ///< [ref] Outgoing delivery whose content is still being sent
+    uint64_t                 priority_vtime;     ///< Virtual finish time of the last delivery sent
+    qd_buffer_list_t         to_override;    ///< Encoded to-override of arrivals on a targeted link (I/O thread only)
+    uint64_t                 arrival_sequence;  ///< Deliveries received so far, kept by the link's I/O thread
+    sys_atomic_t             released_unroutable;  ///< Released by the I/O thread for want of an address, see qdr_link_unroutable
+    uint64_t                 deliver_latency[QDR_LATENCY_BUCKETS];  ///< Ingress until sent on this outgoing link, kept by the I/O thread
+
+    QDR_CACHE_GAP(core_gap);
+
+    //
+    // Written by the core thread only
+    //
+    int                      capacity;       ///< Credit window; adapts between capacity_min and capacity_max
+    int                      credit_outstanding; ///< Credit issued to the sender and not yet used (incoming only)
+    int                      credit_debt;    ///< Replacement credit still to be held back after the window shrank
+    int                      credit_sample_count; ///< Deliveries received in the current sample
+    bool                     credit_starved; ///< The sender ran out of credit during the current sample
+    bool                     credit_backlog; ///< The destinations fell behind during the current sample
     bool                     flow_started;   ///< for incoming, true iff initial credit has been granted
     bool                     drain_mode;
-    int                      credit_to_core; ///< Number of the available credits incrementally given to the core
+    uint64_t                 credit_sample_ns; ///< When the current sample started
+    uint64_t                 credit_issue_ns;  ///< When a starved sender was last given credit, 0 if not waiting
+    uint64_t                 credit_rtt_ns;    ///< Smoothed time from issuing credit to a starved sender to its next delivery
+    int                      credit_deferred; ///< Credit gathered for an incoming link while its sender holds most of its window
+    int                      credit_withheld; ///< Credit held back from an incoming link while buffer memory is constrained
+    int                      credit_throttled; ///< Credit held back from an incoming link by its connection's rate limits
+    int                      balance_slot;   ///< One-based position in the owning balanced address's heap, 0 if none
+    uint64_t                 balance_key;    ///< Heap key: ineligibility, then undelivered + unsettled
+    uint64_t                 balance_stamp;  ///< When the link was last chosen, breaks ties between equal keys
+    qdr_link_t              *cut_through_link;   ///< [ref] Outgoing link the current incoming delivery is cut through to
+    qdr_link_ref_list_t      cut_through_sources; ///< Incoming links cutting deliveries through to this link
+
+    uint64_t          total_deliveries;
+    qdr_link_counts_t counts;
 
-    uint64_t total_deliveries;
-    uint64_t presettled_deliveries;
-    uint64_t accepted_deliveries;
-    uint64_t rejected_deliveries;
-    uint64_t released_deliveries;
-    uint64_t modified_deliveries;
+    //
+    // Used in managing the link, not in passing deliveries
+    //
+    char                    *name;
+    char                    *terminus_addr;
+    int                      detach_count;       ///< 0, 1, or 2 depending on the state of the lifecycle
+    qdr_link_ref_t          *ref[QDR_LINK_LIST_CLASSES];  ///< Pointers to containing reference objects
+    qdr_auto_link_t         *auto_link;          ///< [ref] Auto_link that owns this link
+    bool                     admin_enabled;
+    qdr_link_oper_status_t   oper_status;
 };
 
 ALLOC_DECLARE(qdr_link_t);
 DEQ_DECLARE(qdr_link_t, qdr_link_list_t);
 
-struct qdr_link_ref_t {
-    DEQ_LINKS(qdr_link_ref_t);
-    qdr_link_t *link;
-};
+/**
+ * The deliveries of a cleaned-up link, released a bounded number at a time over
+ * later core passes so that closing a link with a large backlog doesn't stall the
+ * core.  The deliveries no longer refer to the link, which may be freed first.
+ */
+typedef struct qdr_link_teardown_t {
+    DEQ_LINKS(struct qdr_link_teardown_t);
+    qd_direction_t           link_direction;
+    qdr_delivery_ref_list_t  updated_deliveries;
+    qdr_delivery_list_t      undelivered;
+    qdr_delivery_list_t      unsettled;
+} qdr_link_teardown_t;
 
-ALLOC_DECLARE(qdr_link_ref_t);
-DEQ_DECLARE(qdr_link_ref_t, qdr_link_ref_list_t);
+ALLOC_DECLARE(qdr_link_teardown_t);
+DEQ_DECLARE(qdr_link_teardown_t, qdr_link_teardown_list_t);
+
+void qdr_link_teardown_drain_CT(qdr_core_t *core);
 
 void qdr_add_link_ref(qdr_link_ref_list_t *ref_list, qdr_link_t *link, int cls);
 void qdr_del_link_ref(qdr_link_ref_list_t *ref_list, qdr_link_t *link, int cls);
@@ -416,16 +770,66 @@ void qdr_add_connection_ref(qdr_connection_ref_list_t *ref_list, qdr_connection_
 void qdr_del_connection_ref(qdr_connection_ref_list_t *ref_list, qdr_connection_t *conn);
 
 
+//
+// The messages for an in-process subscriber wait in a ring written only by the core
+// thread and drained only by the general work handler, so neither side takes a lock.
+// A drain is posted when the ring becomes non-empty and delivers all it finds.  When the
+// ring is full, messages are posted as general work of their own, and so are those that
+// follow until the posted ones are delivered, to keep the order.
+//
+#define QDR_SUBSCRIPTION_INBOX 256
+
+typedef struct {
+    qd_message_t *msg;
+    int           maskbit;
+    int           inter_router_cost;
+} qdr_inbox_entry_t;
+
 struct qdr_subscription_t {
     DEQ_LINKS(qdr_subscription_t);
-    qdr_core_t    *core;
-    qdr_address_t *addr;
-    qdr_receive_t  on_message;
-    void          *on_message_context;
+    qdr_core_t          *core;
+    qdr_address_t       *addr;
+    qdr_receive_t        on_message;
+    qdr_receive_batch_t  on_message_batch;   ///< Used instead of on_message if set
+    void                *on_message_context;
+    qdr_inbox_entry_t    inbox[QDR_SUBSCRIPTION_INBOX];
+    sys_atomic_t         inbox_head;         ///< Next entry to drain
+    sys_atomic_t         inbox_tail;         ///< Next entry to fill
+    sys_atomic_t         inbox_scheduled;    ///< A drain is posted and not yet started
+    sys_atomic_t         inbox_overflow;     ///< Messages posted as general work, not yet delivered
 };
 
 DEQ_DECLARE(qdr_subscription_t, qdr_subscription_list_t);
 
+void qdr_subscription_free(qdr_subscription_t *sub);
+
+
+/**
+ * What to do with pre-settled deliveries to an address when an outgoing link is backed up.
+ */
+typedef enum {
+    QDR_SHED_DROP_ALL,     ///< Discard every pre-settled delivery queued on the link (the default)
+    QDR_SHED_DROP_OLDEST,  ///< Discard queued pre-settled deliveries, oldest first, until under the limits
+    QDR_SHED_DROP_NEWEST,  ///< Discard the arriving delivery
+    QDR_SHED_CONFLATE      ///< Replace queued deliveries with the same conflation key, else drop the oldest
+} qdr_shed_mode_t;
+
+typedef struct {
+    qdr_shed_mode_t     mode;
+    int                 depth;         ///< Undelivered count that triggers shedding, 0 for the link capacity
+    uint64_t            octets;        ///< Undelivered octets that trigger shedding, 0 for no limit
+    qd_message_field_t  conflate_key;  ///< Message property that identifies the value being updated
+} qdr_shed_policy_t;
+
+extern const qdr_shed_policy_t qdr_shed_policy_default;  ///< For addresses with no configuration
+
+
+typedef struct {
+    uint64_t deliver[QDR_LATENCY_BUCKETS];  ///< Ingress until sent on one of the address's links
+    uint64_t settle[QDR_LATENCY_BUCKETS];   ///< Ingress until a delivery sent to the address was settled
+} qdr_address_latency_t;
+
+ALLOC_DECLARE(qdr_address_latency_t);
 
 struct qdr_address_t {
     DEQ_LINKS(qdr_address_t);
@@ -433,13 +837,16 @@ struct qdr_address_t {
     qdr_connection_ref_list_t  conns;         ///< Local Connections for route-destinations
     qdr_link_ref_list_t        rlinks;        ///< Locally-Connected Consumers
     qdr_link_ref_list_t        inlinks;       ///< Locally-Connected Producers
-    qd_bitmask_t              *rnodes;        ///< Bitmask of remote routers with connected consumers
+    qd_bitmask_t              *rnodes;        ///< Bitmask of remote routers with connected consumers, see qdr_address_rnode_set_CT
+    sys_atomic_t               view_paths;    ///< The path count as published to I/O threads, see qdr_addr_view_paths_CT
     qd_hash_handle_t          *hash_handle;   ///< Linkage back to the hash table entry
     qd_address_treatment_t     treatment;
     qdr_forwarder_t           *forwarder;
     int                        ref_count;     ///< Number of link-routes + auto-links referencing this address
+    qdr_link_t                *edge_link;     ///< [ref] Subscription proxy on the uplink (edge mode)
     bool                       block_deletion;
     bool                       local;
+    bool                       rnodes_owned;  ///< rnodes is the address's own mask rather than a shared one
     uint32_t                   tracked_deliveries;
     uint64_t                   cost_epoch;
 
@@ -453,6 +860,12 @@ struct qdr_address_t {
     // State for "balanced" treatment
     //
     int *outstanding_deliveries;
+    qdr_link_t **balance_heap;   ///< Min-heap of the local consumers (rlinks) by balance_key
+    int          balance_count;
+    int          balance_alloc;
+    uint64_t     balance_stamp;
+    int          group_affinity;        ///< Message groups to keep on one path, 0 for none
+    struct qdr_group_table_t *groups;   ///< The paths of recent groups, see qdr_forward_group_CT
     
     /**@name Statistics */
     ///@{
@@ -461,24 +874,59 @@ struct qdr_address_t {
     uint64_t deliveries_transit;
     uint64_t deliveries_to_container;
     uint64_t deliveries_from_container;
+    uint64_t dropped_presettled_deliveries;
+    qdr_address_latency_t *latency;     ///< Allocated when a delivery to the address is first sent on a local link
     ///@}
+
+    qdr_shed_policy_t    shed;              ///< Overflow policy for pre-settled deliveries, from the address configuration
+    qdr_multicast_rule_t multicast_rule;    ///< Settlement of unsettled multicast deliveries
+    int                  multicast_quorum;  ///< Acceptances needed for QDR_MULTICAST_QUORUM
 };
 
 ALLOC_DECLARE(qdr_address_t);
 DEQ_DECLARE(qdr_address_t, qdr_address_list_t);
 
 qdr_address_t *qdr_address_CT(qdr_core_t *core, qd_address_treatment_t treatment);
+
+/**
+ * Apply an address configuration (which may be null) to a newly created address.
+ */
+void qdr_address_configure_CT(qdr_address_t *addr, const qdr_address_config_t *config);
+
+/**
+ * Add or remove a remote router of an address.  Most addresses have at most one remote
+ * router, so such addresses share constant masks held by the core and get a mask of
+ * their own only when a second router is added.  rnodes may be read directly but must
+ * only be changed through these.  Clear returns true if the router was set.
+ */
+void qdr_address_rnode_set_CT(qdr_core_t *core, qdr_address_t *addr, int router_maskbit);
+bool qdr_address_rnode_clear_CT(qdr_core_t *core, qdr_address_t *addr, int router_maskbit);
 qdr_address_t *qdr_add_local_address_CT(qdr_core_t *core, char aclass, const char *addr, qd_address_treatment_t treatment);
 void qdr_core_remove_address(qdr_core_t *core, qdr_address_t *addr);
 
+/**
+ * Link-route patterns are keyed in addr_hash under the class 'E' (incoming)
+ * or 'F' (outgoing), the pattern counterparts of 'C' and 'D'.  Addresses with
+ * these keys are also indexed in the link-route pattern tree for their
+ * direction; this is undone by qdr_core_remove_address.
+ */
+#define QDR_LINK_ROUTE_PATTERN_IN  'E'
+#define QDR_LINK_ROUTE_PATTERN_OUT 'F'
+void qdr_core_index_link_route_pattern_CT(qdr_core_t *core, qdr_address_t *addr);
+
 struct qdr_address_config_t {
     DEQ_LINKS(qdr_address_config_t);
     qd_hash_handle_t       *hash_handle;
+    char                   *pattern;      ///< Set instead of hash_handle for a pattern configuration
     char                   *name;
     uint64_t                identity;
     qd_address_treatment_t  treatment;
     int                     in_phase;
     int                     out_phase;
+    qdr_shed_policy_t       shed;
+    qdr_multicast_rule_t    multicast_rule;
+    int                     multicast_quorum;
+    int                     group_affinity;
 };
 
 ALLOC_DECLARE(qdr_address_config_t);
@@ -508,10 +956,43 @@ struct qdr_connection_info_t {
     pn_data_t                  *connection_properties;
     bool                        ssl;
     int                         ssl_ssf; //ssl strength factor
+    qdr_compression_stats_t    *compression;
 };
 
 ALLOC_DECLARE(qdr_connection_info_t);
 
+//
+// The work locks of connections are shared from a fixed pool, chosen by connection
+// identity, instead of one mutex for each connection.  No connection's work lock is
+// ever taken while another's is held.
+//
+#define QDR_CONNECTION_WORK_LOCKS 256
+
+//
+// The address view: the keys of addr_hash, striped over hash tables that I/O threads
+// read under a read-write lock per stripe.  See addr_view.c.
+//
+#define QDR_ADDR_VIEW_STRIPES 16
+
+typedef struct {
+    sys_rwlock_t *lock;
+    qd_hash_t    *keys;
+} qdr_addr_view_stripe_t;
+
+void qdr_addr_view_setup(qdr_core_t *core);
+void qdr_addr_view_free(qdr_core_t *core);
+void qdr_addr_view_add_CT(qdr_core_t *core, qdr_address_t *addr);
+void qdr_addr_view_remove_CT(qdr_core_t *core, qdr_address_t *addr);
+void qdr_addr_view_paths_CT(qdr_address_t *addr);
+long qdr_addr_path_count_CT(qdr_address_t *addr);
+
+//
+// The sending links of a connection take turns of core->link_quantum octets.  After
+// about this many quanta in one qdr_connection_process the connection is woken again
+// rather than continuing, so the other connections of its worker are served meanwhile.
+//
+#define QDR_CONNECTION_PASS_QUANTA 8
+
 struct qdr_connection_t {
     DEQ_LINKS(qdr_connection_t);
     DEQ_LINKS_N(ACTIVATE, qdr_connection_t);
@@ -524,9 +1005,10 @@ struct qdr_connection_t {
     bool                        strip_annotations_in;
     bool                        strip_annotations_out;
     int                         link_capacity;
+    int                         link_capacity_max;
     int                         mask_bit;
     qdr_connection_work_list_t  work_list;
-    sys_mutex_t                *work_lock;
+    sys_mutex_t                *work_lock;       ///< One of the core's conn_work_locks
     qdr_link_ref_list_t         links;
     qdr_link_ref_list_t         links_with_deliveries;
     qdr_link_ref_list_t         links_with_work;
@@ -534,6 +1016,13 @@ struct qdr_connection_t {
     int                         tenant_space_len;
     qdr_connection_info_t      *connection_info;
     void                       *user_context; /* Updated from IO thread, use work_lock */
+    char                       *peer_container;  ///< Remote container id of an inter-router or inter-router-data connection
+    qdr_link_t                 *pool_data_link;  ///< Outgoing data link of an inter-router-data connection
+    qdr_rate_limits_t           rate_limits;     ///< As given when the connection was opened
+    qdr_rate_bucket_t          *rate_buckets[QDR_RATE_SCOPES];  ///< Connection, user and vhost buckets, 0 if unlimited
+    bool                        rate_limited;    ///< Some rate bucket is in use
+    bool                        rate_bytes;      ///< Some rate bucket limits octets
+    qdr_connection_t           *next_closed;     ///< Next connection closed by the same connection_closed action
 };
 
 ALLOC_DECLARE(qdr_connection_t);
@@ -558,6 +1047,7 @@ DEQ_DECLARE(qdr_link_route_t, qdr_link_route_list_t);
 
 typedef enum {
     QDR_AUTO_LINK_STATE_INACTIVE,
+    QDR_AUTO_LINK_STATE_QUEUED,
     QDR_AUTO_LINK_STATE_ATTACHING,
     QDR_AUTO_LINK_STATE_FAILED,
     QDR_AUTO_LINK_STATE_ACTIVE,
@@ -568,6 +1058,7 @@ typedef enum {
 struct qdr_auto_link_t {
     DEQ_LINKS(qdr_auto_link_t);
     DEQ_LINKS_N(REF, qdr_auto_link_t);
+    DEQ_LINKS_N(PENDING, qdr_auto_link_t);
     uint64_t               identity;
     char                  *name;
     qdr_address_t         *addr;
@@ -578,6 +1069,8 @@ struct qdr_auto_link_t {
     qdr_link_t            *link;
     qdr_auto_link_state_t  state;
     char                  *last_error;
+    qdr_connection_t      *pending_conn;  ///< Connection the queued auto-link is to attach on
+    bool                   waiting;       ///< Queued ahead of the others: local senders or receivers wait on it
 };
 
 ALLOC_DECLARE(qdr_auto_link_t);
@@ -601,23 +1094,97 @@ struct qdr_core_t {
     qd_log_source_t   *agent_log;
     sys_thread_t      *thread;
     bool               running;
-    qdr_action_list_t  action_list;
+
+    //
+    // Actions are pushed onto the action_stack of their lane without locking.
+    // The core thread swaps out a whole stack and processes it in FIFO order.
+    // action_depth counts the actions waiting on each stack.  The lock and
+    // condition are used only to park the core thread when it is idle;
+    // producers signal only if action_parked is non-zero.
+    //
+    sys_atomic_ptr_t   action_stack[QDR_ACTION_LANES];
+    sys_atomic_t       action_depth[QDR_ACTION_LANES];
+    sys_atomic_t       action_parked;
     sys_cond_t        *action_cond;
     sys_mutex_t       *action_lock;
 
+    //
+    // Idle behavior of the core thread: poll for up to spin_usec before parking.
+    // The accumulated times are maintained by the core thread.
+    //
+    int64_t            spin_usec;
+    uint64_t           spin_time_ns;
+    uint64_t           parked_time_ns;
+
+    //
+    // Saturation of the core thread.  busy_time_ns is the time spent neither
+    // spinning nor parked, and utilization the busy percentage of the last
+    // sampling window.  Each take of actions from the lanes is a drain;
+    // drained_actions / drains is the mean queue depth found and max_drain the
+    // deepest.  Maintained by the core thread.
+    //
+    uint64_t           busy_time_ns;
+    uint64_t           utilization;
+    uint64_t           window_start_ns;
+    uint64_t           window_idle_ns;
+    uint64_t           drains;
+    uint64_t           drained_actions;
+    uint64_t           max_drain;
+
+    //
+    // Router-wide delivery counters kept alongside the per-address ones, and the
+    // double buffer they are published through for readers on other threads.
+    // Slot (stats_seq & 1) holds the latest publication.
+    //
+    qdr_core_stats_t   stats;
+    qdr_core_stats_t   stats_slot[2];
+    sys_atomic_t       stats_seq;
+    uint64_t           stats_published_ns;
+
+    //
+    // The console feed: its address and the snapshot its last message was built from.
+    //
+    qdr_address_t     *console_addr;
+    qdr_core_stats_t   console_last;
+    uint64_t           console_sequence;
+
+    //
+    // Per-label action statistics.  Timing (service and queue-wait) is
+    // collected only if action_timing is set.
+    //
+    bool                action_timing;
+    int                 action_stats_count;
+    qdr_action_stats_t  action_stats[QDR_ACTION_STATS_MAX];
+    qdr_action_stats_t *action_stats_index[QDR_ACTION_STATS_INDEX_SIZE];
+
+    //
+    // General work is posted to the IO threads with qd_server_wake.  Only one
+    // thread processes the work list at a time (work_in_progress).
+    //
     sys_mutex_t             *work_lock;
     qdr_general_work_list_t  work_list;
-    qd_timer_t              *work_timer;
+    bool                     work_in_progress;
+
+    sys_mutex_t *conn_work_locks[QDR_CONNECTION_WORK_LOCKS];
+
+    qdr_addr_view_stripe_t addr_view[QDR_ADDR_VIEW_STRIPES];
 
     qdr_connection_list_t open_connections;
     qdr_link_list_t       open_links;
+    qdr_link_ref_list_t   links_withheld;  ///< Incoming links with credit held back for memory
+    qdr_link_ref_list_t   links_throttled; ///< Incoming links with credit held back by rate limits
+    qdr_rate_bucket_list_t rate_buckets;   ///< Rate buckets shared by connections
+    sys_atomic_t          rate_throttling; ///< Non-zero while links_throttled is not empty
+    sys_atomic_t          memory_withholding; ///< Non-zero while links_withheld is not empty
+    qdr_link_teardown_list_t link_teardowns; ///< Deliveries of cleaned-up links still to be released
+    bool                  link_teardown_scheduled; ///< A link_teardown action is queued
 
     //
     // Agent section
     //
     qdr_query_list_t       outgoing_query_list;
+    qdr_query_list_t       query_cursors;  ///< Paged queries holding a cursor into a live entity list
     sys_mutex_t           *query_lock;
-    qd_timer_t            *agent_timer;
     qdr_manage_response_t  agent_response_handler;
     qdr_subscription_t    *agent_subscription_mobile;
     qdr_subscription_t    *agent_subscription_local;
@@ -625,10 +1192,12 @@ struct qdr_core_t {
     //
     // Route table section
     //
-    void                 *rt_context;
-    qdr_mobile_added_t    rt_mobile_added;
-    qdr_mobile_removed_t  rt_mobile_removed;
-    qdr_link_lost_t       rt_link_lost;
+    void                     *rt_context;
+    qdr_mobile_changed_t      rt_mobile_changed;
+    qdr_link_lost_t           rt_link_lost;
+    qdr_mobile_change_list_t  mobile_changes;        ///< Not yet posted to rt_mobile_changed
+    qd_hash_t                *mobile_change_hash;    ///< address hash => pending change
+    uint64_t                  mobile_changes_since;  ///< When the oldest pending change was made
 
     //
     // Connection section
@@ -651,41 +1220,129 @@ struct qdr_core_t {
 
     qdr_address_config_list_t  addr_config;
     qdr_auto_link_list_t       auto_links;
+    qdr_auto_link_list_t       auto_links_waiting;  ///< Queued auto-links with waiting local links, attached first
+    qdr_auto_link_list_t       auto_links_pending;  ///< Other queued auto-links
+    int                        auto_link_attach_rate; ///< Attaches per second, 0 if unpaced
+    int                        link_quantum;        ///< Octets per turn of a connection's sending links, 0 for no turns
+    uint64_t                   spill_threshold;     ///< Undelivered octets on a link beyond which its messages are spilled
+    int                        auto_link_tokens;    ///< Attaches left in the current rate tick
+    bool                       auto_link_scheduled; ///< An auto_link_attach action is queued
+    sys_atomic_t               auto_link_paced;     ///< Non-zero while queued auto-links wait for the rate tick
     qdr_link_route_list_t      link_routes;
     qd_hash_t                 *conn_id_hash;
     qdr_address_list_t         addrs;
     qd_hash_t                 *addr_hash;
+    qd_parse_tree_t           *addr_parse_tree;     ///< Address configurations given as patterns
+    qd_parse_tree_t           *link_route_tree[2];  ///< Link-route pattern addresses, by qd_direction_t
     qdr_address_t             *hello_addr;
     qdr_address_t             *router_addr_L;
     qdr_address_t             *routerma_addr_L;
     qdr_address_t             *router_addr_T;
     qdr_address_t             *routerma_addr_T;
 
+    //
+    // Edge mode.  The uplink is the edge connection to the interior in use, and
+    // edge_uplink_link its anonymous link for messages going up.
+    //
+    qdr_connection_t          *edge_uplink;
+    qdr_link_t                *edge_uplink_link;
+
     qdr_node_list_t       routers;            ///< List of routers, in order of cost, from lowest to highest
     qd_bitmask_t         *neighbor_free_mask;
+    qd_bitmask_t         *rnodes_none;        ///< Shared rnodes of the addresses with no remote router
+    qd_bitmask_t        **rnodes_single;      ///< Per mask bit, shared rnodes of the addresses with only that router
     qdr_node_t          **routers_by_mask_bit;
     qdr_link_t          **control_links_by_mask_bit;
     qdr_link_t          **data_links_by_mask_bit;
+    qdr_link_ref_list_t  *data_link_pools_by_mask_bit;  ///< Extra data links from inter-router-data connections
+    qd_bitmask_t        **routers_by_origin;  ///< Per origin mask bit, the routers for which it is a valid origin
     uint64_t              cost_epoch;
+    bool                  route_delta_active;   ///< Applying a route-table commit, defer cost sorting
+    bool                  route_delta_resort;   ///< A router's cost changed during the commit
 
     uint64_t              next_tag;
 
-    uint64_t              next_identifier;
-    sys_mutex_t          *id_lock;
+    sys_atomic64_t        next_identifier;
+
+    uint64_t              next_discriminator;   ///< Dynamic addresses and link names generated
+    uint64_t              discriminator_key;
+    char                  discriminator_epoch[4];
+    char                 *temp_addr_prefix;     ///< amqp:/_topo/<area>/<id>/temp.
+    size_t                temp_addr_prefix_len;
 
     qdr_forwarder_t      *forwarders[QD_TREATMENT_LINK_BALANCED + 1];
 };
 
+/**
+ * The link to send a copy of a delivery up to the interior on, or 0 if there is no
+ * uplink or the delivery came down it.  Control messages never go up.
+ */
+static inline qdr_link_t *qdr_edge_uplink_CT(qdr_core_t *core, const qdr_delivery_t *in_dlv, bool control)
+{
+    qdr_link_t *uplink = core->edge_uplink_link;
+    if (!uplink || control || (in_dlv && in_dlv->link && in_dlv->link->conn == uplink->conn))
+        return 0;
+    return uplink;
+}
+
 void *router_core_thread(void *arg);
 uint64_t qdr_identifier(qdr_core_t* core);
+void qdr_discriminator_setup(qdr_core_t *core);
 void qdr_management_agent_on_message(void *context, qd_message_t *msg, int link_id, int cost);
 void  qdr_route_table_setup_CT(qdr_core_t *core);
+
+/**
+ * Add (or remove) a router node's valid origins to (from) core->routers_by_origin.
+ */
+void qdr_route_table_index_origins_CT(qdr_core_t *core, qdr_node_t *rnode, bool add);
 void  qdr_agent_setup_CT(qdr_core_t *core);
 void  qdr_forwarder_setup_CT(qdr_core_t *core);
 qdr_action_t *qdr_action(qdr_action_handler_t action_handler, const char *label);
 void qdr_action_enqueue(qdr_core_t *core, qdr_action_t *action);
+
+/**
+ * The newest action this thread has staged for the core, if it is handled by handler.
+ * The caller may fold more work into it; being the newest keeps the order of everything
+ * staged.  Returns 0 if no batch is active or the newest staged action is different.
+ */
+qdr_action_t *qdr_action_batch_tail(qdr_core_t *core, qdr_action_handler_t handler);
 void qdr_link_issue_credit_CT(qdr_core_t *core, qdr_link_t *link, int credit, bool drain);
+void qdr_link_release_withheld_credit_CT(qdr_core_t *core);
+
+/**
+ * Rate limits.  A connection's rate limits are token buckets, refilled continuously and
+ * holding at most one second of tokens.  Message tokens are taken when credit is issued
+ * to a client sender; octet tokens when its deliveries arrive, and no credit is issued
+ * while they are exhausted.  Credit that can't be issued is held on the link and
+ * released by qdr_core_rate_tick.
+ */
+void qdr_connection_rate_bind_CT(qdr_core_t *core, qdr_connection_t *conn);
+void qdr_connection_rate_unbind_CT(qdr_core_t *core, qdr_connection_t *conn);
+int  qdr_connection_rate_allow_CT(qdr_connection_t *conn, int credit);
+int  qdr_link_rate_limit_CT(qdr_core_t *core, qdr_link_t *link, int credit);
+void qdr_link_release_throttled_credit_CT(qdr_core_t *core);
+void qdr_link_rate_charge_CT(qdr_link_t *link, qdr_delivery_t *dlv);
+void qdr_rate_buckets_free(qdr_core_t *core);
 void qdr_addr_start_inlinks_CT(qdr_core_t *core, qdr_address_t *addr);
+
+/**
+ * Auto-links activated by a connection opening are queued and attached in batches,
+ * at most auto_link_attach_rate a second, those with local links waiting on them
+ * first.  The rate tick refills the allowance.
+ */
+void qdr_route_auto_link_tick_CT(qdr_core_t *core);
+
+/**
+ * Edge mode.  An edge router runs no routing protocol.  It uses one of its edge
+ * connections to the interior as the uplink, sends messages up it that have no local
+ * destination, and keeps a receiving link open on it for each of its local mobile
+ * addresses.  The mobile address changes that an interior router gives to the routing
+ * protocol go to qdr_edge_mobile_changes_CT instead, which consumes the list.
+ */
+void qdr_edge_connection_opened_CT(qdr_core_t *core, qdr_connection_t *conn);
+void qdr_edge_connection_closed_CT(qdr_core_t *core, qdr_connection_t *conn);
+void qdr_edge_mobile_changes_CT(qdr_core_t *core, qdr_mobile_change_list_t *changes);
+void qdr_edge_link_lost_CT(qdr_core_t *core, qdr_link_t *link, qdr_address_t *addr);
 void qdr_delivery_push_CT(qdr_core_t *core, qdr_delivery_t *dlv);
 void qdr_delivery_release_CT(qdr_core_t *core, qdr_delivery_t *delivery);
 void qdr_delivery_failed_CT(qdr_core_t *core, qdr_delivery_t *delivery);
@@ -693,18 +1350,105 @@ bool qdr_delivery_settled_CT(qdr_core_t *core, qdr_delivery_t *delivery);
 void qdr_delivery_decref_CT(qdr_core_t *core, qdr_delivery_t *delivery);
 void qdr_agent_enqueue_response_CT(qdr_core_t *core, qdr_query_t *query);
 
+#define QDR_STATS_PUBLISH_NS 100000000
+
+/**
+ * Publish the core's statistics for qdr_core_stats() readers.  Unless force is
+ * set, nothing is done if the last publication is less than
+ * QDR_STATS_PUBLISH_NS old.
+ */
+void qdr_publish_stats_CT(qdr_core_t *core, bool force);
+
+/**
+ * Position a paged query's cursor at the entity its next get_next should
+ * return, or clear it (entity == 0) when the query has run off the end.
+ */
+void qdr_agent_set_cursor_CT(qdr_core_t *core, qdr_query_t *query, void *entity);
+
+/**
+ * Step any query cursor resting on an entity that is about to be removed from
+ * its list onto the entity that follows it.  Must be called before the entity
+ * is unlinked.
+ */
+void qdr_agent_cursor_remove_CT(qdr_core_t *core, void *entity, void *next);
+
+/**
+ * Callbacks through which the filtering scan reads an entity's column and walks
+ * to the following entity of the same list.
+ */
+typedef void  (*qdr_agent_column_t)(qdr_core_t *core, qd_composed_field_t *field, int column, void *entity);
+typedef void *(*qdr_agent_next_t)(void *entity);
+
+/**
+ * Move *entity forward to the first entity from it onward that satisfies the
+ * query's filter, passing over query->filter_skip matches on the way.  Sets
+ * *entity to 0 if the list runs out.  Returns false if QDR_AGENT_SCAN_QUANTUM
+ * entities were examined without finishing; the cursor has then been parked on
+ * the next candidate and a get_next has been requeued to continue the scan, so
+ * the caller must return without responding.
+ */
+bool qdr_agent_scan_CT(qdr_core_t *core, qdr_query_t *query, void **entity,
+                       qdr_agent_column_t column, qdr_agent_next_t next);
+
+/**
+ * Write a delivery latency histogram (QDR_LATENCY_BUCKETS counts) as a list.
+ */
+void qdr_agent_insert_latency(qd_composed_field_t *body, const uint64_t *histogram);
+
 void qdr_post_mobile_added_CT(qdr_core_t *core, const char *address_hash);
 void qdr_post_mobile_removed_CT(qdr_core_t *core, const char *address_hash);
+
+/**
+ * Post the pending mobile-address changes to the route-table handler.  Unless force
+ * is set, this only happens once the oldest change has waited QDR_MOBILE_COALESCE_NS.
+ */
+void qdr_flush_mobile_changes_CT(qdr_core_t *core, bool force);
 void qdr_post_link_lost_CT(qdr_core_t *core, int link_maskbit);
 
 void qdr_post_general_work_CT(qdr_core_t *core, qdr_general_work_t *work);
 void qdr_check_addr_CT(qdr_core_t *core, qdr_address_t *addr, bool was_local);
 
 qdr_delivery_t *qdr_forward_new_delivery_CT(qdr_core_t *core, qdr_delivery_t *peer, qdr_link_t *link, qd_message_t *msg);
-void qdr_forward_deliver_CT(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv);
+qdr_delivery_t *qdr_forward_move_delivery_CT(qdr_core_t *core, qdr_delivery_t *peer, qdr_link_t *link, qd_message_t *msg); // takes msg
+
+/**
+ * Queue a delivery on an outgoing link.  If the delivery is pre-settled and the link is
+ * backed up, the overflow policy of addr (the default policy if addr is null) decides which
+ * pre-settled deliveries are discarded.
+ */
+void qdr_forward_deliver_CT(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv, qdr_address_t *addr);
+
+/**
+ * Queue a delivery on an outgoing link, taking a reference for the undelivered list.
+ * The caller holds the link's connection work_lock and activates the connection.
+ */
+void qdr_forward_push_LH(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv);
+
+/**
+ * Maintain the heap the balanced forwarder uses to pick the least-loaded local consumer.
+ * Links are added and removed along with the address's rlinks; update is called
+ * whenever a link's undelivered or unsettled count or its capacity may have changed.
+ */
+void qdr_forward_balance_add_CT(qdr_address_t *addr, qdr_link_t *link);
+void qdr_forward_balance_remove_CT(qdr_address_t *addr, qdr_link_t *link);
+void qdr_forward_balance_update_CT(qdr_link_t *link);
+
+/**
+ * Free the group affinity table of a balanced address.
+ */
+void qdr_forward_group_free_CT(qdr_address_t *addr);
+
+/**
+ * True if the local consumers of an address have fallen behind: the least-loaded consumer
+ * of a balanced address, or the first consumer otherwise, is at its capacity.  Only one
+ * link is looked at so the check is cheap enough for every delivery.
+ */
+bool qdr_forward_backlogged_CT(qdr_address_t *addr);
+void qdr_link_cut_through_CT(qdr_link_t *in_link, qdr_link_t *out_link);
+void qdr_link_cut_through_clear_CT(qdr_link_t *in_link);
 void qdr_connection_activate_CT(qdr_core_t *core, qdr_connection_t *conn);
-qd_address_treatment_t qdr_treatment_for_address_CT(qdr_core_t *core, qdr_connection_t *conn, qd_iterator_t *iter, int *in_phase, int *out_phase);
-qd_address_treatment_t qdr_treatment_for_address_hash_CT(qdr_core_t *core, qd_iterator_t *iter);
+qd_address_treatment_t qdr_treatment_for_address_CT(qdr_core_t *core, qdr_connection_t *conn, qd_iterator_t *iter, int *in_phase, int *out_phase, qdr_address_config_t **config);
+qd_address_treatment_t qdr_treatment_for_address_hash_CT(qdr_core_t *core, qd_iterator_t *iter, qdr_address_config_t **config);
 
 void qdr_connection_enqueue_work_CT(qdr_core_t            *core,
                                     qdr_connection_t      *conn,
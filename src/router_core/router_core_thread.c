@@ -18,6 +18,9 @@
  */
 
 #include "router_core_private.h"
+#include "probes.h"
+#include "profile.h"
+#include <string.h>
 
 /**
  * Creates a thread that is dedicated to managing and using the routing table.
@@ -29,48 +32,306 @@
 
 ALLOC_DEFINE(qdr_action_t);
 
+
+//
+// While working through a list of DATA lane actions, the CONTROL lane is checked
+// for new arrivals after this many actions.
+//
+#define QDR_CONTROL_LANE_POLL 16
+
+//
+// Shortest window over which the core thread's utilization is sampled.
+//
+#define QDR_UTILIZATION_WINDOW_NS 1000000000
+
+
+static bool qdr_actions_pending_CT(qdr_core_t *core)
+{
+    for (int lane = 0; lane < QDR_ACTION_LANES; lane++)
+        if (sys_atomic_ptr_get(&core->action_stack[lane]) != 0)
+            return true;
+    return false;
+}
+
+
+/**
+ * Poll the action stacks for up to core->spin_usec.  Returns true if an action
+ * arrived before the time ran out.
+ */
+static bool qdr_spin_for_actions_CT(qdr_core_t *core)
+{
+    uint64_t start    = qdr_monotonic_ns();
+    uint64_t deadline = start + core->spin_usec * 1000;
+    uint64_t now      = start;
+    bool     found    = false;
+
+    while (core->running) {
+        if (qdr_actions_pending_CT(core)) {
+            found = true;
+            break;
+        }
+        now = qdr_monotonic_ns();
+        if (now >= deadline)
+            break;
+    }
+
+    core->spin_time_ns += (found ? qdr_monotonic_ns() : now) - start;
+    return found;
+}
+
+
+static int qdr_histogram_bucket(uint64_t ns)
+{
+    uint64_t usec   = ns / 1000;
+    int      bucket = 0;
+    while (usec && bucket < QDR_ACTION_HISTOGRAM_BUCKETS - 1) {
+        usec >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+
+/**
+ * Find (or create) the statistics record for an action label.  Labels are
+ * string literals so the record is indexed by the label pointer; the string
+ * comparison is only needed the first time a given pointer is seen.
+ */
+static qdr_action_stats_t *qdr_action_stats_CT(qdr_core_t *core, const char *label)
+{
+    int slot = (int) (((uintptr_t) label >> 3) % QDR_ACTION_STATS_INDEX_SIZE);
+
+    for (int probe = 0; probe < QDR_ACTION_STATS_INDEX_SIZE; probe++) {
+        qdr_action_stats_t *stats = core->action_stats_index[slot];
+        if (!stats)
+            break;
+        if (stats->label == label)
+            return stats;
+        slot = (slot + 1) % QDR_ACTION_STATS_INDEX_SIZE;
+    }
+
+    //
+    // This label pointer has not been seen before.  It may be a duplicate literal
+    // of a known label, otherwise create a new record.
+    //
+    qdr_action_stats_t *stats = 0;
+    for (int i = 0; i < core->action_stats_count; i++) {
+        if (strcmp(core->action_stats[i].label, label) == 0) {
+            stats = &core->action_stats[i];
+            break;
+        }
+    }
+
+    if (!stats) {
+        if (core->action_stats_count == QDR_ACTION_STATS_MAX)
+            return 0;
+        stats = &core->action_stats[core->action_stats_count++];
+        stats->label = label;
+    }
+
+    if (!core->action_stats_index[slot])
+        core->action_stats_index[slot] = stats;
+    return stats;
+}
+
+
+/**
+ * Take all of the pending actions from one lane's action stack and append them,
+ * in the order in which they were enqueued, to the tail of action_list.
+ */
+static void qdr_take_actions_CT(qdr_core_t *core, qdr_action_lane_t lane, qdr_action_list_t *action_list)
+{
+    qdr_action_list_t  taken;
+    qdr_action_t      *action = (qdr_action_t*) sys_atomic_ptr_swap(&core->action_stack[lane], 0);
+
+    DEQ_INIT(taken);
+    while (action) {
+        qdr_action_t *next = action->next;
+        action->next = 0;
+        action->prev = 0;
+        DEQ_INSERT_HEAD(taken, action);
+        action = next;
+    }
+
+    if (DEQ_SIZE(taken))
+        sys_atomic_sub(&core->action_depth[lane], DEQ_SIZE(taken));
+    DEQ_APPEND(*action_list, taken);
+}
+
+
+/**
+ * Take the actions from all lanes, highest priority first.
+ */
+static void qdr_take_all_actions_CT(qdr_core_t *core, qdr_action_list_t *action_list)
+{
+    qdr_take_actions_CT(core, QDR_ACTION_LANE_CONTROL, action_list);
+    qdr_take_actions_CT(core, QDR_ACTION_LANE_DATA, action_list);
+}
+
+
+/**
+ * Close the utilization window if it is long enough.  Called at the top of every
+ * pass, so a window that ends in a long park is closed as soon as the thread wakes.
+ */
+static void qdr_sample_utilization_CT(qdr_core_t *core)
+{
+    uint64_t now     = qdr_monotonic_ns();
+    uint64_t elapsed = now - core->window_start_ns;
+    if (elapsed < QDR_UTILIZATION_WINDOW_NS)
+        return;
+
+    uint64_t idle_ns = core->spin_time_ns + core->parked_time_ns;
+    uint64_t idle    = idle_ns - core->window_idle_ns;
+    uint64_t busy    = idle < elapsed ? elapsed - idle : 0;
+
+    core->busy_time_ns   += busy;
+    core->utilization     = busy * 100 / elapsed;
+    core->window_start_ns = now;
+    core->window_idle_ns  = idle_ns;
+}
+
+
+static void qdr_record_drain_CT(qdr_core_t *core, uint64_t depth)
+{
+    core->drains++;
+    core->drained_actions += depth;
+    if (depth > core->max_drain)
+        core->max_drain = depth;
+}
+
+
 void *router_core_thread(void *arg)
 {
     qdr_core_t        *core = (qdr_core_t*) arg;
     qdr_action_list_t  action_list;
     qdr_action_t      *action;
 
+    qd_profile_thread("core");
+    if (core->qd->core_cpus && !sys_thread_bind_cpus(core->qd->core_cpus))
+        qd_log(core->log, QD_LOG_WARNING, "Unable to bind the core thread to CPUs %s", core->qd->core_cpus);
+
     qdr_forwarder_setup_CT(core);
     qdr_route_table_setup_CT(core);
     qdr_agent_setup_CT(core);
 
     qd_log(core->log, QD_LOG_INFO, "Router Core thread running. %s/%s", core->router_area, core->router_id);
+    core->window_start_ns = qdr_monotonic_ns();
     while (core->running) {
-        //
-        // Use the lock only to protect the condition variable and the action list
-        //
-        sys_mutex_lock(core->action_lock);
+        qdr_sample_utilization_CT(core);
 
         //
-        // Block on the condition variable when there is no action to do
+        // Take everything that has been enqueued since the last pass
         //
-        while (core->running && DEQ_IS_EMPTY(core->action_list))
-            sys_cond_wait(core->action_cond, core->action_lock);
+        DEQ_INIT(action_list);
+        qdr_take_all_actions_CT(core, &action_list);
 
-        //
-        // Move the entire action list to a private list so we can process it without
-        // holding the lock
-        //
-        DEQ_MOVE(core->action_list, action_list);
-        sys_mutex_unlock(core->action_lock);
+        if (DEQ_IS_EMPTY(action_list)) {
+            //
+            // The core is idle, report the mobile-address changes it has held back
+            // and bring the published statistics up to date.
+            //
+            qdr_flush_mobile_changes_CT(core, true);
+            qdr_publish_stats_CT(core, true);
+
+            //
+            // There is no action to do.  If so configured, poll for a while
+            // before giving up the CPU.
+            //
+            if (core->spin_usec && qdr_spin_for_actions_CT(core))
+                continue;
+
+            //
+            // Announce that this thread is parking before re-checking the stack
+            // so a concurrent producer either sees the announcement or has its
+            // action seen here.
+            //
+            uint64_t parked_at = qdr_monotonic_ns();
+            sys_mutex_lock(core->action_lock);
+            sys_atomic_inc(&core->action_parked);
+            while (core->running && !qdr_actions_pending_CT(core))
+                sys_cond_wait(core->action_cond, core->action_lock);
+            sys_atomic_dec(&core->action_parked);
+            sys_mutex_unlock(core->action_lock);
+            core->parked_time_ns += qdr_monotonic_ns() - parked_at;
+            continue;
+        }
+
+        qdr_record_drain_CT(core, DEQ_SIZE(action_list));
 
         //
         // Process and free all of the action items in the list
         //
+        bool     timing     = core->action_timing;
+        uint64_t now        = timing ? qdr_monotonic_ns() : 0;
+        int      since_poll = 0;
+
         action = DEQ_HEAD(action_list);
         while (action) {
             DEQ_REMOVE_HEAD(action_list);
-            if (action->label)
+
+            //
+            // Periodically let newly arrived control actions overtake the
+            // remaining data actions.
+            //
+            if (++since_poll == QDR_CONTROL_LANE_POLL) {
+                since_poll = 0;
+                if (!DEQ_IS_EMPTY(action_list) && sys_atomic_ptr_get(&core->action_stack[QDR_ACTION_LANE_CONTROL])) {
+                    qdr_action_list_t control_list;
+                    DEQ_INIT(control_list);
+                    qdr_take_actions_CT(core, QDR_ACTION_LANE_CONTROL, &control_list);
+                    qdr_record_drain_CT(core, DEQ_SIZE(control_list));
+                    DEQ_APPEND(control_list, action_list);
+                    DEQ_MOVE(control_list, action_list);
+                }
+            }
+            qdr_action_stats_t *stats = 0;
+            if (action->label) {
                 qd_log(core->log, QD_LOG_TRACE, "Core action '%s'%s", action->label, core->running ? "" : " (discard)");
+                stats = qdr_action_stats_CT(core, action->label);
+            }
+
+            if (stats && timing && action->enqueued_at && now > action->enqueued_at) {
+                uint64_t wait = now - action->enqueued_at;
+                stats->wait_ns += wait;
+                stats->wait_histogram[qdr_histogram_bucket(wait)]++;
+            }
+            QD_PROBE1(core_action, action->label);
+
             action->action_handler(core, action, !core->running);
             free_qdr_action_t(action);
+
+            if (stats)
+                stats->count++;
+
+            if (timing) {
+                uint64_t end = qdr_monotonic_ns();
+                if (stats) {
+                    uint64_t service = end - now;
+                    stats->service_ns += service;
+                    if (service > stats->max_service_ns)
+                        stats->max_service_ns = service;
+                    stats->service_histogram[qdr_histogram_bucket(service)]++;
+                }
+                now = end;
+            }
             action = DEQ_HEAD(action_list);
         }
+
+        qdr_flush_mobile_changes_CT(core, false);
+        qdr_publish_stats_CT(core, false);
+    }
+
+    //
+    // Discard any actions that were enqueued after the last pass
+    //
+    DEQ_INIT(action_list);
+    qdr_take_all_actions_CT(core, &action_list);
+    action = DEQ_HEAD(action_list);
+    while (action) {
+        DEQ_REMOVE_HEAD(action_list);
+        action->action_handler(core, action, true);
+        free_qdr_action_t(action);
+        action = DEQ_HEAD(action_list);
     }
 
     qd_log(core->log, QD_LOG_INFO, "Router Core thread exited");
@@ -18,14 +18,27 @@
  */
 
 #include "router_core_private.h"
+#include "core_record.h"
+#include "probes.h"
+#include "path_trace.h"
 #include <qpid/dispatch/amqp.h>
+#include <qpid/dispatch/buffer.h>
 #include <stdio.h>
 
 static void qdr_link_deliver_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_link_flow_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
+static void qdr_link_grant_credit_CT(qdr_core_t *core, qdr_link_t *link, int credit, bool drain);
+static void qdr_link_continue_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_send_to_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_update_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
 static void qdr_delete_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool discard);
+static qdr_link_bridge_t *qdr_link_bridge_enter(qdr_link_t *link, bool *bypass);
+static void qdr_link_bridge_deliver_LH(qdr_core_t *core, qdr_link_bridge_t *bridge, qdr_delivery_t *dlv,
+                                       const uint8_t *tag, int tag_length);
+static void qdr_link_bridge_update_LH(qdr_link_bridge_t *bridge, qdr_delivery_t *dlv, uint64_t disp, bool settled,
+                                      qdr_error_t *error, bool ref_given);
+static void qdr_link_bridge_leave(qdr_link_bridge_t *bridge);
+static void qdr_link_bridge_done(qdr_link_bridge_t *bridge);
 
 //==================================================================================
 // Internal Functions
@@ -35,6 +48,15 @@ void qdr_delivery_read_extension_state(qdr_delivery_t *dlv, uint64_t disposition
 void qdr_delivery_copy_extension_state(qdr_delivery_t *src, qdr_delivery_t *dest, bool update_disposition);
 
 
+static void qdr_record_delivery(qdr_delivery_t *dlv, uint8_t flags, uint32_t addr_hash)
+{
+    qdr_link_t *link = dlv->link;
+    qd_core_record(QD_CORE_RECORD_DELIVER, flags | (dlv->settled ? QD_CORE_RECORD_SETTLED : 0),
+                   link->conn->identity, link->identity, dlv->sequence, 0,
+                   (uint32_t) qd_message_size(dlv->msg), addr_hash);
+}
+
+
 //==================================================================================
 // Interface Functions
 //==================================================================================
@@ -55,8 +77,15 @@ qdr_delivery_t *qdr_link_deliver(qdr_link_t *link, qd_message_t *msg, qd_iterato
     dlv->presettled     = settled;
     dlv->link_exclusion = link_exclusion;
     dlv->error          = 0;
+    dlv->sequence       = ++link->arrival_sequence;
+    dlv->ingress_ns     = qdr_monotonic_ns();
+    QD_PROBE2(link_deliver, link, dlv);
 
     action->args.connection.delivery = dlv;
+    if (link->link_type == QD_LINK_CONTROL)
+        action->lane = QDR_ACTION_LANE_CONTROL;
+    if (qd_core_record_enabled())
+        qdr_record_delivery(dlv, 0, 0);
     qdr_action_enqueue(link->core, action);
     return dlv;
 }
@@ -79,8 +108,15 @@ qdr_delivery_t *qdr_link_deliver_to(qdr_link_t *link, qd_message_t *msg,
     dlv->presettled     = settled;
     dlv->link_exclusion = link_exclusion;
     dlv->error          = 0;
+    dlv->sequence       = ++link->arrival_sequence;
+    dlv->ingress_ns     = qdr_monotonic_ns();
+    QD_PROBE2(link_deliver, link, dlv);
 
     action->args.connection.delivery = dlv;
+    if (link->link_type == QD_LINK_CONTROL)
+        action->lane = QDR_ACTION_LANE_CONTROL;
+    if (qd_core_record_enabled())
+        qdr_record_delivery(dlv, QD_CORE_RECORD_ADDRESSED, qd_core_record_hash(addr));
     qdr_action_enqueue(link->core, action);
     return dlv;
 }
@@ -92,9 +128,8 @@ qdr_delivery_t *qdr_link_deliver_to_routed_link(qdr_link_t *link, qd_message_t *
 {
     if (tag_length > 32)
         return 0;
-    
-    qdr_action_t   *action = qdr_action(qdr_link_deliver_CT, "link_deliver");
-    qdr_delivery_t *dlv    = new_qdr_delivery_t();
+
+    qdr_delivery_t *dlv = new_qdr_delivery_t();
 
     ZERO(dlv);
     sys_atomic_init(&dlv->ref_count, 1); // referenced by the action
@@ -103,10 +138,35 @@ qdr_delivery_t *qdr_link_deliver_to_routed_link(qdr_link_t *link, qd_message_t *
     dlv->settled    = settled;
     dlv->presettled = settled;
     dlv->error      = 0;
+    dlv->sequence   = ++link->arrival_sequence;
+    dlv->ingress_ns = qdr_monotonic_ns();
+    QD_PROBE2(link_deliver, link, dlv);
 
     qdr_delivery_read_extension_state(dlv, disposition, disposition_data, true);
 
+    if (qd_core_record_enabled())
+        qdr_record_delivery(dlv, QD_CORE_RECORD_ROUTED, 0);
+
+    //
+    // Once the link route is established, a complete message goes straight to the peer
+    // link from this thread.  The action reference is then the unsettled reference, or
+    // is released at once if the delivery is settled.
+    //
+    bool               bypass = false;
+    qdr_link_bridge_t *bridge = qdr_link_bridge_enter(link, &bypass);
+    if (bypass && qd_message_receive_complete(msg)) {
+        qdr_link_bridge_deliver_LH(link->core, bridge, dlv, tag, tag_length);
+        qdr_link_bridge_leave(bridge);
+        return dlv;
+    }
+
+    qdr_action_t *action = qdr_action(qdr_link_deliver_CT, "link_deliver");
     action->args.connection.delivery = dlv;
+    if (bridge) {
+        bridge->core_pending++;
+        sys_mutex_unlock(bridge->lock);
+        action->args.connection.bridge = bridge;
+    }
     action->args.connection.tag_length = tag_length;
     memcpy(action->args.connection.tag, tag, tag_length);
     qdr_action_enqueue(link->core, action);
@@ -114,20 +174,72 @@ qdr_delivery_t *qdr_link_deliver_to_routed_link(qdr_link_t *link, qd_message_t *
 }
 
 
-void qdr_link_process_deliveries(qdr_core_t *core, qdr_link_t *link, int credit)
+//
+// The most deliveries qdr_link_process_deliveries takes from a link per acquisition of
+// the connection's work lock.
+//
+#define QDR_SEND_BATCH_MAX 32
+
+int qdr_link_process_deliveries(qdr_core_t *core, qdr_link_t *link, int credit)
 {
     qdr_connection_t *conn = link->conn;
     qdr_delivery_t   *dlv;
     bool              drained = false;
     int               offer   = -1;
     bool              settled = false;
+    int               sent    = 0;
+    bool              turns   = core->link_quantum > 0;
 
+    link->drr_limited = false;
     if (link->link_direction == QD_OUTGOING) {
-        while (credit > 0 && !drained) {
+        //
+        // Finish sending a delivery whose message was still arriving the last time through.
+        // It already took its credit.  Until it is done, nothing else may be sent on the link.
+        //
+        sys_mutex_lock(conn->work_lock);
+        dlv = link->streaming_delivery;
+        sys_mutex_unlock(conn->work_lock);
+
+        if (dlv) {
+            if (!core->deliver_handler(core->user_context, link, dlv, dlv->presettled))
+                return 0;
+
+            sys_mutex_lock(conn->work_lock);
+            link->streaming_delivery = 0;
+            sys_mutex_unlock(conn->work_lock);
+            qdr_delivery_decref(core, dlv);
+        }
+
+        while (credit > 0 && !drained && !link->drr_limited) {
+            qdr_delivery_t *batch[QDR_SEND_BATCH_MAX];
+            bool            batch_settled[QDR_SEND_BATCH_MAX];
+            int             count  = 0;
+            uint64_t        octets = 0;
+
+            //
+            // Take the next deliveries for the credit in one critical section.  A delivery
+            // whose message is still arriving ends the batch since it may not be sent whole.
+            //
             sys_mutex_lock(conn->work_lock);
-            dlv = DEQ_HEAD(link->undelivered);
-            if (dlv) {
+            while (count < credit && count < QDR_SEND_BATCH_MAX) {
+                dlv = DEQ_HEAD(link->undelivered);
+                if (!dlv) {
+                    drained = true;
+                    break;
+                }
+                if (turns && link->drr_deficit - (int64_t) octets <= 0) {
+                    //
+                    // The link's turn is over; qdr_connection_process gives it another
+                    // after the connection's other sending links have had theirs.
+                    //
+                    link->drr_limited = true;
+                    break;
+                }
                 DEQ_REMOVE_HEAD(link->undelivered);
+                link->undelivered_octets -= dlv->queued_octets;
+                link->priority_depth[dlv->priority]--;
+                if (dlv->priority_key > link->priority_vtime)
+                    link->priority_vtime = dlv->priority_key;
                 dlv->link_work = 0;
                 settled = dlv->settled;
                 if (!settled) {
@@ -136,16 +248,53 @@ void qdr_link_process_deliveries(qdr_core_t *core, qdr_link_t *link, int credit)
                 } else
                     dlv->where = QDR_DELIVERY_NOWHERE;
 
-                credit--;
-                link->total_deliveries++;
-                offer = DEQ_SIZE(link->undelivered);
-            } else
-                drained = true;
+                dlv->sequence = ++link->total_deliveries;
+                octets += dlv->queued_octets;
+                batch_settled[count] = settled;
+                batch[count++] = dlv;
+                if (!qd_message_receive_complete(dlv->msg))
+                    break;
+            }
+            offer = DEQ_SIZE(link->undelivered);
             sys_mutex_unlock(conn->work_lock);
+            link->drr_deficit -= octets;
 
-            if (dlv) {
+            for (int i = 0; i < count; i++) {
+                dlv     = batch[i];
+                settled = batch_settled[i];
+                credit--;
+                sent++;
                 link->credit_to_core--;
-                core->deliver_handler(core->user_context, link, dlv, settled);
+                dlv->deliver_ns = qdr_monotonic_ns();
+                if (dlv->ingress_ns)
+                    qdr_latency_record(link->deliver_latency, dlv->deliver_ns - dlv->ingress_ns);
+                if (!core->deliver_handler(core->user_context, link, dlv, settled)) {
+                    //
+                    // The rest of the message is still arriving.  Hold the delivery on the
+                    // link (taking over the reference of a settled delivery) and leave the
+                    // remaining credit for when its content has all been sent.  Deliveries
+                    // taken behind it go back to the head of the undelivered list.
+                    //
+                    if (!settled)
+                        qdr_delivery_incref(dlv);
+                    sys_mutex_lock(conn->work_lock);
+                    link->streaming_delivery = dlv;
+                    for (int j = count - 1; j > i; j--) {
+                        qdr_delivery_t *back = batch[j];
+                        if (back->where == QDR_DELIVERY_IN_UNSETTLED)
+                            DEQ_REMOVE(link->unsettled, back);
+                        else if (!batch_settled[j])
+                            continue;  // Settled and released by the core meanwhile
+                        DEQ_INSERT_HEAD(link->undelivered, back);
+                        back->where = QDR_DELIVERY_IN_UNDELIVERED;
+                        link->undelivered_octets += back->queued_octets;
+                        link->priority_depth[back->priority]++;
+                        link->total_deliveries--;
+                        link->drr_deficit += back->queued_octets;
+                    }
+                    sys_mutex_unlock(conn->work_lock);
+                    return sent;
+                }
                 if (settled)
                     qdr_delivery_decref(core, dlv);
             }
@@ -156,12 +305,18 @@ void qdr_link_process_deliveries(qdr_core_t *core, qdr_link_t *link, int credit)
         else if (offer != -1)
             core->offer_handler(core->user_context, link, offer);
     }
+
+    if (link->drr_limited)
+        return sent;
+    return sent + credit;
 }
 
 
 void qdr_link_flow(qdr_core_t *core, qdr_link_t *link, int credit, bool drain_mode)
 {
-    qdr_action_t *action = qdr_action(qdr_link_flow_CT, "link_flow");
+    if (qd_core_record_enabled())
+        qd_core_record(QD_CORE_RECORD_FLOW, drain_mode ? QD_CORE_RECORD_DRAIN : 0,
+                       link->conn->identity, link->identity, 0, credit, 0, 0);
 
     //
     // Compute the number of credits now available that we haven't yet given
@@ -173,14 +328,42 @@ void qdr_link_flow(qdr_core_t *core, qdr_link_t *link, int credit, bool drain_mo
         credit = 0;
     link->credit_to_core += credit;
 
+    //
+    // While the link's last flow is still waiting for the core, this one is folded into
+    // it: the credit is added and the drain mode replaced.
+    //
+    sys_mutex_lock(link->conn->work_lock);
+    qdr_action_t *action = link->flow_action;
+    if (action) {
+        action->args.connection.credit += credit;
+        action->args.connection.drain   = drain_mode;
+    }
+    sys_mutex_unlock(link->conn->work_lock);
+    if (action)
+        return;
+
+    action = qdr_action(qdr_link_flow_CT, "link_flow");
     action->args.connection.link   = link;
     action->args.connection.credit = credit;
     action->args.connection.drain  = drain_mode;
 
+    sys_mutex_lock(link->conn->work_lock);
+    link->flow_action = action;
+    sys_mutex_unlock(link->conn->work_lock);
     qdr_action_enqueue(core, action);
 }
 
 
+void qdr_link_continue_delivery(qdr_link_t *link, bool complete)
+{
+    qdr_action_t *action = qdr_action(qdr_link_continue_delivery_CT, "link_continue_delivery");
+
+    action->args.connection.link     = link;
+    action->args.connection.complete = complete;
+    qdr_action_enqueue(link->core, action);
+}
+
+
 void qdr_send_to1(qdr_core_t *core, qd_message_t *msg, qd_iterator_t *addr, bool exclude_inprocess, bool control)
 {
     qdr_action_t *action = qdr_action(qdr_send_to_CT, "send_to");
@@ -188,6 +371,8 @@ void qdr_send_to1(qdr_core_t *core, qd_message_t *msg, qd_iterator_t *addr, bool
     action->args.io.message           = qd_message_copy(msg);
     action->args.io.exclude_inprocess = exclude_inprocess;
     action->args.io.control           = control;
+    if (control)
+        action->lane = QDR_ACTION_LANE_CONTROL;
 
     qdr_action_enqueue(core, action);
 }
@@ -200,22 +385,79 @@ void qdr_send_to2(qdr_core_t *core, qd_message_t *msg, const char *addr, bool ex
     action->args.io.message           = qd_message_copy(msg);
     action->args.io.exclude_inprocess = exclude_inprocess;
     action->args.io.control           = control;
+    if (control)
+        action->lane = QDR_ACTION_LANE_CONTROL;
 
     qdr_action_enqueue(core, action);
 }
 
 
+//
+// Fold a delivery into the newest staged action if it is of the given kind and has room.
+// Actions counted by a link bridge are never extended.
+//
+static bool qdr_delivery_batch_fold(qdr_core_t *core, qdr_action_handler_t handler, qdr_delivery_t *delivery,
+                                    uint64_t disposition, bool settled, qdr_error_t *error)
+{
+    qdr_action_t *tail = qdr_action_batch_tail(core, handler);
+
+    if (!tail || tail->args.delivery.bridge)
+        return false;
+
+    qdr_delivery_batch_t *batch = tail->args.delivery.batch;
+    if (!batch) {
+        batch = new_qdr_delivery_batch_t();
+        batch->count = 0;
+        tail->args.delivery.batch = batch;
+    } else if (batch->count == QDR_DELIVERY_BATCH_MAX)
+        return false;
+
+    qdr_delivery_batch_entry_t *update = &batch->updates[batch->count++];
+    update->delivery    = delivery;
+    update->disposition = disposition;
+    update->settled     = settled;
+    update->error       = error;
+    return true;
+}
+
+
 void qdr_delivery_update_disposition(qdr_core_t *core, qdr_delivery_t *delivery, uint64_t disposition,
                                      bool settled, qdr_error_t *error, pn_data_t *ext_state, bool ref_given)
 {
+    // handle delivery-state extensions e.g. declared, transactional-state
+    qdr_delivery_read_extension_state(delivery, disposition, ext_state, false);
+    QD_PROBE3(delivery_disposition, delivery, disposition, settled);
+
+    if (qd_core_record_enabled() && delivery->link)
+        qd_core_record(QD_CORE_RECORD_DISPOSITION, settled ? QD_CORE_RECORD_SETTLED : 0,
+                       delivery->link->conn->identity, delivery->link->identity, delivery->sequence,
+                       disposition, 0, 0);
+
     qdr_action_t *action = qdr_action(qdr_update_delivery_CT, "update_delivery");
     action->args.delivery.delivery    = delivery;
     action->args.delivery.disposition = disposition;
     action->args.delivery.settled     = settled;
     action->args.delivery.error       = error;
 
-    // handle delivery-state extensions e.g. declared, transactional-state
-    qdr_delivery_read_extension_state(delivery, disposition, ext_state, false);
+    //
+    // Between the deliveries of an established link route, the update is made from this
+    // thread unless some earlier delivery or update for the route is still with the core.
+    //
+    if (delivery->link && delivery->link->connected_link) {
+        bool               bypass = false;
+        qdr_link_bridge_t *bridge = qdr_link_bridge_enter(delivery->link, &bypass);
+        if (bypass) {
+            free_qdr_action_t(action);
+            qdr_link_bridge_update_LH(bridge, delivery, disposition, settled, error, ref_given);
+            qdr_link_bridge_leave(bridge);
+            return;
+        }
+        if (bridge) {
+            bridge->core_pending++;
+            sys_mutex_unlock(bridge->lock);
+            action->args.delivery.bridge = bridge;
+        }
+    }
 
     //
     // The delivery's ref_count must be incremented to protect its travels into the
@@ -225,6 +467,12 @@ void qdr_delivery_update_disposition(qdr_core_t *core, qdr_delivery_t *delivery,
     if (!ref_given)
         qdr_delivery_incref(delivery);
 
+    if (!action->args.delivery.bridge &&
+        qdr_delivery_batch_fold(core, qdr_update_delivery_CT, delivery, disposition, settled, error)) {
+        free_qdr_action_t(action);
+        return;
+    }
+
     qdr_action_enqueue(core, action);
 }
 
@@ -256,6 +504,9 @@ void qdr_delivery_decref(qdr_core_t *core, qdr_delivery_t *delivery)
         // The delivery deletion must occur inside the core thread.
         // Queue up an action to do the work.
         //
+        if (qdr_delivery_batch_fold(core, qdr_delete_delivery_CT, delivery, 0, false, 0))
+            return;
+
         qdr_action_t *action = qdr_action(qdr_delete_delivery_CT, "delete_delivery");
         action->args.delivery.delivery = delivery;
         qdr_action_enqueue(core, action);
@@ -275,6 +526,11 @@ qd_message_t *qdr_delivery_message(const qdr_delivery_t *delivery)
     return delivery->msg;
 }
 
+uint64_t qdr_delivery_handoff_ns(const qdr_delivery_t *delivery)
+{
+    return delivery->deliver_ns;
+}
+
 qdr_error_t *qdr_delivery_error(const qdr_delivery_t *delivery)
 {
     return delivery->error;
@@ -337,9 +593,11 @@ bool qdr_delivery_settled_CT(qdr_core_t *core, qdr_delivery_t *dlv)
         return false;
 
     //
-    // The lock needs to be acquired only for outgoing links
+    // The lock needs to be acquired only for outgoing links, and for routed links
+    // whose unsettled lists I/O threads also change (see qdr_link_bridge_t)
     //
-    if (link->link_direction == QD_OUTGOING)
+    bool locked = link->link_direction == QD_OUTGOING || link->bridge;
+    if (locked)
         sys_mutex_lock(conn->work_lock);
 
     if (dlv->where == QDR_DELIVERY_IN_UNSETTLED) {
@@ -348,8 +606,10 @@ bool qdr_delivery_settled_CT(qdr_core_t *core, qdr_delivery_t *dlv)
         moved = true;
     }
 
-    if (link->link_direction == QD_OUTGOING)
+    if (locked)
         sys_mutex_unlock(conn->work_lock);
+    if (link->link_direction == QD_OUTGOING)
+        qdr_forward_balance_update_CT(link);
 
     if (dlv->tracking_addr) {
         dlv->tracking_addr->outstanding_deliveries[dlv->tracking_addr_bit]--;
@@ -374,16 +634,64 @@ bool qdr_delivery_settled_CT(qdr_core_t *core, qdr_delivery_t *dlv)
 }
 
 
-static void qdr_delete_delivery_internal_CT(qdr_core_t *core, qdr_delivery_t *delivery)
+//
+// Free a delivery and account for its outcome in counts, which are its link's or, on an
+// I/O thread, those kept for the link in its bridge.  Anything that touches the core's
+// address state is left to qdr_delete_delivery_internal_CT.
+//
+static void qdr_delivery_free(qdr_delivery_t *delivery, qdr_link_counts_t *counts)
 {
-    qdr_link_t *link = delivery->link;
-
     if (delivery->msg)
         qd_message_free(delivery->msg);
 
     if (delivery->to_addr)
         qd_iterator_free(delivery->to_addr);
 
+    if (delivery->link) {
+        if (delivery->presettled)
+            counts->presettled++;
+        else if (delivery->disposition == PN_ACCEPTED)
+            counts->accepted++;
+        else if (delivery->disposition == PN_REJECTED)
+            counts->rejected++;
+        else if (delivery->disposition == PN_RELEASED)
+            counts->released++;
+        else if (delivery->disposition == PN_MODIFIED)
+            counts->modified++;
+
+        if (!delivery->presettled && delivery->ingress_ns)
+            qdr_latency_record(counts->settle_latency, qdr_monotonic_ns() - delivery->ingress_ns);
+    }
+
+    if (delivery->multicast)
+        free_qdr_multicast_t(delivery->multicast);
+
+    qd_bitmask_free(delivery->link_exclusion);
+    qdr_error_free(delivery->error);
+    free_qdr_delivery_t(delivery);
+}
+
+
+static void qdr_delete_delivery_internal_CT(qdr_core_t *core, qdr_delivery_t *delivery)
+{
+    bool        had_msg = delivery->msg != 0;
+    qdr_link_t *link    = delivery->link;
+
+    //
+    // Account a delivery sent to an address in the address's latency histograms
+    //
+    if (link && link->link_direction == QD_OUTGOING && link->owning_addr &&
+        delivery->deliver_ns && delivery->ingress_ns) {
+        qdr_address_t *addr = link->owning_addr;
+        if (!addr->latency) {
+            addr->latency = new_qdr_address_latency_t();
+            ZERO(addr->latency);
+        }
+        qdr_latency_record(addr->latency->deliver, delivery->deliver_ns - delivery->ingress_ns);
+        if (!delivery->presettled)
+            qdr_latency_record(addr->latency->settle, qdr_monotonic_ns() - delivery->ingress_ns);
+    }
+
     if (delivery->tracking_addr) {
         delivery->tracking_addr->outstanding_deliveries[delivery->tracking_addr_bit]--;
         delivery->tracking_addr->tracked_deliveries--;
@@ -394,22 +702,10 @@ static void qdr_delete_delivery_internal_CT(qdr_core_t *core, qdr_delivery_t *de
         delivery->tracking_addr = 0;
     }
 
-    if (link) {
-        if (delivery->presettled)
-            link->presettled_deliveries++;
-        else if (delivery->disposition == PN_ACCEPTED)
-            link->accepted_deliveries++;
-        else if (delivery->disposition == PN_REJECTED)
-            link->rejected_deliveries++;
-        else if (delivery->disposition == PN_RELEASED)
-            link->released_deliveries++;
-        else if (delivery->disposition == PN_MODIFIED)
-            link->modified_deliveries++;
-    }
+    qdr_delivery_free(delivery, link ? &link->counts : 0);
 
-    qd_bitmask_free(delivery->link_exclusion);
-    qdr_error_free(delivery->error);
-    free_qdr_delivery_t(delivery);
+    if (had_msg)
+        qdr_link_release_withheld_credit_CT(core);
 }
 
 
@@ -423,14 +719,50 @@ void qdr_delivery_decref_CT(qdr_core_t *core, qdr_delivery_t *dlv)
 }
 
 
+void qdr_multicast_settled_CT(qdr_core_t *core, qdr_delivery_t *in_dlv, qdr_delivery_t *copy, uint64_t disposition)
+{
+    qdr_multicast_t *mcast = in_dlv->multicast;
+
+    copy->peer = 0;
+
+    if (!mcast->complete) {
+        mcast->outstanding--;
+        if (disposition == PN_ACCEPTED)
+            mcast->accepted++;
+
+        if (mcast->accepted >= mcast->needed || mcast->accepted + mcast->outstanding < mcast->needed) {
+            mcast->complete = true;
+
+            in_dlv->disposition = mcast->accepted >= mcast->needed ? PN_ACCEPTED : (disposition ? disposition : PN_RELEASED);
+            in_dlv->settled     = true;
+            if (qdr_delivery_settled_CT(core, in_dlv)) {
+                qdr_delivery_push_CT(core, in_dlv);
+                qdr_delivery_decref_CT(core, in_dlv);
+            }
+        }
+    }
+
+    //
+    // Release the references of the copy's peer linkage
+    //
+    qdr_delivery_decref_CT(core, copy);
+    qdr_delivery_decref_CT(core, in_dlv);
+}
+
+
 static void qdr_link_flow_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
 {
     if (discard)
         return;
 
-    qdr_link_t *link      = action->args.connection.link;
+    qdr_link_t *link = action->args.connection.link;
+
+    sys_mutex_lock(link->conn->work_lock);
+    link->flow_action     = 0;
     int  credit           = action->args.connection.credit;
     bool drain            = action->args.connection.drain;
+    sys_mutex_unlock(link->conn->work_lock);
+
     bool activate         = false;
     bool drain_was_set    = !link->drain_mode && drain;
     qdr_link_work_t *work = 0;
@@ -478,6 +810,7 @@ static void qdr_link_flow_CT(qdr_core_t *core, qdr_action_t *action, bool discar
             activate = true;
         }
         sys_mutex_unlock(link->conn->work_lock);
+        qdr_forward_balance_update_CT(link);
     }
 
     //
@@ -493,19 +826,59 @@ static void qdr_link_flow_CT(qdr_core_t *core, qdr_action_t *action, bool discar
  * Note that even if there are more than zero paths, the destination still may
  * be unreachable (e.g. an rnode next hop with no link).
  */
-static long qdr_addr_path_count_CT(qdr_address_t *addr)
+long qdr_addr_path_count_CT(qdr_address_t *addr)
 {
     return (long) DEQ_SIZE(addr->subscriptions) + (long) DEQ_SIZE(addr->rlinks) +
         (long) qd_bitmask_cardinality(addr->rnodes);
 }
 
 
+//
+// Find the address an incoming delivery is to be forwarded to.
+//
+static qdr_address_t *qdr_link_delivery_addr_CT(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv)
+{
+    qdr_address_t *addr = link->owning_addr;
+    if (!addr && dlv->to_addr) {
+        qdr_connection_t *conn = link->conn;
+        if (conn && conn->tenant_space)
+            qd_iterator_annotate_space(dlv->to_addr, conn->tenant_space, conn->tenant_space_len);
+        qd_hash_retrieve(core->addr_hash, dlv->to_addr, (void**) &addr);
+    }
+    return addr;
+}
+
+
+//
+// A message that is still arriving can only be cut through to a single outgoing link.  That
+// rules out multicast addresses and in-process subscribers, which need the whole message.
+//
+static bool qdr_link_can_cut_through_CT(qdr_link_t *link, qdr_address_t *addr)
+{
+    return link->link_type != QD_LINK_CONTROL
+        && (addr->treatment == QD_TREATMENT_ANYCAST_CLOSEST || addr->treatment == QD_TREATMENT_ANYCAST_BALANCED)
+        && DEQ_IS_EMPTY(addr->subscriptions);
+}
+
+
 static void qdr_link_forward_CT(qdr_core_t *core, qdr_link_t *link, qdr_delivery_t *dlv, qdr_address_t *addr)
 {
-    if (addr && addr == link->owning_addr && qdr_addr_path_count_CT(addr) == 0) {
+    if (qd_message_aborted(dlv->msg)) {
+        //
+        // The sender aborted the message before it was routed, or while it was held on the
+        // link.  The I/O thread settles the delivery; drop it and replace its credit.
+        //
+        dlv->where = QDR_DELIVERY_NOWHERE;
+        qdr_delivery_decref_CT(core, dlv);
+        qdr_link_issue_credit_CT(core, link, 1, false);
+        return;
+    }
+
+    if (addr && addr == link->owning_addr && qdr_addr_path_count_CT(addr) == 0 && !qdr_edge_uplink_CT(core, dlv, false)) {
         //
         // We are trying to forward a delivery on an address that has no outbound paths
-        // AND the incoming link is targeted (not anonymous).  In this case, we must put
+        // (counting an edge router's uplink) AND the incoming link is targeted (not
+        // anonymous).  In this case, we must put
         // the delivery on the incoming link's undelivered list.  Note that it is safe
         // to do this because the undelivered list will be flushed once the number of
         // paths transitions from zero to one.
@@ -518,13 +891,38 @@ static void qdr_link_forward_CT(qdr_core_t *core, qdr_link_t *link, qdr_delivery
         return;
     }
 
+    if (addr && !qd_message_receive_complete(dlv->msg) && !qdr_link_can_cut_through_CT(link, addr)) {
+        //
+        // Hold the delivery on the incoming link until the rest of its message has arrived.
+        // Again, the action-reference becomes the undelivered reference.
+        //
+        DEQ_INSERT_TAIL(link->undelivered, dlv);
+        dlv->where = QDR_DELIVERY_IN_UNDELIVERED;
+        return;
+    }
+
     int fanout = 0;
 
     if (addr) {
         fanout = qdr_forward_message_CT(core, addr, dlv->msg, dlv, false, link->link_type == QD_LINK_CONTROL);
-        if (link->link_type != QD_LINK_CONTROL && link->link_type != QD_LINK_ROUTER)
+        if (qd_path_trace_enabled())
+            qd_path_trace_routed(dlv->msg, dlv->ingress_ns, (const char*) qd_hash_key_by_handle(addr->hash_handle), fanout);
+        if (link->link_type != QD_LINK_CONTROL && link->link_type != QD_LINK_ROUTER) {
             addr->deliveries_ingress++;
+            core->stats.deliveries_ingress++;
+        }
         link->total_deliveries++;
+    } else {
+        //
+        // On an edge router, a message to an address unknown here goes up to the interior.
+        //
+        qdr_link_t *uplink = qdr_edge_uplink_CT(core, dlv, link->link_type == QD_LINK_CONTROL);
+        if (uplink) {
+            qdr_forward_deliver_CT(core, uplink, qdr_forward_new_delivery_CT(core, dlv, uplink, dlv->msg), 0);
+            core->stats.deliveries_transit++;
+            link->total_deliveries++;
+            fanout = 1;
+        }
     }
 
     if (fanout == 0) {
@@ -570,10 +968,90 @@ static void qdr_link_forward_CT(qdr_core_t *core, qdr_link_t *link, qdr_delivery
 }
 
 
+//
+// A credit window is resized at most once per sample, and a sample lasts at least a
+// window's worth of deliveries and this long.
+//
+#define QDR_CREDIT_SAMPLE_MIN_NS 10000000
+
+/**
+ * Adapt the credit window of an incoming link as a delivery arrives on it.
+ *
+ * Credit used by the sender is counted against the credit issued.  When the sender has
+ * run dry, the time from its next credit to its next delivery gives the credit round
+ * trip.  At the end of each sample the window is halved if the destinations fell
+ * behind, or, if the sender was starved, raised to twice the bandwidth-delay product
+ * (arrival rate times round trip) or by capacity_min, whichever is more.  Extra credit
+ * is issued at once; a smaller window is reached by holding back replacement credit.
+ */
+static void qdr_link_adapt_credit_CT(qdr_core_t *core, qdr_link_t *link, bool backlog)
+{
+    if (link->credit_outstanding > 0)
+        link->credit_outstanding--;
+
+    if (link->credit_deferred > 0 && link->credit_outstanding * 2 <= link->capacity)
+        qdr_link_grant_credit_CT(core, link, 0, link->drain_mode);
+
+    if (link->capacity_max <= link->capacity_min || link->link_type != QD_LINK_ENDPOINT)
+        return;
+
+    uint64_t now = qdr_monotonic_ns();
+
+    if (link->credit_issue_ns) {
+        uint64_t rtt = now - link->credit_issue_ns;
+        link->credit_rtt_ns   = link->credit_rtt_ns ? link->credit_rtt_ns - link->credit_rtt_ns / 8 + rtt / 8 : rtt;
+        link->credit_issue_ns = 0;
+    }
+
+    if (link->credit_outstanding == 0 && link->credit_withheld == 0 && link->credit_throttled == 0)
+        link->credit_starved = true;
+    link->credit_backlog |= backlog;
+
+    if (link->credit_sample_ns == 0)
+        link->credit_sample_ns = now;
+    if (++link->credit_sample_count < link->capacity || now - link->credit_sample_ns < QDR_CREDIT_SAMPLE_MIN_NS)
+        return;
+
+    int window = link->capacity;
+    if (link->credit_backlog)
+        window /= 2;
+    else if (link->credit_starved) {
+        uint64_t bdp = (uint64_t) link->credit_sample_count * link->credit_rtt_ns / (now - link->credit_sample_ns);
+        if (2 * bdp > (uint64_t) (window + link->capacity_min))
+            window = 2 * bdp > (uint64_t) link->capacity_max ? link->capacity_max : (int) (2 * bdp);
+        else
+            window += link->capacity_min;
+    }
+
+    if (window < link->capacity_min)
+        window = link->capacity_min;
+    if (window > link->capacity_max)
+        window = link->capacity_max;
+
+    link->credit_sample_count = 0;
+    link->credit_sample_ns    = now;
+    link->credit_starved      = false;
+    link->credit_backlog      = false;
+
+    if (window > link->capacity) {
+        int grow = window - link->capacity;
+        link->capacity = window;
+        qdr_link_issue_credit_CT(core, link, grow, false);
+    } else if (window < link->capacity) {
+        link->credit_debt += link->capacity - window;
+        link->capacity     = window;
+    }
+}
+
+
 static void qdr_link_deliver_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
 {
-    if (discard)
+    qdr_link_bridge_t *bridge = action->args.connection.bridge;
+
+    if (discard) {
+        qdr_link_bridge_done(bridge);
         return;
+    }
 
     qdr_delivery_t *dlv  = action->args.connection.delivery;
     qdr_link_t     *link = dlv->link;
@@ -582,7 +1060,12 @@ static void qdr_link_deliver_CT(qdr_core_t *core, qdr_action_t *action, bool dis
     // If this is an attach-routed link, put the delivery directly onto the peer link
     //
     if (link->connected_link) {
-        qdr_delivery_t *peer = qdr_forward_new_delivery_CT(core, dlv, link->connected_link, dlv->msg);
+        //
+        // The message has no other owner, so hand it to the peer delivery rather than
+        // copying it.  This keeps the content unshared (and unlocked) end to end.
+        //
+        qdr_delivery_t *peer = qdr_forward_move_delivery_CT(core, dlv, link->connected_link, dlv->msg);
+        dlv->msg = 0;
 
         qdr_delivery_copy_extension_state(dlv, peer, true);
         //
@@ -591,13 +1074,13 @@ static void qdr_link_deliver_CT(qdr_core_t *core, qdr_action_t *action, bool dis
         peer->tag_length = action->args.connection.tag_length;
         memcpy(peer->tag, action->args.connection.tag, peer->tag_length);
 
-        qdr_forward_deliver_CT(core, link->connected_link, peer);
-        qd_message_free(dlv->msg);
-        dlv->msg = 0;
+        qdr_forward_deliver_CT(core, link->connected_link, peer, 0);
         link->total_deliveries++;
         if (!dlv->settled) {
+            sys_mutex_lock(link->conn->work_lock);
             DEQ_INSERT_TAIL(link->unsettled, dlv);
             dlv->where = QDR_DELIVERY_IN_UNSETTLED;
+            sys_mutex_unlock(link->conn->work_lock);
 
             //
             // Note, in this case the ref_count is left unchanged as we are transferring
@@ -610,9 +1093,15 @@ static void qdr_link_deliver_CT(qdr_core_t *core, qdr_action_t *action, bool dis
             //
             qdr_delivery_decref_CT(core, dlv);
         }
+        qdr_link_bridge_done(bridge);
         return;
     }
 
+    qdr_link_bridge_done(bridge);
+
+    if (link->link_type == QD_LINK_ENDPOINT && link->conn && link->conn->rate_bytes)
+        qdr_link_rate_charge_CT(link, dlv);
+
     //
     // NOTE: The link->undelivered list does not need to be protected by the
     //       connection's work lock for incoming links.  This protection is only
@@ -620,19 +1109,16 @@ static void qdr_link_deliver_CT(qdr_core_t *core, qdr_action_t *action, bool dis
     //
 
     if (DEQ_IS_EMPTY(link->undelivered)) {
-        qdr_address_t *addr = link->owning_addr;
-        if (!addr && dlv->to_addr) {
-            qdr_connection_t *conn = link->conn;
-            if (conn && conn->tenant_space)
-                qd_iterator_annotate_space(dlv->to_addr, conn->tenant_space, conn->tenant_space_len);
-            qd_hash_retrieve(core->addr_hash, dlv->to_addr, (void**) &addr);
-        }
+        qdr_address_t *addr = qdr_link_delivery_addr_CT(core, link, dlv);
+        qdr_link_adapt_credit_CT(core, link, addr && qdr_forward_backlogged_CT(addr));
 
         //
         // Give the action reference to the qdr_link_forward function.
         //
         qdr_link_forward_CT(core, link, dlv, addr);
     } else {
+        qdr_link_adapt_credit_CT(core, link, true);
+
         //
         // Take the action reference and use it for undelivered.  Don't decref/incref.
         //
@@ -642,6 +1128,76 @@ static void qdr_link_deliver_CT(qdr_core_t *core, qdr_action_t *action, bool dis
 }
 
 
+void qdr_link_cut_through_CT(qdr_link_t *in_link, qdr_link_t *out_link)
+{
+    qdr_link_cut_through_clear_CT(in_link);
+    in_link->cut_through_link = out_link;
+    qdr_add_link_ref(&out_link->cut_through_sources, in_link, QDR_LINK_LIST_CLASS_CUT_THROUGH);
+}
+
+
+void qdr_link_cut_through_clear_CT(qdr_link_t *in_link)
+{
+    if (in_link->cut_through_link) {
+        qdr_del_link_ref(&in_link->cut_through_link->cut_through_sources, in_link, QDR_LINK_LIST_CLASS_CUT_THROUGH);
+        in_link->cut_through_link = 0;
+    }
+}
+
+
+static void qdr_link_continue_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    if (discard)
+        return;
+
+    qdr_link_t *link     = action->args.connection.link;
+    qdr_link_t *out_link = link->cut_through_link;
+
+    if (out_link) {
+        //
+        // Make sure the outgoing link has delivery work queued so the connection's I/O thread
+        // revisits it.  A zero-valued item consumes no credit; it only resumes the delivery
+        // that is being cut through.
+        //
+        qdr_connection_t *conn = out_link->conn;
+        sys_mutex_lock(conn->work_lock);
+        qdr_link_work_t *work = DEQ_HEAD(out_link->work_list);
+        if (!work || work->work_type != QDR_LINK_WORK_DELIVERY) {
+            work = new_qdr_link_work_t();
+            ZERO(work);
+            work->work_type = QDR_LINK_WORK_DELIVERY;
+            DEQ_INSERT_HEAD(out_link->work_list, work);
+        }
+        qdr_add_link_ref(&conn->links_with_work, out_link, QDR_LINK_LIST_CLASS_WORK);
+        sys_mutex_unlock(conn->work_lock);
+
+        qdr_connection_activate_CT(core, conn);
+    }
+
+    if (!action->args.connection.complete)
+        return;
+
+    qdr_link_cut_through_clear_CT(link);
+
+    //
+    // Deliveries held on the incoming link until their content was complete can be forwarded
+    // now.  Move them to a local list first; any that still cannot be forwarded go back onto
+    // the undelivered list.
+    //
+    if (DEQ_SIZE(link->undelivered) > 0) {
+        qdr_delivery_list_t deliveries;
+        DEQ_MOVE(link->undelivered, deliveries);
+
+        qdr_delivery_t *dlv = DEQ_HEAD(deliveries);
+        while (dlv) {
+            DEQ_REMOVE_HEAD(deliveries);
+            qdr_link_forward_CT(core, link, dlv, qdr_link_delivery_addr_CT(core, link, dlv));
+            dlv = DEQ_HEAD(deliveries);
+        }
+    }
+}
+
+
 static void qdr_send_to_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
 {
     qdr_field_t  *addr_field = action->args.io.address;
@@ -659,6 +1215,7 @@ static void qdr_send_to_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
             (void) qdr_forward_message_CT(core, addr, msg, 0, action->args.io.exclude_inprocess,
                                           action->args.io.control);
             addr->deliveries_from_container++;
+            core->stats.deliveries_from_container++;
         } else
             qd_log(core->log, QD_LOG_DEBUG, "In-process send to an unknown address");
     }
@@ -668,17 +1225,15 @@ static void qdr_send_to_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
 }
 
 
-static void qdr_update_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+static void qdr_update_delivery_one_CT(qdr_core_t *core, qdr_delivery_t *dlv, uint64_t disp, bool settled,
+                                       qdr_error_t *error)
 {
-    qdr_delivery_t *dlv        = action->args.delivery.delivery;
     qdr_delivery_t *peer       = dlv->peer;
     bool            push       = false;
     bool            peer_moved = false;
     bool            dlv_moved  = false;
-    uint64_t        disp       = action->args.delivery.disposition;
-    bool            settled    = action->args.delivery.settled;
-    qdr_error_t    *error      = action->args.delivery.error;
     bool error_unassigned      = true;
+    bool multicast_copy        = peer && peer->multicast;
 
     //
     // Logic:
@@ -693,7 +1248,7 @@ static void qdr_update_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool
         // Disposition has changed, propagate the change to the peer delivery.
         //
         dlv->disposition = disp;
-        if (peer) {
+        if (peer && !multicast_copy) {
             peer->disposition = disp;
             peer->error       = error;
             push = true;
@@ -703,7 +1258,13 @@ static void qdr_update_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool
     }
 
     if (settled) {
-        if (peer) {
+        if (multicast_copy) {
+            //
+            // The outcome of a multicast copy is aggregated into its ingress delivery.
+            //
+            qdr_multicast_settled_CT(core, peer, dlv, disp);
+            peer = 0;
+        } else if (peer) {
             peer->settled = true;
             peer->peer = 0;
             dlv->peer  = 0;
@@ -718,6 +1279,9 @@ static void qdr_update_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool
             qdr_delivery_decref_CT(core, peer);
         }
 
+        if (dlv->multicast)
+            dlv->multicast->complete = true;
+
         if (dlv->link)
             dlv_moved = qdr_delivery_settled_CT(core, dlv);
     }
@@ -742,28 +1306,102 @@ static void qdr_update_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool
 }
 
 
+static void qdr_update_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    qdr_delivery_batch_t *batch = action->args.delivery.batch;
+
+    qdr_update_delivery_one_CT(core, action->args.delivery.delivery, action->args.delivery.disposition,
+                               action->args.delivery.settled, action->args.delivery.error);
+
+    if (batch) {
+        for (int i = 0; i < batch->count; i++) {
+            qdr_delivery_batch_entry_t *update = &batch->updates[i];
+            qdr_update_delivery_one_CT(core, update->delivery, update->disposition, update->settled, update->error);
+        }
+        free_qdr_delivery_batch_t(batch);
+    }
+
+    qdr_link_bridge_done(action->args.delivery.bridge);
+}
+
+
 static void qdr_delete_delivery_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
 {
-    if (!discard)
+    qdr_delivery_batch_t *batch = action->args.delivery.batch;
+
+    if (!discard) {
         qdr_delete_delivery_internal_CT(core, action->args.delivery.delivery);
+        for (int i = 0; batch && i < batch->count; i++)
+            qdr_delete_delivery_internal_CT(core, batch->updates[i].delivery);
+    }
+
+    if (batch)
+        free_qdr_delivery_batch_t(batch);
 }
 
 
 /**
- * Add link-work to provide credit to the link in an IO thread
+ * Issue credit that has passed the link's credit window and rate limits.
  */
-void qdr_link_issue_credit_CT(qdr_core_t *core, qdr_link_t *link, int credit, bool drain)
+static void qdr_link_grant_credit_CT(qdr_core_t *core, qdr_link_t *link, int credit, bool drain)
 {
-    assert(link->link_direction == QD_INCOMING);
-
     bool drain_changed = link->drain_mode |= drain;
     link->drain_mode   = drain;
 
+    //
+    // While buffer memory is over its ceiling, hold back credit from client producers.  The
+    // credit is issued by qdr_link_release_withheld_credit_CT once usage falls below the
+    // low-water mark.  Inter-router and link-routed links are never held back so that the
+    // network can always drain.
+    //
+    if (credit > 0 && link->link_type == QD_LINK_ENDPOINT && !link->connected_link &&
+        qd_buffer_memory_constrained()) {
+        if (link->credit_withheld == 0) {
+            qdr_add_link_ref(&core->links_withheld, link, QDR_LINK_LIST_CLASS_WITHHELD);
+            sys_atomic_swap(&core->memory_withholding, 1);
+        }
+        link->credit_withheld += credit;
+        credit = 0;
+    }
+
+    //
+    // Replacement credit for a client producer that still holds more than half its window
+    // is gathered and issued in one grant when it has used that much (see
+    // qdr_link_adapt_credit_CT), rather than a credit or two at a time.
+    //
+    if (credit > 0 && !drain_changed && link->link_type == QD_LINK_ENDPOINT && !link->connected_link &&
+        link->credit_outstanding * 2 > link->capacity) {
+        link->credit_deferred += credit;
+        return;
+    }
+    credit += link->credit_deferred;
+    link->credit_deferred = 0;
+
+    if (credit > 0) {
+        if (link->credit_outstanding == 0 && link->capacity_max > link->capacity_min)
+            link->credit_issue_ns = qdr_monotonic_ns();
+        link->credit_outstanding += credit;
+    }
+
     if (!drain_changed && credit == 0)
         return;
 
-    if (credit > 0)
-        link->flow_started = true;
+    //
+    // Credit joins a plain grant still waiting at the tail of the link's work list;
+    // the connection is already due to be woken for that one.
+    //
+    qdr_connection_t *conn = link->conn;
+    if (!drain_changed) {
+        sys_mutex_lock(conn->work_lock);
+        qdr_link_work_t *tail = DEQ_TAIL(link->work_list);
+        bool joined = tail && tail->work_type == QDR_LINK_WORK_FLOW && !tail->processing &&
+            tail->drain_action == QDR_LINK_WORK_DRAIN_ACTION_NONE && link->ref[QDR_LINK_LIST_CLASS_WORK];
+        if (joined)
+            tail->value += credit;
+        sys_mutex_unlock(conn->work_lock);
+        if (joined)
+            return;
+    }
 
     qdr_link_work_t *work = new_qdr_link_work_t();
     ZERO(work);
@@ -778,6 +1416,118 @@ void qdr_link_issue_credit_CT(qdr_core_t *core, qdr_link_t *link, int credit, bo
 }
 
 
+/**
+ * Add link-work to provide credit to the link in an IO thread
+ */
+void qdr_link_issue_credit_CT(qdr_core_t *core, qdr_link_t *link, int credit, bool drain)
+{
+    assert(link->link_direction == QD_INCOMING);
+
+    if (credit > 0)
+        link->flow_started = true;
+
+    //
+    // After an adaptive window shrinks, replacement credit is absorbed until the sender's
+    // outstanding credit fits the new window.
+    //
+    if (credit > 0 && link->credit_debt > 0) {
+        int paid = credit < link->credit_debt ? credit : link->credit_debt;
+        link->credit_debt -= paid;
+        credit            -= paid;
+    }
+
+    //
+    // Credit beyond the connection's rate limits is held back and issued by
+    // qdr_link_release_throttled_credit_CT as the limits allow.
+    //
+    if (credit > 0 && link->link_type == QD_LINK_ENDPOINT && !link->connected_link &&
+        link->conn && link->conn->rate_limited)
+        credit = qdr_link_rate_limit_CT(core, link, credit);
+
+    qdr_link_grant_credit_CT(core, link, credit, drain);
+}
+
+
+/**
+ * Issue the credit held back from incoming links if buffer memory is no longer constrained.
+ */
+void qdr_link_release_withheld_credit_CT(qdr_core_t *core)
+{
+    if (DEQ_IS_EMPTY(core->links_withheld))
+        return;
+
+    if (qd_buffer_memory_constrained()) {
+        sys_atomic_swap(&core->memory_withholding, 1);
+        return;
+    }
+
+    qdr_link_ref_t *ref = DEQ_HEAD(core->links_withheld);
+    while (ref) {
+        qdr_link_t *link   = ref->link;
+        int         credit = link->credit_withheld;
+
+        link->credit_withheld = 0;
+        qdr_del_link_ref(&core->links_withheld, link, QDR_LINK_LIST_CLASS_WITHHELD);
+        qdr_link_grant_credit_CT(core, link, credit, false);
+        ref = DEQ_HEAD(core->links_withheld);
+    }
+    sys_atomic_swap(&core->memory_withholding, 0);
+}
+
+
+/**
+ * Issue as much of the credit held back by rate limits as the limits now allow.
+ */
+void qdr_link_release_throttled_credit_CT(qdr_core_t *core)
+{
+    qdr_link_ref_t *ref = DEQ_HEAD(core->links_throttled);
+    while (ref) {
+        qdr_link_ref_t *next   = DEQ_NEXT(ref);
+        qdr_link_t     *link   = ref->link;
+        int             credit = qdr_connection_rate_allow_CT(link->conn, link->credit_throttled);
+
+        if (credit > 0) {
+            link->credit_throttled -= credit;
+            if (link->credit_throttled == 0)
+                qdr_del_link_ref(&core->links_throttled, link, QDR_LINK_LIST_CLASS_THROTTLED);
+            qdr_link_grant_credit_CT(core, link, credit, false);
+        }
+        ref = next;
+    }
+
+    sys_atomic_swap(&core->rate_throttling, DEQ_IS_EMPTY(core->links_throttled) ? 0 : 1);
+}
+
+
+static void qdr_check_memory_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    if (!discard)
+        qdr_link_release_withheld_credit_CT(core);
+}
+
+
+void qdr_core_check_memory(qdr_core_t *core)
+{
+    qdr_action_enqueue(core, qdr_action(qdr_check_memory_CT, "check_memory"));
+}
+
+
+static void qdr_rate_tick_CT(qdr_core_t *core, qdr_action_t *action, bool discard)
+{
+    if (!discard) {
+        qdr_link_release_throttled_credit_CT(core);
+        qdr_route_auto_link_tick_CT(core);
+    }
+}
+
+
+void qdr_core_rate_tick(qdr_core_t *core)
+{
+    if (sys_atomic_get(&core->rate_throttling) || sys_atomic_get(&core->auto_link_paced))
+        qdr_action_enqueue(core, qdr_action(qdr_rate_tick_CT, "rate_tick"));
+}
+
+
 /**
  * This function should be called after adding a new destination (subscription, local link,
  * or remote node) to an address.  If this address now has exactly one destination (i.e. it
@@ -795,7 +1545,10 @@ void qdr_addr_start_inlinks_CT(qdr_core_t *core, qdr_address_t *addr)
     if (DEQ_SIZE(addr->inlinks) == 0)
         return;
 
-    if (qdr_addr_path_count_CT(addr) == 1) {
+    //
+    // An edge router's uplink is a path for every address.
+    //
+    if (qdr_addr_path_count_CT(addr) + (core->edge_uplink_link ? 1 : 0) == 1) {
         qdr_link_ref_t *ref = DEQ_HEAD(addr->inlinks);
         while (ref) {
             qdr_link_t *link = ref->link;
@@ -909,3 +1662,323 @@ void qdr_delivery_read_extension_state(qdr_delivery_t *dlv, uint64_t disposition
         if (update_disposition) dlv->disposition = disposition;
     }
 }
+
+
+//==================================================================================
+// Link-Route Bridge
+//==================================================================================
+
+void qdr_link_bridge_CT(qdr_link_t *link, qdr_link_t *peer)
+{
+    qdr_link_bridge_t *bridge = new_qdr_link_bridge_t();
+
+    ZERO(bridge);
+    bridge->lock = sys_mutex();
+    sys_atomic_init(&bridge->ref_count, 2);
+    bridge->in_link  = link->link_direction == QD_INCOMING ? link : peer;
+    bridge->out_link = link->link_direction == QD_INCOMING ? peer : link;
+
+    sys_mutex_lock(link->conn->work_lock);
+    link->bridge = bridge;
+    sys_mutex_unlock(link->conn->work_lock);
+
+    sys_mutex_lock(peer->conn->work_lock);
+    peer->bridge = bridge;
+    sys_mutex_unlock(peer->conn->work_lock);
+}
+
+
+static void qdr_link_bridge_release(qdr_link_bridge_t *bridge)
+{
+    if (sys_atomic_dec(&bridge->ref_count) == 1) {
+        sys_mutex_free(bridge->lock);
+        free_qdr_link_bridge_t(bridge);
+    }
+}
+
+
+static void qdr_link_counts_add(qdr_link_counts_t *to, qdr_link_counts_t *from)
+{
+    to->presettled += from->presettled;
+    to->accepted   += from->accepted;
+    to->rejected   += from->rejected;
+    to->released   += from->released;
+    to->modified   += from->modified;
+    for (int i = 0; i < QDR_LATENCY_BUCKETS; i++)
+        to->settle_latency[i] += from->settle_latency[i];
+    ZERO(from);
+}
+
+
+static void qdr_link_bridge_collect_LH(qdr_link_bridge_t *bridge)
+{
+    if (bridge->in_link) {
+        bridge->in_link->total_deliveries += bridge->in_deliveries;
+        bridge->in_deliveries = 0;
+        qdr_link_counts_add(&bridge->in_link->counts, &bridge->in_counts);
+        qdr_link_counts_add(&bridge->out_link->counts, &bridge->out_counts);
+    }
+}
+
+
+void qdr_link_bridge_collect_CT(qdr_link_t *link)
+{
+    qdr_link_bridge_t *bridge = link->bridge;
+    if (bridge) {
+        sys_mutex_lock(bridge->lock);
+        qdr_link_bridge_collect_LH(bridge);
+        sys_mutex_unlock(bridge->lock);
+    }
+}
+
+
+void qdr_link_unbridge_CT(qdr_link_t *link)
+{
+    qdr_link_bridge_t *bridge = link->bridge;
+    if (!bridge)
+        return;
+
+    //
+    // Once the bridge is empty no I/O thread hands anything over it, so the core owns
+    // the deliveries of both links again.
+    //
+    sys_mutex_lock(bridge->lock);
+    qdr_link_bridge_collect_LH(bridge);
+    qdr_link_t *links[2] = { bridge->in_link, bridge->out_link };
+    bridge->in_link  = 0;
+    bridge->out_link = 0;
+    sys_mutex_unlock(bridge->lock);
+
+    for (int i = 0; i < 2; i++) {
+        sys_mutex_lock(links[i]->conn->work_lock);
+        links[i]->bridge = 0;
+        sys_mutex_unlock(links[i]->conn->work_lock);
+        qdr_link_bridge_release(bridge);
+    }
+}
+
+
+/**
+ * Take a reference to the bridge of a routed link and lock it.  Returns 0 if the link
+ * is no longer bridged.  bypass is set if nothing for the bridged links is waiting in
+ * the core, so the caller may make its hand-off directly.  qdr_link_bridge_leave undoes
+ * this, unless the caller passes the reference to an action for the core.
+ */
+static qdr_link_bridge_t *qdr_link_bridge_enter(qdr_link_t *link, bool *bypass)
+{
+    sys_mutex_lock(link->conn->work_lock);
+    qdr_link_bridge_t *bridge = link->bridge;
+    if (bridge)
+        sys_atomic_inc(&bridge->ref_count);
+    sys_mutex_unlock(link->conn->work_lock);
+
+    if (!bridge)
+        return 0;
+
+    sys_mutex_lock(bridge->lock);
+    if (!bridge->in_link) {
+        sys_mutex_unlock(bridge->lock);
+        qdr_link_bridge_release(bridge);
+        return 0;
+    }
+
+    *bypass = bridge->core_pending == 0;
+    return bridge;
+}
+
+
+static void qdr_link_bridge_leave(qdr_link_bridge_t *bridge)
+{
+    sys_mutex_unlock(bridge->lock);
+    qdr_link_bridge_release(bridge);
+}
+
+
+/**
+ * The core has processed an action counted in the bridge's core_pending.
+ */
+static void qdr_link_bridge_done(qdr_link_bridge_t *bridge)
+{
+    if (bridge) {
+        sys_mutex_lock(bridge->lock);
+        bridge->core_pending--;
+        sys_mutex_unlock(bridge->lock);
+        qdr_link_bridge_release(bridge);
+    }
+}
+
+
+//
+// Called with the connection's work_lock held.  The wake is made under the lock so that
+// it can't race the connection's context being cleared as it closes.
+//
+static void qdr_link_bridge_activate_LH(qdr_connection_t *conn)
+{
+    qd_connection_t *qd_conn = (qd_connection_t*) conn->user_context;
+    if (qd_conn)
+        qd_server_activate(qd_conn);
+}
+
+
+static void qdr_link_bridge_decref_LH(qdr_link_bridge_t *bridge, qdr_delivery_t *dlv)
+{
+    uint32_t ref_count = sys_atomic_dec(&dlv->ref_count);
+    assert(ref_count > 0);
+
+    //
+    // Deliveries on routed links never track an address, so they can be freed from an
+    // I/O thread.  Their outcomes are kept in the bridge for the core to collect.
+    //
+    if (ref_count == 1) {
+        qdr_core_t *core    = bridge->in_link->core;
+        bool        had_msg = dlv->msg != 0;
+
+        qdr_delivery_free(dlv, dlv->link == bridge->in_link ? &bridge->in_counts : &bridge->out_counts);
+
+        //
+        // The freed buffers may bring memory back under its ceiling.  Have the core
+        // release any credit it is holding back, once per time it started holding some.
+        //
+        if (had_msg && !qd_buffer_memory_constrained() && sys_atomic_swap(&core->memory_withholding, 0))
+            qdr_core_check_memory(core);
+    }
+}
+
+
+static bool qdr_link_bridge_unsettle(qdr_delivery_t *dlv)
+{
+    qdr_connection_t *conn  = dlv->link->conn;
+    bool              moved = false;
+
+    sys_mutex_lock(conn->work_lock);
+    if (dlv->where == QDR_DELIVERY_IN_UNSETTLED) {
+        DEQ_REMOVE(dlv->link->unsettled, dlv);
+        dlv->where = QDR_DELIVERY_NOWHERE;
+        moved = true;
+    }
+    sys_mutex_unlock(conn->work_lock);
+    return moved;
+}
+
+
+static void qdr_link_bridge_push(qdr_delivery_t *dlv)
+{
+    qdr_link_t *link = dlv->link;
+
+    sys_mutex_lock(link->conn->work_lock);
+    if (dlv->where != QDR_DELIVERY_IN_UNDELIVERED) {
+        qdr_delivery_incref(dlv);
+        qdr_add_delivery_ref(&link->updated_deliveries, dlv);
+        qdr_add_link_ref(&link->conn->links_with_work, link, QDR_LINK_LIST_CLASS_WORK);
+        qdr_link_bridge_activate_LH(link->conn);
+    }
+    sys_mutex_unlock(link->conn->work_lock);
+}
+
+
+/**
+ * The I/O-thread counterpart of the routed-link case of qdr_link_deliver_CT.
+ */
+static void qdr_link_bridge_deliver_LH(qdr_core_t *core, qdr_link_bridge_t *bridge, qdr_delivery_t *dlv,
+                                       const uint8_t *tag, int tag_length)
+{
+    qdr_link_t     *link     = bridge->in_link;
+    qdr_link_t     *out_link = bridge->out_link;
+    qdr_delivery_t *peer     = new_qdr_delivery_t();
+
+    ZERO(peer);
+    sys_atomic_init(&peer->ref_count, 0);
+    peer->link       = out_link;
+    peer->msg        = dlv->msg;
+    peer->settled    = dlv->settled;
+    peer->presettled = dlv->settled;
+    peer->ingress_ns = dlv->ingress_ns;
+    peer->tag_length = tag_length;
+    memcpy(peer->tag, tag, tag_length);
+    dlv->msg = 0;
+
+    if (!peer->settled) {
+        peer->peer = dlv;
+        dlv->peer  = peer;
+        qdr_delivery_incref(peer);
+        qdr_delivery_incref(dlv);
+    }
+
+    qdr_delivery_copy_extension_state(dlv, peer, true);
+    peer->queued_octets = qd_message_size(peer->msg);
+    peer->priority      = qd_message_priority(peer->msg);
+
+    sys_mutex_lock(out_link->conn->work_lock);
+    qdr_forward_push_LH(core, out_link, peer);
+    qdr_link_bridge_activate_LH(out_link->conn);
+    sys_mutex_unlock(out_link->conn->work_lock);
+
+    bridge->in_deliveries++;
+    if (!dlv->settled) {
+        sys_mutex_lock(link->conn->work_lock);
+        DEQ_INSERT_TAIL(link->unsettled, dlv);
+        dlv->where = QDR_DELIVERY_IN_UNSETTLED;
+        sys_mutex_unlock(link->conn->work_lock);
+    } else
+        qdr_link_bridge_decref_LH(bridge, dlv);
+}
+
+
+/**
+ * The I/O-thread counterpart of qdr_update_delivery_CT for a delivery on a routed link.
+ */
+static void qdr_link_bridge_update_LH(qdr_link_bridge_t *bridge, qdr_delivery_t *dlv, uint64_t disp, bool settled,
+                                      qdr_error_t *error, bool ref_given)
+{
+    qdr_delivery_t *peer             = dlv->peer;
+    bool            push             = false;
+    bool            peer_moved       = false;
+    bool            dlv_moved        = false;
+    bool            error_unassigned = true;
+
+    if (disp != dlv->disposition) {
+        dlv->disposition = disp;
+        if (peer) {
+            peer->disposition = disp;
+            peer->error       = error;
+            push = true;
+            error_unassigned = false;
+            qdr_delivery_copy_extension_state(dlv, peer, false);
+        }
+    }
+
+    if (settled) {
+        if (peer) {
+            peer->settled = true;
+            peer->peer = 0;
+            dlv->peer  = 0;
+
+            if (peer->link) {
+                peer_moved = qdr_link_bridge_unsettle(peer);
+                if (peer_moved)
+                    push = true;
+            }
+
+            qdr_link_bridge_decref_LH(bridge, dlv);
+            qdr_link_bridge_decref_LH(bridge, peer);
+        }
+
+        if (dlv->link)
+            dlv_moved = qdr_link_bridge_unsettle(dlv);
+    }
+
+    if (push)
+        qdr_link_bridge_push(peer);
+
+    //
+    // Release the caller's reference if it was given, then the unsettled references
+    //
+    if (ref_given)
+        qdr_link_bridge_decref_LH(bridge, dlv);
+    if (dlv_moved)
+        qdr_link_bridge_decref_LH(bridge, dlv);
+    if (peer_moved)
+        qdr_link_bridge_decref_LH(bridge, peer);
+    if (error_unassigned)
+        qdr_error_free(error);
+}
@@ -26,8 +26,12 @@
 #include "dispatch_private.h"
 #include "entity_cache.h"
 #include "router_private.h"
+#include "delivery_trace.h"
+#include "path_trace.h"
+#include "config.h"
 #include <qpid/dispatch/router_core.h>
 #include <proton/sasl.h>
+#include <inttypes.h>
 
 const char *QD_ROUTER_NODE_TYPE = "router.node";
 const char *QD_ROUTER_ADDRESS_TYPE = "router.address";
@@ -37,9 +41,17 @@ const char *CORE_AGENT_ADDRESS = "$management";
 static char *router_role    = "inter-router";
 static char *on_demand_role = "on-demand";
 static char *container_role = "route-container";
+static char *edge_role      = "edge";
 static char *direct_prefix;
 static char *node_id;
 
+//
+// The trace and ingress annotations of a message entering the network here
+// depend only on this router's id, so they are encoded once.
+//
+static qd_buffer_list_t node_trace_encoded;
+static qd_buffer_list_t node_ingress_encoded;
+
 /**
  * Determine the role of a connection
  */
@@ -50,7 +62,8 @@ static void qd_router_connection_get_config(const qd_connection_t  *conn,
                                             bool                   *multi_tenant,
                                             bool                   *strip_annotations_in,
                                             bool                   *strip_annotations_out,
-                                            int                    *link_capacity)
+                                            int                    *link_capacity,
+                                            int                    *link_capacity_max)
 {
     if (conn) {
         const qd_server_config_t *cf = qd_connection_config(conn);
@@ -58,16 +71,24 @@ static void qd_router_connection_get_config(const qd_connection_t  *conn,
         *strip_annotations_in  = cf ? cf->strip_inbound_annotations  : false;
         *strip_annotations_out = cf ? cf->strip_outbound_annotations : false;
         *link_capacity         = cf ? cf->link_capacity : 1;
+        *link_capacity_max     = cf ? cf->link_capacity_max : *link_capacity;
 
         if (cf && strcmp(cf->role, router_role) == 0) {
             *strip_annotations_in  = false;
             *strip_annotations_out = false;
-            *role = QDR_ROLE_INTER_ROUTER;
+            *role = cf->inter_router_data ? QDR_ROLE_INTER_ROUTER_DATA : QDR_ROLE_INTER_ROUTER;
             *cost = cf->inter_router_cost;
         } else if (cf && (strcmp(cf->role, container_role) == 0 ||
                           strcmp(cf->role, on_demand_role) == 0))  // backward compat
             *role = QDR_ROLE_ROUTE_CONTAINER;
-        else
+        else if (cf && strcmp(cf->role, edge_role) == 0) {
+            //
+            // The messages keep their annotations between edge and interior routers
+            //
+            *strip_annotations_in  = false;
+            *strip_annotations_out = false;
+            *role = QDR_ROLE_EDGE_CONNECTION;
+        } else
             *role = QDR_ROLE_NORMAL;
 
         *name = cf ? cf->name : 0;
@@ -92,11 +113,18 @@ static int AMQP_writable_conn_handler(void *type_context, qd_connection_t *conn,
 }
 
 
-static qd_iterator_t *router_annotate_message(qd_router_t       *router,
-                                              qd_parsed_field_t *in_ma,
-                                              qd_message_t      *msg,
-                                              qd_bitmask_t     **link_exclusions,
-                                              bool               strip_inbound_annotations)
+/**
+ * Carry the router's annotations of an arriving message over to its outgoing annotations.
+ * The to-override and phase found in the arriving annotations, if any, are returned in
+ * *ma_to and *ma_phase so the address can be taken from them without searching again.
+ */
+static qd_iterator_t *router_annotate_message(qd_router_t        *router,
+                                              qd_parsed_field_t  *in_ma,
+                                              qd_message_t       *msg,
+                                              qd_bitmask_t      **link_exclusions,
+                                              bool                strip_inbound_annotations,
+                                              qd_parsed_field_t **ma_to,
+                                              int                *ma_phase)
 {
     qd_iterator_t *ingress_iter = 0;
 
@@ -104,8 +132,11 @@ static qd_iterator_t *router_annotate_message(qd_router_t       *router,
     qd_parsed_field_t *ingress = 0;
     qd_parsed_field_t *to      = 0;
     qd_parsed_field_t *phase   = 0;
+    qd_parsed_field_t *span    = 0;
 
     *link_exclusions = 0;
+    *ma_to           = 0;
+    *ma_phase        = 0;
 
     if (in_ma && !strip_inbound_annotations) {
         uint32_t count = qd_parse_sub_count(in_ma);
@@ -127,8 +158,10 @@ static qd_iterator_t *router_annotate_message(qd_router_t       *router,
                 to = qd_parse_sub_value(in_ma, idx);
             } else if (qd_iterator_equal(iter, (unsigned char*) QD_MA_PHASE)) {
                 phase = qd_parse_sub_value(in_ma, idx);
+            } else if (qd_iterator_equal(iter, (unsigned char*) QD_MA_SPAN)) {
+                span = qd_parse_sub_value(in_ma, idx);
             }
-            done = trace && ingress && to && phase;
+            done = trace && ingress && to && phase && span;
         }
     }
 
@@ -137,35 +170,39 @@ static qd_iterator_t *router_annotate_message(qd_router_t       *router,
     // If there is a trace field, append this router's ID to the trace.
     // If the router ID is already in the trace the msg has looped.
     //
-    qd_composed_field_t *trace_field = qd_compose_subfield(0);
-    qd_compose_start_list(trace_field);
-    if (trace) {
-        if (qd_parse_is_list(trace)) {
-            //
-            // Create a link-exclusion map for the items in the trace.  This map will
-            // contain a one-bit for each link that leads to a neighbor router that
-            // the message has already passed through.
-            //
-            *link_exclusions = qd_tracemask_create(router->tracemask, trace);
+    if (trace && qd_parse_is_list(trace)) {
+        qd_composed_field_t *trace_field = qd_compose_subfield(0);
+        qd_compose_start_list(trace_field);
 
-            //
-            // Append this router's ID to the trace.
-            //
-            uint32_t idx = 0;
-            qd_parsed_field_t *trace_item = qd_parse_sub_value(trace, idx);
-            while (trace_item) {
-                qd_iterator_t *iter = qd_parse_raw(trace_item);
-                qd_iterator_reset_view(iter, ITER_VIEW_ALL);
-                qd_compose_insert_string_iterator(trace_field, iter);
-                idx++;
-                trace_item = qd_parse_sub_value(trace, idx);
-            }
+        //
+        // Create a link-exclusion map for the items in the trace.  This map will
+        // contain a one-bit for each link that leads to a neighbor router that
+        // the message has already passed through.  The same lookup finds this
+        // router in the trace.
+        //
+        bool looped;
+        *link_exclusions = qd_tracemask_create(router->tracemask, trace, &looped);
+        if (looped)
+            qd_log(router->log_source, QD_LOG_DEBUG, "Message has looped back to this router");
+
+        //
+        // Copy the trace as it is encoded, then append this router's ID.
+        //
+        uint32_t idx = 0;
+        qd_parsed_field_t *trace_item = qd_parse_sub_value(trace, idx);
+        while (trace_item) {
+            qd_iterator_t *iter = qd_parse_typed(trace_item);
+            qd_iterator_reset(iter);
+            qd_compose_insert_typed_iterator(trace_field, iter);
+            idx++;
+            trace_item = qd_parse_sub_value(trace, idx);
         }
-    }
 
-    qd_compose_insert_string(trace_field, node_id);
-    qd_compose_end_list(trace_field);
-    qd_message_set_trace_annotation(msg, trace_field);
+        qd_compose_insert_string(trace_field, node_id);
+        qd_compose_end_list(trace_field);
+        qd_message_set_trace_annotation(msg, trace_field);
+    } else
+        qd_message_set_trace_annotation_encoded(msg, &node_trace_encoded);
 
     //
     // QD_MA_TO:
@@ -175,6 +212,7 @@ static qd_iterator_t *router_annotate_message(qd_router_t       *router,
         qd_composed_field_t *to_field = qd_compose_subfield(0);
         qd_compose_insert_string_iterator(to_field, qd_parse_raw(to));
         qd_message_set_to_override_annotation(msg, to_field);
+        *ma_to = to;
     }
 
     //
@@ -184,6 +222,7 @@ static qd_iterator_t *router_annotate_message(qd_router_t       *router,
     if (phase) {
         int phase_val = qd_parse_as_int(phase);
         qd_message_set_phase_annotation(msg, phase_val);
+        *ma_phase = phase_val;
     }
 
     //
@@ -191,13 +230,21 @@ static qd_iterator_t *router_annotate_message(qd_router_t       *router,
     // If there is no ingress field, annotate the ingress as
     // this router else keep the original field.
     //
-    qd_composed_field_t *ingress_field = qd_compose_subfield(0);
     if (ingress && qd_parse_is_scalar(ingress)) {
+        qd_composed_field_t *ingress_field = qd_compose_subfield(0);
         ingress_iter = qd_parse_raw(ingress);
         qd_compose_insert_string_iterator(ingress_field, ingress_iter);
+        qd_message_set_ingress_annotation(msg, ingress_field);
     } else
-        qd_compose_insert_string(ingress_field, node_id);
-    qd_message_set_ingress_annotation(msg, ingress_field);
+        qd_message_set_ingress_annotation_encoded(msg, &node_ingress_encoded);
+
+    //
+    // QD_MA_SPAN:
+    // Keep the path trace context of a traced message, or sample a message that
+    // entered the network here (it has no trace yet) for a new trace.
+    //
+    if (span || qd_path_trace_enabled())
+        qd_path_trace_adopt(msg, span, !trace);
 
     //
     // Return the iterator to the ingress field _if_ it was present.
@@ -207,6 +254,349 @@ static qd_iterator_t *router_annotate_message(qd_router_t       *router,
 }
 
 
+static void AMQP_disposition_handler(void* context, qd_link_t *link, pn_delivery_t *pnd);
+
+//
+// Incoming deliveries that span several frames are tagged in their record with one of these
+// markers.  A streaming delivery is being cut through to its destination while the rest of
+// its message is still arriving; a buffering delivery will only be routed once it is complete.
+//
+PN_HANDLE(QD_DELIVERY_STREAMING)
+
+static char rx_streaming;
+static char rx_buffering;
+
+
+static void *AMQP_rx_stream_state(pn_delivery_t *pnd)
+{
+    return pn_record_get(pn_delivery_attachments(pnd), QD_DELIVERY_STREAMING);
+}
+
+
+static void AMQP_rx_set_stream_state(pn_delivery_t *pnd, void *state)
+{
+    pn_record_t *record = pn_delivery_attachments(pnd);
+    pn_record_def(record, QD_DELIVERY_STREAMING, PN_VOID);
+    pn_record_set(record, QD_DELIVERY_STREAMING, state);
+}
+
+
+static bool AMQP_rx_is_streaming(pn_delivery_t *pnd)
+{
+    return AMQP_rx_stream_state(pnd) == &rx_streaming;
+}
+
+
+/**
+ * Determine if the user of this connection is allowed to proxy the
+ * user_id of messages. A message user_id is proxied when the
+ * property value differs from the authenticated user name of the connection.
+ * If the user is not allowed to proxy the user_id then the message user_id
+ * must be blank or it must be equal to the connection user name.
+ */
+static bool AMQP_rx_check_user(qd_connection_t *conn)
+{
+    return conn->policy_settings && !conn->policy_settings->allowUserIdProxy;
+}
+
+
+/**
+ * Validate the content of the delivery as an AMQP message.  This is done partially, only
+ * to validate that we can find the fields we need to route the message.
+ *
+ * If the link is anonymous, we must validate through the message properties to find the
+ * 'to' field.  If the link is not anonymous, we don't need the 'to' field as we will be
+ * using the address from the link target.
+ */
+static qd_message_depth_t AMQP_rx_validation_depth(qdr_link_t *rlink, qd_connection_t *conn)
+{
+    return (qdr_link_is_anonymous(rlink) || AMQP_rx_check_user(conn)) ? QD_DEPTH_PROPERTIES : QD_DEPTH_MESSAGE_ANNOTATIONS;
+}
+
+
+/**
+ * Hand a validated message that arrived on a message-routed link to the router core.
+ * Ownership of the message passes to the core if a delivery is returned.  If 0 is
+ * returned the message is unroutable and still belongs to the caller.
+ */
+static qdr_delivery_t *AMQP_rx_route_message(qd_router_t *router, qd_link_t *link, qdr_link_t *rlink,
+                                             qd_message_t *msg, bool settled, bool *unroutable)
+{
+    qd_connection_t  *conn     = qd_link_connection(link);
+    qdr_delivery_t   *delivery = 0;
+
+    //
+    // Determine if the incoming link is anonymous.  If the link is addressed,
+    // there are some optimizations we can take advantage of.
+    //
+    bool              anonymous_link = qdr_link_is_anonymous(rlink);
+    qdr_connection_t *qdr_conn       = (qdr_connection_t*) qd_connection_get_context(conn);
+    int               tenant_space_len;
+    const char       *tenant_space   = qdr_connection_get_tenant_space(qdr_conn, &tenant_space_len);
+
+    if (AMQP_rx_check_user(conn)) {
+        // This connection must not allow proxied user_id
+        qd_iterator_t *userid_iter  = qd_message_field_iterator(msg, QD_FIELD_USER_ID);
+        if (userid_iter) {
+            // The user_id property has been specified
+            if (qd_iterator_remaining(userid_iter) > 0) {
+                // user_id property in message is not blank
+                if (!qd_iterator_equal(userid_iter, (const unsigned char *)conn->user_id)) {
+                    // This message is rejected: attempted user proxy is disallowed
+                    qd_log(router->log_source, QD_LOG_DEBUG, "Message rejected due to user_id proxy violation. User:%s", conn->user_id);
+                    qd_iterator_free(userid_iter);
+                    return 0;
+                }
+            }
+            qd_iterator_free(userid_iter);
+        }
+    }
+
+    qd_parsed_field_t   *in_ma        = qd_message_message_annotations(msg);
+    qd_bitmask_t        *link_exclusions;
+    bool                 strip        = qdr_link_strip_annotations_in(rlink);
+    qd_parsed_field_t   *ma_to;
+    int                  ma_phase;
+    qd_iterator_t *ingress_iter = router_annotate_message(router, in_ma, msg, &link_exclusions, strip,
+                                                          &ma_to, &ma_phase);
+
+    if (qd_path_trace_enabled())
+        qd_path_trace_received(msg, qd_connection_connection_id(conn), qdr_link_identity(rlink));
+
+    if (anonymous_link) {
+        qd_iterator_t *addr_iter = 0;
+        int phase = 0;
+        
+        //
+        // If the message has delivery annotations, get the to-override field from the annotations.
+        // Unless they were stripped, router_annotate_message has already found it.
+        //
+        if (strip && in_ma) {
+            ma_to    = qd_parse_value_by_key(in_ma, QD_MA_TO);
+            ma_phase = qd_message_get_phase_annotation(msg);
+        }
+        if (ma_to) {
+            addr_iter = qd_iterator_dup(qd_parse_raw(ma_to));
+            phase     = ma_phase;
+        }
+
+        //
+        // Still no destination address?  Use the TO field from the message properties.
+        //
+        if (!addr_iter) {
+            addr_iter = qd_message_field_iterator(msg, QD_FIELD_TO);
+
+            //
+            // If the address came from the TO field and we need to apply a tenant-space,
+            // set the to-override with the annotated address.
+            //
+            if (addr_iter && tenant_space) {
+                qd_iterator_reset_view(addr_iter, ITER_VIEW_ADDRESS_WITH_SPACE);
+                qd_iterator_annotate_space(addr_iter, tenant_space, tenant_space_len);
+                qd_composed_field_t *to_override = qd_compose_subfield(0);
+                qd_compose_insert_string_iterator(to_override, addr_iter);
+                qd_message_set_to_override_annotation(msg, to_override);
+            }
+        }
+
+        if (addr_iter) {
+            qd_iterator_reset_view(addr_iter, ITER_VIEW_ADDRESS_HASH);
+            if (phase > 0)
+                qd_iterator_annotate_phase(addr_iter, '0' + (char) phase);
+
+            //
+            // If the core knows no such address, leave the message for the caller to
+            // release rather than sending it to the core only to be released there.
+            //
+            if (qdr_link_unroutable(rlink, addr_iter)) {
+                *unroutable = true;
+                qd_iterator_free(addr_iter);
+                qd_bitmask_free(link_exclusions);
+            } else
+                delivery = qdr_link_deliver_to(rlink, msg, ingress_iter, addr_iter, settled,
+                                               link_exclusions);
+        }
+    } else {
+        //
+        // This is a targeted link, not anonymous.
+        //
+        const char *term_addr = pn_terminus_get_address(qd_link_remote_target(link));
+        if (!term_addr)
+            term_addr = pn_terminus_get_address(qd_link_source(link));
+
+        if (term_addr) {
+            //
+            // The to-override, prefixed with the tenant space if there is one, is the same
+            // for every message on the link.  It is composed once and kept on the link.
+            //
+            qd_buffer_list_t *encoded = qdr_link_to_override(rlink);
+            if (DEQ_IS_EMPTY(*encoded)) {
+                qd_composed_field_t *to_override = qd_compose_subfield(0);
+                if (tenant_space) {
+                    qd_iterator_storage_t storage;
+                    qd_iterator_t *aiter = qd_iterator_init_string(&storage, term_addr, ITER_VIEW_ADDRESS_WITH_SPACE);
+                    qd_iterator_annotate_space(aiter, tenant_space, tenant_space_len);
+                    qd_compose_insert_string_iterator(to_override, aiter);
+                    qd_iterator_free(aiter);
+                } else
+                    qd_compose_insert_string(to_override, term_addr);
+                qd_compose_take_buffers(to_override, encoded);
+                qd_compose_free(to_override);
+            }
+            qd_message_set_to_override_annotation_encoded(msg, encoded);
+            int phase = qdr_link_phase(rlink);
+            if (phase != 0)
+                qd_message_set_phase_annotation(msg, phase);
+        }
+        delivery = qdr_link_deliver(rlink, msg, ingress_iter, settled, link_exclusions);
+    }
+
+    //
+    // Rules for delivering messages:
+    //
+    // For addressed (non-anonymous) links:
+    //   to-override must be set (done in the core?)
+    //   uses qdr_link_deliver to hand over to the core
+    //
+    // For anonymous links:
+    //   If there's a to-override in the annotations, use that address
+    //   Or, use the 'to' field in the message properties
+    //
+
+    return delivery;
+}
+
+
+/**
+ * Start routing a delivery whose message is still arriving.  The core is given a copy of the
+ * message as soon as the sections needed to route it are in; after that, each new piece of
+ * content only wakes the chosen outgoing link up to send it on.
+ *
+ * Deliveries that cannot be routed yet, or that would be rejected, are left to be handled
+ * once they are complete.  Settlement is also left until the whole message is in.
+ */
+static void AMQP_rx_stream(qd_router_t *router, qd_link_t *link, qdr_link_t *rlink, pn_delivery_t *pnd)
+{
+    void *state = AMQP_rx_stream_state(pnd);
+
+    if (state == &rx_streaming) {
+        qdr_link_continue_delivery(rlink, false);
+        return;
+    }
+
+    //
+    // A message from a peer that compresses messages can only be routed once it is whole.
+    //
+    if (state == &rx_buffering || qdr_link_type(rlink) == QD_LINK_CONTROL || qd_link_connection(link)->deflate)
+        return;
+
+    qd_message_t *msg = qd_message_partial(pnd);
+    if (!msg)
+        return;
+
+    bool routed = qdr_link_is_routed(rlink);
+    qd_message_depth_t        depth  = routed ? QD_DEPTH_MESSAGE_ANNOTATIONS : AMQP_rx_validation_depth(rlink, qd_link_connection(link));
+    qd_message_depth_status_t status = qd_message_check_depth(msg, depth);
+
+    if (status == QD_MESSAGE_DEPTH_INCOMPLETE)
+        return;
+
+    //
+    // A proxied user_id would get the message rejected, so leave the check for the whole
+    // message rather than repeating it on every frame.
+    //
+    if (status == QD_MESSAGE_DEPTH_INVALID || (!routed && AMQP_rx_check_user(qd_link_connection(link)))) {
+        AMQP_rx_set_stream_state(pnd, &rx_buffering);
+        return;
+    }
+
+    qd_message_t   *copy     = qd_message_copy(msg);
+    qdr_delivery_t *delivery;
+    bool            unroutable = false;
+
+    if (routed) {
+        pn_delivery_tag_t dtag = pn_delivery_tag(pnd);
+        delivery = qdr_link_deliver_to_routed_link(rlink, copy, pn_delivery_settled(pnd),
+                                                   (uint8_t*) dtag.start, dtag.size,
+                                                   pn_disposition_type(pn_delivery_remote(pnd)),
+                                                   pn_disposition_data(pn_delivery_remote(pnd)));
+    } else
+        delivery = AMQP_rx_route_message(router, link, rlink, copy, pn_delivery_settled(pnd), &unroutable);
+
+    if (!delivery) {
+        qd_message_free(copy);
+        AMQP_rx_set_stream_state(pnd, &rx_buffering);
+        return;
+    }
+
+    AMQP_rx_set_stream_state(pnd, &rx_streaming);
+
+    if (!pn_delivery_settled(pnd)) {
+        pn_delivery_set_context(pnd, delivery);
+        qdr_delivery_set_context(delivery, pnd);
+        qdr_delivery_incref(delivery);
+    }
+}
+
+
+/**
+ * The message on an incoming delivery will never be complete: the sender aborted it, or the
+ * link is being lost.  The message has been marked aborted.  If it was being cut through,
+ * the outgoing link is woken to abort its copy and the delivery is settled with the core,
+ * which then accounts for its credit.  Otherwise the core never saw it.
+ */
+static void AMQP_rx_abort(qd_router_t *router, qd_link_t *link, qdr_link_t *rlink, pn_delivery_t *pnd,
+                          qd_message_t *msg, bool lost)
+{
+    bool            streaming = AMQP_rx_is_streaming(pnd);
+    qdr_delivery_t *delivery  = (qdr_delivery_t*) pn_delivery_get_context(pnd);
+
+    qd_message_free(msg);
+    AMQP_rx_set_stream_state(pnd, 0);
+
+    if (streaming && rlink) {
+        qdr_link_continue_delivery(rlink, true);
+        if (delivery) {
+            pn_delivery_set_context(pnd, 0);
+            qdr_delivery_set_context(delivery, 0);
+            qdr_delivery_update_disposition(router->router_core, delivery, 0, true, 0, 0, true);
+        }
+    } else if (!lost)
+        pn_link_flow(qd_link_pn(link), 1);
+
+    pn_delivery_settle(pnd);
+}
+
+
+/**
+ * Record a delivery event in the binary delivery trace.  The address is the one
+ * the link is attached to, or for an anonymous sender the message's to field.
+ */
+static void AMQP_trace_delivery(qd_trace_event_t event, qd_link_t *link, qdr_link_t *rlink,
+                                qd_message_t *msg, uint64_t disposition, bool settled)
+{
+    uint32_t addr_hash = 0;
+    if (qd_link_direction(link) == QD_INCOMING) {
+        const char *term_addr = pn_terminus_get_address(qd_link_remote_target(link));
+        if (term_addr)
+            addr_hash = qd_delivery_trace_hash(term_addr);
+        else if (msg && event == QD_TRACE_INGRESS && qd_message_check(msg, QD_DEPTH_PROPERTIES)) {
+            qd_iterator_t *to = qd_message_field_iterator(msg, QD_FIELD_TO);
+            if (to) {
+                addr_hash = qd_iterator_hash_view(to);
+                qd_iterator_free(to);
+            }
+        }
+    } else
+        addr_hash = qd_delivery_trace_hash(pn_terminus_get_address(qd_link_remote_source(link)));
+
+    qd_delivery_trace(event, settled ? QD_TRACE_SETTLED : 0,
+                      qd_connection_connection_id(qd_link_connection(link)),
+                      rlink ? qdr_link_identity(rlink) : 0,
+                      msg, disposition, addr_hash);
+}
+
+
 /**
  * Inbound Delivery Handler
  */
@@ -224,14 +614,24 @@ static void AMQP_rx_handler(void* context, qd_link_t *link, pn_delivery_t *pnd)
     // Receive the message into a local representation.  If the returned message
     // pointer is NULL, we have not yet received a complete message.
     //
-    // Note:  In the link-routing case, consider cutting the message through.  There's
-    //        no reason to wait for the whole message to be received before starting to
-    //        send it.
+    // The message is cut through to its destination as it arrives instead of
+    // waiting for the whole of it, where that is possible.
     //
     msg = qd_message_receive(pnd);
 
-    if (!msg)
+    if (!msg) {
+        if (rlink)
+            AMQP_rx_stream(router, link, rlink, pnd);
         return;
+    }
+
+    if (qd_message_aborted(msg)) {
+        AMQP_rx_abort(router, link, rlink, pnd, msg, false);
+        return;
+    }
+
+    if (qd_delivery_trace_enabled())
+        AMQP_trace_delivery(QD_TRACE_INGRESS, link, rlink, msg, 0, pn_delivery_settled(pnd));
 
     if (cf->log_message) {
         char repr[qd_message_repr_len()];
@@ -261,149 +661,35 @@ static void AMQP_rx_handler(void* context, qd_link_t *link, pn_delivery_t *pnd)
     }
 
     //
-    // Handle the link-routed case
+    // Finish a delivery that was cut through as it arrived.  The core holds its own copy of
+    // the message; wake the outgoing link for the final piece and deal with any settlement
+    // that was held back while the message was incomplete.
     //
-    if (qdr_link_is_routed(rlink)) {
-        pn_delivery_tag_t dtag = pn_delivery_tag(pnd);
-        delivery = qdr_link_deliver_to_routed_link(rlink, msg, pn_delivery_settled(pnd), (uint8_t*) dtag.start, dtag.size,
-                                                   pn_disposition_type(pn_delivery_remote(pnd)), pn_disposition_data(pn_delivery_remote(pnd)));
+    if (AMQP_rx_is_streaming(pnd)) {
+        AMQP_rx_set_stream_state(pnd, 0);
+        qd_message_free(msg);
+        qdr_link_continue_delivery(rlink, true);
 
-        if (delivery) {
+        if (!pn_delivery_get_context(pnd)) {
             if (pn_delivery_settled(pnd))
                 pn_delivery_settle(pnd);
-            else {
-                pn_delivery_set_context(pnd, delivery);
-                qdr_delivery_set_context(delivery, pnd);
-                qdr_delivery_incref(delivery);
-            }
-        }
+        } else if (pn_delivery_settled(pnd) && !pn_delivery_updated(pnd))
+            AMQP_disposition_handler(router, link, pnd);
         return;
     }
 
     //
-    // Determine if the incoming link is anonymous.  If the link is addressed,
-    // there are some optimizations we can take advantage of.
+    // Restore a message the peer router compressed.  A corrupt one is rejected below.
     //
-    bool anonymous_link = qdr_link_is_anonymous(rlink);
+    bool intact = !conn->deflate || qd_message_inflate(msg, conn->compression);
 
     //
-    // Determine if the user of this connection is allowed to proxy the
-    // user_id of messages. A message user_id is proxied when the
-    // property value differs from the authenticated user name of the connection.
-    // If the user is not allowed to proxy the user_id then the message user_id
-    // must be blank or it must be equal to the connection user name.
+    // Handle the link-routed case
     //
-    bool              check_user   = false;
-    qdr_connection_t *qdr_conn     = (qdr_connection_t*) qd_connection_get_context(conn);
-    int               tenant_space_len;
-    const char       *tenant_space = qdr_connection_get_tenant_space(qdr_conn, &tenant_space_len);
-    if (conn->policy_settings)
-        check_user = !conn->policy_settings->allowUserIdProxy;
-
-    //
-    // Validate the content of the delivery as an AMQP message.  This is done partially, only
-    // to validate that we can find the fields we need to route the message.
-    //
-    // If the link is anonymous, we must validate through the message properties to find the
-    // 'to' field.  If the link is not anonymous, we don't need the 'to' field as we will be
-    // using the address from the link target.
-    //
-    qd_message_depth_t  validation_depth = (anonymous_link || check_user) ? QD_DEPTH_PROPERTIES : QD_DEPTH_MESSAGE_ANNOTATIONS;
-    bool                valid_message    = qd_message_check(msg, validation_depth);
-
-    if (valid_message) {
-        if (check_user) {
-            // This connection must not allow proxied user_id
-            qd_iterator_t *userid_iter  = qd_message_field_iterator(msg, QD_FIELD_USER_ID);
-            if (userid_iter) {
-                // The user_id property has been specified
-                if (qd_iterator_remaining(userid_iter) > 0) {
-                    // user_id property in message is not blank
-                    if (!qd_iterator_equal(userid_iter, (const unsigned char *)conn->user_id)) {
-                        // This message is rejected: attempted user proxy is disallowed
-                        qd_log(router->log_source, QD_LOG_DEBUG, "Message rejected due to user_id proxy violation. User:%s", conn->user_id);
-                        pn_link_flow(pn_link, 1);
-                        pn_delivery_update(pnd, PN_REJECTED);
-                        pn_delivery_settle(pnd);
-                        qd_message_free(msg);
-                        qd_iterator_free(userid_iter);
-                        return;
-                    }
-                }
-                qd_iterator_free(userid_iter);
-            }
-        }
-
-        qd_parsed_field_t   *in_ma        = qd_message_message_annotations(msg);
-        qd_bitmask_t        *link_exclusions;
-        bool                 strip        = qdr_link_strip_annotations_in(rlink);
-        qd_iterator_t *ingress_iter = router_annotate_message(router, in_ma, msg, &link_exclusions, strip);
-
-        if (anonymous_link) {
-            qd_iterator_t *addr_iter = 0;
-            int phase = 0;
-            
-            //
-            // If the message has delivery annotations, get the to-override field from the annotations.
-            //
-            if (in_ma) {
-                qd_parsed_field_t *ma_to = qd_parse_value_by_key(in_ma, QD_MA_TO);
-                if (ma_to) {
-                    addr_iter = qd_iterator_dup(qd_parse_raw(ma_to));
-                    phase = qd_message_get_phase_annotation(msg);
-                }
-            }
-
-            //
-            // Still no destination address?  Use the TO field from the message properties.
-            //
-            if (!addr_iter) {
-                addr_iter = qd_message_field_iterator(msg, QD_FIELD_TO);
-
-                //
-                // If the address came from the TO field and we need to apply a tenant-space,
-                // set the to-override with the annotated address.
-                //
-                if (addr_iter && tenant_space) {
-                    qd_iterator_reset_view(addr_iter, ITER_VIEW_ADDRESS_WITH_SPACE);
-                    qd_iterator_annotate_space(addr_iter, tenant_space, tenant_space_len);
-                    qd_composed_field_t *to_override = qd_compose_subfield(0);
-                    qd_compose_insert_string_iterator(to_override, addr_iter);
-                    qd_message_set_to_override_annotation(msg, to_override);
-                }
-            }
-
-            if (addr_iter) {
-                qd_iterator_reset_view(addr_iter, ITER_VIEW_ADDRESS_HASH);
-                if (phase > 0)
-                    qd_iterator_annotate_phase(addr_iter, '0' + (char) phase);
-                delivery = qdr_link_deliver_to(rlink, msg, ingress_iter, addr_iter, pn_delivery_settled(pnd),
-                                               link_exclusions);
-            }
-        } else {
-            //
-            // This is a targeted link, not anonymous.
-            //
-            const char *term_addr = pn_terminus_get_address(qd_link_remote_target(link));
-            if (!term_addr)
-                term_addr = pn_terminus_get_address(qd_link_source(link));
-
-            if (term_addr) {
-                qd_composed_field_t *to_override = qd_compose_subfield(0);
-                if (tenant_space) {
-                    qd_iterator_t *aiter = qd_iterator_string(term_addr, ITER_VIEW_ADDRESS_WITH_SPACE);
-                    qd_iterator_annotate_space(aiter, tenant_space, tenant_space_len);
-                    qd_compose_insert_string_iterator(to_override, aiter);
-                    qd_iterator_free(aiter);
-                } else
-                    qd_compose_insert_string(to_override, term_addr);
-                qd_message_set_to_override_annotation(msg, to_override);
-                int phase = qdr_link_phase(rlink);
-                if (phase != 0)
-                    qd_message_set_phase_annotation(msg, phase);
-            }
-            delivery = qdr_link_deliver(rlink, msg, ingress_iter, pn_delivery_settled(pnd), link_exclusions);
-        }
+    if (intact && qdr_link_is_routed(rlink)) {
+        pn_delivery_tag_t dtag = pn_delivery_tag(pnd);
+        delivery = qdr_link_deliver_to_routed_link(rlink, msg, pn_delivery_settled(pnd), (uint8_t*) dtag.start, dtag.size,
+                                                   pn_disposition_type(pn_delivery_remote(pnd)), pn_disposition_data(pn_delivery_remote(pnd)));
 
         if (delivery) {
             if (pn_delivery_settled(pnd))
@@ -413,34 +699,41 @@ static void AMQP_rx_handler(void* context, qd_link_t *link, pn_delivery_t *pnd)
                 qdr_delivery_set_context(delivery, pnd);
                 qdr_delivery_incref(delivery);
             }
-        } else {
-            //
-            // The message is now and will always be unroutable because there is no address.
-            //
-            pn_link_flow(pn_link, 1);
-            pn_delivery_update(pnd, PN_REJECTED);
-            pn_delivery_settle(pnd);
-            qd_message_free(msg);
         }
+        return;
+    }
 
+    bool unroutable = false;
+    if (intact && qd_message_check(msg, AMQP_rx_validation_depth(rlink, conn)))
+        delivery = AMQP_rx_route_message(router, link, rlink, msg, pn_delivery_settled(pnd), &unroutable);
+
+    if (delivery) {
+        if (pn_delivery_settled(pnd))
+            pn_delivery_settle(pnd);
+        else {
+            pn_delivery_set_context(pnd, delivery);
+            qdr_delivery_set_context(delivery, pnd);
+            qdr_delivery_incref(delivery);
+        }
+    } else if (unroutable) {
         //
-        // Rules for delivering messages:
-        //
-        // For addressed (non-anonymous) links:
-        //   to-override must be set (done in the core?)
-        //   uses qdr_link_deliver to hand over to the core
-        //
-        // For anonymous links:
-        //   If there's a to-override in the annotations, use that address
-        //   Or, use the 'to' field in the message properties
+        // The message is for an address the core doesn't know.  Release it as the core
+        // would, and replace the credit it used.
         //
-
-
-
+        if (qd_delivery_trace_enabled())
+            AMQP_trace_delivery(QD_TRACE_DISPOSITION, link, rlink, msg, PN_RELEASED, true);
+        if (!pn_delivery_settled(pnd))
+            qdr_link_released_unroutable(rlink);
+        pn_link_flow(pn_link, 1);
+        pn_delivery_update(pnd, PN_RELEASED);
+        pn_delivery_settle(pnd);
+        qd_message_free(msg);
     } else {
         //
-        // Message is invalid.  Reject the message and don't involve the router core.
+        // The message is invalid or unroutable.  Reject it and don't involve the router core.
         //
+        if (qd_delivery_trace_enabled())
+            AMQP_trace_delivery(QD_TRACE_DISPOSITION, link, rlink, msg, PN_REJECTED, true);
         pn_link_flow(pn_link, 1);
         pn_delivery_update(pnd, PN_REJECTED);
         pn_delivery_settle(pnd);
@@ -466,6 +759,18 @@ static void AMQP_disposition_handler(void* context, qd_link_t *link, pn_delivery
     if (!delivery)
         return;
 
+    //
+    // Likewise, dispositions on a delivery that is being cut through are held back until the
+    // whole message has arrived.
+    //
+    if (AMQP_rx_is_streaming(pnd))
+        return;
+
+    if (qd_delivery_trace_enabled())
+        AMQP_trace_delivery(QD_TRACE_DISPOSITION, link, (qdr_link_t*) qd_link_get_context(link),
+                            qdr_delivery_message(delivery), pn_delivery_remote_state(pnd),
+                            pn_delivery_settled(pnd));
+
     pn_disposition_t *disp   = pn_delivery_remote(pnd);
     pn_condition_t *cond     = pn_disposition_condition(disp);
     qdr_error_t    *error    = qdr_error_from_pn(cond);
@@ -584,10 +889,21 @@ static int AMQP_link_flow_handler(void* context, qd_link_t *link)
  */
 static int AMQP_link_detach_handler(void* context, qd_link_t *link, qd_detach_type_t dt)
 {
-    qdr_link_t     *rlink  = (qdr_link_t*) qd_link_get_context(link);
-    pn_condition_t *cond   = qd_link_pn(link) ? pn_link_remote_condition(qd_link_pn(link)) : 0;
+    qd_router_t    *router  = (qd_router_t*) context;
+    qdr_link_t     *rlink   = (qdr_link_t*) qd_link_get_context(link);
+    pn_link_t      *pn_link = qd_link_pn(link);
+    pn_condition_t *cond    = pn_link ? pn_link_remote_condition(pn_link) : 0;
 
     if (rlink) {
+        //
+        // A message still arriving on the link will never be completed.  Abort it before
+        // the core hears of the detach so that any copy being cut through is aborted too.
+        //
+        pn_delivery_t *pnd = pn_link && qd_link_direction(link) == QD_INCOMING ? pn_link_current(pn_link) : 0;
+        qd_message_t  *msg = pnd ? qd_message_receive_abort(pnd) : 0;
+        if (msg)
+            AMQP_rx_abort(router, link, rlink, pnd, msg, true);
+
         //
         // This is the last event for this link that we will send into the core.  Remove the
         // core linkage.  Note that the core->qd linkage is still in place.
@@ -617,9 +933,11 @@ static void AMQP_opened_handler(qd_router_t *router, qd_connection_t *conn, bool
     qdr_connection_role_t  role = 0;
     int                    cost = 1;
     int                    remote_cost = 1;
+    bool                   remote_compression = false;
     bool                   strip_annotations_in = false;
     bool                   strip_annotations_out = false;
     int                    link_capacity = 1;
+    int                    link_capacity_max = 1;
     const char            *name = 0;
     bool                   multi_tenant = false;
     const char            *vhost = 0;
@@ -659,13 +977,15 @@ static void AMQP_opened_handler(qd_router_t *router, qd_connection_t *conn, bool
 
 
     qd_router_connection_get_config(conn, &role, &cost, &name, &multi_tenant,
-                                    &strip_annotations_in, &strip_annotations_out, &link_capacity);
+                                    &strip_annotations_in, &strip_annotations_out, &link_capacity,
+                                    &link_capacity_max);
 
     pn_data_t *props = pn_conn ? pn_connection_remote_properties(pn_conn) : 0;
 
-    if (role == QDR_ROLE_INTER_ROUTER) {
+    if (role == QDR_ROLE_INTER_ROUTER || role == QDR_ROLE_INTER_ROUTER_DATA) {
         //
-        // Check the remote properties for an inter-router cost value.
+        // Check the remote properties for an inter-router cost value, for the
+        // marker of an extra data-only connection and for the offer of compression.
         //
 
         if (props) {
@@ -677,14 +997,23 @@ static void AMQP_opened_handler(qd_router_t *router, qd_connection_t *conn, bool
                     if (pn_data_type(props) == PN_SYMBOL) {
                         pn_bytes_t sym = pn_data_get_symbol(props);
                         if (sym.size == strlen(QD_CONNECTION_PROPERTY_COST_KEY) &&
-                            strcmp(sym.start, QD_CONNECTION_PROPERTY_COST_KEY) == 0) {
+                            strncmp(sym.start, QD_CONNECTION_PROPERTY_COST_KEY, sym.size) == 0) {
                             pn_data_next(props);
                             if (pn_data_type(props) == PN_INT)
                                 remote_cost = pn_data_get_int(props);
-                            break;
+                        } else if (sym.size == strlen(QD_CONNECTION_PROPERTY_DATA_KEY) &&
+                                   strncmp(sym.start, QD_CONNECTION_PROPERTY_DATA_KEY, sym.size) == 0) {
+                            pn_data_next(props);
+                            if (pn_data_type(props) == PN_BOOL && pn_data_get_bool(props))
+                                role = QDR_ROLE_INTER_ROUTER_DATA;
+                        } else if (sym.size == strlen(QD_CONNECTION_PROPERTY_COMPRESSION_KEY) &&
+                                   strncmp(sym.start, QD_CONNECTION_PROPERTY_COMPRESSION_KEY, sym.size) == 0) {
+                            pn_data_next(props);
+                            remote_compression = pn_data_type(props) == PN_BOOL && pn_data_get_bool(props);
                         }
                     }
                 }
+                pn_data_exit(props);
             }
         }
 
@@ -693,6 +1022,21 @@ static void AMQP_opened_handler(qd_router_t *router, qd_connection_t *conn, bool
         //
         if (remote_cost > cost)
             cost = remote_cost;
+
+        //
+        // Compress messages only if both routers are configured to.  A WebSocket connection
+        // is left to its own compression.
+        //
+        if (remote_compression && qd_connection_config(conn)->inter_router_compression && !conn->compression) {
+#if USE_ZLIB
+            conn->deflate     = true;
+            conn->compression = qdr_compression_stats();
+            qd_log(router->log_source, QD_LOG_INFO, "Compressing messages on connection %"PRIu64, connection_id);
+#else
+            qd_log(router->log_source, QD_LOG_WARNING,
+                   "Connection %"PRIu64" not compressed: the router is built without zlib", connection_id);
+#endif
+        }
     }
 
     if (multi_tenant)
@@ -727,13 +1071,37 @@ static void AMQP_opened_handler(qd_router_t *router, qd_connection_t *conn, bool
                                                                  props,
                                                                  ssl_ssf,
                                                                  is_ssl);
+    if (conn->compression)
+        qdr_connection_info_set_compression(connection_info, conn->compression);
+
+    //
+    // Policy rate limits apply to the client senders on normal connections.  The vhost's
+    // statistics block identifies the vhost the shared limits belong to.
+    //
+    qdr_rate_limits_t  rate_limits;
+    qdr_rate_limits_t *rate_limits_p = 0;
+    qd_policy_settings_t *settings   = conn->policy_settings;
+    if (settings && role == QDR_ROLE_NORMAL) {
+        ZERO(&rate_limits);
+        rate_limits.msg_rate        = settings->maxMessageRate;
+        rate_limits.byte_rate       = settings->maxByteRate;
+        rate_limits.user_msg_rate   = settings->maxUserMessageRate;
+        rate_limits.user_byte_rate  = settings->maxUserByteRate;
+        rate_limits.vhost_msg_rate  = settings->vhostMaxMessageRate;
+        rate_limits.vhost_byte_rate = settings->vhostMaxByteRate;
+        rate_limits.scope           = settings->denialCounts;
+        rate_limits.throttled       = settings->denialCounts ? &settings->denialCounts->creditThrottled : 0;
+        rate_limits_p = &rate_limits;
+    }
 
     qdr_connection_t *qdrc = qdr_connection_opened(router->router_core, inbound, role, cost, connection_id, name,
                                                    pn_connection_remote_container(pn_conn),
                                                    strip_annotations_in,
                                                    strip_annotations_out,
                                                    link_capacity,
+                                                   link_capacity_max,
                                                    vhost,
+                                                   rate_limits_p,
                                                    connection_info);
 
     qd_connection_set_context(conn, qdrc);
@@ -779,10 +1147,29 @@ static void qd_router_timer_handler(void *context)
     // Periodic processing.
     //
     qd_pyrouter_tick(router);
+    qdr_core_check_memory(router->router_core);
     qd_timer_schedule(router->timer, 1000);
 }
 
 
+static void qd_router_rate_timer_handler(void *context)
+{
+    qd_router_t *router = (qd_router_t*) context;
+
+    qdr_core_rate_tick(router->router_core);
+    qd_timer_schedule(router->rate_timer, QDR_RATE_TICK_MSEC);
+}
+
+
+static void qd_router_console_timer_handler(void *context)
+{
+    qd_router_t *router = (qd_router_t*) context;
+
+    qdr_core_console_tick(router->router_core);
+    qd_timer_schedule(router->console_timer, router->qd->console_feed_interval);
+}
+
+
 static qd_node_type_t router_node = {"router", 0, 0,
                                      AMQP_rx_handler,
                                      AMQP_disposition_handler,
@@ -812,6 +1199,18 @@ qd_router_t *qd_router(qd_dispatch_t *qd, qd_router_mode_t mode, const char *are
     strcat(node_id, "/");
     strcat(node_id, id);
 
+    qd_composed_field_t *field = qd_compose_subfield(0);
+    qd_compose_start_list(field);
+    qd_compose_insert_string(field, node_id);
+    qd_compose_end_list(field);
+    qd_compose_take_buffers(field, &node_trace_encoded);
+    qd_compose_free(field);
+
+    field = qd_compose_subfield(0);
+    qd_compose_insert_string(field, node_id);
+    qd_compose_take_buffers(field, &node_ingress_encoded);
+    qd_compose_free(field);
+
     qd_router_t *router = NEW(qd_router_t);
     ZERO(router);
 
@@ -828,6 +1227,8 @@ qd_router_t *qd_router(qd_dispatch_t *qd, qd_router_mode_t mode, const char *are
 
     router->lock  = sys_mutex();
     router->timer = qd_timer(qd, qd_router_timer_handler, (void*) router);
+    router->rate_timer = qd_timer(qd, qd_router_rate_timer_handler, (void*) router);
+    router->console_timer = qd_timer(qd, qd_router_console_timer_handler, (void*) router);
 
     //
     // Inform the field iterator module of this router's id and area.  The field iterator
@@ -1014,47 +1415,94 @@ static int CORE_link_push(void *context, qdr_link_t *link, int limit)
         int link_credit = pn_link_credit(plink);
         if (link_credit > limit)
             link_credit = limit;
-        qdr_link_process_deliveries(router->router_core, link, link_credit);
-        return link_credit;
+        return qdr_link_process_deliveries(router->router_core, link, link_credit);
     }
 
     return 0;
 }
 
 
-static void CORE_link_deliver(void *context, qdr_link_t *link, qdr_delivery_t *dlv, bool settled)
+static bool CORE_link_deliver(void *context, qdr_link_t *link, qdr_delivery_t *dlv, bool settled)
 {
     qd_router_t *router = (qd_router_t*) context;
     qd_link_t   *qlink  = (qd_link_t*) qdr_link_get_context(link);
     if (!qlink)
-        return;
+        return true;
 
     pn_link_t *plink = qd_link_pn(qlink);
     if (!plink)
-        return;
+        return true;
 
-    const char *tag;
-    int         tag_length;
+    qd_message_t *msg = qdr_delivery_message(dlv);
 
-    qdr_delivery_tag(dlv, &tag, &tag_length);
+    //
+    // The incoming delivery was aborted, or its link lost, while the message was being cut
+    // through.  Abort what has been sent, if anything, and settle the delivery with the core.
+    //
+    if (qd_message_aborted(msg)) {
+        if (!qd_message_send_started(msg)) {
+            if (!settled)
+                qdr_delivery_update_disposition(router->router_core, dlv, 0, true, 0, 0, false);
+            return true;
+        }
 
-    pn_delivery(plink, pn_dtag(tag, tag_length));
-    pn_delivery_t *pdlv = pn_link_current(plink);
+        pn_delivery_t *pdlv = pn_link_current(plink);
+        if (pdlv) {
+            if ((qdr_delivery_t*) pn_delivery_get_context(pdlv) == dlv) {
+                pn_delivery_set_context(pdlv, 0);
+                qdr_delivery_set_context(dlv, 0);
+                qdr_delivery_update_disposition(router->router_core, dlv, 0, true, 0, 0, true);
+            }
+            pn_delivery_abort(pdlv);
+        }
+        return true;
+    }
 
-    // handle any delivery-state on the transfer e.g. transactional-state
-    qdr_delivery_write_extension_state(dlv, pdlv, true);
     //
     // If the remote send settle mode is set to 'settled', we should settle the delivery on behalf of the receiver.
     //
     bool remote_snd_settled = qd_link_remote_snd_settle_mode(qlink) == PN_SND_SETTLED;
+    pn_delivery_t *pdlv;
+
+    if (!qd_message_send_started(msg)) {
+        const char *tag;
+        int         tag_length;
+
+        qdr_delivery_tag(dlv, &tag, &tag_length);
 
-    if (!settled && !remote_snd_settled) {
-        pn_delivery_set_context(pdlv, dlv);
-        qdr_delivery_set_context(dlv, pdlv);
-        qdr_delivery_incref(dlv);
+        pn_delivery(plink, pn_dtag(tag, tag_length));
+        pdlv = pn_link_current(plink);
+
+        // handle any delivery-state on the transfer e.g. transactional-state
+        qdr_delivery_write_extension_state(dlv, pdlv, true);
+
+        if (!settled && !remote_snd_settled) {
+            pn_delivery_set_context(pdlv, dlv);
+            qdr_delivery_set_context(dlv, pdlv);
+            qdr_delivery_incref(dlv);
+        }
+    } else {
+        //
+        // This delivery is being cut through and is still current on the link.  If the
+        // receiver settled it in the meantime there is nothing left to send.
+        //
+        pdlv = pn_link_current(plink);
+        if (!pdlv)
+            return true;
     }
 
-    qd_message_send(qdr_delivery_message(dlv), qlink, qdr_link_strip_annotations_out(link));
+    qd_connection_t *qconn = qd_link_connection(qlink);
+    qd_message_send(msg, qlink, qdr_link_strip_annotations_out(link), qconn->deflate ? qconn->compression : 0);
+
+    if (!qd_message_send_complete(msg))
+        return false;
+
+    if (qd_delivery_trace_enabled())
+        AMQP_trace_delivery(QD_TRACE_EGRESS, qlink, link, msg, 0, settled || remote_snd_settled);
+
+    if (qd_path_trace_enabled())
+        qd_path_trace_sent(msg, qdr_delivery_handoff_ns(dlv), qd_connection_connection_id(qd_link_connection(qlink)),
+                           qdr_link_identity(link));
 
     if (!settled && remote_snd_settled)
         // Tell the core that the delivery has been accepted and settled, since we are settling on behalf of the receiver
@@ -1064,6 +1512,7 @@ static void CORE_link_deliver(void *context, qdr_link_t *link, qdr_delivery_t *d
         pn_delivery_settle(pdlv);
 
     pn_link_advance(plink);
+    return true;
 }
 
 
@@ -1116,6 +1565,7 @@ static void CORE_delivery_update(void *context, qdr_delivery_t *dlv, uint64_t di
 void qd_router_setup_late(qd_dispatch_t *qd)
 {
     qd->router->tracemask   = qd_tracemask();
+    qd_tracemask_set_self(qd->router->tracemask, node_id);
     qd->router->router_core = qdr_core(qd, qd->router->router_mode, qd->router->router_area, qd->router->router_id);
 
     qdr_connection_handlers(qd->router->router_core, (void*) qd->router,
@@ -1133,6 +1583,9 @@ void qd_router_setup_late(qd_dispatch_t *qd)
 
     qd_router_python_setup(qd->router);
     qd_timer_schedule(qd->router->timer, 1000);
+    qd_timer_schedule(qd->router->rate_timer, QDR_RATE_TICK_MSEC);
+    if (qd->console_feed_interval > 0)
+        qd_timer_schedule(qd->router->console_timer, qd->console_feed_interval);
 }
 
 void qd_router_free(qd_router_t *router)
@@ -1144,12 +1597,16 @@ void qd_router_free(qd_router_t *router)
     qdr_core_free(router->router_core);
     qd_tracemask_free(router->tracemask);
     qd_timer_free(router->timer);
+    qd_timer_free(router->rate_timer);
+    qd_timer_free(router->console_timer);
     sys_mutex_free(router->lock);
     qd_router_configure_free(router);
     qd_router_python_free(router);
 
     free(router);
     free(node_id);
+    qd_buffer_list_free_buffers(&node_trace_encoded);
+    qd_buffer_list_free_buffers(&node_ingress_encoded);
     free(direct_prefix);
 }
 
@@ -64,6 +64,8 @@ struct qd_router_t {
 
     sys_mutex_t              *lock;
     qd_timer_t               *timer;
+    qd_timer_t               *rate_timer;
+    qd_timer_t               *console_timer;
 };
 
 #endif
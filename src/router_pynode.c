@@ -30,13 +30,15 @@
 static qd_log_source_t *log_source = 0;
 static PyObject        *pyRouter   = 0;
 static PyObject        *pyTick     = 0;
-static PyObject        *pyAdded    = 0;
-static PyObject        *pyRemoved  = 0;
+static PyObject        *pyChanged  = 0;
 static PyObject        *pyLinkLost = 0;
 
+typedef struct qd_spf_t qd_spf_t;
+
 typedef struct {
     PyObject_HEAD
     qd_router_t *router;
+    qd_spf_t    *spf;     // Route computation state, see qd_calculate_routes
 } RouterAdapter;
 
 
@@ -219,6 +221,54 @@ static PyObject* qd_set_valid_origins(PyObject *self, PyObject *args)
 }
 
 
+static PyObject* qd_set_equal_cost_hops(PyObject *self, PyObject *args)
+{
+    RouterAdapter *adapter = (RouterAdapter*) self;
+    qd_router_t   *router  = adapter->router;
+    int            router_maskbit;
+    PyObject      *lists[2];
+    qd_bitmask_t  *masks[2] = {0, 0};
+    char          *error = 0;
+
+    if (!PyArg_ParseTuple(args, "iOO", &router_maskbit, &lists[0], &lists[1]))
+        return 0;
+
+    if (router_maskbit >= qd_bitmask_width() || router_maskbit < 0)
+        error = "Router bit mask out of range";
+
+    for (int i = 0; i < 2 && !error; i++) {
+        if (!PyList_Check(lists[i])) {
+            error = "Expected List as arguments 2 and 3";
+            break;
+        }
+
+        masks[i] = qd_bitmask(0);
+        Py_ssize_t count = PyList_Size(lists[i]);
+        for (Py_ssize_t idx = 0; idx < count; idx++) {
+            int maskbit = PyInt_AS_LONG(PyList_GetItem(lists[i], idx));
+            if (maskbit >= qd_bitmask_width() || maskbit < 0) {
+                error = "Router bit mask out of range";
+                break;
+            }
+            qd_bitmask_set_bit(masks[i], maskbit);
+        }
+    }
+
+    if (error) {
+        if (masks[0]) qd_bitmask_free(masks[0]);
+        if (masks[1]) qd_bitmask_free(masks[1]);
+        PyErr_SetString(PyExc_Exception, error);
+        return 0;
+    }
+
+    qd_bitmask_set_bit(masks[1], 0);  // This router is a valid origin for all destinations
+    qdr_core_set_equal_cost_hops(router->router_core, router_maskbit, masks[0], masks[1]);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+
 static PyObject* qd_map_destination(PyObject *self, PyObject *args)
 {
     RouterAdapter *adapter = (RouterAdapter*) self;
@@ -262,6 +312,425 @@ static PyObject* qd_unmap_destination(PyObject *self, PyObject *args)
     return Py_None;
 }
 
+/**
+ * Map or unmap a list of destinations for one router.  The changes reach the core as
+ * a single route-table commit.
+ */
+static PyObject* qd_map_destinations_common(PyObject *self, PyObject *args, bool map)
+{
+    RouterAdapter *adapter = (RouterAdapter*) self;
+    qd_router_t   *router  = adapter->router;
+    PyObject      *addrs;
+    int            maskbit;
+
+    if (!PyArg_ParseTuple(args, "Oi", &addrs, &maskbit))
+        return 0;
+
+    if (maskbit >= qd_bitmask_width() || maskbit < 0) {
+        PyErr_SetString(PyExc_Exception, "Router bit mask out of range");
+        return 0;
+    }
+
+    PyObject *seq = PySequence_Fast(addrs, "Destinations must be a sequence");
+    if (!seq)
+        return 0;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    for (Py_ssize_t idx = 0; idx < count; idx++) {
+        if (!PyString_Check(PySequence_Fast_GET_ITEM(seq, idx))) {
+            Py_DECREF(seq);
+            PyErr_SetString(PyExc_TypeError, "Destinations must be strings");
+            return 0;
+        }
+    }
+
+    qdr_core_route_table_begin(router->router_core);
+    for (Py_ssize_t idx = 0; idx < count; idx++) {
+        const char *addr_string = PyString_AsString(PySequence_Fast_GET_ITEM(seq, idx));
+        if (map)
+            qdr_core_map_destination(router->router_core, maskbit, addr_string);
+        else
+            qdr_core_unmap_destination(router->router_core, maskbit, addr_string);
+    }
+    qdr_core_route_table_commit(router->router_core);
+
+    Py_DECREF(seq);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* qd_map_destinations(PyObject *self, PyObject *args)
+{
+    return qd_map_destinations_common(self, args, true);
+}
+
+
+static PyObject* qd_unmap_destinations(PyObject *self, PyObject *args)
+{
+    return qd_map_destinations_common(self, args, false);
+}
+
+
+/**
+ * Native shortest-path-first engine used by PathEngine.calculate_routes.
+ *
+ * Node ids are indexed in sorted order so that scanning for the lowest-cost
+ * unresolved node in index order breaks cost ties by id, exactly like the
+ * NodeSet in path.py.  This keeps the computed trees identical to the Python
+ * implementation.
+ *
+ * The engine keeps the shortest-path tree of every root from the previous
+ * computation.  When the set of routers is unchanged, each changed edge is
+ * checked against the cached trees and only the trees it can alter are
+ * recomputed; a flapping cost on one link usually leaves most of them intact.
+ */
+typedef struct {
+    int  peer;
+    long cost;
+} qd_spf_edge_t;
+
+struct qd_spf_t {
+    PyObject      *ids;         // sorted list of node ids
+    PyObject      *index;       // id => position in ids
+    int            count;
+    int           *edge_start;  // count + 1 offsets into edges
+    qd_spf_edge_t *edges;       // ordered by peer within each node
+    long          *cost;        // count x count, one row per root. -1 == unreachable
+    int           *prev;        // count x count, -1 == root or unreachable
+    int           *order;       // count x count, nodes in the order they were resolved
+    int           *resolved;    // per root, number of entries in its order row
+    char          *valid;       // per root, the row matches the current edges
+    char          *done;        // scratch
+};
+
+
+static void qd_spf_free(qd_spf_t *spf)
+{
+    if (!spf)
+        return;
+    Py_XDECREF(spf->ids);
+    Py_XDECREF(spf->index);
+    free(spf->edge_start);
+    free(spf->edges);
+    free(spf->cost);
+    free(spf->prev);
+    free(spf->order);
+    free(spf->resolved);
+    free(spf->valid);
+    free(spf->done);
+    free(spf);
+}
+
+
+static int qd_spf_edge_cmp(const void *a, const void *b)
+{
+    return ((const qd_spf_edge_t*) a)->peer - ((const qd_spf_edge_t*) b)->peer;
+}
+
+
+/**
+ * Build an engine for the sorted ids and the {id: {peer: cost}} map.  The trees are
+ * allocated but not computed.  Returns 0 with a Python error set on failure.
+ */
+static qd_spf_t *qd_spf(PyObject *ids, PyObject *link_states)
+{
+    qd_spf_t *spf = NEW(qd_spf_t);
+    memset(spf, 0, sizeof(qd_spf_t));
+    Py_INCREF(ids);
+    spf->ids   = ids;
+    spf->index = PyDict_New();
+    spf->count = (int) PyList_Size(ids);
+    if (!spf->index)
+        goto error;
+
+    Py_ssize_t edge_count = 0;
+    for (int i = 0; i < spf->count; i++) {
+        PyObject *idx   = PyInt_FromLong(i);
+        int       rc    = idx ? PyDict_SetItem(spf->index, PyList_GET_ITEM(ids, i), idx) : -1;
+        PyObject *peers = PyDict_GetItem(link_states, PyList_GET_ITEM(ids, i));
+        Py_XDECREF(idx);
+        if (rc < 0)
+            goto error;
+        if (!PyDict_Check(peers)) {
+            PyErr_SetString(PyExc_TypeError, "Link state peers must be a dict");
+            goto error;
+        }
+        edge_count += PyDict_Size(peers);
+    }
+
+    size_t cells = (size_t) spf->count * spf->count + 1;
+    spf->edge_start = NEW_ARRAY(int, spf->count + 1);
+    spf->edges      = NEW_ARRAY(qd_spf_edge_t, edge_count + 1);
+    spf->cost       = NEW_ARRAY(long, cells);
+    spf->prev       = NEW_ARRAY(int, cells);
+    spf->order      = NEW_ARRAY(int, cells);
+    spf->resolved   = NEW_ARRAY(int, spf->count + 1);
+    spf->valid      = NEW_ARRAY(char, spf->count + 1);
+    spf->done       = NEW_ARRAY(char, spf->count + 1);
+    memset(spf->valid, 0, spf->count + 1);
+
+    //
+    // Flatten the map into an adjacency array ordered by peer so two engines can be
+    // compared edge by edge.
+    //
+    int edge = 0;
+    for (int i = 0; i < spf->count; i++) {
+        PyObject  *peers = PyDict_GetItem(link_states, PyList_GET_ITEM(ids, i));
+        PyObject  *peer;
+        PyObject  *cost;
+        Py_ssize_t pos = 0;
+
+        spf->edge_start[i] = edge;
+        while (PyDict_Next(peers, &pos, &peer, &cost)) {
+            PyObject *peer_idx = PyDict_GetItem(spf->index, peer);
+            if (!peer_idx)
+                continue;  // No link state for this peer, it can't be part of a path
+            spf->edges[edge].peer = (int) PyInt_AsLong(peer_idx);
+            spf->edges[edge].cost = PyInt_AsLong(cost);
+            if (spf->edges[edge].cost < 0) {
+                if (!PyErr_Occurred())
+                    PyErr_SetString(PyExc_ValueError, "Link cost must not be negative");
+                goto error;
+            }
+            edge++;
+        }
+        qsort(spf->edges + spf->edge_start[i], edge - spf->edge_start[i], sizeof(qd_spf_edge_t), qd_spf_edge_cmp);
+    }
+    spf->edge_start[spf->count] = edge;
+    return spf;
+
+error:
+    qd_spf_free(spf);
+    return 0;
+}
+
+
+static void qd_spf_tree(qd_spf_t *spf, int root)
+{
+    long *cost  = spf->cost  + (size_t) root * spf->count;
+    int  *prev  = spf->prev  + (size_t) root * spf->count;
+    int  *order = spf->order + (size_t) root * spf->count;
+    int   resolved = 0;
+
+    for (int i = 0; i < spf->count; i++) {
+        cost[i] = -1;
+        prev[i] = -1;
+        spf->done[i] = 0;
+    }
+    cost[root] = 0;
+
+    while (1) {
+        int u = -1;
+        for (int i = 0; i < spf->count; i++)
+            if (!spf->done[i] && cost[i] >= 0 && (u < 0 || cost[i] < cost[u]))
+                u = i;
+        if (u < 0)
+            break;  // There are no more reachable unresolved nodes
+
+        spf->done[u] = 1;
+        order[resolved++] = u;
+        for (int e = spf->edge_start[u]; e < spf->edge_start[u + 1]; e++) {
+            int v = spf->edges[e].peer;
+            if (!spf->done[v]) {
+                long alt = cost[u] + spf->edges[e].cost;
+                if (cost[v] < 0 || alt < cost[v]) {
+                    cost[v] = alt;
+                    prev[v] = u;
+                }
+            }
+        }
+    }
+
+    spf->resolved[root] = resolved;
+    spf->valid[root]    = 1;
+}
+
+
+/**
+ * Check one edge change against the cached trees of the old engine and carry the rest
+ * over.  old_cost or new_cost is -1 when the edge is absent on that side.
+ *
+ * A tree is unaffected when the edge was not one of its branches and the new cost
+ * does not reach the peer at or below its current cost: every node then keeps its
+ * cost, the resolution order is unchanged and the first node to reach each
+ * minimum (the predecessor) is the same.
+ */
+static void qd_spf_edge_changed(qd_spf_t *old, int u, int v, long old_cost, long new_cost)
+{
+    for (int r = 0; r < old->count; r++) {
+        if (!old->valid[r])
+            continue;
+        long *cost = old->cost + (size_t) r * old->count;
+        int  *prev = old->prev + (size_t) r * old->count;
+        if (old_cost >= 0 && prev[v] == u)
+            old->valid[r] = 0;
+        else if (new_cost >= 0 && cost[u] >= 0 && (cost[v] < 0 || cost[u] + new_cost <= cost[v]))
+            old->valid[r] = 0;
+    }
+}
+
+
+/**
+ * Reuse the trees of the previous engine that no edge change can have touched.
+ */
+static void qd_spf_inherit(qd_spf_t *spf, qd_spf_t *old)
+{
+    if (!old || old->count != spf->count ||
+        PyObject_RichCompareBool(old->ids, spf->ids, Py_EQ) != 1) {
+        PyErr_Clear();
+        return;
+    }
+
+    for (int u = 0; u < spf->count; u++) {
+        int oe = old->edge_start[u];
+        int ne = spf->edge_start[u];
+        while (oe < old->edge_start[u + 1] || ne < spf->edge_start[u + 1]) {
+            int op = oe < old->edge_start[u + 1] ? old->edges[oe].peer : spf->count;
+            int np = ne < spf->edge_start[u + 1] ? spf->edges[ne].peer : spf->count;
+            if (op == np) {
+                if (old->edges[oe].cost != spf->edges[ne].cost)
+                    qd_spf_edge_changed(old, u, op, old->edges[oe].cost, spf->edges[ne].cost);
+                oe++;
+                ne++;
+            } else if (op < np) {
+                qd_spf_edge_changed(old, u, op, old->edges[oe].cost, -1);
+                oe++;
+            } else {
+                qd_spf_edge_changed(old, u, np, -1, spf->edges[ne].cost);
+                ne++;
+            }
+        }
+    }
+
+    size_t row = (size_t) spf->count;
+    for (int r = 0; r < spf->count; r++) {
+        if (!old->valid[r])
+            continue;
+        memcpy(spf->cost  + r * row, old->cost  + r * row, row * sizeof(long));
+        memcpy(spf->prev  + r * row, old->prev  + r * row, row * sizeof(int));
+        memcpy(spf->order + r * row, old->order + r * row, row * sizeof(int));
+        spf->resolved[r] = old->resolved[r];
+        spf->valid[r]    = 1;
+    }
+}
+
+
+static PyObject* qd_calculate_routes(PyObject *self, PyObject *args)
+{
+    RouterAdapter *adapter = (RouterAdapter*) self;
+    PyObject      *root_id;
+    PyObject      *link_states;
+
+    if (!PyArg_ParseTuple(args, "OO!", &root_id, &PyDict_Type, &link_states))
+        return 0;
+
+    PyObject *ids = PyDict_Keys(link_states);
+    if (!ids || PyList_Sort(ids) < 0) {
+        Py_XDECREF(ids);
+        return 0;
+    }
+    qd_spf_t *spf = qd_spf(ids, link_states);
+    Py_DECREF(ids);
+    if (!spf)
+        return 0;
+
+    qd_spf_inherit(spf, adapter->spf);
+    qd_spf_free(adapter->spf);
+    adapter->spf = spf;
+
+    PyObject *next_hops     = PyDict_New();
+    PyObject *costs         = PyDict_New();
+    PyObject *valid_origins = PyDict_New();
+    PyObject *result        = Py_BuildValue("(NNN)", next_hops, costs, valid_origins);
+    if (!result)
+        return 0;
+
+    PyObject *root_idx = PyDict_GetItem(spf->index, root_id);
+    if (!root_idx)
+        return result;  // We have no link state yet, nothing is reachable
+    int root = (int) PyInt_AsLong(root_idx);
+
+    //
+    // Shortest-path tree from this router.  The order row lists each node after its
+    // predecessor, so one pass distills the tree into first hops.
+    //
+    size_t row = (size_t) spf->count;
+    if (!spf->valid[root])
+        qd_spf_tree(spf, root);
+    long *cost  = spf->cost  + root * row;
+    int  *prev  = spf->prev  + root * row;
+    int  *order = spf->order + root * row;
+    int  *first = NEW_ARRAY(int, spf->count + 1);
+    char *through = NEW_ARRAY(char, spf->count + 1);
+    int   err   = 0;
+
+    for (int k = 1; k < spf->resolved[root] && !err; k++) {
+        int       v  = order[k];
+        PyObject *id = PyList_GET_ITEM(spf->ids, v);
+        first[v] = prev[v] == root ? v : first[prev[v]];
+
+        PyObject *c  = PyInt_FromLong(cost[v]);
+        PyObject *vo = PyList_New(0);
+        err = !c || !vo
+            || PyDict_SetItem(next_hops, id, PyList_GET_ITEM(spf->ids, first[v])) < 0
+            || PyDict_SetItem(costs, id, c) < 0
+            || PyDict_SetItem(valid_origins, id, vo) < 0;
+        Py_XDECREF(c);
+        Py_XDECREF(vo);
+    }
+
+    //
+    // A remote router is a valid origin for a destination when the destination lies
+    // below us in the origin's shortest-path tree.  Origins are visited in id order so
+    // the lists are stable between computations.
+    //
+    for (int r = 0; r < spf->count && !err; r++) {
+        if (r == root || cost[r] < 0)
+            continue;
+        if (!spf->valid[r])
+            qd_spf_tree(spf, r);
+        int *r_prev  = spf->prev  + r * row;
+        int *r_order = spf->order + r * row;
+        for (int k = 1; k < spf->resolved[r] && !err; k++) {
+            int v = r_order[k];
+            int u = r_prev[v];
+            through[v] = u == root || (u != r && through[u]);
+            if (through[v] && v != root) {
+                PyObject *origins = PyDict_GetItem(valid_origins, PyList_GET_ITEM(spf->ids, v));
+                err = !origins || PyList_Append(origins, PyList_GET_ITEM(spf->ids, r)) < 0;
+            }
+        }
+    }
+
+    free(first);
+    free(through);
+
+    if (err) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_Exception, "Route computation failed");
+        Py_DECREF(result);
+        return 0;
+    }
+    return result;
+}
+
+
+static PyObject* qd_begin_route_table(PyObject *self, PyObject *args)
+{
+    RouterAdapter *adapter = (RouterAdapter*) self;
+    qdr_core_route_table_begin(adapter->router->router_core);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* qd_commit_route_table(PyObject *self, PyObject *args)
+{
+    RouterAdapter *adapter = (RouterAdapter*) self;
+    qdr_core_route_table_commit(adapter->router->router_core);
+    Py_RETURN_NONE;
+}
+
+
 static PyObject* qd_get_agent(PyObject *self, PyObject *args) {
     RouterAdapter *adapter = (RouterAdapter*) self;
     PyObject *agent = adapter->router->qd->agent;
@@ -281,19 +750,31 @@ static PyMethodDef RouterAdapter_methods[] = {
     {"remove_next_hop",     qd_remove_next_hop,   METH_VARARGS, "Remove the next hop for a remote router"},
     {"set_cost",            qd_set_cost,          METH_VARARGS, "Set the cost to reach a remote router"},
     {"set_valid_origins",   qd_set_valid_origins, METH_VARARGS, "Set the valid origins for a remote router"},
+    {"set_equal_cost_hops", qd_set_equal_cost_hops, METH_VARARGS, "Set the equal-cost next hops and their valid origins for a remote router"},
     {"map_destination",     qd_map_destination,   METH_VARARGS, "Add a newly discovered destination mapping"},
     {"unmap_destination",   qd_unmap_destination, METH_VARARGS, "Delete a destination mapping"},
+    {"map_destinations",    qd_map_destinations,  METH_VARARGS, "Add a list of destination mappings for one router"},
+    {"unmap_destinations",  qd_unmap_destinations, METH_VARARGS, "Delete a list of destination mappings for one router"},
+    {"calculate_routes",    qd_calculate_routes,  METH_VARARGS, "Compute next hops, costs and valid origins from a link-state map"},
+    {"begin_route_table",   qd_begin_route_table, METH_NOARGS,  "Stage the following route-table changes"},
+    {"commit_route_table",  qd_commit_route_table, METH_NOARGS, "Hand the staged route-table changes to the core as one action"},
     {"get_agent",           qd_get_agent,         METH_VARARGS, "Get the management agent"},
     {0, 0, 0, 0}
 };
 
+static void RouterAdapter_dealloc(PyObject *self)
+{
+    qd_spf_free(((RouterAdapter*) self)->spf);
+    self->ob_type->tp_free(self);
+}
+
 static PyTypeObject RouterAdapterType = {
     PyObject_HEAD_INIT(0)
     0,                         /* ob_size*/
     "dispatch.RouterAdapter",  /* tp_name*/
     sizeof(RouterAdapter),     /* tp_basicsize*/
     0,                         /* tp_itemsize*/
-    0,                         /* tp_dealloc*/
+    RouterAdapter_dealloc,     /* tp_dealloc*/
     0,                         /* tp_print*/
     0,                         /* tp_getattr*/
     0,                         /* tp_setattr*/
@@ -339,36 +820,28 @@ static PyTypeObject RouterAdapterType = {
 };
 
 
-static void qd_router_mobile_added(void *context, const char *address_hash)
+static PyObject *qd_router_address_list(const char **addresses, int count)
 {
-    qd_router_t *router = (qd_router_t*) context;
-    PyObject    *pArgs;
-    PyObject    *pValue;
-
-    if (pyAdded && router->router_mode == QD_ROUTER_MODE_INTERIOR) {
-        qd_python_lock_state_t lock_state = qd_python_lock();
-        pArgs = PyTuple_New(1);
-        PyTuple_SetItem(pArgs, 0, PyString_FromString(address_hash));
-        pValue = PyObject_CallObject(pyAdded, pArgs);
-        qd_error_py();
-        Py_DECREF(pArgs);
-        Py_XDECREF(pValue);
-        qd_python_unlock(lock_state);
-    }
+    PyObject *list = PyList_New(count);
+    for (int i = 0; list && i < count; i++)
+        PyList_SET_ITEM(list, i, PyString_FromString(addresses[i]));
+    return list;
 }
 
 
-static void qd_router_mobile_removed(void *context, const char *address_hash)
+static void qd_router_mobile_changed(void *context, const char **added, int added_count,
+                                     const char **removed, int removed_count)
 {
     qd_router_t *router = (qd_router_t*) context;
     PyObject    *pArgs;
     PyObject    *pValue;
 
-    if (pyRemoved && router->router_mode == QD_ROUTER_MODE_INTERIOR) {
+    if (pyChanged && router->router_mode == QD_ROUTER_MODE_INTERIOR) {
         qd_python_lock_state_t lock_state = qd_python_lock();
-        pArgs = PyTuple_New(1);
-        PyTuple_SetItem(pArgs, 0, PyString_FromString(address_hash));
-        pValue = PyObject_CallObject(pyRemoved, pArgs);
+        pArgs = PyTuple_New(2);
+        PyTuple_SetItem(pArgs, 0, qd_router_address_list(added, added_count));
+        PyTuple_SetItem(pArgs, 1, qd_router_address_list(removed, removed_count));
+        pValue = PyObject_CallObject(pyChanged, pArgs);
         qd_error_py();
         Py_DECREF(pArgs);
         Py_XDECREF(pValue);
@@ -383,7 +856,7 @@ static void qd_router_link_lost(void *context, int link_mask_bit)
     PyObject    *pArgs;
     PyObject    *pValue;
 
-    if (pyRemoved && router->router_mode == QD_ROUTER_MODE_INTERIOR) {
+    if (pyLinkLost && router->router_mode == QD_ROUTER_MODE_INTERIOR) {
         qd_python_lock_state_t lock_state = qd_python_lock();
         pArgs = PyTuple_New(1);
         PyTuple_SetItem(pArgs, 0, PyInt_FromLong((long) link_mask_bit));
@@ -403,8 +876,7 @@ qd_error_t qd_router_python_setup(qd_router_t *router)
 
     qdr_core_route_table_handlers(router->router_core,
                                   router,
-                                  qd_router_mobile_added,
-                                  qd_router_mobile_removed,
+                                  qd_router_mobile_changed,
                                   qd_router_link_lost);
 
     //
@@ -472,8 +944,7 @@ qd_error_t qd_router_python_setup(qd_router_t *router)
     QD_ERROR_PY_RET();
 
     pyTick = PyObject_GetAttrString(pyRouter, "handleTimerTick"); QD_ERROR_PY_RET();
-    pyAdded = PyObject_GetAttrString(pyRouter, "addressAdded"); QD_ERROR_PY_RET();
-    pyRemoved = PyObject_GetAttrString(pyRouter, "addressRemoved"); QD_ERROR_PY_RET();
+    pyChanged = PyObject_GetAttrString(pyRouter, "addressesChanged"); QD_ERROR_PY_RET();
     pyLinkLost = PyObject_GetAttrString(pyRouter, "linkLost"); QD_ERROR_PY_RET();
     return qd_error_code();
 }
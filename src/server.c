@@ -20,10 +20,12 @@
 #include <Python.h>
 #include <qpid/dispatch/ctools.h>
 #include <qpid/dispatch/threading.h>
+#include <qpid/dispatch/atomic.h>
 #include <qpid/dispatch/log.h>
 #include <qpid/dispatch/amqp.h>
 #include <qpid/dispatch/server.h>
 #include <qpid/dispatch/failoverlist.h>
+#include <qpid/dispatch/router_core.h>
 
 #include <proton/event.h>
 #include <proton/listener.h>
@@ -38,12 +40,46 @@
 #include "policy.h"
 #include "server_private.h"
 #include "timer_private.h"
+#include "profile.h"
 #include "alloc.h"
 #include "config.h"
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <time.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/* Event-loop metrics of one worker thread, read by the workerThread entity */
+#define QD_WORKER_EVENT_TYPES   64   /* Types at or above the last slot are counted there */
+#define QD_WORKER_BATCH_BUCKETS 8
+#define QD_WORKER_BATCH_SIZES   64   /* Exact batch sizes counted for the median, the last slot is unbounded */
+
+typedef struct qd_worker_stats_t qd_worker_stats_t;
+struct qd_worker_stats_t {
+    DEQ_LINKS(qd_worker_stats_t);
+    int      index;
+    uint64_t batches;
+    uint64_t events;
+    uint64_t idle_ns;
+    uint64_t busy_ns;
+    uint64_t latency_ns;  /* Smoothed time to handle a batch, drives accept throttling */
+    uint64_t batch_histogram[QD_WORKER_BATCH_BUCKETS];  /* Bucket N > 0: batches of 2^(N-1) to 2^N - 1 events */
+    uint64_t batch_sizes[QD_WORKER_BATCH_SIZES];
+    uint64_t event_count[QD_WORKER_EVENT_TYPES];
+    uint64_t event_ns[QD_WORKER_EVENT_TYPES];
+    uint64_t connections;         /* Connections taken up from another thread, or new */
+    uint64_t connection_batches;  /* Batches of a connection's events */
+    uint64_t timer_visits;        /* PN_PROACTOR_TIMEOUT events, each running the due timers */
+    uint64_t timer_ns;
+};
+DEQ_DECLARE(qd_worker_stats_t, qd_worker_stats_list_t);
+
+const char *QD_WORKER_THREAD_TYPE = "workerThread";
 
 struct qd_server_t {
     qd_dispatch_t            *qd;
@@ -64,6 +100,14 @@ struct qd_server_t {
     uint64_t                 next_connection_id;
     void                     *py_displayname_obj;
     qd_http_server_t         *http;
+    qd_server_wake_handler_t  wake_handler;
+    void                     *wake_context;
+    bool                      stopping;
+    sys_atomic_t              next_worker;  /* Spreads workers across NUMA nodes */
+    qd_worker_stats_list_t    worker_stats;
+    int                       handshakes;          /* Incoming handshakes in progress, all listeners */
+    qd_listener_list_t        deferred_listeners;  /* Listeners with deferred accepts, DEFERRED links */
+    sys_mutex_t              *deferred_call_locks[QD_DEFERRED_CALL_LOCKS];
 };
 
 #define HEARTBEAT_INTERVAL 1000
@@ -88,7 +132,7 @@ const char CERT_FINGERPRINT_SHA256 = '2';
 const char CERT_FINGERPRINT_SHA512 = '5';
 char *COMPONENT_SEPARATOR = ";";
 
-static const int BACKLOG = 50;  /* Listening backlog */
+static const int BACKLOG = 50;  /* Listening backlog if the listener does not set one */
 
 static void setup_ssl_sasl_and_open(qd_connection_t *ctx);
 
@@ -346,10 +390,28 @@ qd_error_t qd_entity_refresh_sslProfile(qd_entity_t* entity, void *impl)
 }
 
 
-static qd_error_t listener_setup_ssl(qd_connection_t *ctx, const qd_server_config_t *config, pn_transport_t *tport)
+/*
+ * Drop a cached SSL domain once it has outlived its lifetime.  Each domain has its own
+ * server-side session cache and session ticket keys, so replacing the domain rotates
+ * the keys and also picks up changed certificate files.  Connections already using
+ * the old domain keep their own reference to it.
+ */
+static void ssl_domain_expire_lh(pn_ssl_domain_t **domain, qd_timestamp_t *created, int lifetime)
+{
+    if (*domain && qd_timer_now() - *created >= (qd_timestamp_t) lifetime * 1000) {
+        pn_ssl_domain_free(*domain);
+        *domain = 0;
+    }
+}
+
+
+static pn_ssl_domain_t *listener_ssl_domain(const qd_server_config_t *config)
 {
     pn_ssl_domain_t *domain = pn_ssl_domain(PN_SSL_MODE_SERVER);
-    if (!domain) return qd_error(QD_ERROR_RUNTIME, "No SSL support");
+    if (!domain) {
+        qd_error(QD_ERROR_RUNTIME, "No SSL support");
+        return 0;
+    }
 
     // setup my identifying cert:
     if (pn_ssl_domain_set_credentials(domain,
@@ -357,12 +419,14 @@ static qd_error_t listener_setup_ssl(qd_connection_t *ctx, const qd_server_confi
                                       config->ssl_private_key_file,
                                       config->ssl_password)) {
         pn_ssl_domain_free(domain);
-        return qd_error(QD_ERROR_RUNTIME, "Cannot set SSL credentials");
+        qd_error(QD_ERROR_RUNTIME, "Cannot set SSL credentials");
+        return 0;
     }
     if (!config->ssl_required) {
         if (pn_ssl_domain_allow_unsecured_client(domain)) {
             pn_ssl_domain_free(domain);
-            return qd_error(QD_ERROR_RUNTIME, "Cannot allow unsecured client");
+            qd_error(QD_ERROR_RUNTIME, "Cannot allow unsecured client");
+            return 0;
         }
     }
 
@@ -370,7 +434,8 @@ static qd_error_t listener_setup_ssl(qd_connection_t *ctx, const qd_server_confi
     if (config->ssl_trusted_certificate_db) {
         if (pn_ssl_domain_set_trusted_ca_db(domain, config->ssl_trusted_certificate_db)) {
             pn_ssl_domain_free(domain);
-            return qd_error(QD_ERROR_RUNTIME, "Cannot set trusted SSL CA" );
+            qd_error(QD_ERROR_RUNTIME, "Cannot set trusted SSL CA" );
+            return 0;
         }
     }
 
@@ -382,18 +447,36 @@ static qd_error_t listener_setup_ssl(qd_connection_t *ctx, const qd_server_confi
     if (config->ssl_require_peer_authentication) {
         if (!trusted || pn_ssl_domain_set_peer_authentication(domain, PN_SSL_VERIFY_PEER, trusted)) {
             pn_ssl_domain_free(domain);
-            return qd_error(QD_ERROR_RUNTIME, "Cannot set peer authentication");
+            qd_error(QD_ERROR_RUNTIME, "Cannot set peer authentication");
+            return 0;
         }
     }
+    return domain;
+}
 
-    ctx->ssl = pn_ssl(tport);
-    if (!ctx->ssl || pn_ssl_init(ctx->ssl, domain, 0)) {
-        pn_ssl_domain_free(domain);
-        return qd_error(QD_ERROR_RUNTIME, "Cannot initialize SSL");
-    }
 
-    pn_ssl_domain_free(domain);
-    return QD_ERROR_NONE;
+/*
+ * The listener's SSL domain is shared by its connections so that clients can resume
+ * their TLS sessions, by session ID or ticket, when they reconnect.
+ */
+static qd_error_t listener_setup_ssl(qd_connection_t *ctx, const qd_server_config_t *config, pn_transport_t *tport)
+{
+    qd_listener_t *li = ctx->listener;
+    qd_error_clear();
+
+    sys_mutex_lock(ctx->server->lock);
+    ssl_domain_expire_lh(&li->ssl_domain, &li->ssl_domain_created, config->ssl_session_lifetime);
+    if (!li->ssl_domain) {
+        li->ssl_domain         = listener_ssl_domain(config);
+        li->ssl_domain_created = qd_timer_now();
+    }
+    if (li->ssl_domain) {
+        ctx->ssl = pn_ssl(tport);
+        if (!ctx->ssl || pn_ssl_init(ctx->ssl, li->ssl_domain, 0))
+            qd_error(QD_ERROR_RUNTIME, "Cannot initialize SSL");
+    }
+    sys_mutex_unlock(ctx->server->lock);
+    return qd_error_code();
 }
 
 
@@ -433,6 +516,18 @@ static void decorate_connection(qd_server_t *qd_server, pn_connection_t *conn, c
         pn_data_put_int(pn_connection_properties(conn), config->inter_router_cost);
     }
 
+    if (config && config->inter_router_data) {
+        pn_data_put_symbol(pn_connection_properties(conn),
+                           pn_bytes(strlen(QD_CONNECTION_PROPERTY_DATA_KEY), QD_CONNECTION_PROPERTY_DATA_KEY));
+        pn_data_put_bool(pn_connection_properties(conn), true);
+    }
+
+    if (config && config->inter_router_compression) {
+        pn_data_put_symbol(pn_connection_properties(conn),
+                           pn_bytes(strlen(QD_CONNECTION_PROPERTY_COMPRESSION_KEY), QD_CONNECTION_PROPERTY_COMPRESSION_KEY));
+        pn_data_put_bool(pn_connection_properties(conn), true);
+    }
+
     if (config) {
         qd_failover_list_t *fol = config->failover_list;
         if (fol) {
@@ -488,45 +583,182 @@ qd_connection_t *qd_server_connection(qd_server_t *server, qd_server_config_t *c
     if (!ctx) return NULL;
     ZERO(ctx);
     ctx->pn_conn       = pn_connection();
-    ctx->deferred_call_lock = sys_mutex();
     ctx->role = strdup(config->role);
-    if (!ctx->pn_conn || !ctx->deferred_call_lock || !ctx->role) {
+    if (!ctx->pn_conn || !ctx->role) {
         if (ctx->pn_conn) pn_connection_free(ctx->pn_conn);
-        if (ctx->deferred_call_lock) sys_mutex_free(ctx->deferred_call_lock);
         free(ctx->role);
         return NULL;
     }
     ctx->server = server;
     ctx->wake = connection_wake; /* Default, over-ridden for HTTP connections */
+    sys_atomic_init(&ctx->wake_pending, 0);
     pn_connection_set_context(ctx->pn_conn, ctx);
     DEQ_ITEM_INIT(ctx);
     DEQ_INIT(ctx->deferred_calls);
     sys_mutex_lock(server->lock);
     ctx->connection_id = server->next_connection_id++;
     sys_mutex_unlock(server->lock);
+    ctx->deferred_call_lock = server->deferred_call_locks[ctx->connection_id % QD_DEFERRED_CALL_LOCKS];
     decorate_connection(ctx->server, ctx->pn_conn, config);
     return ctx;
 }
 
 
-static void on_accept(pn_event_t *e)
+/* True if the busiest worker's smoothed batch time is over the configured threshold. */
+static bool workers_overloaded_lh(qd_server_t *server)
 {
-    assert(pn_event_type(e) == PN_LISTENER_ACCEPT);
-    pn_listener_t *pn_listener = pn_event_listener(e);
-    qd_listener_t *listener = pn_listener_get_context(pn_listener);
-    qd_connection_t *ctx = qd_server_connection(listener->server, &listener->config);
+    uint64_t threshold = (uint64_t) server->qd->handshake_latency_threshold * 1000000;
+    if (threshold == 0)
+        return false;
+    qd_worker_stats_t *stats = DEQ_HEAD(server->worker_stats);
+    while (stats) {
+        if (stats->latency_ns > threshold)
+            return true;
+        stats = DEQ_NEXT(stats);
+    }
+    return false;
+}
+
+
+/*
+ * Admission control for incoming connections.  Reserve a handshake slot on the
+ * listener if neither its limit nor the router-wide limit has been reached.  While
+ * the workers are overloaded no new handshake starts until those in progress are
+ * done.
+ */
+static bool admit_lh(qd_server_t *server, qd_listener_t *li)
+{
+    int max_global = server->qd->max_handshakes;
+    int max_local  = li->config.max_handshakes;
+    if ((max_local  && li->handshakes >= max_local) ||
+        (max_global && server->handshakes >= max_global) ||
+        (server->handshakes > 0 && workers_overloaded_lh(server)))
+        return false;
+    li->handshakes++;
+    server->handshakes++;
+    return true;
+}
+
+
+static void release_lh(qd_server_t *server, qd_listener_t *li)
+{
+    li->handshakes--;
+    server->handshakes--;
+}
+
+
+static void accept_connection(qd_listener_t *listener, bool rejected)
+{
+    qd_server_t     *server = listener->server;
+    qd_connection_t *ctx    = qd_server_connection(server, &listener->config);
     if (!ctx) {
-        qd_log(listener->server->log_source, QD_LOG_CRITICAL,
+        qd_log(server->log_source, QD_LOG_CRITICAL,
                "Allocation failure during accept to %s", listener->config.host_port);
+        if (!rejected) {
+            sys_mutex_lock(server->lock);
+            release_lh(server, listener);
+            sys_mutex_unlock(server->lock);
+        }
         return;
     }
-    ctx->listener = listener;
-    qd_log(listener->server->log_source, QD_LOG_TRACE,
+    ctx->listener    = listener;
+    ctx->handshaking = !rejected;
+    ctx->rejected    = rejected;
+    qd_log(server->log_source, QD_LOG_TRACE,
            "[%"PRIu64"] Accepting incoming connection from %s to %s",
            ctx->connection_id, qd_connection_name(ctx), ctx->listener->config.host_port);
     /* Asynchronous accept, configure the transport on PN_CONNECTION_BOUND */
-    pn_listener_accept(pn_listener, ctx->pn_conn);
- }
+    pn_listener_accept(listener->pn_listener, ctx->pn_conn);
+}
+
+
+static void on_accept(pn_event_t *e)
+{
+    assert(pn_event_type(e) == PN_LISTENER_ACCEPT);
+    pn_listener_t *pn_listener = pn_event_listener(e);
+    qd_listener_t *listener = pn_listener_get_context(pn_listener);
+    qd_server_t   *server   = listener->server;
+    bool           admitted = false;
+    bool           rejected = false;
+
+    sys_mutex_lock(server->lock);
+    listener->accepts++;
+    if (listener->deferred == 0)
+        admitted = admit_lh(server, listener);
+    if (!admitted) {
+        int max_deferred = listener->config.max_deferred_accepts;
+        if (max_deferred && listener->deferred >= max_deferred) {
+            rejected = true;
+            listener->accepts_rejected++;
+        } else {
+            listener->deferred++;
+            listener->accepts_deferred++;
+            if (!listener->deferring) {
+                listener->deferring = true;
+                DEQ_ITEM_INIT_N(DEFERRED, listener);
+                DEQ_INSERT_TAIL_N(DEFERRED, server->deferred_listeners, listener);
+            }
+        }
+    }
+    sys_mutex_unlock(server->lock);
+
+    if (admitted || rejected)
+        accept_connection(listener, rejected);
+    else
+        qd_log(server->log_source, QD_LOG_DEBUG, "Deferring accept on %s, %d handshakes in progress",
+               listener->config.host_port, listener->handshakes);
+}
+
+
+/*
+ * An incoming connection has finished its handshake, or closed before finishing it.
+ * Release its slot and take up one deferred accept that can now be admitted,
+ * visiting the deferred listeners in turn.
+ */
+static void handshake_done(qd_connection_t *ctx)
+{
+    if (!ctx->handshaking)
+        return;
+    ctx->handshaking = false;
+
+    qd_server_t   *server   = ctx->server;
+    qd_listener_t *admitted = 0;
+
+    sys_mutex_lock(server->lock);
+    release_lh(server, ctx->listener);
+    if (ctx->opened && ctx->ssl && pn_ssl_resume_status(ctx->ssl) == PN_SSL_RESUME_REUSED)
+        ctx->listener->ssl_sessions_resumed++;
+    qd_listener_t *li = DEQ_HEAD(server->deferred_listeners);
+    while (li && !admitted) {
+        qd_listener_t *next = DEQ_NEXT_N(DEFERRED, li);
+        if (admit_lh(server, li)) {
+            admitted = li;
+            li->deferred--;
+            DEQ_REMOVE_N(DEFERRED, server->deferred_listeners, li);
+            if (li->deferred > 0)
+                DEQ_INSERT_TAIL_N(DEFERRED, server->deferred_listeners, li);
+            else
+                li->deferring = false;
+        }
+        li = next;
+    }
+    sys_mutex_unlock(server->lock);
+
+    if (admitted)
+        accept_connection(admitted, false);
+}
+
+
+static void cancel_deferred_accepts(qd_server_t *server, qd_listener_t *li)
+{
+    sys_mutex_lock(server->lock);
+    if (li->deferring) {
+        DEQ_REMOVE_N(DEFERRED, server->deferred_listeners, li);
+        li->deferring = false;
+    }
+    li->deferred = 0;
+    sys_mutex_unlock(server->lock);
+}
 
 
 /* Log the description, set the transport condition (name, description) close the transport tail. */
@@ -566,11 +798,77 @@ static void set_rhost_port(qd_connection_t *ctx) {
                               NI_NUMERICHOST | NI_NUMERICSERV);
         if (!err) {
             snprintf(ctx->rhost_port, sizeof(ctx->rhost_port), "%s:%s", ctx->rhost, rport);
+        } else {
+            ctx->rhost[0] = '\0';
         }
     }
 }
 
 
+/*
+ * Proton does not expose the sockets of its connections.  Find a transport's socket by
+ * its addresses among the process's open descriptors.  This scans the descriptors, so it
+ * is done only for listeners with socket options.  Return -1 if not found.
+ */
+static int transport_socket(pn_transport_t *tport)
+{
+    const pn_netaddr_t *local  = pn_netaddr_local(tport);
+    const pn_netaddr_t *remote = pn_netaddr_remote(tport);
+    if (!local || !remote || !pn_netaddr_sockaddr(local) || !pn_netaddr_sockaddr(remote))
+        return -1;
+
+    DIR *dir = opendir("/proc/self/fd");
+    if (!dir)
+        return -1;
+
+    int            found = -1;
+    struct dirent *entry;
+    while (found < 0 && (entry = readdir(dir))) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+            continue;
+        int                     fd = atoi(entry->d_name);
+        struct sockaddr_storage addr;
+        socklen_t               len = sizeof(addr);
+        if (getpeername(fd, (struct sockaddr*) &addr, &len) != 0 || len != pn_netaddr_socklen(remote) ||
+            memcmp(&addr, pn_netaddr_sockaddr(remote), len) != 0)
+            continue;
+        len = sizeof(addr);
+        if (getsockname(fd, (struct sockaddr*) &addr, &len) != 0 || len != pn_netaddr_socklen(local) ||
+            memcmp(&addr, pn_netaddr_sockaddr(local), len) != 0)
+            continue;
+        found = fd;
+    }
+    closedir(dir);
+    return found;
+}
+
+
+/* Apply a listener's socket options to an accepted connection. */
+static void set_socket_options(qd_connection_t *ctx, const qd_server_config_t *config)
+{
+    if (!config->busy_poll && !config->tcp_quick_ack)
+        return;
+
+    int fd = transport_socket(pn_connection_transport(ctx->pn_conn));
+    if (fd < 0) {
+        qd_log(ctx->server->log_source, QD_LOG_WARNING,
+               "[C%"PRIu64"] Cannot find the socket to set its options", ctx->connection_id);
+        return;
+    }
+
+    int on = 1;
+    if (config->tcp_quick_ack && setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on)) != 0)
+        qd_log(ctx->server->log_source, QD_LOG_WARNING,
+               "[C%"PRIu64"] Cannot set TCP_QUICKACK: %s", ctx->connection_id, strerror(errno));
+#ifdef SO_BUSY_POLL
+    if (config->busy_poll &&
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &config->busy_poll, sizeof(config->busy_poll)) != 0)
+        qd_log(ctx->server->log_source, QD_LOG_WARNING,
+               "[C%"PRIu64"] Cannot set SO_BUSY_POLL: %s", ctx->connection_id, strerror(errno));
+#endif
+}
+
+
 /* Configure the transport once it is bound to the connection */
 static void on_connection_bound(qd_server_t *server, pn_event_t *e) {
     pn_connection_t *pn_conn = pn_event_connection(e);
@@ -578,6 +876,10 @@ static void on_connection_bound(qd_server_t *server, pn_event_t *e) {
     pn_transport_t *tport  = pn_connection_transport(pn_conn);
     pn_transport_set_context(tport, ctx); /* for transport_tracer */
 
+    /* A wake requested before the connection was bound may have been dropped, repeat it */
+    if (sys_atomic_get(&ctx->wake_pending))
+        ctx->wake(ctx);
+
     //
     // Proton pushes out its trace to transport_tracer() which in turn writes a trace
     // message to the qdrouter log If trace level logging is enabled on the router set
@@ -593,6 +895,7 @@ static void on_connection_bound(qd_server_t *server, pn_event_t *e) {
         const char *name = config->host_port;
         pn_transport_set_server(tport);
         set_rhost_port(ctx);
+        set_socket_options(ctx, config);
 
         sys_mutex_lock(server->lock); /* Policy check is not thread safe */
         ctx->policy_counted = qd_policy_socket_accept(server->qd->policy, ctx->rhost);
@@ -603,6 +906,14 @@ static void on_connection_bound(qd_server_t *server, pn_event_t *e) {
             return;
         }
 
+        if (ctx->rejected) {
+            qd_log(server->log_source, QD_LOG_WARNING,
+                   "Rejected connection to %s from %s, too many accepts deferred", name, ctx->rhost_port);
+            pn_transport_close_tail(tport);
+            pn_transport_close_head(tport);
+            return;
+        }
+
         // Set up SSL
         if (config->ssl_profile)  {
             qd_log(ctx->server->log_source, QD_LOG_TRACE, "Configuring SSL on %s", name);
@@ -647,22 +958,26 @@ static void on_connection_bound(qd_server_t *server, pn_event_t *e) {
 
 static void invoke_deferred_calls(qd_connection_t *conn, bool discard)
 {
-    // Lock access to deferred_calls, other threads may concurrently add to it.  Invoke
-    // the calls outside of the critical section.
+    // Take the whole list in one critical section, other threads may concurrently add
+    // to it.  Invoke the calls outside of the critical section; calls added meanwhile
+    // wake the connection again.
     //
+    qd_deferred_call_list_t calls;
     sys_mutex_lock(conn->deferred_call_lock);
+    DEQ_MOVE(conn->deferred_calls, calls);
+    sys_mutex_unlock(conn->deferred_call_lock);
+
     qd_deferred_call_t *dc;
-    while ((dc = DEQ_HEAD(conn->deferred_calls))) {
-        DEQ_REMOVE_HEAD(conn->deferred_calls);
-        sys_mutex_unlock(conn->deferred_call_lock);
+    while ((dc = DEQ_HEAD(calls))) {
+        DEQ_REMOVE_HEAD(calls);
         dc->call(dc->context, discard);
         free_qd_deferred_call_t(dc);
-        sys_mutex_lock(conn->deferred_call_lock);
     }
-    sys_mutex_unlock(conn->deferred_call_lock);
 }
 
-void qd_container_handle_event(qd_container_t *container, pn_event_t *event);
+
+void qd_container_handle_event(qd_container_t *container, pn_event_t *event,
+                               pn_connection_t *conn, qd_connection_t *qd_conn);
 
 static void handle_listener(pn_event_t *e, qd_server_t *qd_server) {
     qd_log_source_t *log = qd_server->log_source;
@@ -694,6 +1009,7 @@ static void handle_listener(pn_event_t *e, qd_server_t *qd_server) {
         } else {
             qd_log(log, QD_LOG_TRACE, "Listener closed on %s", host_port);
         }
+        cancel_deferred_accepts(qd_server, li);
         qd_listener_decref(li);
         break;
     }
@@ -703,20 +1019,171 @@ static void handle_listener(pn_event_t *e, qd_server_t *qd_server) {
 }
 
 
+static int connector_peers(const qd_connector_t *ct)
+{
+    return 1 + (ct->failover_list ? qd_failover_list_size(ct->failover_list) : 0);
+}
+
+
+/* A delay spread over three quarters to five quarters of the given one */
+static long connector_jitter(long delay)
+{
+    return delay > 1 ? delay - delay / 4 + random() % (delay / 2) : delay;
+}
+
+
+/* Start connecting to the next peer not yet tried.  Returns false if the connection cannot be created. */
+static bool connector_attempt_lh(qd_connector_t *ct)
+{
+    const qd_server_config_t *config = &ct->config;
+    int                       peer   = (ct->good + ct->tried) % connector_peers(ct);
+    const char               *host   = config->host;
+    char                      host_port[1024];
+
+    qd_connection_t *ctx = qd_server_connection(ct->server, &ct->config);
+    if (!ctx) {
+        qd_log(ct->server->log_source, QD_LOG_CRITICAL, "Allocation failure connecting to %s",
+               config->host_port);
+        return false;
+    }
+
+    if (peer == 0)
+        snprintf(host_port, sizeof(host_port), "%s", config->host_port);
+    else {
+        host = qd_failover_list_host(ct->failover_list, peer - 1);
+        snprintf(host_port, sizeof(host_port), "%s:%s", host, qd_failover_list_port(ct->failover_list, peer - 1));
+    }
+
+    sys_atomic_inc(&ct->ref_count);  /* Referenced by the attempt's pn_connection_t */
+    ctx->connector      = ct;
+    ctx->connector_peer = peer;
+    ct->probes[ct->probe_count++] = ctx;
+    ct->tried++;
+    ct->state = CXTR_STATE_OPEN;
+
+    //
+    // Set the hostname on the pn_connection. This hostname will be used by proton as the
+    // hostname in the open frame.
+    //
+    pn_connection_set_hostname(ctx->pn_conn, host);
+
+    // Set the sasl user name and password on the proton connection object. This has to be
+    // done before pn_proactor_connect which will bind a transport to the connection
+    if(config->sasl_username)
+        pn_connection_set_user(ctx->pn_conn, config->sasl_username);
+    if (config->sasl_password)
+        pn_connection_set_password(ctx->pn_conn, config->sasl_password);
+
+    qd_log(ct->server->log_source, QD_LOG_TRACE,
+           "[%"PRIu64"] Connecting to %s", ctx->connection_id, host_port);
+    /* Note: the transport is configured in the PN_CONNECTION_BOUND event */
+    pn_proactor_connect(ct->server->proactor, ctx->pn_conn, host_port);
+    return true;
+}
+
+
+/* Try another peer alongside the attempts under way if none has opened in a while */
+static void connector_schedule_probe_lh(qd_connector_t *ct)
+{
+    if (!ct->probe_scheduled && ct->tried < connector_peers(ct)) {
+        ct->probe_scheduled = true;
+        sys_atomic_inc(&ct->ref_count);  /* Referenced by the probe timer */
+        qd_timer_schedule(ct->probe_timer, QD_CONNECTOR_PROBE_DELAY);
+    }
+}
+
+
+static void connector_remove_probe_lh(qd_connector_t *ct, qd_connection_t *ctx)
+{
+    for (int i = 0; i < ct->probe_count; i++) {
+        if (ct->probes[i] == ctx) {
+            ct->probes[i] = ct->probes[--ct->probe_count];
+            break;
+        }
+    }
+}
+
+
+static void connector_deferred_close(void *context, bool discard)
+{
+    if (!discard)
+        pn_connection_close((pn_connection_t*) context);
+}
+
+
+/* The peer opened one of the connector's connections: keep the first, close the others */
+static void connector_connection_opened(qd_connector_t *ct, qd_connection_t *ctx)
+{
+    sys_mutex_lock(ct->lock);
+    connector_remove_probe_lh(ct, ctx);
+    if (ct->ctx) {
+        qd_log(ct->server->log_source, QD_LOG_TRACE,
+               "[%"PRIu64"] Closing connection to %s, another peer answered first", ctx->connection_id,
+               ct->config.host_port);
+        pn_connection_close(ctx->pn_conn);
+    } else {
+        ct->ctx       = ctx;
+        ct->good      = ctx->connector_peer;
+        ct->opened_at = qd_timer_now();
+        for (int i = 0; i < ct->probe_count; i++)
+            qd_connection_invoke_deferred(ct->probes[i], connector_deferred_close, ct->probes[i]->pn_conn);
+    }
+    sys_mutex_unlock(ct->lock);
+}
+
+
+static void connector_connection_closed(qd_connector_t *ct, qd_connection_t *ctx)
+{
+    int  peers    = connector_peers(ct);
+    bool was_open = false;
+
+    sys_mutex_lock(ct->lock);
+    connector_remove_probe_lh(ct, ctx);
+    if (ct->ctx == ctx) {
+        ct->ctx  = 0;
+        was_open = true;
+        if (qd_timer_now() - ct->opened_at >= QD_CONNECTOR_STABLE)
+            ct->backoff = 0;
+    }
+
+    if (!ct->ctx) {
+        //
+        // A failed attempt is followed at once by one to the next peer.  After a
+        // connection is lost, or every peer has failed, the connector waits before
+        // starting over; not at all if the connection had been up for a while.
+        //
+        if (!was_open && ct->tried < peers && ct->probe_count < QD_CONNECTOR_PROBES && connector_attempt_lh(ct)) {
+            connector_schedule_probe_lh(ct);
+        } else if (ct->probe_count == 0) {
+            if (was_open && ct->backoff == 0)
+                ct->delay = 0;
+            else {
+                ct->backoff = ct->backoff ? ct->backoff * 2 : QD_CONNECTOR_BACKOFF_MIN;
+                if (ct->backoff > QD_CONNECTOR_BACKOFF_MAX)
+                    ct->backoff = QD_CONNECTOR_BACKOFF_MAX;
+                ct->delay = connector_jitter(ct->backoff);
+            }
+            ct->state = CXTR_STATE_CONNECTING;
+            sys_atomic_inc(&ct->ref_count);  /* Referenced by timer */
+            qd_timer_schedule(ct->timer, ct->delay);
+        }
+    }
+    sys_mutex_unlock(ct->lock);
+
+    qd_connector_decref(ct);  /* No longer referenced by the pn_connection_t */
+}
+
+
 void qd_connection_free(qd_connection_t *ctx)
 {
     qd_server_t *qd_server = ctx->server;
 
     qd_entity_cache_remove(QD_CONNECTION_TYPE, ctx); /* Removed management entity */
+    handshake_done(ctx);
 
-    // If this is a dispatch connector, schedule the re-connect timer
-    if (ctx->connector) {
-        sys_mutex_lock(ctx->connector->lock);
-        ctx->connector->ctx = 0;
-        ctx->connector->state = CXTR_STATE_CONNECTING;
-        sys_mutex_unlock(ctx->connector->lock);
-        qd_timer_schedule(ctx->connector->timer, ctx->connector->delay);
-    }
+    // If this is a dispatch connector, try another peer or schedule the re-connect timer
+    if (ctx->connector)
+        connector_connection_closed(ctx->connector, ctx);
 
     // If counted for policy enforcement, notify it has closed
     if (ctx->policy_counted) {
@@ -725,21 +1192,18 @@ void qd_connection_free(qd_connection_t *ctx)
         sys_mutex_unlock(qd_server->lock);
     }
 
-    invoke_deferred_calls(ctx, true);  // Discard any pending deferred calls
-    if (ctx->deferred_call_lock)
-        sys_mutex_free(ctx->deferred_call_lock);
-
-    if (ctx->policy_settings) {
-        if (ctx->policy_settings->sources)
-            free(ctx->policy_settings->sources);
-        if (ctx->policy_settings->targets)
-            free(ctx->policy_settings->targets);
-        free (ctx->policy_settings);
-        ctx->policy_settings = 0;
-    }
+    // Discard any pending deferred calls, including those added by the discarded ones
+    while (DEQ_SIZE(ctx->deferred_calls) > 0)
+        invoke_deferred_calls(ctx, true);
+    sys_atomic_destroy(&ctx->wake_pending);
+
+    qd_policy_settings_free(ctx->policy_settings);
+    ctx->policy_settings = 0;
 
     if (ctx->free_user_id) free((char*)ctx->user_id);
     free(ctx->role);
+    if (ctx->deflate)
+        qdr_compression_stats_decref(ctx->compression);
     free_qd_connection_t(ctx);
 
     /* Note: pn_conn is freed by the proactor */
@@ -756,11 +1220,16 @@ static bool handle(qd_server_t *qd_server, pn_event_t *e) {
     switch (pn_event_type(e)) {
 
     case PN_PROACTOR_INTERRUPT:
-        /* Stop the current thread */
-        return false;
+        /* Interrupts are used both to stop threads and by qd_server_wake */
+        if (qd_server->stopping)
+            return false;
+        if (qd_server->wake_handler)
+            qd_server->wake_handler(qd_server->wake_context);
+        break;
 
     case PN_PROACTOR_TIMEOUT:
-        qd_timer_visit();
+        if (!qd_server->qd->timer_thread)
+            qd_timer_visit();
         break;
 
     case PN_LISTENER_OPEN:
@@ -777,13 +1246,20 @@ static bool handle(qd_server_t *qd_server, pn_event_t *e) {
         // If we are transitioning to the open state, notify the client via callback.
         if (!ctx->opened) {
             ctx->opened = true;
+            handshake_done(ctx);
             if (ctx->connector) {
-                ctx->connector->delay = 2000;  // Delay re-connect in case there is a recurring error
+                if (ctx->ssl && pn_ssl_resume_status(ctx->ssl) == PN_SSL_RESUME_REUSED)
+                    qd_log(qd_server->log_source, QD_LOG_DEBUG, "[%"PRIu64"] Resumed TLS session to %s",
+                           ctx->connection_id, ctx->connector->config.host_port);
+                connector_connection_opened(ctx->connector, ctx);
             }
         }
         break;
 
     case PN_CONNECTION_WAKE:
+        // Clear the flag before doing the work so that work requested from now on
+        // wakes the connection again.
+        sys_atomic_swap(&ctx->wake_pending, 0);
         invoke_deferred_calls(ctx, false);
         break;
 
@@ -799,7 +1275,7 @@ static bool handle(qd_server_t *qd_server, pn_event_t *e) {
     } // Switch event type
 
     /* TODO aconway 2017-04-18: fold the container handler into the server */
-    qd_container_handle_event(qd_server->container, e);
+    qd_container_handle_event(qd_server->container, e, pn_conn, ctx);
 
     /* Free the connection after all other processing is complete */
     if (ctx && pn_event_type(e) == PN_TRANSPORT_CLOSED) {
@@ -809,17 +1285,174 @@ static bool handle(qd_server_t *qd_server, pn_event_t *e) {
     return true;
 }
 
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Set up the metrics of a worker thread.  They live as long as the server. */
+static qd_worker_stats_t *worker_stats(qd_server_t *qd_server)
+{
+    qd_worker_stats_t *stats = NEW(qd_worker_stats_t);
+    ZERO(stats);
+    DEQ_ITEM_INIT(stats);
+    sys_mutex_lock(qd_server->lock);
+    stats->index = DEQ_SIZE(qd_server->worker_stats);
+    DEQ_INSERT_TAIL(qd_server->worker_stats, stats);
+    sys_mutex_unlock(qd_server->lock);
+    qd_entity_cache_add(QD_WORKER_THREAD_TYPE, stats);
+    return stats;
+}
+
+
+static int batch_bucket(int events)
+{
+    int bucket = 0;
+    while (events && bucket < QD_WORKER_BATCH_BUCKETS - 1) {
+        events >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+
+/* Count a batch of a connection's events, and the connection if it comes from another thread. */
+static void worker_connection_batch(qd_worker_stats_t *stats, pn_connection_t *pn_conn)
+{
+    if (!pn_conn)
+        return;
+    stats->connection_batches++;
+
+    /* A connection's batches never run concurrently, so its worker field needs no lock */
+    qd_connection_t *ctx = (qd_connection_t*) pn_connection_get_context(pn_conn);
+    if (ctx && ctx->worker != stats->index + 1) {
+        ctx->worker = stats->index + 1;
+        stats->connections++;
+    }
+}
+
+
+static uint64_t median_batch(const qd_worker_stats_t *stats)
+{
+    uint64_t total = 0;
+    for (int size = 0; size < QD_WORKER_BATCH_SIZES; size++)
+        total += stats->batch_sizes[size];
+
+    uint64_t seen = 0;
+    for (int size = 0; size < QD_WORKER_BATCH_SIZES; size++) {
+        seen += stats->batch_sizes[size];
+        if (seen * 2 > total)
+            return size;
+    }
+    return 0;
+}
+
+
+qd_error_t qd_entity_refresh_workerThread(qd_entity_t* entity, void *impl)
+{
+    qd_worker_stats_t *stats = (qd_worker_stats_t*) impl;
+    char identity[32];
+    snprintf(identity, sizeof(identity), "workerThread/%d", stats->index);
+
+    if (qd_entity_set_string(entity, "identity", identity) ||
+        qd_entity_set_long(entity, "thread", stats->index) ||
+        qd_entity_set_long(entity, "batches", stats->batches) ||
+        qd_entity_set_long(entity, "events", stats->events) ||
+        qd_entity_set_long(entity, "idleTime", stats->idle_ns / 1000) ||
+        qd_entity_set_long(entity, "busyTime", stats->busy_ns / 1000) ||
+        qd_entity_set_long(entity, "medianBatch", median_batch(stats)) ||
+        qd_entity_set_long(entity, "connections", stats->connections) ||
+        qd_entity_set_long(entity, "connectionBatches", stats->connection_batches) ||
+        qd_entity_set_long(entity, "timerVisits", stats->timer_visits) ||
+        qd_entity_set_long(entity, "timerTime", stats->timer_ns / 1000) ||
+        qd_entity_set_list(entity, "batchHistogram"))
+        return qd_error_code();
+    for (int bucket = 0; bucket < QD_WORKER_BATCH_BUCKETS; bucket++)
+        if (qd_entity_set_long(entity, "batchHistogram", stats->batch_histogram[bucket]))
+            return qd_error_code();
+
+    if (qd_entity_set_map(entity, "eventCounts") || qd_entity_set_map(entity, "eventTimes"))
+        return qd_error_code();
+    for (int type = 0; type < QD_WORKER_EVENT_TYPES; type++) {
+        if (stats->event_count[type] == 0)
+            continue;
+        const char *name = type < QD_WORKER_EVENT_TYPES - 1 ? pn_event_type_name((pn_event_type_t) type) : 0;
+        if (!name)
+            name = "other";
+        if (qd_entity_set_map_key_value_long(entity, "eventCounts", name, stats->event_count[type]) ||
+            qd_entity_set_map_key_value_long(entity, "eventTimes", name, stats->event_ns[type] / 1000))
+            return qd_error_code();
+    }
+    return QD_ERROR_NONE;
+}
+
+
 static void *thread_run(void *arg)
 {
     qd_server_t      *qd_server = (qd_server_t*)arg;
     bool running = true;
+    qd_worker_stats_t *stats  = worker_stats(qd_server);
+    bool               timing = qd_server->qd->worker_event_timing;
+
+    qd_profile_thread("worker");
+    if (qd_server->qd->worker_cpus) {
+        if (!sys_thread_bind_cpus(qd_server->qd->worker_cpus))
+            qd_log(qd_server->log_source, QD_LOG_WARNING, "Unable to bind worker thread to CPUs %s", qd_server->qd->worker_cpus);
+    } else if (qd_server->qd->numa_aware) {
+        int node = sys_atomic_inc(&qd_server->next_worker) % sys_numa_node_count();
+        if (!sys_thread_bind_node(node))
+            qd_log(qd_server->log_source, QD_LOG_WARNING, "Unable to bind worker thread to NUMA node %d", node);
+    }
+
+    //
+    // The counters are updated only by this thread and read, without locking, by
+    // management.
+    //
+    uint64_t mark = monotonic_ns();
     while (running) {
         pn_event_batch_t *events = pn_proactor_wait(qd_server->proactor);
         pn_event_t * e;
+        uint64_t woke  = monotonic_ns();
+        int      count = 0;
+        stats->idle_ns += woke - mark;
+        //
+        // Core actions generated while handling this batch are handed to the
+        // router core together when the batch is done.
+        //
+        qdr_action_batch_begin();
         while (running && (e = pn_event_batch_next(events))) {
+            int      slot  = pn_event_type(e);
+            bool     timer = slot == PN_PROACTOR_TIMEOUT;
+            uint64_t start = timing || timer ? monotonic_ns() : 0;
+            if (slot < 0 || slot >= QD_WORKER_EVENT_TYPES)
+                slot = QD_WORKER_EVENT_TYPES - 1;
+            if (count == 0)
+                worker_connection_batch(stats, pn_event_connection(e));
             running = handle(qd_server, e);
+            stats->event_count[slot]++;
+            if (timing || timer) {
+                uint64_t elapsed = monotonic_ns() - start;
+                if (timing)
+                    stats->event_ns[slot] += elapsed;
+                if (timer) {
+                    stats->timer_visits++;
+                    stats->timer_ns += elapsed;
+                }
+            }
+            count++;
         }
+        qdr_action_batch_end();
         pn_proactor_done(qd_server->proactor, events);
+        mark = monotonic_ns();
+        stats->busy_ns += mark - woke;
+        stats->latency_ns += ((int64_t) (mark - woke) - (int64_t) stats->latency_ns) / 8;
+        stats->batches++;
+        stats->events += count;
+        stats->batch_histogram[batch_bucket(count)]++;
+        stats->batch_sizes[count < QD_WORKER_BATCH_SIZES ? count : QD_WORKER_BATCH_SIZES - 1]++;
     }
     return NULL;
 }
@@ -828,46 +1461,76 @@ static void *thread_run(void *arg)
 /* Timer callback to try/retry connection open */
 static void try_open_lh(qd_connector_t *ct)
 {
-    if (ct->state != CXTR_STATE_CONNECTING) {
-        /* No longer referenced by pn_connection or timer */
-        qd_connector_decref(ct);
+    if (ct->state != CXTR_STATE_CONNECTING)
         return;
-    }
 
-    qd_connection_t *ctx = qd_server_connection(ct->server, &ct->config);
-    if (!ctx) {                 /* Try again later */
-        qd_log(ct->server->log_source, QD_LOG_CRITICAL, "Allocation failure connecting to %s",
-               ct->config.host_port);
+    ct->tried = 0;
+    if (!connector_attempt_lh(ct)) {  /* Try again later */
         ct->delay = 10000;
+        sys_atomic_inc(&ct->ref_count);  /* Referenced by timer */
         qd_timer_schedule(ct->timer, ct->delay);
         return;
     }
-    ctx->connector    = ct;
+    connector_schedule_probe_lh(ct);
+}
+
+static pn_ssl_domain_t *connector_ssl_domain(qd_connector_t *ct)
+{
     const qd_server_config_t *config = &ct->config;
+    pn_ssl_domain_t *domain = pn_ssl_domain(PN_SSL_MODE_CLIENT);
 
-    //
-    // Set the hostname on the pn_connection. This hostname will be used by proton as the
-    // hostname in the open frame.
-    //
-    pn_connection_set_hostname(ctx->pn_conn, config->host);
+    if (!domain) {
+        qd_error(QD_ERROR_RUNTIME, "SSL domain failed for connection to %s:%s",
+                 ct->config.host, ct->config.port);
+        return 0;
+    }
 
-    // Set the sasl user name and password on the proton connection object. This has to be
-    // done before pn_proactor_connect which will bind a transport to the connection
-    if(config->sasl_username)
-        pn_connection_set_user(ctx->pn_conn, config->sasl_username);
-    if (config->sasl_password)
-        pn_connection_set_password(ctx->pn_conn, config->sasl_password);
+    // set our trusted database for checking the peer's cert:
+    if (config->ssl_trusted_certificate_db) {
+        if (pn_ssl_domain_set_trusted_ca_db(domain, config->ssl_trusted_certificate_db)) {
+            qd_log(ct->server->log_source, QD_LOG_ERROR,
+                   "SSL CA configuration failed for %s:%s",
+                   ct->config.host, ct->config.port);
+        }
+    }
+    // should we force the peer to provide a cert?
+    if (config->ssl_require_peer_authentication) {
+        const char *trusted = (config->ssl_trusted_certificates)
+            ? config->ssl_trusted_certificates
+            : config->ssl_trusted_certificate_db;
+        if (pn_ssl_domain_set_peer_authentication(domain,
+                                                  PN_SSL_VERIFY_PEER,
+                                                  trusted)) {
+            qd_log(ct->server->log_source, QD_LOG_ERROR,
+                   "SSL peer auth configuration failed for %s:%s",
+                   config->host, config->port);
+        }
+    }
 
-    ctx->connector->state = CXTR_STATE_OPEN;
-    ct->ctx   = ctx;
-    ct->delay = 5000;
+    // configure our certificate if the peer requests one:
+    if (config->ssl_certificate_file) {
+        if (pn_ssl_domain_set_credentials(domain,
+                                          config->ssl_certificate_file,
+                                          config->ssl_private_key_file,
+                                          config->ssl_password)) {
+            qd_log(ct->server->log_source, QD_LOG_ERROR,
+                   "SSL local configuration failed for %s:%s",
+                   config->host, config->port);
+        }
+    }
 
-    qd_log(ct->server->log_source, QD_LOG_TRACE,
-           "[%"PRIu64"] Connecting to %s", ctx->connection_id, config->host_port);
-    /* Note: the transport is configured in the PN_CONNECTION_BOUND event */
-    pn_proactor_connect(ct->server->proactor, ctx->pn_conn, config->host_port);
+    //If ssl is enabled and verify_host_name is true, instruct proton to verify peer name
+    if (config->verify_host_name) {
+        if (pn_ssl_domain_set_peer_authentication(domain, PN_SSL_VERIFY_PEER_NAME, NULL)) {
+                qd_log(ct->server->log_source, QD_LOG_ERROR,
+                       "SSL peer host name verification failed for %s:%s",
+                       config->host, config->port);
+        }
+    }
+    return domain;
 }
 
+
 static void setup_ssl_sasl_and_open(qd_connection_t *ctx)
 {
     qd_connector_t *ct = ctx->connector;
@@ -875,63 +1538,27 @@ static void setup_ssl_sasl_and_open(qd_connection_t *ctx)
     pn_transport_t *tport  = pn_connection_transport(ctx->pn_conn);
 
     //
-    // Set up SSL if appropriate
+    // Set up SSL if appropriate.  The connector keeps its SSL domain between
+    // reconnects and names its session so that proton can offer to resume the
+    // previous TLS session to the same peer.
     //
     if (config->ssl_profile) {
-        pn_ssl_domain_t *domain = pn_ssl_domain(PN_SSL_MODE_CLIENT);
-
-        if (!domain) {
-            qd_error(QD_ERROR_RUNTIME, "SSL domain failed for connection to %s:%s",
-                     ct->config.host, ct->config.port);
-            return;
-        }
-
-        // set our trusted database for checking the peer's cert:
-        if (config->ssl_trusted_certificate_db) {
-            if (pn_ssl_domain_set_trusted_ca_db(domain, config->ssl_trusted_certificate_db)) {
-                qd_log(ct->server->log_source, QD_LOG_ERROR,
-                       "SSL CA configuration failed for %s:%s",
-                       ct->config.host, ct->config.port);
-            }
-        }
-        // should we force the peer to provide a cert?
-        if (config->ssl_require_peer_authentication) {
-            const char *trusted = (config->ssl_trusted_certificates)
-                ? config->ssl_trusted_certificates
-                : config->ssl_trusted_certificate_db;
-            if (pn_ssl_domain_set_peer_authentication(domain,
-                                                      PN_SSL_VERIFY_PEER,
-                                                      trusted)) {
-                qd_log(ct->server->log_source, QD_LOG_ERROR,
-                       "SSL peer auth configuration failed for %s:%s",
-                       config->host, config->port);
-            }
+        char session_id[64];
+        snprintf(session_id, sizeof(session_id), "qdrouterd-%p", (void*) ct);
+
+        sys_mutex_lock(ct->server->lock);
+        ssl_domain_expire_lh(&ct->ssl_domain, &ct->ssl_domain_created, config->ssl_session_lifetime);
+        if (!ct->ssl_domain) {
+            ct->ssl_domain         = connector_ssl_domain(ct);
+            ct->ssl_domain_created = qd_timer_now();
         }
-
-        // configure our certificate if the peer requests one:
-        if (config->ssl_certificate_file) {
-            if (pn_ssl_domain_set_credentials(domain,
-                                              config->ssl_certificate_file,
-                                              config->ssl_private_key_file,
-                                              config->ssl_password)) {
-                qd_log(ct->server->log_source, QD_LOG_ERROR,
-                       "SSL local configuration failed for %s:%s",
-                       config->host, config->port);
-            }
+        if (ct->ssl_domain) {
+            ctx->ssl = pn_ssl(tport);
+            pn_ssl_init(ctx->ssl, ct->ssl_domain, session_id);
         }
-
-        //If ssl is enabled and verify_host_name is true, instruct proton to verify peer name
-        if (config->verify_host_name) {
-            if (pn_ssl_domain_set_peer_authentication(domain, PN_SSL_VERIFY_PEER_NAME, NULL)) {
-                    qd_log(ct->server->log_source, QD_LOG_ERROR,
-                           "SSL peer host name verification failed for %s:%s",
-                           config->host, config->port);
-            }
-        }
-
-        ctx->ssl = pn_ssl(tport);
-        pn_ssl_init(ctx->ssl, domain, 0);
-        pn_ssl_domain_free(domain);
+        sys_mutex_unlock(ct->server->lock);
+        if (!ctx->ssl)
+            return;
     }
 
     //
@@ -952,6 +1579,20 @@ static void try_open_cb(void *context) {
     sys_mutex_lock(ct->lock);   /* TODO aconway 2017-05-09: this lock looks too big */
     try_open_lh(ct);
     sys_mutex_unlock(ct->lock);
+    qd_connector_decref(ct);    /* No longer referenced by timer */
+}
+
+
+/* Probe timer callback: no attempt has opened yet, try the next peer as well */
+static void try_probe_cb(void *context) {
+    qd_connector_t *ct = (qd_connector_t*) context;
+    sys_mutex_lock(ct->lock);
+    ct->probe_scheduled = false;
+    if (ct->state == CXTR_STATE_OPEN && !ct->ctx && ct->probe_count > 0 && ct->probe_count < QD_CONNECTOR_PROBES &&
+        ct->tried < connector_peers(ct) && connector_attempt_lh(ct))
+        connector_schedule_probe_lh(ct);
+    sys_mutex_unlock(ct->lock);
+    qd_connector_decref(ct);    /* No longer referenced by the probe timer */
 }
 
 
@@ -983,6 +1624,11 @@ qd_server_t *qd_server(qd_dispatch_t *qd, int thread_count, const char *containe
     qd_server->pause_next_sequence    = 0;
     qd_server->pause_now_serving      = 0;
     qd_server->next_connection_id     = 1;
+    sys_atomic_init(&qd_server->next_worker, 0);
+    DEQ_INIT(qd_server->worker_stats);
+    DEQ_INIT(qd_server->deferred_listeners);
+    for (int i = 0; i < QD_DEFERRED_CALL_LOCKS; i++)
+        qd_server->deferred_call_locks[i] = sys_mutex();
     qd_server->py_displayname_obj     = 0;
 
     qd_server->http = qd_http_server(qd_server, qd_server->log_source);
@@ -1000,6 +1646,16 @@ void qd_server_free(qd_server_t *qd_server)
     qd_timer_finalize();
     pn_proactor_free(qd_server->proactor);
     sys_mutex_free(qd_server->lock);
+    for (int i = 0; i < QD_DEFERRED_CALL_LOCKS; i++)
+        sys_mutex_free(qd_server->deferred_call_locks[i]);
+    sys_atomic_destroy(&qd_server->next_worker);
+    qd_worker_stats_t *stats = DEQ_HEAD(qd_server->worker_stats);
+    while (stats) {
+        DEQ_REMOVE_HEAD(qd_server->worker_stats);
+        qd_entity_cache_remove(QD_WORKER_THREAD_TYPE, stats);
+        free(stats);
+        stats = DEQ_HEAD(qd_server->worker_stats);
+    }
     sys_cond_free(qd_server->cond);
     Py_XDECREF((PyObject *)qd_server->py_displayname_obj);
     free(qd_server);
@@ -1025,6 +1681,8 @@ void qd_server_run(qd_dispatch_t *qd)
 #endif
     int n = qd_server->thread_count - 1; /* Start count-1 threads + use current thread */
     sys_thread_t **threads = (sys_thread_t **)calloc(n, sizeof(sys_thread_t*));
+    if (qd->timer_thread)
+        qd_timer_thread_start();
     for (i = 0; i < n; i++) {
         threads[i] = sys_thread(thread_run, qd_server);
     }
@@ -1034,6 +1692,7 @@ void qd_server_run(qd_dispatch_t *qd)
         sys_thread_free(threads[i]);
     }
     free(threads);
+    qd_timer_thread_stop();
 
     qd_log(qd_server->log_source, QD_LOG_NOTICE, "Shut Down");
 }
@@ -1042,15 +1701,30 @@ void qd_server_run(qd_dispatch_t *qd)
 void qd_server_stop(qd_dispatch_t *qd)
 {
     /* Disconnect everything, interrupt threads */
+    qd->server->stopping = true;
     pn_proactor_disconnect(qd->server->proactor, NULL);
     for (int i = 0; i < qd->server->thread_count; i++) {
         pn_proactor_interrupt(qd->server->proactor);
     }
 }
 
+void qd_server_set_wake_handler(qd_dispatch_t *qd, qd_server_wake_handler_t handler, void *context)
+{
+    qd->server->wake_context = context;
+    qd->server->wake_handler = handler;
+}
+
+void qd_server_wake(qd_dispatch_t *qd)
+{
+    pn_proactor_interrupt(qd->server->proactor);
+}
+
 void qd_server_activate(qd_connection_t *ctx)
 {
-    if (ctx) ctx->wake(ctx);
+    // Activations are coalesced: only the first since the last PN_CONNECTION_WAKE
+    // pays for a wake, the rest are served by the same one.
+    if (ctx && sys_atomic_swap(&ctx->wake_pending, 1) == 0)
+        ctx->wake(ctx);
 }
 
 
@@ -1141,7 +1815,7 @@ static bool qd_listener_listen_pn(qd_listener_t *li) {
     if (li->pn_listener) {
         pn_listener_set_context(li->pn_listener, li);
         pn_proactor_listen(li->server->proactor, li->pn_listener, li->config.host_port,
-                           BACKLOG);
+                           li->config.backlog > 0 ? li->config.backlog : BACKLOG);
         sys_atomic_inc(&li->ref_count); /* In use by proactor, PN_LISTENER_CLOSE will dec */
         /* Listen is asynchronous, log "listening" message on PN_LISTENER_OPEN event */
     } else {
@@ -1174,6 +1848,8 @@ bool qd_listener_listen(qd_listener_t *li) {
 void qd_listener_decref(qd_listener_t* li)
 {
     if (li && sys_atomic_dec(&li->ref_count) == 1) {
+        if (li->ssl_domain)
+            pn_ssl_domain_free(li->ssl_domain);
         qd_server_config_free(&li->config);
         free_qd_listener_t(li);
     }
@@ -1184,11 +1860,13 @@ qd_connector_t *qd_server_connector(qd_server_t *server)
 {
     qd_connector_t *ct        = new_qd_connector_t();
     if (!ct) return 0;
+    ZERO(ct);
     sys_atomic_init(&ct->ref_count, 1);
     ct->server  = server;
     ct->lock = sys_mutex();
     ct->timer = qd_timer(ct->server->qd, try_open_cb, ct);
-    if (!ct->lock || !ct->timer) {
+    ct->probe_timer = qd_timer(ct->server->qd, try_probe_cb, ct);
+    if (!ct->lock || !ct->timer || !ct->probe_timer) {
         qd_connector_decref(ct);
         return 0;
     }
@@ -1202,6 +1880,7 @@ bool qd_connector_connect(qd_connector_t *ct)
     ct->state   = CXTR_STATE_CONNECTING;
     ct->ctx     = 0;
     ct->delay   = 0;
+    ct->backoff = 0;
     /* Referenced by timer */
     sys_atomic_inc(&ct->ref_count);
     qd_timer_schedule(ct->timer, ct->delay);
@@ -1218,8 +1897,14 @@ void qd_connector_decref(qd_connector_t* ct)
             ct->ctx->connector = 0;
         }
         sys_mutex_unlock(ct->lock);
+        if (ct->ssl_domain)
+            pn_ssl_domain_free(ct->ssl_domain);
+        qd_connector_decref(ct->data_connector);
         qd_server_config_free(&ct->config);
+        if (ct->failover_list)
+            qd_failover_list_free(ct->failover_list);
         qd_timer_free(ct->timer);
+        qd_timer_free(ct->probe_timer);
         free_qd_connector_t(ct);
     }
 }
@@ -21,6 +21,7 @@
 
 #include <qpid/dispatch/atomic.h>
 #include <qpid/dispatch/enum.h>
+#include <qpid/dispatch/failoverlist.h>
 #include <qpid/dispatch/server.h>
 #include <qpid/dispatch/threading.h>
 #include "alloc.h"
@@ -34,7 +35,15 @@
 #include "timer_private.h"
 #include "http.h"
 
-#include <netdb.h>              /* For NI_MAXHOST/NI_MAXSERV */
+#include <netdb.h>              /* For NI_MAXSERV */
+#include <netinet/in.h>         /* For INET6_ADDRSTRLEN */
+#include <net/if.h>             /* For IF_NAMESIZE */
+
+/* A numeric host with an IPv6 scope, not the NI_MAXHOST of a host name */
+#define QD_RHOST_SIZE (INET6_ADDRSTRLEN + IF_NAMESIZE)
+
+/* Connections share their deferred call locks from a fixed pool in the server */
+#define QD_DEFERRED_CALL_LOCKS 64
 
 qd_dispatch_t* qd_server_dispatch(qd_server_t *server);
 void qd_server_timeout(qd_server_t *server, qd_duration_t delay);
@@ -99,6 +108,18 @@ struct qd_listener_t {
     qd_http_listener_t       *http;
     DEQ_LINKS(qd_listener_t);
     bool                      exit_on_error;
+    pn_ssl_domain_t          *ssl_domain;          /* Shared by accepted connections, protected by the server lock */
+    qd_timestamp_t            ssl_domain_created;
+    uint64_t                  ssl_sessions_resumed;
+
+    /* Accept throttling, protected by the server lock */
+    DEQ_LINKS_N(DEFERRED, qd_listener_t);
+    bool                      deferring;        /* On the server's list of deferred listeners */
+    int                       handshakes;       /* Accepted connections not yet open */
+    int                       deferred;         /* Accept events not yet acted on */
+    uint64_t                  accepts;
+    uint64_t                  accepts_deferred;
+    uint64_t                  accepts_rejected;
 };
 
 DEQ_DECLARE(qd_listener_t, qd_listener_list_t);
@@ -107,18 +128,44 @@ DEQ_DECLARE(qd_listener_t, qd_listener_list_t);
 /**
  * Connector objects represent the desire to create and maintain an outgoing transport connection.
  */
+/*
+ * A connector with a failover list tries its peers starting with the one it last
+ * connected to.  When an attempt is slow or fails another peer is tried alongside it,
+ * up to QD_CONNECTOR_PROBES at once, and the first to open is kept.  Once every peer has
+ * failed the connector waits, doubling the wait each time, with jitter, from
+ * QD_CONNECTOR_BACKOFF_MIN to QD_CONNECTOR_BACKOFF_MAX msec.  The wait starts over
+ * after a connection has lasted QD_CONNECTOR_STABLE msec.
+ */
+#define QD_CONNECTOR_PROBES      4
+#define QD_CONNECTOR_PROBE_DELAY 250
+#define QD_CONNECTOR_BACKOFF_MIN 100
+#define QD_CONNECTOR_BACKOFF_MAX 30000
+#define QD_CONNECTOR_STABLE      10000
+
 struct qd_connector_t {
-    /* May be referenced by connection_manager, timer and pn_connection_t */
+    /* May be referenced by connection_manager, timers and the pn_connection_t of each attempt */
     sys_atomic_t              ref_count;
     qd_server_t              *server;
     qd_server_config_t        config;
     qd_timer_t               *timer;
     long                      delay;
+    qd_failover_list_t       *failover_list;    /* Other peers to connect to, or 0 */
+    qd_timer_t               *probe_timer;
 
     /* Connector state and ctx can be modified in proactor or management threads. */
     sys_mutex_t              *lock;
     cxtr_state_t              state;
-    qd_connection_t          *ctx;
+    qd_connection_t          *ctx;              /* The open connection */
+    qd_connection_t          *probes[QD_CONNECTOR_PROBES]; /* Attempts under way */
+    int                       probe_count;
+    int                       tried;            /* Peers attempted since the last connection */
+    int                       good;             /* The peer last connected to, 0 for the configured one */
+    bool                      probe_scheduled;
+    long                      backoff;
+    qd_timestamp_t            opened_at;
+    pn_ssl_domain_t          *ssl_domain;       /* Kept between reconnects, protected by the server lock */
+    qd_timestamp_t            ssl_domain_created;
+    qd_connector_t           *data_connector;   /* Next extra connector of an inter-router pool, owned */
     DEQ_LINKS(qd_connector_t);
 };
 
@@ -139,6 +186,8 @@ struct qd_connection_t {
     pn_ssl_t                 *ssl;
     qd_listener_t            *listener;
     qd_connector_t           *connector;
+    int                       connector_peer; // The connector's peer this connection is to
+    int                       worker;         // One more than the index of the worker thread that last served it
     void                     *context; // context from listener or connector
     void                     *user_context;
     void                     *link_context; // Context shared by this connection's links
@@ -151,12 +200,17 @@ struct qd_connection_t {
     int                       n_receivers;
     void                     *open_container;
     qd_deferred_call_list_t   deferred_calls;
-    sys_mutex_t              *deferred_call_lock;
+    sys_mutex_t              *deferred_call_lock; // One of the server's, not owned
+    sys_atomic_t              wake_pending; // A wake has been requested and its PN_CONNECTION_WAKE not yet handled
     bool                      policy_counted;
+    bool                      handshaking; // Counted against the listener's handshake limits until opened
+    bool                      rejected;    // Accepted only to be closed, the listener is overloaded
     char                     *role;  //The specified role of the connection, e.g. "normal", "inter-router", "route-container" etc.
     void (*wake)(qd_connection_t*); /* Wake method, different for HTTP vs. proactor */
-    char rhost[NI_MAXHOST];     /* Remote host numeric IP for incoming connections */
-    char rhost_port[NI_MAXHOST+NI_MAXSERV]; /* Remote host:port for incoming connections */
+    struct qdr_compression_stats_t *compression; /* Compression statistics, owned by HTTP for WebSocket */
+    bool deflate;               /* Messages are compressed for the peer router, compression is ours */
+    char rhost[QD_RHOST_SIZE];  /* Remote host numeric IP for incoming connections */
+    char rhost_port[QD_RHOST_SIZE+NI_MAXSERV]; /* Remote host:port for incoming connections */
 };
 
 DEQ_DECLARE(qd_connection_t, qd_connection_list_t);
@@ -0,0 +1,214 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "spill.h"
+#include "alloc.h"
+#include <qpid/dispatch/ctools.h>
+#include <qpid/dispatch/log.h>
+#include <qpid/dispatch/threading.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+bool qd_spill_on = false;
+
+static unsigned char *spill_map  = 0;
+static uint64_t       spill_size = 0;
+static sys_mutex_t   *spill_lock = 0;
+
+//
+// A run of free space in the spill file.  The holes are kept in file order with no two
+// adjacent, so space released anywhere in the file is reused as soon as it is free.
+//
+typedef struct spill_hole_t spill_hole_t;
+struct spill_hole_t {
+    DEQ_LINKS(spill_hole_t);
+    uint64_t offset;
+    uint64_t length;
+};
+
+ALLOC_DECLARE(spill_hole_t);
+ALLOC_DEFINE(spill_hole_t);
+DEQ_DECLARE(spill_hole_t, spill_hole_list_t);
+
+static spill_hole_list_t spill_holes;
+
+
+qd_error_t qd_spill_open(const char *path, uint64_t size)
+{
+    qd_spill_close();
+    if (size == 0)
+        return qd_error(QD_ERROR_CONFIG, "spillFileSize must be positive");
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return qd_error_errno(errno, "Cannot open spill file '%s'", path);
+    if (ftruncate(fd, (off_t) size) != 0) {
+        int err = errno;
+        close(fd);
+        return qd_error_errno(err, "Cannot size spill file '%s'", path);
+    }
+
+    //
+    // The mapping keeps the file open.
+    //
+    void *map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int   err = errno;
+    close(fd);
+    if (map == MAP_FAILED)
+        return qd_error_errno(err, "Cannot map spill file '%s'", path);
+
+    spill_map   = (unsigned char*) map;
+    spill_size  = size;
+    spill_lock  = sys_mutex();
+    qd_spill_on = true;
+
+    spill_hole_t *hole = new_spill_hole_t();
+    DEQ_ITEM_INIT(hole);
+    hole->offset = 0;
+    hole->length = size;
+    DEQ_INIT(spill_holes);
+    DEQ_INSERT_TAIL(spill_holes, hole);
+    qd_log(qd_log_source("ROUTER"), QD_LOG_INFO, "Spilling queued message bodies to %s, %"PRIu64" octets",
+           path, size);
+    return QD_ERROR_NONE;
+}
+
+
+void qd_spill_close(void)
+{
+    if (!spill_map)
+        return;
+    qd_spill_on = false;
+    munmap(spill_map, spill_size);
+    sys_mutex_free(spill_lock);
+    spill_hole_t *hole = DEQ_HEAD(spill_holes);
+    while (hole) {
+        DEQ_REMOVE_HEAD(spill_holes);
+        free_spill_hole_t(hole);
+        hole = DEQ_HEAD(spill_holes);
+    }
+    spill_map  = 0;
+    spill_lock = 0;
+}
+
+
+bool qd_spill_store(qd_buffer_t *buf, qd_spill_extent_t *extent)
+{
+    uint64_t length = 0;
+    for (qd_buffer_t *b = buf; b; b = DEQ_NEXT(b))
+        length += qd_buffer_size(b);
+    if (length == 0)
+        return false;
+
+    //
+    // Take the front of the first hole the data fits in.
+    //
+    sys_mutex_lock(spill_lock);
+    spill_hole_t *hole = DEQ_HEAD(spill_holes);
+    DEQ_FIND(hole, hole->length >= length);
+    if (!hole) {
+        sys_mutex_unlock(spill_lock);
+        return false;
+    }
+    uint64_t offset = hole->offset;
+    hole->offset += length;
+    hole->length -= length;
+    if (hole->length == 0) {
+        DEQ_REMOVE(spill_holes, hole);
+        free_spill_hole_t(hole);
+    }
+    sys_mutex_unlock(spill_lock);
+
+    //
+    // The space is ours alone, copy into it unlocked.
+    //
+    unsigned char *dest = spill_map + offset;
+    for (qd_buffer_t *b = buf; b; b = DEQ_NEXT(b)) {
+        memcpy(dest, qd_buffer_base(b), qd_buffer_size(b));
+        dest += qd_buffer_size(b);
+    }
+
+    extent->offset = offset;
+    extent->length = length;
+    return true;
+}
+
+
+void qd_spill_load(const qd_spill_extent_t *extent, qd_buffer_list_t *buffers)
+{
+    const unsigned char *src  = spill_map + extent->offset;
+    uint64_t             left = extent->length;
+
+    while (left > 0) {
+        qd_buffer_t *buf = qd_buffer();
+        size_t       n   = qd_buffer_capacity(buf);
+        if (n > left)
+            n = left;
+        memcpy(qd_buffer_cursor(buf), src, n);
+        qd_buffer_insert(buf, n);
+        DEQ_INSERT_TAIL(*buffers, buf);
+        src  += n;
+        left -= n;
+    }
+}
+
+
+void qd_spill_release(qd_spill_extent_t *extent)
+{
+    if (extent->length == 0 || !spill_map)
+        return;
+
+    uint64_t offset = extent->offset;
+    uint64_t end    = extent->offset + extent->length;
+
+    //
+    // Find the holes either side of the extent and merge it with whichever it touches.
+    //
+    sys_mutex_lock(spill_lock);
+    spill_hole_t *next = DEQ_HEAD(spill_holes);
+    DEQ_FIND(next, next->offset > offset);
+    spill_hole_t *prev = next ? DEQ_PREV(next) : DEQ_TAIL(spill_holes);
+
+    if (prev && prev->offset + prev->length == offset) {
+        prev->length += extent->length;
+        if (next && next->offset == end) {
+            prev->length += next->length;
+            DEQ_REMOVE(spill_holes, next);
+            free_spill_hole_t(next);
+        }
+    } else if (next && next->offset == end) {
+        next->offset  = offset;
+        next->length += extent->length;
+    } else {
+        spill_hole_t *hole = new_spill_hole_t();
+        DEQ_ITEM_INIT(hole);
+        hole->offset = offset;
+        hole->length = extent->length;
+        if (prev)
+            DEQ_INSERT_AFTER(spill_holes, hole, prev);
+        else
+            DEQ_INSERT_HEAD(spill_holes, hole);
+    }
+    sys_mutex_unlock(spill_lock);
+    ZERO(extent);
+}
@@ -0,0 +1,75 @@
+#ifndef __spill_h__
+#define __spill_h__ 1
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**@file
+ * Spill file for the bodies of messages queued to slow consumers.
+ *
+ * The file is memory mapped.  Message data copied into it leaves the buffer
+ * pool, and the kernel writes the pages out and drops them as memory runs
+ * short.  Each store takes the first free run of the file it fits in, and
+ * released space is free again at once; a store that fits nowhere is refused
+ * and the data stays in memory.
+ *
+ * The file is scratch space.  It is truncated when opened and nothing in it
+ * survives a restart.
+ */
+
+#include <qpid/dispatch/buffer.h>
+#include <qpid/dispatch/error.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Where a stored run of octets lies in the spill file.  Zero length if none. */
+typedef struct qd_spill_extent_t {
+    uint64_t offset;
+    uint64_t length;
+} qd_spill_extent_t;
+
+/**
+ * Create the spill file at path, size octets long, and map it.
+ */
+qd_error_t qd_spill_open(const char *path, uint64_t size);
+
+void qd_spill_close(void);
+
+extern bool qd_spill_on;
+
+/** True if message data may be spilled. */
+static inline bool qd_spill_enabled(void) { return qd_spill_on; }
+
+/**
+ * Copy the data of buf and of the buffers after it in its list to the spill
+ * file.  Return false, leaving extent alone, if there is no room.
+ */
+bool qd_spill_store(qd_buffer_t *buf, qd_spill_extent_t *extent);
+
+/**
+ * Append buffers holding a copy of the stored data to the list.  The extent
+ * stays allocated.
+ */
+void qd_spill_load(const qd_spill_extent_t *extent, qd_buffer_list_t *buffers);
+
+/**
+ * Give back the space of a stored extent and zero it.
+ */
+void qd_spill_release(qd_spill_extent_t *extent);
+
+#endif
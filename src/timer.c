@@ -20,6 +20,7 @@
 #include "dispatch_private.h"
 #include "timer_private.h"
 #include "server_private.h"
+#include "profile.h"
 #include <qpid/dispatch/ctools.h>
 #include <qpid/dispatch/threading.h>
 #include "alloc.h"
@@ -29,11 +30,36 @@
 
 static sys_mutex_t     *lock = NULL;
 static qd_timer_list_t  idle_timers = {0};
-static qd_timer_list_t  scheduled_timers = {0};
-/* Timers have relative delta_time measured from the previous timer.
- * The delta_time of the first timer on the queue is measured from timer_base.
+
+/*
+ * Scheduled timers are kept in a hierarchical timing wheel with a resolution of one
+ * millisecond.  Level 0 has a slot for each of the next 256 milliseconds, each slot
+ * of level N spans 256 slots of level N-1.  A timer sits on the lowest level whose
+ * span covers its delay; when the wheel turns past the end of a span the next slot
+ * of the level above is redistributed ("cascaded") to the levels below.  Scheduling
+ * and cancelling are constant time.
+ *
+ * wheel_time is the next millisecond not yet processed.  Expired timers are moved to
+ * due_timers in expiry order and fired from there.
  */
-static qd_timestamp_t   time_base = 0;
+#define WHEEL_BITS   8
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+static qd_timer_list_t  wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static int              wheel_count[WHEEL_LEVELS];
+static qd_timestamp_t   wheel_time = 0;
+static qd_timer_list_t  due_timers = {0};
+
+/* The expiry last passed to qd_server_timeout, valid if next_pending */
+static qd_timestamp_t   next_expire = 0;
+static bool             next_pending = false;
+
+/* The dedicated timer thread, if any, waits on timer_cond for next_expire */
+static sys_cond_t      *timer_cond = 0;
+static sys_thread_t    *timer_thread = 0;
+static bool             timer_thread_stopping = false;
 
 ALLOC_DECLARE(qd_timer_t);
 ALLOC_DEFINE(qd_timer_t);
@@ -48,32 +74,165 @@ sys_mutex_t* qd_timer_lock() { return lock; }
 static void timer_cancel_LH(qd_timer_t *timer)
 {
     if (timer->scheduled) {
-        if (timer->next)
-            timer->next->delta_time += timer->delta_time;
-        DEQ_REMOVE(scheduled_timers, timer);
+        DEQ_REMOVE(*timer->list, timer);
+        if (timer->level >= 0)
+            wheel_count[timer->level]--;
         DEQ_INSERT_TAIL(idle_timers, timer);
+        timer->list      = 0;
         timer->scheduled = false;
     }
 }
 
-/* Adjust timer's time_base and delays for the current time. */
-static void timer_adjust_now_LH()
+
+/* Put a timer, not on any list, on the wheel slot for its expiry or, if it has
+ * already expired, on the due list. */
+static void timer_insert_LH(qd_timer_t *timer)
 {
-    qd_timestamp_t now = qd_timer_now();
-    if (time_base != 0 && now > time_base) {
-        qd_duration_t delta = now - time_base;
-        /* Adjust timer delays by removing duration delta, starting from timer. */
-        for (qd_timer_t *timer = DEQ_HEAD(scheduled_timers); delta > 0 && timer; timer = DEQ_NEXT(timer)) {
-            if (timer->delta_time >= delta) {
-                timer->delta_time -= delta;
-                delta = 0;
-            } else {
-                delta -= timer->delta_time;
-                timer->delta_time = 0; /* Ready to fire */
+    if (timer->expire < wheel_time) {
+        timer->list  = &due_timers;
+        timer->level = -1;
+        DEQ_INSERT_TAIL(due_timers, timer);
+        return;
+    }
+
+    qd_timestamp_t at    = timer->expire;
+    qd_timestamp_t delay = at - wheel_time;
+    int            level = 0;
+
+    while (level < WHEEL_LEVELS - 1 && delay >> ((level + 1) * WHEEL_BITS))
+        level++;
+    if (delay >> (WHEEL_LEVELS * WHEEL_BITS))  /* Beyond the top level, cascaded again later */
+        at = wheel_time + ((qd_timestamp_t) 1 << (WHEEL_LEVELS * WHEEL_BITS)) - 1;
+
+    timer->list  = &wheel[level][(at >> (level * WHEEL_BITS)) & WHEEL_MASK];
+    timer->level = level;
+    DEQ_INSERT_TAIL(*timer->list, timer);
+    wheel_count[level]++;
+}
+
+
+static void timer_cascade_LH(int level, int slot)
+{
+    qd_timer_list_t timers;
+    DEQ_MOVE(wheel[level][slot], timers);
+    qd_timer_t *timer;
+    while ((timer = DEQ_HEAD(timers))) {
+        DEQ_REMOVE_HEAD(timers);
+        wheel_count[level]--;
+        timer_insert_LH(timer);
+    }
+}
+
+
+/* Turn the wheel up to and including now, moving expired timers to due_timers. */
+static void timer_advance_LH(qd_timestamp_t now)
+{
+    while (wheel_time <= now) {
+        int slot = wheel_time & WHEEL_MASK;
+        qd_timer_t *timer;
+        while ((timer = DEQ_HEAD(wheel[0][slot]))) {
+            DEQ_REMOVE_HEAD(wheel[0][slot]);
+            wheel_count[0]--;
+            timer->list  = &due_timers;
+            timer->level = -1;
+            DEQ_INSERT_TAIL(due_timers, timer);
+        }
+
+        //
+        // Skip the spans of the empty levels at the bottom of the wheel, stopping at
+        // the next point where a non-empty level must be cascaded.
+        //
+        int empty = 0;
+        while (empty < WHEEL_LEVELS && wheel_count[empty] == 0)
+            empty++;
+        if (empty == WHEEL_LEVELS) {
+            wheel_time = now + 1;
+            break;
+        }
+        qd_timestamp_t span = (qd_timestamp_t) 1 << (empty * WHEEL_BITS);
+        qd_timestamp_t next = (wheel_time | (span - 1)) + 1;
+        wheel_time = next < now + 1 ? next : now + 1;
+
+        //
+        // Entering a new span, cascade the slots that cover it so that no level holds
+        // timers for its current slot.
+        //
+        if ((wheel_time & WHEEL_MASK) == 0) {
+            for (int level = 1; level < WHEEL_LEVELS; level++) {
+                int upper = (wheel_time >> (level * WHEEL_BITS)) & WHEEL_MASK;
+                timer_cascade_LH(level, upper);
+                if (upper != 0)
+                    break;
+            }
+        }
+    }
+}
+
+
+/* Find the scheduled timer that expires first. */
+static qd_timer_t *timer_first_LH(void)
+{
+    qd_timer_t *first = DEQ_HEAD(due_timers);
+    if (first)
+        return first;
+
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (wheel_count[level] == 0)
+            continue;
+        //
+        // Level 0 starts at the current millisecond, higher levels hold only timers
+        // beyond the current span and so start at the next slot.  The first occupied
+        // slot holds the level's earliest timers, except on the top level where timers
+        // too distant for the wheel are parked out of order.
+        //
+        int  current = (wheel_time >> (level * WHEEL_BITS)) & WHEEL_MASK;
+        bool top     = level == WHEEL_LEVELS - 1;
+        for (int i = level ? 1 : 0; i <= WHEEL_SLOTS; i++) {
+            qd_timer_t *timer = DEQ_HEAD(wheel[level][(current + i) & WHEEL_MASK]);
+            if (timer) {
+                for (; timer; timer = DEQ_NEXT(timer))
+                    if (!first || timer->expire < first->expire)
+                        first = timer;
+                if (!top)
+                    break;
             }
         }
     }
-    time_base = now;
+    return first;
+}
+
+
+/* Set the server timeout, or wake the timer thread, for the first timer to expire. */
+static void timer_set_timeout_LH(qd_timer_t *first, qd_timestamp_t now)
+{
+    next_pending = first != 0;
+    if (first) {
+        next_expire = first->expire;
+        if (timer_cond)
+            sys_cond_signal(timer_cond);
+        else
+            qd_server_timeout(first->server, first->expire > now ? first->expire - now : 0);
+    }
+}
+
+
+static void *timer_thread_run(void *unused)
+{
+    qd_profile_thread("timer");
+    sys_mutex_lock(lock);
+    while (!timer_thread_stopping) {
+        if (!next_pending)
+            sys_cond_wait(timer_cond, lock);
+        else if (qd_timer_now() < next_expire)
+            sys_cond_timed_wait(timer_cond, lock, next_expire);
+        else {
+            sys_mutex_unlock(lock);
+            qd_timer_visit();
+            sys_mutex_lock(lock);
+        }
+    }
+    sys_mutex_unlock(lock);
+    return 0;
 }
 
 
@@ -93,7 +252,9 @@ qd_timer_t *qd_timer(qd_dispatch_t *qd, qd_timer_cb_t cb, void* context)
     timer->server     = qd ? qd->server : 0;
     timer->handler    = cb;
     timer->context    = context;
-    timer->delta_time = 0;
+    timer->expire     = 0;
+    timer->list       = 0;
+    timer->level      = 0;
     timer->scheduled  = false;
     sys_mutex_lock(lock);
     DEQ_INSERT_TAIL(idle_timers, timer);
@@ -127,35 +288,19 @@ void qd_timer_schedule(qd_timer_t *timer, qd_duration_t duration)
     timer_cancel_LH(timer);  // Timer is now on the idle list
     DEQ_REMOVE(idle_timers, timer);
 
-    //
-    // Find the insert point in the schedule.
-    //
-    timer_adjust_now_LH();   /* Adjust the timers for current time */
-
-    /* Invariant: time_before == total time up to but not including ptr */
-    qd_timer_t *ptr = DEQ_HEAD(scheduled_timers);
-    qd_duration_t time_before = 0;
-    while (ptr && time_before + ptr->delta_time < duration) {
-        time_before += ptr->delta_time;
-        ptr = ptr->next;
-    }
-    /* ptr is the first timer to exceed duration or NULL if we ran out */
-    if (!ptr) {
-        timer->delta_time = duration - time_before;
-        DEQ_INSERT_TAIL(scheduled_timers, timer);
-    } else {
-        timer->delta_time = duration - time_before;
-        ptr->delta_time -= timer->delta_time;
-        ptr = ptr->prev;
-        if (ptr)
-            DEQ_INSERT_AFTER(scheduled_timers, timer, ptr);
-        else
-            DEQ_INSERT_HEAD(scheduled_timers, timer);
-    }
+    qd_timestamp_t now = qd_timer_now();
+    if (wheel_time == 0)
+        wheel_time = now;
+    timer->expire    = now + duration;
     timer->scheduled = true;
+    timer_insert_LH(timer);
 
-    qd_timer_t *first = DEQ_HEAD(scheduled_timers);
-    qd_server_timeout(first->server, first->delta_time);
+    //
+    // The server timeout only needs moving if this timer is now the first to expire.
+    // A timeout left behind by a cancelled timer just causes an early visit.
+    //
+    if (!next_pending || timer->expire < next_expire)
+        timer_set_timeout_LH(timer, now);
     sys_mutex_unlock(lock);
 }
 
@@ -177,33 +322,71 @@ void qd_timer_initialize(sys_mutex_t *server_lock)
 {
     lock = server_lock;
     DEQ_INIT(idle_timers);
-    DEQ_INIT(scheduled_timers);
-    time_base = 0;
+    DEQ_INIT(due_timers);
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+            DEQ_INIT(wheel[level][slot]);
+        wheel_count[level] = 0;
+    }
+    wheel_time   = 0;
+    next_pending = false;
 }
 
 
 void qd_timer_finalize(void)
 {
+    qd_timer_thread_stop();
     lock = 0;
 }
 
 
+void qd_timer_thread_start(void)
+{
+    if (timer_thread)
+        return;
+    sys_mutex_lock(lock);
+    timer_cond            = sys_cond();
+    timer_thread_stopping = false;
+    sys_mutex_unlock(lock);
+    timer_thread = sys_thread(timer_thread_run, 0);
+}
+
+
+void qd_timer_thread_stop(void)
+{
+    if (!timer_thread)
+        return;
+    sys_mutex_lock(lock);
+    timer_thread_stopping = true;
+    sys_cond_signal(timer_cond);
+    sys_mutex_unlock(lock);
+    sys_thread_join(timer_thread);
+    sys_thread_free(timer_thread);
+    timer_thread = 0;
+
+    sys_mutex_lock(lock);
+    sys_cond_free(timer_cond);
+    timer_cond = 0;
+    sys_mutex_unlock(lock);
+}
+
+
 /* Execute all timers that are ready and set up next timeout. */
 void qd_timer_visit()
 {
     sys_mutex_lock(lock);
-    timer_adjust_now_LH();
-    qd_timer_t *timer = DEQ_HEAD(scheduled_timers);
-    while (timer && timer->delta_time == 0) {
-        timer_cancel_LH(timer); /* Removes timer from scheduled_timers */
+    qd_timestamp_t now = qd_timer_now();
+    if (wheel_time == 0)
+        wheel_time = now;
+    timer_advance_LH(now);
+    qd_timer_t *timer = DEQ_HEAD(due_timers);
+    while (timer) {
+        timer_cancel_LH(timer); /* Removes timer from due_timers */
         sys_mutex_unlock(lock);
         timer->handler(timer->context); /* Call the handler outside the lock, may re-schedule */
         sys_mutex_lock(lock);
-        timer = DEQ_HEAD(scheduled_timers);
-    }
-    qd_timer_t *first = DEQ_HEAD(scheduled_timers);
-    if (first) {
-        qd_server_timeout(first->server, first->delta_time);
+        timer = DEQ_HEAD(due_timers);
     }
+    timer_set_timeout_LH(timer_first_LH(), now);
     sys_mutex_unlock(lock);
 }
@@ -23,21 +23,30 @@
 #include <qpid/dispatch/timer.h>
 #include <qpid/dispatch/threading.h>
 
+DEQ_DECLARE(qd_timer_t, qd_timer_list_t);
+
 struct qd_timer_t {
     DEQ_LINKS(qd_timer_t);
     qd_server_t      *server;
     qd_timer_cb_t     handler;
     void             *context;
-    qd_timestamp_t    delta_time;
-    bool              scheduled; /* true means on scheduled list, false on idle list */
+    qd_timestamp_t    expire;    /* Absolute time at which a scheduled timer fires */
+    qd_timer_list_t  *list;      /* Wheel slot or due list holding a scheduled timer */
+    int               level;     /* Wheel level of the slot, -1 for the due list */
+    bool              scheduled; /* true means on a wheel slot or the due list, false on idle list */
 };
 
-DEQ_DECLARE(qd_timer_t, qd_timer_list_t);
-
 void qd_timer_initialize(sys_mutex_t *server_lock);
 void qd_timer_finalize(void);
 void qd_timer_visit();
 
+/**
+ * Fire timers on a thread of their own from now on instead of on the proactor
+ * timeouts handled by the worker threads.
+ */
+void qd_timer_thread_start(void);
+void qd_timer_thread_stop(void);
+
 /// For tests only
 sys_mutex_t* qd_timer_lock();
 
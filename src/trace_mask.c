@@ -36,6 +36,7 @@ struct qd_tracemask_t {
     sys_rwlock_t   *lock;
     qd_hash_t      *hash;
     qdtm_router_t **router_by_mask_bit;
+    qdtm_router_t  *self;   // This router, found in the trace of a looping message
 };
 
 
@@ -48,6 +49,7 @@ qd_tracemask_t *qd_tracemask(void)
 
     for (int i = 0; i < qd_bitmask_width(); i++)
         tm->router_by_mask_bit[i] = 0;
+    tm->self = 0;
     return tm;
 }
 
@@ -60,6 +62,12 @@ void qd_tracemask_free(qd_tracemask_t *tm)
     }
     free(tm->router_by_mask_bit);
 
+    if (tm->self) {
+        qd_hash_remove_by_handle(tm->hash, tm->self->hash_handle);
+        qd_hash_handle_free(tm->self->hash_handle);
+        free_qdtm_router_t(tm->self);
+    }
+
     qd_hash_free(tm->hash);
     sys_rwlock_free(tm->lock);
     free(tm);
@@ -83,6 +91,25 @@ void qd_tracemask_add_router(qd_tracemask_t *tm, const char *address, int maskbi
 }
 
 
+void qd_tracemask_set_self(qd_tracemask_t *tm, const char *node_id)
+{
+    qd_iterator_t *iter = qd_iterator_string(node_id, ITER_VIEW_NODE_HASH);
+    sys_rwlock_wrlock(tm->lock);
+    assert(tm->self == 0);
+    if (tm->self == 0) {
+        qdtm_router_t *router = new_qdtm_router_t();
+        router->maskbit      = -1;
+        router->link_maskbit = -1;
+        if (qd_hash_insert(tm->hash, iter, router, &router->hash_handle) == QD_ERROR_NONE)
+            tm->self = router;
+        else
+            free_qdtm_router_t(router);
+    }
+    sys_rwlock_unlock(tm->lock);
+    qd_iterator_free(iter);
+}
+
+
 void qd_tracemask_del_router(qd_tracemask_t *tm, int maskbit)
 {
     sys_rwlock_wrlock(tm->lock);
@@ -124,12 +151,14 @@ void qd_tracemask_remove_link(qd_tracemask_t *tm, int router_maskbit)
 }
 
 
-qd_bitmask_t *qd_tracemask_create(qd_tracemask_t *tm, qd_parsed_field_t *tracelist)
+qd_bitmask_t *qd_tracemask_create(qd_tracemask_t *tm, qd_parsed_field_t *tracelist, bool *looped)
 {
     qd_bitmask_t *bm  = qd_bitmask(0);
     int           idx = 0;
 
     assert(qd_parse_is_list(tracelist));
+    if (looped)
+        *looped = false;
 
     sys_rwlock_rdlock(tm->lock);
     qd_parsed_field_t *item   = qd_parse_sub_value(tracelist, idx);
@@ -137,9 +166,12 @@ qd_bitmask_t *qd_tracemask_create(qd_tracemask_t *tm, qd_parsed_field_t *traceli
     while (item) {
         qd_iterator_t *iter = qd_parse_raw(item);
         qd_iterator_reset_view(iter, ITER_VIEW_NODE_HASH);
+        router = 0;
         qd_hash_retrieve(tm->hash, iter, (void*) &router);
         if (router && router->link_maskbit >= 0)
             qd_bitmask_set_bit(bm, router->link_maskbit);
+        else if (router && router == tm->self && looped)
+            *looped = true;
         idx++;
         item = qd_parse_sub_value(tracelist, idx);
     }
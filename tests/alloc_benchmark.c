@@ -0,0 +1,208 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//
+// Allocator contention benchmark.
+//
+// Threads stand in a ring.  Each allocates objects and hands them to the next thread,
+// which frees them: the pattern of messages and buffers, which are allocated by the
+// thread that receives them and freed by the one that sends them on.  Freed objects pile
+// up in the freeing thread's pool and travel back through the global pool in batches.
+//
+// The run is repeated over thread counts and pool configurations.  Results are printed
+// as JSON: allocations per second, and the allocator's own counts of global pool races,
+// heap refills and time spent waiting for the type lock.
+//
+//   alloc_benchmark [objects-per-thread]
+//
+
+#include "alloc.h"
+
+#include <qpid/dispatch.h>
+#include <qpid/dispatch/atomic.h>
+#include <qpid/dispatch/threading.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if USE_MEMORY_POOL
+
+#define OBJECT_SIZE 256
+#define RING_SIZE   1024   ///< Objects in flight between two neighbours; a power of two
+#define MAX_THREADS 16
+
+//
+// Single producer, single consumer queue of objects between neighbours
+//
+typedef struct {
+    sys_atomic_t  head   __attribute__((aligned(64)));  ///< Next slot to take, written by the consumer
+    sys_atomic_t  tail   __attribute__((aligned(64)));  ///< Next slot to fill, written by the producer
+    void         *slot[RING_SIZE];
+} ring_t;
+
+typedef struct {
+    qd_alloc_type_desc_t *desc;
+    qd_alloc_pool_t      *pool;      ///< This thread's pool of the type
+    ring_t               *out;
+    ring_t               *in;
+    uint64_t              objects;
+} worker_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void *worker_run(void *context)
+{
+    worker_t *w        = (worker_t*) context;
+    uint64_t  produced = 0;
+    uint64_t  consumed = 0;
+
+    while (produced < w->objects || consumed < w->objects) {
+        bool idle = true;
+
+        uint32_t tail = sys_atomic_get(&w->out->tail);
+        while (produced < w->objects && tail - sys_atomic_get(&w->out->head) < RING_SIZE) {
+            char *obj = (char*) qd_alloc(w->desc, &w->pool);
+            obj[0] = obj[OBJECT_SIZE - 1] = (char) produced;
+            w->out->slot[tail % RING_SIZE] = obj;
+            sys_atomic_init(&w->out->tail, ++tail);
+            produced++;
+            idle = false;
+        }
+
+        uint32_t head = sys_atomic_get(&w->in->head);
+        while (head != sys_atomic_get(&w->in->tail)) {
+            qd_dealloc(w->desc, &w->pool, (char*) w->in->slot[head % RING_SIZE]);
+            sys_atomic_init(&w->in->head, ++head);
+            consumed++;
+            idle = false;
+        }
+
+        if (idle)
+            sched_yield();
+    }
+    return 0;
+}
+
+
+static bool first_result = true;
+
+static void run(int threads, int batch, int local_max, uint64_t objects)
+{
+    char                  name[64];
+    worker_t              worker[MAX_THREADS];
+    ring_t               *ring[MAX_THREADS];
+    sys_thread_t         *thread[MAX_THREADS];
+
+    //
+    // A type of its own for each run, so every run starts with empty pools.  Types stay
+    // registered until the allocator is finalized, which reclaims their items.
+    //
+    qd_alloc_config_t    *config = NEW(qd_alloc_config_t);
+    qd_alloc_type_desc_t *desc;
+    NEW_CACHE_ALIGNED(qd_alloc_type_desc_t, desc);
+    ZERO(config);
+    ZERO(desc);
+    config->transfer_batch_size = batch;
+    config->local_free_list_max = local_max;
+    snprintf(name, sizeof(name), "bench_%d_%d_%d", threads, batch, local_max);
+    desc->type_name = strdup(name);
+    desc->type_size = OBJECT_SIZE;
+    desc->config    = config;
+
+    for (int i = 0; i < threads; i++) {
+        NEW_CACHE_ALIGNED(ring_t, ring[i]);
+        ZERO(ring[i]);
+        sys_atomic_init(&ring[i]->head, 0);
+        sys_atomic_init(&ring[i]->tail, 0);
+    }
+    for (int i = 0; i < threads; i++) {
+        worker[i].desc    = desc;
+        worker[i].pool    = 0;
+        worker[i].out     = ring[i];
+        worker[i].in      = ring[(i + threads - 1) % threads];
+        worker[i].objects = objects;
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < threads; i++)
+        thread[i] = sys_thread(worker_run, &worker[i]);
+    for (int i = 0; i < threads; i++) {
+        sys_thread_join(thread[i]);
+        sys_thread_free(thread[i]);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    qd_alloc_stats_t *stats = qd_alloc_stats(desc);
+    uint64_t allocs = stats->total_allocs;
+    printf("%s\n    {\"threads\": %d, \"transfer_batch_size\": %d, \"local_free_list_max\": %d, "
+           "\"allocs\": %"PRIu64", \"allocs_per_sec\": %.0f, \"ns_per_alloc_free\": %.1f, "
+           "\"heap_allocs\": %"PRIu64", \"batches_to_threads\": %"PRIu64", \"batches_to_global\": %"PRIu64", "
+           "\"global_retries\": %"PRIu64", \"lock_wait_ns\": %"PRIu64"}",
+           first_result ? "" : ",", threads, batch, local_max,
+           allocs, allocs * 1e9 / elapsed, (double) elapsed * threads / allocs,
+           stats->total_alloc_from_heap, stats->batches_rebalanced_to_threads,
+           stats->batches_rebalanced_to_global, stats->global_retries, stats->lock_wait_ns);
+    first_result = false;
+    fflush(stdout);
+
+    for (int i = 0; i < threads; i++)
+        free(ring[i]);
+}
+
+#endif
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [objects-per-thread]\n", argv[0]);
+        exit(1);
+    }
+#if USE_MEMORY_POOL
+    uint64_t objects = argc == 2 ? strtoull(argv[1], 0, 10) : 1000000;
+
+    // Initializes the allocator
+    qd_dispatch_t *qd = qd_dispatch(0);
+
+    static const int thread_counts[] = {1, 2, 4, 8};
+    static const int batch_sizes[]   = {16, 64, 256};
+    static const int local_factor[]  = {2, 8};
+
+    printf("{\"alloc_benchmarks\": [");
+    for (int t = 0; t < sizeof(thread_counts) / sizeof(int); t++)
+        for (int b = 0; b < sizeof(batch_sizes) / sizeof(int); b++)
+            for (int l = 0; l < sizeof(local_factor) / sizeof(int); l++)
+                run(thread_counts[t], batch_sizes[b], batch_sizes[b] * local_factor[l], objects);
+    printf("\n]}\n");
+
+    qd_dispatch_free(qd);
+    return 0;
+#else
+    fprintf(stderr, "%s: built without memory pools, nothing to measure\n", argv[0]);
+    return 1;
+#endif
+}
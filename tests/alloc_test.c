@@ -32,6 +32,41 @@ qd_alloc_config_t config = {3, 7, 10};
 ALLOC_DECLARE(object_t);
 ALLOC_DEFINE_CONFIG(object_t, sizeof(object_t), 0, &config);
 
+typedef object_t slab_object_t;
+
+qd_alloc_config_t slab_config = {3, 7, 10, 4096, false};
+
+ALLOC_DECLARE(slab_object_t);
+ALLOC_DEFINE_CONFIG(slab_object_t, sizeof(slab_object_t), 0, &slab_config);
+
+typedef object_t shared_object_t;
+
+qd_alloc_config_t shared_config = {4, 8, 0};
+
+ALLOC_DECLARE(shared_object_t);
+ALLOC_DEFINE_CONFIG(shared_object_t, sizeof(shared_object_t), 0, &shared_config);
+
+typedef object_t trim_object_t;
+
+qd_alloc_config_t trim_config = {2, 4, 0};
+
+ALLOC_DECLARE(trim_object_t);
+ALLOC_DEFINE_CONFIG(trim_object_t, sizeof(trim_object_t), 0, &trim_config);
+
+typedef object_t sampled_object_t;
+
+ALLOC_DECLARE(sampled_object_t);
+ALLOC_DEFINE(sampled_object_t);
+
+#define SHARED_THREADS 4
+#define SHARED_ROUNDS  2000
+#define SHARED_OBJECTS 37
+
+typedef struct {
+    int id;
+    int failed;
+} shared_thread_t;
+
 
 static char* check_stats(qd_alloc_stats_t *stats, uint64_t ah, uint64_t fh, uint64_t ht, uint64_t rt, uint64_t rg)
 {
@@ -48,23 +83,25 @@ static char* test_alloc_basic(void *context)
 {
     object_t         *obj[50];
     int               idx;
-    qd_alloc_stats_t *stats;
     char             *error = 0;
 
     for (idx = 0; idx < 20; idx++)
         obj[idx] = new_object_t();
-    stats = alloc_stats_object_t();
-    error = check_stats(stats, 21, 0, 21, 0, 0);
+    error = check_stats(alloc_stats_object_t(), 21, 0, 21, 0, 0);
     for (idx = 0; idx < 20; idx++)
         free_object_t(obj[idx]);
     if (error) return error;
 
-    error = check_stats(stats, 21, 5, 6, 0, 5);
+    //
+    // The global list holds whole batches: 9 items fit under the limit of 10, so the last
+    // two batches (6 items) go back to the heap.
+    //
+    error = check_stats(alloc_stats_object_t(), 21, 6, 6, 0, 5);
     if (error) return error;
 
     for (idx = 0; idx < 20; idx++)
         obj[idx] = new_object_t();
-    error = check_stats(stats, 27, 5, 21, 3, 5);
+    error = check_stats(alloc_stats_object_t(), 27, 6, 21, 3, 5);
     for (idx = 0; idx < 20; idx++)
         free_object_t(obj[idx]);
     if (error) return error;
@@ -72,12 +109,191 @@ static char* test_alloc_basic(void *context)
     return 0;
 }
 
+static char* test_alloc_slab(void *context)
+{
+    slab_object_t *obj[100];
+    int            idx;
+    char          *error = 0;
+
+    //
+    // Enough objects to need more than one slab
+    //
+    for (idx = 0; idx < 100; idx++) {
+        obj[idx] = new_slab_object_t();
+        if (!obj[idx])
+            return "Slab allocation failed";
+        if (((uintptr_t) obj[idx]) % 8)
+            error = "Slab object misaligned";
+        obj[idx]->A = idx;
+        obj[idx]->B = -idx;
+    }
+
+    for (idx = 0; idx < 100 && !error; idx++)
+        if (obj[idx]->A != idx || obj[idx]->B != -idx)
+            error = "Slab objects overlap";
+
+    for (idx = 0; idx < 100; idx++)
+        free_slab_object_t(obj[idx]);
+    if (error) return error;
+
+    //
+    // Freed objects are reused rather than carved again
+    //
+    slab_object_t *again = new_slab_object_t();
+    for (idx = 0; idx < 100; idx++)
+        if (again == obj[idx])
+            break;
+    free_slab_object_t(again);
+    if (idx == 100) return "Freed slab object was not reused";
+
+    return 0;
+}
+
+static void *shared_thread_run(void *context)
+{
+    shared_thread_t *st = (shared_thread_t*) context;
+    shared_object_t *obj[SHARED_OBJECTS];
+
+    for (int round = 0; round < SHARED_ROUNDS && !st->failed; round++) {
+        for (int idx = 0; idx < SHARED_OBJECTS; idx++) {
+            obj[idx] = new_shared_object_t();
+            obj[idx]->A = st->id;
+            obj[idx]->B = idx;
+        }
+        for (int idx = 0; idx < SHARED_OBJECTS; idx++) {
+            if (obj[idx]->A != st->id || obj[idx]->B != idx)
+                st->failed = 1;
+            free_shared_object_t(obj[idx]);
+        }
+    }
+    return 0;
+}
+
+
+static char* test_alloc_shared(void *context)
+{
+    //
+    // Threads that allocate and free concurrently rebalance batches through the global
+    // stack.  An object handed to two threads at once shows up as a clobbered value.
+    //
+    sys_thread_t    *thread[SHARED_THREADS];
+    shared_thread_t  st[SHARED_THREADS];
+    int              idx;
+
+    for (idx = 0; idx < SHARED_THREADS; idx++) {
+        st[idx].id     = idx;
+        st[idx].failed = 0;
+        thread[idx] = sys_thread(shared_thread_run, &st[idx]);
+    }
+    for (idx = 0; idx < SHARED_THREADS; idx++) {
+        sys_thread_join(thread[idx]);
+        sys_thread_free(thread[idx]);
+    }
+    for (idx = 0; idx < SHARED_THREADS; idx++)
+        if (st[idx].failed)
+            return "Object handed to more than one thread";
+
+    return 0;
+}
+
+
+static char* test_alloc_trim(void *context)
+{
+    trim_object_t *obj[20];
+    int            idx;
+
+    for (idx = 0; idx < 20; idx++)
+        obj[idx] = new_trim_object_t();
+    for (idx = 0; idx < 20; idx++)
+        free_trim_object_t(obj[idx]);
+
+    //
+    // 16 of the freed items went to the global stack.  The first trim only starts the
+    // interval; the second finds all eight batches untouched since and releases them.
+    //
+    uint64_t freed = alloc_stats_trim_object_t()->total_free_to_heap;
+    qd_alloc_trim();
+    if (alloc_stats_trim_object_t()->total_free_to_heap != freed) return "Trimmed batches that may still be warm";
+    if (qd_alloc_trim() == 0) return "Cold batches were not released";
+    if (alloc_stats_trim_object_t()->total_free_to_heap != freed + 16) return "Incorrect free-to-heap after trim";
+
+    //
+    // Refill the global stack with three batches and start a new interval.  Taking one
+    // batch during the interval (and later pushing one back) leaves two cold batches.
+    //
+    for (idx = 0; idx < 10; idx++)
+        obj[idx] = new_trim_object_t();
+    for (idx = 0; idx < 10; idx++)
+        free_trim_object_t(obj[idx]);
+    qd_alloc_trim();
+    freed = alloc_stats_trim_object_t()->total_free_to_heap;
+    for (idx = 0; idx < 6; idx++)
+        obj[idx] = new_trim_object_t();
+    for (idx = 0; idx < 6; idx++)
+        free_trim_object_t(obj[idx]);
+    qd_alloc_trim();
+    if (alloc_stats_trim_object_t()->total_free_to_heap != freed + 4) return "Incorrect free-to-heap after partial trim";
+
+    return 0;
+}
+
+
+static sampled_object_t *new_from_site_a(void) { return new_sampled_object_t(); }
+static sampled_object_t *new_from_site_b(void) { return new_sampled_object_t(); }
+
+static char* test_alloc_sampled(void *context)
+{
+    sampled_object_t *obj[30];
+    int               idx;
+
+    qd_alloc_stats_t *stats = alloc_stats_sampled_object_t();
+    uint64_t allocs = stats->total_allocs;
+    uint64_t frees  = stats->total_frees;
+
+    //
+    // With one in three sampled, 20 allocations at one site and 10 at another record
+    // 7 and 3 hits (the first allocation is always sampled).
+    //
+    qd_alloc_set_sample_rate(&__desc_sampled_object_t, 3);
+    for (idx = 0; idx < 20; idx++)
+        obj[idx] = new_from_site_a();
+    for (idx = 20; idx < 30; idx++)
+        obj[idx] = new_from_site_b();
+    qd_alloc_set_sample_rate(&__desc_sampled_object_t, 0);
+
+    stats = alloc_stats_sampled_object_t();
+    if (stats->total_allocs - allocs != 30) return "Incorrect allocation count";
+
+    uint64_t total = 0;
+    int      sites = 0;
+    for (idx = 0; idx < QD_ALLOC_SITES; idx++) {
+        if (__desc_sampled_object_t.sites[idx].site) {
+            sites++;
+            total += __desc_sampled_object_t.sites[idx].count;
+        }
+    }
+
+    for (idx = 0; idx < 30; idx++)
+        free_sampled_object_t(obj[idx]);
+    stats = alloc_stats_sampled_object_t();
+    if (stats->total_frees - frees != 30) return "Incorrect free count";
+
+    if (sites != 2) return "Expected two allocation sites";
+    if (total != 10) return "Incorrect number of samples";
+    return 0;
+}
+
+
 int alloc_tests(void)
 {
     int result = 0;
     char *test_group = "alloc_tests";
 
     TEST_CASE(test_alloc_basic, 0);
+    TEST_CASE(test_alloc_slab, 0);
+    TEST_CASE(test_alloc_shared, 0);
+    TEST_CASE(test_alloc_trim, 0);
+    TEST_CASE(test_alloc_sampled, 0);
 
     return result;
 }
@@ -22,6 +22,7 @@
 #include <string.h>
 #include "test_case.h"
 #include <qpid/dispatch/buffer.h>
+#include <qpid/dispatch/threading.h>
 
 
 static void fill_buffer(qd_buffer_list_t *list,
@@ -73,26 +74,131 @@ static char *test_buffer_list_clone(void *context)
     unsigned int len = qd_buffer_list_clone(&copy, &list);
     if (len != pattern_len) return "Copy failed";
 
-    // 'corrupt' source buffer list:
-    *qd_buffer_base(DEQ_HEAD(list)) = (unsigned char)'X';
+    // the copy shares the source's data, which can no longer be appended to:
+    if (qd_buffer_base(DEQ_HEAD(copy)) != qd_buffer_base(DEQ_HEAD(list))) return "Copy should share the data";
+    if (qd_buffer_capacity(DEQ_TAIL(list)) != 0 || qd_buffer_capacity(DEQ_TAIL(copy)) != 0)
+        return "Shared buffers should be immutable";
+
+    qd_buffer_list_t copy2;
+    qd_buffer_list_clone(&copy2, &copy);
+    if (qd_buffer_base(DEQ_HEAD(copy2)) != qd_buffer_base(DEQ_HEAD(list))) return "Copy of a copy should share the data";
+
     qd_buffer_list_free_buffers(&list);
     if (!DEQ_IS_EMPTY(list)) return "List should be empty!";
 
-    // ensure copy is un-molested:
+    // ensure the copies outlive the source:
     if (!compare_buffer(&copy, (unsigned char *)pattern, pattern_len)) return "Buffer list corrupted";
-
-    qd_buffer_list_free_buffers(&list);
     qd_buffer_list_free_buffers(&copy);
+    if (!compare_buffer(&copy2, (unsigned char *)pattern, pattern_len)) return "Buffer list corrupted";
+
+    qd_buffer_list_free_buffers(&copy2);
+    return 0;
+}
+
+
+static char *test_buffer_sized(void *context)
+{
+    qd_buffer_t *small = qd_buffer();
+    qd_buffer_t *tiny  = qd_buffer_sized(1);
+    qd_buffer_t *big   = qd_buffer_sized(1024 * 1024);
+    char        *error = 0;
+
+    if (qd_buffer_capacity(tiny) != qd_buffer_capacity(small))
+        error = "Small hint should use the default size class";
+    else if (qd_buffer_capacity(big) < qd_buffer_capacity(small))
+        error = "Large hint should not use a smaller size class";
+    else if (qd_buffer_size(big) != 0)
+        error = "New buffer should be empty";
+    else {
+        size_t cap = qd_buffer_capacity(big);
+        memset(qd_buffer_cursor(big), 'x', cap);
+        qd_buffer_insert(big, cap);
+        if (qd_buffer_capacity(big) != 0 || qd_buffer_size(big) != cap)
+            error = "Sized buffer did not fill to its capacity";
+    }
+
+    qd_buffer_free(small);
+    qd_buffer_free(tiny);
+    qd_buffer_free(big);
+    return error;
+}
+
+
+static char *test_buffer_memory_limit(void *context)
+{
+    //
+    // The ballast keeps the limit of used - 1 above zero even with one octet buffers; a
+    // limit of 0 is no limit.
+    //
+    qd_buffer_t *ballast = qd_buffer();
+    uint64_t     base    = qd_buffer_memory_in_use();
+    qd_buffer_t *buf     = qd_buffer();
+    char        *error   = 0;
+    uint64_t     used    = qd_buffer_memory_in_use();
+
+    if (used != base + qd_buffer_capacity(buf))
+        error = "Buffer not accounted for";
+    else {
+        qd_buffer_set_memory_limit(used - 1, base);
+        if (!qd_buffer_memory_constrained())
+            error = "Should be constrained above the limit";
+        else {
+            qd_buffer_free(buf);
+            buf = 0;
+            if (qd_buffer_memory_constrained())
+                error = "Should not be constrained below the low-water mark";
+        }
+        qd_buffer_set_memory_limit(0, 0);
+        if (!error && qd_buffer_memory_in_use() != base)
+            error = "Freed buffer not accounted for";
+    }
+
+    qd_buffer_free(buf);
+    qd_buffer_free(ballast);
+    return error;
+}
+
+
+static void *allocate_and_exit(void *buf)
+{
+    *(qd_buffer_t**) buf = qd_buffer();
     return 0;
 }
 
 
+static char *test_buffer_memory_thread_exit(void *context)
+{
+    char        *error = 0;
+    qd_buffer_t *buf   = 0;
+    uint64_t     base  = qd_buffer_memory_in_use();
+
+    //
+    // The buffer is counted only by the thread that allocated it until that thread exits.
+    //
+    sys_thread_t *thread = sys_thread(allocate_and_exit, &buf);
+    sys_thread_join(thread);
+    sys_thread_free(thread);
+    if (!buf)
+        return "Thread allocated no buffer";
+    if (qd_buffer_memory_in_use() != base + qd_buffer_capacity(buf))
+        error = "Buffer of an exited thread not accounted for";
+
+    qd_buffer_free(buf);
+    if (!error && qd_buffer_memory_in_use() != base)
+        error = "Freed buffer not accounted for";
+    return error;
+}
+
+
 int buffer_tests()
 {
     int result = 0;
     char *test_group = "buffer_tests";
 
     TEST_CASE(test_buffer_list_clone, 0);
+    TEST_CASE(test_buffer_sized, 0);
+    TEST_CASE(test_buffer_memory_limit, 0);
+    TEST_CASE(test_buffer_memory_thread_exit, 0);
 
     return result;
 }
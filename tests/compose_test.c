@@ -126,6 +126,63 @@ static char *test_compose_list_of_maps(void *context)
     return 0;
 }
 
+static void compose_list_of_maps(qd_composed_field_t *field)
+{
+    qd_buffer_list_t buffers;
+    qd_buffer_t     *buf = qd_buffer();
+    memcpy(qd_buffer_cursor(buf), "\xa1\x06key002", 8);
+    qd_buffer_insert(buf, 8);
+    DEQ_INIT(buffers);
+    DEQ_INSERT_TAIL(buffers, buf);
+
+    qd_compose_start_list(field);
+    qd_compose_start_map(field);
+    qd_compose_insert_string(field, "key001");
+    qd_compose_insert_uint(field, 10);
+    qd_compose_insert_buffers(field, &buffers);
+    qd_compose_insert_uint(field, 11);
+    qd_compose_end_map(field);
+    for (int j = 0; j < 9; j++) {
+        qd_compose_start_map(field);
+        qd_compose_insert_string(field, "key001");
+        qd_compose_insert_uint(field, 20);
+        qd_compose_insert_string(field, "key002");
+        qd_compose_insert_uint(field, 21);
+        qd_compose_end_map(field);
+    }
+    qd_compose_end_list(field);
+
+    // Left with the caller only when measuring
+    qd_buffer_list_free_buffers(&buffers);
+}
+
+static char *test_compose_flat(void *context)
+{
+    qd_composed_field_t *field = qd_compose(QD_PERFORMATIVE_BODY_AMQP_VALUE, qd_compose_flat(0, 0));
+    compose_list_of_maps(field);
+    size_t size = qd_compose_flat_size(field);
+    qd_compose_free(field);
+    if (size != vector0_length) return "Incorrect measured length";
+
+    uint8_t memory[302];
+    field = qd_compose(QD_PERFORMATIVE_BODY_AMQP_VALUE, qd_compose_flat(memory, size - 1));
+    compose_list_of_maps(field);
+    size = qd_compose_flat_size(field);
+    qd_compose_free(field);
+    if (size != vector0_length) return "Incorrect length when over capacity";
+
+    memset(memory, 0, sizeof(memory));
+    field = qd_compose(QD_PERFORMATIVE_BODY_AMQP_VALUE, qd_compose_flat(memory, sizeof(memory)));
+    compose_list_of_maps(field);
+    size = qd_compose_flat_size(field);
+    if (!DEQ_IS_EMPTY(field->buffers)) return "Flat field used buffers";
+    qd_compose_free(field);
+    if (size != vector0_length) return "Incorrect flat length";
+    if (memcmp(memory, vector0, vector0_length) != 0) return "Pattern Mismatch";
+
+    return 0;
+}
+
 static char *vector1 =
     "\x00\x53\x71"                             // delivery annotations
     "\xd1\x00\x00\x00\x3d\x00\x00\x00\x04"     // map32 with two item pairs
@@ -345,6 +402,7 @@ int compose_tests()
     char *test_group = "compose_tests";
 
     TEST_CASE(test_compose_list_of_maps, 0);
+    TEST_CASE(test_compose_flat, 0);
     TEST_CASE(test_compose_nested_composites, 0);
     TEST_CASE(test_compose_scalars, 0);
     TEST_CASE(test_compose_subfields, 0);
@@ -0,0 +1,622 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//
+// Replay a core record file (see the router's coreRecordFile) against a router core
+// whose I/O handlers are stubs, and report the core thread's cost per action.
+//
+//   core_replay <record-file>
+//
+// The records are fed to the core as fast as it takes them.  The stub handlers stand in
+// for the proton side: they keep the credit the peers granted, take the deliveries the
+// core sends and hold unsettled ones until the recorded peer settles them.
+//
+// The core runs standalone.  Inter-router connections are not replayed, nor is anything
+// recorded on them.  Addresses are rebuilt from their recorded hashes, so deliveries
+// meet the same links as in the recording but address configuration is not reproduced.
+// Results are JSON: the replay time and, for each action type, the core's counts and
+// service times.
+//
+
+#include "dispatch_private.h"
+#include "core_record.h"
+#include "router_core/router_core_private.h"
+
+#include <qpid/dispatch.h>
+#include <qpid/dispatch/ctools.h>
+#include <qpid/dispatch/hash.h>
+#include <qpid/dispatch/iterator.h>
+#include <qpid/dispatch/message.h>
+#include <qpid/dispatch/threading.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct replay_conn_t     replay_conn_t;
+typedef struct replay_link_t     replay_link_t;
+typedef struct replay_delivery_t replay_delivery_t;
+
+struct replay_delivery_t {
+    DEQ_LINKS(replay_delivery_t);
+    qdr_delivery_t   *dlv;
+    replay_link_t    *link;
+    qd_hash_handle_t *handle;
+};
+
+DEQ_DECLARE(replay_delivery_t, replay_delivery_list_t);
+
+struct replay_link_t {
+    DEQ_LINKS(replay_link_t);
+    replay_conn_t          *conn;
+    qdr_link_t             *link;
+    uint64_t                id;          ///< Identity in the recording, 0 until a core-initiated link is answered
+    qd_hash_handle_t       *handle;
+    qd_direction_t          dir;
+    int                     credit;      ///< Credit the peer has granted on an outgoing link
+    uint64_t                sent;        ///< Deliveries sent on an outgoing link
+    replay_delivery_list_t  unsettled;
+};
+
+DEQ_DECLARE(replay_link_t, replay_link_list_t);
+
+struct replay_conn_t {
+    DEQ_LINKS(replay_conn_t);
+    DEQ_LINKS_N(OPEN, replay_conn_t);
+    qdr_connection_t   *conn;
+    uint64_t            id;
+    qd_hash_handle_t   *handle;
+    bool                activated;
+    replay_link_list_t  links;
+    replay_link_list_t  attaching;       ///< Links the core attached, waiting for the recorded answer
+};
+
+DEQ_DECLARE(replay_conn_t, replay_conn_list_t);
+
+typedef struct {
+    qdr_core_t         *core;
+    sys_mutex_t        *lock;            ///< Guards activated and the connection contexts
+    replay_conn_list_t  activated;
+    replay_conn_list_t  open;
+    qd_hash_t          *conns;
+    qd_hash_t          *links;
+    qd_hash_t          *deliveries;
+    uint64_t            applied;
+    uint64_t            skipped;
+} replay_t;
+
+static replay_t replay;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static qd_iterator_t *key_iterator(qd_iterator_storage_t *storage, char *key, size_t size,
+                                   char kind, uint64_t id, uint64_t seq)
+{
+    snprintf(key, size, "%c%"PRIu64"/%"PRIu64, kind, id, seq);
+    return qd_iterator_init_string(storage, key, ITER_VIEW_ALL);
+}
+
+
+static void *lookup(qd_hash_t *hash, char kind, uint64_t id, uint64_t seq)
+{
+    char                  key[64];
+    qd_iterator_storage_t storage;
+    void                 *value = 0;
+    qd_iterator_t        *iter  = key_iterator(&storage, key, sizeof(key), kind, id, seq);
+    qd_hash_retrieve(hash, iter, &value);
+    qd_iterator_free(iter);
+    return value;
+}
+
+
+static void insert(qd_hash_t *hash, char kind, uint64_t id, uint64_t seq, void *value, qd_hash_handle_t **handle)
+{
+    char                  key[64];
+    qd_iterator_storage_t storage;
+    qd_iterator_t        *iter = key_iterator(&storage, key, sizeof(key), kind, id, seq);
+    qd_hash_insert(hash, iter, value, handle);
+    qd_iterator_free(iter);
+}
+
+
+static void remove_handle(qd_hash_t *hash, qd_hash_handle_t **handle)
+{
+    if (*handle) {
+        qd_hash_remove_by_handle(hash, *handle);
+        qd_hash_handle_free(*handle);
+        *handle = 0;
+    }
+}
+
+
+static qdr_terminus_t *terminus(uint32_t addr_hash)
+{
+    qdr_terminus_t *term = qdr_terminus(0);
+    if (addr_hash) {
+        char address[32];
+        snprintf(address, sizeof(address), "replay/%08"PRIx32, addr_hash);
+        qdr_terminus_set_address(term, address);
+    }
+    return term;
+}
+
+
+//
+// A complete message of the recorded size addressed to the hashed address
+//
+static qd_message_t *message(uint32_t size, uint32_t addr_hash)
+{
+    char             address[32];
+    qd_buffer_list_t body;
+    qd_message_t    *msg = qd_message();
+
+    DEQ_INIT(body);
+    while (size) {
+        qd_buffer_t *buf = qd_buffer();
+        uint32_t     n   = size < qd_buffer_capacity(buf) ? size : (uint32_t) qd_buffer_capacity(buf);
+        memset(qd_buffer_cursor(buf), 'x', n);
+        qd_buffer_insert(buf, n);
+        DEQ_INSERT_TAIL(body, buf);
+        size -= n;
+    }
+    snprintf(address, sizeof(address), "replay/%08"PRIx32, addr_hash);
+    qd_message_compose_1(msg, address, &body);
+    qd_message_check(msg, QD_DEPTH_PROPERTIES);
+    return msg;
+}
+
+
+static void hold_delivery(replay_link_t *rlink, uint64_t seq, qdr_delivery_t *dlv)
+{
+    replay_delivery_t *rdlv = NEW(replay_delivery_t);
+    ZERO(rdlv);
+    rdlv->dlv  = dlv;
+    rdlv->link = rlink;
+    qdr_delivery_incref(dlv);
+    qdr_delivery_set_context(dlv, rdlv);
+    DEQ_INSERT_TAIL(rlink->unsettled, rdlv);
+    insert(replay.deliveries, 'D', rlink->id, seq, rdlv, &rdlv->handle);
+}
+
+
+//
+// Drop the replay's reference to a delivery.  If give is set, the reference was passed to the core.
+//
+static void release_delivery(replay_delivery_t *rdlv, bool give)
+{
+    qdr_delivery_set_context(rdlv->dlv, 0);
+    if (!give)
+        qdr_delivery_decref(replay.core, rdlv->dlv);
+    remove_handle(replay.deliveries, &rdlv->handle);
+    DEQ_REMOVE(rdlv->link->unsettled, rdlv);
+    free(rdlv);
+}
+
+
+static void free_link(replay_link_t *rlink, replay_link_list_t *list)
+{
+    replay_delivery_t *rdlv;
+    while ((rdlv = DEQ_HEAD(rlink->unsettled)))
+        release_delivery(rdlv, false);
+    qdr_link_set_context(rlink->link, 0);
+    remove_handle(replay.links, &rlink->handle);
+    DEQ_REMOVE(*list, rlink);
+    free(rlink);
+}
+
+
+static replay_link_t *new_link(replay_conn_t *rconn, qdr_link_t *link, qd_direction_t dir)
+{
+    replay_link_t *rlink = NEW(replay_link_t);
+    ZERO(rlink);
+    rlink->conn = rconn;
+    rlink->link = link;
+    rlink->dir  = dir;
+    DEQ_INIT(rlink->unsettled);
+    qdr_link_set_context(link, rlink);
+    return rlink;
+}
+
+
+//==================================================================================
+// Stub I/O handlers
+//==================================================================================
+
+static void stub_activate(void *context, qdr_connection_t *conn)
+{
+    // Called on the core thread
+    sys_mutex_lock(replay.lock);
+    replay_conn_t *rconn = (replay_conn_t*) qdr_connection_get_context(conn);
+    if (rconn && !rconn->activated) {
+        rconn->activated = true;
+        DEQ_INSERT_TAIL(replay.activated, rconn);
+    }
+    sys_mutex_unlock(replay.lock);
+}
+
+
+static void stub_first_attach(void *context, qdr_connection_t *conn, qdr_link_t *link,
+                              qdr_terminus_t *source, qdr_terminus_t *target)
+{
+    replay_conn_t *rconn = (replay_conn_t*) qdr_connection_get_context(conn);
+    if (rconn)
+        DEQ_INSERT_TAIL(rconn->attaching, new_link(rconn, link, qdr_link_direction(link)));
+}
+
+
+static void stub_second_attach(void *context, qdr_link_t *link, qdr_terminus_t *source, qdr_terminus_t *target)
+{
+}
+
+
+static void stub_detach(void *context, qdr_link_t *link, qdr_error_t *error, bool first, bool close)
+{
+    replay_link_t *rlink = (replay_link_t*) qdr_link_get_context(link);
+
+    // The core's answer to a recorded detach ends the link
+    if (rlink && !first)
+        free_link(rlink, rlink->id ? &rlink->conn->links : &rlink->conn->attaching);
+}
+
+
+static void stub_flow(void *context, qdr_link_t *link, int credit)
+{
+}
+
+
+static void stub_offer(void *context, qdr_link_t *link, int delivery_count)
+{
+}
+
+
+static void stub_drained(void *context, qdr_link_t *link)
+{
+}
+
+
+static void stub_drain(void *context, qdr_link_t *link, bool mode)
+{
+}
+
+
+static int stub_push(void *context, qdr_link_t *link, int limit)
+{
+    replay_link_t *rlink = (replay_link_t*) qdr_link_get_context(link);
+    if (!rlink)
+        return 0;
+    return qdr_link_process_deliveries(replay.core, link, rlink->credit < limit ? rlink->credit : limit);
+}
+
+
+static bool stub_deliver(void *context, qdr_link_t *link, qdr_delivery_t *dlv, bool settled)
+{
+    replay_link_t *rlink = (replay_link_t*) qdr_link_get_context(link);
+    if (!rlink)
+        return true;
+
+    rlink->credit--;
+    rlink->sent++;
+    if (!settled)
+        hold_delivery(rlink, rlink->sent, dlv);
+    return true;
+}
+
+
+static void stub_delivery_update(void *context, qdr_delivery_t *dlv, uint64_t disp, bool settled)
+{
+    replay_delivery_t *rdlv = (replay_delivery_t*) qdr_delivery_get_context(dlv);
+    if (rdlv && settled)
+        release_delivery(rdlv, false);
+}
+
+
+//
+// Process the connections the core has activated, as the proactor would
+//
+static bool process_activated(void)
+{
+    bool processed = false;
+    while (true) {
+        sys_mutex_lock(replay.lock);
+        replay_conn_t *rconn = DEQ_HEAD(replay.activated);
+        if (rconn) {
+            DEQ_REMOVE_HEAD(replay.activated);
+            rconn->activated = false;
+        }
+        sys_mutex_unlock(replay.lock);
+        if (!rconn)
+            return processed;
+        qdr_connection_process(rconn->conn);
+        processed = true;
+    }
+}
+
+
+//==================================================================================
+// Records
+//==================================================================================
+
+static bool replay_record(const qd_core_record_t *record)
+{
+    bool           settled = !!(record->flags & QD_CORE_RECORD_SETTLED);
+    replay_conn_t *rconn   = 0;
+    replay_link_t *rlink   = 0;
+
+    switch (record->type) {
+    case QD_CORE_RECORD_CONNECTION_OPENED: {
+        qdr_connection_role_t role = (qdr_connection_role_t) record->value;
+        if (role == QDR_ROLE_INTER_ROUTER || role == QDR_ROLE_INTER_ROUTER_DATA)
+            return false;
+        bool incoming = !!(record->flags & QD_CORE_RECORD_INCOMING);
+        char label[32];
+        snprintf(label, sizeof(label), "replay-%"PRIu64, record->connection_id);
+        qdr_connection_info_t *info = qdr_connection_info(false, false, true, 0,
+                                                          incoming ? QD_INCOMING : QD_OUTGOING,
+                                                          "replay", 0, 0, 0, "replay", 0, 0, false);
+        rconn = NEW(replay_conn_t);
+        ZERO(rconn);
+        rconn->id = record->connection_id;
+        DEQ_INIT(rconn->links);
+        DEQ_INIT(rconn->attaching);
+        DEQ_ITEM_INIT_N(OPEN, rconn);
+        DEQ_INSERT_TAIL_N(OPEN, replay.open, rconn);
+        rconn->conn = qdr_connection_opened(replay.core, incoming, role, 1, record->connection_id, label,
+                                            label, false, false, 250, 250, 0, 0, info);
+        qdr_connection_set_context(rconn->conn, rconn);
+        insert(replay.conns, 'C', rconn->id, 0, rconn, &rconn->handle);
+        return true;
+    }
+
+    case QD_CORE_RECORD_CONNECTION_CLOSED:
+        rconn = (replay_conn_t*) lookup(replay.conns, 'C', record->connection_id, 0);
+        if (!rconn)
+            return false;
+        sys_mutex_lock(replay.lock);
+        qdr_connection_set_context(rconn->conn, 0);
+        if (rconn->activated)
+            DEQ_REMOVE(replay.activated, rconn);
+        sys_mutex_unlock(replay.lock);
+        while (DEQ_HEAD(rconn->links))
+            free_link(DEQ_HEAD(rconn->links), &rconn->links);
+        while (DEQ_HEAD(rconn->attaching))
+            free_link(DEQ_HEAD(rconn->attaching), &rconn->attaching);
+        qdr_connection_closed(rconn->conn);
+        remove_handle(replay.conns, &rconn->handle);
+        DEQ_REMOVE_N(OPEN, replay.open, rconn);
+        free(rconn);
+        return true;
+
+    case QD_CORE_RECORD_FIRST_ATTACH: {
+        rconn = (replay_conn_t*) lookup(replay.conns, 'C', record->connection_id, 0);
+        if (!rconn)
+            return false;
+        qd_direction_t dir = record->flags & QD_CORE_RECORD_INCOMING ? QD_INCOMING : QD_OUTGOING;
+        char name[32];
+        snprintf(name, sizeof(name), "replay-%"PRIu64, record->link_id);
+        qdr_terminus_t *source = terminus(dir == QD_OUTGOING ? record->addr_hash : 0);
+        qdr_terminus_t *target = terminus(dir == QD_INCOMING ? record->addr_hash : 0);
+        qdr_link_t     *link   = qdr_link_first_attach(rconn->conn, dir, source, target, name, 0);
+        rlink = new_link(rconn, link, dir);
+        rlink->id = record->link_id;
+        DEQ_INSERT_TAIL(rconn->links, rlink);
+        insert(replay.links, 'L', rlink->id, 0, rlink, &rlink->handle);
+        return true;
+    }
+
+    case QD_CORE_RECORD_SECOND_ATTACH: {
+        rconn = (replay_conn_t*) lookup(replay.conns, 'C', record->connection_id, 0);
+        if (!rconn)
+            return false;
+        qd_direction_t dir = record->flags & QD_CORE_RECORD_INCOMING ? QD_INCOMING : QD_OUTGOING;
+
+        // Core-initiated links are matched to the recording in the order they were attached
+        for (rlink = DEQ_HEAD(rconn->attaching); rlink && rlink->dir != dir; rlink = DEQ_NEXT(rlink))
+            ;
+        if (!rlink)
+            return false;
+        DEQ_REMOVE(rconn->attaching, rlink);
+        DEQ_INSERT_TAIL(rconn->links, rlink);
+        rlink->id = record->link_id;
+        insert(replay.links, 'L', rlink->id, 0, rlink, &rlink->handle);
+        qdr_link_second_attach(rlink->link, terminus(dir == QD_OUTGOING ? record->addr_hash : 0),
+                               terminus(dir == QD_INCOMING ? record->addr_hash : 0));
+        return true;
+    }
+
+    case QD_CORE_RECORD_DETACH:
+        rlink = (replay_link_t*) lookup(replay.links, 'L', record->link_id, 0);
+        if (!rlink)
+            return false;
+        qdr_link_detach(rlink->link, (qd_detach_type_t) record->value, 0);
+        return true;
+
+    case QD_CORE_RECORD_FLOW:
+        rlink = (replay_link_t*) lookup(replay.links, 'L', record->link_id, 0);
+        if (!rlink)
+            return false;
+        rlink->credit = (int) record->value;
+        qdr_link_flow(replay.core, rlink->link, (int) record->value, !!(record->flags & QD_CORE_RECORD_DRAIN));
+        return true;
+
+    case QD_CORE_RECORD_DELIVER: {
+        rlink = (replay_link_t*) lookup(replay.links, 'L', record->link_id, 0);
+        if (!rlink)
+            return false;
+        qd_message_t   *msg = message(record->size, record->addr_hash);
+        qdr_delivery_t *dlv;
+        if (record->flags & QD_CORE_RECORD_ROUTED) {
+            dlv = qdr_link_deliver_to_routed_link(rlink->link, msg, settled, (const uint8_t*) &record->sequence,
+                                                  sizeof(record->sequence), 0, 0);
+        } else if (record->flags & QD_CORE_RECORD_ADDRESSED) {
+            char address[32];
+            snprintf(address, sizeof(address), "replay/%08"PRIx32, record->addr_hash);
+            dlv = qdr_link_deliver_to(rlink->link, msg, 0, qd_iterator_string(address, ITER_VIEW_ADDRESS_HASH),
+                                      settled, 0);
+        } else
+            dlv = qdr_link_deliver(rlink->link, msg, 0, settled, 0);
+        if (dlv && !settled)
+            hold_delivery(rlink, record->sequence, dlv);
+        return true;
+    }
+
+    case QD_CORE_RECORD_DISPOSITION: {
+        replay_delivery_t *rdlv = (replay_delivery_t*) lookup(replay.deliveries, 'D', record->link_id,
+                                                              record->sequence);
+        if (!rdlv)
+            return false;
+        qdr_delivery_t *dlv = rdlv->dlv;
+        if (settled)
+            release_delivery(rdlv, true);
+        qdr_delivery_update_disposition(replay.core, dlv, record->value, settled, 0, 0, settled);
+        return true;
+    }
+    }
+
+    return false;
+}
+
+
+//
+// Wait till the core has taken every action and no connection is waiting to be processed
+//
+static void wait_idle(void)
+{
+    int quiet = 0;
+    while (quiet < 10) {
+        bool busy = process_activated();
+        for (int lane = 0; lane < QDR_ACTION_LANES; lane++)
+            busy = busy || sys_atomic_get(&replay.core->action_depth[lane]) != 0;
+        quiet = busy ? 0 : quiet + 1;
+        usleep(1000);
+    }
+}
+
+
+static void print_results(uint64_t records, uint64_t elapsed_ns)
+{
+    qdr_core_t *core = replay.core;
+
+    printf("{\n    \"records\": %"PRIu64", \"applied\": %"PRIu64", \"skipped\": %"PRIu64", \"replay_ns\": %"PRIu64",\n",
+           records, replay.applied, replay.skipped, elapsed_ns);
+    printf("    \"actions\": [");
+    for (int i = 0; i < core->action_stats_count; i++) {
+        qdr_action_stats_t *stats = &core->action_stats[i];
+        printf("%s\n        {\"label\": \"%s\", \"count\": %"PRIu64", \"service_ns_per_action\": %.1f, "
+               "\"max_service_ns\": %"PRIu64", \"wait_ns_per_action\": %.1f}",
+               i ? "," : "", stats->label, stats->count,
+               stats->count ? (double) stats->service_ns / stats->count : 0.0, stats->max_service_ns,
+               stats->count ? (double) stats->wait_ns / stats->count : 0.0);
+    }
+    printf("\n    ]\n}\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <record-file>\n", argv[0]);
+        exit(1);
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(argv[1]);
+        exit(1);
+    }
+    if ((size_t) st.st_size < sizeof(qd_core_record_header_t)) {
+        fprintf(stderr, "%s is too short to be a core record file\n", argv[1]);
+        exit(1);
+    }
+    void *base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(argv[1]);
+        exit(1);
+    }
+    const qd_core_record_header_t *header = (const qd_core_record_header_t*) base;
+    if (memcmp(header->magic, QD_CORE_RECORD_MAGIC, sizeof(QD_CORE_RECORD_MAGIC)) != 0 ||
+        header->version != QD_CORE_RECORD_VERSION || header->record_size != sizeof(qd_core_record_t)) {
+        fprintf(stderr, "%s is not a version %d core record file\n", argv[1], QD_CORE_RECORD_VERSION);
+        exit(1);
+    }
+    const qd_core_record_t *records = (const qd_core_record_t*) (header + 1);
+    uint64_t capacity = (st.st_size - sizeof(qd_core_record_header_t)) / sizeof(qd_core_record_t);
+    if (header->capacity < capacity)
+        capacity = header->capacity;
+
+    qd_dispatch_t *qd = qd_dispatch(0);
+    qd->core_action_timing = true;
+
+    ZERO(&replay);
+    replay.lock       = sys_mutex();
+    replay.conns      = qd_hash(10, 32, 0);
+    replay.links      = qd_hash(12, 32, 0);
+    replay.deliveries = qd_hash(12, 32, 0);
+    DEQ_INIT(replay.activated);
+    DEQ_INIT(replay.open);
+    replay.core = qdr_core(qd, QD_ROUTER_MODE_STANDALONE, "0", "replay");
+    qdr_connection_handlers(replay.core, &replay, stub_activate, stub_first_attach, stub_second_attach,
+                            stub_detach, stub_flow, stub_offer, stub_drained, stub_drain, stub_push,
+                            stub_deliver, stub_delivery_update);
+
+    uint64_t count = 0;
+    uint64_t start = now_ns();
+    for (; count < capacity && records[count].type; count++) {
+        if (replay_record(&records[count]))
+            replay.applied++;
+        else
+            replay.skipped++;
+        process_activated();
+    }
+    wait_idle();
+    uint64_t elapsed = now_ns() - start;
+    print_results(count, elapsed);
+
+    //
+    // Close what the recording left open
+    //
+    qd_core_record_t close = {0};
+    close.type = QD_CORE_RECORD_CONNECTION_CLOSED;
+    while (DEQ_HEAD(replay.open)) {
+        close.connection_id = DEQ_HEAD(replay.open)->id;
+        replay_record(&close);
+    }
+    wait_idle();
+
+    qdr_core_free(replay.core);
+    qd_hash_free(replay.deliveries);
+    qd_hash_free(replay.links);
+    qd_hash_free(replay.conns);
+    sys_mutex_free(replay.lock);
+    munmap(base, st.st_size);
+    qd_dispatch_free(qd);
+    return 0;
+}
@@ -869,6 +869,8 @@ static char *test_prefix_hash(void *context)
                                                        {0, 0}};
 
     qd_hash_t *hash = qd_hash(10, 32, 0);
+    if (context)
+        qd_hash_prefix_index(hash, (const char*) context);
     long idx = 0;
 
     //
@@ -942,6 +944,8 @@ static char *test_prefix_hash_with_space(void *context)
                                                        {0, 0}};
 
     qd_hash_t *hash = qd_hash(10, 32, 0);
+    if (context)
+        qd_hash_prefix_index(hash, (const char*) context);
     long idx = 0;
 
     //
@@ -980,6 +984,233 @@ static char *test_prefix_hash_with_space(void *context)
 }
 
 
+static char *test_view_hash_cached(void *context)
+{
+    qd_iterator_t *iter  = qd_iterator_string("amqp:/my-addr", ITER_VIEW_ADDRESS_HASH);
+    qd_iterator_t *fresh = qd_iterator_string("amqp:/my-addr", ITER_VIEW_ADDRESS_HASH);
+
+    uint32_t first  = qd_iterator_hash_view(iter);
+    uint32_t second = qd_iterator_hash_view(iter);
+    if (first != second || first != qd_iterator_hash_view(fresh))
+        return "Cached view hash differs from a fresh computation";
+
+    qd_iterator_annotate_phase(iter, '5');
+    qd_iterator_annotate_phase(fresh, '5');
+    if (qd_iterator_hash_view(iter) == first)
+        return "View hash was not invalidated by a phase annotation";
+
+    qd_iterator_free(fresh);
+    fresh = qd_iterator_string("amqp:/my-addr", ITER_VIEW_ADDRESS_HASH);
+    qd_iterator_annotate_phase(fresh, '5');
+    if (qd_iterator_hash_view(iter) != qd_iterator_hash_view(fresh))
+        return "Re-cached view hash differs from a fresh computation";
+
+    qd_iterator_free(iter);
+    qd_iterator_free(fresh);
+    return 0;
+}
+
+
+static char *test_hash_grow(void *context)
+{
+    static char error[200];
+    const long count = 5000;
+    qd_hash_t        *hash    = qd_hash(2, 4, 0);
+    qd_hash_handle_t *handles[count];
+    char              key[32];
+
+    //
+    // Insert enough entries to force several resizes, holding a handle to each
+    //
+    for (long i = 0; i < count; i++) {
+        snprintf(key, sizeof(key), "addr-%ld", i);
+        qd_iterator_t *iter = qd_iterator_string(key, ITER_VIEW_ALL);
+        if (qd_hash_insert(hash, iter, (void*) (i + 1), &handles[i]) != QD_ERROR_NONE) {
+            qd_iterator_free(iter);
+            return "qd_hash_insert failed";
+        }
+        qd_iterator_free(iter);
+    }
+
+    if (qd_hash_size(hash) != count)
+        return "Wrong hash size after inserts";
+
+    //
+    // Remove every odd entry, alternating between key and handle removal
+    //
+    for (long i = 1; i < count; i += 2) {
+        if (i % 4 == 1) {
+            snprintf(key, sizeof(key), "addr-%ld", i);
+            qd_iterator_t *iter = qd_iterator_string(key, ITER_VIEW_ALL);
+            qd_error_t     err  = qd_hash_remove(hash, iter);
+            qd_iterator_free(iter);
+            if (err != QD_ERROR_NONE)
+                return "qd_hash_remove failed";
+        } else if (qd_hash_remove_by_handle(hash, handles[i]) != QD_ERROR_NONE)
+            return "qd_hash_remove_by_handle failed";
+    }
+
+    for (long i = 0; i < count; i++) {
+        void *val;
+        snprintf(key, sizeof(key), "addr-%ld", i);
+        qd_iterator_t *iter = qd_iterator_string(key, ITER_VIEW_ALL);
+        qd_hash_retrieve(hash, iter, &val);
+        qd_iterator_free(iter);
+        void *expected = (i & 1) ? 0 : (void*) (i + 1);
+        if (val != expected) {
+            snprintf(error, 200, "Key '%s': expected %p, got %p", key, expected, val);
+            return error;
+        }
+        if (!(i & 1) && strcmp((const char*) qd_hash_key_by_handle(handles[i]), key) != 0)
+            return "Handle does not reference its key";
+        qd_hash_handle_free(handles[i]);
+    }
+
+    if (qd_hash_size(hash) != count / 2)
+        return "Wrong hash size after removals";
+
+    qd_hash_free(hash);
+    return 0;
+}
+
+
+static char *test_prefix_hash_indexed(void *context)
+{
+    return test_prefix_hash("M");
+}
+
+
+static char *test_prefix_hash_with_space_indexed(void *context)
+{
+    return test_prefix_hash_with_space("M");
+}
+
+
+static char *test_prefix_index_remove(void *context)
+{
+    const char *entries[] = {"Ca", "Ca.b", "Ca.b.c", "Ca.bc", 0};
+    qd_hash_t  *hash      = qd_hash(4, 4, 0);
+    long        idx;
+
+    qd_hash_prefix_index(hash, "C");
+    for (idx = 0; entries[idx]; idx++) {
+        qd_iterator_t *iter = qd_iterator_string(entries[idx], ITER_VIEW_ALL);
+        qd_hash_insert(hash, iter, (void*) (idx + 1), 0);
+        qd_iterator_free(iter);
+    }
+
+    struct { const char *key; const char *lookup; long expected; } steps[] = {
+        {0,        "Ca.b.c.d", 3},
+        {"Ca.b.c", "Ca.b.c.d", 2},
+        {0,        "Ca.bcd",   1},
+        {0,        "Ca.bc",    4},
+        {"Ca.b",   "Ca.b.c",   1},
+        {"Ca",     "Ca.b",     0},
+        {0,        "Ca.bc.x",  4},
+        {"Ca.bc",  "Ca.bc",    0},
+        {0, 0, 0}};
+
+    for (idx = 0; steps[idx].lookup; idx++) {
+        if (steps[idx].key) {
+            qd_iterator_t *iter = qd_iterator_string(steps[idx].key, ITER_VIEW_ALL);
+            qd_hash_remove(hash, iter);
+            qd_iterator_free(iter);
+        }
+        void          *ptr;
+        qd_iterator_t *iter = qd_iterator_string(steps[idx].lookup, ITER_VIEW_ALL);
+        qd_hash_retrieve_prefix(hash, iter, &ptr);
+        qd_iterator_free(iter);
+        if ((long) ptr != steps[idx].expected)
+            return "Prefix index returned the wrong entry after a remove";
+    }
+
+    qd_hash_free(hash);
+    return 0;
+}
+
+
+static char *test_contiguous_view(void *context)
+{
+    const char *text = "amqp:/some.long.topic.name/with.several/segments.and.a.tail.0123456789";
+    int         len  = strlen(text);
+
+    qd_buffer_list_t chain;
+    DEQ_INIT(chain);
+    build_buffer_chain(&chain, text, 7);
+
+    qd_iterator_t *flat  = qd_iterator_string(text, ITER_VIEW_ALL);
+    qd_iterator_t *split = qd_iterator_buffer(DEQ_HEAD(chain), 0, len, ITER_VIEW_ALL);
+    char          *ret   = 0;
+
+    if (qd_iterator_hash_view(flat) != qd_iterator_hash_view(split))
+        ret = "Contiguous and split views hash differently";
+    else if (!qd_iterator_equal(flat, (const unsigned char*) text) || !qd_iterator_equal(split, (const unsigned char*) text))
+        ret = "View does not equal its own text";
+    else if (qd_iterator_equal(flat, (const unsigned char*) "amqp:/some.long") ||
+             qd_iterator_equal(flat, (const unsigned char*) "amqp:/some.long.topic.name/with.several/segments.and.a.tail.0123456789x"))
+        ret = "View equals a shorter or longer string";
+    else if (!qd_iterator_prefix(flat, "amqp:/some") || !qd_iterator_prefix(flat, ".long"))
+        ret = "Prefix did not match and advance";
+    else if (qd_iterator_prefix(flat, ".topic.nope") || !qd_iterator_prefix(flat, ".topic"))
+        ret = "Failed prefix moved the view";
+    else {
+        unsigned char copy[100];
+        int n = qd_iterator_ncopy(flat, copy, 10);
+        if (n != 10 || memcmp(copy, text, 10) != 0)
+            ret = "Short ncopy returned the wrong octets";
+        else if (strcmp(qd_iterator_strncpy(split, (char*) copy, sizeof(copy)), text) != 0)
+            ret = "Copy of a split view is wrong";
+    }
+
+    qd_iterator_free(flat);
+    qd_iterator_free(split);
+    release_buffer_chain(&chain);
+    return ret;
+}
+
+
+static char *test_iterator_in_storage(void *context)
+{
+    qd_hash_t *hash = qd_hash(4, 4, 0);
+    char      *ret  = 0;
+
+    qd_iterator_t *key = qd_iterator_string("Ca.b.c.d.e.f.g.h.i", ITER_VIEW_ALL);
+    qd_hash_insert(hash, key, "DEEP", 0);
+    qd_iterator_free(key);
+    key = qd_iterator_string("Ca.b", ITER_VIEW_ALL);
+    qd_hash_insert(hash, key, "SHALLOW", 0);
+    qd_iterator_free(key);
+
+    //
+    // Twelve segments: more than are held inline, so the deepest spill onto the list
+    //
+    qd_iterator_storage_t storage;
+    qd_iterator_t *iter = qd_iterator_init_string(&storage, "Ca.b.c.d.e.f.g.h.i.j.k.l", ITER_VIEW_ALL);
+    void          *val;
+
+    qd_hash_retrieve_prefix(hash, iter, &val);
+    if (!val || strcmp((char*) val, "DEEP") != 0)
+        ret = "Prefix lookup with spilled segments failed";
+    qd_iterator_free(iter);
+
+    if (!ret) {
+        qd_iterator_t        *src = qd_iterator_string("Ca.b.x", ITER_VIEW_ALL);
+        qd_iterator_storage_t dup_storage;
+        qd_iterator_t        *dup = qd_iterator_init_dup(&dup_storage, src);
+        qd_hash_retrieve_prefix(hash, dup, &val);
+        if (!val || strcmp((char*) val, "SHALLOW") != 0)
+            ret = "Prefix lookup with a duplicated iterator failed";
+        else if (!qd_iterator_equal(src, (const unsigned char*) "Ca.b.x"))
+            ret = "Lookup on the duplicate disturbed the original";
+        qd_iterator_free(dup);
+        qd_iterator_free(src);
+    }
+
+    qd_hash_free(hash);
+    return ret;
+}
+
+
 int field_tests(void)
 {
     int result = 0;
@@ -1000,6 +1231,7 @@ int field_tests(void)
     TEST_CASE(test_view_node_hash, 0);
     TEST_CASE(test_field_advance_string, 0);
     TEST_CASE(test_field_advance_buffer, 0);
+    TEST_CASE(test_contiguous_view, 0);
     TEST_CASE(test_qd_hash_retrieve_prefix_separator, 0);
     TEST_CASE(test_qd_hash_retrieve_prefix, 0);
     TEST_CASE(test_qd_hash_retrieve_prefix_no_match, 0);
@@ -1011,6 +1243,12 @@ int field_tests(void)
     TEST_CASE(test_qd_hash_retrieve_prefix_separator_exact_match_dot_at_end_1, 0);
     TEST_CASE(test_prefix_hash, 0);
     TEST_CASE(test_prefix_hash_with_space, 0);
+    TEST_CASE(test_prefix_hash_indexed, 0);
+    TEST_CASE(test_prefix_hash_with_space_indexed, 0);
+    TEST_CASE(test_prefix_index_remove, 0);
+    TEST_CASE(test_iterator_in_storage, 0);
+    TEST_CASE(test_view_hash_cached, 0);
+    TEST_CASE(test_hash_grow, 0);
 
     return result;
 }
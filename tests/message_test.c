@@ -165,8 +165,12 @@ static char* test_message_properties(void *context)
 
     set_content(content, size);
 
+    if (!qd_message_check(msg, QD_DEPTH_ALL)) return "Message check failed";
+    if (content->properties) return "Property locations allocated before a property was needed";
+
     qd_iterator_t *iter = qd_message_field_iterator(msg, QD_FIELD_CORRELATION_ID);
     if (!iter) return "Expected iterator for the 'correlation-id' field";
+    if (!content->properties) return "Property locations not allocated";
     if (qd_iterator_length(iter) != 13) return "Bad length for correlation-id";
     if (!qd_iterator_equal(iter, (const unsigned char *)"correlationId")) {
         qd_iterator_free(iter);
@@ -311,6 +315,126 @@ static char* test_send_message_annotations(void *context)
 }
 
 
+static char* test_check_depth_incomplete(void *context)
+{
+    pn_message_t *pn_msg = pn_message();
+    pn_message_set_address(pn_msg, "test_addr_4");
+    pn_data_put_string(pn_message_body(pn_msg), pn_bytes(28, "a body long enough to follow"));
+
+    size_t size = 10000;
+    int result = pn_message_encode(pn_msg, buffer, &size);
+    pn_message_free(pn_msg);
+    if (result != 0) return "Error in pn_message_encode";
+
+    qd_message_t         *msg     = qd_message();
+    qd_message_content_t *content = MSG_CONTENT(msg);
+
+    content->receive_complete = false;
+    set_content(content, 5);
+    if (qd_message_check_depth(msg, QD_DEPTH_PROPERTIES) != QD_MESSAGE_DEPTH_INCOMPLETE)
+        return "Expected a truncated message to be incomplete";
+
+    qd_buffer_list_free_buffers(&content->buffers);
+    set_content(content, size);
+    if (qd_message_check_depth(msg, QD_DEPTH_PROPERTIES) != QD_MESSAGE_DEPTH_OK)
+        return "Expected the properties to be found once they have arrived";
+
+    qd_iterator_t *iter = qd_message_field_iterator(msg, QD_FIELD_TO);
+    if (iter == 0) return "Expected an iterator for the 'to' field";
+    if (!qd_iterator_equal(iter, (unsigned char*) "test_addr_4")) {
+        qd_iterator_free(iter);
+        return "Mismatched 'to' field contents";
+    }
+    qd_iterator_free(iter);
+
+    content->receive_complete = true;
+    if (qd_message_check_depth(msg, QD_DEPTH_ALL) != QD_MESSAGE_DEPTH_OK)
+        return "Expected a complete message to be valid";
+
+    qd_message_free(msg);
+    return 0;
+}
+
+
+static char* test_inline_buffer(void *context)
+{
+    pn_message_t *pn_msg = pn_message();
+    pn_message_set_address(pn_msg, "test_addr_inline");
+
+    size_t size = 10000;
+    int result = pn_message_encode(pn_msg, buffer, &size);
+    pn_message_free(pn_msg);
+    if (result != 0) return "Error in pn_message_encode";
+    if (size > QD_MESSAGE_INLINE_CAPACITY) return "Test message too large for the inline buffer";
+
+    qd_message_t         *msg     = qd_message();
+    qd_message_content_t *content = MSG_CONTENT(msg);
+    qd_buffer_t          *buf     = MSG_INLINE_BUFFER(content);
+
+    if (qd_buffer_size(buf) != 0 || qd_buffer_capacity(buf) != QD_MESSAGE_INLINE_CAPACITY) {
+        qd_message_free(msg);
+        return "Inline buffer not initialized";
+    }
+
+    // Fill the inline buffer as qd_message_receive does for a small delivery
+    memcpy(qd_buffer_cursor(buf), buffer, size);
+    qd_buffer_insert(buf, size);
+    DEQ_INSERT_TAIL(content->buffers, buf);
+
+    char *error = 0;
+    qd_iterator_t *iter = qd_message_field_iterator(msg, QD_FIELD_TO);
+    if (!iter)
+        error = "Expected an iterator for the 'to' field";
+    else if (!qd_iterator_equal(iter, (unsigned char*) "test_addr_inline"))
+        error = "Mismatched 'to' field contents";
+    qd_iterator_free(iter);
+
+    // Freeing the message must leave the inline buffer out of the buffer pools
+    qd_message_free(msg);
+    return error;
+}
+
+
+static char* test_message_priority(void *context)
+{
+    pn_message_t *pn_msg = pn_message();
+    pn_message_set_address(pn_msg, "test_addr_priority");
+    pn_message_set_priority(pn_msg, 7);
+
+    size_t size = 10000;
+    int result = pn_message_encode(pn_msg, buffer, &size);
+    pn_message_free(pn_msg);
+    if (result != 0) return "Error in pn_message_encode";
+
+    qd_message_t *msg = qd_message();
+    set_content(MSG_CONTENT(msg), size);
+
+    char *error = 0;
+    if (qd_message_priority(msg) != 7)
+        error = "Expected priority 7 from the header";
+    else if (qd_message_priority(msg) != 7)
+        error = "Expected the cached priority to be 7";
+    qd_message_free(msg);
+    if (error)
+        return error;
+
+    pn_msg = pn_message();
+    pn_message_set_address(pn_msg, "test_addr_priority");
+    pn_message_set_durable(pn_msg, false);
+    size   = 10000;
+    result = pn_message_encode(pn_msg, buffer, &size);
+    pn_message_free(pn_msg);
+    if (result != 0) return "Error in pn_message_encode";
+
+    msg = qd_message();
+    set_content(MSG_CONTENT(msg), size);
+    if (qd_message_priority(msg) != QD_MESSAGE_DEFAULT_PRIORITY)
+        error = "Expected the default priority without a header priority";
+    qd_message_free(msg);
+    return error;
+}
+
+
 int message_tests(void)
 {
     int result = 0;
@@ -321,6 +445,9 @@ int message_tests(void)
     TEST_CASE(test_message_properties, 0);
     TEST_CASE(test_check_multiple, 0);
     TEST_CASE(test_send_message_annotations, 0);
+    TEST_CASE(test_check_depth_incomplete, 0);
+    TEST_CASE(test_inline_buffer, 0);
+    TEST_CASE(test_message_priority, 0);
 
     return result;
 }
@@ -51,3 +51,9 @@ class IoAdapter:
 
   def send(self, address, properties, application_properties, body, correlation_id=None):
     print "IO: send(addr=%s properties=%r application_properties=%r body=%r" % (address, properties, application_properties, body)
+
+  def absorbed(self):
+    return []
+
+  def clear_absorbed(self):
+    pass
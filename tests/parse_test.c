@@ -214,6 +214,110 @@ static char *test_map(void *context)
 }
 
 
+static char *test_map_key_index(void *context)
+{
+    static char error[1000];
+    // map32 of 20 "kNN":NN entries followed by a duplicate "k05":99
+    unsigned char data[9 + 21 * 7];
+    unsigned char *cursor = data + 9;
+    for (int i = 0; i < 21; i++) {
+        int n = i < 20 ? i : 5;
+        *cursor++ = 0xa3;
+        *cursor++ = 3;
+        *cursor++ = 'k';
+        *cursor++ = '0' + n / 10;
+        *cursor++ = '0' + n % 10;
+        *cursor++ = 0x52;
+        *cursor++ = i < 20 ? i : 99;
+    }
+    uint32_t size = sizeof(data) - 5;
+    data[0] = 0xd1;
+    data[1] = size >> 24;
+    data[2] = size >> 16;
+    data[3] = size >> 8;
+    data[4] = size;
+    data[5] = data[6] = data[7] = 0;
+    data[8] = 42;
+
+    qd_iterator_t     *data_iter = qd_iterator_binary((const char*) data, sizeof(data), ITER_VIEW_ALL);
+    qd_parsed_field_t *field     = qd_parse(data_iter);
+    char              *result    = 0;
+
+    if (!qd_parse_ok(field)) {
+        snprintf(error, 1000, "Parse failed: %s", qd_parse_error(field));
+        result = error;
+    }
+
+    for (int i = 19; !result && i >= 0; i--) {
+        char key[4];
+        snprintf(key, sizeof(key), "k%02d", i);
+        qd_parsed_field_t *value = qd_parse_value_by_key(field, key);
+        if (!value || qd_parse_as_uint(value) != i) {
+            snprintf(error, 1000, "Lookup of '%s' failed", key);
+            result = error;
+        } else if (qd_parse_as_uint(qd_parse_sub_value(field, i)) != i ||
+                   !qd_iterator_equal(qd_parse_raw(qd_parse_sub_key(field, i)), (unsigned char*) key)) {
+            snprintf(error, 1000, "Entry %d is not '%s'", i, key);
+            result = error;
+        }
+    }
+
+    if (!result && (qd_parse_value_by_key(field, "k20") || qd_parse_value_by_key(field, "k0")))
+        result = "Lookup of an absent key succeeded";
+    if (!result && (qd_parse_sub_key(field, 21) || qd_parse_sub_value(field, 21)))
+        result = "Entry past the end of the map returned";
+
+    qd_iterator_free(data_iter);
+    qd_parse_free(field);
+    return result;
+}
+
+
+static char *test_parse_arena(void *context)
+{
+    const char *data =
+        "\xd1\x00\x00\x00\x2d\x00\x00\x00\x06"    // map32, 6 items
+        "\xa3\x05\x66irst\xa1\x0evalue_of_first"  // (23) "first":"value_of_first"
+        "\xa3\x06second\x52\x20"                  // (10) "second":32
+        "\xa3\x05third\x41";                      // (8)  "third":true
+    int   data_len = 50;
+    char *result   = 0;
+
+    qd_iterator_t     *data_iter = qd_iterator_binary(data, data_len, ITER_VIEW_ALL);
+    qd_parsed_field_t *field     = qd_parse_arena(data_iter);
+    qd_parsed_field_t *dup       = qd_parse_dup(field);
+
+    if (!qd_parse_ok(field) || !qd_parse_is_map(field) || qd_parse_sub_count(field) != 3)
+        result = "Arena parse of a map failed";
+    else if (!qd_parse_value_by_key(field, "second") || qd_parse_as_uint(qd_parse_value_by_key(field, "second")) != 32)
+        result = "Arena lookup of 'second' failed";
+    else if (!qd_iterator_equal(qd_parse_raw(qd_parse_sub_value(field, 0)), (unsigned char*) "value_of_first") ||
+             !qd_iterator_equal(qd_parse_typed(qd_parse_sub_key(field, 2)), (unsigned char*) "\xa3\x05third"))
+        result = "Arena entries have the wrong content";
+    else if (!qd_parse_as_bool(qd_parse_value_by_key(dup, "third")))
+        result = "Duplicate of an unparsed arena map is wrong";
+    qd_parse_free(dup);
+
+    dup = qd_parse_dup(field);
+    if (!result && !qd_iterator_equal(qd_parse_raw(qd_parse_sub_key(dup, 0)), (unsigned char*) "first"))
+        result = "Duplicate of a parsed arena map is wrong";
+    qd_parse_free(dup);
+    qd_parse_free(field);
+    qd_iterator_free(data_iter);
+    if (result)
+        return result;
+
+    // An error in a nested field is found up front
+    data_iter = qd_iterator_binary("\xc0\x02\x02\x41", 4, ITER_VIEW_ALL);
+    field     = qd_parse_arena(data_iter);
+    if (qd_parse_ok(field))
+        result = "Arena parse of a list missing an element succeeded";
+    qd_parse_free(field);
+    qd_iterator_free(data_iter);
+    return result;
+}
+
+
 struct err_vector_t {
     const char *data;
     int         length;
@@ -285,6 +389,7 @@ static char *test_tracemask(void *context)
     qd_compose_insert_string(comp, "0/Router.A");
     qd_compose_insert_string(comp, "0/Router.D");
     qd_compose_insert_string(comp, "0/Router.E");
+    qd_compose_insert_string(comp, "0/ROUTER");
     qd_compose_end_list(comp);
 
     DEQ_INIT(list);
@@ -302,7 +407,16 @@ static char *test_tracemask(void *context)
     qd_parsed_field_t *pf   = qd_parse(iter);
     qd_iterator_free(iter);
 
-    bm = qd_tracemask_create(tm, pf);
+    bool looped = false;
+    bm = qd_tracemask_create(tm, pf, &looped);
+    if (looped)
+        return "Loop detected before the tracemask knew this router";
+    qd_bitmask_free(bm);
+
+    qd_tracemask_set_self(tm, "0/ROUTER");
+    bm = qd_tracemask_create(tm, pf, &looped);
+    if (!looped)
+        return "This router in the trace was not detected";
     if (qd_bitmask_cardinality(bm) != 3) {
         sprintf(error, "Expected cardinality of 3, got %d", qd_bitmask_cardinality(bm));
         return error;
@@ -321,7 +435,7 @@ static char *test_tracemask(void *context)
     qd_tracemask_del_router(tm, 3);
     qd_tracemask_remove_link(tm, 0);
 
-    bm = qd_tracemask_create(tm, pf);
+    bm = qd_tracemask_create(tm, pf, 0);
     qd_parse_free(pf);
     if (qd_bitmask_cardinality(bm) != 1) {
         sprintf(error, "Expected cardinality of 1, got %d", qd_bitmask_cardinality(bm));
@@ -354,6 +468,8 @@ int parse_tests()
 
     TEST_CASE(test_parser_fixed_scalars, 0);
     TEST_CASE(test_map, 0);
+    TEST_CASE(test_map_key_index, 0);
+    TEST_CASE(test_parse_arena, 0);
     TEST_CASE(test_parser_errors, 0);
     TEST_CASE(test_tracemask, 0);
 
@@ -0,0 +1,129 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "test_case.h"
+#include <qpid/dispatch.h>
+#include <qpid/dispatch/parse_tree.h>
+
+
+static const char *match(qd_parse_tree_t *tree, const char *address)
+{
+    void          *payload;
+    qd_iterator_t *iter = qd_iterator_string(address, ITER_VIEW_ALL);
+    qd_parse_tree_retrieve_match(tree, iter, &payload);
+    qd_iterator_free(iter);
+    return (const char*) payload;
+}
+
+
+static char *test_parse_tree_match(void *context)
+{
+    static char error[200];
+    const char *patterns[] = {"a.b.c", "a.*.c", "a.#", "#.z", "*.b.*", "x/y/#", "x/#/y/#", 0};
+    struct { const char *address; const char *pattern; } cases[] = {
+        {"a.b.c",      "a.b.c"},    // literal beats wildcards
+        {"a.q.c",      "a.*.c"},    // '*' beats '#'
+        {"a",          "a.#"},      // '#' matches zero tokens
+        {"a.b.c.d",    "a.#"},
+        {"q.b.r",      "*.b.*"},
+        {"q.b",        0},
+        {"q.r.s.z",    "#.z"},
+        {"z",          "#.z"},
+        {"x/y",        "x/y/#"},
+        {"x/q/y/r",    "x/#/y/#"},
+        {"x.y.z",      "x/y/#"},    // the separators are interchangeable
+        {"nothing",    0},
+        {0, 0}};
+
+    qd_parse_tree_t *tree = qd_parse_tree();
+    for (int i = 0; patterns[i]; i++)
+        if (qd_parse_tree_add_pattern(tree, patterns[i], (void*) patterns[i]) != QD_ERROR_NONE)
+            return "Failed to add a pattern";
+
+    if (qd_parse_tree_add_pattern(tree, "a.#.#", "dup") != QD_ERROR_ALREADY_EXISTS)
+        return "Duplicate (normalized) pattern was accepted";
+
+    for (int i = 0; cases[i].address; i++) {
+        const char *got = match(tree, cases[i].address);
+        if ((got == 0) != (cases[i].pattern == 0) || (got && strcmp(got, cases[i].pattern) != 0)) {
+            snprintf(error, 200, "Address '%s': expected %s, got %s",
+                     cases[i].address, cases[i].pattern ? cases[i].pattern : "none", got ? got : "none");
+            qd_parse_tree_free(tree);
+            return error;
+        }
+    }
+
+    qd_parse_tree_free(tree);
+    return 0;
+}
+
+
+static char *test_parse_tree_remove(void *context)
+{
+    qd_parse_tree_t *tree = qd_parse_tree();
+    qd_parse_tree_add_pattern(tree, "a.b.#", "first");
+    qd_parse_tree_add_pattern(tree, "a.*.c", "second");
+
+    if (qd_parse_tree_get_pattern(tree, "a.b.#") == 0 || qd_parse_tree_get_pattern(tree, "a.b") != 0)
+        return "Exact pattern lookup failed";
+
+    if (strcmp(match(tree, "a.b.c"), "first") != 0)
+        return "Expected the literal-first pattern to match";
+
+    if (strcmp((char*) qd_parse_tree_remove_pattern(tree, "a.b.#"), "first") != 0)
+        return "Remove returned the wrong payload";
+
+    if (qd_parse_tree_remove_pattern(tree, "a.b.#") != 0)
+        return "Removed a pattern twice";
+
+    if (strcmp(match(tree, "a.b.c"), "second") != 0 || match(tree, "a.b.d") != 0)
+        return "Match after remove failed";
+
+    qd_parse_tree_remove_pattern(tree, "a.*.c");
+    if (qd_parse_tree_size(tree) != 0 || match(tree, "a.x.c") != 0)
+        return "Tree not empty after removing every pattern";
+
+    qd_parse_tree_free(tree);
+    return 0;
+}
+
+
+static char *test_parse_tree_is_pattern(void *context)
+{
+    if (!qd_parse_tree_is_pattern("a.*.b") || !qd_parse_tree_is_pattern("#") || !qd_parse_tree_is_pattern("a/#"))
+        return "Wildcard text not recognized as a pattern";
+    if (qd_parse_tree_is_pattern("a.b*") || qd_parse_tree_is_pattern("#a.b") || qd_parse_tree_is_pattern("a.b"))
+        return "Literal text recognized as a pattern";
+    return 0;
+}
+
+
+int parse_tree_tests(void)
+{
+    int result = 0;
+    char *test_group = "parse_tree_tests";
+
+    TEST_CASE(test_parse_tree_match, 0);
+    TEST_CASE(test_parse_tree_remove, 0);
+    TEST_CASE(test_parse_tree_is_pattern, 0);
+
+    return result;
+}
@@ -0,0 +1,296 @@
+#!/usr/bin/env python
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+"""Throughput and latency benchmarks over router topologies.
+
+Starts the topology of each profile in profiles.json, sends the profile's
+messages through it and reports msg/s and p50/p99/p999 latency as JSON.
+Senders attach to the first router of the topology and receivers to the last.
+Receivers run in a separate process so they do not compete with the sender for
+the python interpreter.  Run it from the build directory so it finds the router:
+
+    python run.py -s <source>/tests/perf/run_perf.py [profile ...]
+"""
+
+import sys, os, json, time, optparse, multiprocessing, Queue
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir))
+
+from proton import Message
+from proton.handlers import MessagingHandler
+from proton.reactor import Container, AtMostOnce
+from system_test import Tester, Qdrouterd, retry, TIMEOUT
+
+DIR = os.path.dirname(os.path.abspath(__file__))
+
+LINK_ROUTE_PREFIX = "perf.lr"
+
+# Receivers give up when no message has arrived for this many seconds, presettled messages may be dropped.
+IDLE_TIMEOUT = 5
+
+
+def address(profile):
+    if profile["linkRoute"]: return LINK_ROUTE_PREFIX + ".queue"
+    if profile["fanout"] > 1: return "multicast/perf"
+    return "perf/anycast"
+
+
+class Receivers(MessagingHandler):
+    """Receive on 'fanout' links from the last router, or accept the links routed to
+    this container when the profile is link routed."""
+
+    def __init__(self, url, profile, expected, timeout):
+        super(Receivers, self).__init__(prefetch=profile["window"])
+        self.url = url
+        self.profile = profile
+        self.expected = expected
+        self.deadline = time.time() + timeout
+        self.latencies = []
+        self.last = None
+        self.connections = []
+        self.acceptor = None
+
+    def on_start(self, event):
+        if self.profile["linkRoute"]:
+            self.acceptor = event.container.listen(self.url)
+        else:
+            connection = event.container.connect(self.url)
+            self.connections.append(connection)
+            for i in xrange(self.profile["fanout"]):
+                event.container.create_receiver(connection, address(self.profile), name="perf-%s" % i)
+        event.container.schedule(1, self)
+
+    def on_connection_opened(self, event):
+        if event.connection not in self.connections:
+            self.connections.append(event.connection)
+
+    def on_message(self, event):
+        self.last = time.time()
+        self.latencies.append(self.last - event.message.properties["sent"])
+        if len(self.latencies) >= self.expected:
+            self.stop()
+
+    def on_timer_task(self, event):
+        now = time.time()
+        if now > self.deadline or (self.last and now - self.last > IDLE_TIMEOUT):
+            self.stop()
+        else:
+            event.container.schedule(1, self)
+
+    def stop(self):
+        for connection in self.connections:
+            connection.close()
+        self.connections = []
+        if self.acceptor:
+            self.acceptor.close()
+            self.acceptor = None
+
+
+def receive(url, profile, expected, timeout, results):
+    """Process entry point: receive, then post (latencies, last receive time)"""
+    receivers = Receivers(url, profile, expected, timeout)
+    Container(receivers).run()
+    results.put((receivers.latencies, receivers.last))
+
+
+class Sender(MessagingHandler):
+    """Send the profile's messages, keeping at most 'window' unsettled"""
+
+    def __init__(self, url, profile):
+        super(Sender, self).__init__(prefetch=0)
+        self.url = url
+        self.profile = profile
+        self.presettled = profile["settlement"] == "presettled"
+        self.body = "x" * profile["size"]
+        self.sent = 0
+        self.settled = 0
+        self.released = 0
+
+    def on_start(self, event):
+        self.connection = event.container.connect(self.url)
+        self.sender = event.container.create_sender(
+            self.connection, address(self.profile), options=AtMostOnce() if self.presettled else None)
+
+    def on_sendable(self, event):
+        self.send()
+
+    def send(self):
+        total = self.profile["messages"]
+        while self.sender.credit and self.sent < total and \
+              (self.presettled or self.sent - self.settled < self.profile["window"]):
+            self.sender.send(Message(body=self.body, properties={"sent": time.time()}))
+            self.sent += 1
+        if self.presettled and self.sent == total:
+            self.connection.close()
+
+    def on_released(self, event):
+        self.released += 1
+
+    def on_rejected(self, event):
+        self.released += 1
+
+    def on_settled(self, event):
+        self.settled += 1
+        if self.settled == self.profile["messages"]:
+            self.connection.close()
+        else:
+            self.send()
+
+
+def start_routers(tester, topology, profile, container_port):
+    """Start the routers of a topology and wait till they are listening"""
+    names = topology["routers"]
+    interior = len(names) > 1
+    inter_router_ports = dict((name, tester.get_port()) for name in names)
+    routers = []
+    for name in names:
+        config = [
+            ('router', {'mode': 'interior' if interior else 'standalone', 'id': 'perf.%s' % name}),
+            ('listener', {'port': tester.get_port(), 'linkCapacity': profile["window"]}),
+            ('address', {'prefix': 'multicast', 'distribution': 'multicast'}),
+            # Logging at trace level would dominate the measurement
+            ('log', {'module': 'DEFAULT', 'enable': 'notice+', 'output': 'perf.%s.log' % name})
+        ]
+        if interior:
+            config.append(('listener', {'role': 'inter-router', 'port': inter_router_ports[name]}))
+        config += [('connector', {'role': 'inter-router', 'port': inter_router_ports[b]})
+                   for a, b in topology["links"] if a == name]
+        if profile["linkRoute"]:
+            if name == names[-1]:
+                config.append(('connector', {'name': 'perf-container', 'role': 'route-container',
+                                             'port': container_port}))
+                config += [('linkRoute', {'prefix': LINK_ROUTE_PREFIX, 'connection': 'perf-container', 'dir': d})
+                           for d in ('in', 'out')]
+            else:
+                config += [('linkRoute', {'prefix': LINK_ROUTE_PREFIX, 'dir': d}) for d in ('in', 'out')]
+        routers.append(tester.qdrouterd('perf.%s' % name, Qdrouterd.Config(config), wait=False))
+    for router in routers:
+        router.wait_ports()
+    return routers
+
+
+def wait_address(router, profile, local):
+    """Wait till the sender's router can route the profile's address to every receiver"""
+    needed = profile["fanout"] if local and not profile["linkRoute"] else 1
+    def check():
+        entities = router.management.query(
+            type='org.apache.qpid.dispatch.router.address',
+            attribute_names=[u'name', u'subscriberCount', u'remoteCount', u'containerCount']).get_entities()
+        prefix = LINK_ROUTE_PREFIX if profile["linkRoute"] else address(profile)
+        return [e for e in entities if e['name'].endswith(prefix) and
+                e['subscriberCount'] + e['remoteCount'] + e['containerCount'] >= needed]
+    assert retry(check), "Address %s not reachable from %s" % (address(profile), router.name)
+
+
+def percentile(ordered, fraction):
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def run_profile(profile, topology, timeout):
+    tester = Tester("run_perf.%s.routers" % profile["name"])
+    tester.rmtree()
+    tester.setup()
+    try:
+        container_port = tester.get_port()
+        routers = start_routers(tester, topology, profile, container_port)
+        first, last = routers[0], routers[-1]
+
+        copies = 1 if profile["linkRoute"] else profile["fanout"]     # Deliveries per message sent
+        expected = profile["messages"] * copies
+        url = "127.0.0.1:%s" % container_port if profile["linkRoute"] else last.addresses[0]
+        results = multiprocessing.Queue()
+        receiver = multiprocessing.Process(target=receive, args=(url, profile, expected, timeout, results))
+        receiver.daemon = True
+        receiver.start()
+
+        for router in routers:
+            router.wait_connectors()
+        for router in routers[1:]:
+            first.wait_router_connected(router.config.router_id)
+        wait_address(first, profile, first is last)
+
+        sender = Sender(first.addresses[0], profile)
+        start = time.time()
+        Container(sender).run()
+        try:
+            latencies, last_receive = results.get(timeout=timeout)
+        except Queue.Empty:
+            raise Exception("Receivers did not finish within %s seconds" % timeout)
+        receiver.join()
+    finally:
+        tester.teardown()
+
+    result = dict((k, profile[k]) for k in ("name", "topology", "size", "settlement", "fanout", "linkRoute"))
+    result.update({"sent": sender.sent, "released": sender.released, "received": len(latencies)})
+    if latencies:
+        elapsed = last_receive - start
+        ordered = sorted(latencies)
+        result["msgPerSec"] = round(len(latencies) / float(copies) / elapsed, 1)
+        result["latencyMs"] = dict((name, round(percentile(ordered, fraction) * 1000, 3))
+                                   for name, fraction in (("p50", .5), ("p99", .99), ("p999", .999)))
+    return result
+
+
+def main():
+    parser = optparse.OptionParser(usage="%prog [options] [profile ...]", description=__doc__)
+    parser.add_option("-f", "--profiles", default=os.path.join(DIR, "profiles.json"),
+                      help="Profile file (default %default)")
+    parser.add_option("-o", "--output", help="Write the JSON results to this file instead of stdout")
+    parser.add_option("-m", "--messages", type="int", help="Override the message count of every profile")
+    parser.add_option("-t", "--timeout", type="float", default=max(TIMEOUT, 600),
+                      help="Seconds allowed for each profile (default %default)")
+    parser.add_option("-l", "--list", action="store_true", help="List the profiles and exit")
+    opts, names = parser.parse_args()
+
+    with open(opts.profiles) as f:
+        config = json.load(f)
+    profiles = []
+    for p in config["profiles"]:
+        profile = dict(config["defaults"])
+        profile.update(p)
+        if opts.messages: profile["messages"] = opts.messages
+        if profile["fanout"] > 1 and profile["settlement"] != "presettled":
+            parser.error("profile %s: the router only multicasts presettled messages" % profile["name"])
+        profiles.append(profile)
+    if opts.list:
+        for p in profiles: print p["name"]
+        return 0
+    unknown = set(names) - set(p["name"] for p in profiles)
+    if unknown:
+        parser.error("unknown profiles: %s" % ", ".join(sorted(unknown)))
+
+    results = []
+    for profile in profiles:
+        if names and profile["name"] not in names: continue
+        result = run_profile(profile, config["topologies"][profile["topology"]], opts.timeout)
+        results.append(result)
+        latency = result.get("latencyMs", {})
+        print >>sys.stderr, "%-32s %10s msg/s  p50 %s  p99 %s  p999 %s  (ms)" % (
+            result["name"], result.get("msgPerSec"), latency.get("p50"), latency.get("p99"), latency.get("p999"))
+
+    output = json.dumps({"results": results}, indent=4, sort_keys=True)
+    if opts.output:
+        with open(opts.output, "w") as f: f.write(output + "\n")
+    else:
+        print output
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
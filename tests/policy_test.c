@@ -78,12 +78,164 @@ static char *test_link_name_lookup(void *context)
     return 0;
 }
 
+static char *test_link_name_trie(void *context)
+{
+    char *result = 0;
+    qd_policy_name_trie_t *trie = qd_policy_name_trie(",joe,,temp-*,${user}-q,");
+
+    // An exact name is not a prefix
+    if (qd_policy_name_trie_match(trie, "", "jo"))
+        result = "proposed link 'jo' should not match allowed link 'joe' but does";
+    else if (!qd_policy_name_trie_match(trie, "", "joe"))
+        result = "proposed link 'joe' should match allowed link 'joe' but does not";
+    else if (!qd_policy_name_trie_match(trie, "", "temp-") || !qd_policy_name_trie_match(trie, "", "temp-1"))
+        result = "proposed link 'temp-1' should match allowed link 'temp-*' but does not";
+    else if (qd_policy_name_trie_match(trie, "", "temp"))
+        result = "proposed link 'temp' should not match allowed link 'temp-*' but does";
+    else if (!qd_policy_name_trie_match(trie, "chuck", "chuck-q"))
+        result = "proposed link 'chuck-q' should match allowed link '${user}-q' but does not";
+    else if (qd_policy_name_trie_match(trie, "chuck", "joe-q") || qd_policy_name_trie_match(trie, 0, "chuck-q"))
+        result = "proposed link should not match allowed link '${user}-q' for another user but does";
+    qd_policy_name_trie_decref(trie);
+    if (result)
+        return result;
+
+    trie = qd_policy_name_trie(0);
+    if (qd_policy_name_trie_match(trie, "", ""))
+        result = "empty allowed list matched";
+    qd_policy_name_trie_decref(trie);
+    return result;
+}
+
+static char *test_host_tree(void *context)
+{
+    char *result = 0;
+    const unsigned char lo4[4] = {10, 0, 0, 5};
+    const unsigned char hi4[4] = {10, 0, 1, 2};
+    const unsigned char one4[4] = {192, 168, 1, 1};
+    unsigned char lo6[16] = {0x20, 0x01, 0x0d, 0xb8};
+    unsigned char hi6[16] = {0x20, 0x01, 0x0d, 0xb8};
+    hi6[15] = 0xff;
+    qd_policy_host_tree_t *tree = qd_policy_host_tree();
+
+    if (qd_policy_host_tree_add(tree, hi4, lo4, 4) || qd_policy_host_tree_add(tree, lo4, hi4, 5))
+        result = "invalid host range accepted";
+    else if (!qd_policy_host_tree_add(tree, lo4, hi4, 4) || !qd_policy_host_tree_add(tree, one4, one4, 4) ||
+             !qd_policy_host_tree_add(tree, lo6, hi6, 16))
+        result = "valid host range rejected";
+    else if (qd_policy_host_tree_match(tree, "10.0.0.4") || qd_policy_host_tree_match(tree, "10.0.1.3") ||
+             qd_policy_host_tree_match(tree, "192.168.1.2") || qd_policy_host_tree_match(tree, "2001:db8::1:0"))
+        result = "host outside the ranges matched";
+    else if (!qd_policy_host_tree_match(tree, "10.0.0.5") || !qd_policy_host_tree_match(tree, "10.0.0.200") ||
+             !qd_policy_host_tree_match(tree, "10.0.1.2") || !qd_policy_host_tree_match(tree, "192.168.1.1") ||
+             !qd_policy_host_tree_match(tree, "2001:db8::ff"))
+        result = "host inside the ranges did not match";
+    else if (qd_policy_host_tree_match(tree, "localhost") || qd_policy_host_tree_match(tree, 0))
+        result = "non-numeric host matched";
+    else if (!qd_policy_host_tree_add(tree, 0, 0, 0) || !qd_policy_host_tree_match(tree, "172.16.0.1"))
+        result = "wildcard did not match";
+    qd_policy_host_tree_free(tree);
+    return result;
+}
+
+static char *test_lookup_cache(void *context)
+{
+    qd_policy_t *policy = qd_policy(0);
+    long counts = qd_policy_c_counts_alloc();
+    qd_policy_denial_counts_t *dc = (qd_policy_denial_counts_t*) counts;
+    qd_policy_settings_t approved = {0};
+    approved.maxSessions  = 3;
+    approved.sources      = "src";
+    approved.targets      = "tgt";
+    approved.sourcesTrie  = qd_policy_name_trie(approved.sources);
+    approved.denialCounts = dc;
+    char name[64];
+    qd_policy_settings_t settings;
+    char *result = 0;
+
+    // Not cached until python has set the usergroup's host tree
+    qd_policy_c_counts_limits(counts, 2, 2, 2);
+    qd_policy_cache_insert(policy, "joe", "10.0.0.1", "vhost", "group", &approved);
+    if (qd_policy_cache_open(policy, "joe", "10.0.0.1", "vhost", "c1", 1, name, sizeof(name), &settings)) {
+        result = "lookup without a host tree was cached";
+        goto done;
+    }
+    const unsigned char host[4] = {10, 0, 0, 1};
+    qd_policy_host_tree_t *tree = qd_policy_host_tree();
+    qd_policy_host_tree_add(tree, host, host, 4);
+    qd_policy_set_host_tree(policy, counts, "group", tree);
+
+    // Not cached while a per-user limit could bind before the vhost limit
+    qd_policy_c_counts_limits(counts, 2, 1, 2);
+    qd_policy_cache_insert(policy, "joe", "10.0.0.1", "vhost", "group", &approved);
+    if (qd_policy_cache_open(policy, "joe", "10.0.0.1", "vhost", "c1", 1, name, sizeof(name), &settings)) {
+        result = "lookup with a binding per-user limit was cached";
+        goto done;
+    }
+
+    qd_policy_c_counts_limits(counts, 2, 2, 2);
+    qd_policy_cache_insert(policy, "joe", "10.0.0.1", "vhost", "group", &approved);
+    if (qd_policy_cache_open(policy, "joe", "10.0.0.2", "vhost", "c1", 1, name, sizeof(name), &settings) ||
+        qd_policy_cache_open(policy, "jo", "e10.0.0.1", "vhost", "c1", 1, name, sizeof(name), &settings)) {
+        result = "cache hit for a different user or host";
+        goto done;
+    }
+    memset(&settings, 0, sizeof(settings));
+    if (!qd_policy_cache_open(policy, "joe", "10.0.0.1", "vhost", "c1", 1, name, sizeof(name), &settings)) {
+        result = "cached lookup missed";
+        goto done;
+    }
+    bool same = strcmp(name, "group") == 0 && settings.maxSessions == 3 && settings.denialCounts == dc &&
+        strcmp(settings.sources, "src") == 0 && settings.sources != approved.sources &&
+        settings.sourcesTrie == approved.sourcesTrie;
+    free(settings.sources);
+    free(settings.targets);
+    qd_policy_name_trie_decref(settings.sourcesTrie);
+    if (!same) {
+        result = "cache hit returned the wrong settings";
+        goto done;
+    }
+    if (dc->connectionsCurrent != 1) {
+        result = "cache hit was not counted";
+        goto done;
+    }
+
+    // The vhost limit is left to python
+    dc->connectionsCurrent = 2;
+    if (qd_policy_cache_open(policy, "joe", "10.0.0.1", "vhost", "c2", 2, name, sizeof(name), &settings)) {
+        result = "cache hit over the vhost connection limit";
+        goto done;
+    }
+    dc->connectionsCurrent = 0;
+
+    qd_policy_cache_clear(policy);
+    if (qd_policy_cache_open(policy, "joe", "10.0.0.1", "vhost", "c3", 3, name, sizeof(name), &settings)) {
+        result = "cache hit after clear";
+        goto done;
+    }
+
+    qd_policy_cache_insert(policy, "joe", "10.0.0.1", "vhost", "group", &approved);
+    qd_policy_clear_host_trees(policy, counts);
+    if (qd_policy_cache_open(policy, "joe", "10.0.0.1", "vhost", "c4", 4, name, sizeof(name), &settings))
+        result = "cache hit after the host trees were cleared";
+
+ done:
+    qd_policy_free(policy);
+    qd_policy_name_trie_decref(approved.sourcesTrie);
+    qd_policy_c_counts_free(counts);
+    return result;
+}
+
+
 int policy_tests(void)
 {
     int result = 0;
     char *test_group = "policy_tests";
 
     TEST_CASE(test_link_name_lookup, 0);
+    TEST_CASE(test_link_name_trie, 0);
+    TEST_CASE(test_host_tree, 0);
+    TEST_CASE(test_lookup_cache, 0);
 
     return result;
 }
@@ -19,13 +19,16 @@
 
 import os
 import sys
+import tempfile
 import unittest
 import mock                     # Mock definitions for tests.
 
 sys.path.append(os.path.join(os.environ["SOURCE_DIR"], "python"))
 
-from qpid_dispatch_internal.router.engine import HelloProtocol, PathEngine, NodeTracker
-from qpid_dispatch_internal.router.data import LinkState, MessageHELLO, ProtocolVersion
+from qpid_dispatch_internal.router.engine import HelloProtocol, PathEngine, NodeTracker, MobileAddressEngine
+from qpid_dispatch_internal.router.node import RouterNode
+from qpid_dispatch_internal.router.snapshot import TopologySnapshot
+from qpid_dispatch_internal.router.data import LinkState, MessageHELLO, MessageMAU, MessageMAR, ProtocolVersion
 from qpid_dispatch.management.entity import EntityBase
 from system_test import main_module
 
@@ -643,6 +646,254 @@ class PathTest(unittest.TestCase):
         self.assertEqual(r1_next_hops['R6'], 'R2')
         self.assertEqual(r3_valid_origins['R6'], [])
 
+    def test_equal_cost_paths(self):
+        """
+
+        +====+      +----+
+        | R1 |------| R2 |
+        +====+      +----+
+           |           |
+        +----+      +----+      +----+
+        | R3 |------| R4 |------| R5 |
+        +----+      +----+      +----+
+
+        """
+        collection = { 'R1': LinkState(None, 'R1', 1, {'R2':1, 'R3':1}),
+                       'R2': LinkState(None, 'R2', 1, {'R1':1, 'R4':1}),
+                       'R3': LinkState(None, 'R3', 1, {'R1':1, 'R4':1}),
+                       'R4': LinkState(None, 'R4', 1, {'R2':1, 'R3':1, 'R5':1}),
+                       'R5': LinkState(None, 'R5', 1, {'R4':1}) }
+        next_hops, valid_origins = self.engine.calculate_equal_cost_routes(collection)
+        self.assertEqual(next_hops['R2'], ['R2'])
+        self.assertEqual(next_hops['R3'], ['R3'])
+        self.assertEqual(next_hops['R4'], ['R2', 'R3'])
+        self.assertEqual(next_hops['R5'], ['R2', 'R3'])
+
+        ##
+        ## R1 is on one of R3's two lowest-cost paths to R2 and vice versa
+        ##
+        self.assertEqual(valid_origins['R2'], ['R3'])
+        self.assertEqual(valid_origins['R3'], ['R2'])
+        self.assertEqual(valid_origins['R4'], [])
+        self.assertEqual(valid_origins['R5'], [])
+
+        ##
+        ## The single-path view still picks exactly one of the equal-cost hops
+        ##
+        single_hops, costs, single_origins = self.engine.calculate_routes(collection)
+        self.assertTrue(single_hops['R5'] in next_hops['R5'])
+
+class MobileTest(unittest.TestCase):
+    """
+    Two mobile-address engines, R1 and R2, where R2 tracks R1's addresses in a RouterNode.
+    Messages sent by R1 are passed through their encoded form.
+    """
+    class RouterAdapter(object):
+        def __init__(self):
+            self.mapped = set()
+            self.calls  = 0
+        def add_router(self, address, maskbit):
+            pass
+        def get_agent(self):
+            return self
+        def add_implementation(self, impl, entity_type):
+            pass
+        def map_destination(self, addr, maskbit):
+            self.map_destinations([addr], maskbit)
+        def unmap_destination(self, addr, maskbit):
+            self.unmap_destinations([addr], maskbit)
+        def map_destinations(self, addrs, maskbit):
+            self.calls += 1
+            self.mapped.update(addrs)
+        def unmap_destinations(self, addrs, maskbit):
+            self.calls += 1
+            self.mapped.difference_update(addrs)
+
+    class Container(object):
+        def __init__(self, id):
+            self.id   = id
+            self.sent = []
+        def send(self, dest, msg):
+            self.sent.append(MessageMAU(msg.to_dict()))
+        def log(self, level, text):
+            pass
+        def log_ma(self, level, text):
+            pass
+
+    def setUp(self):
+        self.id             = 'R2'
+        self.container      = self
+        self.router_adapter = self.RouterAdapter()
+        self.r1             = self.Container('R1')
+        self.engine1        = MobileAddressEngine(self.r1, None)
+        self.engine2        = MobileAddressEngine(self.Container('R2'), self)
+        self.node           = RouterNode(self, 'R1', ProtocolVersion, 1)
+
+    def log(self, level, text):
+        pass
+
+    def _allocate_maskbit(self):
+        return 1
+
+    def router_node(self, node_id):
+        return self.node
+
+    def deliver(self):
+        for msg in self.r1.sent:
+            self.engine2.handle_mau(msg, 0)
+        self.r1.sent = []
+
+    def test_large_delta_split(self):
+        for i in range(2500):
+            self.engine1.add_local_address('M0addr%d' % i)
+        self.engine1.tick(0)
+        self.assertEqual([len(m.add_list) for m in self.r1.sent], [1000, 1000, 500])
+        self.deliver()
+        self.assertEqual(self.router_adapter.mapped, self.engine1.local_addrs)
+        self.assertEqual(self.node.mobile_address_sequence, 3)
+        self.assertEqual(self.router_adapter.calls, 3)
+
+    def test_merged_catch_up(self):
+        self.engine1.add_local_address('M0a')
+        self.engine1.tick(0)
+        self.deliver()
+        self.engine1.add_local_address('M0b')
+        self.engine1.tick(0)
+        self.engine1.del_local_address('M0b')
+        self.engine1.add_local_address('M0c')
+        self.engine1.tick(0)
+        self.r1.sent = []   # R2 missed the last two updates
+        self.engine1.handle_mar(MessageMAR(None, 'R2', self.node.mobile_address_sequence), 0)
+        self.assertEqual(len(self.r1.sent), 1)
+        self.assertEqual(self.r1.sent[0].base_seq, 1)
+        self.assertEqual(self.r1.sent[0].add_list, ['M0c'])
+        self.assertEqual(self.r1.sent[0].del_list, [])
+        self.deliver()
+        self.assertEqual(self.router_adapter.mapped, set(['M0a', 'M0c']))
+        self.assertEqual(self.node.mobile_address_sequence, 3)
+
+    def test_chunked_absolute(self):
+        for i in range(2500):
+            self.engine1.add_local_address('M0addr%d' % i)
+        self.engine1.tick(0)
+        self.engine1.sent_deltas = {}   # Force an absolute update
+        self.r1.sent = []
+        self.engine1.handle_mar(MessageMAR(None, 'R2', 0), 0)
+        self.assertEqual([m.chunk for m in self.r1.sent], [0, 1, 2])
+        self.deliver()
+        self.assertEqual(self.router_adapter.mapped, self.engine1.local_addrs)
+        self.assertEqual(self.node.mobile_address_sequence, 3)
+
+        ##
+        ## A missing part drops the update and asks for it again
+        ##
+        self.node.mobile_address_sequence = 0
+        self.engine1.handle_mar(MessageMAR(None, 'R2', 0), 0)
+        self.r1.sent.pop(1)
+        self.deliver()
+        self.assertEqual(self.node.mobile_address_sequence, 0)
+        self.assertTrue(self.node.need_mobile_request)
+
+    def test_old_peer_gets_whole_list(self):
+        for i in range(1500):
+            self.engine1.add_local_address('M0addr%d' % i)
+        self.engine1.tick(0)
+        self.engine1.sent_deltas = {}
+        self.r1.sent = []
+        mar = MessageMAR(None, 'R2', 0)
+        mar.version = 1
+        self.engine1.handle_mar(mar, 0)
+        self.assertEqual(len(self.r1.sent), 1)
+        self.assertEqual(self.r1.sent[0].chunks, None)
+        self.assertEqual(len(self.r1.sent[0].exist_list), 1500)
+
+
+class SnapshotTest(unittest.TestCase):
+    """
+    A topology snapshot written from one node tracker seeds another.
+    """
+    class Config(object):
+        helloMaxAge        = 3
+        remoteLsMaxAge     = 60
+        raIntervalFlux     = 4
+        equalCostMultipath = False
+
+    class Container(object):
+        def __init__(self, id):
+            self.id             = id
+            self.area           = '0'
+            self.config         = SnapshotTest.Config()
+            self.router_adapter = MobileTest.RouterAdapter()
+        def log(self, level, text):
+            pass
+
+    def setUp(self):
+        fd, self.filename = tempfile.mkstemp()
+        os.close(fd)
+        os.remove(self.filename)
+
+    def tearDown(self):
+        if os.path.exists(self.filename):
+            os.remove(self.filename)
+
+    def tracker(self, id='R1'):
+        container = self.Container(id)
+        return container, NodeTracker(container, 64)
+
+    def test_round_trip(self):
+        container, tracker = self.tracker()
+        tracker.seed_router('R2', ProtocolVersion, 7, 3, {'R1':1, 'R3':1}, 5, ['M0a', 'M0b'], 0)
+        tracker.seed_router('R3', ProtocolVersion, 8, 2, {'R2':1}, 0, [], 0)
+        TopologySnapshot(container, tracker, self.filename).save()
+
+        container, tracker = self.tracker()
+        TopologySnapshot(container, tracker, self.filename).load(100)
+        self.assertEqual(sorted(tracker.nodes.keys()), ['R2', 'R3'])
+        r2 = tracker.nodes['R2']
+        self.assertEqual(r2.instance, 7)
+        self.assertEqual(r2.link_state.ls_seq, 3)
+        self.assertEqual(r2.link_state.peers, {'R1':1, 'R3':1})
+        self.assertEqual(r2.link_state.last_seen, 100)
+        self.assertEqual(r2.mobile_address_sequence, 5)
+        self.assertEqual(container.router_adapter.mapped, set(['M0a', 'M0b']))
+        self.assertTrue(tracker.recompute_topology)
+
+    def test_other_router_ignored(self):
+        container, tracker = self.tracker()
+        tracker.seed_router('R2', ProtocolVersion, 7, 3, {'R1':1}, 0, [], 0)
+        TopologySnapshot(container, tracker, self.filename).save()
+
+        container, tracker = self.tracker('R9')
+        TopologySnapshot(container, tracker, self.filename).load(100)
+        self.assertEqual(tracker.nodes, {})
+
+
+class RaAbsorbTest(unittest.TestCase):
+    """
+    Only an RA that asks nothing of the receiving router may have its repeats absorbed.
+    """
+    class LinkStateEngine(object):
+        def __init__(self):
+            self.lsr = []
+        def send_lsr(self, _id):
+            self.lsr.append(_id)
+
+    def setUp(self):
+        self.container = SnapshotTest.Container('R1')
+        self.container.link_state_engine = self.LinkStateEngine()
+        self.tracker = NodeTracker(self.container, 64)
+        self.tracker.seed_router('R2', ProtocolVersion, 7, 3, {'R1':1}, 5, [], 0)
+
+    def test_current_ra(self):
+        self.assertTrue(self.tracker.ra_received('R2', ProtocolVersion, 3, 5, 7, 10))
+        self.assertEqual(self.tracker.nodes['R2'].link_state.last_seen, 10)
+        self.assertEqual(self.container.link_state_engine.lsr, [])
+
+    def test_newer_ra(self):
+        self.assertFalse(self.tracker.ra_received('R2', ProtocolVersion, 4, 5, 7, 10))
+        self.assertEqual(self.container.link_state_engine.lsr, ['R2'])
+        self.assertFalse(self.tracker.ra_received('R2', ProtocolVersion, 3, 5, 8, 10))
+
 
 if __name__ == '__main__':
     unittest.main(main_module())
@@ -95,6 +95,11 @@ class PolicyHostAddrTest(TestCase):
         self.check_hostaddr_match(aaa,"::1")
         self.check_hostaddr_match(aaa,"ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff")
 
+    def test_policy_hostaddr_c_range(self):
+        self.assertEqual(HostAddr("*").c_range(), None)
+        self.assertEqual(HostAddr("10.0.0.1").c_range(), ("\x0a\x00\x00\x01", "\x0a\x00\x00\x01"))
+        self.assertEqual(HostAddr("10.0.0.1,10.0.1.0").c_range(), ("\x0a\x00\x00\x01", "\x0a\x00\x01\x00"))
+
     def test_policy_malformed_hostaddr_ipv4(self):
         self.expect_deny( "0.0.0.0.0", "Name or service not known")
         self.expect_deny( "1.1.1.1,2.2.2.2,3.3.3.3", "arg count")
@@ -114,9 +119,19 @@ class QpidDispatch(object):
     def qd_dispatch_policy_c_counts_refresh(self, cstats, entitymap):
         pass
 
+    def qd_dispatch_policy_c_counts_limits(self, cstats, maxconn, maxconnperuser, maxconnperhost):
+        pass
+
+    def qd_dispatch_policy_set_hosts(self, dispatch, cstats, usergroup, ranges):
+        pass
+
+    def qd_dispatch_policy_clear_hosts(self, dispatch, cstats):
+        pass
+
 class MockAgent(object):
     def __init__(self):
         self.qd = QpidDispatch()
+        self.dispatch = None
 
     def add_implementation(self, entity, cfg_obj_name):
         pass
@@ -226,6 +241,29 @@ class PolicyFileApplicationFallback(TestCase):
         self.assertTrue(
             self.policy.lookup_user('zeke', '192.168.100.5', 'galleria', "connid", 5) == '')
 
+class PolicyRateLimits(TestCase):
+
+    def test_rate_limits_in_settings(self):
+        policy = PolicyLocal(MockPolicyManager())
+        policy.create_ruleset({"id": "rates", "maxMessageRate": 1000, "maxByteRate": 1000000,
+                               "groups": {"$default": {"remoteHosts": "*", "maxMessageRate": 10,
+                                                       "maxUserByteRate": 2000}}})
+        upolicy = {}
+        self.assertTrue(policy.lookup_settings('rates', '$default', upolicy))
+        self.assertEqual(upolicy['maxMessageRate'], 10)
+        self.assertEqual(upolicy['maxByteRate'], 0)
+        self.assertEqual(upolicy['maxUserMessageRate'], 0)
+        self.assertEqual(upolicy['maxUserByteRate'], 2000)
+        self.assertEqual(upolicy['vhostMaxMessageRate'], 1000)
+        self.assertEqual(upolicy['vhostMaxByteRate'], 1000000)
+
+    def test_negative_rate_limits_rejected(self):
+        policy = PolicyLocal(MockPolicyManager())
+        with self.assertRaises(PolicyError):
+            policy.create_ruleset({"id": "rates", "maxMessageRate": -1, "groups": {}})
+        with self.assertRaises(PolicyError):
+            policy.create_ruleset({"id": "rates", "groups": {"$default": {"maxByteRate": -1}}})
+
 class PolicyAppConnectionMgrTests(TestCase):
 
     def test_policy_app_conn_mgr_fail_by_total(self):
@@ -0,0 +1,335 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//
+// Microbenchmarks for the hash table, iterators, parser and composer.
+//
+// Every benchmark runs a fixed number of operations over fixed data so runs of
+// two builds can be compared.  Results are printed as JSON: nanoseconds per
+// operation and, when built with memory pools, pool allocations per operation.
+//
+//   benchmarks [filter]
+//
+// runs only the benchmarks whose name contains filter.
+//
+
+#include "alloc.h"
+
+#include <qpid/dispatch.h>
+#include <qpid/dispatch/amqp.h>
+#include <qpid/dispatch/buffer.h>
+#include <qpid/dispatch/compose.h>
+#include <qpid/dispatch/hash.h>
+#include <qpid/dispatch/iterator.h>
+#include <qpid/dispatch/parse.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char *filter;
+static bool        first_result = true;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+#if USE_MEMORY_POOL
+static void count_allocs(void *context, const char *type_name, size_t type_size, const qd_alloc_stats_t *stats)
+{
+    *(uint64_t*) context += stats->total_allocs;
+}
+#endif
+
+//
+// Pool allocations made so far, by every thread and of every type
+//
+static uint64_t pool_allocs(void)
+{
+    uint64_t total = 0;
+#if USE_MEMORY_POOL
+    qd_alloc_each_type(count_allocs, &total);
+#endif
+    return total;
+}
+
+
+typedef struct {
+    const char *name;
+    uint64_t    ops;
+    uint64_t    start_ns;
+    uint64_t    start_allocs;
+} bench_t;
+
+static bool bench_start(bench_t *bench, const char *name, uint64_t ops)
+{
+    if (filter && !strstr(name, filter))
+        return false;
+    bench->name         = name;
+    bench->ops          = ops;
+    bench->start_allocs = pool_allocs();
+    bench->start_ns     = now_ns();
+    return true;
+}
+
+
+static void bench_end(bench_t *bench)
+{
+    uint64_t elapsed = now_ns() - bench->start_ns;
+    uint64_t allocs  = pool_allocs() - bench->start_allocs;
+
+    printf("%s\n    {\"name\": \"%s\", \"ops\": %"PRIu64", \"ns_per_op\": %.1f, \"allocs_per_op\": ",
+           first_result ? "" : ",", bench->name, bench->ops, (double) elapsed / bench->ops);
+#if USE_MEMORY_POOL
+    printf("%.2f}", (double) allocs / bench->ops);
+#else
+    (void) allocs;
+    printf("null}");
+#endif
+    first_result = false;
+    fflush(stdout);
+}
+
+
+static void bench_hash(int keys)
+{
+    char       name[64];
+    char       key[64];
+    bench_t    bench;
+    qd_hash_t *hash = qd_hash(10, 32, 0);
+    qd_hash_handle_t **handles = NEW_PTR_ARRAY(qd_hash_handle_t, keys);
+    qd_iterator_storage_t storage;
+
+    snprintf(name, sizeof(name), "hash_insert_%d", keys);
+    bool timed = bench_start(&bench, name, keys);
+    for (int i = 0; i < keys; i++) {
+        snprintf(key, sizeof(key), "org.apache/service-%d", i);
+        qd_iterator_t *iter = qd_iterator_init_string(&storage, key, ITER_VIEW_ADDRESS_HASH);
+        qd_hash_insert(hash, iter, (void*) (intptr_t) (i + 1), &handles[i]);
+        qd_iterator_free(iter);
+    }
+    if (timed)
+        bench_end(&bench);
+
+    snprintf(name, sizeof(name), "hash_retrieve_%d", keys);
+    if (bench_start(&bench, name, keys)) {
+        for (int i = 0; i < keys; i++) {
+            void *value;
+            snprintf(key, sizeof(key), "org.apache/service-%d", (i * 7919) % keys);
+            qd_iterator_t *iter = qd_iterator_init_string(&storage, key, ITER_VIEW_ADDRESS_HASH);
+            qd_hash_retrieve(hash, iter, &value);
+            qd_iterator_free(iter);
+        }
+        bench_end(&bench);
+    }
+
+    snprintf(name, sizeof(name), "hash_retrieve_prefix_%d", keys);
+    if (bench_start(&bench, name, keys)) {
+        for (int i = 0; i < keys; i++) {
+            void *value = 0;
+            snprintf(key, sizeof(key), "org.apache/service-%d/queue/a", (i * 7919) % keys);
+            qd_iterator_t *iter = qd_iterator_init_string(&storage, key, ITER_VIEW_ADDRESS_HASH);
+            qd_hash_retrieve_prefix(hash, iter, &value);
+            qd_iterator_free(iter);
+        }
+        bench_end(&bench);
+    }
+
+    for (int i = 0; i < keys; i++) {
+        qd_hash_remove_by_handle(hash, handles[i]);
+        qd_hash_handle_free(handles[i]);
+    }
+    free(handles);
+    qd_hash_free(hash);
+}
+
+
+//
+// Put text in a chain of buffers holding at most 'piece' octets each
+//
+static void buffer_text(qd_buffer_list_t *list, const char *text, size_t piece)
+{
+    size_t length = strlen(text);
+    DEQ_INIT(*list);
+    while (length) {
+        qd_buffer_t *buf = qd_buffer();
+        size_t       n   = length < piece ? length : piece;
+        memcpy(qd_buffer_cursor(buf), text, n);
+        qd_buffer_insert(buf, n);
+        DEQ_INSERT_TAIL(*list, buf);
+        text   += n;
+        length -= n;
+    }
+}
+
+
+static void bench_iterator(const char *label, size_t piece)
+{
+    const char *text =
+        "amqp:/_topo/0/Router.A/org.apache.qpid.dispatch/examples/service/queue-with-a-long-name/0001";
+    char             name[64];
+    bench_t          bench;
+    qd_buffer_list_t list;
+    const int        ops = 1000000;
+
+    buffer_text(&list, text, piece);
+    qd_iterator_t *iter = qd_iterator_buffer(DEQ_HEAD(list), 0, strlen(text), ITER_VIEW_ALL);
+
+    snprintf(name, sizeof(name), "iterator_equal_%s", label);
+    if (bench_start(&bench, name, ops)) {
+        for (int i = 0; i < ops; i++)
+            qd_iterator_equal(iter, (const unsigned char*) text);
+        bench_end(&bench);
+    }
+
+    snprintf(name, sizeof(name), "iterator_hash_%s", label);
+    if (bench_start(&bench, name, ops)) {
+        for (int i = 0; i < ops; i++) {
+            // Changing the view drops the cached hash
+            qd_iterator_reset_view(iter, ITER_VIEW_ALL);
+            qd_iterator_hash_view(iter);
+        }
+        bench_end(&bench);
+    }
+
+    qd_iterator_free(iter);
+    qd_buffer_list_free_buffers(&list);
+}
+
+
+//
+// A map like the application properties of a request, with 'entries' string keys
+//
+static void compose_properties(qd_buffer_list_t *list, int entries)
+{
+    char key[32];
+    qd_composed_field_t *field = qd_compose_subfield(0);
+    qd_compose_start_map(field);
+    for (int i = 0; i < entries; i++) {
+        snprintf(key, sizeof(key), "property-%d", i);
+        qd_compose_insert_string(field, key);
+        if (i % 2)
+            qd_compose_insert_string(field, "a string value");
+        else
+            qd_compose_insert_long(field, i * 1000);
+    }
+    qd_compose_end_map(field);
+    qd_compose_take_buffers(field, list);
+    qd_compose_free(field);
+}
+
+
+static void bench_parse(int entries, bool arena)
+{
+    char             name[64];
+    char             key[32];
+    bench_t          bench;
+    qd_buffer_list_t list;
+    const int        ops = 100000;
+
+    compose_properties(&list, entries);
+    qd_iterator_t *iter = qd_iterator_buffer(DEQ_HEAD(list), 0, qd_buffer_list_length(&list), ITER_VIEW_ALL);
+    snprintf(key, sizeof(key), "property-%d", entries / 2);
+
+    snprintf(name, sizeof(name), "%s_map_%d", arena ? "parse_arena" : "parse", entries);
+    if (bench_start(&bench, name, ops)) {
+        for (int i = 0; i < ops; i++) {
+            qd_iterator_reset(iter);
+            qd_parsed_field_t *field = arena ? qd_parse_arena(iter) : qd_parse(iter);
+            qd_parse_free(field);
+        }
+        bench_end(&bench);
+    }
+
+    snprintf(name, sizeof(name), "%s_map_%d_lookup", arena ? "parse_arena" : "parse", entries);
+    if (bench_start(&bench, name, ops)) {
+        for (int i = 0; i < ops; i++) {
+            qd_iterator_reset(iter);
+            qd_parsed_field_t *field = arena ? qd_parse_arena(iter) : qd_parse(iter);
+            qd_parse_value_by_key(field, key);
+            qd_parse_free(field);
+        }
+        bench_end(&bench);
+    }
+
+    qd_iterator_free(iter);
+    qd_buffer_list_free_buffers(&list);
+}
+
+
+static void bench_compose(void)
+{
+    bench_t   bench;
+    const int ops = 1000000;
+
+    if (bench_start(&bench, "compose_message_annotations", ops)) {
+        for (int i = 0; i < ops; i++) {
+            qd_buffer_list_t     list;
+            qd_composed_field_t *field = qd_compose(QD_PERFORMATIVE_MESSAGE_ANNOTATIONS, 0);
+            qd_compose_start_map(field);
+            qd_compose_insert_symbol(field, QD_MA_TRACE);
+            qd_compose_start_list(field);
+            qd_compose_insert_string(field, "0/Router.A");
+            qd_compose_insert_string(field, "0/Router.B");
+            qd_compose_end_list(field);
+            qd_compose_insert_symbol(field, QD_MA_INGRESS);
+            qd_compose_insert_string(field, "0/Router.A");
+            qd_compose_insert_symbol(field, QD_MA_TO);
+            qd_compose_insert_string(field, "org.apache/service-1");
+            qd_compose_end_map(field);
+            qd_compose_take_buffers(field, &list);
+            qd_compose_free(field);
+            qd_buffer_list_free_buffers(&list);
+        }
+        bench_end(&bench);
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [filter]\n", argv[0]);
+        exit(1);
+    }
+    filter = argc == 2 ? argv[1] : 0;
+
+    // Initializes the allocator
+    qd_dispatch_t *qd = qd_dispatch(0);
+    qd_iterator_set_address("0", "Router.A");
+
+    printf("{\"benchmarks\": [");
+    for (int keys = 1000; keys <= 1000000; keys *= 10)
+        bench_hash(keys);
+    bench_iterator("single_buffer", 512);
+    bench_iterator("multi_buffer", 16);
+    bench_parse(10, false);
+    bench_parse(10, true);
+    bench_parse(50, false);
+    bench_parse(50, true);
+    bench_compose();
+    printf("\n]}\n");
+
+    qd_dispatch_free(qd);
+    return 0;
+}
@@ -29,6 +29,7 @@ int alloc_tests(void);
 int compose_tests(void);
 int policy_tests(void);
 int failoverlist_tests(void);
+int parse_tree_tests(void);
 
 int main(int argc, char** argv)
 {
@@ -60,6 +61,7 @@ int main(int argc, char** argv)
 #endif
     result += policy_tests();
     result += failoverlist_tests();
+    result += parse_tree_tests();
     qd_dispatch_free(qd);       // dispatch_free last.
 
     return result;
@@ -18,12 +18,67 @@
  */
 
 #include <qpid/dispatch/buffer.h>
+#include <qpid/dispatch/static_assert.h>
 #include "alloc.h"
+#include "message_private.h"
+#include "server_private.h"
+#include "router_core/router_core_private.h"
+#include <stddef.h>
+#include <stdio.h>
+
+//
+// Layout budgets of the structures there is one of per message, delivery, link, address
+// or connection.  Growing one past its budget fails the build: raise the budget in the
+// same change only if the growth is worth it.  Each structure also keeps the fields used
+// on every message within its first cache lines ("hot" below).
+//
+#define CACHE_LINE QDR_CACHE_LINE
+#define FIELD_END(T, f) (offsetof(T, f) + sizeof(((T*) 0)->f))
+#define LINES(octets)   (((octets) + CACHE_LINE - 1) / CACHE_LINE)
+
+#define DELIVERY_BUDGET    256
+#define LINK_BUDGET       1280
+#define ADDRESS_BUDGET     384
+#define CONTENT_BUDGET     512
+#define CONNECTION_BUDGET  448
+
+STATIC_ASSERT(sizeof(qdr_delivery_t)       <= DELIVERY_BUDGET,   qdr_delivery_t_within_budget);
+STATIC_ASSERT(sizeof(qdr_link_t)           <= LINK_BUDGET,       qdr_link_t_within_budget);
+STATIC_ASSERT(sizeof(qdr_address_t)        <= ADDRESS_BUDGET,    qdr_address_t_within_budget);
+STATIC_ASSERT(sizeof(qd_message_content_t) <= CONTENT_BUDGET,    qd_message_content_t_within_budget);
+STATIC_ASSERT(sizeof(qd_connection_t)      <= CONNECTION_BUDGET, qd_connection_t_within_budget);
+
+// Forwarding of a delivery, with the reference count a line away from the forwarding fields
+STATIC_ASSERT(FIELD_END(qdr_delivery_t, msg) <= CACHE_LINE, qdr_delivery_t_hot_fields_in_first_line);
+STATIC_ASSERT(offsetof(qdr_delivery_t, ref_count) >= FIELD_END(qdr_delivery_t, origin) + CACHE_LINE,
+              qdr_delivery_t_ref_count_apart);
+// The connection and direction, read for every delivery on the link
+STATIC_ASSERT(FIELD_END(qdr_link_t, link_direction) <= CACHE_LINE, qdr_link_t_hot_fields_in_first_line);
+// The link's shared, I/O thread and core thread fields on lines of their own
+STATIC_ASSERT(offsetof(qdr_link_t, work_batch) >= FIELD_END(qdr_link_t, updated_deliveries) + CACHE_LINE,
+              qdr_link_t_io_fields_apart);
+STATIC_ASSERT(offsetof(qdr_link_t, capacity) >= FIELD_END(qdr_link_t, deliver_latency) + CACHE_LINE,
+              qdr_link_t_core_fields_apart);
+// The consumers the forwarder chooses among
+STATIC_ASSERT(FIELD_END(qdr_address_t, rlinks) <= 2 * CACHE_LINE, qdr_address_t_hot_fields_in_two_lines);
+// The lock, reference count and buffer chain, touched by every receive and send
+STATIC_ASSERT(FIELD_END(qd_message_content_t, buffers) <= CACHE_LINE, qd_message_content_t_hot_fields_in_first_line);
+// The server and proton connection, read on every I/O event
+STATIC_ASSERT(FIELD_END(qd_connection_t, pn_conn) <= CACHE_LINE, qd_connection_t_hot_fields_in_first_line);
+
+
+static void print_layout(const char *name, size_t size, size_t budget, size_t hot_end)
+{
+    printf("  %-22s %5zu octets in %2zu cache lines (budget %5zu), hot fields in %zu\n",
+           name, size, LINES(size), budget, LINES(hot_end));
+}
+
 
 int message_tests();
 int field_tests();
 int parse_tests();
 int buffer_tests();
+int spill_tests();
 
 int main(int argc, char** argv)
 {
@@ -38,11 +93,36 @@ int main(int argc, char** argv)
     qd_alloc_initialize();
     qd_buffer_set_size(buffer_size);
 
+    printf("Per-message overhead: %zu octets (message %zu, content %zu, properties %zu when parsed)"
+           " plus a %d octet inline buffer\n",
+           sizeof(qd_message_pvt_t) + sizeof(qd_message_content_t) + sizeof(qd_buffer_t),
+           sizeof(qd_message_pvt_t), sizeof(qd_message_content_t), sizeof(qd_message_properties_t),
+           QD_MESSAGE_INLINE_CAPACITY);
+
+    printf("Per-address overhead: %zu octets with at most one remote router, plus a %d-bit mask with more"
+           " and %zu octets of latency histograms once sent to a local consumer\n",
+           sizeof(qdr_address_t), qd_bitmask_width(), sizeof(qdr_address_latency_t));
+
+    printf("Per-connection overhead: %zu octets idle (server %zu, core %zu, info %zu)\n",
+           sizeof(qd_connection_t) + sizeof(qdr_connection_t) + sizeof(qdr_connection_info_t),
+           sizeof(qd_connection_t), sizeof(qdr_connection_t), sizeof(qdr_connection_info_t));
+
+    printf("Per-buffer memory: %zu octets for %zu octets of message, and %zu octets per delivery of a message\n",
+           sizeof(qd_buffer_t) + buffer_size, buffer_size, sizeof(qdr_delivery_t));
+
+    printf("Layout (%d octet cache lines):\n", CACHE_LINE);
+    print_layout("qdr_delivery_t",       sizeof(qdr_delivery_t),       DELIVERY_BUDGET,   FIELD_END(qdr_delivery_t, msg));
+    print_layout("qdr_link_t",           sizeof(qdr_link_t),           LINK_BUDGET,       FIELD_END(qdr_link_t, link_direction));
+    print_layout("qdr_address_t",        sizeof(qdr_address_t),        ADDRESS_BUDGET,    FIELD_END(qdr_address_t, rlinks));
+    print_layout("qd_message_content_t", sizeof(qd_message_content_t), CONTENT_BUDGET,    FIELD_END(qd_message_content_t, buffers));
+    print_layout("qd_connection_t",      sizeof(qd_connection_t),      CONNECTION_BUDGET, FIELD_END(qd_connection_t, pn_conn));
+
     int result = 0;
     result += message_tests();
     result += field_tests();
     result += parse_tests();
     result += buffer_tests();
+    result += spill_tests();
 
     qd_alloc_finalize();
     return result;
@@ -0,0 +1,181 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_case.h"
+#include "spill.h"
+
+#define CHUNK 3000
+
+
+static void fill_chunk(qd_buffer_list_t *list, unsigned char mark)
+{
+    unsigned char data[CHUNK];
+    memset(data, mark, CHUNK);
+
+    const unsigned char *src  = data;
+    size_t               left = CHUNK;
+    DEQ_INIT(*list);
+    while (left > 0) {
+        qd_buffer_t *buf   = qd_buffer();
+        size_t       count = qd_buffer_capacity(buf);
+        if (count > left)
+            count = left;
+        memcpy(qd_buffer_cursor(buf), src, count);
+        qd_buffer_insert(buf, count);
+        DEQ_INSERT_TAIL(*list, buf);
+        src  += count;
+        left -= count;
+    }
+}
+
+
+static bool store_chunk(qd_spill_extent_t *extent, unsigned char mark)
+{
+    qd_buffer_list_t list;
+    fill_chunk(&list, mark);
+    bool stored = qd_spill_store(DEQ_HEAD(list), extent);
+    qd_buffer_list_free_buffers(&list);
+    return stored;
+}
+
+
+static bool chunk_is(const qd_spill_extent_t *extent, unsigned char mark)
+{
+    qd_buffer_list_t list;
+    DEQ_INIT(list);
+    qd_spill_load(extent, &list);
+
+    size_t       length = 0;
+    bool         same   = true;
+    qd_buffer_t *buf    = DEQ_HEAD(list);
+    while (buf) {
+        for (size_t i = 0; i < qd_buffer_size(buf); i++)
+            same = same && qd_buffer_base(buf)[i] == mark;
+        length += qd_buffer_size(buf);
+        buf = DEQ_NEXT(buf);
+    }
+    qd_buffer_list_free_buffers(&list);
+    return same && length == CHUNK;
+}
+
+
+//
+// The file is unlinked once mapped, the mapping keeps it.
+//
+static bool open_spill(uint64_t chunks)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "spill_test.%d", (int) getpid());
+    qd_error_t err = qd_spill_open(path, chunks * CHUNK);
+    unlink(path);
+    return err == QD_ERROR_NONE;
+}
+
+
+static char *test_spill_reuse(void *context)
+{
+    char              *error = 0;
+    qd_spill_extent_t  extents[4];
+    memset(extents, 0, sizeof(extents));
+
+    if (!open_spill(4))
+        return "Cannot open the spill file";
+
+    //
+    // A slow consumer: the oldest extent is released and a new one stored, so the file
+    // always holds live data while many times its size passes through it.
+    //
+    for (int i = 0; i < 3; i++)
+        if (!store_chunk(&extents[i], (unsigned char) i))
+            error = "Store into an empty file failed";
+
+    for (int i = 3; !error && i < 40; i++) {
+        qd_spill_extent_t *oldest = &extents[(i - 3) % 4];
+        if (!chunk_is(oldest, (unsigned char) (i - 3)))
+            error = "Loaded data differs from the stored data";
+        qd_spill_release(oldest);
+        if (!error && !store_chunk(&extents[i % 4], (unsigned char) i))
+            error = "Store failed with free space in the file";
+    }
+
+    for (int i = 0; i < 4; i++)
+        qd_spill_release(&extents[i]);
+    qd_spill_close();
+    return error;
+}
+
+
+static char *test_spill_coalesce(void *context)
+{
+    char              *error = 0;
+    qd_spill_extent_t  extents[4];
+    qd_spill_extent_t  wide;
+    qd_buffer_list_t   list;
+    qd_buffer_list_t   second;
+    memset(extents, 0, sizeof(extents));
+    ZERO(&wide);
+
+    if (!open_spill(4))
+        return "Cannot open the spill file";
+
+    for (int i = 0; i < 4; i++)
+        if (!store_chunk(&extents[i], (unsigned char) i))
+            error = "Store into an empty file failed";
+    if (!error && store_chunk(&extents[0], 9))
+        error = "Store into a full file succeeded";
+
+    //
+    // Two neighbours released out of order make room for data twice their size.
+    //
+    qd_spill_release(&extents[2]);
+    qd_spill_release(&extents[1]);
+    fill_chunk(&list, 7);
+    fill_chunk(&second, 7);
+    DEQ_APPEND(list, second);
+    if (!error && !qd_spill_store(DEQ_HEAD(list), &wide))
+        error = "Store into coalesced space failed";
+    if (!error && (wide.offset != CHUNK || wide.length != 2 * CHUNK))
+        error = "Store did not take the coalesced space";
+    qd_buffer_list_free_buffers(&list);
+
+    if (!error && (!chunk_is(&extents[0], 0) || !chunk_is(&extents[3], 3)))
+        error = "Neighbouring data was overwritten";
+
+    qd_spill_release(&wide);
+    qd_spill_release(&extents[0]);
+    qd_spill_release(&extents[3]);
+    qd_spill_close();
+    return error;
+}
+
+
+int spill_tests()
+{
+    int result = 0;
+    char *test_group = "spill_tests";
+
+    TEST_CASE(test_spill_reuse, 0);
+    TEST_CASE(test_spill_coalesce, 0);
+
+    return result;
+}
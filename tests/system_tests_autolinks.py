@@ -166,6 +166,33 @@ class AutolinkTest(TestCase):
         self.assertEqual(None, test.error)
 
 
+class AutolinkPacedTest(TestCase):
+    """Auto-link attaches paced by autoLinkAttachRate"""
+    COUNT = 40
+
+    @classmethod
+    def setUpClass(cls):
+        super(AutolinkPacedTest, cls).setUpClass()
+        config = [
+            ('router', {'mode': 'standalone', 'id': 'QDR.P', 'autoLinkAttachRate': 20}),
+            ('listener', {'port': cls.tester.get_port(), 'role': 'route-container'}),
+        ]
+        for i in range(cls.COUNT):
+            config.append(('autoLink', {'addr': 'paced.%d' % i, 'containerId': 'container.paced', 'dir': 'out'}))
+        cls.router = cls.tester.qdrouterd("test-router-paced", Qdrouterd.Config(config))
+        cls.router.wait_ready()
+        cls.route_address = cls.router.addresses[0]
+
+    def test_01_paced_attach(self):
+        """
+        Connect the route container and verify that all of its auto-links attach, a batch
+        per rate tick.
+        """
+        test = AutolinkPacedAttachTest('container.paced', self.route_address, self.COUNT)
+        test.run()
+        self.assertEqual(None, test.error)
+
+
 class Timeout(object):
     def __init__(self, parent):
         self.parent = parent
@@ -224,6 +251,40 @@ class AutolinkAttachTest(MessagingHandler):
         container.run()
 
 
+class AutolinkPacedAttachTest(MessagingHandler):
+    def __init__(self, cid, address, count):
+        super(AutolinkPacedAttachTest, self).__init__(prefetch=0)
+        self.cid        = cid
+        self.address    = address
+        self.count      = count
+        self.error      = None
+        self.n_attached = 0
+
+    def timeout(self):
+        self.error = "Timeout Expired: n_attached=%d of %d" % (self.n_attached, self.count)
+        self.conn.close()
+
+    def on_start(self, event):
+        self.timer = event.reactor.schedule(TIMEOUT, Timeout(self))
+        self.conn  = event.container.connect(self.address)
+
+    def on_link_opening(self, event):
+        if event.receiver:
+            event.receiver.target.address = event.receiver.remote_target.address
+
+    def on_link_opened(self, event):
+        if event.receiver:
+            self.n_attached += 1
+            if self.n_attached == self.count:
+                self.timer.cancel()
+                self.conn.close()
+
+    def run(self):
+        container = Container(self)
+        container.container_id = self.cid
+        container.run()
+
+
 class AutolinkCreditTest(MessagingHandler):
     def __init__(self, normal_address, route_address):
         super(AutolinkCreditTest, self).__init__(prefetch=0)
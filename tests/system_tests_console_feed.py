@@ -0,0 +1,66 @@
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License
+#
+
+import unittest
+from proton import Message
+from proton.utils import BlockingConnection
+from system_test import TestCase, Qdrouterd, main_module, TIMEOUT
+
+class ConsoleFeedTest(TestCase):
+    """Receive the router's statistics on the console feed address"""
+
+    @classmethod
+    def setUpClass(cls):
+        super(ConsoleFeedTest, cls).setUpClass()
+        config = Qdrouterd.Config([
+            ('router', {'mode': 'standalone', 'id': 'QDR', 'consoleFeedInterval': 200}),
+            ('listener', {'port': cls.tester.get_port()}),
+        ])
+        cls.router = cls.tester.qdrouterd('test_router', config, wait=True)
+
+    def test_stats_feed(self):
+        conn = BlockingConnection(self.router.addresses[0], timeout=TIMEOUT)
+        feed = conn.create_receiver("_local/qdconsole")
+        sender = conn.create_sender("feed.address")
+        receiver = conn.create_receiver("feed.address")
+        for i in range(5):
+            sender.send(Message(body="message %d" % i))
+            receiver.receive()
+            receiver.accept()
+
+        first = feed.receive()
+        feed.accept()
+        self.assertEqual("stats", first.subject)
+        self.assertEqual("QDR", first.properties['router'])
+        for key in ['sequence', 'intervalMsec', 'connectionCount', 'linkCount', 'addrCount',
+                    'nodeCount', 'linkRouteCount', 'autoLinkCount', 'coreUtilization']:
+            self.assertTrue(key in first.body, key)
+        self.assertTrue(first.body['connectionCount'] >= 1)
+
+        # Counters arrive as deltas: summed over the messages they add up to the totals.
+        second = feed.receive()
+        feed.accept()
+        self.assertEqual(first.body['sequence'] + 1, second.body['sequence'])
+        self.assertTrue(second.body['intervalMsec'] > 0)
+        self.assertTrue(first.body['deltas']['deliveriesIngress'] >= 5)
+        self.assertTrue('coreBusyTime' in second.body['deltas'])
+        conn.close()
+
+if __name__ == '__main__':
+    unittest.main(main_module())
@@ -0,0 +1,79 @@
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License
+#
+
+import json, os, unittest
+from proton import Message
+from proton.utils import BlockingConnection
+from system_test import TestCase, Process, Qdrouterd, main_module, TIMEOUT
+from subprocess import PIPE, STDOUT
+
+class DeliveryTraceTest(TestCase):
+    """Trace deliveries to a ring file and decode it with qdtrace"""
+
+    @classmethod
+    def setUpClass(cls):
+        super(DeliveryTraceTest, cls).setUpClass()
+        cls.trace_file = os.path.abspath('delivery.trace')
+        config = Qdrouterd.Config([
+            ('router', {'mode': 'standalone', 'id': 'QDR', 'traceFile': cls.trace_file,
+                        'traceFileRecords': 16}),
+            ('listener', {'port': cls.tester.get_port()}),
+        ])
+        cls.router = cls.tester.qdrouterd('test_router', config, wait=True)
+
+    def run_qdtrace(self, *args):
+        p = self.popen(['qdtrace', '--json'] + list(args) + [self.trace_file],
+                       stdout=PIPE, stderr=STDOUT, expect=Process.EXIT_OK)
+        out = p.communicate()[0]
+        try:
+            p.teardown()
+        except Exception, e:
+            raise Exception("%s\n%s" % (e, out))
+        return json.loads(out)
+
+    def test_trace_send_receive(self):
+        conn = BlockingConnection(self.router.addresses[0], timeout=TIMEOUT)
+        receiver = conn.create_receiver("trace.address")
+        sender = conn.create_sender("trace.address")
+        for i in range(20):
+            sender.send(Message(body="message %d" % i))
+            receiver.receive()
+            receiver.accept()
+        conn.close()
+
+        # The ring keeps only the most recent 16 records, in order.
+        records = self.run_qdtrace()
+        self.assertEqual(16, len(records))
+        seqs = [r['seq'] for r in records]
+        self.assertEqual(range(seqs[0], seqs[0] + 16), seqs)
+
+        ingress = self.run_qdtrace('--event', 'ingress')
+        egress = self.run_qdtrace('--event', 'egress')
+        self.assertTrue(ingress and egress)
+        # Each message's egress record follows its ingress record, with the same address.
+        first = dict((r['messageId'], r) for r in ingress)
+        for r in egress:
+            if r['messageId'] in first:
+                self.assertEqual(first[r['messageId']]['addrHash'], r['addrHash'])
+                self.assertTrue(first[r['messageId']]['seq'] < r['seq'])
+                self.assertTrue(r['size'] > 0)
+        self.assertTrue(any(r['disposition'] == 'accepted' for r in self.run_qdtrace('--event', 'disposition')))
+
+if __name__ == '__main__':
+    unittest.main(main_module())
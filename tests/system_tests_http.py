@@ -96,6 +96,26 @@ class RouterTestHttp(TestCase):
         # https not configured
         self.assertRaises(urllib2.URLError, urllib2.urlopen, "https://localhost:%d/nosuch" % r.ports[0])
 
+    def test_metrics(self):
+        if not sys.version_info >= (2, 9):
+            return
+
+        config = Qdrouterd.Config([
+            ('router', {'id': 'QDR.METRICS'}),
+            ('listener', {'port': self.get_port(), 'httpRoot': os.path.dirname(__file__)}),
+            ('listener', {'port': self.get_port(), 'httpRoot': os.path.dirname(__file__), 'metrics': False}),
+        ])
+        r = self.qdrouterd('metrics-test-router', config)
+
+        text = self.get("http://localhost:%d/metrics" % r.ports[0])
+        self.assertTrue(text.endswith("# EOF\n"))
+        self.assertIn("# TYPE qdrouterd_connections gauge\n", text)
+        self.assertIn("qdrouterd_deliveries_ingress_total ", text)
+        self.assertIn('qdrouterd_alloc_in_use{type="qd_message_t"} ', text)
+
+        # Metrics disabled on the second listener
+        self.assertRaises(urllib2.HTTPError, urllib2.urlopen, "http://localhost:%d/metrics" % r.ports[1])
+
     def test_https_get(self):
         if not sys.version_info >= (2, 9):
             return
@@ -585,6 +585,16 @@ class LinkRouteTest(TestCase):
         test.run()
         self.assertEqual(None, test.error)
 
+    def test_cut_through_abort(self):
+        test = CutThroughAbortTest(self.routers[1].addresses[0], self.routers[1].addresses[1])
+        test.run()
+        self.assertEqual(None, test.error)
+
+    def test_link_counters(self):
+        test = LinkCountersTest(self.routers[1].addresses[0], self.routers[1].addresses[1])
+        test.run()
+        self.assertEqual(None, test.error)
+
 
 class Timeout(object):
     def __init__(self, parent):
@@ -721,6 +731,201 @@ class CloseWithUnsettledTest(MessagingHandler):
         Container(self).run()
 
 
+class Interrupt(object):
+    def __init__(self, parent):
+        self.parent = parent
+
+    def on_timer_task(self, event):
+        self.parent.interrupt()
+
+
+class CutThroughAbortTest(MessagingHandler):
+    ##
+    ## Half of a large message is sent across a link route, which the router cuts through
+    ## to the route container as it arrives.  The sender then aborts the delivery.  A second
+    ## message sent on the same link must still reach the route container.
+    ##
+    def __init__(self, normal_addr, route_addr):
+        super(CutThroughAbortTest, self).__init__(prefetch=0)
+        self.normal_addr = normal_addr
+        self.route_addr  = route_addr
+        self.dest        = "pulp.task.CTAbortTest"
+        self.error       = None
+        self.sender      = None
+        self.phase       = "first"
+        self.big         = Message(body="0123456789" * 20000).encode()
+        self.body        = "CutThroughAbortTest"
+
+    def timeout(self):
+        self.error = "Timeout Expired: phase=%s" % self.phase
+        self.conn_normal.close()
+        self.conn_route.close()
+
+    def on_start(self, event):
+        self.timer      = event.reactor.schedule(TIMEOUT, Timeout(self))
+        self.reactor    = event.reactor
+        self.conn_route = event.container.connect(self.route_addr)
+
+    def on_connection_opened(self, event):
+        if event.connection == self.conn_route:
+            self.conn_normal = event.container.connect(self.normal_addr)
+        elif event.connection == self.conn_normal:
+            self.sender = event.container.create_sender(self.conn_normal, self.dest)
+
+    def on_link_opened(self, event):
+        if event.receiver:
+            event.receiver.flow(2)
+
+    def on_sendable(self, event):
+        if event.sender != self.sender:
+            return
+        if self.phase == "first":
+            self.first = self.sender.delivery("first")
+            self.sender.stream(self.big[:len(self.big) // 2])
+            self.phase = "abort"
+            self.reactor.schedule(1.0, Interrupt(self))
+        elif self.phase == "second":
+            self.send_second()
+
+    def interrupt(self):
+        self.phase = "second"
+        self.first.abort()
+        if self.sender.credit > 0:
+            self.send_second()
+
+    def send_second(self):
+        self.sender.send(Message(body=self.body))
+        self.phase = "sent"
+
+    def on_message(self, event):
+        if event.message.body != self.body:
+            self.error = "Received the aborted message"
+        self.timer.cancel()
+        self.conn_normal.close()
+        self.conn_route.close()
+
+    def run(self):
+        Container(self).run()
+
+
+class PollTimer(object):
+    def __init__(self, parent):
+        self.parent = parent
+
+    def on_timer_task(self, event):
+        self.parent.poll()
+
+
+class LinkCountersTest(MessagingHandler):
+    ##
+    ## This test sends pre-settled deliveries from the sender and unsettled ones that the
+    ## receiver accepts, rejects or releases across a link route, then checks the delivery
+    ## counters of both routed links on the router.
+    ##
+    PRESETTLED = 4
+    OUTCOMES   = ['accepted', 'accepted', 'accepted', 'rejected', 'rejected', 'released']
+
+    def __init__(self, normal_addr, route_addr):
+        super(LinkCountersTest, self).__init__(auto_accept=False)
+        self.normal_addr = normal_addr
+        self.route_addr  = route_addr
+        self.dest        = "pulp.task.LCtest"
+        self.error       = None
+        self.sender      = None
+        self.n_sent      = 0
+        self.n_settled   = 0
+        self.n_unsettled = 0
+        self.expected    = {'deliveryCount':   self.PRESETTLED + len(self.OUTCOMES),
+                            'presettledCount': self.PRESETTLED,
+                            'acceptedCount':   self.OUTCOMES.count('accepted'),
+                            'rejectedCount':   self.OUTCOMES.count('rejected'),
+                            'releasedCount':   self.OUTCOMES.count('released')}
+        self.last        = None
+        self.polling     = False
+
+    def timeout(self):
+        self.error = "Timeout Expired - link counters %s, expected %s" % (self.last, self.expected)
+        self.conn_normal.close()
+        self.conn_route.close()
+
+    def on_start(self, event):
+        self.timer      = event.reactor.schedule(TIMEOUT, Timeout(self))
+        self.reactor    = event.reactor
+        self.conn_route = event.container.connect(self.route_addr)
+
+    def on_connection_opened(self, event):
+        if event.connection == self.conn_route:
+            self.conn_normal = event.container.connect(self.normal_addr)
+        elif event.connection == self.conn_normal:
+            self.sender = event.container.create_sender(self.conn_normal, self.dest)
+
+    def on_sendable(self, event):
+        if event.sender != self.sender:
+            return
+        total = self.PRESETTLED + len(self.OUTCOMES)
+        while self.n_sent < total and self.sender.credit > 0:
+            dlv = self.sender.send(Message(body=self.n_sent))
+            if self.n_sent < self.PRESETTLED:
+                dlv.settle()
+            self.n_sent += 1
+
+    def on_message(self, event):
+        if event.delivery.settled:
+            self.n_settled += 1
+        else:
+            outcome = self.OUTCOMES[self.n_unsettled]
+            self.n_unsettled += 1
+            if outcome == 'accepted':
+                self.accept(event.delivery)
+            elif outcome == 'rejected':
+                self.reject(event.delivery)
+            else:
+                self.release(event.delivery, delivered=False)
+
+    def on_settled(self, event):
+        self.check_done()
+
+    def on_accepted(self, event):
+        self.check_done()
+
+    def on_rejected(self, event):
+        self.check_done()
+
+    def on_released(self, event):
+        self.check_done()
+
+    def check_done(self):
+        if self.n_settled == self.PRESETTLED and self.n_unsettled == len(self.OUTCOMES) and not self.polling:
+            self.polling = True
+            self.poll()
+
+    def poll(self):
+        if self.error:
+            return
+        local_node = Node.connect(self.normal_addr, timeout=TIMEOUT)
+        out = local_node.query(type='org.apache.qpid.dispatch.router.link')
+        local_node.close()
+
+        names = out.attribute_names
+        counters = {}
+        for result in out.results:
+            if result[names.index('owningAddr')] == 'M0' + self.dest:
+                counters[result[names.index('linkDir')]] = \
+                    dict((k, result[names.index(k)]) for k in self.expected)
+        self.last = counters
+
+        if counters.get('in') == self.expected and counters.get('out') == self.expected:
+            self.timer.cancel()
+            self.conn_normal.close()
+            self.conn_route.close()
+        else:
+            # The routed links count a delivery when it is freed, after both ends settle
+            self.reactor.schedule(0.1, PollTimer(self))
+
+    def run(self):
+        Container(self).run()
+
+
 class DynamicSourceTest(MessagingHandler):
     ##
     ## This test verifies that a dynamic source can be propagated via link-route to
@@ -239,6 +239,23 @@ class ManagementTest(system_test.TestCase):
         # Invalid values
         self.assertRaises(ManagementError, node.update, dict(identity="log/AGENT", enable="foo"))
 
+    def test_log_ring(self):
+        """Keep raw log entries in a module's ring and fetch them formatted"""
+        node = self.cleanup(Node.connect(self.router.addresses[0]))
+        node.update(dict(identity="log/AGENT", ringEnable="error+", ringSize=5))
+        for name in ["nosuch1", "nosuch2"]:
+            self.assertRaises(ManagementError, node.create, type=name, name=name)
+        ring = node.get_log_ring(module="AGENT")
+        self.assertEqual(2, len(ring))
+        self.assertEqual(['AGENT', 'error'], ring[0][0:2])
+        self.assertRegexpMatches(ring[0][2], 'nosuch1')
+        self.assertRegexpMatches(ring[1][2], 'nosuch2')
+        self.assertEqual(ring[1:], node.get_log_ring(module="AGENT", limit=1))
+
+        # Disabling the ring discards its entries.
+        node.update(dict(identity="log/AGENT", ringEnable="none"))
+        self.assertEqual([], node.get_log_ring(module="AGENT"))
+
     def test_create_fixed_address(self):
         self.assert_create_ok(FIXED_ADDRESS, 'fixed1', dict(prefix='fixed1'))
         msgr = self.messenger()
@@ -53,6 +53,11 @@ class RouterTest(TestCase):
             ('address', {'prefix': 'closest', 'distribution': 'closest'}),
             ('address', {'prefix': 'spread', 'distribution': 'balanced'}),
             ('address', {'prefix': 'multicast', 'distribution': 'multicast'}),
+            ('address', {'prefix': 'conflate', 'distribution': 'balanced',
+                         'presettledOverflow': 'conflate', 'presettledDepth': 10}),
+            ('address', {'prefix': 'mcall', 'distribution': 'multicast', 'multicastCompletion': 'all'}),
+            ('address', {'prefix': 'mcany', 'distribution': 'multicast', 'multicastCompletion': 'any'}),
+            ('address', {'prefix': 'group', 'distribution': 'balanced', 'groupAffinity': 16}),
         ])
         cls.router = cls.tester.qdrouterd(name, config)
         cls.router.wait_ready()
@@ -1124,6 +1129,57 @@ class RouterTest(TestCase):
         test.run()
         self.assertEqual(None, test.error)
 
+    def test_22_presettled_conflation(self):
+        test = PresettledConflationTest(self.address)
+        test.run()
+        self.assertEqual(None, test.error)
+
+        node = Node.connect(self.address)
+        results = node.query(type='org.apache.qpid.dispatch.router.address',
+                             attribute_names=[u'name', u'droppedPresettledDeliveries']).results
+        dropped = [r[1] for r in results if r[0].endswith(test.dest)]
+        node.close()
+        self.assertEqual(1, len(dropped))
+        self.assertEqual(test.count - test.n_received, dropped[0])
+
+    def test_23_multicast_completion_all(self):
+        test = MulticastCompletionTest(self.address, "mcall.accepted", Delivery.ACCEPTED, Delivery.ACCEPTED)
+        test.run()
+        self.assertEqual(None, test.error)
+
+        test = MulticastCompletionTest(self.address, "mcall.rejected", Delivery.REJECTED, Delivery.REJECTED)
+        test.run()
+        self.assertEqual(None, test.error)
+
+    def test_24_multicast_completion_any(self):
+        test = MulticastCompletionTest(self.address, "mcany.released", Delivery.RELEASED, Delivery.ACCEPTED)
+        test.run()
+        self.assertEqual(None, test.error)
+
+    def test_25_anonymous_unroutable(self):
+        test = AnonymousUnroutableTest(self.address, "closest.UnroutableTest", False)
+        test.run()
+        self.assertEqual(None, test.error)
+
+        test = AnonymousUnroutableTest(self.address, "closest.NoConsumerTest", True)
+        test.run()
+        self.assertEqual(None, test.error)
+
+    def test_26_group_affinity(self):
+        test = GroupAffinityTest(self.address, "group.GroupAffinityTest")
+        test.run()
+        self.assertEqual(None, test.error)
+
+    def test_27_cut_through_sender_detach(self):
+        test = CutThroughInterruptTest(self.address, "closest.CTDetachTest", abort=False)
+        test.run()
+        self.assertEqual(None, test.error)
+
+    def test_28_cut_through_sender_abort(self):
+        test = CutThroughInterruptTest(self.address, "spread.CTAbortTest", abort=True)
+        test.run()
+        self.assertEqual(None, test.error)
+
     def test_reject_disposition(self):
         test = RejectDispositionTest(self.address)
         test.run()
@@ -1155,6 +1211,88 @@ class Timeout(object):
 
 HELLO_WORLD = "Hello World!"
 
+class Interrupt(object):
+    def __init__(self, parent):
+        self.parent = parent
+
+    def on_timer_task(self, event):
+        self.parent.interrupt()
+
+
+class CutThroughInterruptTest(MessagingHandler):
+    """
+    Half of a large message is sent to an anycast address, which the router starts cutting
+    through to the receiver.  The sender then detaches its link, or aborts the delivery.
+    A second message must still reach the receiver over the same outgoing link.
+    """
+    def __init__(self, address, dest, abort):
+        super(CutThroughInterruptTest, self).__init__(prefetch=0)
+        self.address   = address
+        self.dest      = dest
+        self.abort     = abort
+        self.error     = None
+        self.conn      = None
+        self.receiver  = None
+        self.sender    = None
+        self.phase     = "first"
+        self.big       = Message(body="0123456789" * 20000).encode()
+        self.body      = "CutThroughInterruptTest"
+
+    def timeout(self):
+        self.error = "Timeout Expired: phase=%s" % self.phase
+        self.conn.close()
+
+    def on_start(self, event):
+        self.timer     = event.reactor.schedule(TIMEOUT, Timeout(self))
+        self.reactor   = event.reactor
+        self.container = event.container
+        self.conn      = event.container.connect(self.address)
+        self.receiver  = event.container.create_receiver(self.conn, self.dest)
+
+    def on_link_opened(self, event):
+        if event.receiver == self.receiver:
+            self.receiver.flow(2)
+            self.sender = self.container.create_sender(self.conn, self.dest)
+
+    def on_sendable(self, event):
+        if event.sender != self.sender:
+            return
+        if self.phase == "first":
+            #
+            # Send half of the message, leaving the delivery open, then give the router
+            # time to start passing it on.
+            #
+            self.first = self.sender.delivery("first")
+            self.sender.stream(self.big[:len(self.big) // 2])
+            self.phase = "interrupt"
+            self.reactor.schedule(1.0, Interrupt(self))
+        elif self.phase == "second":
+            self.send_second()
+
+    def interrupt(self):
+        self.phase = "second"
+        if self.abort:
+            self.first.abort()
+            if self.sender.credit > 0:
+                self.send_second()
+        else:
+            self.sender.close()
+            self.sender = self.container.create_sender(self.conn, self.dest)
+
+    def send_second(self):
+        self.sender.send(Message(body=self.body))
+        self.phase = "sent"
+
+    def on_message(self, event):
+        if event.message.body != self.body:
+            self.error = "Received the interrupted message"
+        self.timer.cancel()
+        self.conn.close()
+
+    def run(self):
+        Container(self).run()
+
+
 class SndSettleModeTest(MessagingHandler):
     def __init__(self, address):
         super(SndSettleModeTest, self).__init__()
@@ -1542,6 +1680,118 @@ class PresettledOverflowTest(MessagingHandler):
         Container(self).run()
 
 
+class MulticastCompletionTest(MessagingHandler):
+    """
+    Send unsettled deliveries to a multicast address with two receivers, one accepting
+    and one settling with other_outcome, and check the outcome the sender sees.
+    """
+    def __init__(self, address, dest, other_outcome, expected):
+        super(MulticastCompletionTest, self).__init__(auto_accept=False)
+        self.address       = address
+        self.dest          = dest
+        self.other_outcome = other_outcome
+        self.expected      = expected
+        self.error         = None
+        self.count         = 10
+        self.n_sent        = 0
+        self.n_settled     = 0
+        self.outcomes      = {}
+
+    def timeout(self):
+        self.error = "Timeout Expired: sent=%d settled=%d outcomes=%r" % (self.n_sent, self.n_settled, self.outcomes)
+        self.conn.close()
+
+    def on_start(self, event):
+        self.timer    = event.reactor.schedule(TIMEOUT, Timeout(self))
+        self.conn     = event.container.connect(self.address)
+        self.accepter = event.container.create_receiver(self.conn, self.dest, name="accepter")
+        self.other    = event.container.create_receiver(self.conn, self.dest, name="other")
+        self.sender   = None
+
+    def on_link_opened(self, event):
+        if event.receiver and self.sender is None and self.accepter.state & self.accepter.REMOTE_ACTIVE \
+           and self.other.state & self.other.REMOTE_ACTIVE:
+            self.sender = event.container.create_sender(self.conn, self.dest)
+
+    def on_sendable(self, event):
+        while self.n_sent < self.count and event.sender.credit > 0:
+            event.sender.send(Message(body=self.n_sent))
+            self.n_sent += 1
+
+    def on_message(self, event):
+        if event.receiver == self.accepter:
+            self.accept(event.delivery)
+        else:
+            event.delivery.update(self.other_outcome)
+            event.delivery.settle()
+
+    def on_settled(self, event):
+        if event.delivery.link != self.sender:
+            return
+        outcome = event.delivery.remote_state
+        self.outcomes[outcome] = self.outcomes.get(outcome, 0) + 1
+        self.n_settled += 1
+        if outcome != self.expected:
+            self.error = "Expected outcome %r, got %r" % (self.expected, outcome)
+        if self.n_settled == self.count or self.error:
+            self.timer.cancel()
+            self.conn.close()
+
+    def run(self):
+        Container(self).run()
+
+
+class PresettledConflationTest(MessagingHandler):
+    def __init__(self, address):
+        super(PresettledConflationTest, self).__init__(prefetch=0)
+        self.address = address
+        self.dest = "conflate.PresettledConflation"
+        self.error = None
+        self.count       = 500
+        self.keys        = 5
+        self.n_sent      = 0
+        self.n_received  = 0
+        self.latest      = {}
+
+    def timeout(self):
+        self.error = "Timeout Expired: sent=%d rcvd=%d latest=%r" % (self.n_sent, self.n_received, self.latest)
+        self.conn.close()
+
+    def on_start(self, event):
+        self.timer    = event.reactor.schedule(TIMEOUT, Timeout(self))
+        self.conn     = event.container.connect(self.address)
+        self.sender   = event.container.create_sender(self.conn, self.dest)
+        self.receiver = event.container.create_receiver(self.conn, self.dest)
+
+    def send(self):
+        while self.n_sent < self.count and self.sender.credit > 0:
+            msg = Message(subject="key-%d" % (self.n_sent % self.keys), body={"seq": self.n_sent})
+            dlv = self.sender.send(msg)
+            dlv.settle()
+            self.n_sent += 1
+        if self.n_sent == self.count:
+            self.receiver.flow(self.count)
+
+    def on_sendable(self, event):
+        if self.n_sent < self.count:
+            self.send()
+
+    def on_message(self, event):
+        self.n_received += 1
+        seq = event.message.body["seq"]
+        if self.latest.get(event.message.subject, -1) >= seq:
+            self.error = "Out of order delivery for %s: %d" % (event.message.subject, seq)
+        self.latest[event.message.subject] = seq
+        if len(self.latest) == self.keys and min(self.latest.values()) == self.count - self.keys:
+            if self.n_received == self.count:
+                self.error = "No deliveries were conflated"
+            self.conn.close()
+            self.timer.cancel()
+
+    def run(self):
+        Container(self).run()
+
+
 class RejectDispositionTest(MessagingHandler):
     def __init__(self, address):
         super(RejectDispositionTest, self).__init__(auto_accept=False)
@@ -1576,5 +1826,123 @@ class RejectDispositionTest(MessagingHandler):
     def run(self):
         Container(self).run()
 
+class AnonymousUnroutableTest(MessagingHandler):
+    """
+    Messages on an anonymous link to an address the router doesn't know, or that has no
+    consumers, are released, and delivered once a receiver for the address has attached.
+    An addressed sender keeps the address known.
+    """
+    def __init__(self, address, dest, known):
+        super(AnonymousUnroutableTest, self).__init__()
+        self.address    = address
+        self.dest       = dest
+        self.known      = known
+        self.error      = None
+        self.count      = 5
+        self.n_sent     = 0
+        self.n_released = 0
+        self.n_received = 0
+        self.receiver   = None
+
+    def timeout(self):
+        self.error = "Timeout Expired: sent=%d, released=%d, received=%d" % \
+                     (self.n_sent, self.n_released, self.n_received)
+        self.conn.close()
+
+    def on_start(self, event):
+        self.timer  = event.reactor.schedule(TIMEOUT, Timeout(self))
+        self.conn   = event.container.connect(self.address)
+        self.sender = None
+        if self.known:
+            self.holder = event.container.create_sender(self.conn, self.dest)
+        else:
+            self.sender = event.container.create_sender(self.conn, None)
+
+    def send(self):
+        while self.sender.credit > 0 and self.n_sent < self.count * 2 and \
+              (self.receiver or self.n_sent < self.count):
+            self.sender.send(Message(address=self.dest, body=self.n_sent))
+            self.n_sent += 1
+
+    def on_sendable(self, event):
+        if event.sender == self.sender:
+            self.send()
+
+    def on_released(self, event):
+        self.n_released += 1
+        if self.n_released == self.count:
+            self.receiver = event.container.create_receiver(self.conn, self.dest)
+
+    def on_link_opened(self, event):
+        if self.known and event.sender and event.sender == self.holder:
+            self.sender = event.container.create_sender(self.conn, None)
+        if event.receiver and event.receiver == self.receiver:
+            self.send()
+
+    def on_message(self, event):
+        self.n_received += 1
+        if self.n_received == self.count:
+            self.timer.cancel()
+            self.conn.close()
+
+    def run(self):
+        Container(self).run()
+
+
+
+class GroupAffinityTest(MessagingHandler):
+    """
+    The messages of each group sent to a balanced address with groupAffinity all arrive
+    at the same one of the address's receivers.
+    """
+    def __init__(self, address, dest):
+        super(GroupAffinityTest, self).__init__()
+        self.address    = address
+        self.dest       = dest
+        self.error      = None
+        self.groups     = ["group-%d" % i for i in range(6)]
+        self.count      = 60
+        self.n_sent     = 0
+        self.n_received = 0
+        self.n_opened   = 0
+        self.placement  = {}
+
+    def timeout(self):
+        self.error = "Timeout Expired: sent=%d, received=%d" % (self.n_sent, self.n_received)
+        self.conn.close()
+
+    def on_start(self, event):
+        self.timer     = event.reactor.schedule(TIMEOUT, Timeout(self))
+        self.conn      = event.container.connect(self.address)
+        self.receivers = [event.container.create_receiver(self.conn, self.dest) for i in range(2)]
+        self.sender    = None
+
+    def on_link_opened(self, event):
+        if event.receiver in self.receivers:
+            self.n_opened += 1
+            if self.n_opened == len(self.receivers):
+                self.sender = event.container.create_sender(self.conn, self.dest)
+
+    def on_sendable(self, event):
+        if event.sender == self.sender:
+            while self.sender.credit > 0 and self.n_sent < self.count:
+                group = self.groups[self.n_sent % len(self.groups)]
+                self.sender.send(Message(body=self.n_sent, group_id=group))
+                self.n_sent += 1
+
+    def on_message(self, event):
+        self.n_received += 1
+        group    = event.message.group_id
+        receiver = self.receivers.index(event.receiver)
+        if self.placement.setdefault(group, receiver) != receiver:
+            self.error = "Group %s arrived at more than one receiver" % group
+        if self.error or self.n_received == self.count:
+            self.timer.cancel()
+            self.conn.close()
+
+    def run(self):
+        Container(self).run()
+
+
 if __name__ == '__main__':
     unittest.main(main_module())
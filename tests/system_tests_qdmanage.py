@@ -160,6 +160,23 @@ class QdmanageTest(TestCase):
                        if e['type'] not in ignore_types)
         self.assertEqual(name_type(qall), name_type(qattr))
 
+    def test_query_where(self):
+        qaddr = json.loads(self.run_qdmanage('query --type=router.address'))
+        qall = json.loads(self.run_qdmanage('query --type=router.address --where=deliveriesEgress>=0'))
+        self.assertEqual(len(qaddr), len(qall))
+        qnone = json.loads(self.run_qdmanage('query --type=router.address --where=deliveriesEgress<0'))
+        self.assertEqual([], qnone)
+
+        name = qaddr[0]['name']
+        qname = json.loads(self.run_qdmanage('query --type=router.address name --where=name==%s' % name))
+        self.assertEqual([{'name': name}], qname)
+
+        # Python-managed entities filter too
+        qlistener = json.loads(self.run_qdmanage('query --type=listener --where=sslProfile==server-ssl'))
+        self.assertEqual(1, len(qlistener))
+
+        self.run_qdmanage('query --type=router.address --where=noSuchAttribute>0', expect=Process.EXIT_FAIL)
+
     def test_get_schema(self):
         schema = dictify(QdSchema().dump())
         actual = self.run_qdmanage("get-json-schema")
@@ -214,6 +231,39 @@ class QdmanageTest(TestCase):
 
         self.assertEquals ( good_logs, len(logs) )
 
+    def test_get_python_locks(self):
+        locks = json.loads(self.run_qdmanage('QUERY --type=pythonLock'))
+        sites = dict((lock['site'], lock) for lock in locks)
+        # This query went through the management agent in Python
+        self.assertIn('qd_io_rx_handler', sites)
+        lock = sites['qd_io_rx_handler']
+        self.assertTrue(lock['acquisitions'] > 0)
+        self.assertEqual(sum(lock['waitHistogram']), lock['acquisitions'])
+        # The hold in progress is counted when this query's handler returns
+        self.assertEqual(sum(lock['holdHistogram']), lock['acquisitions'] - 1)
+
+    def test_profiler(self):
+        profiler = json.loads(self.run_qdmanage('QUERY --type=profiler'))[0]
+        self.assertEqual(0, profiler['frequency'])
+        identity = profiler['identity']
+
+        started = json.loads(self.run_qdmanage('UPDATE --type=profiler --identity=%s frequency=997' % identity))
+        self.assertEqual(997, started['frequency'])
+        for i in range(10):
+            self.run_qdmanage('QUERY --type=allocator')
+        profiler = json.loads(self.run_qdmanage('READ --type=profiler --identity=%s' % identity))
+        self.assertEqual(997, profiler['frequency'])
+        counted = 0
+        for line in profiler['foldedStacks']:
+            stack, count = line.rsplit(' ', 1)
+            self.assertIn(stack.split(';')[0], ['worker', 'core', 'timer', 'http', 'log'])
+            counted += int(count)
+        self.assertTrue(counted <= profiler['samples'])
+
+        stopped = json.loads(self.run_qdmanage('UPDATE --type=profiler --identity=%s frequency=0' % identity))
+        self.assertEqual(0, stopped['frequency'])
+        self.run_qdmanage('UPDATE --type=profiler --identity=%s frequency=5000' % identity, expect=Process.EXIT_FAIL)
+
     def test_update(self):
         exception = False
         try:
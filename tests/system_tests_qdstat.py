@@ -95,6 +95,12 @@ class QdstatTest(system_test.TestCase):
     def test_log(self):
         self.run_qdstat(['--log',  '--limit=5'], r'AGENT \(trace\).*GET-LOG')
 
+    def test_workers(self):
+        out = self.run_qdstat(['--workers'], r'Worker Threads')
+        self.assertTrue(re.search(r'CONNECTION_WAKE|TIMER|DELIVERY|TRANSPORT', out), out)
+        self.assertIn('median', out)
+        self.assertIn('timer%', out)
+
 try:
     SSLDomain(SSLDomain.MODE_CLIENT)
     class QdstatSslTest(system_test.TestCase):
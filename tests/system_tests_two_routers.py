@@ -20,7 +20,7 @@
 import unittest, os, json, logging
 from subprocess import PIPE, STDOUT
 from proton import Message, PENDING, ACCEPTED, REJECTED, RELEASED, Timeout
-from system_test import TestCase, Qdrouterd, main_module, DIR, TIMEOUT, Process
+from system_test import TestCase, Qdrouterd, main_module, DIR, TIMEOUT, Process, retry
 from proton.handlers import MessagingHandler
 from proton.reactor import Container, AtMostOnce, AtLeastOnce
 
@@ -1054,6 +1054,79 @@ class RouterTest(TestCase):
         self.assertEqual(None, test.error)
 
 
+class DataConnectionPoolTest(TestCase):
+    """Inter-router connector opening extra data connections to its peer"""
+
+    @classmethod
+    def setUpClass(cls):
+        super(DataConnectionPoolTest, cls).setUpClass()
+
+        def router(name, connection):
+            config = Qdrouterd.Config([
+                ('router', {'mode': 'interior', 'id': 'QDR.%s'%name}),
+                ('listener', {'port': cls.tester.get_port()}),
+                ('address', {'prefix': 'closest', 'distribution': 'closest'}),
+                ('address', {'prefix': 'spread', 'distribution': 'balanced'}),
+                connection
+            ])
+            cls.routers.append(cls.tester.qdrouterd(name, config, wait=True))
+
+        cls.routers = []
+        inter_router_port = cls.tester.get_port()
+        router('A', ('listener', {'role': 'inter-router', 'port': inter_router_port}))
+        router('B', ('connector', {'role': 'inter-router', 'port': inter_router_port,
+                                   'dataConnectionCount': 3}))
+
+        cls.routers[0].wait_router_connected('QDR.B')
+        cls.routers[1].wait_router_connected('QDR.A')
+
+    def test_01_data_connections(self):
+        def roles():
+            rows = self.routers[0].management.query(type='org.apache.qpid.dispatch.connection',
+                                                    attribute_names=['role']).results
+            found = sorted([r[0] for r in rows if r[0] != 'normal'])
+            return found if found == ['inter-router', 'inter-router-data', 'inter-router-data'] else None
+        self.assertTrue(retry(roles))
+
+    def run_ordered(self, prefix):
+        M1 = self.messenger()
+        M2 = self.messenger()
+
+        M1.route("amqp:/*", self.routers[0].addresses[0]+"/$1")
+        M2.route("amqp:/*", self.routers[1].addresses[0]+"/$1")
+
+        addrs = ["amqp:/%s.pool.%d" % (prefix, i) for i in range(4)]
+        for addr in addrs:
+            M2.subscribe(addr)
+        for i in range(4):
+            self.routers[0].wait_address("%s.pool.%d" % (prefix, i), 0, 1)
+
+        tm = Message()
+        for n in range(50):
+            for addr in addrs:
+                tm.address = addr
+                tm.body = {'number': n}
+                M1.put(tm)
+        M1.send()
+
+        rm = Message()
+        last = {}
+        for n in range(200):
+            M2.recv(1)
+            M2.get(rm)
+            self.assertEqual(last.get(rm.address, -1) + 1, rm.body['number'])
+            last[rm.address] = rm.body['number']
+
+        M1.stop()
+        M2.stop()
+
+    def test_02_closest_order_per_address(self):
+        self.run_ordered("closest")
+
+    def test_03_balanced_order_per_address(self):
+        self.run_ordered("spread")
+
+
 class Timeout(object):
     def __init__(self, parent):
         self.parent = parent
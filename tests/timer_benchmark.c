@@ -0,0 +1,325 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//
+// Timer scale benchmark.
+//
+// For 10k timers and up, THREADS threads each own a share of the timers and
+//
+//   - schedule them as connection idle timeouts, 10 to 70 seconds out,
+//   - reschedule them, as traffic on the connection does,
+//   - schedule a short retry timer per connection, 0 to 1 second out, and keep
+//     rescheduling the idle timeouts while the retries fire,
+//   - cancel the idle timeouts, as closing connections do.
+//
+// The latency of every qd_timer_schedule and qd_timer_cancel call is measured, and so
+// is the lateness of every retry timer: the time from when it was due until its
+// callback ran.  A visitor thread stands in for the server: it sleeps until the
+// timeout the timers ask for (qd_server_timeout) and then runs qd_timer_visit.
+// Results are printed as JSON percentiles.
+//
+//   timer_benchmark [max-timers]
+//
+
+#include <qpid/dispatch.h>
+#include <qpid/dispatch/threading.h>
+#include <qpid/dispatch/timer.h>
+#include "dispatch_private.h"
+#include "timer_private.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define THREADS 4
+
+typedef struct {
+    qd_timer_t *timer;
+    uint64_t    due_ns;
+} retry_t;
+
+typedef struct {
+    int          id;
+    int          count;          ///< Timers owned by this thread
+    int          phase;
+    qd_timer_t **idle;
+    retry_t     *retry;
+    uint32_t    *schedule_ns;    ///< Latency of each call in the phase
+    uint32_t    *cancel_ns;
+} worker_t;
+
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  wake_cond = PTHREAD_COND_INITIALIZER;
+static int64_t         wake_ns;       ///< When the timers next want a visit, 0 for never
+static bool            stopping;
+
+static int64_t        *lateness_ns;   ///< Lateness of each retry, written by the visitor
+static volatile int    retries_fired;
+
+enum { PHASE_SCHEDULE, PHASE_RESCHEDULE, PHASE_RETRY, PHASE_CANCEL };
+
+
+static uint64_t now_ns(void)
+{
+    // The timers run on CLOCK_REALTIME, see qd_timer_now
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+//
+// Stands in for the server's timeout.  Called with the timer lock held.
+//
+void qd_server_timeout(qd_server_t *server, qd_duration_t duration)
+{
+    pthread_mutex_lock(&wake_lock);
+    wake_ns = now_ns() + duration * 1000000;
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+}
+
+
+static void *visitor_run(void *context)
+{
+    pthread_mutex_lock(&wake_lock);
+    while (!stopping) {
+        if (wake_ns == 0 || (uint64_t) wake_ns > now_ns()) {
+            if (wake_ns) {
+                struct timespec ts = {wake_ns / 1000000000, wake_ns % 1000000000};
+                pthread_cond_timedwait(&wake_cond, &wake_lock, &ts);
+            } else
+                pthread_cond_wait(&wake_cond, &wake_lock);
+            continue;
+        }
+        wake_ns = 0;
+        pthread_mutex_unlock(&wake_lock);
+        qd_timer_visit();
+        pthread_mutex_lock(&wake_lock);
+    }
+    pthread_mutex_unlock(&wake_lock);
+    return 0;
+}
+
+
+static void on_idle(void *context)
+{
+}
+
+
+static void on_retry(void *context)
+{
+    retry_t *retry = (retry_t*) context;
+    lateness_ns[retries_fired++] = (int64_t) (now_ns() - retry->due_ns);
+}
+
+
+static void timed_schedule(qd_timer_t *timer, qd_duration_t msec, uint32_t *latency)
+{
+    uint64_t start = now_ns();
+    qd_timer_schedule(timer, msec);
+    *latency = (uint32_t) (now_ns() - start);
+}
+
+
+static void *worker_run(void *context)
+{
+    worker_t *w    = (worker_t*) context;
+    uint32_t  seed = w->id + 1;
+
+    switch (w->phase) {
+    case PHASE_SCHEDULE:
+    case PHASE_RESCHEDULE:
+        for (int i = 0; i < w->count; i++)
+            timed_schedule(w->idle[i], 10000 + rand_r(&seed) % 60000, &w->schedule_ns[i]);
+        break;
+
+    case PHASE_RETRY:
+        for (int i = 0; i < w->count; i++) {
+            qd_duration_t delay = rand_r(&seed) % 1000;
+            w->retry[i].due_ns = now_ns() + delay * 1000000;
+            timed_schedule(w->retry[i].timer, delay, &w->schedule_ns[i]);
+        }
+        // Traffic goes on while the retries fire
+        for (int i = 0; i < w->count && retries_fired < w->count * THREADS; i++)
+            qd_timer_schedule(w->idle[i], 10000 + rand_r(&seed) % 60000);
+        break;
+
+    case PHASE_CANCEL:
+        for (int i = 0; i < w->count; i++) {
+            uint64_t start = now_ns();
+            qd_timer_cancel(w->idle[i]);
+            w->cancel_ns[i] = (uint32_t) (now_ns() - start);
+        }
+        break;
+    }
+    return 0;
+}
+
+
+static void run_phase(worker_t *workers, int phase)
+{
+    sys_thread_t *thread[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        workers[t].phase = phase;
+        thread[t] = sys_thread(worker_run, &workers[t]);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        sys_thread_join(thread[t]);
+        sys_thread_free(thread[t]);
+    }
+}
+
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+
+static int compare_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t*) a, y = *(const int64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+
+//
+// Gather the threads' latencies for a phase and print their percentiles in nanoseconds
+//
+static void print_latency(const char *name, worker_t *workers, bool cancel, uint32_t *all)
+{
+    int n = 0;
+    for (int t = 0; t < THREADS; t++) {
+        memcpy(all + n, cancel ? workers[t].cancel_ns : workers[t].schedule_ns, workers[t].count * sizeof(uint32_t));
+        n += workers[t].count;
+    }
+    qsort(all, n, sizeof(uint32_t), compare_u32);
+    printf(", \"%s_ns\": {\"p50\": %"PRIu32", \"p99\": %"PRIu32", \"p999\": %"PRIu32", \"max\": %"PRIu32"}",
+           name, all[n / 2], all[n * 99 / 100], all[n * 999 / 1000], all[n - 1]);
+}
+
+
+static bool first_result = true;
+
+static void run(int timers)
+{
+    worker_t  workers[THREADS];
+    uint32_t *all = NEW_ARRAY(uint32_t, timers);
+    int       per_thread = timers / THREADS;
+
+    timers = per_thread * THREADS;
+    lateness_ns   = NEW_ARRAY(int64_t, timers);
+    retries_fired = 0;
+
+    for (int t = 0; t < THREADS; t++) {
+        worker_t *w = &workers[t];
+        w->id          = t;
+        w->count       = per_thread;
+        w->idle        = NEW_PTR_ARRAY(qd_timer_t, per_thread);
+        w->retry       = NEW_ARRAY(retry_t, per_thread);
+        w->schedule_ns = NEW_ARRAY(uint32_t, per_thread);
+        w->cancel_ns   = NEW_ARRAY(uint32_t, per_thread);
+        for (int i = 0; i < per_thread; i++) {
+            w->idle[i]         = qd_timer(0, on_idle, 0);
+            w->retry[i].timer  = qd_timer(0, on_retry, &w->retry[i]);
+            w->retry[i].due_ns = 0;
+        }
+    }
+
+    printf("%s\n    {\"timers\": %d, \"threads\": %d", first_result ? "" : ",", timers, THREADS);
+    first_result = false;
+
+    run_phase(workers, PHASE_SCHEDULE);
+    print_latency("schedule", workers, false, all);
+    run_phase(workers, PHASE_RESCHEDULE);
+    print_latency("reschedule", workers, false, all);
+
+    run_phase(workers, PHASE_RETRY);
+    print_latency("retry_schedule", workers, false, all);
+    uint64_t deadline = now_ns() + 30 * (uint64_t) 1000000000;
+    while (retries_fired < timers && now_ns() < deadline) {
+        struct timespec ts = {0, 10000000};
+        nanosleep(&ts, 0);
+    }
+    int fired = retries_fired;
+    if (fired) {
+        qsort(lateness_ns, fired, sizeof(int64_t), compare_i64);
+        printf(", \"retries_fired\": %d, \"retry_lateness_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}",
+               fired, lateness_ns[fired / 2] / 1000.0, lateness_ns[fired * 99 / 100] / 1000.0,
+               lateness_ns[fired * 999 / 1000] / 1000.0, lateness_ns[fired - 1] / 1000.0);
+    } else
+        printf(", \"retries_fired\": 0");
+
+    run_phase(workers, PHASE_CANCEL);
+    print_latency("cancel", workers, true, all);
+    printf("}");
+    fflush(stdout);
+
+    for (int t = 0; t < THREADS; t++) {
+        worker_t *w = &workers[t];
+        for (int i = 0; i < per_thread; i++) {
+            qd_timer_free(w->idle[i]);
+            qd_timer_free(w->retry[i].timer);
+        }
+        free(w->idle);
+        free(w->retry);
+        free(w->schedule_ns);
+        free(w->cancel_ns);
+    }
+    free(lateness_ns);
+    free(all);
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [max-timers]\n", argv[0]);
+        exit(1);
+    }
+    int max_timers = argc == 2 ? atoi(argv[1]) : 1000000;
+
+    // Initializes the allocator.  The timers run without a server, on a lock of their own.
+    qd_dispatch_t *qd   = qd_dispatch(0);
+    sys_mutex_t   *lock = sys_mutex();
+    qd_timer_initialize(lock);
+
+    sys_thread_t *visitor = sys_thread(visitor_run, 0);
+
+    printf("{\"timer_benchmarks\": [");
+    for (int timers = 10000; timers <= max_timers; timers *= 10)
+        run(timers);
+    printf("\n]}\n");
+
+    pthread_mutex_lock(&wake_lock);
+    stopping = true;
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+    sys_thread_join(visitor);
+    sys_thread_free(visitor);
+
+    qd_timer_finalize();
+    sys_mutex_free(lock);
+    qd_dispatch_free(qd);
+    return 0;
+}
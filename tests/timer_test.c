@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <limits.h>
+#include <unistd.h>
 #include <qpid/dispatch/timer.h>
 #include "dispatch_private.h"
 #include "alloc.h"
@@ -285,6 +286,94 @@ static char* test_big(void *context)
 }
 
 
+static char* test_long_delays(void *context)
+{
+    fire_mask = fired = 0;
+
+    // Delays that start on the upper levels of the timing wheel
+    qd_timer_schedule(timers[0], 300);
+    qd_timer_schedule(timers[1], 70000);
+    qd_timer_schedule(timers[2], 256);
+    if (timeout != 256) return "Incorrect timeout";
+
+    time_value += 255;
+    qd_timer_visit();
+    if (fired != 0) return "Premature firing";
+    time_value += 1;
+    qd_timer_visit();
+    if (fire_mask != 4) return "Incorrect fire mask 4";
+    time_value += 44;
+    qd_timer_visit();
+    if (fire_mask != 5) return "Incorrect fire mask 5";
+    if (timeout != 69700) return "Incorrect timeout for long delay";
+
+    time_value += 69699;
+    qd_timer_visit();
+    if (fire_mask != 5) return "Long delay fired prematurely";
+    time_value += 1;
+    qd_timer_visit();
+    if (fire_mask != 7) return "Incorrect fire mask 7";
+
+    return 0;
+}
+
+
+static qd_timer_t *victim;
+
+static void cancel_victim(void *context)
+{
+    on_timer(context);
+    qd_timer_cancel(victim);
+}
+
+
+static char* test_cancel_due(void *context)
+{
+    fire_mask = fired = 0;
+
+    // A handler cancels a timer that is due in the same visit.
+    qd_timer_t *canceller = qd_timer(0, cancel_victim, (void*) 0x00000001);
+    victim = timers[1];
+    qd_timer_schedule(canceller, 2);
+    qd_timer_schedule(victim, 2);
+    time_value += 2;
+    qd_timer_visit();
+    qd_timer_free(canceller);
+
+    if (fired != 1) return "Expected one firing";
+    if (fire_mask != 1) return "Cancelled timer fired";
+
+    return 0;
+}
+
+
+static unsigned long fired_locked(void)
+{
+    sys_mutex_lock(qd_timer_lock());
+    unsigned long count = fired;
+    sys_mutex_unlock(qd_timer_lock());
+    return count;
+}
+
+
+static char* test_thread(void *context)
+{
+    fire_mask = fired = 0;
+
+    // On the timer thread a due timer fires without a visit.
+    qd_timer_thread_start();
+    qd_timer_schedule(timers[0], 0);
+    for (int i = 0; i < 1000 && fired_locked() == 0; i++)
+        usleep(1000);
+    qd_timer_thread_stop();
+
+    if (fired != 1) return "Expected 1 firing on the timer thread";
+    if (fire_mask != 1) return "Incorrect fire mask";
+
+    return 0;
+}
+
+
 int timer_tests()
 {
     char *test_group = "timer_tests";
@@ -319,6 +408,9 @@ int timer_tests()
     TEST_CASE(test_two_duplicate, 0);
     TEST_CASE(test_separated, 0);
     TEST_CASE(test_big, 0);
+    TEST_CASE(test_long_delays, 0);
+    TEST_CASE(test_cancel_due, 0);
+    TEST_CASE(test_thread, 0);
 
     int i;
     for (i = 0; i < 16; i++)
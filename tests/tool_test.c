@@ -306,6 +306,50 @@ static char* test_bitmask(void *context)
 }
 
 
+static char* test_bitmask_ops(void *context)
+{
+    qd_bitmask_t *a = qd_bitmask(0);
+    qd_bitmask_t *b = qd_bitmask(0);
+    int           top = qd_bitmask_width() - 1;
+    int           num;
+    int           c;
+    int           count;
+
+    qd_bitmask_set_bit(a, 1);
+    qd_bitmask_set_bit(a, 63);
+    qd_bitmask_set_bit(a, 64);
+    qd_bitmask_set_bit(a, top);
+    qd_bitmask_set_bit(b, 63);
+    qd_bitmask_set_bit(b, top);
+    qd_bitmask_set_bit(b, 70);
+
+    count = 0;
+    for (QD_BITMASK_EACH(a, num, c)) {
+        int expected[] = {1, 63, 64, top};
+        if (count > 3 || num != expected[count]) return "Unexpected bit in iteration across words";
+        count++;
+    }
+    if (count != 4) return "Expected to iterate over 4 bits";
+
+    qd_bitmask_and(a, b);
+    if (qd_bitmask_cardinality(a) != 2)      return "Expected cardinality == 2 after and";
+    if (!qd_bitmask_first_set(a, &num))      return "Expected first set bit after and";
+    if (num != 63)                           return "Expected first set bit to be 63 after and";
+
+    qd_bitmask_or(a, b);
+    if (qd_bitmask_cardinality(a) != 3)      return "Expected cardinality == 3 after or";
+    if (!qd_bitmask_value(a, 70))            return "Expected bit 70 set after or";
+
+    qd_bitmask_clear_all(a);
+    qd_bitmask_and(b, a);
+    if (qd_bitmask_first_set(b, &num))       return "Expected no first set bit after and with empty";
+
+    qd_bitmask_free(a);
+    qd_bitmask_free(b);
+    return 0;
+}
+
+
 int tool_tests(void)
 {
     int result = 0;
@@ -315,6 +359,7 @@ int tool_tests(void)
     TEST_CASE(test_deq_basic2, 0);
     TEST_CASE(test_deq_multi, 0);
     TEST_CASE(test_bitmask, 0);
+    TEST_CASE(test_bitmask_ops, 0);
 
     return result;
 }